@@ -0,0 +1,354 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Resident UART bootloader, "make boot" and "make flash-boot". Layout, entry conditions and protocol: see boot.h.
+// Registers only, no HAL code, so it fits BOOT_SIZE. The clock is the HSI x8 (64 MHz) whatever crystal the board
+// has; everything the bootloader touched except the power latch is put back to its reset state before the jump.
+
+#include <stddef.h>
+#include <string.h>
+#include "defines.h"
+#include "crc32.h"
+#include "boot.h"
+
+#define BOOT_SYSCLK         64000000U   // [Hz] HSI / 2 x 16
+#define BOOT_PCLK1          (BOOT_SYSCLK / 2)
+#define BOOT_RING           4096        // [bytes] DMA receive ring, room for the frame being programmed and the next
+#define BOOT_BYTE_TMO       50          // [ms] max gap inside a frame
+#define BOOT_FRAME_MAX      (5 + 4 + BOOT_BLOCK + 4)   // cmd, seq, len, offset, data, crc
+
+#define PIN_OUT_PP          0x2         // GPIO CRL/CRH: output push-pull 2 MHz
+#define PIN_AF_PP           0xB         // alternate function push-pull 50 MHz
+#define PIN_IN_PULL         0x8         // input with pull up/down, ODR = 1 selects up
+
+typedef struct {
+  USART_TypeDef       *usart;
+  DMA_Channel_TypeDef *dma;             // Rx channel
+  GPIO_TypeDef        *gpio;
+  uint16_t             tx, rx;          // pin masks
+  uint8_t              syncCnt;
+} BootPort;
+
+static BootPort ports[2] = {
+  {USART2, DMA1_Channel6, GPIOA, GPIO_PIN_2,  GPIO_PIN_3,  0},  // left sensor cable
+  {USART3, DMA1_Channel3, GPIOB, GPIO_PIN_10, GPIO_PIN_11, 0},  // right sensor cable
+};
+
+static BootPort  *port;                 // port of the session
+static uint8_t    ring[BOOT_RING];
+static uint16_t   ringTail;
+static uint8_t    frame[BOOT_FRAME_MAX];
+static volatile uint32_t msTick;
+
+static BootHeader hdrNew;               // image announced by BEGIN
+static uint8_t    active;               // BEGIN accepted, header page erased
+static uint8_t    flashErr;             // programming of an acknowledged block failed
+static uint32_t   written;              // [bytes] image bytes received in order
+static uint32_t   erasedEnd;            // first address not erased yet
+static uint32_t   lastOff, lastLen;     // last DATA frame, a repetition is acknowledged again
+
+void SysTick_Handler(void) {
+  msTick++;
+}
+
+static uint32_t rd32(const uint8_t *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24; }
+static uint16_t rd16(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+static void pinMode(GPIO_TypeDef *gpio, uint16_t mask, uint32_t mode) {
+  uint32_t pin = __builtin_ctz(mask);
+  volatile uint32_t *cr = pin < 8 ? &gpio->CRL : &gpio->CRH;
+  uint32_t sh = (pin & 7) * 4;
+  *cr = (*cr & ~(0xFU << sh)) | (mode << sh);
+}
+
+// Keep the board powered, first thing after the reset like the application does
+static void powerLatch(void) {
+  RCC->APB2ENR |= RCC_APB2ENR_IOPAEN | RCC_APB2ENR_IOPBEN | RCC_APB2ENR_IOPCEN | RCC_APB2ENR_AFIOEN;
+  OFF_PORT->BSRR = OFF_PIN;
+  pinMode(OFF_PORT, OFF_PIN, PIN_OUT_PP);
+}
+
+static void powerOff(void) {
+  OFF_PORT->BRR = OFF_PIN;
+  while (1) {}
+}
+
+static void clockInit(void) {
+  FLASH->ACR = FLASH_ACR_PRFTBE | FLASH_ACR_LATENCY_1;          // 2 wait states above 48 MHz
+  RCC->CFGR  = RCC_CFGR_PLLMULL16 | RCC_CFGR_PPRE1_DIV2;         // PLL source HSI / 2, APB1 max 36 MHz
+  RCC->CR   |= RCC_CR_PLLON;
+  while (!(RCC->CR & RCC_CR_PLLRDY)) {}
+  RCC->CFGR |= RCC_CFGR_SW_PLL;
+  while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL) {}
+  SysTick_Config(BOOT_SYSCLK / 1000);
+}
+
+// Rx pins only: on some variants the sensor cables carry the ADC inputs, Tx is driven after the sync
+static void portsInit(void) {
+  RCC->APB1ENR |= RCC_APB1ENR_USART2EN | RCC_APB1ENR_USART3EN;
+  RCC->AHBENR  |= RCC_AHBENR_DMA1EN;
+  for (uint8_t i = 0; i < 2; i++) {
+    BootPort *p = &ports[i];
+    p->gpio->BSRR = p->rx;
+    pinMode(p->gpio, p->rx, PIN_IN_PULL);
+    p->usart->BRR = (BOOT_PCLK1 + BOOT_BAUD / 2) / BOOT_BAUD;
+    p->usart->CR1 = USART_CR1_UE | USART_CR1_RE | USART_CR1_TE;
+  }
+}
+
+// Wait for BOOT_SYNC_CNT sync bytes on either port, NULL after window ms
+static BootPort *bootSync(uint32_t window) {
+  uint32_t t0 = msTick;
+  while (msTick - t0 < window) {
+    for (uint8_t i = 0; i < 2; i++) {
+      BootPort *p = &ports[i];
+      if (p->usart->SR & (USART_SR_RXNE | USART_SR_ORE)) {   // reading DR after SR also clears an overrun
+        p->syncCnt = p->usart->DR == BOOT_SYNC ? p->syncCnt + 1 : 0;
+        if (p->syncCnt >= BOOT_SYNC_CNT) return p;
+      }
+    }
+  }
+  return NULL;
+}
+
+static void portWrite(const uint8_t *b, uint8_t n) {
+  while (n--) {
+    while (!(port->usart->SR & USART_SR_TXE)) {}
+    port->usart->DR = *b++;
+  }
+}
+
+static void portFlush(void) {
+  while (!(port->usart->SR & USART_SR_TC)) {}
+}
+
+static void portStart(void) {
+  pinMode(port->gpio, port->tx, PIN_AF_PP);
+  port->dma->CPAR  = (uint32_t)&port->usart->DR;
+  port->dma->CMAR  = (uint32_t)ring;
+  port->dma->CNDTR = BOOT_RING;
+  port->dma->CCR   = DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_EN;
+  port->usart->CR3 = USART_CR3_DMAR;
+  ringTail = 0;
+}
+
+// Next received byte, -1 after timeout ms. The DMA fills the ring also while the CPU waits for the flash
+static int16_t ringGet(uint32_t timeout) {
+  uint32_t t0 = msTick;
+  while (ringTail == BOOT_RING - port->dma->CNDTR) {
+    if (msTick - t0 >= timeout) return -1;
+  }
+  uint8_t c = ring[ringTail];
+  ringTail  = (ringTail + 1) % BOOT_RING;
+  return c;
+}
+
+static void replySync(void) {
+  const uint8_t r[2] = {BOOT_ACK, BOOT_VERSION};
+  portWrite(r, sizeof(r));
+}
+
+static void reply(uint16_t seq, uint8_t status) {
+  const uint8_t r[4] = {status == BOOT_OK ? BOOT_ACK : BOOT_NAK, (uint8_t)seq, (uint8_t)(seq >> 8), status};
+  portWrite(r, sizeof(r));
+}
+
+// Read the next frame (cmd ... crc) into frame[], 0 if nothing arrived for BOOT_IDLE ms
+static uint8_t frameRead(uint16_t *len) {
+  int16_t c;
+  while (1) {
+    if ((c = ringGet(BOOT_IDLE)) < 0) return 0;
+    if (c == BOOT_SYNC) { replySync(); continue; }              // the host syncs again
+    if (c != BOOT_SOF) continue;
+    uint16_t n = 0, total = 5;
+    while (n < total) {
+      if ((c = ringGet(BOOT_BYTE_TMO)) < 0) break;
+      frame[n++] = (uint8_t)c;
+      if (n == 5) {
+        *len  = rd16(&frame[3]);
+        total = 5 + *len + 4;
+        if (total > BOOT_FRAME_MAX) break;
+      }
+    }
+    if (n == total && n > 5) return 1;                          // else resynchronize on the next BOOT_SOF
+  }
+}
+
+static uint8_t flashWait(void) {
+  while (FLASH->SR & FLASH_SR_BSY) {}
+  uint8_t ok = !(FLASH->SR & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR));
+  FLASH->SR  = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+  return ok;
+}
+
+static uint8_t flashErase(uint32_t addr) {
+  FLASH->CR |= FLASH_CR_PER;
+  FLASH->AR  = addr;
+  FLASH->CR |= FLASH_CR_STRT;
+  uint8_t ok = flashWait();
+  FLASH->CR &= ~FLASH_CR_PER;
+  return ok;
+}
+
+// Program and verify, an odd last byte is padded with 0xFF
+static uint8_t flashWrite(uint32_t addr, const uint8_t *src, uint32_t len) {
+  uint8_t ok = 1;
+  FLASH->CR |= FLASH_CR_PG;
+  for (uint32_t i = 0; i < len && ok; i += 2) {
+    *(volatile uint16_t *)(addr + i) = src[i] | (i + 1 < len ? src[i + 1] : 0xFF) << 8;
+    ok = flashWait();
+  }
+  FLASH->CR &= ~FLASH_CR_PG;
+  return ok && memcmp((const void *)addr, src, len) == 0;
+}
+
+static uint8_t appValid(void) {
+  const BootHeader *h   = (const BootHeader *)BOOT_HDR_ADDR;
+  const uint32_t   *vec = (const uint32_t *)BOOT_APP_ADDR;
+  if (h->magic != BOOT_HDR_MAGIC || h->hdrCrc != calc_crc32((const uint8_t *)h, offsetof(BootHeader, hdrCrc))) return 0;
+  if (h->size < 8 || h->size > BOOT_APP_END - BOOT_APP_ADDR) return 0;
+  if (vec[0] <= SRAM_BASE || vec[0] > SRAM_BASE + 48 * 1024) return 0;    // initial stack pointer
+  return calc_crc32((const uint8_t *)BOOT_APP_ADDR, h->size) == h->crc;
+}
+
+static void bootJump(void) {
+  const uint32_t *vec = (const uint32_t *)BOOT_APP_ADDR;
+  SysTick->CTRL = 0;
+  SCB->ICSR     = SCB_ICSR_PENDSTCLR_Msk;
+  for (uint8_t i = 0; i < 2; i++) {
+    ports[i].usart->CR1 = 0;
+    ports[i].dma->CCR   = 0;
+  }
+  RCC->APB1RSTR = RCC_APB1RSTR_USART2RST | RCC_APB1RSTR_USART3RST;
+  RCC->APB1RSTR = 0;
+  RCC->APB1ENR &= ~(RCC_APB1ENR_USART2EN | RCC_APB1ENR_USART3EN);
+  RCC->AHBENR  &= ~RCC_AHBENR_DMA1EN;
+  RCC->CFGR    &= ~RCC_CFGR_SW;                                 // back to the HSI, SystemClock_Config needs the PLL off
+  while (RCC->CFGR & RCC_CFGR_SWS) {}
+  RCC->CR      &= ~RCC_CR_PLLON;
+  RCC->CFGR     = 0;
+  FLASH->ACR    = FLASH_ACR_PRFTBE;
+  SCB->VTOR     = BOOT_APP_ADDR;
+  __set_MSP(vec[0]);
+  ((void (*)(void))vec[1])();
+}
+
+static uint8_t cmdBegin(uint16_t len) {
+  if (len != 12) return BOOT_ERR_SIZE;
+  hdrNew.magic   = BOOT_HDR_MAGIC;
+  hdrNew.size    = rd32(&frame[5]);
+  hdrNew.crc     = rd32(&frame[9]);
+  hdrNew.version = rd32(&frame[13]);
+  hdrNew.hdrCrc  = calc_crc32((const uint8_t *)&hdrNew, offsetof(BootHeader, hdrCrc));
+  if (hdrNew.size == 0 || hdrNew.size > BOOT_APP_END - BOOT_APP_ADDR) return BOOT_ERR_SIZE;
+  active    = 0;
+  flashErr  = 0;
+  written   = 0;
+  erasedEnd = BOOT_APP_ADDR;
+  lastLen   = 0;
+  if (!flashErase(BOOT_HDR_ADDR)) return BOOT_ERR_FLASH;        // from here on the old image does not start
+  active    = 1;
+  return BOOT_OK;
+}
+
+// Checks a DATA frame. *prog is set if the block has to be programmed after the reply
+static uint8_t cmdData(uint16_t len, uint8_t *prog) {
+  uint32_t off = rd32(&frame[5]);
+  uint32_t n   = len - 4;
+  *prog = 0;
+  if (!active) return BOOT_ERR_ORDER;
+  if (flashErr) return BOOT_ERR_FLASH;
+  if (len <= 4 || n > BOOT_BLOCK) return BOOT_ERR_SIZE;
+  if (lastLen && off == lastOff && n == lastLen && written == off + n) return BOOT_OK;    // ACK was lost
+  if (off != written) return BOOT_ERR_ORDER;
+  if (off + n > hdrNew.size) return BOOT_ERR_SIZE;
+  lastOff = off;
+  lastLen = n;
+  written = off + n;
+  *prog   = 1;
+  return BOOT_OK;
+}
+
+// Runs after the ACK, while the DMA already receives the next frame
+static void dataProgram(void) {
+  uint32_t addr = BOOT_APP_ADDR + lastOff;
+  while (erasedEnd < addr + lastLen && !flashErr) {
+    flashErr  = !flashErase(erasedEnd);
+    erasedEnd += BOOT_PAGE;
+  }
+  if (!flashErr) flashErr = !flashWrite(addr, &frame[9], lastLen);
+}
+
+static uint8_t cmdEnd(void) {
+  if (!active || written != hdrNew.size) return BOOT_ERR_ORDER;
+  if (flashErr) return BOOT_ERR_FLASH;
+  if (calc_crc32((const uint8_t *)BOOT_APP_ADDR, hdrNew.size) != hdrNew.crc) return BOOT_ERR_VERIFY;
+  if (!flashWrite(BOOT_HDR_ADDR, (const uint8_t *)&hdrNew, sizeof(hdrNew))) return BOOT_ERR_FLASH;
+  active = 0;
+  return appValid() ? BOOT_OK : BOOT_ERR_VERIFY;
+}
+
+// Frames until RESET or BOOT_IDLE ms without one
+static void bootSession(void) {
+  uint16_t len;
+  uint8_t  status, prog;
+  portStart();
+  replySync();
+  FLASH->KEYR = FLASH_KEY1;
+  FLASH->KEYR = FLASH_KEY2;
+  while (frameRead(&len)) {
+    prog = 0;
+    if (rd32(&frame[5 + len]) != calc_crc32(frame, 5 + len)) {
+      status = BOOT_ERR_CRC;
+    } else {
+      switch (frame[0]) {
+        case BOOT_CMD_BEGIN: status = cmdBegin(len);        break;
+        case BOOT_CMD_DATA:  status = cmdData(len, &prog);  break;
+        case BOOT_CMD_END:   status = cmdEnd();             break;
+        case BOOT_CMD_RESET: status = BOOT_OK;              break;
+        default:             status = BOOT_ERR_CMD;         break;
+      }
+    }
+    reply(rd16(&frame[1]), status);
+    if (prog) dataProgram();
+    if (frame[0] == BOOT_CMD_RESET && status == BOOT_OK) break;
+  }
+  FLASH->CR |= FLASH_CR_LOCK;
+  portFlush();
+}
+
+int main(void) {
+  uint8_t req, valid;
+
+  powerLatch();
+  clockInit();
+  RCC->APB1ENR |= RCC_APB1ENR_PWREN | RCC_APB1ENR_BKPEN;
+  req = BKP->DR1 == BOOT_REQ_MAGIC;
+  if (req) {
+    PWR->CR |= PWR_CR_DBP;
+    BKP->DR1 = 0;
+  }
+  valid = appValid();
+  if (valid && !req && BOOT_WAIT == 0) bootJump();
+
+  portsInit();
+  port = bootSync(valid && !req ? BOOT_WAIT : BOOT_IDLE);
+  if (port) bootSession();
+  if (appValid()) bootJump();
+  powerOff();                           // no application and nobody updating it
+  return 0;
+}
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+# This file is part of the hoverboard-firmware-hack project.
+#
+# Firmware update over a sensor cable through the UART bootloader (Inc/boot.h). Needs pyserial.
+#
+#   python3 Boot/upload.py /dev/ttyUSB0 build/hover.bin                 power the board on while this waits
+#   python3 Boot/upload.py /dev/ttyUSB0 build/hover.bin --boot-cmd      running application with DEBUG_SERIAL_PROTOCOL
+#
+# The image is the .bin of "make BOOTLOADER=1". Every DATA frame is acknowledged before the bootloader programs it,
+# so sending the next frame overlaps with the flash programming of the previous one.
+
+import argparse
+import struct
+import sys
+import time
+
+import serial
+
+BOOT_BAUD      = 460800
+BOOT_BLOCK     = 1024
+BOOT_SYNC      = 0x7F
+BOOT_SOF       = 0xB5
+BOOT_ACK       = 0x79
+BOOT_NAK       = 0x1F
+CMD_BEGIN, CMD_DATA, CMD_END, CMD_RESET = 1, 2, 3, 4
+STATUS = ["OK", "CRC", "CMD", "SIZE", "ORDER", "FLASH", "VERIFY"]
+RETRIES        = 5
+
+
+def crc32c_table():
+    table = []
+    for i in range(256):
+        c = i
+        for _ in range(8):
+            c = (c >> 1) ^ 0x82F63B78 if c & 1 else c >> 1
+        table.append(c)
+    return table
+
+
+CRC_TAB = crc32c_table()
+
+
+def calc_crc32(data):
+    """calc_crc32 of crc32.c: CRC32C, init 1, no final xor"""
+    crc = 1
+    for b in data:
+        crc = CRC_TAB[(crc ^ b) & 0xFF] ^ (crc >> 8)
+    return crc
+
+
+class BootError(Exception):
+    pass
+
+
+def sync(port, timeout):
+    port.reset_input_buffer()
+    end = time.time() + timeout
+    while time.time() < end:
+        port.write(bytes([BOOT_SYNC] * 4))
+        r = port.read(2)
+        if len(r) == 2 and r[0] == BOOT_ACK:
+            time.sleep(0.05)            # sync bytes still in flight are answered too
+            port.reset_input_buffer()
+            return r[1]
+    raise BootError("no answer from the bootloader")
+
+
+def command(port, cmd, seq, payload=b"", timeout=2.0):
+    body = struct.pack("<BHH", cmd, seq, len(payload)) + payload
+    frame = bytes([BOOT_SOF]) + body + struct.pack("<I", calc_crc32(body))
+    for _ in range(RETRIES):
+        port.write(frame)
+        port.timeout = timeout
+        r = port.read(4)
+        if len(r) < 4:
+            continue                    # frame or reply lost, the bootloader acknowledges a repetition again
+        rseq, status = struct.unpack("<HB", r[1:])
+        if rseq != seq:
+            port.reset_input_buffer()
+            continue
+        if r[0] == BOOT_ACK:
+            return
+        if r[0] == BOOT_NAK and STATUS[status] != "CRC":
+            raise BootError("command %d seq %d: %s" % (cmd, seq, STATUS[status] if status < len(STATUS) else status))
+    raise BootError("command %d seq %d: no reply" % (cmd, seq))
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Hoverboard UART bootloader upload")
+    ap.add_argument("port")
+    ap.add_argument("image")
+    ap.add_argument("--baud", type=int, default=BOOT_BAUD, help="BOOT_BAUD of boot.h")
+    ap.add_argument("--version", type=lambda v: int(v, 0), default=0, help="image version stored in the header")
+    ap.add_argument("--boot-cmd", action="store_true", help="send $BOOT to the application first")
+    ap.add_argument("--app-baud", type=int, default=115200, help="debug USART baud rate of the application")
+    ap.add_argument("--wait", type=float, default=30.0, help="[s] time to wait for the bootloader")
+    args = ap.parse_args()
+
+    image = open(args.image, "rb").read()
+    if args.boot_cmd:
+        with serial.Serial(args.port, args.app_baud, timeout=0.5) as app:
+            app.write(b"$BOOT\r\n")
+            print(app.readline().decode(errors="replace").strip())
+
+    t0 = time.time()
+    with serial.Serial(args.port, args.baud, timeout=0.02) as port:
+        version = sync(port, args.wait)
+        print("bootloader protocol %d" % version)
+        t0 = time.time()
+        command(port, CMD_BEGIN, 0, struct.pack("<III", len(image), calc_crc32(image), args.version), timeout=5.0)
+        seq = 1
+        for off in range(0, len(image), BOOT_BLOCK):
+            command(port, CMD_DATA, seq, struct.pack("<I", off) + image[off:off + BOOT_BLOCK])
+            seq = (seq + 1) & 0xFFFF
+            sys.stdout.write("\r%3d %%" % (100 * min(off + BOOT_BLOCK, len(image)) // len(image)))
+            sys.stdout.flush()
+        command(port, CMD_END, seq, timeout=5.0)
+        command(port, CMD_RESET, (seq + 1) & 0xFFFF)
+    print("\r%d bytes in %.1f s" % (len(image), time.time() - t0))
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except BootError as e:
+        sys.exit("error: %s" % e)
@@ -0,0 +1,854 @@
+// *******************************************************************
+//  Host client library for the hoverboard serial protocols
+// *******************************************************************
+// See hoverclient.h. POSIX: termios for the ports, poll() for the event loop.
+#include "hoverclient.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
+
+namespace hover {
+
+// ########################## CRC ##########################
+
+static uint32_t crcTab[256];
+
+static void crcInit()
+{
+  if (crcTab[1]) return;
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+    crcTab[i] = c;
+  }
+}
+
+uint32_t crc32c(const uint8_t *data, size_t len)
+{
+  uint32_t crc = 1;
+  crcInit();
+  while (len--) crc = crcTab[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+uint32_t crc32Stm(const uint8_t *data, size_t len)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i += 4) {
+    uint32_t word = 0;
+    for (size_t k = 0; k < 4 && i + k < len; k++) word |= (uint32_t)data[i + k] << (8 * k);
+    crc ^= word;
+    for (int b = 0; b < 32; b++) crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+  }
+  return crc;
+}
+
+uint16_t crc16(const uint8_t *data, size_t len)
+{
+  uint16_t crc = 0xFFFF;
+  while (len--) {
+    crc ^= (uint16_t)(*data++ << 8);
+    for (int b = 0; b < 8; b++) crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+  return crc;
+}
+
+static inline uint16_t rd16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static inline uint32_t rd32(const uint8_t *p) { return (uint32_t)rd16(p) | ((uint32_t)rd16(p + 2) << 16); }
+
+static void put32(std::vector<uint8_t> &v, uint32_t x)
+{
+  for (int i = 0; i < 4; i++) v.push_back((uint8_t)(x >> (8 * i)));
+}
+
+// ########################## FRAMES ##########################
+
+// type (low byte of the start frame), the bytes between start frame and checksum, CRC-16, COBS encoded, delimiter
+std::vector<uint8_t> cobsFrame(const void *frame, size_t len)
+{
+  const uint8_t *f = (const uint8_t *)frame;
+  std::vector<uint8_t> msg(f + 1, f + len - 4);
+  msg[0] = f[0];
+  uint16_t crc = crc16(msg.data(), msg.size());
+  msg.push_back((uint8_t)crc);
+  msg.push_back((uint8_t)(crc >> 8));
+
+  std::vector<uint8_t> out(1);
+  size_t code = 0;
+  for (size_t i = 0; i < msg.size(); i++) {
+    if (msg[i]) out.push_back(msg[i]);
+    if (!msg[i] || out.size() - code == 0xFF) {
+      out[code] = (uint8_t)(out.size() - code);
+      code = out.size();
+      out.push_back(0);
+    }
+  }
+  out[code] = (uint8_t)(out.size() - code);
+  out.push_back(PROTO_COBS_DELIM);
+  return out;
+}
+
+ProtoCommand packCommand(int16_t steer, int16_t speed, uint16_t seq, uint8_t caps, uint16_t fbEcho, bool hwCrc, uint32_t syncTime)
+{
+  ProtoCommand c;
+  c.start   = hwCrc ? PROTO_START_FRAME_HWCRC : PROTO_START_FRAME;
+  c.version = PROTO_VERSION;
+  c.caps    = caps | (hwCrc ? PROTO_CAP_HW_CRC : 0);
+  c.steer   = steer;
+  c.speed   = speed;
+  c.seq     = seq;
+  c.fbEcho  = fbEcho;
+  c.syncTime = syncTime;
+  uint32_t crc = hwCrc ? crc32Stm((const uint8_t *)&c, offsetof(ProtoCommand, checksumL))
+                       : crc32c((const uint8_t *)&c, offsetof(ProtoCommand, checksumL));
+  c.checksumL = (uint16_t)crc;
+  c.checksumH = (uint16_t)(crc >> 16);
+  return c;
+}
+
+ProtoCommandExt packCommandExt(const ProtoCommandExt &x, int16_t steer, int16_t speed, uint16_t seq, uint8_t caps,
+                               uint16_t fbEcho, uint32_t syncTime)
+{
+  ProtoCommandExt c = x;
+  c.start    = PROTO_START_FRAME_EXT;
+  c.version  = PROTO_VERSION;
+  c.caps     = caps;
+  c.steer    = steer;
+  c.speed    = speed;
+  c.seq      = seq;
+  c.fbEcho   = fbEcho;
+  c.syncTime = syncTime;
+  c.reserved = 0;
+  uint32_t crc = crc32c((const uint8_t *)&c, offsetof(ProtoCommandExt, checksumL));
+  c.checksumL = (uint16_t)crc;
+  c.checksumH = (uint16_t)(crc >> 16);
+  return c;
+}
+
+ProtoBusCommand packBusCommand(const std::vector<std::pair<int16_t, int16_t> > &targets, uint8_t poll, uint16_t seq,
+                               uint8_t caps, uint16_t fbEcho, uint32_t syncTime)
+{
+  ProtoBusCommand c;
+  memset(&c, 0, sizeof(c));
+  c.start   = PROTO_START_FRAME_BUS;
+  c.version = PROTO_VERSION;
+  c.caps    = caps;
+  c.poll    = poll;
+  c.seq     = seq;
+  c.fbEcho  = fbEcho;
+  c.syncTime = syncTime;
+  for (size_t i = 0; i < targets.size() && i < PROTO_BUS_MAX; i++) {
+    c.target[i].steer = targets[i].first;
+    c.target[i].speed = targets[i].second;
+  }
+  uint32_t crc = crc32c((const uint8_t *)&c, offsetof(ProtoBusCommand, checksumL));
+  c.checksumL = (uint16_t)crc;
+  c.checksumH = (uint16_t)(crc >> 16);
+  return c;
+}
+
+static std::vector<uint8_t> binHeader(uint8_t op, size_t n)
+{
+  std::vector<uint8_t> f;
+  f.push_back((uint8_t)BIN_START_FRAME);
+  f.push_back((uint8_t)(BIN_START_FRAME >> 8));
+  f.push_back(op);
+  f.push_back((uint8_t)n);
+  return f;
+}
+
+std::vector<uint8_t> packGet(const std::vector<uint8_t> &index)
+{
+  std::vector<uint8_t> f = binHeader(BIN_OP_GET, index.size());
+  f.insert(f.end(), index.begin(), index.end());
+  put32(f, crc32c(f.data(), f.size()));
+  return f;
+}
+
+std::vector<uint8_t> packSet(const std::vector<std::pair<uint8_t, int32_t> > &items)
+{
+  std::vector<uint8_t> f = binHeader(BIN_OP_SET, items.size());
+  for (size_t i = 0; i < items.size(); i++) {
+    f.push_back(items[i].first);
+    put32(f, (uint32_t)items[i].second);
+  }
+  put32(f, crc32c(f.data(), f.size()));
+  return f;
+}
+
+// ########################## DECODER ##########################
+
+Decoder::Decoder() : pos(0), seqValid(false), seqNext(0), cobs(false)
+{
+  memset(&st, 0, sizeof(st));
+  memset(&compact, 0, sizeof(compact));
+}
+
+void Decoder::setStreamLayout(const std::vector<uint8_t> &sizes)
+{
+  layout   = sizes;
+  seqValid = false;
+}
+
+static bool isStart(uint8_t c)
+{
+  return c == (uint8_t)PROTO_START_FRAME || c == (uint8_t)PROTO_START_FRAME_HWCRC ||
+         c == (uint8_t)PROTO_START_FRAME_COMPACT || c == (uint8_t)PROTO_START_FRAME_COMPACT_HWCRC ||
+         c == (uint8_t)PROTO_START_FRAME_TRIP ||
+         c == (uint8_t)STREAM_START_FRAME || c == (uint8_t)BIN_START_FRAME;
+}
+
+// End of a COBS frame: decoded and checked, then queued in rx in the start frame form with its CRC32C
+void Decoder::cobsEnd()
+{
+  std::vector<uint8_t> msg;
+  size_t i = 0;
+  while (i < cobsRx.size()) {
+    uint8_t code = cobsRx[i++];
+    if (i + code - 1 > cobsRx.size()) break;
+    msg.insert(msg.end(), cobsRx.begin() + i, cobsRx.begin() + i + code - 1);
+    i += code - 1;
+    if (code != 0xFF && i < cobsRx.size()) msg.push_back(0);
+  }
+  if (i != cobsRx.size() || msg.size() < 3 ||
+      crc16(msg.data(), msg.size() - 2) != rd16(&msg[msg.size() - 2])) {
+    st.crcErrors++;
+    return;
+  }
+  std::vector<uint8_t> f(1, msg[0]);
+  f.insert(f.end(), msg.begin(), msg.end() - 2);
+  put32(f, crc32c(f.data(), f.size()));
+  rx.insert(rx.end(), f.begin(), f.end());
+}
+
+void Decoder::feed(const uint8_t *data, size_t len)
+{
+  if (cobs) {
+    for (size_t i = 0; i < len; i++) {
+      if (data[i] != PROTO_COBS_DELIM) {
+        if (cobsRx.size() >= 1024) {    // far longer than any frame: not a COBS stream, drop until the next delimiter
+          st.skipped += cobsRx.size();
+          cobsRx.clear();
+        }
+        cobsRx.push_back(data[i]);
+        continue;
+      }
+      if (!cobsRx.empty()) cobsEnd();
+      cobsRx.clear();
+    }
+  } else {
+    rx.insert(rx.end(), data, data + len);
+  }
+  while (pos < rx.size()) {
+    uint8_t c = rx[pos];
+    if (isStart(c)) {
+      if (rx.size() - pos < 2) break;
+      if (rx[pos + 1] == c) {
+        Result r;
+        if (c == (uint8_t)STREAM_START_FRAME)   r = tryStream();
+        else if (c == (uint8_t)BIN_START_FRAME) r = tryBin();
+        else if (c == (uint8_t)PROTO_START_FRAME_COMPACT || c == (uint8_t)PROTO_START_FRAME_COMPACT_HWCRC)
+          r = tryFeedbackCompact();
+        else if (c == (uint8_t)PROTO_START_FRAME_TRIP) r = tryTrip();
+        else                                    r = tryFeedback();
+        if (r == NEED_MORE) break;
+        if (r == DONE) continue;
+        // Not a frame: part of a text line ("zz" is valid text) or garbage
+        if (line.empty()) {
+          st.skipped++;
+          pos++;
+          continue;
+        }
+      }
+    }
+    textByte(c);
+    pos++;
+  }
+  rx.erase(rx.begin(), rx.begin() + pos);
+  pos = 0;
+}
+
+Decoder::Result Decoder::tryFeedback()
+{
+  const size_t size = sizeof(ProtoFeedback);
+  if (rx.size() - pos < size) return NEED_MORE;
+  const uint8_t *f = &rx[pos];
+  uint32_t crc = rd16(f) == PROTO_START_FRAME_HWCRC ? crc32Stm(f, offsetof(ProtoFeedback, checksumL))
+                                                    : crc32c(f, offsetof(ProtoFeedback, checksumL));
+  if (crc != rd32(f + offsetof(ProtoFeedback, checksumL))) {
+    st.crcErrors++;
+    return BAD;
+  }
+  pos += size;
+  if (f[offsetof(ProtoFeedback, version)] != PROTO_VERSION) {
+    st.versionErrors++;
+    return DONE;
+  }
+  ProtoFeedback fb;
+  memcpy(&fb, f, size);
+  st.feedback++;
+  if (onFeedback) onFeedback(fb);
+  return DONE;
+}
+
+// Expanded to a ProtoFeedback, the slow fields not in the frame keep their last value
+Decoder::Result Decoder::tryFeedbackCompact()
+{
+  const size_t head = sizeof(ProtoFeedbackCompact);
+  if (rx.size() - pos < head) return NEED_MORE;
+  const uint8_t *f = &rx[pos];
+  uint8_t fields = f[offsetof(ProtoFeedbackCompact, fields)];
+  if (fields >> PROTO_FB_SLOW_N) return BAD;
+  size_t n = 0;
+  for (int i = 0; i < PROTO_FB_SLOW_N; i++) n += (fields >> i) & 1;
+  const size_t size = head + 2 * n + 4;
+  if (rx.size() - pos < size) return NEED_MORE;
+  f = &rx[pos];
+  uint32_t crc = rd16(f) == PROTO_START_FRAME_COMPACT_HWCRC ? crc32Stm(f, size - 4) : crc32c(f, size - 4);
+  if (crc != rd32(f + size - 4)) {
+    st.crcErrors++;
+    return BAD;
+  }
+  pos += size;
+  if (f[offsetof(ProtoFeedbackCompact, version)] != PROTO_VERSION) {
+    st.versionErrors++;
+    return DONE;
+  }
+  ProtoFeedbackCompact c;
+  memcpy(&c, f, head);
+  static const size_t slow[PROTO_FB_SLOW_N] = {offsetof(ProtoFeedback, batVoltage), offsetof(ProtoFeedback, boardTemp),
+                                               offsetof(ProtoFeedback, batSoc), offsetof(ProtoFeedback, regenWh),
+                                               offsetof(ProtoFeedback, isrCycMean), offsetof(ProtoFeedback, isrCycMax),
+                                               offsetof(ProtoFeedback, cmdLed), offsetof(ProtoFeedback, cpuLoad)};
+  const uint8_t *p = f + head;
+  for (int i = 0; i < PROTO_FB_SLOW_N; i++) {
+    if (fields & (1 << i)) {
+      memcpy((uint8_t *)&compact + slow[i], p, 2);
+      p += 2;
+    }
+  }
+  compact.start       = c.start;
+  compact.version     = c.version;
+  compact.caps        = c.caps;
+  compact.odo0        = c.odo0;
+  compact.odo1        = c.odo1;
+  compact.odoTime     = c.odoTime;
+  compact.edgeAge0    = c.edgeAge0;
+  compact.edgeAge1    = c.edgeAge1;
+  compact.speedR_meas = c.speedR_meas;
+  compact.speedL_meas = c.speedL_meas;
+  compact.cmdSeq      = c.cmdSeq;
+  compact.cmdAge      = c.cmdAge;
+  compact.fbTime      = c.fbTime;
+  compact.syncTime    = c.syncTime;
+  st.feedback++;
+  if (onFeedback) onFeedback(compact);
+  return DONE;
+}
+
+Decoder::Result Decoder::tryTrip()
+{
+  const size_t size = sizeof(ProtoTrip);
+  if (rx.size() - pos < size) return NEED_MORE;
+  const uint8_t *f = &rx[pos];
+  if (crc32c(f, offsetof(ProtoTrip, checksumL)) != rd32(f + offsetof(ProtoTrip, checksumL))) {
+    st.crcErrors++;
+    return BAD;
+  }
+  pos += size;
+  if (f[offsetof(ProtoTrip, version)] != PROTO_VERSION) {
+    st.versionErrors++;
+    return DONE;
+  }
+  ProtoTrip t;
+  memcpy(&t, f, size);
+  st.trip++;
+  if (onTrip) onTrip(t);
+  return DONE;
+}
+
+Decoder::Result Decoder::tryStream()
+{
+  if (rx.size() - pos < 4) return NEED_MORE;
+  uint8_t n = rx[pos + 2], len = rx[pos + 3];
+  if (n > STREAM_MAX || len < n || len > 4 * n) return BAD;
+  size_t size = 10 + len + 4;
+  if (rx.size() - pos < size) return NEED_MORE;
+  const uint8_t *f = &rx[pos];
+  if (crc32c(f, size - 4) != rd32(f + size - 4)) {
+    st.crcErrors++;
+    return BAD;
+  }
+  pos += size;
+
+  StreamFrame s;
+  s.seq  = rd16(f + 4);
+  s.time = rd32(f + 6);
+  s.lost = seqValid ? (uint16_t)(s.seq - seqNext) : 0;
+  seqNext  = s.seq + 1;
+  seqValid = true;
+  st.streamLost += s.lost;
+  size_t total = 0;
+  for (size_t i = 0; i < layout.size(); i++) total += layout[i];
+  if (layout.size() == n && total == len) {
+    const uint8_t *v = f + 10;
+    for (size_t i = 0; i < n; i++) {
+      switch (layout[i]) {
+        case 4:  s.values.push_back((int32_t)rd32(v)); break;
+        case 2:  s.values.push_back((int16_t)rd16(v)); break;
+        default: s.values.push_back((int8_t)v[0]);     break;
+      }
+      v += layout[i];
+    }
+  }
+  st.stream++;
+  if (onStream) onStream(s);
+  return DONE;
+}
+
+Decoder::Result Decoder::tryBin()
+{
+  if (rx.size() - pos < 4) return NEED_MORE;
+  uint8_t op = rx[pos + 2], n = rx[pos + 3];
+  uint8_t base = op & ~(BIN_OP_REPLY | BIN_OP_ERROR);
+  if (!(op & BIN_OP_REPLY) || (base != BIN_OP_GET && base != BIN_OP_SET) || n > 48) return BAD;
+  size_t payload = (op & BIN_OP_ERROR) ? 0 : (base == BIN_OP_GET ? 4 * n : n);
+  size_t size = 4 + payload + 4;
+  if (rx.size() - pos < size) return NEED_MORE;
+  const uint8_t *f = &rx[pos];
+  if (crc32c(f, size - 4) != rd32(f + size - 4)) {
+    st.crcErrors++;
+    return BAD;
+  }
+  pos += size;
+
+  BinReply r;
+  r.op    = base;
+  r.error = (op & BIN_OP_ERROR) != 0;
+  for (size_t i = 0; i < payload; i += (base == BIN_OP_GET ? 4 : 1)) {
+    r.values.push_back(base == BIN_OP_GET ? (int32_t)rd32(f + 4 + i) : f[4 + i]);
+  }
+  st.bin++;
+  if (onBin) onBin(r);
+  return DONE;
+}
+
+void Decoder::textByte(uint8_t c)
+{
+  if (c == '\n' || c == '\r') {
+    if (!line.empty()) {
+      st.lines++;
+      if (line.compare(0, 8, "# stream") == 0) streamLine(line);
+      if (onLine) onLine(line);
+      line.clear();
+    }
+  } else if (line.size() < 1024) {
+    line.push_back((char)c);
+  }
+}
+
+// "# stream NAME:size NAME:size ..." printed by $STREAM
+void Decoder::streamLine(const std::string &l)
+{
+  std::istringstream in(l.substr(8));
+  std::string item;
+  std::vector<uint8_t> sizes;
+  names.clear();
+  while (in >> item) {
+    size_t colon = item.rfind(':');
+    if (colon == std::string::npos) return;         // not the layout line
+    names.push_back(item.substr(0, colon));
+    sizes.push_back((uint8_t)atoi(item.c_str() + colon + 1));
+  }
+  setStreamLayout(sizes);
+}
+
+// ########################## PORT ##########################
+
+static speed_t baudConst(uint32_t baud)
+{
+  switch (baud) {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+#ifdef B460800
+    case 460800:  return B460800;
+#endif
+#ifdef B921600
+    case 921600:  return B921600;
+#endif
+    default:      return 0;
+  }
+}
+
+Port::Port(const std::string &d, uint32_t baud) : dev(d), fd(-1)
+{
+  speed_t speed = baudConst(baud);
+  if (!speed) {
+    errno = EINVAL;
+    return;
+  }
+  fd = ::open(dev.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0) return;
+  struct termios t;
+  if (tcgetattr(fd, &t) == 0) {
+    cfmakeraw(&t);
+    t.c_cflag |= CLOCAL | CREAD;
+    t.c_cflag &= ~(CSTOPB | CRTSCTS);
+    t.c_cc[VMIN]  = 0;
+    t.c_cc[VTIME] = 0;
+    cfsetispeed(&t, speed);
+    cfsetospeed(&t, speed);
+  }
+  if (tcsetattr(fd, TCSANOW, &t) != 0) {
+    int err = errno;
+    ::close(fd);
+    fd = -1;
+    errno = err;
+    return;
+  }
+  tcflush(fd, TCIOFLUSH);
+}
+
+Port::~Port()
+{
+  if (fd >= 0) ::close(fd);
+}
+
+void Port::write(const uint8_t *data, size_t len)
+{
+  tx.insert(tx.end(), data, data + len);
+}
+
+bool Port::flush()
+{
+  while (!tx.empty()) {
+    ssize_t n = ::write(fd, tx.data(), tx.size());
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    tx.erase(tx.begin(), tx.begin() + n);
+  }
+  return true;
+}
+
+void Port::read()
+{
+  uint8_t buf[512];
+  ssize_t n;
+  while ((n = ::read(fd, buf, sizeof(buf))) > 0) dec.feed(buf, (size_t)n);
+}
+
+// ########################## BOARD ##########################
+
+Board::Board(Loop &l, Port &c, Port *d, int id) :
+  loop(l), ctrl(c), debug(d), busId(id), cmdSteer(0), cmdSpeed(0), posMode(false), posL(0), posR(0), seq(0), hwCrc(false), echo(false),
+  fbCompact(false), cobs(false), tripReq(false), fbValid(false), fbCount(0), rtt(-1)
+{
+  memset(&fb, 0, sizeof(fb));
+  memset(&tripStats, 0, sizeof(tripStats));
+  memset(&ext, 0, sizeof(ext));
+  odo[0] = odo[1] = 0;
+}
+
+void Board::sendCommand(uint8_t caps)
+{
+  int16_t steer = cmdSteer, speed = cmdSpeed;
+  if (echo && fbValid) caps |= PROTO_CMD_ECHO;
+  if (fbCompact) caps |= PROTO_CMD_FB_COMPACT;
+  if (tripReq) caps |= PROTO_CMD_TRIP;
+  tripReq = false;
+  if (posMode) {                        // low 16 bits of the target in the odo0 / odo1 frame of the board
+    steer = fbValid ? (int16_t)(fb.odo0 + (uint16_t)(posL - odo[0])) : 0;
+    speed = fbValid ? (int16_t)(fb.odo1 + (uint16_t)(posR - odo[1])) : 0;
+    caps |= fbValid ? PROTO_CMD_POS : 0;
+  }
+  Clock::time_point now = Clock::now();
+  if (ext.ext) {
+    ProtoCommandExt c = packCommandExt(ext, steer, speed, seq, caps, fb.fbTime, loop.syncTime(now));
+    write(&c, sizeof(c));
+  } else {
+    ProtoCommand c = packCommand(steer, speed, seq, caps, fb.fbTime, hwCrc && !cobs, loop.syncTime(now));
+    write(&c, sizeof(c));
+  }
+  sendTime[seq % 64] = now;
+  seq++;
+}
+
+void Board::write(const void *frame, size_t len)
+{
+  if (cobs) {
+    std::vector<uint8_t> f = cobsFrame(frame, len);
+    ctrl.write(f.data(), f.size());
+  } else {
+    ctrl.write((const uint8_t *)frame, len);
+  }
+}
+
+void Board::handleFeedback(const ProtoFeedback &f)
+{
+  Clock::time_point now = Clock::now();
+  if (fbValid) {
+    odo[0] += (int16_t)(f.odo0 - fb.odo0);
+    odo[1] += (int16_t)(f.odo1 - fb.odo1);
+  }
+  uint16_t age = (uint16_t)(seq - f.cmdSeq);
+  if (age >= 1 && age <= 64 && sendTime[f.cmdSeq % 64] != Clock::time_point()) {
+    rtt = (int32_t)std::chrono::duration_cast<std::chrono::milliseconds>(now - sendTime[f.cmdSeq % 64]).count() - f.cmdAge;
+  }
+  fb      = f;
+  fbValid = true;
+  fbTime  = now;
+  fbCount++;
+  if (onFeedback) onFeedback(f);
+}
+
+void Board::handleTrip(const ProtoTrip &t)
+{
+  tripStats = t;
+  if (onTrip) onTrip(t);
+}
+
+void Board::get(const std::vector<uint8_t> &index, Result cb)
+{
+  if (!debug || index.empty() || index.size() > BIN_MAX_ITEMS) {
+    if (cb) cb(false, std::vector<int32_t>());
+    return;
+  }
+  Request r;
+  r.frame = packGet(index);
+  r.cb    = cb;
+  waiting.push_back(r);
+  pumpRequests(Clock::now());
+}
+
+void Board::set(const std::vector<std::pair<uint8_t, int32_t> > &items, Result cb)
+{
+  if (!debug || items.empty() || items.size() > BIN_MAX_ITEMS) {
+    if (cb) cb(false, std::vector<int32_t>());
+    return;
+  }
+  Request r;
+  r.frame = packSet(items);
+  r.cb    = cb;
+  waiting.push_back(r);
+  pumpRequests(Clock::now());
+}
+
+void Board::text(const std::string &cmd)
+{
+  if (debug) debug->write("$" + cmd + "\r\n");
+}
+
+// Replies carry no id: they are matched in order, a reply whose op or count does not fit the oldest request is
+// a late one of a request that already timed out and is dropped
+void Board::handleBin(const BinReply &r)
+{
+  if (inFlight.empty()) return;
+  const Request &q = inFlight.front();
+  if (r.op != q.frame[2] || (!r.error && r.values.size() != q.frame[3])) return;
+  Result cb = q.cb;
+  inFlight.pop_front();
+  bool ok = !r.error;
+  if (r.op == BIN_OP_SET) {
+    for (size_t i = 0; i < r.values.size(); i++) ok = ok && r.values[i];
+  }
+  if (cb) cb(ok, r.values);
+  pumpRequests(Clock::now());
+}
+
+void Board::pumpRequests(Clock::time_point now)
+{
+  while (!inFlight.empty() && now - inFlight.front().sent > std::chrono::milliseconds(loop.replyTimeout)) {
+    Result cb = inFlight.front().cb;
+    inFlight.pop_front();
+    if (cb) cb(false, std::vector<int32_t>());
+  }
+  while (inFlight.size() < BIN_QUEUE && !waiting.empty()) {
+    Request r = waiting.front();
+    waiting.pop_front();
+    r.sent = now;
+    debug->write(r.frame.data(), r.frame.size());
+    inFlight.push_back(r);
+  }
+}
+
+// ########################## LOOP ##########################
+
+Loop::Loop() : cmdPeriod(0), cmdLatch(false), replyTimeout(200), running(false), epoch(Clock::now()) {}
+
+Loop::~Loop() {}
+
+// The write of the batch follows within the loop iteration, the board takes the rest as part of the transfer delay.
+// 0 means no reference to the board, the next microsecond is sent instead
+uint32_t Loop::syncTime(Clock::time_point t) const
+{
+  uint32_t us = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(t - epoch).count();
+  return us ? us : 1;
+}
+
+Clock::time_point Loop::fromSync(uint32_t syncTime) const
+{
+  int32_t d = (int32_t)(syncTime - this->syncTime(Clock::now()));
+  return Clock::now() + std::chrono::microseconds(d);
+}
+
+Port *Loop::open(const std::string &dev, uint32_t baud)
+{
+  std::unique_ptr<Port> p(new Port(dev, baud));
+  if (!p->ok()) {
+    int err = errno;
+    p.reset();
+    errno = err;
+    return nullptr;
+  }
+  ports.push_back(std::move(p));
+  return ports.back().get();
+}
+
+Board &Loop::add(Port &ctrl, Port *debug)
+{
+  boards.push_back(std::unique_ptr<Board>(new Board(*this, ctrl, debug)));
+  Board *b = boards.back().get();
+  ctrl.decoder().onFeedback = [b](const ProtoFeedback &f) { b->handleFeedback(f); };
+  ctrl.decoder().onTrip     = [b](const ProtoTrip &t) { b->handleTrip(t); };
+  attachDebug(b, debug);
+  return *b;
+}
+
+Board &Loop::addBus(Port &port, uint8_t id, Port *debug)
+{
+  Bus *bus = nullptr;
+  for (size_t i = 0; i < buses.size(); i++) {
+    if (buses[i]->port == &port) bus = buses[i].get();
+  }
+  if (!bus) {
+    buses.push_back(std::unique_ptr<Bus>(new Bus()));
+    bus = buses.back().get();
+    bus->port = &port;
+    bus->next = 0;
+    bus->seq  = 0;
+    std::fill(bus->polled, bus->polled + 64, (Board *)nullptr);
+    port.decoder().onFeedback = [bus](const ProtoFeedback &f) {
+      Board *b = bus->polled[f.cmdSeq % 64];
+      if (b) b->handleFeedback(f);
+    };
+  }
+  boards.push_back(std::unique_ptr<Board>(new Board(*this, port, debug, id % PROTO_BUS_MAX)));
+  Board *b = boards.back().get();
+  bus->boards.push_back(b);
+  attachDebug(b, debug);
+  return *b;
+}
+
+void Loop::attachDebug(Board *b, Port *debug)
+{
+  if (debug) {
+    debug->decoder().onBin    = [b](const BinReply &r) { b->handleBin(r); };
+    debug->decoder().onStream = [b](const StreamFrame &s) { if (b->onStream) b->onStream(s); };
+    debug->decoder().onLine   = [b](const std::string &l) { if (b->onLine) b->onLine(l); };
+  }
+}
+
+void Loop::every(uint32_t ms, std::function<void()> fn)
+{
+  Timer t;
+  t.period = std::chrono::milliseconds(ms);
+  t.next   = Clock::now() + t.period;
+  t.fn     = fn;
+  timers.push_back(t);
+}
+
+void Loop::sendCommands()
+{
+  if (cmdLatch) {
+    for (size_t i = 0; i < boards.size(); i++) if (boards[i]->busId < 0) boards[i]->sendCommand(PROTO_CMD_HOLD);
+    for (size_t i = 0; i < boards.size(); i++) if (boards[i]->busId < 0) boards[i]->sendCommand(PROTO_CMD_LATCH);
+  } else {
+    for (size_t i = 0; i < boards.size(); i++) if (boards[i]->busId < 0) boards[i]->sendCommand(0);
+  }
+  for (size_t i = 0; i < buses.size(); i++) sendBus(*buses[i]);
+}
+
+// One frame with the targets of all boards of the port. fbEcho is for the board polled in the previous frame, if its
+// answer to that frame has arrived
+void Loop::sendBus(Bus &bus)
+{
+  Clock::time_point now = Clock::now();
+  std::vector<std::pair<int16_t, int16_t> > targets(PROTO_BUS_MAX, std::make_pair((int16_t)0, (int16_t)0));
+  Board *prev = bus.polled[(uint16_t)(bus.seq - 1) % 64];
+  Board *poll = bus.boards[bus.next];
+  uint8_t caps = 0;
+  uint16_t echo = 0;
+
+  if (prev && prev->echo && prev->fbValid && prev->fb.cmdSeq == (uint16_t)(bus.seq - 1)) {
+    caps |= PROTO_CMD_ECHO;
+    echo  = prev->fb.fbTime;
+  }
+  for (size_t i = 0; i < bus.boards.size(); i++) {
+    Board *b = bus.boards[i];
+    targets[b->busId] = std::make_pair(b->cmdSteer, b->cmdSpeed);
+    b->sendTime[bus.seq % 64] = now;
+    b->seq = bus.seq + 1;               // the round trip of handleFeedback() counts from the bus seq
+  }
+  ProtoBusCommand c = packBusCommand(targets, (uint8_t)poll->busId, bus.seq, caps, echo, syncTime(now));
+  bus.port->write((const uint8_t *)&c, sizeof(c));
+  bus.polled[bus.seq % 64] = poll;
+  bus.next = (bus.next + 1) % bus.boards.size();
+  bus.seq++;
+}
+
+bool Loop::runOnce(int timeoutMs)
+{
+  Clock::time_point now = Clock::now();
+  Clock::time_point due = now + std::chrono::milliseconds(timeoutMs);
+  for (size_t i = 0; i < timers.size(); i++) due = std::min(due, timers[i].next);
+  if (cmdPeriod) due = std::min(due, cmdNext);
+  int wait = (int)std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count());
+
+  std::vector<struct pollfd> fds(ports.size());
+  for (size_t i = 0; i < ports.size(); i++) {
+    fds[i].fd      = ports[i]->fd;
+    fds[i].events  = POLLIN | (ports[i]->tx.empty() ? 0 : POLLOUT);
+    fds[i].revents = 0;
+  }
+  if (poll(fds.data(), fds.size(), wait) < 0 && errno != EINTR) return false;
+  for (size_t i = 0; i < ports.size(); i++) {
+    if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) return false;
+    if (fds[i].revents & POLLIN) ports[i]->read();
+  }
+
+  now = Clock::now();
+  for (size_t i = 0; i < timers.size(); i++) {
+    if (now < timers[i].next) continue;
+    timers[i].next += timers[i].period;
+    if (timers[i].next < now) timers[i].next = now + timers[i].period;   // do not catch up after a stall
+    timers[i].fn();
+  }
+  if (cmdPeriod && now >= cmdNext) {
+    sendCommands();
+    cmdNext += std::chrono::milliseconds(cmdPeriod);
+    if (cmdNext < now) cmdNext = now + std::chrono::milliseconds(cmdPeriod);
+  }
+  for (size_t i = 0; i < boards.size(); i++) boards[i]->pumpRequests(now);
+
+  bool ok = true;
+  for (size_t i = 0; i < ports.size(); i++) ok = ports[i]->flush() && ok;
+  return ok;
+}
+
+void Loop::run()
+{
+  running = true;
+  while (running && runOnce(10)) {}
+}
+
+} // namespace hover
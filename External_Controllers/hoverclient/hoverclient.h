@@ -0,0 +1,313 @@
+// *******************************************************************
+//  Host client library for the hoverboard serial protocols
+//  for   https://github.com/EmanuelFeru/hoverboard-firmware-hack-FOC
+// *******************************************************************
+// Reference implementation of the wire formats of the firmware, for Linux / macOS hosts:
+// • ProtoCommand / ProtoFeedback of Inc/protocol.h (CONTROL_SERIAL_USARTx, FEEDBACK_SERIAL_USARTx)
+// • ProtoTrip frames with the lifetime totals of the board (TRIP_STATS), the answer to a PROTO_CMD_TRIP command
+// • binary parameter requests and replies, DEBUG_BIN_START_FRAME (comms.c, DEBUG_SERIAL_PROTOCOL)
+// • binary stream frames, DEBUG_STREAM_START_FRAME, with the layout taken from the "# stream" line of $STREAM
+// • text lines of the debug protocol ($GET, $SET, ...)
+// Decoder works on any byte stream and resyncs on the start frames, so it can also check captures or the firmware
+// output of the host SIL. Loop drives any number of boards on any number of serial ports from one thread: the
+// commands of all boards are packed at the command period and every port gets one write() per loop iteration.
+// Boards on a multi-drop bus port (firmware SERIAL_BUS) share one ProtoBusCommand per period, polled round robin.
+// Callbacks run in the thread that calls Loop::run / runOnce, they may call back into the library.
+#ifndef HOVERCLIENT_H
+#define HOVERCLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "protocol.h"                   // symlink to Inc/protocol.h, the wire format shared with the firmware
+
+namespace hover {
+
+// Constants of Inc/config.h and Inc/comms.h, keep in sync
+const uint16_t BIN_START_FRAME    = 0x7D7D; // DEBUG_BIN_START_FRAME
+const uint16_t STREAM_START_FRAME = 0x7C7C; // DEBUG_STREAM_START_FRAME
+const uint8_t  BIN_MAX_ITEMS      = 16;     // DEBUG_BIN_MAX_ITEMS
+const uint8_t  BIN_QUEUE          = 2;      // binary requests the firmware queues, more are dropped
+const uint8_t  STREAM_MAX         = 16;     // MAX_PARAM_STREAM
+const uint8_t  BIN_OP_GET         = 0x01;
+const uint8_t  BIN_OP_SET         = 0x02;
+const uint8_t  BIN_OP_REPLY       = 0x80;
+const uint8_t  BIN_OP_ERROR       = 0x40;
+
+typedef std::chrono::steady_clock Clock;
+
+// calc_crc32 of Src/crc32.c: CRC32C, init 1, no final xor
+uint32_t crc32c(const uint8_t *data, size_t len);
+// calc_crc32_hw of Src/crc32.c: STM32 CRC unit, little-endian words, last word zero padded
+uint32_t crc32Stm(const uint8_t *data, size_t len);
+// crc16 of Src/cobs.c: CRC-16/CCITT-FALSE
+uint16_t crc16(const uint8_t *data, size_t len);
+// COBS frame (firmware SERIAL_COBS, PROTO_COBS_DELIM in protocol.h) of a complete start frame / checksum frame of len bytes
+std::vector<uint8_t> cobsFrame(const void *frame, size_t len);
+
+// Complete ProtoCommand frame, checksum included. syncTime [us] is the sender clock for TIME_SYNC, 0 for none
+ProtoCommand packCommand(int16_t steer, int16_t speed, uint16_t seq, uint8_t caps = 0, uint16_t fbEcho = 0, bool hwCrc = false,
+                         uint32_t syncTime = 0);
+// Complete ProtoCommandExt frame (firmware SERIAL_EXT_CMD, software CRC only): ext and the extra fields from x
+ProtoCommandExt packCommandExt(const ProtoCommandExt &x, int16_t steer, int16_t speed, uint16_t seq, uint8_t caps = 0,
+                               uint16_t fbEcho = 0, uint32_t syncTime = 0);
+// Complete ProtoBusCommand frame: targets by board id (steer, speed), at most PROTO_BUS_MAX, the rest zero
+ProtoBusCommand packBusCommand(const std::vector<std::pair<int16_t, int16_t> > &targets, uint8_t poll, uint16_t seq,
+                               uint8_t caps = 0, uint16_t fbEcho = 0, uint32_t syncTime = 0);
+// Binary GET / SET request frame, at most BIN_MAX_ITEMS items
+std::vector<uint8_t> packGet(const std::vector<uint8_t> &index);
+std::vector<uint8_t> packSet(const std::vector<std::pair<uint8_t, int32_t> > &items);
+
+struct StreamFrame {
+  uint16_t seq;                         // [-] frame counter of the board
+  uint32_t time;                        // [us] board timebase, timeUs(), wraps after 71 minutes
+  uint16_t lost;                        // [-] frames missing before this one (seq gap)
+  std::vector<int32_t> values;          // internal values, 1 and 2 byte channels sign extended, empty without the layout
+};
+
+struct BinReply {
+  uint8_t op;                           // BIN_OP_GET or BIN_OP_SET
+  bool    error;                        // BIN_OP_ERROR: GET with an unknown index
+  std::vector<int32_t> values;          // GET: values, SET: 1 = written, 0 = rejected
+};
+
+struct DecoderStats {
+  uint32_t feedback;                    // valid frames of each kind
+  uint32_t trip;
+  uint32_t stream;
+  uint32_t bin;
+  uint32_t lines;
+  uint32_t crcErrors;                   // start frame found, checksum wrong
+  uint32_t versionErrors;               // intact ProtoFeedback of another PROTO_VERSION
+  uint32_t skipped;                     // bytes dropped while resyncing
+  uint32_t streamLost;                  // stream frames missing in the seq
+};
+
+// Byte stream to frames. Bytes that do not start a frame are collected as text lines. A start frame with a wrong
+// checksum drops one byte only, so a frame starting inside a corrupted one is still found. With setCobs the stream is
+// COBS frames (firmware SERIAL_COBS) instead, converted to the start frame form: bad frames count as crcErrors.
+class Decoder {
+public:
+  std::function<void(const ProtoFeedback &)>  onFeedback;
+  std::function<void(const ProtoTrip &)>      onTrip;
+  std::function<void(const StreamFrame &)>    onStream;
+  std::function<void(const BinReply &)>       onBin;
+  std::function<void(const std::string &)>    onLine;   // without the line end
+
+  Decoder();
+  void feed(const uint8_t *data, size_t len);
+  // Byte size of each stream channel. Set automatically from the "# stream" line, frames whose channel count or
+  // length do not match are dropped (the layout changed and the line was missed: send $STREAM again)
+  void setStreamLayout(const std::vector<uint8_t> &sizes);
+  void setCobs(bool on) { cobs = on; cobsRx.clear(); }
+  const std::vector<uint8_t> &streamLayout() const { return layout; }
+  const std::vector<std::string> &streamNames() const { return names; }
+  const DecoderStats &stats() const { return st; }
+
+private:
+  enum Result {NEED_MORE, BAD, DONE};
+  Result tryFeedback();
+  Result tryFeedbackCompact();
+  Result tryTrip();
+  Result tryStream();
+  Result tryBin();
+  void   textByte(uint8_t c);
+  void   cobsEnd();
+  void   streamLine(const std::string &line);
+
+  std::vector<uint8_t>     rx;
+  size_t                   pos;         // first unprocessed byte of rx
+  std::string              line;
+  std::vector<uint8_t>     layout;
+  std::vector<std::string> names;
+  bool                     seqValid;
+  uint16_t                 seqNext;
+  DecoderStats             st;
+  ProtoFeedback            compact;     // last compact frame expanded, keeps the slow fields
+  bool                     cobs;
+  std::vector<uint8_t>     cobsRx;      // COBS frame being received, without the delimiter
+};
+
+class Loop;
+
+// One serial port, 8N1 raw. The decoder output goes to the boards attached to the port.
+class Port {
+public:
+  const std::string &name() const { return dev; }
+  Decoder &decoder() { return dec; }
+  void write(const uint8_t *data, size_t len);    // appended to the batch of this loop iteration
+  void write(const std::string &s) { write((const uint8_t *)s.data(), s.size()); }
+  size_t pending() const { return tx.size(); }
+  bool ok() const { return fd >= 0; }
+  ~Port();
+
+private:
+  friend class Loop;
+  Port(const std::string &dev, uint32_t baud);
+  Port(const Port &);
+  Port &operator=(const Port &);
+  bool flush();                         // false on a write error
+  void read();
+
+  std::string          dev;
+  int                  fd;
+  Decoder              dec;
+  std::vector<uint8_t> tx;
+};
+
+// One mainboard: the command / feedback port and optionally a debug protocol port (may be the same port)
+class Board {
+public:
+  typedef std::function<void(bool ok, const std::vector<int32_t> &values)> Result;
+
+  std::function<void(const ProtoFeedback &)>  onFeedback;
+  std::function<void(const ProtoTrip &)>      onTrip;
+  std::function<void(const StreamFrame &)>    onStream;
+  std::function<void(const std::string &)>    onLine;
+
+  // Target sent every command period. The sequence number is managed here.
+  void command(int16_t steer, int16_t speed) { cmdSteer = steer; cmdSpeed = speed; posMode = false; ext.ext &= ~PROTO_EXT_WHEEL; }
+  // Extended commands (firmware SERIAL_EXT_CMD, not with setHwCrc or on a bus): left / right wheel targets without the mixing, until
+  // the next command(). The mode and limits below go out with every command from then on, the board takes them
+  // together in one control tick. 0 = leave the value of the board. [A*100] currents, [rpm] speed
+  void wheels(int16_t left, int16_t right) { cmdSteer = left; cmdSpeed = right; posMode = false; ext.ext |= PROTO_EXT_WHEEL; }
+  void setMode(uint8_t mode) { ext.ctrlMod = mode; extFlag(PROTO_EXT_MODE, mode != 0); }
+  void setLimits(uint16_t iMax, uint16_t nMax) { ext.iMax = iMax; ext.nMax = nMax; extFlag(PROTO_EXT_I_MAX, iMax != 0); extFlag(PROTO_EXT_N_MAX, nMax != 0); }
+  void setFieldWeak(uint8_t ena, uint16_t iMax) { ext.fieldWeakEna = ena; ext.fieldWeakMax = iMax; extFlag(PROTO_EXT_FIELD_WEAK, true); }
+  // POS_MODE targets (firmware POS_CTRL) in the odometry() frame instead of steer / speed, until the next command().
+  // A target must be less than 32767 hall steps from the present position. Zero targets until the first feedback
+  void position(int64_t left, int64_t right) { posL = left; posR = right; posMode = true; ext.ext &= ~PROTO_EXT_WHEEL; }
+  void setHwCrc(bool on) { hwCrc = on; }
+  // COBS framing of the commands and the feedback (firmware SERIAL_COBS), for the whole port: not with setHwCrc
+  void setCobs(bool on) { cobs = on; ctrl.decoder().setCobs(on); }
+  void setEcho(bool on) { echo = on; }  // PROTO_CMD_ECHO: the board measures the round trip from fbEcho
+  // PROTO_CMD_FB_COMPACT (firmware FEEDBACK_COMPACT): shorter feedback frames, onFeedback still gets full ProtoFeedback
+  void setCompact(bool on) { fbCompact = on; }
+  // PROTO_CMD_TRIP (firmware TRIP_STATS) in the next command: the board answers with one ProtoTrip frame instead of
+  // the next feedback frame, it goes to onTrip and trip(). Not on a bus
+  void requestTrip() { tripReq = true; }
+
+  // Binary parameter access by params[] index, the ids printed by $GET. The result callback gets ok = false on an
+  // error reply, a rejected SET item or when no reply came within the timeout. At most BIN_QUEUE requests are on the wire, the rest wait.
+  void get(const std::vector<uint8_t> &index, Result cb);
+  void set(const std::vector<std::pair<uint8_t, int32_t> > &items, Result cb);
+  // Debug protocol text command, "$" and the line end are added
+  void text(const std::string &cmd);
+
+  const ProtoFeedback &feedback() const { return fb; }
+  uint32_t feedbackCount() const { return fbCount; }
+  Clock::time_point feedbackTime() const { return fbTime; }
+  // [ms] last controller round trip from cmdSeq / cmdAge, -1 before the first feedback with a known seq
+  int32_t roundTrip() const { return rtt; }
+  int64_t odometry(int side) const { return odo[side & 1]; }   // [hall steps] accumulated odo0 / odo1
+  const ProtoTrip &trip() const { return tripStats; }           // last ProtoTrip frame, zero before the first
+
+private:
+  friend class Loop;
+  struct Request {
+    std::vector<uint8_t> frame;
+    Result               cb;
+    Clock::time_point    sent;
+  };
+  Board(Loop &loop, Port &ctrl, Port *debug, int busId = -1);
+  void sendCommand(uint8_t caps);
+  void write(const void *frame, size_t len);   // command frame, COBS framed with setCobs
+  void extFlag(uint8_t flag, bool on) { ext.ext = on ? (ext.ext | flag) : (ext.ext & ~flag); }
+  void handleFeedback(const ProtoFeedback &f);
+  void handleTrip(const ProtoTrip &t);
+  void handleBin(const BinReply &r);
+  void pumpRequests(Clock::time_point now);
+
+  Loop              &loop;
+  Port              &ctrl;
+  Port              *debug;
+  int                busId;             // [-] id on a SERIAL_BUS port, -1 on a port of its own
+  int16_t            cmdSteer, cmdSpeed;
+  bool               posMode;
+  int64_t            posL, posR;
+  uint16_t           seq;
+  bool               hwCrc, echo, fbCompact, cobs, tripReq;
+  ProtoCommandExt    ext;               // extra fields of the extended commands, sent while ext.ext is not 0
+  Clock::time_point  sendTime[64];      // send time per seq % 64, for the round trip
+  ProtoFeedback      fb;
+  bool               fbValid;
+  uint32_t           fbCount;
+  Clock::time_point  fbTime;
+  int32_t            rtt;
+  int64_t            odo[2];
+  ProtoTrip          tripStats;
+  std::deque<Request> waiting, inFlight;
+};
+
+class Loop {
+public:
+  Loop();
+  ~Loop();
+
+  // Opens the device, nullptr on error (errno is kept)
+  Port  *open(const std::string &dev, uint32_t baud);
+  Board &add(Port &ctrl, Port *debug = nullptr);
+  // Board with the id BUS_ID on a SERIAL_BUS port, no other kind of board on that port. Every command period the port
+  // gets one ProtoBusCommand with the targets of all its boards and polls one of them, round robin, so each board
+  // answers every n-th period. The feedback goes to the board polled in the frame of its cmdSeq. The period must be
+  // longer than that frame plus one feedback frame (90 bytes, 8 ms at 115200 baud). Bus boards take command() only:
+  // no position(), setCompact() or HOLD / LATCH, the one frame already reaches all boards together.
+  Board &addBus(Port &bus, uint8_t id, Port *debug = nullptr);
+
+  // [ms] command period, 0 stops the commands. With latch, every period sends HOLD frames to all boards and then
+  // LATCH frames, so all boards apply the new targets within one control tick (PROTO_CMD_HOLD / LATCH).
+  void setCommandPeriod(uint32_t ms, bool latch = false) { cmdPeriod = ms; cmdLatch = latch; }
+  void setReplyTimeout(uint32_t ms) { replyTimeout = ms; }
+  // Periodic callback, first call one period from now
+  void every(uint32_t ms, std::function<void()> fn);
+
+  // Clock of the commands for TIME_SYNC, microseconds since the Loop was created, and the host time of a feedback
+  // syncTime of a board with TIME_SYNC (the instant nearest to now, syncTime wraps every 71 minutes)
+  uint32_t          syncTime(Clock::time_point t) const;
+  Clock::time_point fromSync(uint32_t syncTime) const;
+
+  // Waits up to timeoutMs for data, runs the due timers and callbacks, then writes the batches. False if a port failed.
+  bool runOnce(int timeoutMs = 1);
+  void run();                           // until stop()
+  void stop() { running = false; }
+
+private:
+  friend class Board;
+  struct Timer {
+    std::chrono::milliseconds period;
+    Clock::time_point         next;
+    std::function<void()>     fn;
+  };
+  struct Bus {
+    Port                *port;
+    std::vector<Board *> boards;
+    size_t               next;          // index in boards of the next poll
+    uint16_t             seq;
+    Board               *polled[64];    // poll board per seq % 64, routes the feedback
+  };
+  void sendCommands();
+  void sendBus(Bus &bus);
+  void attachDebug(Board *b, Port *debug);
+
+  std::vector<std::unique_ptr<Port> >  ports;
+  std::vector<std::unique_ptr<Board> > boards;
+  std::vector<std::unique_ptr<Bus> >   buses;
+  std::vector<Timer>                   timers;
+  uint32_t                             cmdPeriod;
+  bool                                 cmdLatch;
+  Clock::time_point                    cmdNext;
+  uint32_t                             replyTimeout;
+  bool                                 running;
+  Clock::time_point                    epoch;             // syncTime 0
+};
+
+} // namespace hover
+
+#endif // HOVERCLIENT_H
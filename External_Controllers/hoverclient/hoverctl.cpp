@@ -0,0 +1,129 @@
+// *******************************************************************
+//  hoverctl: example for the hoverclient library
+// *******************************************************************
+// Drives one or more boards with a constant command and prints their feedback once per second.
+//
+//   hoverctl [-b baud] [-s speed] [-t steer] [-l] [-c] [-r] [-g id,id,...] PORT[:DEBUGPORT] [PORT@N] ...
+//
+// Every PORT is the command / feedback USART of one board, DEBUGPORT its DEBUG_SERIAL_PROTOCOL USART (may be the same
+// device). PORT@N is a SERIAL_BUS port with N boards, ids 0..N-1. -l sends HOLD / LATCH pairs so all boards switch
+// together, -c uses the COBS framing (SERIAL_COBS), -r prints the trip totals (TRIP_STATS, not on a bus) and -g reads
+// parameters by id every second.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "hoverclient.h"
+
+static std::vector<uint8_t> parseIds(const char *s)
+{
+  std::vector<uint8_t> ids;
+  while (*s) {
+    ids.push_back((uint8_t)strtoul(s, (char **)&s, 0));
+    if (*s == ',') s++;
+  }
+  return ids;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t baud  = 115200;
+  int16_t  speed = 0, steer = 0;
+  bool     latch = false;
+  bool     cobs  = false;
+  bool     trip  = false;
+  std::vector<uint8_t> ids;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:s:t:lcrg:")) != -1) {
+    switch (opt) {
+      case 'b': baud  = strtoul(optarg, NULL, 0);          break;
+      case 's': speed = (int16_t)atoi(optarg);             break;
+      case 't': steer = (int16_t)atoi(optarg);             break;
+      case 'l': latch = true;                              break;
+      case 'c': cobs  = true;                              break;
+      case 'r': trip  = true;                              break;
+      case 'g': ids   = parseIds(optarg);                  break;
+      default:
+        fprintf(stderr, "usage: %s [-b baud] [-s speed] [-t steer] [-l] [-c] [-r] [-g id,...] PORT[:DEBUGPORT] | PORT@N ...\n", argv[0]);
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "no port given\n");
+    return 1;
+  }
+
+  hover::Loop loop;
+  std::vector<hover::Board *> boards;
+  std::vector<hover::Board *> tripBoards;  // boards on a port of their own, PROTO_CMD_TRIP is not used on a bus
+  for (int i = optind; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t at = arg.find('@');
+    if (at != std::string::npos) {
+      hover::Port *bus = loop.open(arg.substr(0, at), baud);
+      if (!bus) {
+        perror(arg.substr(0, at).c_str());
+        return 1;
+      }
+      int n = atoi(arg.c_str() + at + 1);
+      for (int id = 0; id < n && id < PROTO_BUS_MAX; id++) {
+        hover::Board &b = loop.addBus(*bus, (uint8_t)id);
+        b.command(steer, speed);
+        boards.push_back(&b);
+      }
+      continue;
+    }
+    size_t colon = arg.find(':');
+    hover::Port *ctrl = loop.open(arg.substr(0, colon), baud);
+    hover::Port *debug = NULL;
+    if (!ctrl) {
+      perror(arg.substr(0, colon).c_str());
+      return 1;
+    }
+    if (colon != std::string::npos) {
+      std::string dev = arg.substr(colon + 1);
+      debug = (dev == ctrl->name()) ? ctrl : loop.open(dev, baud);
+      if (!debug) {
+        perror(dev.c_str());
+        return 1;
+      }
+    }
+    hover::Board &b = loop.add(*ctrl, debug);
+    b.command(steer, speed);
+    b.setCobs(cobs);
+    b.onLine = [i](const std::string &l) { printf("%d> %s\n", i - optind, l.c_str()); };
+    b.onTrip = [i](const ProtoTrip &t) {
+      printf("%d: trip %u m  used %.3f Wh  regen %.3f Wh  on %u s  error %u s  max %.1f C %.2f A\n", i - optind, t.odoM,
+             t.usedMWh / 1000.0, t.regenMWh / 1000.0, t.onTime, t.errTime, t.maxTemp / 10.0, t.maxCurr / 100.0);
+    };
+    boards.push_back(&b);
+    if (trip) tripBoards.push_back(&b);
+  }
+
+  loop.setCommandPeriod(20, latch);
+  loop.every(1000, [&]() {
+    for (size_t i = 0; i < boards.size(); i++) {
+      hover::Board &b = *boards[i];
+      const ProtoFeedback &f = b.feedback();
+      printf("%zu: fb %u  speed L %d R %d rpm  bat %.2f V  temp %.1f C  odo %lld %lld  rtt %d ms\n", i, b.feedbackCount(),
+             f.speedL_meas, f.speedR_meas, f.batVoltage / 100.0, f.boardTemp / 10.0,
+             (long long)b.odometry(0), (long long)b.odometry(1), b.roundTrip());
+      if (!ids.empty()) {
+        b.get(ids, [i](bool ok, const std::vector<int32_t> &v) {
+          printf("%zu: get %s", i, ok ? "" : "failed");
+          for (size_t k = 0; k < v.size(); k++) printf(" %d", v[k]);
+          printf("\n");
+        });
+      }
+    }
+    for (size_t i = 0; i < tripBoards.size(); i++) tripBoards[i]->requestTrip();
+    fflush(stdout);
+  });
+  loop.run();
+  fprintf(stderr, "port error\n");
+  return 1;
+}
@@ -0,0 +1,345 @@
+// *******************************************************************
+//  Binary telemetry log of the stream frames (.hvl)
+// *******************************************************************
+// See hoverlog.h. The reader maps the whole file, nothing is copied.
+#include "hoverlog.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+
+namespace hover {
+
+// ########################## WRITER ##########################
+
+LogWriter::LogWriter() :
+  f(NULL), recordSize(0), chunkRecords(0), count(0), t0(0), t1(0), tExt(0), tLast(0), started(false), total(0), ok(false)
+{
+}
+
+bool LogWriter::open(const std::string &path, const std::vector<std::string> &names, const std::vector<uint8_t> &sz,
+                     uint32_t tickHz, uint16_t chunkRec)
+{
+  close();
+  if (names.size() != sz.size() || sz.empty() || sz.size() > 255 || !chunkRec) return false;
+  f = fopen(path.c_str(), "wb");
+  if (!f) return false;
+  setvbuf(f, NULL, _IOFBF, 1 << 16);
+
+  sizes        = sz;
+  chunkRecords = chunkRec;
+  recordSize   = 8;
+  for (size_t i = 0; i < sizes.size(); i++) recordSize += sizes[i];
+  range.assign(sizes.size(), LogRange());
+  buf.clear();
+  index.clear();
+  count = 0;
+  total = 0;
+  started = false;
+
+  LogHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic        = LOG_MAGIC;
+  h.version      = LOG_VERSION;
+  h.channels     = (uint8_t)sizes.size();
+  h.recordSize   = recordSize;
+  h.chunkRecords = chunkRecords;
+  h.tickHz       = tickHz;
+  h.startMs      = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::system_clock::now().time_since_epoch()).count();
+  ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  for (size_t i = 0; i < sizes.size(); i++) {
+    LogChannel c;
+    memset(&c, 0, sizeof(c));
+    strncpy(c.name, names[i].c_str(), LOG_NAME_LEN - 1);
+    c.size = sizes[i];
+    ok = ok && fwrite(&c, sizeof(c), 1, f) == 1;
+  }
+  return ok;
+}
+
+bool LogWriter::add(const StreamFrame &s)
+{
+  if (!f || s.values.size() != sizes.size()) return false;
+  if (!started) {
+    tExt    = s.time;
+    started = true;
+  } else {
+    tExt += (uint32_t)(s.time - tLast);   // board time wraps after 71 minutes at 1 MHz
+  }
+  tLast = s.time;
+  if (count && tExt - t0 > UINT32_MAX) flush();
+  if (count == 0) {
+    t0 = tExt;
+    for (size_t i = 0; i < range.size(); i++) {
+      range[i].min = INT32_MAX;
+      range[i].max = INT32_MIN;
+    }
+  }
+
+  uint32_t dt = (uint32_t)(tExt - t0);
+  uint8_t rec[8] = {(uint8_t)dt, (uint8_t)(dt >> 8), (uint8_t)(dt >> 16), (uint8_t)(dt >> 24),
+                    (uint8_t)s.seq, (uint8_t)(s.seq >> 8), (uint8_t)s.lost, (uint8_t)(s.lost >> 8)};
+  buf.insert(buf.end(), rec, rec + 8);
+  for (size_t i = 0; i < sizes.size(); i++) {
+    int32_t v = s.values[i];
+    for (uint8_t k = 0; k < sizes[i]; k++) buf.push_back((uint8_t)(v >> (8 * k)));
+    if (v < range[i].min) range[i].min = v;
+    if (v > range[i].max) range[i].max = v;
+  }
+  t1 = tExt;
+  count++;
+  total++;
+  if (count >= chunkRecords) return flush();
+  return ok;
+}
+
+bool LogWriter::flush()
+{
+  if (!f || !count) return ok;
+  std::vector<uint8_t> body((const uint8_t *)range.data(), (const uint8_t *)(range.data() + range.size()));
+  body.insert(body.end(), buf.begin(), buf.end());
+
+  LogChunk c;
+  memset(&c, 0, sizeof(c));
+  c.magic = LOG_CHUNK_MAGIC;
+  c.count = count;
+  c.t0    = t0;
+  c.t1    = t1;
+  c.crc   = crc32c(body.data(), body.size());
+
+  LogIndexEntry e;
+  memset(&e, 0, sizeof(e));
+  e.offset = (uint64_t)ftello(f);
+  e.t0     = t0;
+  e.t1     = t1;
+  e.count  = count;
+  index.push_back(e);
+
+  ok = ok && fwrite(&c, sizeof(c), 1, f) == 1 && fwrite(body.data(), body.size(), 1, f) == 1 && fflush(f) == 0;
+  buf.clear();
+  count = 0;
+  return ok;
+}
+
+bool LogWriter::close()
+{
+  if (!f) return ok;
+  flush();
+  LogTrailer t;
+  t.magic       = LOG_INDEX_MAGIC;
+  t.chunks      = (uint32_t)index.size();
+  t.indexOffset = (uint64_t)ftello(f);
+  if (!index.empty()) ok = ok && fwrite(index.data(), sizeof(LogIndexEntry), index.size(), f) == index.size();
+  ok = ok && fwrite(&t, sizeof(t), 1, f) == 1;
+  ok = (fclose(f) == 0) && ok;
+  f = NULL;
+  return ok;
+}
+
+// ########################## READER ##########################
+
+LogReader::LogReader() : fd(-1), map(NULL), mapLen(0), hdr(NULL), total(0), hasIndex(false) {}
+
+LogReader::~LogReader()
+{
+  close();
+}
+
+void LogReader::close()
+{
+  if (map) munmap((void *)map, mapLen);
+  if (fd >= 0) ::close(fd);
+  fd     = -1;
+  map    = NULL;
+  hdr    = NULL;
+  mapLen = 0;
+  total  = 0;
+  chans.clear();
+  offs.clear();
+  chunks.clear();
+}
+
+bool LogReader::open(const std::string &path)
+{
+  struct stat sb;
+  close();
+  fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0 || fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(LogHeader)) {
+    close();
+    return false;
+  }
+  mapLen = (size_t)sb.st_size;
+  void *m = mmap(NULL, mapLen, PROT_READ, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) {
+    map = NULL;
+    close();
+    return false;
+  }
+  map = (const uint8_t *)m;
+  hdr = (const LogHeader *)map;
+
+  size_t pos = sizeof(LogHeader) + hdr->channels * sizeof(LogChannel);
+  if (hdr->magic != LOG_MAGIC || hdr->version != LOG_VERSION || !hdr->channels || !hdr->tickHz || pos > mapLen) {
+    close();
+    return false;
+  }
+  size_t recSize = 8;
+  for (size_t i = 0; i < hdr->channels; i++) {
+    LogChannel c;
+    memcpy(&c, map + sizeof(LogHeader) + i * sizeof(LogChannel), sizeof(c));
+    chans.push_back(c);
+    offs.push_back(recSize);
+    recSize += c.size;
+  }
+  if (recSize != hdr->recordSize) {
+    close();
+    return false;
+  }
+  const size_t rangeSize = hdr->channels * sizeof(LogRange);
+
+  // Index of a closed log: the entries must point at chunk headers that agree with them
+  hasIndex = false;
+  if (mapLen >= pos + sizeof(LogTrailer)) {
+    const LogTrailer *t = (const LogTrailer *)(map + mapLen - sizeof(LogTrailer));
+    if (t->magic == LOG_INDEX_MAGIC && t->indexOffset >= pos &&
+        t->indexOffset + (uint64_t)t->chunks * sizeof(LogIndexEntry) + sizeof(LogTrailer) == mapLen) {
+      const LogIndexEntry *e = (const LogIndexEntry *)(map + t->indexOffset);
+      hasIndex = true;
+      for (uint32_t i = 0; i < t->chunks && hasIndex; i++) {
+        const LogChunk *c = (const LogChunk *)(map + e[i].offset);
+        hasIndex = e[i].offset + sizeof(LogChunk) + rangeSize + (uint64_t)e[i].count * recSize <= t->indexOffset &&
+                   c->magic == LOG_CHUNK_MAGIC && c->count == e[i].count && c->t0 == e[i].t0;
+        if (hasIndex) {
+          Chunk k = {c, (const LogRange *)(c + 1), (const uint8_t *)(c + 1) + rangeSize, total};
+          chunks.push_back(k);
+          total += c->count;
+        }
+      }
+      if (!hasIndex) {
+        chunks.clear();
+        total = 0;
+      }
+    }
+  }
+  // No index (recording not closed): walk the chunks up to the first incomplete or corrupted one
+  while (!hasIndex && pos + sizeof(LogChunk) <= mapLen) {
+    const LogChunk *c = (const LogChunk *)(map + pos);
+    size_t body = rangeSize + (size_t)c->count * recSize;
+    if (c->magic != LOG_CHUNK_MAGIC || !c->count || c->count > hdr->chunkRecords || pos + sizeof(LogChunk) + body > mapLen ||
+        crc32c((const uint8_t *)(c + 1), body) != c->crc) {
+      break;
+    }
+    Chunk k = {c, (const LogRange *)(c + 1), (const uint8_t *)(c + 1) + rangeSize, total};
+    chunks.push_back(k);
+    total += c->count;
+    pos += sizeof(LogChunk) + body;
+  }
+  return true;
+}
+
+std::string LogReader::name(size_t ch) const
+{
+  return std::string(chans[ch].name, strnlen(chans[ch].name, LOG_NAME_LEN));
+}
+
+size_t LogReader::chunkOf(size_t rec) const
+{
+  size_t lo = 0, hi = chunks.size();
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if (chunks[mid].first <= rec) lo = mid; else hi = mid;
+  }
+  return lo;
+}
+
+const uint8_t *LogReader::recPtr(size_t rec, size_t &c) const
+{
+  c = chunkOf(rec);
+  return chunks[c].rec + (rec - chunks[c].first) * hdr->recordSize;
+}
+
+static inline uint32_t ld32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint16_t ld16(const uint8_t *p) { uint16_t v; memcpy(&v, p, 2); return v; }
+
+uint64_t LogReader::time(size_t rec) const
+{
+  size_t c;
+  const uint8_t *p = recPtr(rec, c);
+  return chunks[c].hdr->t0 + ld32(p);
+}
+
+uint16_t LogReader::seq(size_t rec) const
+{
+  size_t c;
+  return ld16(recPtr(rec, c) + 4);
+}
+
+uint16_t LogReader::lost(size_t rec) const
+{
+  size_t c;
+  return ld16(recPtr(rec, c) + 6);
+}
+
+int32_t LogReader::value(size_t rec, size_t ch) const
+{
+  size_t c;
+  const uint8_t *p = recPtr(rec, c) + offs[ch];
+  switch (chans[ch].size) {
+    case 4:  return (int32_t)ld32(p);
+    case 2:  return (int16_t)ld16(p);
+    default: return (int8_t)p[0];
+  }
+}
+
+size_t LogReader::find(uint64_t t) const
+{
+  size_t lo = 0, hi = chunks.size();
+  while (lo < hi) {                     // first chunk ending at or after t
+    size_t mid = (lo + hi) / 2;
+    if (chunks[mid].hdr->t1 < t) lo = mid + 1; else hi = mid;
+  }
+  if (lo == chunks.size()) return total;
+  const Chunk &k = chunks[lo];
+  size_t a = 0, b = k.hdr->count;
+  while (a < b) {
+    size_t mid = (a + b) / 2;
+    if (k.hdr->t0 + ld32(k.rec + mid * hdr->recordSize) < t) a = mid + 1; else b = mid;
+  }
+  return k.first + a;
+}
+
+std::vector<LogRange> LogReader::downsample(size_t ch, uint64_t t0, uint64_t t1, size_t buckets) const
+{
+  std::vector<LogRange> out;
+  if (ch >= chans.size() || t1 <= t0 || !buckets) return out;
+  for (size_t b = 0; b < buckets; b++) {
+    uint64_t tb = t0 + (t1 - t0) * b / buckets;
+    uint64_t te = t0 + (t1 - t0) * (b + 1) / buckets;
+    LogRange r = {INT32_MAX, INT32_MIN};
+    size_t i = find(tb);
+    size_t c = i < total ? chunkOf(i) : chunks.size();
+    while (i < total) {
+      const Chunk &k = chunks[c];
+      if (i == k.first && k.hdr->t1 < te) {            // whole chunk in the bucket: its header is enough
+        if (k.range[ch].min < r.min) r.min = k.range[ch].min;
+        if (k.range[ch].max > r.max) r.max = k.range[ch].max;
+        i += k.hdr->count;
+        c++;
+        continue;
+      }
+      if (time(i) >= te) break;
+      int32_t v = value(i, ch);
+      if (v < r.min) r.min = v;
+      if (v > r.max) r.max = v;
+      if (++i == k.first + k.hdr->count) c++;
+    }
+    out.push_back(r);
+  }
+  return out;
+}
+
+} // namespace hover
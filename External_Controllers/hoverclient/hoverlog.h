@@ -0,0 +1,153 @@
+// *******************************************************************
+//  Binary telemetry log of the stream frames (.hvl)
+// *******************************************************************
+// File layout, little-endian:
+//   LogHeader, channels x LogChannel                   channel map: the $STREAM channels in frame order
+//   chunks:    LogChunk, channels x LogRange, count x record
+//   on close:  chunks x LogIndexEntry, LogTrailer
+// A record is uint32 dt (ticks since the chunk t0), uint16 seq, uint16 lost, then the internal value of every channel
+// in its stream size (1, 2 or 4 bytes), so all records of a file have the same size. A chunk is written in one piece
+// when it is full or on flush(), its header carries the time span and the min / max of every channel, so a plot over
+// many chunks reads the headers only. A log that was not closed has no index: the reader walks the chunk headers, a
+// chunk cut short or with a wrong CRC ends the log there.
+#ifndef HOVERLOG_H
+#define HOVERLOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hoverclient.h"
+
+namespace hover {
+
+const uint32_t LOG_MAGIC         = 0x314C5648;   // "HVL1"
+const uint32_t LOG_CHUNK_MAGIC   = 0x4B435648;   // "HVCK"
+const uint32_t LOG_INDEX_MAGIC   = 0x58495648;   // "HVIX"
+const uint16_t LOG_VERSION       = 1;
+const uint16_t LOG_CHUNK_RECORDS = 4096;         // default records per chunk
+const uint8_t  LOG_NAME_LEN      = 20;
+
+struct __attribute__((packed)) LogHeader {
+  uint32_t magic;                       // LOG_MAGIC
+  uint16_t version;                     // LOG_VERSION
+  uint8_t  channels;
+  uint8_t  reserved;
+  uint16_t recordSize;                  // [bytes] 8 + sum of the channel sizes
+  uint16_t chunkRecords;                // max records per chunk
+  uint32_t tickHz;                      // [Hz] board ticks per second (1 MHz, timeUs())
+  uint64_t startMs;                     // [ms] host time of the first record, unix epoch
+};
+
+struct __attribute__((packed)) LogChannel {
+  char     name[LOG_NAME_LEN];          // parameter name, zero padded
+  uint8_t  size;                        // [bytes] 1, 2 or 4, values sign extended on read
+  uint8_t  reserved[3];
+};
+
+struct __attribute__((packed)) LogChunk {
+  uint32_t magic;                       // LOG_CHUNK_MAGIC
+  uint32_t count;                       // records in this chunk
+  uint64_t t0;                          // [ticks] first record, board time extended to 64 bits
+  uint64_t t1;                          // [ticks] last record
+  uint32_t crc;                         // crc32c of the ranges and records
+  uint32_t reserved;
+};
+
+struct __attribute__((packed)) LogRange {
+  int32_t  min;
+  int32_t  max;
+};
+
+struct __attribute__((packed)) LogIndexEntry {
+  uint64_t offset;                      // [bytes] LogChunk position in the file
+  uint64_t t0;
+  uint64_t t1;
+  uint32_t count;
+  uint32_t reserved;
+};
+
+struct __attribute__((packed)) LogTrailer {
+  uint32_t magic;                       // LOG_INDEX_MAGIC
+  uint32_t chunks;
+  uint64_t indexOffset;                 // [bytes] first LogIndexEntry
+};
+
+class LogWriter {
+public:
+  LogWriter();
+  ~LogWriter() { close(); }
+  // Channel names and stream sizes as in the "# stream" line, see Decoder::streamNames
+  bool open(const std::string &path, const std::vector<std::string> &names, const std::vector<uint8_t> &sizes,
+            uint32_t tickHz, uint16_t chunkRecords = LOG_CHUNK_RECORDS);
+  // False if the frame does not match the channel map (values missing, layout changed)
+  bool add(const StreamFrame &s);
+  bool flush();                         // writes the pending records as a chunk
+  bool close();                         // last chunk and the index
+  uint64_t records() const { return total; }
+
+private:
+  FILE                      *f;
+  std::vector<uint8_t>       sizes;
+  uint16_t                   recordSize, chunkRecords;
+  std::vector<uint8_t>       buf;       // records of the open chunk
+  std::vector<LogRange>      range;
+  uint32_t                   count;
+  uint64_t                   t0, t1, tExt;
+  uint32_t                   tLast;
+  bool                       started;
+  uint64_t                   total;
+  std::vector<LogIndexEntry> index;
+  bool                       ok;
+};
+
+// Memory mapped log, read only
+class LogReader {
+public:
+  LogReader();
+  ~LogReader();
+  bool open(const std::string &path);
+  void close();
+
+  const LogHeader &header() const { return *hdr; }
+  size_t channels() const { return chans.size(); }
+  std::string name(size_t ch) const;
+  size_t records() const { return total; }
+  bool indexed() const { return hasIndex; }                 // false: rebuilt from the chunk headers
+  double seconds(uint64_t t) const { return (double)t / hdr->tickHz; }
+
+  uint64_t time(size_t rec) const;                          // [ticks]
+  uint16_t seq(size_t rec) const;
+  uint16_t lost(size_t rec) const;
+  int32_t  value(size_t rec, size_t ch) const;
+  size_t   find(uint64_t t) const;                          // first record at or after t, records() if none
+  // Min / max of a channel in buckets equal parts of [t0, t1). Chunks inside one bucket are taken from their header.
+  // A bucket without records has min > max.
+  std::vector<LogRange> downsample(size_t ch, uint64_t t0, uint64_t t1, size_t buckets) const;
+
+private:
+  struct Chunk {
+    const LogChunk *hdr;
+    const LogRange *range;
+    const uint8_t  *rec;
+    size_t          first;              // record number of the first record
+  };
+  size_t chunkOf(size_t rec) const;
+  const uint8_t *recPtr(size_t rec, size_t &c) const;
+
+  int                       fd;
+  const uint8_t            *map;
+  size_t                    mapLen;
+  const LogHeader          *hdr;
+  std::vector<LogChannel>   chans;
+  std::vector<size_t>       offs;       // value offset in the record per channel
+  std::vector<Chunk>        chunks;
+  size_t                    total;
+  bool                      hasIndex;
+};
+
+} // namespace hover
+
+#endif // HOVERLOG_H
@@ -0,0 +1,218 @@
+// *******************************************************************
+//  hoverrec: record and read the binary telemetry logs (hoverlog.h)
+// *******************************************************************
+//   hoverrec record [-b baud] [-r rate] [-k tick_hz] [-c NAME,NAME,...] PORT FILE
+//   hoverrec info FILE
+//   hoverrec csv [-f from_s] [-t to_s] [-n buckets] FILE
+//
+// record streams from the DEBUG_SERIAL_PROTOCOL port until Ctrl-C. With -c it toggles the channels into the stream
+// ($STREAM) and sets STREAM_RATE, without it the board must be streaming already and the layout is taken from the
+// next "# stream" line. csv prints the records between from and to, or with -n the min / max of every channel per
+// bucket (for plotting hours of data).
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "hoverclient.h"
+#include "hoverlog.h"
+
+static hover::Loop *loopStop;
+
+static void onSignal(int)
+{
+  if (loopStop) loopStop->stop();
+}
+
+static std::vector<std::string> split(const char *s)
+{
+  std::vector<std::string> out;
+  std::string item;
+  for (; *s; s++) {
+    if (*s == ',') { out.push_back(item); item.clear(); }
+    else item.push_back(*s);
+  }
+  if (!item.empty()) out.push_back(item);
+  return out;
+}
+
+static bool sameSet(std::vector<std::string> a, std::vector<std::string> b)
+{
+  std::sort(a.begin(), a.end());
+  std::sort(b.begin(), b.end());
+  return a == b;
+}
+
+static int usage()
+{
+  fprintf(stderr, "usage: hoverrec record [-b baud] [-r rate] [-k tick_hz] [-c NAME,...] PORT FILE\n"
+                  "       hoverrec info FILE\n"
+                  "       hoverrec csv [-f from_s] [-t to_s] [-n buckets] FILE\n");
+  return 1;
+}
+
+static int record(int argc, char **argv)
+{
+  uint32_t baud = 115200, rate = 0, tickHz = 1000000;
+  std::vector<std::string> want;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:r:k:c:")) != -1) {
+    switch (opt) {
+      case 'b': baud   = strtoul(optarg, NULL, 0); break;
+      case 'r': rate   = strtoul(optarg, NULL, 0); break;
+      case 'k': tickHz = strtoul(optarg, NULL, 0); break;
+      case 'c': want   = split(optarg);            break;
+      default:  return usage();
+    }
+  }
+  if (argc - optind != 2) return usage();
+
+  hover::Loop loop;
+  hover::Port *port = loop.open(argv[optind], baud);
+  if (!port) {
+    perror(argv[optind]);
+    return 1;
+  }
+  hover::Board &board = loop.add(*port, port);
+  hover::LogWriter log;
+  std::string path = argv[optind + 1];
+  bool open = false, fixed = want.empty();
+  size_t replies = 0;
+  uint32_t mismatch = 0;
+
+  // $STREAM toggles: a channel that was streaming already is switched off, switch it on again once
+  for (size_t i = 0; i < want.size(); i++) board.text("STREAM " + want[i]);
+  board.onLine = [&](const std::string &l) {
+    if (l.compare(0, 8, "# stream") != 0) {
+      fprintf(stderr, "%s\n", l.c_str());
+      return;
+    }
+    const std::vector<std::string> &have = port->decoder().streamNames();
+    if (open && have != want) {         // want is the board's channel order from here on
+      fprintf(stderr, "stream layout changed, stopping\n");
+      loop.stop();
+    } else if (!fixed && ++replies == want.size()) {
+      fixed = true;                     // reply to the last toggle
+      for (size_t i = 0; i < want.size(); i++) {
+        if (std::find(have.begin(), have.end(), want[i]) == have.end()) board.text("STREAM " + want[i]);
+      }
+      if (rate) board.text("SET STREAM_RATE " + std::to_string(rate));
+    }
+  };
+  if (want.empty() && rate) board.text("SET STREAM_RATE " + std::to_string(rate));
+
+  board.onStream = [&](const hover::StreamFrame &s) {
+    if (!open) {
+      const hover::Decoder &d = port->decoder();
+      if (s.values.empty() || (!want.empty() && !sameSet(d.streamNames(), want))) return;
+      if (!log.open(path, d.streamNames(), d.streamLayout(), tickHz)) {
+        perror(path.c_str());
+        loop.stop();
+        return;
+      }
+      want = d.streamNames();
+      open = true;
+      fprintf(stderr, "recording %zu channels to %s\n", want.size(), path.c_str());
+    }
+    if (!log.add(s)) mismatch++;
+  };
+  loop.every(1000, [&]() {
+    if (!open) return;
+    log.flush();
+    fprintf(stderr, "\r%llu records, %u lost, %u skipped ", (unsigned long long)log.records(),
+            port->decoder().stats().streamLost, mismatch);
+  });
+
+  loopStop = &loop;
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  loop.run();
+  if (rate) {
+    board.text("SET STREAM_RATE 0");
+    loop.runOnce(0);
+  }
+  if (open && !log.close()) {
+    perror(path.c_str());
+    return 1;
+  }
+  fprintf(stderr, "\n");
+  return 0;
+}
+
+static int info(int argc, char **argv)
+{
+  hover::LogReader log;
+  if (argc - optind != 1 || !log.open(argv[optind])) return usage();
+  const hover::LogHeader &h = log.header();
+  printf("channels:   %zu, record %u bytes, %u Hz ticks\n", log.channels(), h.recordSize, h.tickHz);
+  for (size_t i = 0; i < log.channels(); i++) printf("  %s\n", log.name(i).c_str());
+  printf("records:    %zu%s\n", log.records(), log.indexed() ? "" : " (not closed, index rebuilt)");
+  if (log.records()) {
+    uint64_t lost = 0;
+    for (size_t i = 0; i < log.records(); i++) lost += log.lost(i);
+    printf("duration:   %.3f s, %llu frames lost\n", log.seconds(log.time(log.records() - 1) - log.time(0)),
+           (unsigned long long)lost);
+  }
+  return 0;
+}
+
+static int csv(int argc, char **argv)
+{
+  double from = 0, to = -1;
+  size_t buckets = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:t:n:")) != -1) {
+    switch (opt) {
+      case 'f': from    = atof(optarg);              break;
+      case 't': to      = atof(optarg);              break;
+      case 'n': buckets = strtoul(optarg, NULL, 0);  break;
+      default:  return usage();
+    }
+  }
+  hover::LogReader log;
+  if (argc - optind != 1 || !log.open(argv[optind])) return usage();
+  if (!log.records()) return 0;
+
+  uint64_t base = log.time(0), end = log.time(log.records() - 1) + 1;
+  uint64_t t0 = base + (uint64_t)(from * log.header().tickHz);
+  uint64_t t1 = to < 0 ? end : std::min(end, base + (uint64_t)(to * log.header().tickHz));
+  printf("time");
+  for (size_t c = 0; c < log.channels(); c++) {
+    if (buckets) printf(",%s_min,%s_max", log.name(c).c_str(), log.name(c).c_str());
+    else printf(",%s", log.name(c).c_str());
+  }
+  printf("\n");
+
+  if (buckets) {
+    std::vector<std::vector<hover::LogRange> > r;
+    for (size_t c = 0; c < log.channels(); c++) r.push_back(log.downsample(c, t0, t1, buckets));
+    for (size_t b = 0; b < buckets && t1 > t0; b++) {
+      if (r[0][b].min > r[0][b].max) continue;            // no records in this bucket
+      printf("%.4f", log.seconds(t0 + (t1 - t0) * b / buckets - base));
+      for (size_t c = 0; c < log.channels(); c++) printf(",%d,%d", r[c][b].min, r[c][b].max);
+      printf("\n");
+    }
+    return 0;
+  }
+  for (size_t i = log.find(t0); i < log.records() && log.time(i) < t1; i++) {
+    printf("%.5f", log.seconds(log.time(i) - base));
+    for (size_t c = 0; c < log.channels(); c++) printf(",%d", log.value(i, c));
+    printf("\n");
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2) return usage();
+  std::string cmd = argv[1];
+  optind = 2;
+  if (cmd == "record") return record(argc, argv);
+  if (cmd == "info")   return info(argc, argv);
+  if (cmd == "csv")    return csv(argc, argv);
+  return usage();
+}
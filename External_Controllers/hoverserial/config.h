@@ -10,6 +10,8 @@
 
 #define THROTTLE_MAX 1000
 #define THROTTLE_REVERSE_MAX (THROTTLE_MAX * 3 / 10)
+#define THROTTLE_CURVE_N 5
+#define THROTTLE_CURVE {93, 240, 440, 693, 1000}   // throttle response at 20, 40 .. 100 % of THROTTLE_MAX, linear in between. Same default as INPUT_CURVE of the firmware, tunable over telemetry (THR_CRVx)
 
 #define THROTTLE0_PIN 32
 #define THROTTLE1_PIN 35
@@ -21,15 +23,64 @@
 #define RX1 18
 #define TX1 5
 // ########################## DEFINES ##########################
-#define HOVER_SERIAL_BAUD 115200 // [-] Baud rate for HoverSerial (used to communicate with the hoverboard)
+#define HOVER_SERIAL_HW          // [-] Use the ESP32 hardware UARTs 1/2 for the boards (comment-out for SoftwareSerial)
+#define HOVER_SERIAL_BAUD 115200 // [-] Baud rate for HoverSerial (used to communicate with the hoverboard), the hardware UARTs allow more
+#define HOVER_SERIAL_RX_BUF 256  // [bytes] Rx ring buffer per hardware UART, holds several feedback frames between control ticks
+// #define HOVER_SERIAL_FAST_BAUD 1000000 // [-] Negotiate this rate with the boards (SERIAL_BAUD_NEGOTIATION on the board side), HOVER_SERIAL_HW only
 #define SERIAL_BAUD 115200       // [-] Baud rate for built-in Serial (used for the Serial Monitor)
-#define START_FRAME 0xABCD       // [-] Start frame definition for reliable serial communication
-#define TIME_SEND 20             // [ms] Sending time interval
+#define TRACTION_CONTROL         // [-] Share torque between the four wheels (traction.cpp). Needs TRQ_MODE and FEEDBACK_FAST on both boards (comment-out to disable)
+#define CONTROL_HZ 200           // [Hz] Control tick from a hardware timer: input sampling and one command per board, one per fast feedback frame
+#define CONTROL_CORE 1           // [-] Core of the control task (ticks, board links, inputs)
+#define CONTROL_PRIO (configMAX_PRIORITIES - 2) // [-] FreeRTOS priority of the control task, above everything else on its core
+#define CONTROL_STACK 4096       // [bytes] Stack of the control task
+#define UI_CORE 0                // [-] Core of the UI task (display, monitor prints, Bluetooth)
+#define UI_PRIO 1                // [-] FreeRTOS priority of the UI task
+#define UI_STACK 4096            // [bytes] Stack of the UI task
+#define UI_MS 100                // [ms] Serial monitor print interval
+#define RX_CHUNK 64              // [bytes] Block read out of the Rx buffer per call
+#define TC_SLIP_MAX 0.15f        // [-] allowed wheel speed excess over the reference, relative
+#define TC_SLIP_RPM 20           // [rpm] allowed wheel speed excess over the reference, absolute (low speed dead band)
+#define TC_CUT 2.0f              // [-] torque scale reduction per unit of relative over-slip, per feedback frame
+#define TC_RECOVER 0.02f         // [-] torque scale recovery per feedback frame without slip (0.2 -> 1 in 40 frames = 200 ms)
+#define TC_SCALE_MIN 0.2f        // [-] lowest torque scale of a slipping wheel
+#define TC_STALE_MS 30           // [ms] feedback older than this on either board disables the correction
+#define DIFFERENTIAL             // [-] Electronic differential (differential.cpp): Ackermann wheel speed ratios from WHEELBASE, WHEEL_WIDTH and STEERING_TO_WHEEL_DIST (comment-out for equal commands)
+// #define ED_SPD_MODE           // [-] Boards in SPD_MODE: the ratios scale the speed targets, no speed feedback correction
+#define ED_KP 2                  // [-] torque per rpm a wheel is behind its Ackermann share of the vehicle speed (TRQ_MODE)
+#define ED_CORR_MAX 25           // [%] limit of that correction, relative to the throttle
+#define SUPERVISOR               // [-] Zero a board that stops answering or reports a motor fault, limp on the other one (supervisor.cpp), comment-out to disable
+#define SUP_STALE_MS 30          // [ms] feedback older than this marks a board bad, a few frames with FEEDBACK_FAST
+#define SUP_RAMP_MS 200          // [ms] ramp of the command scale between zero and full
+#define SUP_LIMP_PCT 30          // [%] command scale of the remaining board in limp mode
+#define SUP_RECOVER_MS 1000      // [ms] both boards good for this long and the throttle released before full commands again
+#define SUP_REARM_THR 50         // [-] throttle below this counts as released
+#define HOVER_SYNC_LATCH         // [-] Send both boards a held command, then latch frames, so front and rear apply targets together (comment-out for plain commands)
 // #define DEBUG_RX                        // [-] Debug received data. Prints all bytes to serial (comment-out to disable)
+// #define DEBUG_FEEDBACK                  // [-] Print every valid feedback frame to serial (comment-out to disable)
 
 #define SCREEN_ADDRESS 0x3C ///< See datasheet for Address; 0x3D for 128x64, 0x3C for 128x32
 #define SCREEN_WIDTH 128 // OLED display width, in pixels
 #define SCREEN_HEIGHT 64 // OLED display height, in pixels
+// #define GAMEPAD_INPUT         // [-] Throttle and steering from a Bluetooth gamepad (Bluepad32 board package) instead of the analog pins
+#define GAMEPAD_DEADMAN 0x0020   // [-] Button mask that must be held to drive, 0x0020 = R1 (BUTTON_SHOULDER_R)
+#define GAMEPAD_TIMEOUT_MS 100   // [ms] No poll with the gamepad connected for this long stops the commands, the boards then stop on their serial timeout
+#define GAMEPAD_DEAD_ZONE 40     // [-] Steering dead zone, in [-THROTTLE_MAX, THROTTLE_MAX]
+#define BT_TELEMETRY             // [-] Stream both boards over Bluetooth SPP and accept tuning requests (telemetry.cpp), comment-out to disable
+#define BT_NAME "ESP32_BobbyCon" // [-] Bluetooth device name
+#define TELEM_HZ 50              // [Hz] Telemetry frame rate, at most 1000 / DASH_POLL_MS
+#define TELEM_BATCH 4            // [-] Frames per Bluetooth write
+#define TELEM_LAYOUT_MS 2000     // [ms] Repeat interval of the "# stream" and "# params" lines, also sent on connect
+#define TELEM_BIN_MAX 8          // [-] Max parameters per tuning request
+#if defined(GAMEPAD_INPUT) && defined(BT_TELEMETRY)
+  #error Bluepad32 owns the Bluetooth stack, GAMEPAD_INPUT cannot be used with BT_TELEMETRY
+#endif
+#define DASH_MS 100              // [ms] Dashboard render interval, only rows whose text changed are drawn
+#define DASH_PAGES 2             // [-] Display pages (8 pixel rows) sent per UI pass, about 3 ms each at DASH_I2C_HZ
+#define DASH_POLL_MS 10          // [ms] UI pass interval
+#define DASH_I2C_HZ 400000       // [Hz] I2C clock for the display
+#define DASH_I2C_CHUNK 64        // [bytes] Data bytes per I2C transfer, below the Wire buffer size
+#define DASH_STALE_MS 500        // [ms] Feedback older than this shows LINK as the board fault
 
-#define BUFFERSIZE 256
-#define VAL_CNT 3
+#define VAL_CNT 3                // [-] Analog input channels: 0 throttle, 1 steering, 2 spare
+#define FILT_MED_N {5, 5, 5}     // [-] Analog input filter per channel: median of the last 1, 3 or 5 samples (spike rejection, delay (N - 1) / 2 ticks), then
+#define FILT_SHIFT {2, 2, 2}     // [-] two cascaded EMAs with coefficient 2^-FILT_SHIFT, delay about 2 * (2^FILT_SHIFT - 1) ticks
@@ -755,3 +755,8 @@ calculate_crc32c(uint32_t crc32c,
 		return (multitable_crc32c(crc32c, buffer, length));
 	}
 }
+
+uint32_t calc_crc32(const unsigned char *buffer,
+    unsigned int length){
+		return calculate_crc32c(1,buffer,length);
+}
@@ -0,0 +1,101 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <Wire.h>
+#include "defines.h"
+#include "config.h"
+#include "dashboard.h"
+
+#define DASH_COLS  21           // [-] characters per row at text size 1
+#define DASH_ROWS  (SCREEN_HEIGHT / 8)
+
+static Adafruit_SSD1306 *dsp;
+static uint8_t dspAddr;
+static char shown[DASH_ROWS][DASH_COLS + 1];  // text rendered per row
+static uint8_t dirty;           // pages rendered but not sent yet, one bit per page
+static uint8_t next;            // page the next send starts the search at, round robin
+static unsigned long renderMs;
+
+static void command(const uint8_t *c, uint8_t n)
+{
+  Wire.beginTransmission(dspAddr);
+  Wire.write((uint8_t)0x00);    // control byte: command stream
+  Wire.write(c, n);
+  Wire.endTransmission();
+}
+
+// One page of the framebuffer: column window 0..127 and page window page..page, then the data in I2C sized chunks
+static void sendPage(uint8_t page)
+{
+  const uint8_t win[] = {SSD1306_COLUMNADDR, 0, SCREEN_WIDTH - 1, SSD1306_PAGEADDR, page, page};
+  const uint8_t *buf = dsp->getBuffer() + page * SCREEN_WIDTH;
+
+  command(win, sizeof(win));
+  for (uint8_t i = 0; i < SCREEN_WIDTH; i += DASH_I2C_CHUNK)
+  {
+    Wire.beginTransmission(dspAddr);
+    Wire.write((uint8_t)0x40);  // control byte: data stream
+    Wire.write(buf + i, MIN(DASH_I2C_CHUNK, SCREEN_WIDTH - i));
+    Wire.endTransmission();
+  }
+}
+
+static void row(uint8_t r, const char *fmt, ...)
+{
+  char text[DASH_COLS + 1];
+  va_list ap;
+
+  if (r >= DASH_ROWS)
+    return;
+  va_start(ap, fmt);
+  vsnprintf(text, sizeof(text), fmt, ap);
+  va_end(ap);
+  if (strcmp(text, shown[r]) == 0)
+    return;
+  strcpy(shown[r], text);
+  // Text size 1 with a background colour overwrites the whole row, the padding clears what the old text left
+  dsp->setCursor(0, r * 8);
+  dsp->printf("%-21s", text);
+  dirty |= 1 << r;
+}
+
+void dashInit(Adafruit_SSD1306 *d, uint8_t addr)
+{
+  dsp = d;
+  dspAddr = addr;
+  Wire.setClock(DASH_I2C_HZ);
+  dsp->clearDisplay();
+  dsp->setTextSize(1);
+  dsp->setTextColor(SSD1306_WHITE, SSD1306_BLACK);
+  dsp->setTextWrap(false);
+  dsp->display();               // the only full transfer
+  memset(shown, 0, sizeof(shown));
+  dirty = 0;
+}
+
+void dashUpdate(const DashData *v, unsigned long now)
+{
+  if (dsp == NULL)
+    return;
+
+  if (dirty == 0 && now - renderMs >= DASH_MS)
+  {
+    renderMs = now;
+    row(0, "speed %6d rpm", v->speed);
+    row(1, "thr %5d str %5d", v->throttle, v->steering);
+    row(2, "T%5d%5d%5d%5d", v->torque[0], v->torque[1], v->torque[2], v->torque[3]);
+    row(3, "bat %5.2f %5.2f V", v->batVoltage[0] / 100.0, v->batVoltage[1] / 100.0);
+    row(4, "tmp %5.1f %5.1f C", v->boardTemp[0] / 10.0, v->boardTemp[1] / 10.0);
+    row(5, "flt F %-4s R %-4s", v->fault[0], v->fault[1]);
+    row(6, "bad %lu %lu", (unsigned long)v->bad[0], (unsigned long)v->bad[1]);
+    row(7, "%-4s miss %lu", v->mode, (unsigned long)v->tickMissed);
+  }
+
+  for (uint8_t n = 0; n < DASH_PAGES && dirty; n++)
+  {
+    while (!(dirty & (1 << next)))
+      next = (next + 1) % DASH_ROWS;
+    sendPage(next);
+    dirty &= ~(1 << next);
+  }
+}
@@ -0,0 +1,32 @@
+// *******************************************************************
+//  Incremental dashboard on the SSD1306 OLED
+// *******************************************************************
+// One text row per 8 pixel display page. dashUpdate() re-renders only the rows whose text changed and sends only
+// those pages over I2C, at most DASH_PAGES per call, instead of the whole 1 KB framebuffer with display().
+// Rendering is rate limited to one pass per DASH_MS. Pages left over are sent by the next calls.
+#ifndef DASHBOARD_H
+#define DASHBOARD_H
+
+#include <stdint.h>
+#include <Adafruit_SSD1306.h>
+
+// Values shown, both boards: index 0 front, 1 rear
+typedef struct
+{
+  int speed;                    // [rpm] vehicle speed, median of the wheels
+  int throttle;
+  int steering;
+  int torque[4];
+  int batVoltage[2];            // [V*100]
+  int boardTemp[2];             // [degC*10]
+  const char *fault[2];         // short fault text, "ok" when none
+  uint32_t bad[2];              // rejected frames
+  uint32_t tickMissed;
+  const char *mode;             // supervisor state, supText()
+} DashData;
+
+void dashInit(Adafruit_SSD1306 *d, uint8_t addr);
+// Call it often: returns at once while nothing is due, one call sends at most DASH_PAGES pages
+void dashUpdate(const DashData *v, unsigned long now);
+
+#endif // DASHBOARD_H
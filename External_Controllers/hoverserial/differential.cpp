@@ -0,0 +1,96 @@
+#include <math.h>
+#include <stdlib.h>
+#include "defines.h"
+#include "config.h"
+#include "differential.h"
+
+#define ED_TABLE_N 17           // [-] table points over the steering input 0..THROTTLE_MAX, linear in between
+
+int edKp = ED_KP;               // tunable at run time (telemetry.cpp)
+int edCorrMax = ED_CORR_MAX;
+
+// Radius ratios per table point [Q12]: front inner, front outer, rear inner, rear outer
+static uint16_t table[ED_TABLE_N][4];
+
+/* Geometry, in the units of WHEELBASE: the kingpins are WHEEL_WIDTH apart, the tyres STEERING_TO_WHEEL_DIST outside
+ * of them, the rear wheels on the same track as the front ones. With the curvature c = tan(angle) / WHEELBASE of the
+ * rear axle centre, the radii relative to its radius are 1 -+ c (W/2 + d) at the rear and
+ * sqrt((c L)^2 + (1 -+ c W/2)^2) -+ c d at the front, where the steered tyre sits on the line to the turn centre. */
+void edInit(void)
+{
+  const float h = WHEEL_WIDTH / 2.0f;
+  const float d = STEERING_TO_WHEEL_DIST;
+
+  for (uint8_t i = 0; i < ED_TABLE_N; i++)
+  {
+    float c = tanf((float)THROTTLE_MAX * i / (ED_TABLE_N - 1) * STEERING_EAGLE_FACTOR) / WHEELBASE;
+    float r[4];
+    r[0] = sqrtf(c * WHEELBASE * c * WHEELBASE + (1.0f - c * h) * (1.0f - c * h)) - c * d;
+    r[1] = sqrtf(c * WHEELBASE * c * WHEELBASE + (1.0f + c * h) * (1.0f + c * h)) + c * d;
+    r[2] = MAX(1.0f - c * (h + d), 0.0f);
+    r[3] = 1.0f + c * (h + d);
+    float mean = (r[0] + r[1] + r[2] + r[3]) / 4.0f;
+    for (uint8_t j = 0; j < 4; j++)
+      table[i][j] = (uint16_t)lroundf(r[j] / mean * ED_ONE);
+  }
+}
+
+// Ratios of the four wheels in wheel order, the inner side is the left one for positive steering
+static void ratios(int steer, int *k)
+{
+  int s = MIN(abs(steer), THROTTLE_MAX) * (ED_TABLE_N - 1);
+  int i = s / THROTTLE_MAX;
+  int f = s % THROTTLE_MAX;
+  int r[4];
+
+  for (uint8_t j = 0; j < 4; j++)
+    r[j] = i < ED_TABLE_N - 1 ? table[i][j] + (table[i + 1][j] - table[i][j]) * f / THROTTLE_MAX : table[i][j];
+  bool left = steer >= 0;
+  k[0] = left ? r[0] : r[1];
+  k[1] = left ? r[1] : r[0];
+  k[2] = left ? r[2] : r[3];
+  k[3] = left ? r[3] : r[2];
+}
+
+int edRatio(int steer, uint8_t wheel)
+{
+  int k[ED_WHEELS];
+  ratios(steer, k);
+  return wheel < ED_WHEELS ? k[wheel] : ED_ONE;
+}
+
+void edNormalize(int steer, const int *speed, int *out)
+{
+  int k[ED_WHEELS];
+  ratios(steer, k);
+  for (uint8_t i = 0; i < ED_WHEELS; i++)
+    out[i] = k[i] > 0 ? speed[i] * ED_ONE / k[i] : 0;
+}
+
+void edApply(int steer, const int *speed, int *cmd)
+{
+  int k[ED_WHEELS];
+  int base = cmd[0];
+
+  ratios(steer, k);
+  for (uint8_t i = 0; i < ED_WHEELS; i++)
+    cmd[i] = CLAMP(base * k[i] / ED_ONE, -THROTTLE_MAX, THROTTLE_MAX);
+
+#ifndef ED_SPD_MODE
+  if (speed == NULL)
+    return;
+  // Vehicle speed at the mean radius: average of the two middle normalised speeds, a spinning or blocked wheel drops out
+  int n[ED_WHEELS];
+  edNormalize(steer, speed, n);
+  for (uint8_t i = 0; i < ED_WHEELS - 1; i++)
+    for (uint8_t j = i + 1; j < ED_WHEELS; j++)
+      if (n[j] < n[i]) { int t = n[i]; n[i] = n[j]; n[j] = t; }
+  int ref = (n[1] + n[2]) / 2;
+  int lim = abs(base) * edCorrMax / 100;   // no throttle, no correction: coasting stays free
+  for (uint8_t i = 0; i < ED_WHEELS; i++)
+  {
+    int e = ref * k[i] / ED_ONE - speed[i];
+    cmd[i] = CLAMP(cmd[i] + CLAMP(e * edKp, -lim, lim), -THROTTLE_MAX, THROTTLE_MAX);
+  }
+#endif
+}
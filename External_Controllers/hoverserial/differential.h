@@ -0,0 +1,32 @@
+// *******************************************************************
+//  Electronic differential for two mainboards (4 wheels)
+// *******************************************************************
+// Wheel order: 0 front left, 1 front right, 2 rear left, 3 rear right, as in torgue[] / wheel_rpm[].
+// With Ackermann steering every wheel rolls on its own circle around the turn centre, which lies on the
+// rear axle line. edApply() scales the common command of each wheel by its radius over the mean radius,
+// so the sum of the four commands stays the throttle. In TRQ_MODE the measured wheel speeds are also
+// pulled towards the same ratios, a wheel behind its share gets more torque and one ahead gets less.
+// The radius ratios are tabulated once by edInit(), edApply() and edNormalize() only use integers.
+#ifndef DIFFERENTIAL_H
+#define DIFFERENTIAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ED_WHEELS 4
+#define ED_ONE    4096          // [-] ratio 1.0 of the radius ratios, Q12
+
+extern int edKp;                // [-] ED_KP, run time value
+extern int edCorrMax;           // [%] ED_CORR_MAX, run time value
+
+void edInit(void);
+// steer: steering input [-THROTTLE_MAX, THROTTLE_MAX], positive turns left. cmd: commands [-THROTTLE_MAX, THROTTLE_MAX],
+// the same value on all wheels on entry, distributed in place. speed: measured wheel speeds [rpm], forward positive,
+// NULL while the feedback is stale
+void edApply(int steer, const int *speed, int *cmd);
+// Wheel speeds divided by their radius ratio: all equal when every wheel rolls without scrub, for the traction control
+void edNormalize(int steer, const int *speed, int *out);
+// Radius ratio of one wheel at the steering input [Q12], for display
+int edRatio(int steer, uint8_t wheel);
+
+#endif // DIFFERENTIAL_H
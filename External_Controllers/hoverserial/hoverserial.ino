@@ -23,12 +23,12 @@
 //   #define FEEDBACK_SERIAL_USART2
 //   // #define DEBUG_SERIAL_USART2
 // *******************************************************************
+#ifndef HOVER_SERIAL_HW
 #include <SoftwareSerial.h>
-#include <BluetoothSerial.h> //Header File for Serial Bluetooth, will be added by default into Arduino
+#endif
 #include <Wire.h>
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
-// #include <Bluepad32.h>
 #include <math.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -39,11 +39,32 @@
 
 #include "defines.h"
 #include "config.h"
+#ifdef BT_TELEMETRY
+#include <BluetoothSerial.h> //Header File for Serial Bluetooth, will be added by default into Arduino
+#endif
+#ifdef GAMEPAD_INPUT
+#include <Bluepad32.h>
+#endif
+#include "protocol.h"            // symlink to Inc/protocol.h, the wire format shared with the firmware
+#include "traction.h"
+#include "differential.h"
+#include "supervisor.h"
+#include "dashboard.h"
+#include "telemetry.h"
+
+extern "C" uint32_t calc_crc32(const unsigned char *buffer, unsigned int length);
 
 //LiquidCrystal_I2C lcd(0x27, 20, 4);  //Hier wird das Display benannt (Adresse/Zeichen pro Zeile/Anzahl Zeilen). In unserem Fall „lcd“. Die Adresse des I²C Displays kann je nach Modul variieren.
+#ifdef HOVER_SERIAL_HW
+HardwareSerial HoverSerial_front(1);        // ESP32 UART1, pins set in setup()
+HardwareSerial HoverSerial_rear(2);         // ESP32 UART2
+#else
 SoftwareSerial HoverSerial_front(RX0, TX0); // RX, TX
 SoftwareSerial HoverSerial_rear(RX1, TX1);  // RX, TX
-// BluetoothSerial ESP_BT; //Object for Bluetooth
+#endif
+#ifdef BT_TELEMETRY
+BluetoothSerial ESP_BT;                     // SPP link for the telemetry bridge (telemetry.cpp)
+#endif
 
 
 // Declaration for an SSD1306 display connected to I2C (SDA, SCL pins)
@@ -54,30 +75,12 @@ SoftwareSerial HoverSerial_rear(RX1, TX1);  // RX, TX
 Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire);
 
 
-uint32_t index_buff_vals[VAL_CNT];
-uint32_t buff_vals[VAL_CNT][BUFFERSIZE];
-uint32_t cur_buff_val_sum[VAL_CNT];
+uint16_t filt_vals[VAL_CNT][2];          // analog input filter states, value * 16
+uint16_t filt_hist[VAL_CNT][5];          // last raw samples per channel for the median
+uint8_t filt_idx[VAL_CNT];               // next slot in filt_hist
 bool dsp_connected;
-typedef struct
-{
-  uint16_t start;
-  int16_t steer;
-  int16_t speed_per_wheel;
-  uint16_t checksum;
-} SerialCommand;
-
-typedef struct
-{
-  uint16_t start;
-  int16_t cmd1;
-  int16_t cmd2;
-  int16_t speedR_meas;
-  int16_t speedL_meas;
-  int16_t batVoltage;
-  int16_t boardTemp;
-  uint16_t cmdLed;
-  uint16_t checksum;
-} SerialFeedback;
+typedef ProtoCommand SerialCommand;
+typedef ProtoFeedback SerialFeedback;
 
 // ########################## SETUP ##########################
 void setup()
@@ -85,88 +88,114 @@ void setup()
   Serial.begin(SERIAL_BAUD);
   Serial.println("Hoverboard Serial v1.0");
   Wire.begin(I2C_SDA, I2C_SCL);
-  // ESP_BT.begin("ESP32_BobbyCon"); //Name of your Bluetooth Signal
+#ifdef BT_TELEMETRY
+  ESP_BT.begin(BT_NAME);
+  telemInit(&ESP_BT);
+#endif
   pinMode(THROTTLE0_PIN,INPUT);
   pinMode(STEERING_PIN,INPUT);
+#ifdef DIFFERENTIAL
+  edInit();
+#endif
   scan_i2c();
   if(!(dsp_connected = display.begin(SSD1306_SWITCHCAPVCC, SCREEN_ADDRESS)))
     Serial.println("SSD1306 allocation failed");
   else
-    display.display();
+    dashInit(&display, SCREEN_ADDRESS);
   //lcd.init(); //Im Setup wird der LCD gestartet
   //lcd.backlight(); //Hintergrundbeleuchtung einschalten (0 schaltet die Beleuchtung aus).
 
 
+#ifdef HOVER_SERIAL_HW
+  // The UART driver fills the Rx ring buffer from the FIFO interrupt, both boards receive concurrently
+  HoverSerial_front.setRxBufferSize(HOVER_SERIAL_RX_BUF);
+  HoverSerial_rear.setRxBufferSize(HOVER_SERIAL_RX_BUF);
+  HoverSerial_front.begin(HOVER_SERIAL_BAUD, SERIAL_8N1, RX0, TX0);
+  HoverSerial_rear.begin(HOVER_SERIAL_BAUD, SERIAL_8N1, RX1, TX1);
+#ifdef HOVER_SERIAL_FAST_BAUD
+  BaudInit();
+#endif
+#else
   HoverSerial_front.begin(HOVER_SERIAL_BAUD);
 
   HoverSerial_rear.begin(HOVER_SERIAL_BAUD);
+#endif
   pinMode(LED_BUILTIN, OUTPUT);
 
   for (int i = 0; i < VAL_CNT; i++)
   {
-    cur_buff_val_sum[i] = index_buff_vals[i] = 0;
-    for (int j = 0; j < BUFFERSIZE; j++)
-      cur_buff_val_sum[i] += (buff_vals[i][j] = ADC_MID);
+    filt_vals[i][0] = filt_vals[i][1] = ADC_MID << 4;
+    for (int j = 0; j < 5; j++)
+      filt_hist[i][j] = ADC_MID;
   }
   //init_debug_screen();
+  xTaskCreatePinnedToCore(controlTask, "control", CONTROL_STACK, NULL, CONTROL_PRIO, &controlHandle, CONTROL_CORE);
+  xTaskCreatePinnedToCore(uiTask, "ui", UI_STACK, NULL, UI_PRIO, NULL, UI_CORE);
+#ifdef GAMEPAD_INPUT
+  BP32.setup(&onPadConnected, &onPadDisconnected);
+  xTaskCreatePinnedToCore(gamepadTask, "gamepad", UI_STACK, NULL, UI_PRIO + 1, NULL, UI_CORE);
+#endif
+  TickInit();
 }
 
-// ########################## LOOP ##########################
-
-unsigned long iTimeSend = 0;
+// Control tick from a hardware timer, it wakes the control task (see TASKS)
+hw_timer_t *tickTimer = NULL;
+TaskHandle_t controlHandle = NULL;
+uint32_t tickMissed = 0;        // ticks the control task was too late for, at most one control step runs per wake up
 
-uint32_t value_buffer(uint32_t in, int val)
+void IRAM_ATTR onTick(void)
 {
-  cur_buff_val_sum[val] -= buff_vals[val][index_buff_vals[val]];
-  cur_buff_val_sum[val] += (buff_vals[val][index_buff_vals[val]] = in);
-  index_buff_vals[val] = (index_buff_vals[val] + 1) % (BUFFERSIZE);
-  return (cur_buff_val_sum[val] / (BUFFERSIZE));
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(controlHandle, &woken);
+  portYIELD_FROM_ISR(woken);
 }
 
-void draw(void) {
-  display.clearDisplay();
+void TickInit(void)
+{
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+  tickTimer = timerBegin(1000000);                        // [Hz] 1 us resolution
+  timerAttachInterrupt(tickTimer, &onTick);
+  timerAlarm(tickTimer, 1000000 / CONTROL_HZ, true, 0);
+#else
+  tickTimer = timerBegin(0, 80, true);                    // 80 MHz APB / 80 = 1 us resolution
+  timerAttachInterrupt(tickTimer, &onTick, true);
+  timerAlarmWrite(tickTimer, 1000000 / CONTROL_HZ, true);
+  timerAlarmEnable(tickTimer);
+#endif
+}
 
-  display.setTextSize(1);      // Normal 1:1 pixel scale
-  display.setTextColor(SSD1306_WHITE); // Draw white text
-  display.setCursor(0, 0);     // Start at top-left corner
-  display.cp437(true);         // Use full 256 char 'Code Page 437' font
+// Compare-exchange, the building block of the sorting networks: a fixed sequence, no data dependent loops
+#define CSWAP(a, b) do { if ((a) > (b)) { int t_ = (a); (a) = (b); (b) = t_; } } while (0)
 
-  // Not all the characters will fit on the display. This is normal.
-  // Library will draw what it can and the rest will be clipped.
-  for(int16_t i=0; i<256; i++) {
-    if(i == '\n') display.write(' ');
-    else          display.write(i);
+// Median of the last FILT_MED_N samples of the channel, then two cascaded EMAs with its FILT_SHIFT, the EMAs are
+// the same as ema2Step in the firmware (Src/filters.c). The median drops single spikes the EMAs would smear out.
+// Values up to 4095
+uint32_t value_buffer(uint32_t in, int val)
+{
+  static const uint8_t medN[VAL_CNT] = FILT_MED_N;
+  static const uint8_t shift[VAL_CNT] = FILT_SHIFT;
+  uint16_t *h = filt_hist[val];
+  int m[5];
+
+  h[filt_idx[val]] = in;
+  filt_idx[val] = filt_idx[val] + 1 < medN[val] ? filt_idx[val] + 1 : 0;
+  if (medN[val] == 5)
+  { // 7 comparators, only the middle element is needed
+    m[0] = h[0]; m[1] = h[1]; m[2] = h[2]; m[3] = h[3]; m[4] = h[4];
+    CSWAP(m[0], m[1]); CSWAP(m[3], m[4]); CSWAP(m[0], m[3]);
+    CSWAP(m[1], m[4]); CSWAP(m[1], m[2]); CSWAP(m[2], m[3]);
+    CSWAP(m[1], m[2]);
+    in = m[2];
   }
-
-  display.display();
-  delay(2000);
-}
-
-void testscrolltext(void) {
-  display.clearDisplay();
-
-  display.setTextSize(2); // Draw 2X-scale text
-  display.setTextColor(SSD1306_WHITE);
-  display.setCursor(10, 0);
-  display.println(F("scroll"));
-  display.display();      // Show initial text
-  delay(100);
-
-  // Scroll in various directions, pausing in-between:
-  display.startscrollright(0x00, 0x0F);
-  delay(2000);
-  display.stopscroll();
-  delay(1000);
-  display.startscrollleft(0x00, 0x0F);
-  delay(2000);
-  display.stopscroll();
-  delay(1000);
-  display.startscrolldiagright(0x00, 0x07);
-  delay(2000);
-  display.startscrolldiagleft(0x00, 0x07);
-  delay(2000);
-  display.stopscroll();
-  delay(1000);
+  else if (medN[val] == 3)
+  {
+    m[0] = h[0]; m[1] = h[1]; m[2] = h[2];
+    CSWAP(m[0], m[1]); CSWAP(m[1], m[2]); CSWAP(m[0], m[1]);
+    in = m[1];
+  }
+  filt_vals[val][0] += ((int32_t)(in << 4) - filt_vals[val][0]) >> shift[val];
+  filt_vals[val][1] += ((int32_t)filt_vals[val][0] - filt_vals[val][1]) >> shift[val];
+  return (filt_vals[val][1] + 8) >> 4;
 }
 
 /*
@@ -240,11 +269,17 @@ int clean_adc_half(uint32_t inval)
   return outval * (THROTTLE_MAX / 2) / (ADC_MAX - DEAD_ZONE * 3);
 }
 
-int throttle_calc(int cleaned_adc)
+int throttleCurve[THROTTLE_CURVE_N] = THROTTLE_CURVE;   // tunable at run time (telemetry.cpp)
+
+// Throttle response: linear interpolation between (0, 0) and the throttleCurve points, reverse scaled to THROTTLE_REVERSE_MAX
+int throttle_curve(int cleaned_adc)
 {
-  return cleaned_adc < 0 ?
-    ((cleaned_adc * cleaned_adc / THROTTLE_MAX) * (-2) + cleaned_adc) / 3 *THROTTLE_REVERSE_MAX / THROTTLE_MAX
-    : ((cleaned_adc * cleaned_adc / THROTTLE_MAX) * 2 + cleaned_adc) / 3;
+  const int step = THROTTLE_MAX / THROTTLE_CURVE_N;
+  int x = MIN(abs(cleaned_adc), THROTTLE_MAX);
+  int k = MIN(x / step, THROTTLE_CURVE_N - 1);
+  int y0 = k ? throttleCurve[k - 1] : 0;
+  int y = y0 + (throttleCurve[k] - y0) * (x - k * step) / step;
+  return cleaned_adc < 0 ? -y * THROTTLE_REVERSE_MAX / THROTTLE_MAX : y;
 }
 
 int calc_torque(int throttle, int breaks)
@@ -263,74 +298,130 @@ int calc_torque(int throttle, int breaks)
   }
 }
 
-float calc_steering_eagle(int inval)
+// steering: [-THROTTLE_MAX, THROTTLE_MAX], STEERING_EAGLE_FACTOR turns it into the angle. speed: wheel speeds or NULL when stale
+inline void calc_torque_per_wheel(int throttle, int steering, const int *speed, int *torque)
 {
-  return (float)inval * STEERING_EAGLE_FACTOR;
+  torque[0] = torque[1] = torque[2] = torque[3] = throttle;
+#ifdef DIFFERENTIAL
+  edApply(steering, speed, torque);
+#endif
 }
 
-inline void calc_torque_per_wheel(int throttle, float steering_eagle, int *torque)
+// Median of four: mean of the two middle values, 5 comparators
+int median4(const int *x)
 {
-    torque[0] = torque[1] = torque[2] = torque[3] = throttle;
+  int a = x[0], b = x[1], c = x[2], d = x[3];
+  CSWAP(a, b); CSWAP(c, d); CSWAP(a, c); CSWAP(b, d); CSWAP(b, c);
+  return (b + c) / 2;
 }
 
-inline void swp(int *x, int *y)
-{
-  int tmp = *x;
-  *x = *y;
-  *y = tmp;
-}
-inline void sort_array(int x[], int cnt)
-{
-  for (int y = 0; y < cnt - 1; y++)
-    for (int z = y + 1; z < cnt; z++)
-      if (x[y] > x[z])
-        swp(&x[y], &x[z]);
-}
-int calc_median(int x[], int cnt)
+// ########################## LINKS ##########################
+#define SEQ_HIST 16             // [-] command send times kept for the round trip measurement, power of 2
+
+// Per board state: frame parser, so both ports can be drained in the same loop, and command timing
+typedef struct
 {
-  sort_array(x, cnt);
-  if (cnt % 2)
-    return x[cnt / 2];
-  else
-    return (x[cnt / 2] + x[cnt / 2 + 1]) / 2;
-}
+  Stream *port;
+  SerialFeedback frame;         // frame being assembled
+  uint8_t idx;                  // bytes in frame
+  byte prev;                    // previous byte, for the start frame detection
+  SerialFeedback last;          // last valid feedback
+  uint32_t good;                // valid frames
+  uint32_t bad;                 // wrong checksum or protocol version
+  uint8_t badVersion;           // protocol version of the last frame rejected for it, 0 = none
+  uint16_t seq;                 // next command sequence number
+  unsigned long sentMs[SEQ_HIST]; // [ms] send time per seq
+  long rttMs;                   // [ms] last round trip, board turnaround removed, -1 = unknown
+  unsigned long rxMs;           // [ms] arrival of the last valid feedback
+#if defined(HOVER_SERIAL_HW) && defined(HOVER_SERIAL_FAST_BAUD)
+  HardwareSerial *hw;           // same port, for the baud rate change
+  uint32_t baud;                // [baud] current rate
+  uint16_t baudSeq;             // seq of the last PROTO_CMD_BAUD frame
+  unsigned long baudMs;         // [ms] last request or switch
+#endif
+} HoverLink;
+
+HoverLink link_front = {&HoverSerial_front};
+HoverLink link_rear  = {&HoverSerial_rear};
 
 // ########################## SEND ##########################
-void Send(SoftwareSerial *board, int16_t speed0, int16_t speed1)
+void Send(HoverLink *link, int16_t speed0, int16_t speed1, uint8_t flags)
 {
   SerialCommand Command;
   // Create command
-  Command.start = (uint16_t)START_FRAME;
+  Command.start = (uint16_t)PROTO_START_FRAME;
+  Command.version = PROTO_VERSION;
+  Command.caps = flags;
   Command.steer = (int16_t)speed0;
-  Command.speed_per_wheel = (int16_t)speed1;
-  Command.checksum = (uint16_t)(Command.start ^ Command.steer ^ Command.speed_per_wheel);
+  Command.speed = (int16_t)speed1;
+  Command.seq = link->seq;
+  Command.fbEcho = link->last.fbTime;     // lets the board measure the round trip on its own clock
+  if (link->good)
+    Command.caps |= PROTO_CMD_ECHO;
+  link->sentMs[link->seq & (SEQ_HIST - 1)] = millis();
+  link->seq++;
+  uint32_t now = micros();
+  Command.syncTime = now ? now : 1;       // both boards follow this clock (firmware TIME_SYNC), 0 would mean none
+  uint32_t checksum = calc_crc32((const uint8_t *)&Command, sizeof(Command) - sizeof(uint16_t) * 2);
+  Command.checksumL = (uint16_t)(checksum & 0xFFFF);
+  Command.checksumH = (uint16_t)(checksum >> 16);
 
   // Write to Serial
-  board->write((uint8_t *)&Command, sizeof(Command));
+  link->port->write((uint8_t *)&Command, sizeof(Command));
 }
 
-// ########################## RECEIVE ##########################
-// Global variables
-uint8_t idx = 0; // index_buff_vals for new data pointer
-byte *p;         // Pointer declaration for the new received data
-byte incomingByte;
-byte incomingBytePrev;
-SerialFeedback NewFeedback;
-bool Receive(SoftwareSerial *board, SerialFeedback *out)
-{
-
-  uint16_t bufStartFrame; // Buffer Start Frame
-  // byte buffer[sizeof(SerialFeedback)];
-  //  Check for new data availability in the Serial buffer
-  if (board->available())
+#if defined(HOVER_SERIAL_HW) && defined(HOVER_SERIAL_FAST_BAUD)
+#define BAUD_RETRY_MS 1000      // [ms] time between requests at the start rate
+#define BAUD_LOST_MS  300       // [ms] back to the start rate without feedback at the fast rate, the board does the same
+
+void BaudInit()
+{
+  link_front.hw = &HoverSerial_front;
+  link_rear.hw = &HoverSerial_rear;
+  link_front.baud = link_rear.baud = HOVER_SERIAL_BAUD;
+}
+
+// Request the fast rate while at the start rate and a board answers, fall back when the feedback stops
+void BaudCheck(HoverLink *link, unsigned long now)
+{
+  if (link->baud != HOVER_SERIAL_BAUD)
   {
-    incomingByte = board-> read();                            // Read the incoming byte
-    bufStartFrame = ((uint16_t)(incomingByte) << 8) | incomingBytePrev; // Construct the start frame
+    if (now - link->rxMs > BAUD_LOST_MS && now - link->baudMs > BAUD_LOST_MS)
+    {
+      link->hw->updateBaudRate(HOVER_SERIAL_BAUD);
+      link->baud = HOVER_SERIAL_BAUD;
+      link->baudMs = now;
+    }
   }
-  else
+  else if (link->good && now - link->rxMs < BAUD_LOST_MS && now - link->baudMs > BAUD_RETRY_MS)
   {
-    return false;
+    link->baudSeq = link->seq;
+    link->baudMs = now;
+    Send(link, 0, (int16_t)(HOVER_SERIAL_FAST_BAUD / 100), PROTO_CMD_BAUD);
   }
+}
+#endif
+
+// Both boards get the new targets, then the latch frames go out back to back so they switch together
+void SendSync(int16_t t0, int16_t t1, int16_t t2, int16_t t3)
+{
+#ifdef HOVER_SYNC_LATCH
+  Send(&link_front, t0, t1, PROTO_CMD_HOLD);
+  Send(&link_rear, t2, t3, PROTO_CMD_HOLD);
+  Send(&link_front, 0, 0, PROTO_CMD_LATCH);
+  Send(&link_rear, 0, 0, PROTO_CMD_LATCH);
+#else
+  Send(&link_front, t0, t1, 0);
+  Send(&link_rear, t2, t3, 0);
+#endif
+}
+
+// ########################## RECEIVE ##########################
+// Frame parser, one byte at a time. Returns true when the byte completed a new valid frame
+static bool ReceiveByte(HoverLink *link, byte incomingByte)
+{
+  uint16_t bufStartFrame = ((uint16_t)(incomingByte) << 8) | link->prev; // Construct the start frame
+  byte *p = (byte *)&link->frame;
 
 // If DEBUG_RX is defined print all incoming bytes
 #ifdef DEBUG_RX
@@ -338,66 +429,126 @@ bool Receive(SoftwareSerial *board, SerialFeedback *out)
 #endif
 
   // Copy received data
-  if (bufStartFrame == START_FRAME)
+  if (bufStartFrame == PROTO_START_FRAME)
   { // Initialize if new data is detected
-    p = (byte *)&NewFeedback;
-    *p++ = incomingBytePrev;
-    *p++ = incomingByte;
-    idx = 2;
+    p[0] = link->prev;
+    p[1] = incomingByte;
+    link->idx = 2;
   }
-  else if (idx >= 2 && idx < sizeof(SerialFeedback))
+  else if (link->idx >= 2 && link->idx < sizeof(SerialFeedback))
   { // Save the new received data
-    *p++ = incomingByte;
-    idx++;
+    p[link->idx++] = incomingByte;
   }
   // Update previous states
-  incomingBytePrev = incomingByte;
+  link->prev = incomingByte;
+
   // Check if we reached the end of the package
-  if (idx == sizeof(SerialFeedback))
+  if (link->idx == sizeof(SerialFeedback))
   {
-    uint16_t checksum;
-    checksum = (uint16_t)(NewFeedback.start ^ NewFeedback.cmd1 ^ NewFeedback.cmd2 ^ NewFeedback.speedR_meas ^ NewFeedback.speedL_meas ^ NewFeedback.batVoltage ^ NewFeedback.boardTemp ^ NewFeedback.cmdLed);
-    idx = 0; // Reset the index_buff_vals (it prevents to enter in this if condition in the next cycle)
+    uint32_t checksum = calc_crc32((const uint8_t *)&link->frame, sizeof(SerialFeedback) - sizeof(uint16_t) * 2);
+    link->idx = 0; // Reset the index (it prevents to enter in this if condition in the next cycle)
 
     // Check validity of the new data
-    if (NewFeedback.start == START_FRAME && checksum == NewFeedback.checksum)
+    // No printing here, the control task must not wait for the monitor: the UI task reports the counters
+    if (checksum != ((uint32_t)link->frame.checksumH << 16 | link->frame.checksumL))
     {
-      // Copy the new data
-      memcpy(&out, &NewFeedback, sizeof(SerialFeedback));
-
-      // Print data to built-in Serial
-      Serial.print("1: ");
-      Serial.print(out->cmd1);
-      Serial.print(" 2: ");
-      Serial.print(out->cmd2);
-      Serial.print(" 3: ");
-      Serial.print(out->speedR_meas);
-      Serial.print(" 4: ");
-      Serial.print(out->speedL_meas);
-      Serial.print(" 5: ");
-      Serial.print(out->batVoltage);
-      Serial.print(" 6: ");
-      Serial.print(out->boardTemp);
-      Serial.print(" 7: ");
-      Serial.println(out->cmdLed);
-      return true;
+      link->bad++;
+    }
+    else if (link->frame.version != PROTO_VERSION)
+    {
+      link->bad++;
+      link->badVersion = link->frame.version;
     }
     else
     {
-      Serial.println("Non-valid data skipped");
-      return false;
+      memcpy(&link->last, &link->frame, sizeof(SerialFeedback));
+      link->good++;
+      link->rxMs = millis();
+      // Only trust the echo while its send time is still in the history
+      uint16_t behind = (uint16_t)(link->seq - link->last.cmdSeq);
+      if (behind >= 1 && behind <= SEQ_HIST)
+        link->rttMs = (long)(millis() - link->sentMs[link->last.cmdSeq & (SEQ_HIST - 1)]) - link->last.cmdAge;
+      else
+        link->rttMs = -1;
+#if defined(HOVER_SERIAL_HW) && defined(HOVER_SERIAL_FAST_BAUD)
+      // The board switches right after this frame
+      if ((link->last.caps & PROTO_CAP_BAUD) && link->last.cmdSeq == link->baudSeq && link->baud == HOVER_SERIAL_BAUD)
+      {
+        link->hw->updateBaudRate(HOVER_SERIAL_FAST_BAUD);
+        link->baud = HOVER_SERIAL_FAST_BAUD;
+        link->baudMs = millis();
+      }
+#endif
+      return true;
     }
   }
-  else{
-    return false;
+  return false;
+}
+
+// Consume all the bytes available on the port, returns true if a new valid frame was completed.
+// The bytes come in blocks out of the Rx ring buffer the UART driver fills from its FIFO interrupt
+bool Receive(HoverLink *link)
+{
+  bool received = false;
+  byte chunk[RX_CHUNK];
+  int avail;
+
+  while ((avail = link->port->available()) > 0)
+  {
+    size_t len = link->port->readBytes(chunk, MIN(avail, RX_CHUNK));
+    for (size_t i = 0; i < len; i++)
+      received |= ReceiveByte(link, chunk[i]);
   }
+  return received;
 }
 
-SerialFeedback SerialFeedback_front;
-SerialFeedback SerialFeedback_rear;
+void printFeedback(const SerialFeedback *out)
+{
+  Serial.print("1: ");
+  Serial.print(out->odo0);
+  Serial.print(" 2: ");
+  Serial.print(out->odo1);
+  Serial.print(" 3: ");
+  Serial.print(out->speedR_meas);
+  Serial.print(" 4: ");
+  Serial.print(out->speedL_meas);
+  Serial.print(" 5: ");
+  Serial.print(out->batVoltage);
+  Serial.print(" 6: ");
+  Serial.print(out->boardTemp);
+  Serial.print(" 7: ");
+  Serial.print(out->cmdLed);
+  if (out->caps & PROTO_CAP_BAT_SOC) {
+    Serial.print(" SoC[%]: ");
+    Serial.print(out->batSoc / 10);
+  }
+  if (out->caps & PROTO_CAP_REGEN) {
+    Serial.print(" regen[Wh]: ");
+    Serial.print(out->regenWh / 100.0, 2);
+  }
+  Serial.print(" load[%]: ");
+  Serial.print(out->cpuLoad / 10.0, 1);
+  if (out->syncTime) {
+    Serial.print(" t[us]: ");                 // micros() of this Arduino when the board sent the frame
+    Serial.print(out->syncTime);
+  }
+  Serial.println();
+}
+
+void printLatency(const char *name, long rttMs, uint32_t good, uint32_t bad)
+{
+  Serial.print(name);
+  Serial.print(" rtt[ms]: ");
+  Serial.print(rttMs);
+  Serial.print(" good: ");
+  Serial.print(good);
+  Serial.print(" bad: ");
+  Serial.println(bad);
+}
 
 int torgue[4];
-int speed_per_wheel[4];
+int wheel_rpm[4];               // measured wheel speeds, same order as torgue[]
+bool wheel_new = false;         // feedback arrived since the last command
 int speed;
 
 void scan_i2c(){
@@ -432,40 +583,335 @@ void scan_i2c(){
   }  
 }
 
-void loop(void)
+// ########################## TASKS ##########################
+// Control and board links run in controlTask, pinned to CONTROL_CORE at a high priority and woken by the tick.
+// Display, monitor prints and Bluetooth run in uiTask on UI_CORE, so an OLED refresh over I2C cannot delay a command.
+// The control task publishes a snapshot of its state once per tick, the UI task reads the latest one.
+
+// Latest state, written by the control task only
+typedef struct
+{
+  int throttle;
+  int steering;                 // raw steering input, for display
+  int torque[4];
+  int wheel_rpm[4];
+  uint32_t tickMissed;
+  SerialFeedback fb[2];         // last valid feedback, front and rear
+  uint32_t good[2];
+  uint32_t bad[2];
+  uint8_t badVersion[2];
+  long rttMs[2];
+  unsigned long rxMs[2];        // [ms] arrival of the last valid feedback
+  int speed;                    // [rpm] median wheel speed
+  uint8_t supState;             // supStates, SUP_OK without SUPERVISOR
+#ifdef GAMEPAD_INPUT
+  bool padOk;                   // commands sent from the gamepad
+  uint32_t padAgeUs;            // [us] report age at its first command, last and max
+  uint32_t padAgeMaxUs;
+#endif
+} ControlState;
+
+// Sequence lock: the writer never waits, a reader retries when the sequence was odd or changed during its copy.
+// One writer per slot
+void SeqWrite(volatile uint32_t *seq, void *slot, const void *src, size_t len)
+{
+  (*seq)++;
+  __sync_synchronize();
+  memcpy(slot, src, len);
+  __sync_synchronize();
+  (*seq)++;
+}
+
+void SeqRead(volatile uint32_t *seq, const void *slot, void *dst, size_t len)
+{
+  uint32_t s;
+  do
+  {
+    while ((s = *seq) & 1)
+      ;
+    __sync_synchronize();
+    memcpy(dst, slot, len);
+    __sync_synchronize();
+  } while (*seq != s);
+}
+
+static ControlState stateBuf;
+static volatile uint32_t stateSeq = 0;
+
+#ifdef GAMEPAD_INPUT
+// Latest gamepad input, written by gamepadTask
+typedef struct
+{
+  int16_t throttle;             // [-THROTTLE_MAX, THROTTLE_MAX] before throttle_curve
+  int16_t steering;             // [-THROTTLE_MAX, THROTTLE_MAX]
+  bool deadman;                 // GAMEPAD_DEADMAN held
+  uint32_t pollUs;              // [us] last poll with the controller connected, for the timeout
+  uint32_t reportUs;            // [us] arrival of the last new report, for the latency
+} GamepadState;
+
+static GamepadState padBuf;
+static volatile uint32_t padSeq = 0;
+static ControllerPtr pad = NULL;
+uint32_t padAgeUs, padAgeMaxUs; // [us] report age when its first command was sent, last and max
+
+void onPadConnected(ControllerPtr ctl)
+{
+  if (pad == NULL)
+    pad = ctl;
+}
+
+void onPadDisconnected(ControllerPtr ctl)
+{
+  if (pad == ctl)
+    pad = NULL;
+}
+
+// Polls Bluepad32 every ms on UI_CORE, above the UI task. Bluepad32 owns the Bluetooth stack, no BT_TELEMETRY with it
+void gamepadTask(void *arg)
+{
+  GamepadState g = {0, 0, false, 0, 0};
+  for (;;)
+  {
+    if (BP32.update() && pad && pad->hasData())
+    {
+      int t = (pad->throttle() - pad->brake()) * THROTTLE_MAX / 1023;   // R2 forward, L2 brake and reverse
+      int x = pad->axisX() * THROTTLE_MAX / 512;
+      g.throttle = CLAMP(t, -THROTTLE_MAX, THROTTLE_MAX);
+      g.steering = abs(x) < GAMEPAD_DEAD_ZONE ? 0 : CLAMP(x, -THROTTLE_MAX, THROTTLE_MAX);
+      g.deadman = (pad->buttons() & GAMEPAD_DEADMAN) != 0;
+      g.reportUs = micros();
+    }
+    if (pad && pad->isConnected())
+      g.pollUs = micros();
+    SeqWrite(&padSeq, &padBuf, &g, sizeof(g));
+    vTaskDelay(1);
+  }
+}
+#endif
+
+void controlStep(ControlState *st)
 {
   int a0;
+  // Drain both ports, one tick holds less than a frame per board
+  bool fb_front = Receive(&link_front);
+  bool fb_rear  = Receive(&link_rear);
+  if (fb_front || fb_rear) {
+    wheel_rpm[0] = link_front.last.speedL_meas;
+    wheel_rpm[1] = link_front.last.speedR_meas;
+    wheel_rpm[2] = link_rear.last.speedL_meas;
+    wheel_rpm[3] = link_rear.last.speedR_meas;
+    wheel_new = true;
+    speed = median4(wheel_rpm);
+  }
+  // Sample the inputs and send the commands
   unsigned long timeNow = millis();
-  int throttle = throttle_calc(clean_adc_full(value_buffer(analogRead(THROTTLE0_PIN),0)));
-  float steering = calc_steering_eagle(clean_adc_full(a0 = value_buffer(analogRead(STEERING_PIN),1)));
-  // Check for new received data
-  //if(Receive(&HoverSerial_front, &SerialFeedback_front) || Receive(&HoverSerial_rear, &SerialFeedback_rear)){
-  //  speed_per_wheel[0] = SerialFeedback_front.speedL_meas;
-  //  speed_per_wheel[1] = SerialFeedback_front.speedR_meas;
-  //  speed_per_wheel[2] = SerialFeedback_rear.speedL_meas;
-  //  speed_per_wheel[3] = SerialFeedback_rear.speedR_meas;
-  //  speed = calc_median(speed_per_wheel,4);
-  //}  // Send commands
-  if (iTimeSend > timeNow)
+#ifdef GAMEPAD_INPUT
+  // Gamepad lost, its task stalled or the deadman released: no commands, the boards stop on their serial timeout
+  GamepadState g;
+  SeqRead(&padSeq, &padBuf, &g, sizeof(g));
+  uint32_t nowUs = micros();
+  if (!g.deadman || g.pollUs == 0 || nowUs - g.pollUs > GAMEPAD_TIMEOUT_MS * 1000UL)
+  {
+    st->padOk = false;
     return;
-  iTimeSend = timeNow + TIME_SEND;
-  calc_torque_per_wheel(throttle, steering, torgue);
-  Send(&HoverSerial_front, torgue[0], torgue[1]);
-  Send(&HoverSerial_rear, torgue[2], torgue[3]);
-  Serial.print("Set: Throttle: ");
-  Serial.print(throttle);
-  Serial.print("  steering: ");
-  Serial.print(a0);
-  Serial.print("  torgue: ");
-  Serial.print(torgue[0]);
-  Serial.print(" ");
-  Serial.print(torgue[1]);
-  Serial.print(" ");
-  Serial.print(torgue[2]);
-  Serial.print(" ");
-  Serial.println(torgue[3]);
+  }
+  st->padOk = true;
+  int throttle = throttle_curve(g.throttle);
+  int steering = g.steering;
+  a0 = steering;
+  static uint32_t padReportDone = 0;
+  if (g.reportUs != padReportDone)
+  {
+    padReportDone = g.reportUs;
+    padAgeUs = nowUs - g.reportUs;
+    padAgeMaxUs = MAX(padAgeMaxUs, padAgeUs);
+  }
+#else
+  int throttle = throttle_curve(clean_adc_full(value_buffer(analogRead(THROTTLE0_PIN),0)));
+  int steering = clean_adc_full(a0 = value_buffer(analogRead(STEERING_PIN),1));
+#endif
+  bool fresh = timeNow - link_front.rxMs < TC_STALE_MS && timeNow - link_rear.rxMs < TC_STALE_MS;
+  calc_torque_per_wheel(throttle, steering, fresh ? wheel_rpm : NULL, torgue);
+#ifdef TRACTION_CONTROL
+  if (fresh)
+  {
+#ifdef DIFFERENTIAL
+    int tc_rpm[4];
+    edNormalize(steering, wheel_rpm, tc_rpm); // the outer wheels run faster in a turn without slipping
+    tcApply(tc_rpm, torgue, wheel_new);
+#else
+    tcApply(wheel_rpm, torgue, wheel_new);
+#endif
+  }
+  else
+    tcReset();                  // no recent speeds from one board: plain torque split
+  wheel_new = false;
+#endif
+#if defined(HOVER_SERIAL_HW) && defined(HOVER_SERIAL_FAST_BAUD)
+  BaudCheck(&link_front, timeNow);
+  BaudCheck(&link_rear, timeNow);
+#endif
+#ifdef SUPERVISOR
+  bool good[2];
+  const HoverLink *sup[2] = {&link_front, &link_rear};
+  for (int i = 0; i < 2; i++)
+    good[i] = sup[i]->good && timeNow - sup[i]->rxMs < SUP_STALE_MS && !(sup[i]->last.caps & PROTO_CAP_FAULT);
+  st->supState = supApply(good, throttle, torgue, timeNow);
+#endif
+  SendSync(torgue[0], torgue[1], torgue[2], torgue[3]);
   // Blink the LED
   digitalWrite(LED_BUILTIN, (timeNow % 2000) < 1000);
+
+  st->throttle = throttle;
+  st->steering = a0;
+  memcpy(st->torque, torgue, sizeof(st->torque));
+  memcpy(st->wheel_rpm, wheel_rpm, sizeof(st->wheel_rpm));
+  st->tickMissed = tickMissed;
+  const HoverLink *links[2] = {&link_front, &link_rear};
+  for (int i = 0; i < 2; i++)
+  {
+    st->fb[i] = links[i]->last;
+    st->good[i] = links[i]->good;
+    st->bad[i] = links[i]->bad;
+    st->badVersion[i] = links[i]->badVersion;
+    st->rttMs[i] = links[i]->rttMs;
+    st->rxMs[i] = links[i]->rxMs;
+  }
+  st->speed = speed;
+#ifdef GAMEPAD_INPUT
+  st->padAgeUs = padAgeUs;
+  st->padAgeMaxUs = padAgeMaxUs;
+#endif
+}
+
+void controlTask(void *arg)
+{
+  static ControlState st;
+  for (;;)
+  {
+    uint32_t ticks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (ticks > 1)
+      tickMissed += ticks - 1;
+    controlStep(&st);
+    SeqWrite(&stateSeq, &stateBuf, &st, sizeof(st));
+  }
+}
+
+// Fault text of one board: the feedback carries only a fault flag, the link state and the sideboard LED byte add to it
+const char *faultText(const ControlState *st, int i, unsigned long now, char *buf)
+{
+  if (st->badVersion[i])
+    return "VER";
+  if (now - st->rxMs[i] > DASH_STALE_MS)
+    return "LINK";
+  if (st->fb[i].caps & PROTO_CAP_FAULT)
+    return "MOT";
+  if (st->fb[i].caps & PROTO_CAP_LED)
+  {
+    snprintf(buf, 5, "L%02X", st->fb[i].cmdLed & 0xFF);
+    return buf;
+  }
+  return "ok";
+}
+
+void uiTask(void *arg)
+{
+  static ControlState st;
+  static DashData dash;
+  static const char *names[2] = {"front", "rear"};
+  char faultBuf[2][5];
+  unsigned long printMs = 0;
+#ifdef DEBUG_FEEDBACK
+  uint32_t goodShown[2] = {0, 0};
+#endif
+  for (;;)
+  {
+    unsigned long now = millis();
+    SeqRead(&stateSeq, &stateBuf, &st, sizeof(st));
+    if (dsp_connected)
+    {
+      dash.speed = st.speed;
+      dash.throttle = st.throttle;
+      dash.steering = st.steering;
+      memcpy(dash.torque, st.torque, sizeof(dash.torque));
+      for (int i = 0; i < 2; i++)
+      {
+        dash.batVoltage[i] = st.fb[i].batVoltage;
+        dash.boardTemp[i] = st.fb[i].boardTemp;
+        dash.fault[i] = faultText(&st, i, now, faultBuf[i]);
+        dash.bad[i] = st.bad[i];
+      }
+      dash.tickMissed = st.tickMissed;
+      dash.mode = supText(st.supState);
+      dashUpdate(&dash, now);
+    }
+#ifdef BT_TELEMETRY
+    int16_t ch[TELEM_CH] = {
+      (int16_t)st.throttle, (int16_t)st.steering,
+      (int16_t)st.torque[0], (int16_t)st.torque[1], (int16_t)st.torque[2], (int16_t)st.torque[3],
+      (int16_t)st.wheel_rpm[0], (int16_t)st.wheel_rpm[1], (int16_t)st.wheel_rpm[2], (int16_t)st.wheel_rpm[3],
+      st.fb[0].batVoltage, st.fb[1].batVoltage, st.fb[0].boardTemp, st.fb[1].boardTemp,
+      (int16_t)MIN(st.tickMissed, 32767UL), st.supState};
+    telemStep(ch, now, ESP_BT.hasClient());
+#endif
+    vTaskDelay(pdMS_TO_TICKS(DASH_POLL_MS));
+    if (now - printMs < UI_MS)
+      continue;
+    printMs = now;
+    Serial.print("Set: Throttle: ");
+    Serial.print(st.throttle);
+    Serial.print("  steering: ");
+    Serial.print(st.steering);
+    Serial.print("  torgue: ");
+    Serial.print(st.torque[0]);
+    Serial.print(" ");
+    Serial.print(st.torque[1]);
+    Serial.print(" ");
+    Serial.print(st.torque[2]);
+    Serial.print(" ");
+    Serial.print(st.torque[3]);
+    Serial.print("  missed ticks: ");
+    Serial.print(st.tickMissed);
+    Serial.print("  mode: ");
+    Serial.println(supText(st.supState));
+#ifdef GAMEPAD_INPUT
+    // Input to wheel: report age when its first command left, plus half the command round trip (board turnaround removed)
+    Serial.print(st.padOk ? "pad" : "pad stopped");
+    Serial.print(" latency[ms]: ");
+    Serial.print((st.padAgeUs + 500) / 1000 + MAX(st.rttMs[0], st.rttMs[1]) / 2);
+    Serial.print(" input age[us]: ");
+    Serial.print(st.padAgeUs);
+    Serial.print(" max: ");
+    Serial.println(st.padAgeMaxUs);
+#endif
+    for (int i = 0; i < 2; i++)
+    {
+      if (st.badVersion[i])
+      {
+        Serial.print("Protocol version mismatch: ");
+        Serial.print(names[i]);
+        Serial.print(" board ");
+        Serial.print(st.badVersion[i]);
+        Serial.print(", controller ");
+        Serial.println(PROTO_VERSION);
+      }
+#ifdef DEBUG_FEEDBACK
+      // Latest frame only, the monitor cannot keep up with every one
+      if (st.good[i] != goodShown[i])
+      {
+        goodShown[i] = st.good[i];
+        printFeedback(&st.fb[i]);
+        printLatency(names[i], st.rttMs[i], st.good[i], st.bad[i]);
+      }
+#endif
+    }
+  }
+}
+
+// ########################## LOOP ##########################
+void loop(void)
+{
+  vTaskDelete(NULL);            // all the work runs in controlTask and uiTask
 }
 
 // ########################## END ##########################
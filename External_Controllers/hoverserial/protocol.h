@@ -0,0 +1 @@
+../../Inc/protocol.h
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include <stdlib.h>
+#include "defines.h"
+#include "config.h"
+#include "supervisor.h"
+
+#define SUP_STEP MAX(SUP_ONE * 1000 / (SUP_RAMP_MS * CONTROL_HZ), 1)   // [-] scale change per tick
+
+// Power on like a recovery: both boards must answer and the throttle be released before the commands ramp up
+static uint8_t state = SUP_STOP;
+static int scale[SUP_BOARDS];
+static unsigned long goodMs;    // [ms] last tick with a bad board
+
+uint8_t supApply(const bool *good, int throttle, int *torque, unsigned long now)
+{
+  uint8_t n = good[0] + good[1];
+  bool released = abs(throttle) < SUP_REARM_THR;
+
+  if (n == 0)
+    state = SUP_STOP;
+  else if (n == 1 && (state != SUP_STOP || released))
+    state = SUP_LIMP;           // out of STOP only with the throttle released, as into OK
+  else if (n == SUP_BOARDS && state != SUP_OK && now - goodMs >= SUP_RECOVER_MS && released)
+    state = SUP_OK;
+  if (n < SUP_BOARDS)
+    goodMs = now;
+
+  for (uint8_t b = 0; b < SUP_BOARDS; b++)
+  {
+    int target = state == SUP_OK ? SUP_ONE : state == SUP_LIMP ? SUP_ONE * SUP_LIMP_PCT / 100 : 0;
+    if (!good[b])
+      scale[b] = 0;             // at once: the board faulted or its link is gone, its other wheel must not push alone
+    else
+      scale[b] = STEP(scale[b], target, SUP_STEP);
+    torque[2 * b] = torque[2 * b] * scale[b] / SUP_ONE;
+    torque[2 * b + 1] = torque[2 * b + 1] * scale[b] / SUP_ONE;
+  }
+  return state;
+}
+
+const char *supText(uint8_t s)
+{
+  return s == SUP_OK ? "OK" : s == SUP_LIMP ? "LIMP" : "STOP";
+}
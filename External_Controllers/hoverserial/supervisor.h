@@ -0,0 +1,32 @@
+// *******************************************************************
+//  Supervisor of the two mainboards: feedback freshness and fault flags
+// *******************************************************************
+// A board is bad while its feedback is older than SUP_STALE_MS or it reports PROTO_CAP_FAULT (a motor error, the board
+// has switched off both its motors). A bad board gets zero commands, and instead of driving on alone at full torque,
+// with the dead axle dragging, the other board ramps down to SUP_LIMP_PCT of its commands (limp mode). With both
+// boards bad everything ramps to zero. Both scales change in the same tick, and the HOLD / LATCH frames of SendSync()
+// apply them on both boards together.
+// Back to normal when both boards were good for SUP_RECOVER_MS and the throttle is released, then ramp up.
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SUP_BOARDS 2            // 0 front, 1 rear
+#define SUP_ONE    256          // [-] command scale 1.0, Q8
+
+enum supStates
+{
+  SUP_OK,                       // both boards good, full commands
+  SUP_LIMP,                     // one board bad: its commands zero, the other one at SUP_LIMP_PCT
+  SUP_STOP,                     // both boards bad: ramp to zero
+};
+
+// Call once per control tick. good: per board, fresh feedback without fault. throttle: input after the curve, for
+// the recovery. torque: the four wheel commands, in wheel order, scaled in place. Returns the state (supStates)
+uint8_t supApply(const bool *good, int throttle, int *torque, unsigned long now);
+// Short state text for display
+const char *supText(uint8_t state);
+
+#endif // SUPERVISOR_H
@@ -0,0 +1,221 @@
+#include <string.h>
+#include <Arduino.h>
+#include "defines.h"
+#include "config.h"
+#include "telemetry.h"
+#include "traction.h"
+#include "differential.h"
+
+extern "C" uint32_t calc_crc32(const unsigned char *buffer, unsigned int length);
+extern int throttleCurve[THROTTLE_CURVE_N];   // hoverserial.ino
+
+// Same values as the firmware: DEBUG_STREAM_START_FRAME, DEBUG_BIN_START_FRAME (Inc/config.h) and binOps (Inc/comms.h)
+#define STREAM_START_FRAME  0x7C7C
+#define BIN_START_FRAME     0x7D7D
+#define BIN_OP_GET          0x01
+#define BIN_OP_SET          0x02
+#define BIN_OP_REPLY        0x80
+#define BIN_OP_ERROR        0x40
+
+#define FRAME_LEN  (10 + TELEM_CH * 2 + 4)      // [bytes] header, int16 channels, CRC32
+#define REQ_MAX    (4 + 5 * TELEM_BIN_MAX + 4)  // [bytes] longest request, a SET of TELEM_BIN_MAX items
+
+static const char *const names[TELEM_CH] = {
+  "THR", "STR", "TRQ0", "TRQ1", "TRQ2", "TRQ3", "RPM0", "RPM1", "RPM2", "RPM3",
+  "BAT_F", "BAT_R", "TMP_F", "TMP_R", "MISS", "SUP"};
+
+// Tunables, addressed by their index. Floats are exchanged scaled by 1000
+typedef struct
+{
+  const char *name;
+  int *i;
+  float *f;
+  int32_t min, max;             // internal value range
+} TelemParam;
+
+static const TelemParam params[] = {
+  {"ED_KP",          &edKp,              NULL,       0, 50},
+  {"ED_CORR_MAX",    &edCorrMax,         NULL,       0, 100},
+  {"TC_SLIP_RPM",    &tcSlipRpm,         NULL,       0, 500},
+  {"TC_SLIP_MAX_PM", NULL,               &tcSlipMax, 0, 1000},
+  {"THR_CRV1",       &throttleCurve[0],  NULL,       0, THROTTLE_MAX},
+  {"THR_CRV2",       &throttleCurve[1],  NULL,       0, THROTTLE_MAX},
+  {"THR_CRV3",       &throttleCurve[2],  NULL,       0, THROTTLE_MAX},
+  {"THR_CRV4",       &throttleCurve[3],  NULL,       0, THROTTLE_MAX},
+  {"THR_CRV5",       &throttleCurve[4],  NULL,       0, THROTTLE_MAX},
+};
+#define PARAM_N (sizeof(params) / sizeof(params[0]))
+
+static Stream *port;
+static uint8_t batch[TELEM_BATCH * FRAME_LEN];
+static uint16_t batchLen;
+static uint16_t seq;
+static unsigned long sampleMs, layoutMs;
+static bool wasConnected;
+static uint8_t req[REQ_MAX];
+static uint8_t reqLen, reqSize;
+uint32_t telemReqDrop;          // requests with a bad checksum or header
+
+static int32_t paramGet(uint8_t k)
+{
+  return params[k].i ? *params[k].i : (int32_t)lroundf(*params[k].f * 1000.0f);
+}
+
+static uint8_t paramSet(uint8_t k, int32_t v)
+{
+  if (k >= PARAM_N || v < params[k].min || v > params[k].max)
+    return 0;
+  if (params[k].i)
+    *params[k].i = v;
+  else
+    *params[k].f = v / 1000.0f;
+  return 1;
+}
+
+// Text lines between the frames, as the firmware prints them on $STREAM
+static void layout(void)
+{
+  port->print("# stream");
+  for (uint8_t i = 0; i < TELEM_CH; i++)
+  {
+    port->print(' ');
+    port->print(names[i]);
+    port->print(":2");
+  }
+  port->print("\r\n# params");
+  for (uint8_t i = 0; i < PARAM_N; i++)
+  {
+    port->print(' ');
+    port->print(params[i].name);
+  }
+  port->print("\r\n");
+}
+
+static void putCrc(uint8_t *frame, uint16_t len)
+{
+  uint32_t crc = calc_crc32(frame, len);
+  memcpy(frame + len, &crc, 4);
+}
+
+// Answer a complete request, same layout as process_bin_request() in Src/comms.c
+static void reply(void)
+{
+  uint8_t frame[4 + 4 * TELEM_BIN_MAX + 4];
+  uint8_t op = req[2], n = req[3];
+  uint16_t len = 4;
+
+  frame[0] = (uint8_t)BIN_START_FRAME;
+  frame[1] = (uint8_t)(BIN_START_FRAME >> 8);
+  frame[2] = op | BIN_OP_REPLY;
+  frame[3] = n;
+  for (uint8_t i = 0; i < n; i++)
+  {
+    if (op == BIN_OP_GET)
+    {
+      if (req[4 + i] >= PARAM_N)
+      {
+        frame[2] |= BIN_OP_ERROR;
+        frame[3] = 0;
+        len = 4;
+        break;
+      }
+      int32_t v = paramGet(req[4 + i]);
+      memcpy(&frame[len], &v, 4);
+      len += 4;
+    }
+    else
+    {
+      int32_t v;
+      memcpy(&v, &req[4 + 5 * i + 1], 4);
+      frame[len++] = paramSet(req[4 + 5 * i], v);
+    }
+  }
+  putCrc(frame, len);
+  port->write(frame, len + 4);
+}
+
+static void receive(void)
+{
+  while (port->available() > 0)
+  {
+    uint8_t c = port->read();
+    if (reqLen < 2)
+    {
+      reqLen = c == (uint8_t)BIN_START_FRAME ? reqLen + 1 : 0;
+      req[0] = req[1] = c;
+      continue;
+    }
+    req[reqLen++] = c;
+    if (reqLen == 4)
+    {
+      uint8_t op = req[2], n = req[3];
+      if (n == 0 || n > TELEM_BIN_MAX || (op != BIN_OP_GET && op != BIN_OP_SET))
+      {
+        telemReqDrop++;
+        reqLen = 0;
+        continue;
+      }
+      reqSize = 4 + n * (op == BIN_OP_SET ? 5 : 1) + 4;
+    }
+    if (reqLen > 4 && reqLen == reqSize)
+    {
+      uint32_t crc;
+      memcpy(&crc, &req[reqSize - 4], 4);
+      if (crc == calc_crc32(req, reqSize - 4))
+        reply();
+      else
+        telemReqDrop++;
+      reqLen = 0;
+    }
+  }
+}
+
+void telemInit(Stream *p)
+{
+  port = p;
+  batchLen = 0;
+  reqLen = 0;
+}
+
+void telemStep(const int16_t *ch, unsigned long now, bool connected)
+{
+  if (port == NULL)
+    return;
+  if (!connected)
+  {
+    wasConnected = false;
+    batchLen = 0;
+    return;
+  }
+  if (!wasConnected || now - layoutMs >= TELEM_LAYOUT_MS)
+  {
+    wasConnected = true;
+    layoutMs = now;
+    layout();
+  }
+  receive();
+
+  if (now - sampleMs < 1000 / TELEM_HZ)
+    return;
+  sampleMs = now - sampleMs < 2000 / TELEM_HZ ? sampleMs + 1000 / TELEM_HZ : now;   // no burst after a stall
+
+  // One stream frame: start, channels, payload length, seq, time in us (the firmware's timeUs())
+  uint8_t *f = batch + batchLen;
+  uint32_t time = (uint32_t)esp_timer_get_time();
+  f[0] = (uint8_t)STREAM_START_FRAME;
+  f[1] = (uint8_t)(STREAM_START_FRAME >> 8);
+  f[2] = TELEM_CH;
+  f[3] = TELEM_CH * 2;
+  memcpy(f + 4, &seq, 2);
+  memcpy(f + 6, &time, 4);
+  memcpy(f + 10, ch, TELEM_CH * 2);
+  putCrc(f, FRAME_LEN - 4);
+  seq++;
+  batchLen += FRAME_LEN;
+
+  if (batchLen >= sizeof(batch))
+  {
+    port->write(batch, batchLen);
+    batchLen = 0;
+  }
+}
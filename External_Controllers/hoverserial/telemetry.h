@@ -0,0 +1,30 @@
+// *******************************************************************
+//  Telemetry bridge: both boards and the controller state over Bluetooth SPP
+// *******************************************************************
+// The frames have the layout of the firmware's binary stream (DEBUG_STREAM_START_FRAME, see Src/comms.c), announced by
+// the same "# stream name:size ..." line, so hoverclient and hoverrec decode them unchanged. TELEM_BATCH frames are
+// collected and written in one go, one SPP packet instead of one per frame.
+// Tuning requests come back in the firmware's binary parameter format (DEBUG_BIN_START_FRAME, BIN_OP_GET / BIN_OP_SET),
+// the index being the position in the "# params" line.
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <Stream.h>
+
+// Channels in frame order, all int16
+enum telemChannels
+{
+  TELEM_THR, TELEM_STR,
+  TELEM_TRQ0, TELEM_TRQ1, TELEM_TRQ2, TELEM_TRQ3,
+  TELEM_RPM0, TELEM_RPM1, TELEM_RPM2, TELEM_RPM3,
+  TELEM_BAT_F, TELEM_BAT_R, TELEM_TMP_F, TELEM_TMP_R,
+  TELEM_MISS, TELEM_SUP,
+  TELEM_CH
+};
+
+void telemInit(Stream *port);
+// Call every UI pass with the latest values: samples at TELEM_HZ, writes full batches and answers the requests
+void telemStep(const int16_t *ch, unsigned long now, bool connected);
+
+#endif // TELEMETRY_H
@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include "defines.h"
+#include "config.h"
+#include "traction.h"
+
+float tcSlipMax = TC_SLIP_MAX;   // tunable at run time (telemetry.cpp)
+int tcSlipRpm = TC_SLIP_RPM;
+
+static float scale[TC_WHEELS] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+void tcReset(void)
+{
+  for (uint8_t i = 0; i < TC_WHEELS; i++)
+    scale[i] = 1.0f;
+}
+
+float tcScale(uint8_t wheel)
+{
+  return wheel < TC_WHEELS ? scale[wheel] : 1.0f;
+}
+
+// Second slowest wheel: one spinning wheel, or a wheel in the air, cannot drag the reference along
+static int reference(const int *speed)
+{
+  int s[TC_WHEELS];
+  for (uint8_t i = 0; i < TC_WHEELS; i++)
+    s[i] = abs(speed[i]);
+  for (uint8_t i = 0; i < 2; i++)
+    for (uint8_t j = i + 1; j < TC_WHEELS; j++)
+      if (s[j] < s[i]) { int t = s[i]; s[i] = s[j]; s[j] = t; }
+  return s[1];
+}
+
+void tcApply(const int *speed, int *torque, bool update)
+{
+  int ref = reference(speed);
+  int removed[TC_WHEELS];
+
+  for (uint8_t i = 0; i < TC_WHEELS; i++)
+  {
+    // Slip only counts in the direction the wheel is pushed
+    if (update)
+    {
+      int w = SIGN_INT(torque[i]) * speed[i];
+      float over = (float)(w - ref) - (float)ref * tcSlipMax - tcSlipRpm;
+      if (torque[i] != 0 && over > 0.0f)
+        scale[i] -= TC_CUT * over / (float)(ref + tcSlipRpm);
+      else
+        scale[i] += TC_RECOVER;
+      scale[i] = CLAMP(scale[i], TC_SCALE_MIN, 1.0f);
+    }
+
+    int out = (int)(torque[i] * scale[i]);
+    removed[i] = torque[i] - out;
+    torque[i] = out;
+  }
+
+  // Hand the removed torque to the gripping wheels pushing the same way
+  for (uint8_t i = 0; i < TC_WHEELS; i++)
+  {
+    if (removed[i] == 0)
+      continue;
+    uint8_t n = 0;
+    for (uint8_t j = 0; j < TC_WHEELS; j++)
+      if (scale[j] >= 1.0f && SIGN_INT(torque[j]) == SIGN_INT(removed[i]))
+        n++;
+    if (n == 0)
+      continue;
+    for (uint8_t j = 0; j < TC_WHEELS; j++)
+      if (scale[j] >= 1.0f && SIGN_INT(torque[j]) == SIGN_INT(removed[i]))
+        torque[j] = CLAMP(torque[j] + removed[i] / n, -THROTTLE_MAX, THROTTLE_MAX);
+  }
+}
@@ -0,0 +1,26 @@
+// *******************************************************************
+//  Traction control for two mainboards (4 wheels) in TRQ_MODE
+// *******************************************************************
+// Wheel order: 0 front left, 1 front right, 2 rear left, 3 rear right, as in torgue[] / speed_per_wheel[].
+// A wheel spinning faster than the reference (second slowest wheel) by more than the allowed slip gets
+// its torque scaled down, and the removed torque goes to the wheels that still grip and push the same way.
+// Call tcApply() for every command, with update set when new feedback arrived since the last call,
+// so the correction lands within one feedback period.
+#ifndef TRACTION_H
+#define TRACTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TC_WHEELS 4
+
+extern float tcSlipMax;         // [-] TC_SLIP_MAX, run time value
+extern int tcSlipRpm;           // [rpm] TC_SLIP_RPM, run time value
+
+void tcReset(void);
+// speed: measured wheel speeds [rpm], forward positive. torque: commands [-THROTTLE_MAX, THROTTLE_MAX], corrected in place
+void tcApply(const int *speed, int *torque, bool update);
+// Current torque scale per wheel [0..1], for display
+float tcScale(uint8_t wheel);
+
+#endif // TRACTION_H
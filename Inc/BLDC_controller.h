@@ -148,6 +148,9 @@ typedef struct {
   uint8_T is_active_c1_BLDC_controller;/* '<S5>/F03_02_Control_Mode_Manager' */
   uint8_T is_c1_BLDC_controller;       /* '<S5>/F03_02_Control_Mode_Manager' */
   uint8_T is_ACTIVE;                   /* '<S5>/F03_02_Control_Mode_Manager' */
+  int32_T n_errFiltState[8];           /* SPD_FILT speed error biquad states x1, x2, y1, y2 [fixdt(1,32,12)] of the
+                                        * notch, then of the low pass (not generated, keep when re-generating the code) */
+  uint8_T z_taskCnt;                   /* CTRL_MULTIRATE slow task counter, '<S1>/Task_Scheduler' */
   boolean_T Merge_p;                   /* '<S21>/Merge' */
   boolean_T dz_cntTrnsDet;             /* '<S17>/dz_cntTrnsDet' */
   boolean_T UnitDelay2_DSTATE_c;       /* '<S2>/UnitDelay2' */
@@ -161,15 +164,16 @@ typedef struct {
 
 /* Constant parameters (auto storage) */
 typedef struct {
-  /* Computed Parameter: r_sin_M1_Table
-   * Referenced by: '<S52>/r_sin_M1'
+  /* sin(0..91 deg) in fixdt(1,16,14) for the Park transforms, replaces the generated
+   * r_sin_M1_Table and r_cos_M1_Table (not generated, keep when re-generating the code)
    */
-  int16_T r_sin_M1_Table[181];
+  int16_T r_sinQuarter_Table[92];
 
-  /* Computed Parameter: r_cos_M1_Table
-   * Referenced by: '<S52>/r_cos_M1'
+  /* d axis current magnitude in fixdt(1,16,4) ADC bits of FI_WEAK_ENA 2 (FOC), FW_MAP_R input
+   * target rows of FW_MAP_N speeds, calibrated with host/sil -w (not generated, keep when
+   * re-generating the code)
    */
-  int16_T r_cos_M1_Table[181];
+  int16_T r_fieldWeakMap_Table[125];
 
   /* Computed Parameter: r_sin3PhaA_M1_Table
    * Referenced by: '<S96>/r_sin3PhaA_M1'
@@ -214,6 +218,16 @@ typedef struct {
   int16_T i_phaBC;                     /* '<Root>/i_phaBC' */
   int16_T i_DCLink;                    /* '<Root>/i_DCLink' */
   int16_T a_mechAngle;                 /* '<Root>/a_mechAngle' */
+  int16_T Vq_ff;                       /* SPD_MODE voltage feedforward [fixdt(1,16,4)], added to the speed
+                                        * PI output (not generated, keep when re-generating the code) */
+  int16_T Vd_dec;                      /* CTRL_PREDICT decoupling voltage [fixdt(1,16,4)], added to the id PI
+                                        * output (not generated, keep when re-generating the code) */
+  int16_T Vq_dec;                      /* CTRL_PREDICT back-EMF and decoupling voltage [fixdt(1,16,4)], added to
+                                        * the TRQ_MODE iq PI output (not generated, keep when re-generating the code) */
+  int16_T a_elecAdv;                   /* inverse Park angle advance [deg, fixdt(1,16,6)], 0 = generated
+                                        * behaviour (not generated, keep when re-generating the code) */
+  int16_T id_inj;                      /* WINDING_TEMP standstill d axis current [fixdt(1,16,4)], added to the
+                                        * id target (not generated, keep when re-generating the code) */
 } ExtU;
 
 /* External outputs (root outports fed by signals with auto storage) */
@@ -371,8 +385,28 @@ struct P_ {
                                         *   '<S6>/b_fieldWeakEna'
                                         *   '<S97>/b_fieldWeakEna'
                                         */
+  int16_T a_hallCorr[6];               /* Hall edge angle corrections [deg, fixdt(1,16,6)] of the edge into
+                                        * position 0..5, applied by F01_05_Electrical_Angle_Estimation with
+                                        * HALL_CALIB (not generated, keep when re-generating the code)
+                                        */
+  uint16_T r_fieldWeakMapSca;          /* Speed scale of the field weakening map [fixdt(0,16,12)],
+                                        * calibration battery voltage / battery voltage, set by the
+                                        * firmware (not generated, keep when re-generating the code)
+                                        */
+  int32_T cf_nFilt[10];                /* SPD_FILT speed error biquads b0, b1, b2, a1, a2 [Q28] of the notch, then
+                                        * of the low pass, b0 = 0 skips a stage, set by the firmware (not
+                                        * generated, keep when re-generating the code)
+                                        */
 };
 
+/* Field weakening map breakpoints (not generated, keep when re-generating the code): speed |n_mot|
+ * 0, 32, .. 768 rpm at the calibration battery voltage (r_fieldWeakMapSca) and input target
+ * |r_inpTgt| 0, 256, .. 1024, both in fixdt(1,16,4) */
+#define FW_MAP_N                       25
+#define FW_MAP_R                       5
+#define FW_MAP_N_SHIFT                 9        /* 32 rpm in fixdt(1,16,4) */
+#define FW_MAP_R_SHIFT                 12       /* 256 in fixdt(1,16,4) */
+
 /* Parameters (auto storage) */
 typedef struct P_ P;
 
@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+
+// Anti-lock braking, ANTILOCK_BRAKE. Detects a wheel that decelerates much faster than the other one while braking
+// and lowers its braking torque until it has spun up again (see antilock.c). antilockStep runs every 1 ms in the slow
+// task, the control interrupt scales the TORQUE mode target of each motor with fac.
+#define ANTILOCK_FAC_ONE        32768   // [-] fac of the full braking torque
+
+typedef struct {
+  int16_t  nAbs;                        // [rpm] speed magnitude at the last step
+  int8_t   dir;                         // [-] last direction of motion, 1, -1 or 0 before the wheel has moved
+  uint8_t  slip;                        // [-] wheel found locking at the last step
+  int32_t  decel;                       // [rpm/s] filtered deceleration, positive while the wheel slows down
+  uint16_t fac;                         // [Q15] braking torque factor read by the control interrupt
+} AntilockWheel;
+
+typedef struct {
+  AntilockWheel w[2];                   // left, right
+  uint32_t events;                      // [-] lock detections since power on
+} Antilock;
+
+void antilockInit(Antilock *a);
+void antilockStep(Antilock *a, int16_t nL, int16_t nR, int16_t cmdL, int16_t cmdR);
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+
+// On-board balance controller, BALANCE_CONTROL (VARIANT_HOVERBOARD). Each half of the board balances on its own
+// sideboard: the torque target of a motor follows the pitch and pitch rate reported by the sideboard above it (see balance.c).
+enum balanceStates {BAL_OFF, BAL_ON};
+
+typedef struct {
+  int32_t  rate;                        // [dPitch units, Q8] filtered pitch rate
+  int32_t  integ;                       // [torque, Q8] integral part
+  uint16_t ramp;                        // [ticks] soft start, BALANCE_RAMP down to 0
+  int16_t  trq;                         // [-1000, 1000] torque target
+  uint8_t  state;                       // [-] balanceStates
+} Balance;
+
+void    balanceInit(Balance *b);
+int16_t balanceStep(Balance *b, int16_t pitch, int16_t dPitch, uint8_t ok);
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+
+// Battery state of charge estimation, BAT_SOC_ENABLE. Counts the charge drawn through the DC link current and
+// corrects it slowly with the open circuit voltage, the measured voltage plus the sag of an estimated internal
+// resistance (see battery.c). The level replaces the plain battery voltage thresholds of the LEDs, beeps and BAT_DEAD.
+#define BAT_SOC_NONE            0xFFFF  // [-] stored value of a word that was never written
+
+enum batLevels {BAT_LEVEL_DEAD, BAT_LEVEL_1, BAT_LEVEL_2, BAT_LEVEL_3, BAT_LEVEL_4, BAT_LEVEL_5, BAT_LEVEL_FULL};
+
+typedef struct {
+  int32_t  charge;                      // [mAs] remaining charge, 0 .. BAT_CAPACITY
+  int32_t  rest;                        // [A*100*ms] drawn charge not yet counted in charge
+  int32_t  iFixdt;                      // [A*100, Q16] filtered battery current, positive = discharge
+  int16_t  vPrev;                       // [V*100] battery voltage of the last resistance sample
+  int16_t  iPrev;                       // [A*100] battery current of the last resistance sample
+  int16_t  vOcv;                        // [V*100] open circuit voltage estimate, the sag is added back
+  uint16_t rInt;                        // [mOhm] internal resistance estimate
+  uint16_t soc;                         // [0.1 %] state of charge
+  uint16_t ticks;                       // [ms] time since the last resistance sample
+  uint16_t restTicks;                   // [ms] time with a small current, saturated
+  uint16_t emptyTicks;                  // [ms] time below the empty voltage, saturated
+} BatSoc;
+
+void     batSocInit(BatSoc *b, int16_t vBat, uint16_t stored, uint16_t storedR);
+void     batSocStep(BatSoc *b, int16_t vBat, int16_t iBat, uint16_t dt);
+uint8_t  batSocLevel(const BatSoc *b);
+uint16_t batSocStored(const BatSoc *b);
@@ -0,0 +1,4 @@
+#pragma once
+
+// On-target cycle benchmark of the control and support functions, VARIANT_BENCH (see bench.c)
+void benchRun(void);
@@ -1,17 +1,337 @@
 #pragma once
 #include <stdint.h>
+#include "config.h"
+#include "hallcal.h"
+#include "hallstat.h"
+#include "motorid.h"
+#include "cogging.h"
+#include "derate.h"
+#include "dcbudget.h"
+#include "wtemp.h"
+#include "regen.h"
+#include "antilock.h"
+#include "selftest.h"
+#include "hooks.h"
+#include "spdfilt.h"
 
 extern volatile int pwml;               // global variable for pwm left. -1000 to 1000
 extern volatile int pwmr;               // global variable for pwm right. -1000 to 1000
 
 extern uint8_t enable;                  // global variable for motor enable
+extern uint8_t pwmZeroSeq;              // output stage zero sequence, PWM_ZSEQ_MID or PWM_ZSEQ_LOW
+extern int16_t dtComp;                  // [timer counts] dead time compensation, DT_COMP
+#if defined(SPD_REF_GEN)
+extern volatile int16_t spdFfAcc[2];    // [fixdt(1,16,4)] SPD_MODE acceleration voltage feedforward, left / right
+extern volatile int32_t spdFfKv;        // [fixdt(1,32,8)] SPD_MODE back-EMF voltage feedforward per r_inpTgt unit
+#endif
+#if defined(CTRL_PREDICT)
+typedef struct {
+  int32_t kA;                           // [fixdt(1,32,16)] angle advance in fixdt(1,16,6) deg per rpm and half period
+  int32_t kE;                           // [fixdt(1,32,8)] back-EMF voltage per rpm
+  int32_t kL;                           // [fixdt(1,32,24)] w L voltage per rpm and iq / id unit
+} CtrlPredict;
+extern volatile CtrlPredict ctrlPred[2];  // left, right motor
+#endif
 
 extern int16_t batVoltage;              // global variable for battery voltage
-extern volatile uint16_t steps[2];
 extern volatile uint32_t buzzerTimer;
 extern uint8_t buzzerCount;             // global variable for the buzzer counts. can be 1, 2, 3, 4, 5, 6, 7...
 extern uint8_t buzzerFreq;              // global variable for the buzzer pitch. can be 1, 2, 3, 4, 5, 6, 7...
 extern uint8_t buzzerPattern;           // global variable for the buzzer pattern. can be 1, 2, 3, 4, 5, 6, 7...
 
+// Tone sequencer of the slow task, the queued notes play before the buzzer patterns above
+#define BEEP_QUEUE_LEN          32      // [-] queued notes, power of 2
+typedef struct {
+  uint8_t  freq;                        // [-] pitch like buzzerFreq, 0 = rest
+  uint16_t ms;                          // [ms] duration
+} BeepNote;
 
-void bldc_start_calibration();
\ No newline at end of file
+uint8_t beepNote(uint8_t freq, uint16_t ms);
+uint8_t beepBusy(void);
+
+
+void bldc_start_calibration();
+void bldc_cycle_counter_init(void);
+void bldc_slow_task(void);
+
+// Hall odometry, updated by the control interrupt at every hall edge
+typedef struct {
+  int32_t  pos;                         // [hall steps] signed position, counts up while n_mot is positive
+  uint32_t edgeTick;                    // [ticks] control interrupt counter at the last hall edge, PWM_FREQ ticks per second
+} Odometry;
+
+extern Odometry odo[2];                 // 0 = left, 1 = right motor
+
+// Controller state published by the control interrupt at the end of every tick, read by the main loop with
+// bldc_state_read. Index 0 = left, 1 = right motor
+typedef struct {
+  uint32_t tick;                        // [ticks] mainCounter of the publishing tick
+  Odometry odo[2];
+  int16_t  n_mot[2];                    // [rpm] rtY n_mot
+  int16_t  i_DCLink[2];                 // [ADC bits] rtU i_DCLink
+  int16_t  iq[2];                       // [fixdt(1,16,4) ADC bits] rtY iq
+  int16_t  id[2];                       // [fixdt(1,16,4) ADC bits] rtY id
+  uint8_t  errCode[2];                  // [-] rtY z_errCode
+  int16_t  batVoltage;                  // [ADC bits] filtered battery voltage
+} BldcState;
+
+void bldc_state_read(BldcState *out);
+#if defined(PARAM_STAGED)
+uint8_t bldc_param_commit(void);        // 1 = rtP_Left / rtP_Right are taken at the next control tick, 0 = retry later
+#endif
+
+#if defined(SERIAL_EXT_CMD)
+// Mode and limits of an extended serial command (ProtoCommandExt), both motors, in the units of the controller
+typedef struct {
+  uint8_t  ext;                         // [-] PROTO_EXT_* of the valid fields
+  uint8_t  ctrlMod;                     // [-] VLT_MODE, SPD_MODE or TRQ_MODE
+  int16_t  iMax;                        // [fixdt(1,16,4) ADC bits] i_max
+  int16_t  nMax;                        // [fixdt(1,16,4) rpm] n_max
+  uint8_t  fieldWeakEna;                // [-] b_fieldWeakEna
+  int16_t  fieldWeakMax;                // [fixdt(1,16,4) ADC bits] id_fieldWeakMax
+} BldcExtCmd;
+
+void bldc_ext_command(const BldcExtCmd *c);   // taken by the next control tick, from the serial Rx processing
+#endif
+void bldc_odo_snapshot(Odometry *out, uint32_t *tick);
+
+#if defined(HALL_SPEED_EST)
+void bldc_hall_speed(int16_t *rpm);     // [rpm] left and right, same sign as n_mot
+#endif
+
+#if defined(VARIANT_BENCH)
+extern uint8_t benchHall[2];            // [-] hall inputs of bldc_control, left and right, set by bench.c
+void bldc_control(void);
+void bldc_bench_init(void);
+#endif
+
+#if defined(HALL_CALIB)
+extern HallCal hallCal[2];              // left, right hall calibration, HALL_CAL_DONE until the result is saved
+void bldc_hall_calib_start(void);
+#endif
+
+#if defined(HALL_STATS)
+extern HallStat hallStat[2];            // left, right hall sensor statistics, written by the control interrupt
+extern volatile uint8_t hallStatReq[2]; // [-] set by the main loop, the control interrupt resets the statistics at the next edge
+#endif
+
+#if defined(MOTOR_IDENT)
+extern MotId motId[2];                  // left, right motor identification, MOT_ID_DONE until the result is saved
+void bldc_motor_ident_start(void);
+#endif
+
+#if defined(SPD_FILT)
+extern SpdId spdId[2];                  // left, right $SPDID sweep, SPD_ID_DONE until the result is printed
+void bldc_spd_ident_start(void);
+#endif
+
+#if defined(COGGING_COMP)
+extern Cogging cogging[2];              // left, right cogging table, COG_DONE until the new table is saved
+void bldc_cogging_start(void);
+#endif
+
+#if defined(ADC_SAMPLE_ALIGN)
+#define ADC_SWEEP_POINTS        16      // [-] trigger points of $ADCSWEEP
+#define ADC_SWEEP_TICKS_LOG2    8
+#define ADC_SWEEP_TICKS         (1 << ADC_SWEEP_TICKS_LOG2)  // [ticks] summed per point
+#define ADC_SWEEP_SKIP          4       // [ticks] before each point, the compare is preloaded
+enum adcSweepStates {ADC_SWEEP_IDLE, ADC_SWEEP_RUN, ADC_SWEEP_DONE, ADC_SWEEP_FAIL};
+
+typedef struct {
+  int32_t  sum[4];                      // [ADC bits] shunt currents left A, B, right B, C of the running point
+  uint32_t sq[4];                       // [ADC bits^2] their squares
+  uint32_t var[ADC_SWEEP_POINTS][4];    // [ADC bits^2 * 16] result: variance per point and shunt
+  uint16_t ticks;                       // [ticks] in the running point
+  uint8_t  point;                       // [-] running point, 0 = ADC_SAMPLE_SWEEP before the top
+  uint8_t  state;                       // [-] adcSweepStates
+} AdcSweep;
+
+extern int16_t  adcSmpOfs;              // [timer counts] ADC trigger before the top of the PWM, ADC_SAMPLE_OFFSET
+extern AdcSweep adcSweep;               // $ADCSWEEP, ADC_SWEEP_DONE until printed
+void bldc_adc_sweep_start(void);
+#endif
+
+#if defined(POS_CTRL)
+void bldc_pos_target(int16_t l, int16_t r);  // [hall steps] POS_MODE targets, low 16 bits in the odo0 / odo1 feedback frame
+#endif
+
+#if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+enum bldcHolds {BLDC_HOLD_NONE, BLDC_HOLD_POS, BLDC_HOLD_SPD};
+extern volatile uint8_t holdReq;        // [-] bldcHolds: standstill position hold or cruise control, set by the main loop
+extern volatile int16_t holdTgt[2];     // [rpm] cruise speed target, left / right
+#endif
+
+#if defined(CURRENT_DERATING)
+extern Derate derate;                   // phase current derating, derateStep in the monitor task, read by the control interrupt
+#endif
+#if defined(DC_BUDGET)
+extern DcBudget dcBudget;               // shared battery current budget, dcBudgetTotal in the monitor task, dcBudgetStep in the control interrupt
+#endif
+#if defined(WINDING_TEMP)
+extern WTemp wtemp[2];                  // left, right winding temperature, sums of the control interrupt, wtempStep in the monitor task
+#endif
+
+#if defined(SELF_TEST)
+extern SelfTest selfTest;               // boot self-test, run by the control interrupt after the offset calibration
+#endif
+
+#if defined(HW_BREAK)
+extern uint32_t hwBreakTrips[2];        // [ticks] control ticks that found the break input tripped, left / right
+#endif
+
+#if defined(DC_FOLDBACK)
+extern uint16_t dcFold[2];              // [1/32768] duty scale of the DC current foldback, left / right
+#endif
+
+#if defined(OVERMOD)
+extern uint16_t overmodGain[2];         // [1/1024] duty gain of the overmodulation, left / right, 1024 = linear
+#endif
+
+#if defined(DC_LINK_EST)
+extern int16_t dcEstShunt[2];           // [ADC bits, Q4] filtered DC link shunt current, left / right
+extern int16_t dcEstDev[2];             // [ADC bits, Q4] filtered estimate minus shunt, left / right
+#endif
+
+#if defined(IDLE_POWER_SAVE)
+extern uint8_t idleReq;                 // [-] main loop: parked, slow down the control interrupt and switch off the outputs
+extern uint8_t idleWake;                // [-] control interrupt: a hall sensor changed in idle, cleared by the main loop
+extern uint32_t idleTicks;              // [ticks] time spent in idle
+#endif
+
+#if defined(PWM_CARRIER_DOUBLE)
+extern uint8_t pwmCarrierReq;           // [-] main loop: PWM_FREQ multiple of the carrier, 1 or 2
+extern uint8_t pwmCarrier;              // [-] control interrupt: PWM_FREQ multiple of the running carrier
+#endif
+
+#if defined(REGEN_LIMIT)
+extern Regen regen;                     // regenerative braking limit and energy count, regenStep in the monitor task
+#endif
+#if defined(ANTILOCK_BRAKE)
+extern Antilock antilock;               // anti-lock braking, antilockStep in the slow task
+#endif
+
+// ADC offset calibration
+enum calibChannels {CALIB_RLA, CALIB_RLB, CALIB_RRB, CALIB_RRC, CALIB_DCL, CALIB_DCR, CALIB_CH};
+
+typedef struct {
+  uint16_t offset[CALIB_CH];            // [ADC counts] calibrated offsets, valid when done is set
+  uint16_t warm[CALIB_CH];              // [ADC counts] offsets saved at the last poweroff (CALIBRATION_ADAPTIVE)
+  uint8_t  warmValid;                   // [-] warm contains offsets read from EEPROM
+  uint8_t  done;                        // [-] calibration finished, bldc_control is running
+  uint16_t samples;                     // [samples] samples used by the last calibration
+  uint16_t drift;                       // [ADC counts] largest distance of a tracked offset from offset (OFFSET_TRACK)
+} AdcCalib;
+
+extern AdcCalib adcCalib;
+#if defined(ADC_INPUT_OVS)
+extern uint16_t adcInOvs[2];            // [ADC counts * ADC_INPUT_OVS] oversampled pot inputs l_tx2, l_rx2, see ADC_INPUT_OVS
+#endif
+
+// Control interrupt deadline miss monitor
+enum isrStages {ISR_STAGE_NONE, ISR_STAGE_CTRL, ISR_STAGE_REENTRY};
+#define ERR_DEADLINE_MISS       8       // z_errCode bit set when DEADLINE_MISS_FAULT trips (bits 1, 2, 4 are used by the BLDC controller diagnostics)
+
+typedef struct {
+  uint32_t cnt;                         // [-] total number of deadline misses
+  uint32_t worstCycles;                 // [cycles] longest interrupt duration that missed the deadline
+  uint32_t worstTime;                   // [ticks] mainCounter value of the worst miss
+  uint8_t  worstStage;                  // [-] stage during which the worst miss happened, see isrStages
+  uint16_t rate;                        // [1/s] number of misses in the last second
+  uint16_t cntWin;
+  uint16_t winTicks;
+  uint8_t  fault;                       // [-] latched deadline miss fault
+  uint32_t pwmLate[2];                  // [-] ticks where the new left/right duty missed the first timer update after the current sampling
+} IsrDeadlineMiss;
+
+extern IsrDeadlineMiss isrMiss;
+
+#if defined(BLACKBOX_ENABLE)
+  enum blackboxStates {BLACKBOX_ARMED, BLACKBOX_TRIGGERED, BLACKBOX_FROZEN};
+  #define BLACKBOX_ERR          0x0F    // flags bits: z_errCode
+  #define BLACKBOX_MODE_SHIFT   4       // flags bits 4..5: z_ctrlModReq of the step
+  #define BLACKBOX_ENA          0x40    // flags bit: b_motEna of the step
+  #define BLACKBOX_CHOP         0x80    // flags bit: DC current chopping active
+
+  typedef struct {
+    int16_t  curA;                      // [-] first measured phase current (ADC counts)
+    int16_t  curB;                      // [-] second measured phase current (ADC counts)
+    int16_t  curDC;                     // [-] DC link current (ADC counts)
+    int16_t  dutyA;                     // [-] controller duty outputs DC_phaA/B/C
+    int16_t  dutyB;
+    int16_t  dutyC;
+    int16_t  n_mot;                     // [rpm] measured speed
+    uint8_t  hall;                      // [-] hall index: bit0 = U, bit1 = V, bit2 = W
+    uint8_t  flags;                     // [-] z_errCode | z_ctrlModReq << BLACKBOX_MODE_SHIFT | BLACKBOX_ENA | BLACKBOX_CHOP
+    int16_t  inpTgt;                    // [-] controller input r_inpTgt. With the inputs above a sample replays the step (host/sil -r)
+  } BlackBoxMotor;
+
+  typedef struct {
+    BlackBoxMotor left;
+    BlackBoxMotor right;
+  } BlackBoxSample;
+
+  typedef struct {
+    BlackBoxSample buf[BLACKBOX_DEPTH];
+    uint16_t wr;                        // [-] next write index
+    uint16_t cnt;                       // [-] number of valid samples
+    uint16_t trig;                      // [-] index of the trigger sample
+    uint16_t post;                      // [samples] samples left to record after the trigger
+    uint8_t  decim;                     // [-] decimation counter
+    uint8_t  state;                     // [-] see blackboxStates
+    uint8_t  arm;                       // [-] set to 1 to clear and re-arm
+    uint32_t trigTime;                  // [ticks] buzzerTimer value of the trigger
+  } BlackBox;
+
+  extern BlackBox blackbox;
+#endif
+
+#if defined(SCOPE_ENABLE)
+  enum scopeStates {SCOPE_IDLE, SCOPE_ARMED, SCOPE_TRIGGERED, SCOPE_DONE};
+  enum scopeEdges  {SCOPE_RISE, SCOPE_FALL, SCOPE_BOTH};
+
+  typedef struct {
+    const volatile void *src[SCOPE_CH]; // sampled variables, changed by $SCOPE only while not armed
+    uint8_t  type[SCOPE_CH];            // [-] enum types of comms.h, width and sign of src
+    uint8_t  n;                         // [-] channels
+    uint8_t  arm;                       // [-] 1: clear and arm, 2: trigger now (armed first if needed), taken by the control interrupt
+    uint8_t  trigCh;                    // [-] 0: command trigger only, 1..n: channel compared with level
+    uint8_t  edge;                      // [-] see scopeEdges
+    int16_t  level;                     // [-] trigger level, internal value of the trigger channel
+    uint8_t  pre;                       // [%] share of the depth before the trigger
+    uint8_t  state;                     // [-] see scopeStates
+    uint16_t decim;                     // [-] record every Nth control cycle
+    uint16_t dec;                       // [-] decimation counter
+    uint16_t depth;                     // [samples] SCOPE_WORDS / n, set when armed
+    uint16_t preN;                      // [samples] samples before the trigger, set when armed
+    uint16_t wr;                        // [-] next write sample
+    uint16_t cnt;                       // [-] number of valid samples
+    uint16_t trig;                      // [-] sample index of the trigger
+    uint16_t post;                      // [samples] samples left to record after the trigger
+    int32_t  prev;                      // [-] previous value of the trigger channel
+    uint32_t trigTime;                  // [us] timeUs() of the trigger
+    int32_t  buf[SCOPE_WORDS];          // n values per sample
+  } Scope;
+
+  extern Scope scope;
+#endif
+
+#if defined(ISR_PROFILING)
+  #define ISR_PERIOD_CYCLES     (SYSCLK_HZ / PWM_FREQ)  // [cycles] CPU cycles available per control interrupt
+  #define ISR_PROF_MEAN_SHIFT   10                      // [-] mean is calculated over 2^ISR_PROF_MEAN_SHIFT samples
+  #define ISR_PROF_HIST_BINS    8                       // [-] histogram bins, each bin is ISR_PERIOD_CYCLES / ISR_PROF_HIST_BINS wide. Last bin also counts overruns
+
+  enum isrProfPhases {ISR_PROF_TOTAL, ISR_PROF_CTRL, ISR_PROF_MOT_L, ISR_PROF_MOT_R, ISR_PROF_BUZZER, ISR_PROF_BAT, ISR_PROF_HOOKS, ISR_PROF_PHASES};
+
+  typedef struct {
+    uint16_t last;                      // [cycles] last measured duration
+    uint16_t min;                       // [cycles] minimum duration since reset
+    uint16_t max;                       // [cycles] maximum duration since reset
+    uint16_t mean;                      // [cycles] mean duration of the last 2^ISR_PROF_MEAN_SHIFT samples
+    uint32_t sum;
+    uint16_t cnt;
+  } IsrProfPhase;
+
+  extern IsrProfPhase isrProf[ISR_PROF_PHASES];
+  extern uint32_t isrProfHist[ISR_PROF_HIST_BINS];
+  extern uint8_t  isrProfRst;           // set to 1 to reset the statistics. Reset is done in the interrupt
+#endif
@@ -0,0 +1,79 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// UART bootloader (Boot/boot.c) and the application built behind it with "make BOOTLOADER=1".
+//
+// Flash layout:  0x08000000  bootloader, BOOT_SIZE
+//                0x08002000  application header page, BootHeader, written last by an update
+//                0x08002800  application vector table and image (_boot_size in STM32F103RCTx_FLASH.ld)
+//                0x0803C000  NVM: trip log, fault log and EEPROM emulation, never touched by the bootloader
+//
+// After a reset the bootloader listens BOOT_WAIT ms on the USART2 and USART3 sensor cables for BOOT_SYNC_CNT sync
+// bytes, then starts a valid application. It stays when the header or the image CRC do not match, or when the
+// application requested an update with $BOOT (BKP->DR1 = BOOT_REQ_MAGIC). The header page is erased at the start
+// of an update and written only after the image CRC was verified in flash, so an interrupted update never starts a
+// half written image: the board comes up in the bootloader again and the update is simply repeated.
+//
+// Protocol, BOOT_BAUD 8N1, little endian, CRC = calc_crc32 (CRC32C, init 1, as the serial frames):
+//   host: BOOT_SYNC ...                                 boot: BOOT_ACK BOOT_VERSION
+//   host: BOOT_SOF cmd seq[2] len[2] payload[len] crc[4] boot: BOOT_ACK | BOOT_NAK, seq[2], status
+//   crc over cmd ... payload. BEGIN carries size, crc and version of the image (BootHeader without magic and hdrCrc),
+//   DATA the image offset[4] + up to BOOT_BLOCK bytes in order, END has no payload, RESET starts the application.
+// A DATA frame is acknowledged as soon as it is checked, then programmed while the DMA receives the next one. A
+// programming error is reported on the next frame. A repeated frame (lost ACK) is acknowledged again, not written.
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stdint.h>
+
+#define BOOT_SIZE           0x2000      // [bytes] bootloader code
+#define BOOT_HDR_ADDR       0x08002000  // application header page
+#define BOOT_APP_ADDR       0x08002800  // application vector table, 0x200 aligned for SCB->VTOR
+#define BOOT_APP_END        0x0803C000  // start of the NVM region of STM32F103RCTx_FLASH.ld
+#define BOOT_PAGE           0x800       // [bytes] flash page of the STM32F103RC
+#define BOOT_BLOCK          1024        // [bytes] max image bytes of a DATA frame
+
+#define BOOT_BAUD           460800      // [bit/s] update baud rate, 0.6 % off at the 32 MHz APB1 of the bootloader
+#define BOOT_WAIT           100         // [ms] sync window after a reset, 0 = only with $BOOT or without a valid application
+#define BOOT_IDLE           60000       // [ms] no frame for this long: start the application, or power off without one
+#define BOOT_SYNC_CNT       4           // [-] consecutive BOOT_SYNC bytes that start a session
+#define BOOT_VERSION        1           // [-] protocol version, answered to the sync
+
+#define BOOT_SYNC           0x7F
+#define BOOT_SOF            0xB5
+#define BOOT_ACK            0x79
+#define BOOT_NAK            0x1F
+#define BOOT_REQ_MAGIC      0xB007      // BKP->DR1: update requested by the application
+#define BOOT_HDR_MAGIC      0x31425648  // "HVB1"
+
+enum bootCommands {BOOT_CMD_BEGIN = 1, BOOT_CMD_DATA, BOOT_CMD_END, BOOT_CMD_RESET};
+enum bootStatus   {BOOT_OK, BOOT_ERR_CRC, BOOT_ERR_CMD, BOOT_ERR_SIZE, BOOT_ERR_ORDER, BOOT_ERR_FLASH, BOOT_ERR_VERIFY};
+
+typedef struct {
+  uint32_t magic;                       // BOOT_HDR_MAGIC
+  uint32_t size;                        // [bytes] image size
+  uint32_t crc;                         // calc_crc32 of the image
+  uint32_t version;                     // image version, free for the fleet tooling
+  uint32_t hdrCrc;                      // calc_crc32 of the words above
+} BootHeader;
+
+#if defined(BOOTLOADER)
+void bootEnter(void);                   // application side: restart into the bootloader (util.c)
+#endif
+
+#endif // BOOT_H
@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+
+// COBS framing with CRC-16 of the command and feedback ports, SERIAL_COBS (see cobs.c and protocol.h).
+#define COBS_MSG_MAX            64      // [bytes] longest start / checksum frame cobsFrame and cobsUnframe take
+#define COBS_ENC_MAX(n)         ((n) + (n) / 254 + 2)   // [bytes] longest encoding of n bytes, delimiter included
+
+uint16_t crc16(const uint8_t *buf, uint16_t len);
+uint16_t cobsEncode(const uint8_t *src, uint16_t len, uint8_t *dst);
+uint16_t cobsDecode(const uint8_t *src, uint16_t len, uint8_t *dst);
+uint16_t cobsFrame(const uint8_t *frame, uint16_t len, uint8_t *dst);
+uint16_t cobsUnframe(uint8_t *enc, uint16_t len, uint8_t *frame, uint16_t max);
@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+
+// Cogging torque compensation, COGGING_COMP. The motor turns in SPD_MODE at a constant low speed, where the speed loop
+// cancels the cogging torque: its q axis current minus the mean, recorded over the electrical angle, is the torque the
+// table adds to the TORQUE mode target (see cogging.c).
+#define COG_BINS                64      // [-] table bins per electrical turn
+#define COG_WORDS               (COG_BINS / 2)  // [-] EEPROM words per motor, two int8 bins each
+
+enum cogStates {COG_IDLE, COG_SETTLE_FWD, COG_FWD, COG_SETTLE_REV, COG_REV, COG_DONE, COG_FAIL};
+
+typedef struct {
+  int32_t  sum[COG_BINS];               // [ADC bits, fixdt(1,16,4)] iq sums of the running direction
+  uint16_t cnt[COG_BINS];               // [-] number of summed ticks
+  int16_t  res[2][COG_BINS];            // [ADC bits, fixdt(1,16,4)] iq minus mean per bin, forward / reverse
+  uint32_t ticks;                       // [ticks] time in the current state
+  int8_t   tab[COG_BINS];               // [-] compensation in r_inpTgt units (1000 = i_max), applied in TORQUE mode
+  uint8_t  state;                       // [-] cogStates
+} Cogging;
+
+void    cogStart(Cogging *c);
+void    cogInput(const Cogging *c, int16_t nMax, uint8_t *mode, int16_t *inpTgt);
+void    cogStep(Cogging *c, int16_t angle, int16_t n, int16_t iq, int16_t iMax);
+int16_t cogComp(const Cogging *c, int16_t angle, int16_t n);
@@ -26,6 +26,13 @@
 #if defined(DEBUG_SERIAL_PROTOCOL)
 
 enum types {UINT8_T,UINT16_T,UINT32_T,INT8_T,INT16_T,INT32_T,INT,FLOAT};
+enum paramTypes {PARAMETER,VARIABLE};     // params[] entry type, only a PARAMETER can be set and saved
+// int32_t is long on the ARM toolchain but int on the host build (make host-fuzz), where plain int is an int32_t
+#if defined(__arm__)
+  #define TYPENAME_INT  int: INT,
+#else
+  #define TYPENAME_INT
+#endif
 #define typename(x) _Generic((x), \
     uint8_t:    UINT8_T, \
     uint16_t:   UINT16_T, \
@@ -33,14 +40,28 @@ enum types {UINT8_T,UINT16_T,UINT32_T,INT8_T,INT16_T,INT32_T,INT,FLOAT};
     int8_t:     INT8_T, \
     int16_t:    INT16_T, \
     int32_t:    INT32_T, \
-    int:        INT, \
+    TYPENAME_INT \
     float:      FLOAT)
 
 #define PARAM_SIZE(param) sizeof(param) / sizeof(parameter_entry)
 #define COMMAND_SIZE(command) sizeof(command) / sizeof(command_entry)
 
+// Help texts of commands[] and params[], DEBUG_NO_HELP leaves them out of the flash
+#if defined(DEBUG_NO_HELP)
+  #define HELP(text)  ""
+#else
+  #define HELP(text)  text
+#endif
+
 #define SIZEP(x) ((char*)(&(x) + 1) - (char*)&(x))
-#define ADD_PARAM(var) typename(var),&var
+
+// params[] ids from Inc/params.def, e.g. PARAM_ID_I_MOT_MAX. They depend on the configuration, like the "#<id>" of the protocol
+enum paramIds {
+  #define PARAM(type, name, ...)    PARAM_ID_##name,
+  #define PARAM_CONST(name, ...)    PARAM_ID_##name,
+  #include "params.def"
+  PARAM_COUNT
+};
 
 
 int32_t extToInt(uint8_t index,int32_t value);
@@ -54,6 +75,7 @@ int8_t initParamVal(uint8_t index);
 int8_t incrParamVal(uint8_t index);
 
 int8_t saveAllParamVal();
+uint8_t loadAllParamVal();
 int16_t getParamInitInt(uint8_t index);
 int32_t getParamInitExt(uint8_t index);
 int8_t printCommandHelp(uint8_t index);
@@ -64,11 +86,80 @@ int8_t printParamDef(uint8_t index);
 int8_t printAllParamDef();
 void printError(uint8_t errornum );
 int8_t watchParamVal(uint8_t index);
+int8_t streamParamVal(uint8_t index);
 
 int8_t findCommand(uint8_t *userCommand, uint32_t len);
-int8_t findParam(uint8_t *userCommand, uint32_t len);
+int8_t findParam(uint8_t *userCommand, uint32_t len, uint8_t *size);
 void handle_input(uint8_t *userCommand, uint32_t len);
+void handle_input_chunk(const uint8_t *data, uint32_t len);
 void process_debug();
+void process_commands();
+void process_stream();
+void process_bin_commands();
+#if defined(BLACKBOX_ENABLE)
+int8_t dumpBlackbox();
+void process_blackbox();
+#endif
+#if defined(SCOPE_ENABLE)
+int8_t dumpScope();
+int8_t scopeParamVal(uint8_t index);
+void process_scope();
+#endif
+#if defined(SCHED_STATS)
+int8_t dumpSched();
+void process_sched();
+#endif
+#if defined(LATENCY_MEAS)
+int8_t dumpLat();
+void process_lat();
+#endif
+#if defined(CTRL_HOOKS)
+int8_t dumpHooks();
+void process_hooks();
+#endif
+#if defined(FAULTLOG_ENABLE)
+int8_t dumpFaultLog();
+void process_faultlog();
+#endif
+#if defined(HALL_CALIB)
+int8_t startHallCalib();
+void process_hallcal();
+#endif
+#if defined(HALL_STATS)
+int8_t dumpHallStat();
+void process_hallstat();
+#endif
+#if defined(MOTOR_IDENT)
+int8_t startMotorIdent();
+void process_motid();
+#endif
+#if defined(ADC_SAMPLE_ALIGN)
+int8_t startAdcSweep();
+void process_adcsweep();
+#endif
+#if defined(COGGING_COMP)
+int8_t startCogCalib();
+void process_cogcal();
+#endif
+#if defined(SPD_FILT)
+int8_t startSpdIdent();
+void process_spdid();
+#endif
+#if defined(BOOTLOADER)
+int8_t startBoot();
+#endif
+#if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+int8_t startInputCalib();
+int8_t startInputLimits();
+#endif
+
+extern uint16_t streamRate;
+extern uint32_t cmdQueueDrop;
+extern uint32_t binReqDrop;
+
+enum binOps {BIN_OP_GET = 0x01, BIN_OP_SET = 0x02};
+#define BIN_OP_REPLY  0x80      // set in the op of a response
+#define BIN_OP_ERROR  0x40      // set in the op of a response to a rejected request
 
 
 typedef struct debug_command_struct debug_command;
@@ -78,6 +169,7 @@ struct debug_command_struct {
   int8_t command_index;
   int8_t param_index;
   int32_t param_value;
+  int16_t id;                   // response ID from "$@<id> ...", -1 = none
 };
 
 typedef struct command_entry_struct command_entry;
@@ -90,23 +182,27 @@ struct command_entry_struct {
   const char *help;
 };
 
+// params[] entry, generated from Inc/params.def. Pointers first and the small fields packed, 40 bytes instead of 56,
+// the help pointer is left out with DEBUG_NO_HELP
 typedef struct parameter_entry_struct parameter_entry;
 struct parameter_entry_struct {
-  const uint8_t type;
   const char *name;
-  const uint8_t datatype;
-  void *valueL;
-  void *valueR;
-  const uint16_t addr;
+  void *valueL;                         // NULL for a PARAM_CONST, its value is init
+  void *valueR;                         // second motor or NULL
+  void (*callback_function)();
+  #if !defined(DEBUG_NO_HELP)
+  const char *help;
+  #endif
   const int32_t init;
-  const uint8_t initFormat;
   const int32_t min;
   const int32_t max;
+  const uint16_t addr;
+  const uint8_t type       : 1;         // paramTypes
+  const uint8_t initFormat : 1;
+  const uint8_t datatype   : 3;         // types
   const uint8_t div;
   const uint8_t mul;
   const uint8_t fix;
-  void (*callback_function)();
-  const char *help;
 };
 
 #endif  // DEBUG_SERIAL_PROTOCOL
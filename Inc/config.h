@@ -20,13 +20,39 @@
   //#define VARIANT_HOVERBOARD  // Variant for HOVERBOARD build
   //#define VARIANT_TRANSPOTTER // Variant for TRANSPOTTER build https://github.com/NiklasFauth/hoverboard-firmware-hack/wiki/Build-Instruction:-TranspOtter https://hackaday.io/project/161891-transpotter-ng
   //#define VARIANT_SKATEBOARD  // Variant for SKATEBOARD build
+  //#define VARIANT_BENCH       // Cycle benchmark on the board, motor outputs off (see bench.c)
 #endif
 // ########################### END OF VARIANT SELECTION ############################
 
 
 // ############################### DO-NOT-TOUCH SETTINGS ###############################
-#define PWM_FREQ            16000     // PWM frequency in Hz / is also used for buzzer
-#define DEAD_TIME              48     // PWM deadtime
+#ifndef PWM_FREQ
+  #define PWM_FREQ          16000     // [Hz] PWM and control interrupt frequency, 16000 (default) to 24000 in 1000 steps. Higher = quieter, more switching losses, less ISR time (see ISR_PROFILING)
+#endif
+#define PWM_FREQ_BASE       16000     // [Hz] rate the generated controller parameters were tuned for. BLDC_Init rescales the tick based ones to PWM_FREQ
+#define PWM_RES_BASE        (64000000 / 2 / PWM_FREQ_BASE)  // [timer counts] period the controller duties are scaled for, +-1000 = full duty at 2000
+
+// System clock: the internal HSI oscillator with PLL to 64 MHz (default), or the 8 MHz HSE crystal with PLL to the 72 MHz
+// maximum, 12 % more ISR time and crystal accuracy for the UART baud rates and the control timing. Only where the crystal is
+// populated: without it the board starts on the HSI at 64 MHz, then PWM_FREQ and all timing are 11 % slow
+// #define CLOCK_HSE                    // [-] Enable the 72 MHz HSE clock
+
+// Mainboard MCU. Boards with a GD32F103 or AT32F403 in place of the STM32F103 (docs/20190620_at32_hover_sch.pdf) run the
+// same build, their peripherals are register compatible, but stay at 64 MHz. Select the part to run it at its rated
+// clock from the HSI, see Inc/mcu.h. Or make -e MCU_TYPE=GD32F103 / AT32F403. Not on an STM32F103, it would not start
+// #define MCU_GD32F103                 // [-] GD32F103: 108 MHz, 69 % more ISR time
+// #define MCU_AT32F403                 // [-] AT32F403 / AT32F403A: 240 MHz, 3.75 times the ISR time
+#if defined(MCU_AT32F403)
+  #define SYSCLK_HZ     240000000     // [Hz] CPU and PWM timer clock
+#elif defined(MCU_GD32F103)
+  #define SYSCLK_HZ     108000000
+#elif defined(CLOCK_HSE)
+  #define SYSCLK_HZ      72000000
+#else
+  #define SYSCLK_HZ      64000000
+#endif
+#define PWM_RES       (SYSCLK_HZ / 2 / PWM_FREQ)  // [timer counts] center aligned PWM period, 2000 at 64 MHz and 16 kHz
+#define DEAD_TIME     (48 * (SYSCLK_HZ / 1000000) / 64)  // PWM deadtime, 48 counts = 750 ns at 64 MHz
 #ifdef VARIANT_TRANSPOTTER
   #define DELAY_IN_MAIN_LOOP    2
 #else
@@ -34,7 +60,6 @@
 #endif
 #define TIMEOUT                20     // number of wrong / missing input commands before emergency off
 #define A2BIT_CONV             50     // A to bit for current conversion on ADC. Example: 1 A = 50, 2 A = 100, etc
-// #define PRINTF_FLOAT_SUPPORT          // [-] Uncomment this for printf to support float on Serial Debug. It will increase code size! Better to avoid it!
 
 // ADC conversion time definitions
 #define ADC_CONV_TIME_1C5       (14)  //Total ADC clock cycles / conversion = (  1.5+12.5)
@@ -51,11 +76,25 @@
 #define ADC_CONV_CLOCK_CYCLES   (ADC_CONV_TIME_7C5)
 
 // Set the configured ADC divider. This parameter needs to be the same ADC divider as PeriphClkInit.AdcClockSelection (see main.c)
-#define ADC_CLOCK_DIV           (4)
+#if defined(MCU_AT32F403)
+  #define ADC_CLOCK_DIV         (12)  // 20 MHz, APB2 / 6 with APB2 at half the system clock. The ADC maximum is 28 MHz
+#elif defined(MCU_GD32F103)
+  #define ADC_CLOCK_DIV         (8)   // 13.5 MHz
+#elif defined(CLOCK_HSE)
+  #define ADC_CLOCK_DIV         (6)   // 12 MHz, the ADC maximum is 14 MHz
+#else
+  #define ADC_CLOCK_DIV         (4)   // 16 MHz
+#endif
 
 // ADC Total conversion time: this will be used to offset TIM8 in advance of TIM1 to align the Phase current ADC measurement
-// This parameter is used in setup.c
-#define ADC_TOTAL_CONV_TIME     (ADC_CLOCK_DIV * ADC_CONV_CLOCK_CYCLES) // = ((SystemCoreClock / ADC_CLOCK_HZ) * ADC_CONV_CLOCK_CYCLES), where ADC_CLOCK_HZ = SystemCoreClock/ADC_CLOCK_DIV
+// This parameter is used in setup.c. With ADC_OVERSAMPLE the middle of the phase current burst is aligned
+#define ADC_TOTAL_CONV_TIME     (ADC_CLOCK_DIV * ADC_CONV_CLOCK_CYCLES * ADC_OVERSAMPLE) // = ((SystemCoreClock / ADC_CLOCK_HZ) * ADC_CONV_CLOCK_CYCLES), where ADC_CLOCK_HZ = SystemCoreClock/ADC_CLOCK_DIV
+
+// Regular group conversions (ADC1 + ADC2 pairs, one DMA word each): DC link currents (not with DC_LINK_EST), then the phase currents ADC_OVERSAMPLE times
+#define ADC_REG_WORDS           (ADC_DC_REG + 2 * ADC_OVERSAMPLE)
+
+// FOC phase current sampling window at the top of the PWM period, it follows the ADC conversion time
+#define PWM_MARGIN              (110 * ADC_CLOCK_DIV / 4 + (ADC_OVERSAMPLE - 1) * ADC_CLOCK_DIV * ADC_CONV_CLOCK_CYCLES) // [timer counts] 110 = 1.7 us at 64 MHz, plus one conversion per extra sample
 // ########################### END OF  DO-NOT-TOUCH SETTINGS ############################
 
 // ############################### BOARD VARIANT ###############################
@@ -79,13 +118,27 @@
 #define BAT_LVL2_ENABLE         0         // to beep or not to beep, 1 or 0
 #define BAT_LVL1_ENABLE         1         // to beep or not to beep, 1 or 0
 #define BAT_DEAD_ENABLE         1         // to poweroff or not to poweroff, 1 or 0
-#define BAT_BLINK_INTERVAL      80        // battery led blink interval (80 loops * 5ms ~= 400ms)
+#define BAT_BLINK_INTERVAL      80        // battery led blink interval (80 sideboard ticks * 5ms ~= 400ms)
 #define BAT_LVL5                (390 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE    // Green blink:  no beep
 #define BAT_LVL4                (375 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE    // Yellow:       no beep
 #define BAT_LVL3                (360 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE    // Yellow blink: no beep 
 #define BAT_LVL2                (345 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE    // Red:          gently beep at this voltage level. [V*100/cell]. In this case 3.60 V/cell
 #define BAT_LVL1                (330 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE    // Red blink:    fast beep. Your battery is almost empty. Charge now! [V*100/cell]. In this case 3.50 V/cell
 #define BAT_DEAD                (300 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE    // All leds off: undervoltage poweroff. (while not driving) [V*100/cell]. In this case 3.37 V/cell
+
+/* State of charge estimation: counts the charge drawn through the DC link current and corrects it with the voltage,
+ * compensated for the sag under load with a learned internal resistance (see battery.c). The charge thresholds below
+ * then replace BAT_LVL1..5 and BAT_DEAD, with the same LEDs and beeps. The remaining charge is saved at power off.
+ */
+// #define BAT_SOC_ENABLE                 // Enable the state of charge estimation
+#define BAT_CAPACITY            4400      // [mAh] usable battery capacity, 4.4 Ah for a normal hoverboard battery
+#define BAT_R_INT               200       // [mOhm] battery internal resistance, start value of the estimate
+#define BAT_I_BOARD             10        // [A*100] board consumption not seen by the DC link current, counted on top
+#define BAT_SOC_LVL5            60        // [%] Green blink
+#define BAT_SOC_LVL4            45        // [%] Yellow
+#define BAT_SOC_LVL3            30        // [%] Yellow blink
+#define BAT_SOC_LVL2            15        // [%] Red, gently beep (BAT_LVL2_ENABLE)
+#define BAT_SOC_LVL1            7         // [%] Red blink, fast beep (BAT_LVL1_ENABLE). At 0 % the board powers off (BAT_DEAD_ENABLE)
 // ######################## END OF BATTERY ###############################
 
 
@@ -108,6 +161,16 @@
 #define TEMP_WARNING            600       // annoying fast beeps [°C * 10].  Here 60.0 °C
 #define TEMP_POWEROFF_ENABLE    0         // to poweroff or not to poweroff, 1 or 0, DO NOT ACTIVITE WITHOUT CALIBRATION!
 #define TEMP_POWEROFF           700       // overheat poweroff. (while not driving) [°C * 10]. Here 65.0 °C
+
+/* The temperature sensor needs 239.5 ADC cycles (17 us) of sampling, the injected group spends them in every PWM period.
+ * ADC_TEMP_DECIM converts it, and VREFINT for the supply voltage VDDA, only every ADC_TEMP_PERIOD ms in turn, the other
+ * groups take 2 x 20 ADC cycles. With TEMP_VREF_COMP the temperature ADC value is scaled to VDDA = 3.3 V before the filter,
+ * the calibration above must then be done with it.
+*/
+// #define ADC_TEMP_DECIM                 // [-] Enable the decimated temperature and VREFINT sampling
+#define ADC_TEMP_PERIOD         5         // [ms] temperature and VREFINT sample period, each is sampled every 2 periods
+#define ADC_VREFINT_MV          1200      // [mV] VREFINT, 1160 .. 1240 between chips
+#define TEMP_VREF_COMP          0         // [-] 1 = compensate the VDDA drift of the temperature sensor, 0 = off
 // ######################## END OF TEMPERATURE ###############################
 
 
@@ -141,6 +204,7 @@
 #define VLT_MODE        1               // [-] VOLTAGE mode
 #define SPD_MODE        2               // [-] SPEED mode
 #define TRQ_MODE        3               // [-] TORQUE mode
+#define POS_MODE        4               // [-] POSITION mode, serial PROTO_CMD_POS frames only (POS_CTRL). The controller runs in SPD_MODE
 
 // Enable/Disable Motor
 #define MOTOR_LEFT_ENA                  // [-] Enable LEFT motor.  Comment-out if this motor is not needed to be operational
@@ -149,23 +213,264 @@
 // Control selections
 #define CTRL_TYP_SEL    FOC_CTRL        // [-] Control type selection: COM_CTRL, SIN_CTRL, FOC_CTRL (default)
 #define CTRL_MOD_REQ    VLT_MODE        // [-] Control mode request: OPEN_MODE, VLT_MODE (default), SPD_MODE, TRQ_MODE. Note: SPD_MODE and TRQ_MODE are only available for CTRL_FOC!
+// #define CTRL_FIXED                   // [-] Compile the controller for CTRL_TYP_SEL and CTRL_MOD_REQ only: the branches of the other types and modes are removed (smaller, shorter ISR). CTRL_TYP and CTRL_MOD can then not be changed at runtime
+// #define CTRL_MULTIRATE               // [-] Run the FOC current PI (speed PI in SPD_MODE) every control tick and Diagnostics + Control Mode Manager and Field Weakening + Motor Limitations once per CTRL_SLOW_DIV ticks each, on other ticks than the other motor. Default: the three groups take turns, one per tick
+// #define CTRL_DSP                     // [-] Forward and inverse Park transforms with the dual 16 bit multiply-accumulate of the Cortex-M4 (SMUAD / SMUSD, make -e MCU_TYPE=AT32F403), plain C on the M3. Both products of an axis are summed before the one truncation, the generated code truncates each: up to 1 bit apart
+#define CTRL_SLOW_DIV   4               // [ticks] CTRL_MULTIRATE slow task period: 4, 6 or 8. With 4 every tick runs exactly one slow group. Above 8 the current limitation in SPD_MODE gets too slow for a stalled motor
+// #define PARAM_STAGED                 // [-] The controllers run on a copy of rtP_Left / rtP_Right that is swapped in at a tick boundary once per main loop (DELAY_IN_MAIN_LOOP), both motors at once. Parameter changes, also many "$SET" in a row, then never take effect half way
 #define DIAG_ENA        1               // [-] Motor Diagnostics enable flag: 0 = Disabled, 1 = Enabled (default)
 
 // Limitation settings
 #define I_MOT_MAX       20              // [A] Maximum single motor current limit
 #define I_DC_MAX        25              // [A] Maximum stage2 DC Link current limit for Commutation and Sinusoidal types (This is the final current protection. Above this value, current chopping is applied. To avoid this make sure that I_DC_MAX = I_MOT_MAX + 2A)
+// #define DC_FOLDBACK                  // [-] Soft stage2 limit: above I_DC_FOLD the three duties of the motor are scaled down instead of chopped, the MOE cut above I_DC_MAX stays as the last resort
+#define I_DC_FOLD       22              // [A] DC_FOLDBACK start, below I_DC_MAX
+#define DC_FOLD_ATTACK  8               // [1/32768 per ADC count per tick] duty scale decrease per count above I_DC_FOLD
+#define DC_FOLD_RELEASE 16              // [1/32768 per tick] duty scale recovery below I_DC_FOLD, 128 ms from 0 to full at 16 kHz
+// #define DC_BUDGET                    // [-] One battery current budget for both motors (dcbudget.c): split each tick from their battery currents, a motor gets what the other one leaves and at least half. Lowers the i_max of each controller step
+#define DC_BUDGET_I     30              // [A] battery current of both motors together
+#define DC_BUDGET_P     0               // [W] battery power of both motors together, 0 = current budget only
+#define DC_BUDGET_FILT  4               // [-] filter of the battery currents and iq, 2^4 ticks = 1 ms at 16 kHz
+// #define HW_BREAK                     // [-] Hardware overcurrent trip: the break input of the motor timer, BKIN of TIM8 (left, PA6) and TIM1 (right, PB12), switches the outputs off within a few clock cycles instead of at the next control tick.
+                                        //     Only for boards with an overcurrent comparator wired to these pins, the stock boards leave them open. The control interrupt re-arms the outputs on the next tick, as after a stage2 chop, and counts the trips (BRK_L, BRK_R)
+#define HW_BREAK_POLARITY TIM_BREAKPOLARITY_LOW  // [-] Active level of the comparator output: TIM_BREAKPOLARITY_LOW (the pin is pulled up) or TIM_BREAKPOLARITY_HIGH (pulled down)
 #define N_MOT_MAX       2000            // [rpm] Maximum motor speed limit
 //Curremt calibration samples for Motor current reading
 #define CALIBRATION_SAMPLES 2048
+// #define CALIBRATION_ADAPTIVE         // [-] Stop the ADC offset calibration as soon as all offsets settle, runs during the power-on melody and uses the offsets saved at the last poweroff as warm start
+#define CALIBRATION_MIN_SAMPLES 128     // [samples] minimum number of calibration samples in adaptive mode (8 ms at 16 kHz). CALIBRATION_SAMPLES is the maximum
+#define CALIBRATION_WARM_TOL    8       // [ADC counts] accept the calibration after CALIBRATION_MIN_SAMPLES if every offset is this close to the saved one
+// #define OFFSET_TRACK                 // [-] Follow the ADC offset drift with the board temperature: while the outputs are off (enable == 0) the mean of every 2^OFFSET_TRACK_SHIFT samples moves each offset of the motor by at most OFFSET_TRACK_SLEW
+#define OFFSET_TRACK_SHIFT      12      // [-] 4096 samples per step, 0.26 s at 16 kHz
+#define OFFSET_TRACK_SLEW       1       // [ADC counts] max offset change per step
+#define OFFSET_TRACK_BAND       64      // [ADC counts] a step with a sample this far from the offset is dropped: current still decaying, or a wheel turning faster than the battery voltage allows
+#define OFFSET_TRACK_MAX        48      // [ADC counts] max drift from the power-on calibration
+// Phase current oversampling
+#define ADC_OVERSAMPLE          1       // [-] samples of every phase current per PWM period: 1 (default), 2 or 4, averaged before the controller. The burst is centred on the PWM top and PWM_MARGIN grows by one conversion per extra sample: with 4 FOC_VOLT_MAX must be lowered to about 825
+// DC link current from the phase currents: the battery current of a motor is the sum of its phase currents times their
+// high side duties. The controller and the stage2 chopping take this sum of the period the currents were sampled in, the
+// DC link shunts move from the phase current burst to the slow channels (ADC injected group): the burst, and so the time
+// from the sampling to the control interrupt and the new duties, is one conversion shorter. The shunts, one tick later,
+// cross-check the sum (DCE_DEV_L, DCE_DEV_R) and stay the DC link current of COM and SIN, which have no sampling window
+// #define DC_LINK_EST                  // [-] Enable the DC link current estimate. Not with OVERMOD: a phase at the rail has no current sample
+#define DC_EST_FILT     6               // [-] filter of the cross-check, 2^6 ticks = 4 ms at 16 kHz
+#if defined(DC_LINK_EST)
+  #define ADC_DC_REG    0               // [conversions] DC link currents in the regular group
+#else
+  #define ADC_DC_REG    1
+#endif
+#define ADC_DC_INJ      (1 - ADC_DC_REG) // [conversions] DC link currents ahead of the slow channels in the injected group
+// Boot time
+// #define BOOT_PROFILE                 // [-] Time the boot phases (HAL, clock, peripherals, init, calibration, button release) and print them on the debug serial port when the main loop starts
+#define BOOT_BUDGET             300     // [ms] BOOT_PROFILE time to ready target, a longer boot is reported. The wait for the power button release is not counted
+// #define FAST_BOOT                    // [-] One short beep instead of the 1 s power on melody, the boot only waits for the ADC offset calibration. Best with CALIBRATION_ADAPTIVE
+#define FAST_BOOT_CALIB_TIMEOUT 300     // [ms] FAST_BOOT: continue after this time if the calibration keeps restarting (wheels turning)
+// #define SELF_TEST                    // [-] Boot self-test: the ADC offsets and hall inputs are checked at the end of the offset calibration, then short pulses on every phase must show up on the shunts (15 ms, during the melody).
+                                        //     A failed motor stays disabled, 6 beeps (low pitch). A board that passed and then turned all 6 hall positions without a fault skips the pulses at the next boot (see selftest.c)
+#define SELF_TEST_DUTY          20      // [-] pulse voltage of a phase against the two others, 1000 = the battery voltage: 20 = 2 % for 1 ms
+#define SELF_TEST_CUR           1       // [A] smallest current of a phase pulse on its own shunt
+// Speed estimate from the hall edge times
+// #define HALL_SPEED_EST               // [-] Feed speedAvg (standstill hold, electric brake, cruise control) from the time between hall edges instead of n_mot. Between edges the estimate decays as the time since the last edge grows
+#define HALL_SPEED_EDGES        2       // [-] edge intervals averaged, 1..6. 6 cancels the hall sensor placement error but lags more at low speed
+#define HALL_SPEED_TIMEOUT      500     // [ms] no hall edge for this long = standstill
+// Hall edge commutation. The hall sensors of this board are not on the inputs of a timer hall interface, so the edges
+// are taken with the EXTI interrupts (left lines 5..7, right lines 10..12), which preempt the control interrupt
+// #define HALL_COM_HW                  // [-] COM_CTRL: switch the block commutation in the hall edge interrupt to the next sector at the duties of the last controller step, instead of at the next control interrupt (up to one PWM period later). With HALL_SPEED_EST the edges are timed in us there. Not with CONTROL_PPM_RIGHT / CONTROL_PWM_RIGHT (EXTI lines 10, 11) nor PWM_CARRIER_DOUBLE
+// Hall sensor placement calibration. "$HALLCAL" (DEBUG_SERIAL_PROTOCOL) turns both motors open loop in both directions, WHEELS OFF THE GROUND,
+// measures the 6 hall edge angles and saves a per motor correction of the controller angle estimation to EEPROM (applied at once and at power on)
+// #define HALL_CALIB                   // [-] Enable the hall edge calibration and correction
+#define HALL_CALIB_VOLT         40      // [-] open loop voltage amplitude, 1000 = full. Raise it slowly if the wheels do not follow, only the phase resistance limits the current
+#define HALL_CALIB_SPEED        10      // [rpm] open loop wheel speed, the calibration takes about 15 s
+// Hall sensor quality statistics. "$HALLST" (DEBUG_SERIAL_PROTOCOL) prints per motor the hall edges into invalid states (000 / 111),
+// the skipped sectors, the direction reversals, and at steady speed the 6 sector widths and an edge jitter histogram, then starts over.
+// HST_* variables for the telemetry. Sector widths off 60 deg by a few deg are worth a $HALLCAL, a large jitter is not fixed by it
+// #define HALL_STATS                   // [-] Enable the hall sensor statistics. With the control tick as time base (no HALL_COM_HW) the widths and jitter only cover electrical periods of 360 ticks and more, 180 rpm at 15 pole pairs
+// Motor constant identification. "$MOTID" (DEBUG_SERIAL_PROTOCOL) measures phase resistance, inductance and rotor flux linkage
+// of both motors, WHEELS OFF THE GROUND: DC and square wave voltages along phase A, then a short VLT_MODE run. The results
+// are saved to EEPROM and read as MOTR*, MOTL*, MOTF* [mOhm, uH, uV s], the units of OBS_R, OBS_L and OBS_FLUX
+// #define MOTOR_IDENT                  // [-] Enable the $MOTID identification
+#define MOTOR_IDENT_CUR         8       // [A] DC test current, the rotor locks onto phase A with it. Lower it for small motors
+#define MOTOR_IDENT_VLT         400     // [-] VLT_MODE target of the flux measurement, high enough that the dead time effect is small
+#define MOTOR_IDENT_BW          500     // [Hz] current loop bandwidth of the d / q PI gains set from the identified R and L (at power on and after $MOTID), 0 = keep the generated gains
+// Cogging torque compensation. "$COGCAL" (DEBUG_SERIAL_PROTOCOL) turns both motors in SPD_MODE at COGGING_SPEED, WHEELS OFF THE GROUND,
+// first forward, then backward, and records the q axis current of the speed loop over the electrical angle. The ripple is saved
+// to EEPROM as a 64 bin table per motor and added to the TORQUE mode target at low speed (applied at once and at power on)
+// #define COGGING_COMP                 // [-] Enable the $COGCAL recording and the compensation
+#define COGGING_SPEED           30      // [rpm] recording speed, low enough that the speed loop follows the cogging
+#define COGGING_TIME            10      // [s] recording time per direction, plus 2 s of settling each
+#define COGGING_N_MAX           60      // [rpm] full compensation up to this speed, faded out at twice of it
+// Speed reference generator (SPD_MODE, filters.c refGenStep): the speed and steer commands follow a jerk limited profile
+// instead of RATE and FILTER (or the raw inputs with USE_RAW_INPUT). The back-EMF of the speed target (OBS_FLUX) and the R drop of the acceleration current
+// (OBS_R) are added to the speed PI output as a voltage feedforward, so the PI only corrects the remaining error
+// #define SPD_REF_GEN                  // [-] Enable the SPD_MODE reference generator and feedforward
+#define SPD_REF_ACC     500             // [rpm/s] maximum acceleration of the speed reference
+#define SPD_REF_JERK    5000            // [rpm/s^2] maximum change of the acceleration
+#define SPD_FF_ACC      10              // [mA per rpm/s] q axis current for the acceleration (wheel and load inertia), 0 = back-EMF feedforward only
+// Position control (posctrl.c): a serial command frame with PROTO_CMD_POS carries left / right position targets in hall steps
+// (the odo0 / odo1 frame of the feedback) instead of steer / speed. The control interrupt runs a position loop every POS_CTRL_DIV ticks
+// that gives the SPD_MODE speed target, limited to POS_SPD_MAX and POS_ACC. One hall step is 1 / (6 * pole pairs) turn.
+// Best with SPD_REF_GEN: its back-EMF feedforward makes the speed loop follow without the lag that overshoots the target
+// #define POS_CTRL                     // [-] Enable POS_MODE for PROTO_CMD_POS frames
+#define POS_CTRL_DIV    16              // [ticks] position loop period, 1 ms at 16 kHz
+#define POS_SPD_MAX     300             // [rpm] maximum speed of a position move
+#define POS_ACC         600             // [rpm/s] acceleration and braking of a position move
+#define POS_KP          20              // [1/s] position gain near the target: speed target = POS_KP * position error
 // Field Weakening / Phase Advance
-#define FIELD_WEAK_ENA  1               // [-] Field Weakening / Phase Advance enable flag: 0 = Disabled (default), 1 = Enabled
+#define FIELD_WEAK_ENA  1               // [-] Field Weakening / Phase Advance enable flag: 0 = Disabled (default), 1 = Enabled, 2 = Map (FOC only, SIN uses 1)
 #define FIELD_WEAK_MAX  10               // [A] Maximum Field Weakening D axis current (only for FOC). Higher current results in higher maximum speed. Up to 10A has been tested using 10" wheels.
 #define PHASE_ADV_MAX   25              // [deg] Maximum Phase Advance angle (only for SIN). Higher angle results in higher maximum speed.
 #define FIELD_WEAK_HI   1000            // (1000, 1500] Input target High threshold for reaching maximum Field Weakening / Phase Advance. Do NOT set this higher than 1500.
 #define FIELD_WEAK_LO   750             // ( 500, 1000] Input target Low threshold for starting Field Weakening / Phase Advance. Do NOT set this higher than 1000.
+// Field weakening map (FIELD_WEAK_ENA 2): the d axis current comes from r_fieldWeakMap_Table (BLDC_controller_data.c) over the speed and
+// the input target, only as much as the voltage limit needs, up to FIELD_WEAK_MAX. Calibrate it for the motor with make host-sil
+// SIL_ARGS="-w" and a scenario with its R, L and Ke. The speed axis is scaled with the battery voltage to the calibration voltage
+#define FIELD_WEAK_MAP_VBAT 3600        // [V*100] battery voltage of the map calibration, same as host/config.h
+// Gain scheduling (FOC): the current loop (cf_idKp/Ki, cf_iqKp/Ki) and speed loop (cf_nKp/Ki) gains of each motor are scaled
+// over its speed by the tables below, linear between the GAIN_SCHED_N speeds (ascending) and held beyond the ends. 100 = the
+// generated gains. Updated every main loop and taken by both controllers at one tick through PARAM_STAGED
+// #define GAIN_SCHED                   // [-] Enable the speed scheduled controller gains
+#define GAIN_SCHED_N    {0, 200, 500, 900}      // [rpm] speed points of the tables
+#define GAIN_SCHED_I_KP {100, 100, 110, 130}    // [%] current loop Kp per speed point, d and q axis
+#define GAIN_SCHED_I_KI {100, 100, 100, 100}    // [%] current loop Ki
+#define GAIN_SCHED_N_KP {100, 100, 80, 60}      // [%] speed loop Kp
+#define GAIN_SCHED_N_KI {100, 100, 80, 60}      // [%] speed loop Ki
+#define GAIN_SCHED_VBAT 0               // [V*100] 0 = off. Else the current loop gains are also scaled by GAIN_SCHED_VBAT / battery voltage, for the same bandwidth on a full and an empty battery
+// Controller gains as parameters: the current loop (cf_idKp/Ki, cf_iqKp/Ki) and speed loop (cf_nKp/Ki) PI gains and the current
+// filter (cf_currFilt) of both motors are the parameters ID_KP ... CUR_FILT, saved with "$SAVE" and set with "$SET", e.g. from the
+// file of make host-tune. In the generated units at PWM_FREQ_BASE, the integral gains and the filter are rescaled to the control
+// rate like BLDC_Init does. The EEPROM layout changes: a configuration saved without CTRL_GAINS is not loaded (config.h values)
+// #define CTRL_GAINS                   // [-] Enable the controller gain parameters
+#define CTRL_GAIN_ID_KP   819           // [-] d axis current Kp, the values below are the generated ones
+#define CTRL_GAIN_ID_KI   737           // [-] d axis current Ki
+#define CTRL_GAIN_IQ_KP   1229          // [-] q axis current Kp
+#define CTRL_GAIN_IQ_KI   1229          // [-] q axis current Ki
+#define CTRL_GAIN_N_KP    4833          // [-] speed Kp
+#define CTRL_GAIN_N_KI    251           // [-] speed Ki
+#define CTRL_GAIN_FILT    7864          // [-] dq current filter coefficient, fixdt(0,16,16): higher = less filtering
+// Speed loop filters (FOC, SPD_MODE): a notch and a low pass biquad on the speed error before the speed PI, inside the controller
+// step, so a belt or mount resonance does not force a detuned speed loop. The parameters NF_FREQ, NF_BW, NF_DEPTH and NLP_FREQ
+// are saved with "$SAVE", the coefficients follow a "$SET" at once. "$SPDID" finds the resonance: the speed target of both
+// motors gets a sine of SPD_ID_AMP stepped from SPD_ID_F0 to SPD_ID_F1 (continuous phase), the response of each frequency is
+// printed and the highest peak over SPD_ID_PEAK % of the lowest frequency becomes NF_FREQ. Run it in SPD_MODE at a steady
+// speed command. An armed scope ("$SCOPE", SCOPE_ENABLE) is triggered at the start, SID_EXC is the excitation
+// #define SPD_FILT                     // [-] Enable the speed loop filters and $SPDID
+#define SPD_FILT_NOTCH_HZ   0           // [Hz] notch centre, 0 = off (default)
+#define SPD_FILT_NOTCH_BW   10          // [Hz] notch -3 dB width
+#define SPD_FILT_NOTCH_DEPTH 0          // [%] notch gain at the centre, 0 = full notch
+#define SPD_FILT_LP_HZ      0           // [Hz] second order low pass (Butterworth) corner, 0 = off (default)
+#define SPD_ID_AMP          30          // [-] excitation amplitude, r_inpTgt units
+#define SPD_ID_F0           3           // [Hz] first frequency of the sweep
+#define SPD_ID_F1           150         // [Hz] last frequency of the sweep
+#define SPD_ID_PEAK         130         // [%] least response peak, relative to SPD_ID_F0, taken as a resonance
+// Bus voltage compensation: the controller voltage outputs (all types and modes) are scaled by VBAT_COMP_NOM / battery voltage
+// before the PWM, from a fast battery voltage (1 kHz average, 4 ms filter), so VLT_MODE, COM and SIN give the same motor voltage
+// and the current loops the same gain over the state of charge and through load dips. A full battery then runs as one at
+// VBAT_COMP_NOM: set it near the low end of the working range. The scale is limited to [0.25, 1.25]
+// #define VBAT_COMP                    // [-] Enable the bus voltage compensation
+#define VBAT_COMP_NOM   3600            // [V*100] voltage the outputs are scaled to
+// PWM output stage. FOC (min/max of the phases, Clarke_Park_Transform_Inverse) and SIN (r_sin3Pha tables) already output
+// the space vector zero sequence, so the full line-to-line voltage is used in both. PWM_ZSEQ only selects where it is centred
+#define PWM_ZSEQ_MID    0               // [-] Zero sequence centred between the rails, as the controller outputs it
+#define PWM_ZSEQ_LOW    1               // [-] Lowest phase held at the bottom rail (discontinuous PWM): same voltage, one phase less switching at a time in COM and SIN
+#define PWM_ZSEQ        PWM_ZSEQ_MID    // [-] Output stage zero sequence: PWM_ZSEQ_MID (default), PWM_ZSEQ_LOW. Runtime parameter PWM_ZSEQ
+// Dead time compensation. During the DEAD_TIME of each switching edge the phase voltage follows the phase current: low while
+// it flows into the motor, high while it flows out. DT_COMP timer counts are added to each duty in the direction of its current (FOC)
+#define DT_COMP         0               // [timer counts] 0 = off (default). DEAD_TIME is the full dead time, the diode and switching delays make the effective one less: start at DEAD_TIME / 2. Runtime parameter DT_COMP
+#define DT_COMP_BAND    300             // [mA] current around zero in which the compensation is scaled down linearly: the current sign there is not reliable (ripple, noise)
+// FOC voltage limit. Only the two phases with a current shunt need the sampling window at the top of the PWM (pwm_margin), the third
+// phase and the bottom go to the rail and the zero sequence moves as needed (pwmApply). That leaves room above the generated limit
+#define FOC_VOLT_MAX    900             // [-] FOC voltage vector limit, 1000 = the full PWM range. 900 = generated (default), up to 945 at 16 kHz, 917 at 24 kHz (CLOCK_HSE: 927, 890)
+// Overmodulation (FOC). Once the voltage vector of the controller stays at FOC_VOLT_MAX (Vq at Vq_max_M1, top speed), the duties
+// are scaled up by a gain that rises by OVERMOD_RATE per tick: the hexagon corners are clipped by the PWM range (pwmApply), from
+// SVPWM through overmodulation towards six-step, at 2.0 about 19 % more fundamental voltage than at FOC_VOLT_MAX 900. The gain falls back
+// as soon as the vector drops below OVERMOD_EXIT. In overmodulation the highest shunt phase may go to the rail, its current is
+// then taken from the DC link shunt, the two other phases being low at the sample. Both shunt phases at the rail (full
+// six-step) would leave a phase current unknown, so one of them always keeps the sampling window
+// #define OVERMOD                      // [-] Enable the overmodulation
+#define OVERMOD_GAIN_MAX 2048           // [1/1024] highest duty gain, 2048 = 2.0 (default) comes close to six-step, 1024 = off
+#define OVERMOD_RATE    1               // [1/1024 per tick] gain change, 1 = 64 ms from 1.0 to 2.0 at 16 kHz (default)
+#define OVERMOD_ENTER   98              // [%] of FOC_VOLT_MAX: the gain rises above this voltage vector
+#define OVERMOD_EXIT    90              // [%] of FOC_VOLT_MAX: the gain falls below it, holds in between
+// ADC sample point: the phase currents are sampled in the window around the top of the PWM where the low side FETs of the
+// shunt phases are on. By default the TIM8 update event at the top starts the conversions. ADC_SAMPLE_ALIGN triggers them
+// from the TIM8 channel 4 compare instead (no output pin), ADC_SAMPLE_OFFSET before the top. ADC_SAMPLE_SETTLE moves the
+// trigger later when the duties narrow the window: at least that long after the last low side of a shunt phase switched
+// on, so the ringing of the edge has settled. "$ADCSWEEP" sweeps the trigger over ADC_SAMPLE_SWEEP before the top and prints
+// the current noise of each shunt at each point, the motors enabled at standstill without a command
+// #define ADC_SAMPLE_ALIGN             // [-] Enable the compare triggered sampling. Not with IDLE_POWER_SAVE / PWM_CARRIER_DOUBLE
+#define ADC_SAMPLE_OFFSET 0             // [timer counts] trigger before the top, 0 = the update event timing. Runtime parameter ADC_SMP
+#define ADC_SAMPLE_SETTLE (SYSCLK_HZ / 1000000)  // [timer counts] 1 us after the dead time of the last shunt edge. 0 = no duty compensation
+#define ADC_SAMPLE_SWEEP  (PWM_RES / 2) // [timer counts] $ADCSWEEP range, 16 points up to the top of 256 ticks each
+// Sensorless angle at speed: a flux observer (observer.c) integrates the applied phase voltages minus the R and L drops.
+// Its angle offset to the hall angle is learned between OBS_SPD_LO and OBS_SPD_HI, above OBS_SPD_HI it replaces the hall
+// angle (FOC, SIN). The hall sensors still start the motor and the angle falls back to them when the observer is not plausible
+// #define ANGLE_OBSERVER               // [-] Enable the flux observer angle above OBS_SPD_HI
+#define OBS_R           120             // [mOhm] motor phase resistance (star equivalent)
+#define OBS_L           250             // [uH] motor phase inductance (star equivalent)
+#define OBS_FLUX        25333           // [uV s] rotor flux linkage per phase, peak. Only scales the observer: within a factor 1.5
+#define OBS_SPD_LO      150             // [rpm] hall angle below, observer offset learning above
+#define OBS_SPD_HI      250             // [rpm] observer angle above, once the offset is learned
+// Current derating (derate.c): the phase current limit falls below I_MOT_MAX (or the runtime I_MOT_MAX) with the board
+// temperature trend, the battery voltage sag and an I^2t estimate of the heating. I_MOT_MAX then is the peak current,
+// DERATE_I_CONT the one that can flow for a long time
+// #define CURRENT_DERATING             // [-] Enable the current derating
+#define DERATE_I_CONT   15              // [A] continuous phase current, the I^2t limit falls to it
+#define DERATE_I2T_TAU  60              // [s] thermal time constant of the I^2t estimate
+#define DERATE_TEMP_ENABLE 0            // [-] temperature derating, 1 or 0, DO NOT ACTIVATE WITHOUT the temperature calibration
+#define DERATE_TEMP_START TEMP_WARNING  // [°C * 10] full current below, DERATE_MIN at TEMP_POWEROFF
+#define DERATE_TEMP_AHEAD 20            // [s] the rising temperature trend is extrapolated this far
+#define DERATE_BAT_START 330            // [V*100/cell] full current above this loaded battery voltage
+#define DERATE_BAT_END  300             // [V*100/cell] DERATE_MIN at this voltage
+#define DERATE_MIN      20              // [%] lowest limit of the temperature and battery derating
+#define DERATE_RISE     4               // [A/s] recovery rate of the limit
+// Winding temperature (wtemp.c, FOC_CTRL): the phase resistance, measured with a d axis current at standstill and from
+// the voltage equation at low speed, gives the copper temperature over the resistance at WTEMP_T_REF (MOTOR_IDENT or
+// OBS_R). In between an I^2R thermal model follows the current. With CURRENT_DERATING the current limit falls from
+// WTEMP_START to DERATE_MIN % at WTEMP_MAX of the hotter motor. The hall angle is within 30 deg at standstill, up to half
+// of WTEMP_INJ_CUR makes torque: keep it well below the current that turns the wheel
+// #define WINDING_TEMP                 // [-] Enable the winding temperature estimate
+#define WTEMP_T_REF     250             // [°C * 10] winding temperature of the OBS_R / MOTOR_IDENT resistance
+#define WTEMP_RTH       150             // [K/W * 100] winding to ambient thermal resistance of one motor
+#define WTEMP_TAU       600             // [s] winding thermal time constant
+#define WTEMP_INJ_CUR   4               // [A] standstill measurement current, half of it first
+#define WTEMP_INJ_PERIOD 30             // [s] standstill measurement interval
+#define WTEMP_START     1000            // [°C * 10] full current below this winding temperature
+#define WTEMP_MAX       1400            // [°C * 10] DERATE_MIN at this winding temperature
+// Regenerative braking (regen.c): braking feeds current back into the battery, its voltage rises with it. The braking
+// torque is scaled down between REGEN_V_START and REGEN_V_MAX of the battery voltage, and the recovered energy is counted
+// (REGEN_MWH, feedback). Only the TORQUE mode torque targets against the direction of motion are scaled, electric brake included
+// #define REGEN_LIMIT                  // [-] Enable the regenerative braking limit and the energy count
+#define REGEN_V_START   420             // [V*100/cell] full braking torque below this battery voltage
+#define REGEN_V_MAX     430             // [V*100/cell] no braking torque at this voltage
+#define REGEN_RISE      200             // [%/s] recovery rate of the braking torque factor
+// Anti-lock braking (antilock.c): a wheel that decelerates ANTILOCK_DECEL faster than the other one while braking is
+// about to lock. Its TORQUE mode braking torque is released until it spins within ANTILOCK_SLIP of the other wheel
+// again, then applied again, the other wheel keeps braking. Electric brake included, FOC TORQUE mode only
+// #define ANTILOCK_BRAKE               // [-] Enable the anti-lock braking
+#define ANTILOCK_DECEL  3000            // [rpm/s] deceleration difference of the wheels that detects a locking wheel, about 2.5 g on 6.5" wheels
+#define ANTILOCK_SLIP   20              // [%] a released wheel is braked again when it is at most this much slower than the other one
+#define ANTILOCK_N_MIN  30              // [rpm] no anti-lock below this speed of the faster wheel, the vehicle stops
+#define ANTILOCK_RELEASE 10             // [%/ms] braking torque release rate of a locking wheel
+#define ANTILOCK_APPLY  500             // [%/s] braking torque re-apply rate
+// Idle power save: when the board is parked, the control interrupt, the ADC conversions and the current sampling slow
+// down to PWM_FREQ / IDLE_DIV and the PWM outputs are off. The main loop keeps its timing and sleeps between its tasks.
+// Full control returns within a few ms when an input, a hall sensor or a beep needs it
+// #define IDLE_POWER_SAVE              // [-] Enable the idle power save
+#define IDLE_DIV        16              // [-] control interrupt divider while idle, 16 = 1 kHz at 16 kHz PWM_FREQ, max 128
+#define IDLE_DELAY      2000            // [ms] standstill without input before the idle mode
+#define IDLE_THRES      20              // [-] inputs and commands below this count as no input
+// PWM carrier doubling: below PWM_CARRIER_N the outputs switch at twice PWM_FREQ, which moves the whine of the motors
+// out of the most audible range where there is no driving noise to cover it. The control interrupt, the current sampling
+// and all controller time steps stay at PWM_FREQ. From PWM_CARRIER_TEMP below TEMP_WARNING the carrier stays at
+// PWM_FREQ, which halves the switching losses again. The doubled carrier has about half the voltage range above the
+// sampling window, enough for the low speeds. The change is made at a PWM boundary without a lost period, see bldc.c
+// #define PWM_CARRIER_DOUBLE           // [-] Enable the carrier doubling
+#define PWM_CARRIER_N   100             // [rpm] doubled carrier below this average wheel speed
+#define PWM_CARRIER_HYST 30             // [rpm] back at PWM_FREQ above PWM_CARRIER_N + PWM_CARRIER_HYST
+#define PWM_CARRIER_TEMP 100            // [°C*10] PWM_FREQ only from TEMP_WARNING - PWM_CARRIER_TEMP, doubled again 2 °C below
 
 // Extra functionality
-// #define STANDSTILL_HOLD_ENABLE          // [-] Flag to hold the position when standtill is reached. Only available and makes sense for VOLTAGE or TORQUE mode.
+// #define STANDSTILL_HOLD_ENABLE          // [-] Flag to hold the position when standtill is reached: the control interrupt holds the hall step position with the POS_CTRL position loop (POS_KP, POS_ACC). FOC only.
 // #define ELECTRIC_BRAKE_ENABLE           // [-] Flag to enable electric brake and replace the motor "freewheel" with a constant braking when the input torque request is 0. Only available and makes sense for TORQUE mode.
 // #define ELECTRIC_BRAKE_MAX    100       // (0, 500) Maximum electric brake to be applied when input torque request is 0 (pedal fully released).
 // #define ELECTRIC_BRAKE_THRES  120       // (0, 500) Threshold below at which the electric brake starts engaging.
@@ -180,7 +485,16 @@
 #define ADC_MARGIN                100     // ADC input margin applied on the raw ADC min and max to make sure the MIN and MAX values are reached even in the presence of noise
 #define ADC_PROTECT_TIMEOUT       100     // ADC Protection: number of wrong / missing input commands before safety state is taken
 #define ADC_PROTECT_THRESH        200     // ADC Protection threshold below/above the MIN/MAX ADC values
-// #define AUTO_CALIBRATION_ENA              // Enable/Disable input auto-calibration by holding power button pressed. Un-comment this if auto-calibration is not needed.
+#define ADC_INPUT_FILT            0       // ADC input pre-filter on the raw pot values: 0 = off (default), 1 = moving average of 2^ADC_INPUT_FILT_SHIFT samples, 2 = two cascaded EMAs with coefficient 2^-ADC_INPUT_FILT_SHIFT (lower delay for the same noise rejection)
+#define ADC_INPUT_FILT_SHIFT      2       // [-] ADC input pre-filter length: moving average of 2^N samples, delay (2^N - 1)/2 samples; EMA delay 2 * (2^N - 1) samples. Samples are taken every main loop
+// #define ADC_INPUT_OVS             16      // [-] CONTROL_ADC: sample the pots (PA2, PA3) continuously with ADC3 and DMA2 instead of once per control tick in the ADC2 injected group. The last 4, 8 or 16 samples of each (0.13 to 0.5 ms) are averaged every 1 ms, variables IN1_OVS / IN2_OVS show their sum with ADC_INPUT_OVS times the resolution. Often makes ADC_INPUT_FILT unnecessary
+// #define INPUT_CURVE                       // [-] Response curve on the scaled input2 command (throttle), and on input1 (brake) for VARIANT_HOVERCAR. Parameters IN_CRV1..IN_CRV5
+#define INPUT_CURVE_1             93      // [-] Curve output at 20, 40 .. 100 % of the command 1000, odd symmetric, linear in between and slope 1 above 1000.
+#define INPUT_CURVE_2             240     //     Default: (2*x^2/1000 + x) / 3, softer around the middle position. 200, 400 .. 1000 is the linear response
+#define INPUT_CURVE_3             440
+#define INPUT_CURVE_4             693
+#define INPUT_CURVE_5             1000
+// #define AUTO_CALIBRATION_ENA              // Enable/Disable input auto-calibration by holding power button pressed or $INCAL. Un-comment this if auto-calibration is not needed.
 
 /* FILTER is in fixdt(0,16,16): VAL_fixedPoint = VAL_floatingPoint * 2^16. In this case 6553 = 0.1 * 2^16
  * Value of COEFFICIENT is in fixdt(1,16,14)
@@ -219,6 +533,7 @@
  * enable CRUISE_CONTROL_SUPPORT and (SUPPORT_BUTTONS_LEFT or SUPPORT_BUTTONS_RIGHT depending on which cable is the button installed)
  * can be activated/deactivated by pressing button1 (Blue cable) to GND
  * when activated, it maintains the current speed by switching to SPD_MODE. Acceleration is still possible via the input request, but when released it resumes to previous set speed.
+ * The control interrupt eases into the set speed: the speed target follows SPD_REF_ACC and SPD_REF_JERK from the acceleration at the button press.
  * when deactivated, it returns to previous control MODE and follows the input request.
 */
 // #define CRUISE_CONTROL_SUPPORT
@@ -252,14 +567,187 @@
 
 // #define DEBUG_SERIAL_USART2          // left sensor board cable, disable if ADC or PPM is used!
 #define DEBUG_SERIAL_USART3          // right sensor board cable, disable if I2C (nunchuk or lcd) is used!
-// #define DEBUG_SERIAL_PROTOCOL        // uncomment this to send user commands to the board, change parameters and print specific signals (see comms.c for the user commands)
+// #define DEBUG_SERIAL_PROTOCOL        // uncomment this to send user commands to the board, change parameters and print specific signals (see comms.c for the user commands). Parameters can be given by name or by the id printed by GET, e.g. "$GET #3"
+// #define DEBUG_RTT                    // debug channel in RAM instead of a USART: a SEGGER RTT control block (rtt.c) that the debugger reads and writes over SWD while the board runs,
+                                        // e.g. OpenOCD "rtt setup 0x20000000 0xC000 \"SEGGER RTT\"", "rtt start", "rtt server start 19021 0". Text, stream and protocol on channel 0, both ways.
+                                        // Disable DEBUG_SERIAL_USART2 / DEBUG_SERIAL_USART3, the sensor board cables are then free for the control inputs. Without a debugger attached the output is dropped
+#define DEBUG_RTT_RX_SIZE       64      // [bytes] DEBUG_RTT down buffer, the commands from the debugger. Must be a power of 2
+#define DEBUG_STREAM_MAX_RATE   1000    // [Hz] max rate of the binary stream (DEBUG_SERIAL_PROTOCOL): "$STREAM name" toggles a channel, "$SET STREAM_RATE hz" starts it. Raise the baud rate to carry it
+#define DEBUG_STREAM_START_FRAME 0x7C7C // [-] Start frame of the binary stream frames
+#define DEBUG_TX_BUFFER_SIZE    512     // [bytes] printf output is queued here and sent by the UART TX DMA, so printing does not stall the main loop. With DEBUG_RTT the size of the up buffer. Must be a power of 2
+// #define DEBUG_NO_HELP                // uncomment to leave the help texts of the commands, parameters and errors out of the flash (about 6 KB). "$HELP" and the errors then print the index, a host tool can look the texts up by it
+// #define DEBUG_TX_BLOCK               // uncomment to wait for free space when the queue is full (main loop only). Default: drop the extra characters and count them in DBG_TX_DROP. Not with DEBUG_RTT, no debugger may be reading
+#define DEBUG_CMD_QUEUE_SIZE    8       // [-] received protocol commands waiting to be executed (every DELAY_IN_MAIN_LOOP ms). Must be a power of 2. "$@<id> GET ..." appends " @<id>" to the OK/error reply
+#define DEBUG_CMD_LINE_MAX      64      // [bytes] longest protocol command line, lines may arrive split or several per UART idle event
+#define DEBUG_BIN_START_FRAME   0x7D7D  // [-] Start frame of the binary parameter requests and responses (see comms.c), sent on the same USART as the text commands
+#define DEBUG_BIN_MAX_ITEMS     16      // [-] max parameters per binary GET/SET request
 // ########################### END OF DEBUG SERIAL ############################
 
 
 
+// ############################### DEBUG PROFILING ###############################
+/* ISR profiling uses the DWT cycle counter to measure the DMA1_Channel1 control interrupt (see bldc.c)
+ * Measured phases: total ISR, calibration/bldc_control, left and right BLDC_controller_step
+ * and the buzzer and battery filter of the slow task (PendSV)
+ * For each phase last/min/max/mean cycles are available, plus a histogram of the total ISR duration (as fraction of the PWM period)
+ * The values can be read as variables via DEBUG_SERIAL_PROTOCOL (e.g. "$GET ISR_TOT_MAX") and are appended to the serial feedback frame.
+ * NOTE: the serial feedback frame is extended with isrCycMean and isrCycMax, the receiving side has to use the same frame layout!
+*/
+// #define ISR_PROFILING                 // [-] Enable control interrupt cycle profiling
+
+/* Control interrupt hooks: site specific code before and after the controller step of each motor, listed in
+ * Inc/hooks.def instead of patched into bldc_control (see hooks.c). A pre-step hook may change the control mode, the
+ * target and lower the current limit, a post-step hook the duties. Every run is timed with the cycle counter, a run
+ * longer than the budget of the hook switches it off. "$HOOKS" prints the hooks with their runtimes and switches them
+ * on again. With ISR_PROFILING the sum of all hooks per tick is ISR_HOOK_MAX / ISR_HOOK_MEAN.
+*/
+// #define CTRL_HOOKS                   // [-] Enable the control interrupt hooks of Inc/hooks.def
+#define CTRL_HOOK_BUDGET        300     // [cycles] Default longest run of a hook, ~4.7 us at 64 MHz. The whole interrupt has SYSCLK_HZ / PWM_FREQ cycles
+
+/* Deadline monitor: control interrupt deadline misses are always counted (see isrMiss in bldc.c)
+ * and can be read via DEBUG_SERIAL_PROTOCOL (e.g. "$GET ISR_MISS_CNT").
+ * Enable DEADLINE_MISS_FAULT to disable the motors (z_errCode bit ERR_DEADLINE_MISS) when the misses per second exceed the threshold.
+*/
+// #define DEADLINE_MISS_FAULT    10     // [1/s] trip a motor error if more than this number of deadline misses happen within 1 s
+
+/* Main loop load: the scheduler (sched.c) measures the time the main loop spends outside WFI every second and sends it as
+ * cpuLoad in the feedback frames. It also keeps the longest single task run, the worst blocking call.
+ * SCHED_STATS adds per task min runtimes and runtime histograms, printed with "$SCHED", and the variables CPU_LOAD,
+ * CPU_LOAD_MAX, SCHED_WORST and SCHED_WORST_TASK. "$SET SCHED_RST 1" clears the statistics.
+*/
+// #define SCHED_STATS                  // [-] Enable the main loop task statistics on the debug protocol
+
+/* Input to PWM latency: a change of the selected input is tagged with its sample time (serial frame receive time,
+ * PPM frame or PWM pulse capture time, else the main loop read), the tag follows the command through the filters and
+ * the mixer to pwml / pwmr and stops at the control tick that steps the controllers with them (see latency.c).
+ * The latencies go to a histogram per input index: "$LAT" prints them with the 50 / 90 / 99 % percentiles and restarts,
+ * LAT1_P50, LAT1_P99 (LAT2_* with DUAL_INPUTS) read the running values. Only one tag is in flight, and only from
+ * steady outputs, so a fast sweep gives fewer samples, not wrong ones. The serial fast path (SERIAL_FAST_CMD) and
+ * BALANCE_CONTROL set the outputs outside the main loop path and are not measured.
+*/
+// #define LATENCY_MEAS                 // [-] Enable the input to PWM latency measurement on the debug protocol
+#define LATENCY_STEP            20      // [-] input change that starts a measurement, in raw input units (ADC counts, -1000..1000 for the others)
+#define LATENCY_TIMEOUT         1000    // [ms] a tag that has not reached the duties by then is dropped (outputs held, e.g. motors off)
+
+/* SWO trace: single byte events on the ITM stimulus ports, sent on the SWO pin (PB3) of the SWD header and read by the
+ * ST-LINK, e.g. with OpenOCD "itm ports on" and "tpiu config internal <file> uart off <SYSCLK_HZ> <TRACE_SWO_BAUD>".
+ * No UART load and a few cycles per event, a full ITM FIFO drops the event (traceDrop, see trace.h for the layout):
+ * port 1 the enter / exit of the control interrupt, PendSV and the HALL_COM_HW edges, port 2 the start / end of the
+ * scheduler tasks. The ITM timestamps give the timeline. TRACE_ITM_PRINTF sends the debug text (printf) on port 0
+ * instead of the debug USART, which then only receives: not with DEBUG_SERIAL_PROTOCOL, whose answers go to its host tool.
+*/
+// #define TRACE_ITM                    // [-] Enable the SWO trace
+#define TRACE_SWO_BAUD          2000000 // [bit/s] SWO bit rate, SYSCLK_HZ / TRACE_SWO_BAUD must be an integer
+// #define TRACE_ITM_PRINTF             // [-] printf on ITM port 0 instead of the debug USART TX
+
+/* Both motors are sampled together (one dual ADC conversion triggered by TIM8), so the interrupt order only decides
+ * when each duty is written. TIM8 (left, RCR = 1) loads new compare values once per period, TIM1 (right, RCR = 0) at
+ * every under- and overflow. ISR_LATE_L / ISR_LATE_R count the ticks where a motor missed its first update.
+ * CTRL_RIGHT_FIRST steps the right motor first so it usually makes the half period update: half the current-to-PWM
+ * latency for the right motor, the left one only needs to finish within the period as before.
+*/
+// #define CTRL_RIGHT_FIRST              // [-] Step the right motor before the left one in bldc_control
+
+/* CTRL_VALLEY_LOAD: TIM8 also loads at every under- and overflow (RCR = 0), the duties of both motors apply at the
+ * valley half a period after the sampling instead of a full period: half the current-to-PWM delay, the main limit of
+ * the current loop bandwidth (with CTRL_MULTIRATE the FOC current PI runs every tick). The shunts are on the low side
+ * and only carry the phase currents around the top, so the sampling stays once per period. Both motors must be done
+ * within the half period, ISR_LATE_L / ISR_LATE_R count the misses (FOC_IN_RAM, CTRL_FIXED help). Needs the compare
+ * triggered sampling of ADC_SAMPLE_ALIGN, the update event no longer marks the top.
+*/
+// #define CTRL_VALLEY_LOAD             // [-] Load the duties of both motors at the valley
+
+/* CTRL_PREDICT: predictive current control (FOC_CTRL). The duties of a tick apply 1.5 PWM periods after the current
+ * sampling (1 period with CTRL_VALLEY_LOAD, and for the right motor with CTRL_RIGHT_FIRST), the rotor turns on
+ * meanwhile: at 1000 rpm and 15 pole pairs 8 deg, which the current loop sees as a d / q cross coupling. The inverse
+ * Park transform uses the angle advanced by that rotation. The back-EMF and the w L cross coupling of the dq model
+ * are added to the current PI outputs (the back-EMF in TRQ_MODE, in SPD_MODE it is the Vq_ff of SPD_REF_GEN), so the
+ * PIs only correct the model error. Uses the identified L and flux of MOTOR_IDENT, OBS_L and OBS_FLUX without them
+*/
+// #define CTRL_PREDICT                 // [-] Enable the angle advance and the dq decoupling of the current control
+
+/* FOC_IN_RAM: execute the control hot path (DMA1_Channel1_IRQHandler, bldc_control, BLDC_controller_step and its sub-functions) from SRAM
+ * to avoid the flash wait states. Uses about 10 kB more RAM. Only supported with the Makefile build (the .ramfunc section is copied by startup_stm32f103xe.s).
+ * Enable it with "make -e FOC_IN_RAM=1" and compare ISR_TOT_MEAN / ISR_TOT_MAX with ISR_PROFILING enabled.
+*/
+
+/* FLASH_SAFE_WRITE: program the flash while driving. The flash stalls every read from it while it is programmed or erased,
+ * so on top of FOC_IN_RAM the vector table and the constant tables of the hot path (RAMCONST) are copied to SRAM and the
+ * flash routines poll the busy flag from SRAM: the control interrupt keeps its timing, only code outside the hot path
+ * waits. The EEPROM writes of $SAVE and of the calibrations only fill the RAM cache, EE_Service in the monitor task
+ * programs one variable per call and splits the page transfer into steps. Page erases (about 20 ms each, one per call)
+ * are only done at standstill, as the trip log appends that need one. Poweroff still writes everything at once.
+ * Not available with HALL_CALIB, MOTOR_IDENT, COGGING_COMP, SPD_FILT and SELF_TEST, whose interrupt code stays in flash.
+ * Enable it with "make -e FLASH_SAFE_WRITE=1", which also sets FOC_IN_RAM.
+*/
+
+/* Black box recorder: a circular buffer in RAM records the control loop signals of both motors (phase currents, DC current,
+ * duty outputs, hall state, n_mot, error code, current chopping and the controller command, mode and enable) every
+ * BLACKBOX_DECIM control cycles. On any motor error or DC current chopping it records BLACKBOX_POST more samples and freezes.
+ * Dump it via DEBUG_SERIAL_PROTOCOL with "$BBOX" and re-arm with "$SET BBOX_ARM 1". Uses BLACKBOX_DEPTH * 36 bytes of RAM.
+ * With BLACKBOX_DECIM 1 a saved dump can be replayed through the controller on the PC: build/host/sil -r dump.txt
+*/
+// #define BLACKBOX_ENABLE               // [-] Enable the black box recorder
+#define BLACKBOX_DEPTH          512     // [samples] recorder depth
+#define BLACKBOX_DECIM          4       // [-] record every Nth control cycle (16 kHz / 4 = 4 kHz)
+#define BLACKBOX_POST           128     // [samples] samples recorded after the trigger
+
+/* Scope: on demand capture of up to SCOPE_CH params[] entries (parameters, or variables such as IQL, DC_CURR, SPDL) from the control
+ * interrupt into RAM, without halting the core. "$SCOPE NAME" adds or removes a channel, SCOPE_TRIG selects the trigger channel
+ * (0: command only) and SCOPE_LEVEL / SCOPE_EDGE the condition, SCOPE_PRE the share before the trigger, SCOPE_DECIM the sample rate.
+ * "$SET SCOPE_ARM 1" arms, "$SET SCOPE_ARM 2" triggers by command, "$SCOPE" dumps the capture through the debug TX DMA queue.
+ * The channels share SCOPE_WORDS 32 bit words, the depth is SCOPE_WORDS / channels samples. Needs DEBUG_SERIAL_PROTOCOL.
+*/
+// #define SCOPE_ENABLE                 // [-] Enable the scope
+#define SCOPE_CH                4       // [-] max channels
+#define SCOPE_WORDS             1024    // [words] capture buffer, 4 kB of RAM
+
+/* Stack monitor: at boot the RAM between the heap reserve (_Min_Heap_Size above .bss) and the stack pointer is painted with a
+ * pattern, once per second the main loop looks for the lowest overwritten word: "$GET STACK_FREE" gives the bytes never used
+ * (the high-water mark is STACK_SIZE - STACK_FREE). The lowest STACK_GUARD bytes are a guard, checked at every main loop pass:
+ * overwritten, they disable the motors with z_errCode bit ERR_STACK_GUARD. The F103 has no MPU, an overflow that hits
+ * .bss before the check still corrupts it, keep STACK_FREE well above STACK_GUARD. "make ram-report" lists RAM and flash per object.
+*/
+// #define STACK_MONITOR                // [-] Enable the stack high-water mark and guard
+#define STACK_GUARD             64      // [bytes] guard at the bottom of the stack, multiple of 4
+
+/* Fault log: at every poweroff a snapshot (poweroff cause, motor error codes, battery voltage, board temperature, speeds, uptime
+ * and with BLACKBOX_ENABLE the FAULTLOG_BBOX_SAMPLES black box samples up to the trigger) is appended to a reserved flash region,
+ * separate from the EEPROM emulation pages. The oldest page is erased when the region is full.
+ * Read it back via DEBUG_SERIAL_PROTOCOL with "$FLOG".
+*/
+// #define FAULTLOG_ENABLE               // [-] Enable the flash fault log
+#define FAULTLOG_ADDR           0x0803D000  // [-] start address of the fault log, must be FLASH_PAGE_SIZE aligned (default: 2 kB pages 122 and 123, reserved by the linker script)
+#define FAULTLOG_PAGES          2       // [-] number of FLASH_PAGE_SIZE (2 kB) flash pages used by the fault log, at least 2 to keep records across an erase
+#define FAULTLOG_BBOX_SAMPLES   4       // [samples] black box samples stored per record (36 bytes each)
+
+/* Trip statistics: lifetime odometer, energy drawn and recovered, time powered on and with a motor error, highest board
+ * temperature and battery current, counted in RAM and appended to a second flash log (wear levelled over TRIP_PAGES pages,
+ * the oldest page is erased when the log is full). Flash writes stall the CPU, so the totals are saved at standstill with the
+ * motors idle, at most every TRIP_SAVE_PERIOD, and at poweroff. Read them with "$GET TRIP_*" (DEBUG_SERIAL_PROTOCOL) or
+ * with a ProtoTrip frame: a command with PROTO_CMD_TRIP gets one instead of the next feedback frame on that port.
+*/
+// #define TRIP_STATS                    // [-] Enable the trip statistics
+#define TRIP_ADDR               0x0803C000  // [-] start address of the trip log, must be FLASH_PAGE_SIZE aligned (default: 2 kB pages 120 and 121, reserved by the linker script below the fault log)
+#define TRIP_PAGES              2       // [-] number of FLASH_PAGE_SIZE (2 kB) flash pages used by the trip log, at least 2 to keep records across an erase
+#define TRIP_SAVE_PERIOD        300     // [s] minimum time between two saves while powered on
+#define TRIP_WHEEL_MM           530     // [mm] wheel circumference for the odometer, 530 = 6.5" hoverboard wheel
+
+/* Efficiency estimate (FOC_CTRL): per motor electrical input power (battery voltage times DC link current), copper loss (iq,
+ * id and the resistance of WINDING_TEMP, MOTOR_IDENT or OBS_R) and mechanical output (iq times speed with the MOTOR_IDENT flux
+ * or OBS_FLUX), averaged over EFF_WINDOW s, and the net energy per distance of the board (TRIP_WHEEL_MM). Read them with
+ * "$GET EFF_*" or add them to the binary stream with "$STREAM" (DEBUG_SERIAL_PROTOCOL) to compare parameter sets on the road.
+*/
+// #define EFF_ESTIMATE                  // [-] Enable the efficiency estimate
+#define EFF_WINDOW              10      // [s] averaging window of the powers, the efficiency and the Wh/km
+// ########################### END OF DEBUG PROFILING ############################
+
+
+
 // ############################### DEBUG LCD ###############################
 // #define DEBUG_I2C_LCD                // standard 16x2 or larger text-lcd via i2c-converter on right sensor board cable
 #define LCD_ADDRESS 0x27
+// #define LCD_ASYNC                    // write the LCD into a RAM shadow and push only the changed cells by I2C DMA from the main loop scheduler
 // ########################### END OF DEBUG LCD ############################
 
 
@@ -336,6 +824,7 @@
 
   #define USE_RAW_INPUT
   #define TANK_STEERING              // use for tank steering, each input controls each wheel 
+  // #define SERIAL_FAST_CMD         // mix and set the motor targets from each valid command in the Rx interrupt, not in the next main loop. Latency tens of us instead of several ms, needs USE_RAW_INPUT
   // #define SUPPORT_BUTTONS_LEFT       // use left sensor board cable for button inputs.  Disable DEBUG_SERIAL_USART2!
   // #define SUPPORT_BUTTONS_RIGHT      // use right sensor board cable for button inputs. Disable DEBUG_SERIAL_USART3!
 #endif
@@ -352,6 +841,7 @@
    * Recommendation: Nunchuk Breakout Board https://github.com/Jan--Henrik/hoverboard-breakout
   */
   #define CONTROL_NUNCHUK         0       // use nunchuk as input. Number indicates priority for dual-input. Disable FEEDBACK_SERIAL_USART3, DEBUG_SERIAL_USART3!
+  // #define NUNCHUK_ASYNC                   // Interrupt driven I2C reads scheduled by SysTick, with bus recovery. The main loop no longer blocks on the Nunchuk
 
   // #define DUAL_INPUTS                     // Nunchuk*(Primary) + UART(Auxiliary). Uncomment this to use Dual-inputs
   #define PRI_INPUT1              2, -1024, 0, 1024, 0     // TYPE, MIN, MID, MAX, DEADBAND. See INPUT FORMAT section
@@ -401,6 +891,7 @@
     #define PRI_INPUT2            3, -1000, 0, 1000, 100  // TYPE, MIN, MID, MAX, DEADBAND. See INPUT FORMAT section
   #endif
   #define PPM_NUM_CHANNELS        6       // total number of PPM channels to receive, even if they are not used.
+  // #define PPM_DMA                         // capture the PPM edges with TIM2 CH4 input capture into a DMA buffer and decode them in the main loop: no interrupt per edge, timestamps without interrupt jitter. Uses DMA1 channel 7, so CONTROL_PPM_RIGHT needs USART2 disabled
 
   // #define TANK_STEERING                   // use for tank steering, each input controls each wheel 
   // #define SUPPORT_BUTTONS                 // Define for PPM buttons support
@@ -447,6 +938,7 @@
   // #define INVERT_L_DIRECTION
   // #define SUPPORT_BUTTONS_LEFT            // use left sensor board cable for button inputs.  Disable DEBUG_SERIAL_USART2!
   // #define SUPPORT_BUTTONS_RIGHT           // use right sensor board cable for button inputs. Disable DEBUG_SERIAL_USART3!
+  // #define PWM_CAPTURE                     // latch both pulse edges with the TIM2 and TIM5 input capture instead of the EXTI interrupts: no CPU load per edge and no interrupt jitter. Only with CONTROL_PWM_LEFT, PB10/PB11 have no second timer
 
   #if defined(CONTROL_PWM_RIGHT) && !defined(DUAL_INPUTS)
     #define DEBUG_SERIAL_USART2           // left sensor cable debug
@@ -523,31 +1015,12 @@
 
   // Extra functionality
   // #define CRUISE_CONTROL_SUPPORT            // [-] Flag to enable Cruise Control support. Activation/Deactivation is done by sideboard button or Brake pedal press.
-  // #define STANDSTILL_HOLD_ENABLE            // [-] Flag to hold the position when standtill is reached. Only available and makes sense for VOLTAGE or TORQUE mode.
+  // #define STANDSTILL_HOLD_ENABLE            // [-] Flag to hold the position when standtill is reached, on the hall steps (see above)
   // #define ELECTRIC_BRAKE_ENABLE             // [-] Flag to enable electric brake and replace the motor "freewheel" with a constant braking when the input torque request is 0. Only available and makes sense for TORQUE mode.
   // #define ELECTRIC_BRAKE_MAX    100         // (0, 500) Maximum electric brake to be applied when input torque request is 0 (pedal fully released).
   // #define ELECTRIC_BRAKE_THRES  120         // (0, 500) Threshold below at which the electric brake starts engaging.
 
-  #define MULTI_MODE_DRIVE                  // This option enables the selection of 3 driving modes at start-up using combinations of Brake and Throttle pedals (see below)
-  #ifdef MULTI_MODE_DRIVE
-      // BEGINNER MODE:     Power ON + Brake [released] + Throttle [released or pressed]
-      #define MULTI_MODE_DRIVE_M1_MAX   175
-      #define MULTI_MODE_DRIVE_M1_RATE  250
-      #define MULTI_MODE_M1_I_MOT_MAX   4
-      #define MULTI_MODE_M1_N_MOT_MAX   30
-
-      // INTERMEDIATE MODE: Power ON + Brake [pressed] + Throttle [released]
-      #define MULTI_MODE_DRIVE_M2_MAX   500
-      #define MULTI_MODE_DRIVE_M2_RATE  300
-      #define MULTI_MODE_M2_I_MOT_MAX   8
-      #define MULTI_MODE_M2_N_MOT_MAX   80
-
-      // ADVANCED MODE:    Power ON + Brake [pressed] + Throttle [pressed]
-      #define MULTI_MODE_DRIVE_M3_MAX   1000
-      #define MULTI_MODE_DRIVE_M3_RATE  450
-      #define MULTI_MODE_M3_I_MOT_MAX   I_MOT_MAX
-      #define MULTI_MODE_M3_N_MOT_MAX   N_MOT_MAX
-  #endif
+  #define MULTI_MODE_DRIVE                  // This option enables the selection of 3 driving modes at start-up using combinations of Brake and Throttle pedals (see DRIVE PROFILES)
 
 #endif
 
@@ -560,9 +1033,46 @@
 
 
 
+// ################################# DRIVE PROFILES ##################################
+// MULTI_MODE_DRIVE: 3 drive profiles of acceleration rate, max pedal command, current and speed limit, filter and field weakening.
+// VARIANT_HOVERCAR selects one at power on with the pedals, other variants can enable MULTI_MODE_DRIVE as well.
+#ifdef MULTI_MODE_DRIVE
+  // BEGINNER MODE:     Power ON + Brake [released] + Throttle [released or pressed]
+  #define MULTI_MODE_DRIVE_M1_MAX   175
+  #define MULTI_MODE_DRIVE_M1_RATE  250
+  #define MULTI_MODE_M1_I_MOT_MAX   4
+  #define MULTI_MODE_M1_N_MOT_MAX   30
+  #define MULTI_MODE_M1_FILTER      FILTER
+  #define MULTI_MODE_M1_FIELD_WEAK  0
+
+  // INTERMEDIATE MODE: Power ON + Brake [pressed] + Throttle [released]
+  #define MULTI_MODE_DRIVE_M2_MAX   500
+  #define MULTI_MODE_DRIVE_M2_RATE  300
+  #define MULTI_MODE_M2_I_MOT_MAX   8
+  #define MULTI_MODE_M2_N_MOT_MAX   80
+  #define MULTI_MODE_M2_FILTER      FILTER
+  #define MULTI_MODE_M2_FIELD_WEAK  0
+
+  // ADVANCED MODE:    Power ON + Brake [pressed] + Throttle [pressed]
+  #define MULTI_MODE_DRIVE_M3_MAX   1000
+  #define MULTI_MODE_DRIVE_M3_RATE  450
+  #define MULTI_MODE_M3_I_MOT_MAX   I_MOT_MAX
+  #define MULTI_MODE_M3_N_MOT_MAX   N_MOT_MAX
+  #define MULTI_MODE_M3_FILTER      FILTER
+  #define MULTI_MODE_M3_FIELD_WEAK  FIELD_WEAK_ENA
+
+  // Power ON with both pedals released keeps the last profile ("$SET DRV_PROFILE", saved with "$SAVE"). At standstill the
+  // profile can also be changed at run time, without stopping the main loop. The profile values are the DRV_Mx_* parameters.
+  // #define DRIVE_PROFILE_BUTTON          // [-] sideboard sensor 2 (SWD on a sideboard RC receiver) selects the profile, replaces the field weakening switch
+  // #define DRIVE_PROFILE_IBUS_CH  5      // [-] iBUS channel 1..14 of a 3 position switch that selects the profile (CONTROL_IBUS)
+#endif
+// ############################## END OF DRIVE PROFILES ##############################
+
+
+
 // ############################ VARIANT_HOVERBOARD SETTINGS ############################
 // Communication:         [DONE]
-// Balancing controller:  [TODO]
+// Balancing controller:  [OPTIONAL, BALANCE_CONTROL]
 #ifdef VARIANT_HOVERBOARD
   #define FLASH_WRITE_KEY     0x1008          // Flash memory writing key. Change this key to ignore the input calibrations from the flash memory and use the ones in config.h
   #define SIDEBOARD_SERIAL_USART2 1           // left sensor board cable. Number indicates priority for dual-input. Disable if ADC or PPM is used! 
@@ -576,6 +1086,23 @@
   #define PRI_INPUT2          3, -1000, 0, 1000, 0  // Priority Sideboard can be used to send commands via an iBUS Receiver connected to the sideboard
   #define AUX_INPUT1          3, -1000, 0, 1000, 0  // not used
   #define AUX_INPUT2          3, -1000, 0, 1000, 0  // not used
+
+  // On-board balancing (balance.c): each motor torque follows the pitch/dPitch of its own sideboard, in a 1 kHz task.
+  // The gains are Q8 torque per sideboard unit: check the pitch and dPitch units of the sideboard firmware, start low.
+  // A v2 sideboard in the high rate mode (SIDEBOARD_FAST) keeps the data fresh at the loop rate.
+  // #define BALANCE_CONTROL                   // [-] Enable the balance controller. Switches CTRL_MOD_REQ to TRQ_MODE
+  #define BALANCE_KP          64              // [Q8 torque per pitch unit] proportional gain
+  #define BALANCE_KD          32              // [Q8 torque per dPitch unit] rate gain
+  #define BALANCE_KI          0               // [Q8 torque per pitch unit and ms] integral gain, 0 = off
+  #define BALANCE_RATE_FILT   2               // [-] dPitch low pass of 2^n ms
+  #define BALANCE_TRQ_MAX     800             // [-] torque target limit, 1000 = I_MOT_MAX
+  #define BALANCE_PITCH_START 200             // [pitch units] a half engages only when its pitch is within this
+  #define BALANCE_PITCH_MAX   2000            // [pitch units] torque off beyond this: the board fell over
+  #define BALANCE_RAMP        500             // [ms] soft start of the gains after engaging
+  #if defined(BALANCE_CONTROL)
+    #undef  CTRL_MOD_REQ
+    #define CTRL_MOD_REQ      TRQ_MODE        // the controller outputs are torque targets
+  #endif
 #endif
 // ######################## END OF VARIANT_HOVERBOARD SETTINGS #########################
 
@@ -591,6 +1118,7 @@
   #define GAMETRAK_CONNECTION_NORMAL    // for normal wiring according to the wiki instructions
   // #define GAMETRAK_CONNECTION_ALTERNATE // use this define instead if you messed up the gametrak ADC wiring (steering is speed, and length of the wire is steering)
   #define ROT_P               1.2       // P coefficient for the direction controller. Positive / Negative values to invert gametrak steering direction.
+  #define GAMETRAK_CNT_PER_M  1345      // [ADC counts] gametrak cable length of 1 m
   // during nunchuk control (only relevant when activated)
   #define SPEED_COEFFICIENT   14746     // 0.9f - higher value == stronger. 0.0 to ~2.0?
   #define STEER_COEFFICIENT   8192      // 0.5f - higher value == stronger. if you do not want any steering, set it to 0.0; 0.0 to 1.0
@@ -625,7 +1153,7 @@
   #define INVERT_L_DIRECTION
   // #define SUPPORT_BUTTONS_LEFT       // use left sensor board cable for button inputs.  Disable DEBUG_SERIAL_USART2!
   // #define SUPPORT_BUTTONS_RIGHT      // use right sensor board cable for button inputs. Disable DEBUG_SERIAL_USART3!
-  // #define STANDSTILL_HOLD_ENABLE     // [-] Flag to hold the position when standtill is reached. Only available and makes sense for VOLTAGE or TORQUE mode.
+  // #define STANDSTILL_HOLD_ENABLE     // [-] Flag to hold the position when standtill is reached, on the hall steps (see above)
 
   #ifdef CONTROL_PWM_RIGHT
     #define DEBUG_SERIAL_USART2         // left sensor cable debug
@@ -637,12 +1165,81 @@
 
 
 
+// ################################# VARIANT_BENCH SETTINGS ##############################
+#ifdef VARIANT_BENCH
+/* ###### CYCLE BENCHMARK ######
+ * Boots without starting the ADCs and with the motor outputs off, replays hall and current vectors into
+ * bldc_control and BLDC_controller_step, times the support functions and prints a DWT cycle table on USART3.
+ * Build with "make -e VARIANT=VARIANT_BENCH" or the PlatformIO env VARIANT_BENCH. Compare the same PROFILE only.
+*/
+  #define FLASH_WRITE_KEY     0x1011    // Flash memory writing key. Change this key to ignore the input calibrations from the flash memory and use the ones in config.h
+  #define PRI_INPUT1          0, -1000, 0, 1000, 0    // Disabled. TYPE, MIN, MID, MAX, DEADBAND. See INPUT FORMAT section
+  #define PRI_INPUT2          0, -1000, 0, 1000, 0    // Disabled. TYPE, MIN, MID, MAX, DEADBAND. See INPUT FORMAT section
+  #ifndef DEBUG_SERIAL_PROTOCOL
+    #define DEBUG_SERIAL_PROTOCOL       // the parameter lookups of the debug parser are timed
+  #endif
+  #ifndef DEBUG_TX_BLOCK
+    #define DEBUG_TX_BLOCK              // the table is longer than the TX queue
+  #endif
+  #define BENCH_RUNS          1024      // [-] calls per case
+  #define BENCH_PERIOD        5000      // [ms] the table is printed again after this time
+#endif
+// ############################# END OF VARIANT_BENCH SETTINGS ############################
+
+
+
 // ########################### UART SETIINGS ############################
+#if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3) || defined(DEBUG_RTT)
+  #define DEBUG_OUT                                       // [-] derived: a debug channel for printf and the protocol, a debug USART or DEBUG_RTT
+#endif
 #if defined(FEEDBACK_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(DEBUG_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2) || \
     defined(FEEDBACK_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(DEBUG_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
   #define SERIAL_START_FRAME      0x7A7A                  // [-] Start frame definition for serial commands
-  #define SERIAL_BUFFER_SIZE      64                      // [bytes] Size of Serial Rx buffer. Make sure it is always larger than the structure size
+  #define SERIAL_START_FRAME_HWCRC 0x7B7B                 // [-] Start frame definition for serial commands protected by the hardware CRC (see SERIAL_HW_CRC)
+  // #define SERIAL_HW_CRC                                // [-] Enable to also accept 0x7B7B frames checked with the STM32 CRC unit. Frames starting with 0x7A7A keep the software CRC32C, so old controllers still work.
+                                                          // Hardware CRC = CRC-32/MPEG-2 (poly 0x04C11DB7, init 0xFFFFFFFF, no reflection, no final XOR) over little-endian 32-bit words, last word zero padded.
+                                                          // Feedback frames are answered in the format of the last valid command received on the same port.
+  // #define SERIAL_BAUD_NEGOTIATION                      // [-] Accept PROTO_CMD_BAUD frames on the CONTROL_SERIAL ports: the controller starts at USARTx_BAUD and requests a higher rate, the board acknowledges it in the feedback and switches.
+                                                          // Back to USARTx_BAUD on an error burst or when the valid frames stop. Needs FEEDBACK_SERIAL on the same port.
+  #define SERIAL_BAUD_MAX         2000000                 // [baud] Highest rate accepted by the negotiation. USART2/3 run on the 32 MHz APB1 clock: 2 Mbaud at most (36 MHz, 2.25 Mbaud with CLOCK_HSE)
+  #define SERIAL_BAUD_FALLBACK    200                     // [ms] Back to USARTx_BAUD when no valid frame arrived for this long at the negotiated rate
+  #define SERIAL_BAUD_ERR_BURST   8                       // [-] Back to USARTx_BAUD after this many bad or resync events without a valid frame
+  #if defined(SERIAL_BAUD_NEGOTIATION) && SERIAL_BAUD_MAX > 320000
+    #define SERIAL_BUFFER_SIZE    (SERIAL_BAUD_MAX / 5000)  // [bytes] Size of Serial Rx buffer: 2 ms of data at SERIAL_BAUD_MAX
+  #else
+    #define SERIAL_BUFFER_SIZE    64                      // [bytes] Size of Serial Rx buffer. Make sure it is always larger than the structure size
+  #endif
+  // #define SERIAL_RX_DMA_IRQ                            // [-] Also process the Rx buffers on the half transfer and transfer complete interrupts of their DMA channels, not only on the IDLE line: a continuous
+                                                          // stream (bulk upload, back to back frames) is parsed every half buffer instead of when the line goes quiet. A buffer lap is counted in RX_L_OVF / RX_R_OVF.
   #define SERIAL_TIMEOUT          160                     // [-] Serial timeout duration for the received data. 160 ~= 0.8 sec. Calculation: 0.8 sec / 0.005 sec
+  // #define SERIAL_TIMEOUT_ADAPTIVE                      // [-] Learn the frame interval of each serial input and time out after SERIAL_TIMEOUT_FRAMES missed frames, SERIAL_TIMEOUT is the upper limit. The targets ramp down before the timeout trips
+  #define SERIAL_TIMEOUT_FRAMES   5                       // [-] Missed frames of the learned interval before the ramp down starts
+  #define SERIAL_TIMEOUT_MIN      4                       // [-] Lower limit of the learned timeout in main loops, against trips from frame jitter. 4 = 20 ms
+  #define SERIAL_TIMEOUT_RAMP     40                      // [-] Targets ramp down to 0 in this many main loops, then the timeout trips. 40 = 0.2 sec
+  // #define SIDEBOARD_FAST                               // [-] Ask v2 sideboards (PROTO_SB_START_FRAME frames with CRC and seq) for their high rate mode, for a low pitch latency. v1 sideboards are not affected. Use 115200 baud or more on the sideboard port.
+  #define SIDEBOARD_LED_REFRESH   500                     // [ms] Feedback to a sideboard port is only sent when the LED state changes and at least this often
+  // #define FEEDBACK_FAST                                // [-] Send the feedback every DELAY_IN_MAIN_LOOP instead of every 4th loop, for traction control in the external controller. Needs 115200 baud or more on the feedback port.
+  // #define FEEDBACK_COMPACT                             // [-] Answer commands with PROTO_CMD_FB_COMPACT with ProtoFeedbackCompact frames: odometry, speeds and timing every frame, battery, temperature and the other slow fields only
+                                                          // when they changed plus one round robin (35 instead of 48 bytes). Controllers without the flag get the full frames. Needs CONTROL_SERIAL and FEEDBACK_SERIAL on the same port.
+  // #define SERIAL_BUS                                   // [-] Multi-drop bus on the CONTROL_SERIAL port (see PROTO_START_FRAME_BUS in protocol.h): ProtoBusCommand frames only, the feedback is sent only when this board is polled, right
+                                                          // from the frame processing (PendSV), and the TX pin is an input in between. Needs FEEDBACK_SERIAL on the same port. Use 115200 baud or more: command and feedback take 8 ms at 115200.
+  #ifndef BUS_ID
+    #define BUS_ID                0                       // [-] Id of this board on the bus, 0..PROTO_BUS_MAX-1. Overridden by the BUS_ID parameter saved in EEPROM
+  #endif
+  // #define TIME_SYNC                                    // [-] Follow the controller clock from the syncTime of its command frames (offset and drift, see timesync.c) and stamp the feedback with
+                                                          // syncTime in that clock, so the frames of several boards line up. Needs CONTROL_SERIAL and FEEDBACK_SERIAL. Works on SERIAL_BUS too.
+  #define TIME_SYNC_PERIOD        50                      // [ms] References closer than this are skipped, longer spans average the jitter of the frame timing
+  #define TIME_SYNC_STEP          5000                    // [us] A reference further off than this restarts the estimate from it (controller restarted)
+  // #define SERIAL_EXT_CMD                               // [-] Also accept ProtoCommandExt frames (PROTO_START_FRAME_EXT in protocol.h) on the CONTROL_SERIAL ports: per wheel targets, control mode and
+                                                          // limit overrides in the motion command, the mode and limits are taken by both controllers in the same control tick. Not with SERIAL_HW_CRC or SERIAL_BUS.
+  // #define SERIAL_COBS                                  // [-] COBS framing with CRC-16 on the CONTROL_SERIAL and FEEDBACK_SERIAL ports (see protocol.h): a zero byte ends every frame, the receivers resync
+                                                          // on the next one from any byte, one byte shorter than the start frame and CRC32. Those ports then only take COBS frames. Not with SERIAL_HW_CRC, SERIAL_BUS or iBUS.
+  // #define CMD_INTERP                                   // [-] Ramp the motor targets linearly from one command to the next in the control interrupt, over the learned interval of the command changes,
+                                                          // instead of a step per frame: smoother torque at 50..100 Hz frame rates, for the delay of about one frame interval
+  #define CMD_INTERP_MAX          40                      // [ms] Longest command interval that is learned and ramped over, a command held longer does not stretch the ramp
+#endif
+#ifndef CRC32_TABLES
+  #define CRC32_TABLES            8                       // [-] Software CRC32C of the serial frames: 8 = slicing-by-8 tables (8 KB flash), 1 = one table (1 KB flash, byte by byte, slower on long frames)
 #endif
 #if defined(FEEDBACK_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(DEBUG_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
   #ifndef USART2_BAUD
@@ -684,7 +1281,8 @@
 
 // ############################### VALIDATE SETTINGS ###############################
 #if !defined(VARIANT_ADC) && !defined(VARIANT_USART) && !defined(VARIANT_NUNCHUK) && !defined(VARIANT_PPM) && !defined(VARIANT_PWM) && \
-    !defined(VARIANT_IBUS) && !defined(VARIANT_HOVERCAR) && !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER) && !defined(VARIANT_SKATEBOARD)
+    !defined(VARIANT_IBUS) && !defined(VARIANT_HOVERCAR) && !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER) && !defined(VARIANT_SKATEBOARD) && \
+    !defined(VARIANT_BENCH)
   #error Variant not defined! Please check platformio.ini or Inc/config.h for available variants.
 #endif
 
@@ -710,14 +1308,30 @@
   #error DEBUG_SERIAL_USART2 and DEBUG_SERIAL_USART3 not allowed, choose one.
 #endif
 
+#if defined(DEBUG_RTT) && (defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3) || defined(TRACE_ITM_PRINTF))
+  #error DEBUG_RTT replaces the debug USART, disable DEBUG_SERIAL_USART2, DEBUG_SERIAL_USART3 and TRACE_ITM_PRINTF.
+#endif
+
+#if defined(DEBUG_RTT) && ((DEBUG_RTT_RX_SIZE & (DEBUG_RTT_RX_SIZE - 1)) || DEBUG_RTT_RX_SIZE < 16 || DEBUG_RTT_RX_SIZE > 1024)
+  #error DEBUG_RTT_RX_SIZE must be a power of 2 between 16 and 1024.
+#endif
+
 #if defined(CONTROL_PPM_LEFT) && defined(CONTROL_PPM_RIGHT)
   #error CONTROL_PPM_LEFT and CONTROL_PPM_RIGHT not allowed, choose one.
 #endif
 
+#if defined(PPM_DMA) && defined(CONTROL_PPM_RIGHT) && (defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART2) || defined(DEBUG_SERIAL_USART2))
+  #error PPM_DMA and SERIAL_USART2 not allowed. TIM2 CH4 and the USART2 TX share DMA1 channel 7.
+#endif
+
 #if defined(CONTROL_PWM_LEFT) && defined(CONTROL_PWM_RIGHT)
   #error CONTROL_PWM_LEFT and CONTROL_PWM_RIGHT not allowed, choose one.
 #endif
 
+#if defined(PWM_CAPTURE) && !defined(CONTROL_PWM_LEFT)
+  #error PWM_CAPTURE is only available with CONTROL_PWM_LEFT (TIM2 and TIM5 on PA2 and PA3).
+#endif
+
 #if defined(SUPPORT_BUTTONS_LEFT) && defined(SUPPORT_BUTTONS_RIGHT)
   #error SUPPORT_BUTTONS_LEFT and SUPPORT_BUTTONS_RIGHT not allowed, choose one.
 #endif
@@ -778,6 +1392,18 @@
   #error SUPPORT_BUTTONS_RIGHT and (CONTROL_NUNCHUK or CONTROL_PPM_RIGHT or CONTROL_PWM_RIGHT or DEBUG_I2C_LCD) not allowed. It is on the same cable.
 #endif
 
+#if defined(NUNCHUK_ASYNC) && !defined(CONTROL_NUNCHUK)
+  #error NUNCHUK_ASYNC requires CONTROL_NUNCHUK
+#endif
+
+#if defined(LCD_ASYNC) && !defined(DEBUG_I2C_LCD) && !defined(SUPPORT_LCD)
+  #error LCD_ASYNC requires DEBUG_I2C_LCD or SUPPORT_LCD
+#endif
+
+#if defined(LCD_ASYNC) && defined(NUNCHUK_ASYNC)
+  #error LCD_ASYNC and NUNCHUK_ASYNC not allowed. Both own the I2C2 callbacks.
+#endif
+
 #if defined(CONTROL_NUNCHUK) && (defined(CONTROL_PPM_RIGHT) || defined(CONTROL_PWM_RIGHT) || defined(DEBUG_I2C_LCD))
   #error CONTROL_NUNCHUK and (CONTROL_PPM_RIGHT or CONTROL_PWM_RIGHT or DEBUG_I2C_LCD) not allowed. It is on the same cable.
 #endif
@@ -795,6 +1421,437 @@
 #if (defined(CONTROL_PPM_LEFT) || defined(CONTROL_PPM_RIGHT)) && !defined(PPM_NUM_CHANNELS)
   #error Total number of PPM channels needs to be set
 #endif
+
+#if defined(FOC_IN_RAM) && defined(PLATFORMIO)
+  #error FOC_IN_RAM is only supported with the Makefile build. The PlatformIO startup code does not copy the .ramfunc section.
+#endif
+
+#if defined(FLASH_SAFE_WRITE) && !defined(FOC_IN_RAM)
+  #error FLASH_SAFE_WRITE needs FOC_IN_RAM, build it with "make -e FLASH_SAFE_WRITE=1".
+#endif
+
+#if defined(FLASH_SAFE_WRITE) && (defined(HALL_CALIB) || defined(MOTOR_IDENT) || defined(COGGING_COMP) || defined(SPD_FILT) || defined(SELF_TEST))
+  #error FLASH_SAFE_WRITE does not support HALL_CALIB, MOTOR_IDENT, COGGING_COMP, SPD_FILT or SELF_TEST, their control interrupt code runs from flash (64-bit division in libgcc).
+#endif
+
+#if (DEBUG_TX_BUFFER_SIZE & (DEBUG_TX_BUFFER_SIZE - 1)) || (DEBUG_TX_BUFFER_SIZE < 2) || (DEBUG_TX_BUFFER_SIZE > 32768)
+  #error DEBUG_TX_BUFFER_SIZE must be a power of 2 between 2 and 32768.
+#endif
+
+#if defined(DC_FOLDBACK) && (I_DC_FOLD >= I_DC_MAX)
+  #error I_DC_FOLD must be below I_DC_MAX.
+#endif
+
+#if defined(DC_LINK_EST) && defined(OVERMOD)
+  #error DC_LINK_EST needs both shunt phase currents, OVERMOD holds a shunt phase at the rail and takes its current from the DC link.
+#endif
+
+#if defined(DC_LINK_EST) && (DC_EST_FILT < 1 || DC_EST_FILT > 10)
+  #error DC_EST_FILT must be between 1 and 10.
+#endif
+
+#if defined(DC_BUDGET) && (DC_BUDGET_I < 1 || DC_BUDGET_I > 2 * I_DC_MAX || DC_BUDGET_P < 0 || DC_BUDGET_FILT < 1 || DC_BUDGET_FILT > 8)
+  #error DC_BUDGET_I must be in [1, 2 * I_DC_MAX] A, DC_BUDGET_P at least 0 and DC_BUDGET_FILT in [1, 8].
+#endif
+
+#if defined(OFFSET_TRACK) && (OFFSET_TRACK_SHIFT < 4 || OFFSET_TRACK_SHIFT > 16)
+  #error OFFSET_TRACK_SHIFT must be between 4 and 16.
+#endif
+
+#if defined(CALIBRATION_ADAPTIVE) && (CALIBRATION_MIN_SAMPLES < 32 || CALIBRATION_MIN_SAMPLES > CALIBRATION_SAMPLES || CALIBRATION_SAMPLES > 65535)
+  #error CALIBRATION_MIN_SAMPLES must be between 32 and CALIBRATION_SAMPLES, CALIBRATION_SAMPLES at most 65535.
+#endif
+
+#if defined(SELF_TEST) && (SELF_TEST_DUTY < 5 || SELF_TEST_DUTY > 100 || SELF_TEST_CUR < 1)
+  #error SELF_TEST_DUTY must be between 5 and 100, SELF_TEST_CUR at least 1 A.
+#endif
+
+#if (ADC_INPUT_FILT < 0) || (ADC_INPUT_FILT > 2) || (ADC_INPUT_FILT == 1 && (ADC_INPUT_FILT_SHIFT < 1 || ADC_INPUT_FILT_SHIFT > 8)) || (ADC_INPUT_FILT == 2 && (ADC_INPUT_FILT_SHIFT < 1 || ADC_INPUT_FILT_SHIFT > 4))
+  #error ADC_INPUT_FILT must be 0, 1 or 2. ADC_INPUT_FILT_SHIFT must be between 1 and 8 for the moving average and between 1 and 4 for the EMAs.
+#endif
+
+#if defined(ADC_INPUT_OVS) && !defined(CONTROL_ADC)
+  #error ADC_INPUT_OVS needs CONTROL_ADC.
+#endif
+
+#if defined(ADC_INPUT_OVS) && ADC_INPUT_OVS != 4 && ADC_INPUT_OVS != 8 && ADC_INPUT_OVS != 16
+  #error ADC_INPUT_OVS must be 4, 8 or 16.
+#endif
+
+#if (DEBUG_BIN_MAX_ITEMS < 1) || (DEBUG_BIN_MAX_ITEMS > 48)
+  #error DEBUG_BIN_MAX_ITEMS must be between 1 and 48.
+#endif
+
+#if (DEBUG_CMD_QUEUE_SIZE & (DEBUG_CMD_QUEUE_SIZE - 1)) || (DEBUG_CMD_QUEUE_SIZE < 2) || (DEBUG_CMD_QUEUE_SIZE > 128)
+  #error DEBUG_CMD_QUEUE_SIZE must be a power of 2 between 2 and 128.
+#endif
+
+#if defined(SCOPE_ENABLE) && !defined(DEBUG_SERIAL_PROTOCOL)
+  #error SCOPE_ENABLE needs DEBUG_SERIAL_PROTOCOL.
+#endif
+
+#if defined(SCHED_STATS) && !defined(DEBUG_SERIAL_PROTOCOL)
+  #error SCHED_STATS needs DEBUG_SERIAL_PROTOCOL.
+#endif
+
+#if defined(HALL_STATS) && !defined(DEBUG_SERIAL_PROTOCOL)
+  #error HALL_STATS needs DEBUG_SERIAL_PROTOCOL.
+#endif
+
+#if defined(CTRL_HOOKS) && (CTRL_HOOK_BUDGET < 1 || CTRL_HOOK_BUDGET > 65534)
+  #error CTRL_HOOK_BUDGET must be in [1, 65534] cycles.
+#endif
+
+#if defined(LATENCY_MEAS) && (!defined(DEBUG_SERIAL_PROTOCOL) || defined(VARIANT_TRANSPOTTER))
+  #error LATENCY_MEAS needs DEBUG_SERIAL_PROTOCOL, and not VARIANT_TRANSPOTTER, which sets the outputs its own way.
+#endif
+
+#if defined(STACK_MONITOR) && (STACK_GUARD < 4 || STACK_GUARD % 4)
+  #error STACK_GUARD must be a multiple of 4 and at least 4.
+#endif
+
+#if defined(BLACKBOX_ENABLE) && (BLACKBOX_POST >= BLACKBOX_DEPTH)
+  #error BLACKBOX_POST must be smaller than BLACKBOX_DEPTH.
+#endif
+
+#if defined(FAULTLOG_ENABLE) && ((FAULTLOG_ADDR % FLASH_PAGE_SIZE) || FAULTLOG_PAGES < 2 || FAULTLOG_ADDR < 0x0803C000 || (FAULTLOG_ADDR + FAULTLOG_PAGES * FLASH_PAGE_SIZE) > 0x0803E000)
+  #error FAULTLOG_ADDR must be FLASH_PAGE_SIZE aligned and the fault log must fit below the EEPROM emulation pages in the NVM region of the linker script (0x0803C000 - 0x0803DFFF), FAULTLOG_PAGES at least 2.
+#endif
+
+#if defined(FAULTLOG_ENABLE) && defined(BLACKBOX_ENABLE) && (FAULTLOG_BBOX_SAMPLES < 1 || FAULTLOG_BBOX_SAMPLES > 27 || FAULTLOG_BBOX_SAMPLES > BLACKBOX_DEPTH)
+  #error FAULTLOG_BBOX_SAMPLES must be between 1 and 27 (one record has to fit in a flash page) and not exceed BLACKBOX_DEPTH.
+#endif
+
+#if defined(TRIP_STATS) && ((TRIP_ADDR % FLASH_PAGE_SIZE) || TRIP_PAGES < 2 || TRIP_ADDR < 0x0803C000 || (TRIP_ADDR + TRIP_PAGES * FLASH_PAGE_SIZE) > 0x0803E000)
+  #error TRIP_ADDR must be FLASH_PAGE_SIZE aligned and the trip log must fit below the EEPROM emulation pages in the NVM region of the linker script (0x0803C000 - 0x0803DFFF), TRIP_PAGES at least 2.
+#endif
+
+#if defined(VBAT_COMP) && (VBAT_COMP_NOM < 100 * BAT_CELLS * 2 || VBAT_COMP_NOM > 100 * BAT_CELLS * 5 || (defined(GAIN_SCHED) && GAIN_SCHED_VBAT != 0))
+  #error VBAT_COMP_NOM must be in [2, 5] V per cell, and VBAT_COMP not with GAIN_SCHED_VBAT: both compensate the battery voltage in the current loop.
+#endif
+
+#if defined(GAIN_SCHED) && (!defined(PARAM_STAGED) || CTRL_TYP_SEL != FOC_CTRL || GAIN_SCHED_VBAT < 0)
+  #error GAIN_SCHED needs PARAM_STAGED and CTRL_TYP_SEL FOC_CTRL, GAIN_SCHED_VBAT must not be negative.
+#endif
+
+#if defined(TRIP_STATS) && defined(FAULTLOG_ENABLE) && (TRIP_ADDR < FAULTLOG_ADDR + FAULTLOG_PAGES * FLASH_PAGE_SIZE) && (FAULTLOG_ADDR < TRIP_ADDR + TRIP_PAGES * FLASH_PAGE_SIZE)
+  #error The trip log and the fault log must not share flash pages, see TRIP_ADDR and FAULTLOG_ADDR.
+#endif
+
+#if defined(EFF_ESTIMATE) && (CTRL_TYP_SEL != FOC_CTRL || EFF_WINDOW < 1 || EFF_WINDOW > 60 || TRIP_WHEEL_MM < 1)
+  #error EFF_ESTIMATE needs CTRL_TYP_SEL FOC_CTRL (iq, id), EFF_WINDOW in [1, 60] s and TRIP_WHEEL_MM at least 1.
+#endif
+
+#if defined(TRIP_STATS) && (TRIP_SAVE_PERIOD < 10 || TRIP_WHEEL_MM < 1)
+  #error TRIP_SAVE_PERIOD must be at least 10 s and TRIP_WHEEL_MM positive.
+#endif
+
+#if PWM_FREQ < 16000 || PWM_FREQ > 24000 || (PWM_FREQ % 1000) != 0
+  #error PWM_FREQ must be a multiple of 1000 between 16000 and 24000. Above 24 kHz the controller speed coefficient overflows and the ISR deadline gets too short.
+#endif
+
+#if defined(HALL_SPEED_EST) && (HALL_SPEED_EDGES < 1 || HALL_SPEED_EDGES > 6)
+  #error HALL_SPEED_EDGES must be between 1 and 6.
+#endif
+
+#if defined(FEEDBACK_FAST) && ((defined(FEEDBACK_SERIAL_USART2) && USART2_BAUD < 115200) || (defined(FEEDBACK_SERIAL_USART3) && USART3_BAUD < 115200))
+  #error FEEDBACK_FAST needs 115200 baud or more on the feedback port, a frame would not fit in one main loop.
+#endif
+
+#if defined(SERIAL_BAUD_NEGOTIATION) && (defined(CONTROL_IBUS) || !(defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)) || \
+    (defined(CONTROL_SERIAL_USART2) && !defined(FEEDBACK_SERIAL_USART2)) || (defined(CONTROL_SERIAL_USART3) && !defined(FEEDBACK_SERIAL_USART3)))
+  #error SERIAL_BAUD_NEGOTIATION needs CONTROL_SERIAL_USARTx (not iBUS) with FEEDBACK_SERIAL_USARTx on the same port, the switch is acknowledged in the feedback.
+#endif
+
+#if defined(FEEDBACK_COMPACT) && (defined(CONTROL_IBUS) || \
+    !((defined(CONTROL_SERIAL_USART2) && defined(FEEDBACK_SERIAL_USART2)) || (defined(CONTROL_SERIAL_USART3) && defined(FEEDBACK_SERIAL_USART3))))
+  #error FEEDBACK_COMPACT needs CONTROL_SERIAL_USARTx (not iBUS) with FEEDBACK_SERIAL_USARTx on the same port, the controller asks for it in its commands.
+#endif
+
+#if defined(SERIAL_BUS) && (defined(CONTROL_IBUS) || (defined(CONTROL_SERIAL_USART2) && defined(CONTROL_SERIAL_USART3)) || \
+    !((defined(CONTROL_SERIAL_USART2) && defined(FEEDBACK_SERIAL_USART2)) || (defined(CONTROL_SERIAL_USART3) && defined(FEEDBACK_SERIAL_USART3))))
+  #error SERIAL_BUS needs one CONTROL_SERIAL_USARTx (not iBUS) with FEEDBACK_SERIAL_USARTx on the same port, the board answers when polled.
+#endif
+
+#if defined(SERIAL_BUS) && (defined(SERIAL_HW_CRC) || defined(SERIAL_BAUD_NEGOTIATION) || defined(FEEDBACK_COMPACT) || \
+    (defined(CONTROL_SERIAL_USART2) && defined(FEEDBACK_SERIAL_USART3)) || (defined(CONTROL_SERIAL_USART3) && defined(FEEDBACK_SERIAL_USART2)))
+  #error SERIAL_BUS can not be combined with SERIAL_HW_CRC, SERIAL_BAUD_NEGOTIATION, FEEDBACK_COMPACT or a second FEEDBACK_SERIAL port.
+#endif
+
+#if defined(SERIAL_EXT_CMD) && (defined(CONTROL_IBUS) || !(defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)) || \
+    defined(SERIAL_HW_CRC) || defined(SERIAL_BUS))
+  #error SERIAL_EXT_CMD needs CONTROL_SERIAL_USARTx (not iBUS) and can not be combined with SERIAL_HW_CRC or SERIAL_BUS, its frames take the second start frame.
+#endif
+
+#if defined(TIME_SYNC) && (defined(CONTROL_IBUS) || !(defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)) || \
+    !(defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3)))
+  #error TIME_SYNC needs CONTROL_SERIAL_USARTx (not iBUS) for the references and FEEDBACK_SERIAL_USARTx for the stamped feedback.
+#endif
+
+#if defined(TIME_SYNC) && (TIME_SYNC_PERIOD < 10 || TIME_SYNC_PERIOD > 1000 || TIME_SYNC_STEP < 100)
+  #error TIME_SYNC_PERIOD must be in [10, 1000] ms and TIME_SYNC_STEP at least 100 us.
+#endif
+
+#if defined(SERIAL_COBS) && (defined(CONTROL_IBUS) || defined(SERIAL_HW_CRC) || defined(SERIAL_BUS) || \
+    !(defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)) || \
+    (defined(FEEDBACK_SERIAL_USART2) && !defined(CONTROL_SERIAL_USART2)) || (defined(FEEDBACK_SERIAL_USART3) && !defined(CONTROL_SERIAL_USART3)))
+  #error SERIAL_COBS needs CONTROL_SERIAL_USARTx (not iBUS), FEEDBACK_SERIAL_USARTx only on those ports, and can not be combined with SERIAL_HW_CRC or SERIAL_BUS.
+#endif
+
+#if defined(CMD_INTERP) && (CMD_INTERP_MAX < 2 * DELAY_IN_MAIN_LOOP || CMD_INTERP_MAX > 100)
+  #error CMD_INTERP_MAX must be in [2 * DELAY_IN_MAIN_LOOP, 100] ms.
+#endif
+
+#if defined(SERIAL_TIMEOUT_ADAPTIVE) && (SERIAL_TIMEOUT_MIN < 1 || SERIAL_TIMEOUT_MIN > SERIAL_TIMEOUT || SERIAL_TIMEOUT_FRAMES < 2 || SERIAL_TIMEOUT_RAMP < 1)
+  #error SERIAL_TIMEOUT_MIN must be in [1, SERIAL_TIMEOUT], SERIAL_TIMEOUT_FRAMES at least 2 and SERIAL_TIMEOUT_RAMP at least 1.
+#endif
+
+#if defined(BALANCE_CONTROL) && !defined(VARIANT_HOVERBOARD)
+  #error BALANCE_CONTROL is only available for VARIANT_HOVERBOARD.
+#endif
+
+#if defined(BALANCE_CONTROL) && (CTRL_TYP_SEL != FOC_CTRL || BALANCE_PITCH_START >= BALANCE_PITCH_MAX || BALANCE_RAMP < 1 || BALANCE_TRQ_MAX > 1000)
+  #error BALANCE_CONTROL needs CTRL_TYP_SEL FOC_CTRL (TRQ_MODE), BALANCE_PITCH_START below BALANCE_PITCH_MAX, BALANCE_RAMP at least 1 and BALANCE_TRQ_MAX at most 1000.
+#endif
+
+#if defined(SIDEBOARD_FAST) && !((defined(SIDEBOARD_SERIAL_USART2) && defined(FEEDBACK_SERIAL_USART2)) || (defined(SIDEBOARD_SERIAL_USART3) && defined(FEEDBACK_SERIAL_USART3)))
+  #error SIDEBOARD_FAST needs FEEDBACK_SERIAL on a SIDEBOARD_SERIAL port, the request travels in the feedback.
+#endif
+
+#if defined(SIDEBOARD_FAST) && SIDEBOARD_LED_REFRESH >= 1000
+  #error SIDEBOARD_LED_REFRESH must be below the 1000 ms high rate mode timeout of the sideboard (PROTO_SB_FAST_HOLD).
+#endif
+
+#if defined(SERIAL_BAUD_NEGOTIATION) && (SERIAL_BAUD_MAX < 115200 || SERIAL_BAUD_MAX > 2250000)
+  #error SERIAL_BAUD_MAX must be in [115200, 2250000].
+#endif
+
+#if defined(SERIAL_RX_DMA_IRQ) && SERIAL_BUFFER_SIZE % 2
+  #error SERIAL_RX_DMA_IRQ needs an even SERIAL_BUFFER_SIZE, the half transfer interrupt splits the buffer in two.
+#endif
+
+#if defined(CONTROL_IBUS) && (IBUS_NUM_CHANNELS != 14 || IBUS_LENGTH != 2 * IBUS_NUM_CHANNELS + 4)
+  #error The iBUS frame is IBUS_LENGTH = 32 bytes: 14 channels.
+#endif
+
+#if CRC32_TABLES != 1 && CRC32_TABLES != 8
+  #error CRC32_TABLES must be 1 or 8.
+#endif
+
+#if defined(SERIAL_HW_CRC) && defined(CONTROL_IBUS)
+  #error SERIAL_HW_CRC is not available with CONTROL_IBUS. The iBUS frame uses its own checksum.
+#endif
+
+#if defined(CTRL_MULTIRATE) && (CTRL_SLOW_DIV < 4 || CTRL_SLOW_DIV > 8 || (CTRL_SLOW_DIV % 2) != 0)
+  #error CTRL_SLOW_DIV must be 4, 6 or 8. Below 4 the slow tasks of both motors can not take separate ticks.
+#endif
+
+#if PWM_ZSEQ != PWM_ZSEQ_MID && PWM_ZSEQ != PWM_ZSEQ_LOW
+  #error PWM_ZSEQ must be PWM_ZSEQ_MID or PWM_ZSEQ_LOW.
+#endif
+
+#if defined(OVERMOD) && (OVERMOD_GAIN_MAX < 1024 || OVERMOD_GAIN_MAX > 4096 || OVERMOD_RATE < 1 || OVERMOD_RATE > 64)
+  #error OVERMOD_GAIN_MAX must be in [1024, 4096] and OVERMOD_RATE in [1, 64].
+#endif
+
+#if defined(OVERMOD) && (OVERMOD_EXIT < 50 || OVERMOD_EXIT >= OVERMOD_ENTER || OVERMOD_ENTER > 100)
+  #error OVERMOD_EXIT must be in [50, OVERMOD_ENTER) and OVERMOD_ENTER at most 100.
+#endif
+
+#if DT_COMP < 0 || DT_COMP > 2 * DEAD_TIME || DT_COMP_BAND * A2BIT_CONV < 1000
+  #error DT_COMP must be in [0, 2 * DEAD_TIME] and DT_COMP_BAND at least one ADC bit.
+#endif
+
+#if ADC_OVERSAMPLE != 1 && ADC_OVERSAMPLE != 2 && ADC_OVERSAMPLE != 4
+  #error ADC_OVERSAMPLE must be 1, 2 or 4.
+#endif
+
+#if (defined(MCU_GD32F103) && defined(MCU_AT32F403)) || ((defined(MCU_GD32F103) || defined(MCU_AT32F403)) && defined(CLOCK_HSE))
+  #error Select one MCU_ type, and not with CLOCK_HSE: the MCU_ clocks run from the HSI.
+#endif
+
+#if DEAD_TIME > 254 || PWM_RES > 65535
+  #error DEAD_TIME must be at most 254 timer counts (BDTR DTG) and PWM_RES fit the 16 bit timer: a lower SYSCLK_HZ or a higher PWM_FREQ.
+#endif
+
+// The FOC duties span 2 FOC_VOLT_MAX at most, that must fit between the bottom and the sampling window (pwm_margin) of a shunt phase
+#if FOC_VOLT_MAX < 500 || 2 * FOC_VOLT_MAX > 2000 - PWM_MARGIN * 2000L / PWM_RES
+  #error FOC_VOLT_MAX must be at least 500 and fit the PWM range, at most 945 at 16 kHz (927 with CLOCK_HSE), less with ADC_OVERSAMPLE.
+#endif
+
+#if defined(DRIVE_PROFILE_IBUS_CH) && (!defined(MULTI_MODE_DRIVE) || !defined(CONTROL_IBUS) || DRIVE_PROFILE_IBUS_CH < 1 || DRIVE_PROFILE_IBUS_CH > IBUS_NUM_CHANNELS)
+  #error DRIVE_PROFILE_IBUS_CH needs MULTI_MODE_DRIVE, CONTROL_IBUS and a channel from 1 to IBUS_NUM_CHANNELS.
+#endif
+
+#if defined(DRIVE_PROFILE_BUTTON) && (!defined(MULTI_MODE_DRIVE) || defined(VARIANT_HOVERBOARD) || !(defined(SIDEBOARD_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART3)))
+  #error DRIVE_PROFILE_BUTTON needs MULTI_MODE_DRIVE and a sideboard on USART2 or USART3, not on VARIANT_HOVERBOARD.
+#endif
+
+#if defined(STANDSTILL_HOLD_ENABLE) && (CTRL_TYP_SEL != FOC_CTRL || (defined(CTRL_FIXED) && CTRL_MOD_REQ != SPD_MODE))
+  #error STANDSTILL_HOLD_ENABLE runs the controller in SPD_MODE: it needs FOC_CTRL, and CTRL_MOD_REQ = SPD_MODE with CTRL_FIXED.
+#endif
+
+#if (defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)) && \
+    (SPD_REF_JERK * 65536 * POS_CTRL_DIV * POS_CTRL_DIV < PWM_FREQ * PWM_FREQ || SPD_REF_JERK * POS_CTRL_DIV > SPD_REF_ACC * PWM_FREQ)
+  #error The cruise control reference steps every POS_CTRL_DIV ticks: SPD_REF_JERK must be in [PWM_FREQ^2 / (65536 * POS_CTRL_DIV^2), SPD_REF_ACC * PWM_FREQ / POS_CTRL_DIV] rpm/s^2.
+#endif
+
+#if defined(DRIVE_PROFILE_BUTTON) && defined(CRUISE_CONTROL_SUPPORT)
+  #error DRIVE_PROFILE_BUTTON and CRUISE_CONTROL_SUPPORT both use sideboard sensor 2, select just one.
+#endif
+
+#if defined(HALL_CALIB) && !(defined(DEBUG_SERIAL_PROTOCOL) && defined(DEBUG_OUT))
+  #error HALL_CALIB needs DEBUG_SERIAL_PROTOCOL on a debug USART or DEBUG_RTT for the $HALLCAL command.
+#endif
+
+#if defined(SPD_FILT) && !(defined(DEBUG_SERIAL_PROTOCOL) && defined(DEBUG_OUT))
+  #error SPD_FILT needs DEBUG_SERIAL_PROTOCOL on a debug USART or DEBUG_RTT for its parameters and the $SPDID command.
+#endif
+
+#if defined(SPD_FILT) && (SPD_FILT_NOTCH_HZ > 500 || SPD_FILT_LP_HZ > 500 || SPD_FILT_NOTCH_BW < 1 || SPD_FILT_NOTCH_BW > 200 || SPD_FILT_NOTCH_DEPTH > 100)
+  #error SPD_FILT_NOTCH_HZ and SPD_FILT_LP_HZ must be at most 500, SPD_FILT_NOTCH_BW in [1, 200] and SPD_FILT_NOTCH_DEPTH at most 100.
+#endif
+
+#if defined(SPD_FILT) && (SPD_ID_F0 < 1 || SPD_ID_F1 <= SPD_ID_F0 || SPD_ID_F1 > 500 || SPD_ID_AMP < 1 || SPD_ID_PEAK < 100)
+  #error SPD_ID_F0 must be at least 1 and below SPD_ID_F1, SPD_ID_F1 at most 500, SPD_ID_AMP at least 1 and SPD_ID_PEAK at least 100.
+#endif
+
+#if defined(MOTOR_IDENT) && !(defined(DEBUG_SERIAL_PROTOCOL) && defined(DEBUG_OUT))
+  #error MOTOR_IDENT needs DEBUG_SERIAL_PROTOCOL on a debug USART or DEBUG_RTT for the $MOTID command.
+#endif
+
+#if defined(COGGING_COMP) && !(defined(DEBUG_SERIAL_PROTOCOL) && defined(DEBUG_OUT))
+  #error COGGING_COMP needs DEBUG_SERIAL_PROTOCOL on a debug USART or DEBUG_RTT for the $COGCAL command.
+#endif
+
+#if defined(COGGING_COMP) && (CTRL_TYP_SEL != FOC_CTRL || COGGING_SPEED < 5 || COGGING_SPEED > 100 || COGGING_TIME < 2 || COGGING_TIME > 30 || COGGING_N_MAX < 10)
+  #error COGGING_COMP needs FOC, COGGING_SPEED in [5, 100] rpm, COGGING_TIME in [2, 30] s and COGGING_N_MAX of at least 10 rpm.
+#endif
+
+#if defined(MOTOR_IDENT) && (MOTOR_IDENT_CUR < 2 || MOTOR_IDENT_CUR > 15 || MOTOR_IDENT_VLT < 100 || MOTOR_IDENT_VLT > 600)
+  #error MOTOR_IDENT_CUR must be in [2, 15] A and MOTOR_IDENT_VLT in [100, 600].
+#endif
+
+#if defined(CTRL_GAINS) && defined(MOTOR_IDENT) && MOTOR_IDENT_BW > 0
+  #error CTRL_GAINS loads the saved current loop gains after the ones of MOTOR_IDENT_BW, set MOTOR_IDENT_BW 0.
+#endif
+
+#if defined(MOTOR_IDENT) && (MOTOR_IDENT_BW < 0 || MOTOR_IDENT_BW * 30 > PWM_FREQ)
+  #error MOTOR_IDENT_BW must be in [0, PWM_FREQ / 30] Hz, the current PI runs at PWM_FREQ / 3 and needs about 10 steps per bandwidth period.
+#endif
+
+#if defined(SPD_REF_GEN) && (SPD_REF_ACC < 10 || SPD_REF_ACC > 20000 || SPD_REF_JERK < SPD_REF_ACC || \
+                             SPD_REF_JERK * DELAY_IN_MAIN_LOOP > SPD_REF_ACC * 1000 || SPD_FF_ACC < 0 || SPD_FF_ACC > 100)
+  #error SPD_REF_ACC must be in [10, 20000] rpm/s, SPD_REF_JERK in [SPD_REF_ACC, SPD_REF_ACC * 1000 / DELAY_IN_MAIN_LOOP] rpm/s^2 and SPD_FF_ACC in [0, 100] mA per rpm/s.
+#endif
+
+#if defined(POS_CTRL) && (!(defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)) || defined(CONTROL_IBUS))
+  #error POS_CTRL needs the serial command protocol on CONTROL_SERIAL_USART2 or CONTROL_SERIAL_USART3.
+#endif
+
+#if defined(POS_CTRL) && (CTRL_TYP_SEL != FOC_CTRL || (defined(CTRL_FIXED) && CTRL_MOD_REQ != SPD_MODE))
+  #error POS_CTRL runs the controller in SPD_MODE: it needs FOC_CTRL, and CTRL_MOD_REQ = SPD_MODE with CTRL_FIXED.
+#endif
+
+#if defined(POS_CTRL) && (POS_CTRL_DIV < 1 || POS_CTRL_DIV > 64 || POS_SPD_MAX < 10 || POS_SPD_MAX > N_MOT_MAX || \
+                          POS_ACC < 10 || POS_ACC > 20000 || POS_KP < 1 || POS_KP > 200 || POS_ACC / POS_KP > 2000)
+  #error POS_CTRL_DIV must be in [1, 64] ticks, POS_SPD_MAX in [10, N_MOT_MAX] rpm, POS_ACC in [10, 20000] rpm/s, POS_KP in [1, 200] 1/s and POS_ACC / POS_KP at most 2000 rpm.
+#endif
+
+#if defined(HALL_CALIB) && (HALL_CALIB_VOLT < 10 || HALL_CALIB_VOLT > 300 || HALL_CALIB_SPEED < 2 || HALL_CALIB_SPEED > 60)
+  #error HALL_CALIB_VOLT must be in [10, 300] and HALL_CALIB_SPEED in [2, 60] rpm.
+#endif
+
+#if defined(TRACE_ITM) && (SYSCLK_HZ % TRACE_SWO_BAUD != 0 || TRACE_SWO_BAUD > 4000000)
+  #error TRACE_SWO_BAUD must divide SYSCLK_HZ and be at most 4 Mbit/s (ST-LINK V2).
+#endif
+
+#if defined(TRACE_ITM_PRINTF) && (!defined(TRACE_ITM) || defined(DEBUG_SERIAL_PROTOCOL) || !(defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)))
+  #error TRACE_ITM_PRINTF needs TRACE_ITM and a DEBUG_SERIAL_USART2 / DEBUG_SERIAL_USART3 debug output without DEBUG_SERIAL_PROTOCOL.
+#endif
+
+#if defined(HALL_COM_HW) && (defined(CONTROL_PPM_RIGHT) || defined(CONTROL_PWM_RIGHT) || defined(PWM_CARRIER_DOUBLE) || (defined(CTRL_FIXED) && CTRL_TYP_SEL != COM_CTRL))
+  #error HALL_COM_HW needs the EXTI lines 10..12 (no CONTROL_PPM_RIGHT / CONTROL_PWM_RIGHT), a fixed carrier (no PWM_CARRIER_DOUBLE) and COM_CTRL with CTRL_FIXED.
+#endif
+
+#if defined(ANGLE_OBSERVER) && CTRL_TYP_SEL == COM_CTRL
+  #error ANGLE_OBSERVER needs CTRL_TYP_SEL FOC_CTRL or SIN_CTRL, COM_CTRL does not use the angle.
+#endif
+
+#if defined(ANGLE_OBSERVER) && (OBS_SPD_LO >= OBS_SPD_HI || OBS_SPD_HI >= N_MOT_MAX)
+  #error OBS_SPD_LO must be lower than OBS_SPD_HI and OBS_SPD_HI lower than N_MOT_MAX.
+#endif
+
+#if defined(SERIAL_FAST_CMD) && (!defined(USE_RAW_INPUT) || defined(CONTROL_IBUS) || !(defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)) || \
+                                 defined(VARIANT_HOVERCAR) || defined(VARIANT_SKATEBOARD) || defined(VARIANT_TRANSPOTTER))
+  #error SERIAL_FAST_CMD needs USE_RAW_INPUT and CONTROL_SERIAL_USART2 or CONTROL_SERIAL_USART3 (not iBUS), the input filters and the variant logic of the main loop are bypassed.
+#endif
+
+#if defined(CURRENT_DERATING) && (DERATE_I_CONT < 1 || DERATE_I_CONT > I_MOT_MAX || DERATE_BAT_END >= DERATE_BAT_START || \
+                                  DERATE_TEMP_START >= TEMP_POWEROFF || DERATE_MIN < 1 || DERATE_MIN > 100 || DERATE_I2T_TAU < 1)
+  #error CURRENT_DERATING: DERATE_I_CONT must be in [1, I_MOT_MAX], DERATE_BAT_END below DERATE_BAT_START, DERATE_TEMP_START below TEMP_POWEROFF and DERATE_MIN in [1, 100] %.
+#endif
+
+#if defined(WINDING_TEMP) && (CTRL_TYP_SEL != FOC_CTRL || WTEMP_INJ_CUR < 1 || 2 * WTEMP_INJ_CUR > I_MOT_MAX || WTEMP_START >= WTEMP_MAX || \
+                              WTEMP_RTH < 1 || WTEMP_TAU < 10 || WTEMP_INJ_PERIOD < 5)
+  #error WINDING_TEMP needs CTRL_TYP_SEL FOC_CTRL, WTEMP_INJ_CUR in [1, I_MOT_MAX / 2], WTEMP_START below WTEMP_MAX, WTEMP_TAU at least 10 s and WTEMP_INJ_PERIOD at least 5 s.
+#endif
+
+#if FIELD_WEAK_ENA < 0 || FIELD_WEAK_ENA > 2
+  #error FIELD_WEAK_ENA must be 0, 1 or 2.
+#endif
+
+#if defined(ANTILOCK_BRAKE) && (ANTILOCK_DECEL < 500 || ANTILOCK_SLIP < 1 || ANTILOCK_SLIP > 90 || ANTILOCK_RELEASE < 1 || ANTILOCK_RELEASE > 100 || ANTILOCK_APPLY < 4 || ANTILOCK_APPLY > 10000)
+  #error ANTILOCK_BRAKE: ANTILOCK_DECEL must be at least 500 rpm/s, ANTILOCK_SLIP in [1, 90] %, ANTILOCK_RELEASE in [1, 100] %/ms and ANTILOCK_APPLY in [4, 10000] %/s.
+#endif
+
+#if defined(ANTILOCK_BRAKE) && (CTRL_TYP_SEL != FOC_CTRL)
+  #error ANTILOCK_BRAKE needs FOC, it acts on the TORQUE mode targets.
+#endif
+
+#if defined(REGEN_LIMIT) && (REGEN_V_START >= REGEN_V_MAX || REGEN_RISE < 4 || REGEN_RISE > 10000)
+  #error REGEN_LIMIT: REGEN_V_START must be below REGEN_V_MAX and REGEN_RISE in [4, 10000] %/s.
+#endif
+
+#if defined(ADC_TEMP_DECIM) && (ADC_TEMP_PERIOD < 1 || ADC_TEMP_PERIOD > 1000)
+  #error ADC_TEMP_PERIOD must be in [1, 1000] ms.
+#endif
+
+#if defined(IDLE_POWER_SAVE) && (IDLE_DIV < 2 || IDLE_DIV > 128)
+  #error IDLE_DIV must be in [2, 128], the master timer repetition counter takes 2 * IDLE_DIV - 1 in 8 bits.
+#endif
+
+#if defined(PWM_CARRIER_DOUBLE) && (PWM_RES % 2 || PWM_MARGIN >= PWM_RES / 4 || PWM_CARRIER_N < 1 || PWM_CARRIER_HYST < 1)
+  #error PWM_CARRIER_DOUBLE needs an even PWM_RES (PWM_FREQ), a PWM_MARGIN below a quarter of it and PWM_CARRIER_N, PWM_CARRIER_HYST >= 1.
+#endif
+
+#if defined(CTRL_PREDICT) && (CTRL_TYP_SEL != FOC_CTRL)
+  #error CTRL_PREDICT needs CTRL_TYP_SEL FOC_CTRL, the angle advance and the decoupling act on the dq voltages.
+#endif
+
+#if defined(CTRL_VALLEY_LOAD) && !defined(ADC_SAMPLE_ALIGN)
+  #error CTRL_VALLEY_LOAD needs ADC_SAMPLE_ALIGN: with TIM8 RCR = 0 the update event also comes at the valley, where the shunts carry no current.
+#endif
+
+#if defined(ADC_SAMPLE_ALIGN) && (defined(IDLE_POWER_SAVE) || defined(PWM_CARRIER_DOUBLE))
+  #error ADC_SAMPLE_ALIGN triggers the ADC every PWM period, the repetition counter of IDLE_POWER_SAVE / PWM_CARRIER_DOUBLE no longer decimates it.
+#endif
+
+#if defined(ADC_SAMPLE_ALIGN) && (ADC_SAMPLE_OFFSET < 0 || ADC_SAMPLE_OFFSET > PWM_RES / 2 || ADC_SAMPLE_SETTLE < 0 || ADC_SAMPLE_SETTLE > PWM_MARGIN || ADC_SAMPLE_SWEEP < 16 || ADC_SAMPLE_SWEEP > PWM_RES / 2)
+  #error ADC_SAMPLE_OFFSET must be in [0, PWM_RES / 2], ADC_SAMPLE_SETTLE in [0, PWM_MARGIN] and ADC_SAMPLE_SWEEP in [16, PWM_RES / 2] timer counts.
+#endif
+
+#if defined(PWM_CARRIER_DOUBLE) && defined(IDLE_POWER_SAVE) && IDLE_DIV > 64
+  #error IDLE_DIV must be at most 64 with PWM_CARRIER_DOUBLE, the doubled carrier doubles the repetition counter.
+#endif
+
+#if defined(BAT_SOC_ENABLE) && (BAT_CAPACITY < 100 || BAT_CAPACITY > 65000)
+  #error BAT_CAPACITY must be in [100, 65000] mAh, the remaining charge is saved as one 16 bit word.
+#endif
+
+#if defined(BAT_SOC_ENABLE) && !(BAT_SOC_LVL1 < BAT_SOC_LVL2 && BAT_SOC_LVL2 < BAT_SOC_LVL3 && BAT_SOC_LVL3 < BAT_SOC_LVL4 && BAT_SOC_LVL4 < BAT_SOC_LVL5 && BAT_SOC_LVL5 <= 100)
+  #error BAT_SOC_LVL1 .. BAT_SOC_LVL5 must be rising and at most 100 %.
+#endif
 // ############################# END OF VALIDATE SETTINGS ############################
 
 #endif
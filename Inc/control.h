@@ -13,3 +13,10 @@ extern volatile uint16_t ppm_captured_value[PPM_NUM_CHANNELS+1];
 extern volatile uint16_t pwm_captured_ch1_value;
 extern volatile uint16_t pwm_captured_ch2_value;
 #endif
+#if defined(CONTROL_PPM_LEFT) || defined(CONTROL_PPM_RIGHT)
+extern uint32_t ppm_time;               // [us] timeUs() of the last valid frame
+#endif
+#if defined(CONTROL_PWM_LEFT) || defined(CONTROL_PWM_RIGHT)
+extern uint32_t pwm_time_ch1;           // [us] timeUs() of the last valid pulse
+extern uint32_t pwm_time_ch2;
+#endif
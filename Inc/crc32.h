@@ -1,4 +1,9 @@
 #pragma once
 #include <stdint.h>
+#include "config.h"
 uint32_t calc_crc32(const unsigned char *buffer,
     unsigned int length);
+#if defined(SERIAL_HW_CRC)
+uint32_t calc_crc32_hw(const unsigned char *buffer,
+    unsigned int length);
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+
+// Shared DC link budget, DC_BUDGET. One battery current limit for both motors together, split each control tick from
+// their demand and fed to the i_max of each controller step (see dcbudget.c).
+// dcBudgetTotal runs in the monitor task, dcBudgetStep in the control interrupt after both motors.
+typedef struct {
+  int32_t  iDc[2];                      // [ADC bits, Q4 + filter shift] filtered battery current, left / right
+  int32_t  iq[2];                       // [fixdt(1,16,4), Q filter shift] filtered |iq|, left / right
+  int32_t  total;                       // [ADC bits, Q4] budget of both motors, from the current and the power limit
+  int32_t  share[2];                    // [ADC bits, Q4] DC link current allowed to each motor
+  int16_t  iMax[2];                     // [fixdt(1,16,4) ADC bits] phase current limit read by the next controller step
+} DcBudget;
+
+void dcBudgetInit(DcBudget *b);
+void dcBudgetTotal(DcBudget *b, int16_t vBat);
+void dcBudgetStep(DcBudget *b, int16_t iDcL, int16_t iDcR, int16_t iqL, int16_t iqR);
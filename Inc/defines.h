@@ -25,6 +25,7 @@
 
 #include "stm32f1xx_hal.h"
 #include "config.h"
+#include "ramfunc.h"
 
 #define LEFT_HALL_U_PIN GPIO_PIN_5
 #define LEFT_HALL_V_PIN GPIO_PIN_6
@@ -42,6 +43,12 @@
 #define RIGHT_HALL_V_PORT GPIOC
 #define RIGHT_HALL_W_PORT GPIOC
 
+// Hall decoding reads the IDR of one port per motor: U, V, W pins must be on the same port and consecutive (U lowest)
+#define LEFT_HALL_PORT   GPIOB
+#define LEFT_HALL_SHIFT  5               // bit position of LEFT_HALL_U_PIN
+#define RIGHT_HALL_PORT  GPIOC
+#define RIGHT_HALL_SHIFT 10             // bit position of RIGHT_HALL_U_PIN
+
 #define LEFT_TIM TIM8
 #define LEFT_TIM_U CCR1
 #define LEFT_TIM_UH_PIN GPIO_PIN_6
@@ -76,6 +83,12 @@
 #define RIGHT_TIM_WL_PIN GPIO_PIN_15
 #define RIGHT_TIM_WL_PORT GPIOB
 
+// Break inputs of the motor timers (HW_BREAK)
+#define LEFT_TIM_BKIN_PIN GPIO_PIN_6
+#define LEFT_TIM_BKIN_PORT GPIOA
+#define RIGHT_TIM_BKIN_PIN GPIO_PIN_12
+#define RIGHT_TIM_BKIN_PORT GPIOB
+
 // #define LEFT_DC_CUR_ADC ADC1
 // #define LEFT_U_CUR_ADC ADC1
 // #define LEFT_V_CUR_ADC ADC1
@@ -187,6 +200,20 @@
 
 #define DELAY_TIM_FREQUENCY_US 1000000
 
+/* Interrupt priorities, NVIC_PRIORITYGROUP_4: 0 is the highest, no sub-priorities.
+ * The control interrupt preempts everything else, so its jitter does not depend on inputs or serial traffic.
+ * Only the hall edges of HALL_COM_HW come first, they write the three duties of the next sector and return.
+ * The USART IRQs only note the IDLE line and pend PendSV, the frames are copied, checked and processed there,
+ * in the same context as the slow task of the control interrupt. SysTick stays above PendSV, so the tick
+ * (serial timeouts, frame intervals) keeps counting while a burst of frames is processed. */
+#define IRQ_PRIO_COMMUT     0     // EXTI9_5, EXTI15_10: hall edges with HALL_COM_HW (bldc.c)
+#define IRQ_PRIO_CONTROL    1     // DMA1_Channel1: ADC done, FOC of both motors (bldc.c)
+#define IRQ_PRIO_INPUT      2     // EXTI: PPM / PWM input edges, a timer read each
+#define IRQ_PRIO_COMMS      4     // USART2/3 and their DMA channels, I2C2 and its DMA: HAL transfer handling only
+#define IRQ_PRIO_SYSTICK    14    // SysTick: HAL tick, TIM4: timebase epoch (timebase.c)
+#define IRQ_PRIO_DEFERRED   15    // PendSV: slow task and serial frame processing
+#define IRQ_BASEPRI(prio)   ((prio) << (8U - __NVIC_PRIO_BITS))   // BASEPRI value masking prio and lower
+
 #define MILLI_R (R * 1000)
 #define MILLI_PSI (PSI * 1000)
 #define MILLI_V (V * 1000)
@@ -210,10 +237,7 @@
 #define MAX3(a, b, c) MAX(a, MAX(b, c))
 #define ARRAY_LEN(x) (uint32_t)(sizeof(x) / sizeof(*(x)))
 #define MAP(x, in_min, in_max, out_min, out_max) (((((x) - (in_min)) * ((out_max) - (out_min))) / ((in_max) - (in_min))) + (out_min))
-
-#if defined(PRINTF_FLOAT_SUPPORT) && (defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)) && defined(__GNUC__)
-    asm(".global _printf_float");     // this is the magic trick for printf to support float. Warning: It will increase code considerably! Better to avoid!
-#endif
+#define RCP16(num, den) ((int32_t)((((int64_t)(num) << 16) + (den) - 1) / (den)))   // num/den as fixdt(1,32,16) multiplier rounded up, den > 0, for constant scalings
 
 
 typedef struct {
@@ -227,6 +251,7 @@ typedef struct {
   uint16_t l_tx2;
   uint16_t temp;
   uint16_t l_rx2;
+  uint16_t vref;                        // VREFINT, only with ADC_TEMP_DECIM
 } adc_buf_t;
 
 typedef enum {
@@ -238,10 +263,15 @@ typedef enum {
 
 // Define I2C, Nunchuk, PPM, PWM functions
 void I2C_Init(void);
+void I2C_Bus_Recover(void);
 nunchuk_state Nunchuk_Read(void);
 void PPM_Init(void);
 void PPM_ISR_Callback(void);
+void PPM_Decode(void);
+void PPM_Timeout(void);
 void PWM_Init(void);
+void PWM_Read(void);
+void PWM_Timeout(void);
 void PWM_ISR_CH1_Callback(void);
 void PWM_ISR_CH2_Callback(void);
 
@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+
+// Phase current derating, CURRENT_DERATING. Lowers the i_max of both controllers below the configured one from the
+// board temperature trend, the battery voltage sag, an I^2t estimate of the motor and MOSFET heating and the winding
+// temperature of WINDING_TEMP (see derate.c).
+// derateStep runs in the monitor task, the control interrupt only clamps i_max to iMax around the controller steps.
+enum derateSources {DERATE_SRC_NONE, DERATE_SRC_TEMP, DERATE_SRC_BAT, DERATE_SRC_I2T, DERATE_SRC_WIND};
+
+typedef struct {
+  int32_t  iMaxQ8;                      // [fixdt(1,16,4) ADC bits, Q8] smoothed current limit
+  int32_t  heat;                        // [Q24] I^2t state, 1.0 = steady state heat of DERATE_I_CONT
+  int32_t  tempSlope;                   // [degC*10 per s, Q8] filtered board temperature trend
+  int16_t  tempPrev;                    // [degC*10] board temperature of the last trend sample
+  uint16_t tempTicks;                   // [ms] time since the last trend sample
+  int16_t  iMax;                        // [fixdt(1,16,4) ADC bits] current limit read by the control interrupt
+  uint8_t  src;                         // [-] derateSources, the limit that is active
+} Derate;
+
+void    derateInit(Derate *d, int16_t iMaxBase, int16_t temp);
+int16_t derateStep(Derate *d, int16_t iMaxBase, int16_t temp, int16_t vBat, int32_t iSq, int16_t tWind, uint16_t dt);
@@ -174,24 +174,30 @@
 #define ADDR_FLASH_PAGE_126   ((uint32_t)0x0801F800) /* Base @ of Page 126, 1 Kbytes */
 #define ADDR_FLASH_PAGE_127   ((uint32_t)0x0801FC00) /* Base @ of Page 127, 1 Kbytes */
 
-/* Define the size of the sectors to be used */
-#define PAGE_SIZE               (uint32_t)FLASH_PAGE_SIZE  /* Page size */
+/* The emulation uses two banks of EE_BANK_PAGES flash pages at the top of the 256 KB flash. The region is
+   reserved in STM32F103RCTx_FLASH.ld (NVM memory, symbol _seeprom), so the code cannot grow into it.
+   Keep EE_FLASH_END and EE_BANK_PAGES in line with the linker script */
+#define EE_FLASH_END          ((uint32_t)0x08040000) /* End of the flash + 1 */
+#define EE_BANK_PAGES         2                      /* Flash pages per bank, 2 KB pages on the STM32F103xE */
+
+/* Define the size of the sectors to be used: one bank */
+#define PAGE_SIZE             ((uint32_t)(FLASH_PAGE_SIZE * EE_BANK_PAGES))  /* Bank size */
 
 /* EEPROM start address in Flash */
-#define EEPROM_START_ADDRESS  ((uint32_t)ADDR_FLASH_PAGE_64) /* EEPROM emulation start address */
+#define EEPROM_START_ADDRESS  ((uint32_t)(EE_FLASH_END - 2 * PAGE_SIZE))     /* EEPROM emulation start address */
 
 /* Pages 0 and 1 base and end addresses */
 #define PAGE0_BASE_ADDRESS    ((uint32_t)(EEPROM_START_ADDRESS + 0x0000))
 #define PAGE0_END_ADDRESS     ((uint32_t)(EEPROM_START_ADDRESS + (PAGE_SIZE - 1)))
-#define PAGE0_ID               ADDR_FLASH_PAGE_64
+#define PAGE0_ID               PAGE0_BASE_ADDRESS
 
-#define PAGE1_BASE_ADDRESS    ((uint32_t)(EEPROM_START_ADDRESS + 0x10000))
-#define PAGE1_END_ADDRESS     ((uint32_t)(EEPROM_START_ADDRESS + 0x10000 + PAGE_SIZE - 1))
-#define PAGE1_ID               ADDR_FLASH_PAGE_96
+#define PAGE1_BASE_ADDRESS    ((uint32_t)(EEPROM_START_ADDRESS + PAGE_SIZE))
+#define PAGE1_END_ADDRESS     ((uint32_t)(EEPROM_START_ADDRESS + PAGE_SIZE + PAGE_SIZE - 1))
+#define PAGE1_ID               PAGE1_BASE_ADDRESS
 
-/* Used Flash pages for EEPROM emulation */
+/* Used Flash pages for EEPROM emulation: bank index, the bank address is EEPROM_START_ADDRESS + index * PAGE_SIZE */
 #define PAGE0                 ((uint16_t)0x0000)
-#define PAGE1                 ((uint16_t)0x0040)
+#define PAGE1                 ((uint16_t)0x0001)
 
 /* No valid page define */
 #define NO_VALID_PAGE         ((uint16_t)0x00AB)
@@ -209,7 +215,7 @@
 #define PAGE_FULL             ((uint8_t)0x80)
 
 /* Variables' number */
-#define NB_OF_VAR             ((uint8_t)0x13)       /* 19 Variables */
+#define NB_OF_VAR             ((uint8_t)0xA0)       /* 160 Variables, at most (PAGE_SIZE - 4) / 4 */
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported macro ------------------------------------------------------------*/
@@ -217,6 +223,13 @@
 uint16_t EE_Init(void);
 uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data);
 uint16_t EE_WriteVariable(uint16_t VirtAddress, uint16_t Data);
+uint16_t EE_Commit(void);
+void     EE_Save(void);
+uint16_t EE_ProgramHalfWord(uint32_t Address, uint16_t Data);
+uint16_t EE_ErasePage(uint32_t PageAddress);
+#if defined(FLASH_SAFE_WRITE)
+uint16_t EE_Service(uint8_t Standstill);
+#endif
 
 #endif /* __EEPROM_H */
 
@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+
+// Efficiency estimate, EFF_ESTIMATE. Electrical input power, copper loss and mechanical output power of each motor,
+// averaged over windows of EFF_WINDOW s, and the energy per distance of the board (see eff.c). effStep runs in the
+// monitor task, the results of the last window are read through params[].
+typedef struct {
+  int64_t  eIn[2];                      // [mW*ms] electrical input energy of the running window, left / right
+  int64_t  eCu[2];                      // [mW*ms] copper loss
+  int64_t  eMech[2];                    // [mW*ms] mechanical output, negative while braking
+  uint32_t steps;                       // [hall steps] distance of both wheels in the running window
+  uint16_t time;                        // [ms] length of the running window
+  int16_t  pIn[2];                      // [W] mean electrical input power of the last window, negative while braking
+  int16_t  pCu[2];                      // [W] mean copper loss
+  int16_t  pMech[2];                    // [W] mean mechanical output
+  int16_t  eta[2];                      // [0.1 %] output over input while driving, input over output while braking, 0 else
+  int16_t  whKm;                        // [Wh/km*10] net electrical energy of both motors per distance, 0 without distance
+} Eff;
+
+void effInit(Eff *e);
+void effStep(Eff *e, int16_t vBat, const int16_t iDc[2], const int16_t iq[2], const int16_t id[2], const int16_t n[2],
+             const int32_t r[2], const uint16_t flux[2], uint8_t polePairs, uint16_t steps, uint16_t dt);
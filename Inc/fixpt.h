@@ -0,0 +1,39 @@
+#pragma once
+#include <stdint.h>
+#include "stm32f1xx_hal.h"      // CMSIS __SSAT / __USAT, on the host the portable versions of host/shim
+
+// Saturating fixed-point helpers of the hand written hot paths (filters.c, bldc.c).
+// Q formats of the controller: fixdt(1,16,4) = int16 Q4, fixdt(1,32,16) = int32 Q16, fixdt(0,16,16) = uint16 Q16.
+// A power of two range is a single SSAT / USAT instruction (the bit count must be a constant), a run time bound
+// compiles to compares with conditional moves (IT blocks), both without branches.
+
+#define Q4_ONE          (1 << 4)                // 1.0 in fixdt(1,16,4)
+#define Q16_ONE         (1L << 16)              // 1.0 in fixdt(1,32,16)
+
+/* int32 to int16 / fixdt(1,16,4), saturating */
+static inline int16_t sat16(int32_t x) {
+  return (int16_t)__SSAT(x, 16);
+}
+
+/* int32 to uint16 / fixdt(0,16,16), saturating, negative values give 0 */
+static inline uint16_t usat16(int32_t x) {
+  return (uint16_t)__USAT(x, 16);
+}
+
+/* int64 to int32 / fixdt(1,32,16), saturating: the high word must be the sign extension of the low word */
+static inline int32_t sat32(int64_t x) {
+  int32_t lo = (int32_t)x;
+  return ((int64_t)lo == x) ? lo : (int32_t)((uint32_t)(x >> 63) ^ 0x7FFFFFFFU);
+}
+
+/* x clamped to [-lim, lim], lim >= 0 */
+static inline int32_t clampSym(int32_t x, int32_t lim) {
+  x = (x > lim) ? lim : x;
+  return (x < -lim) ? -lim : x;
+}
+
+/* x clamped to [0, hi], 0 <= hi <= 65535 */
+static inline uint16_t clampU16(int32_t x, int32_t hi) {
+  uint16_t u = usat16(x);
+  return (u > hi) ? (uint16_t)hi : u;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+
+// Gain scheduling, GAIN_SCHED. Scales the current loop and speed loop PI gains of a motor over its speed with the
+// GAIN_SCHED_* tables, the current loop also with the battery voltage (see gainsched.c). gainSchedStep runs in the
+// control task before the staged parameter commit, both controllers take the new gains at one tick.
+enum gainSchedGains {GS_ID_KP, GS_ID_KI, GS_IQ_KP, GS_IQ_KI, GS_N_KP, GS_N_KI, GS_GAINS};
+
+typedef struct {
+  uint16_t base[GS_GAINS];              // [-] gains at 100 %, the rtP values at init or written by others since
+  uint16_t out[GS_GAINS];               // [-] gains written at the last step
+  uint16_t scale[GS_GAINS];             // [%] scales of the last step, the d axis gains follow the q axis table
+} GainSched;
+
+void gainSchedInit(GainSched *g, uint16_t *const gain[GS_GAINS]);
+void gainSchedStep(GainSched *g, uint16_t *const gain[GS_GAINS], int16_t n, int16_t vBat);
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+
+// Hall sensor placement calibration, HALL_CALIB. Turns a motor open loop in both directions, records the field angle
+// at every hall edge and computes the offset of each of the 6 edges to its nominal 60 deg position (see hallcal.c).
+// The result is applied by the controller's angle estimation through P.a_hallCorr.
+#define HALL_CAL_CORR_MAX       1280    // [deg*64] 20 deg, larger corrections mean a wiring or sensor fault
+
+enum hallCalStates {HALL_CAL_IDLE, HALL_CAL_ALIGN, HALL_CAL_FWD, HALL_CAL_REV, HALL_CAL_STOP, HALL_CAL_DONE, HALL_CAL_FAIL};
+
+typedef struct {
+  uint32_t angle;                       // [2^32 per turn] open loop field angle, electrical
+  uint32_t step;                        // [2^32 per turn] field angle change per tick
+  uint32_t ticks;                       // [ticks] time in the current state
+  uint32_t edgeTicks;                   // [ticks] ticks value of the last used hall edge
+  int32_t  sum[2][6];                   // [2^16 per turn] edge angle minus nominal minus ref, forward / reverse, per edge
+  uint16_t cnt[2][6];                   // [-] number of summed edges
+  int16_t  ref;                         // [2^16 per turn] first edge angle minus nominal, keeps the sums small
+  uint16_t edges;                       // [-] number of used edges
+  int16_t  corr[6];                     // [deg*64] result: true minus nominal angle of the edge into position k, mean 0
+  uint8_t  turns;                       // [-] electrical turns per direction
+  uint8_t  skip;                        // [-] edges still to skip while the rotor settles
+  int8_t   pos;                         // [-] controller hall position (vec_hallToPos) of the previous tick
+  int8_t   dir;                         // [-] controller position step for a positive field rotation, 0 = unknown
+  uint8_t  state;                       // [-] hallCalStates
+} HallCal;
+
+void    hallCalStart(HallCal *c, uint8_t hall, uint8_t polePairs);
+uint8_t hallCalStep(HallCal *c, uint8_t hall, int16_t dc[3]);
@@ -0,0 +1,110 @@
+#pragma once
+#include <stdint.h>
+
+// Hall sensor quality statistics, HALL_STATS. The control interrupt updates them at every hall edge (hallStatEdge, from
+// odoStep in bldc.c), "$HALLST" prints them and starts over, the HST_* variables stream them.
+// - invalid: edges into 000 or 111, a sensor or wiring fault. skips: steps over two or three sectors, a missed edge.
+//   reversals: direction changes between two valid edges, bouncing edges count here as well
+// - sector widths and jitter, only at steady speed: HALL_STAT_RUN valid edges in a row in one direction, the electrical
+//   period (the last 6 sectors) within 1/8 of the one a turn before, and at least HALL_STAT_PER_MIN time units, so one
+//   unit is at most 1 deg. The width of a sector is its time over the period, a mean over about 64 turns. The jitter of
+//   an edge is the change of the width of the sector it ends from the turn before, the speed change cancels
+// The sector widths are the hall placement error that $HALLCAL (HALL_CALIB) corrects, the jitter is the noise it cannot.
+#define HALL_STAT_W_NOM         600                 // [deg*10] sector width, electrical
+#define HALL_STAT_PER_MIN       360                 // [time units] shortest electrical period of the widths and jitter
+#define HALL_STAT_PER_MAX       (1UL << 20)         // [time units] longest one, no overflow of the width
+#define HALL_STAT_RUN           13                  // [-] edges in a row for a width with a period of a turn before
+#define HALL_STAT_EMA           6                   // [-] widths and jitter are means over 2^6 of their updates
+#define HALL_STAT_JIT_BINS      6                   // [-] jitter histogram bins, bin k holds jitter below HALL_STAT_JIT_BIN0 << k, the last one the rest
+#define HALL_STAT_JIT_BIN0      5                   // [deg*10]
+
+typedef struct {
+  uint32_t edges;                       // [-] hall edges
+  uint32_t invalid;                     // [-] edges into an invalid state, 000 or 111
+  uint32_t skips;                       // [-] steps over more than one sector
+  uint32_t reversals;                   // [-] direction changes between two valid edges
+  uint32_t steady;                      // [-] edges at steady speed, the ones in the widths and jitter
+  uint32_t jitHist[HALL_STAT_JIT_BINS]; // [-] steady edges per jitter bin
+  int16_t  width[6];                    // [deg*10] mean width of hall position k, electrical
+  uint16_t asym;                        // [deg*10] largest width error over the 6 sectors
+  uint16_t jitAvg;                      // [deg*10] mean edge jitter
+  uint16_t jitMax;                      // [deg*10] largest edge jitter
+  int32_t  wAcc[6];                     // [deg*10 << HALL_STAT_EMA] width filters
+  uint32_t jAcc;                        // [deg*10 << HALL_STAT_EMA] jitter filter
+  uint32_t tick;                        // [time units] time of the last edge
+  uint32_t dur[6];                      // [time units] time of the last pass through hall position k
+  uint32_t per[6];                      // [time units] electrical period at the last edge out of position k
+  int16_t  wLast[6];                    // [deg*10] width of position k at its last steady edge, 0 = none
+  uint8_t  run;                         // [-] valid edges in a row in one direction, up to HALL_STAT_RUN
+  int8_t   dir;                         // [-] direction of the last valid edge, 0 = none yet
+} HallStat;
+
+static inline void hallStatReset(HallStat *s) {
+  s->edges = s->invalid = s->skips = s->reversals = s->steady = 0;
+  for (uint8_t k = 0; k < HALL_STAT_JIT_BINS; k++) {
+    s->jitHist[k] = 0;
+  }
+  for (uint8_t k = 0; k < 6; k++) {
+    s->width[k] = HALL_STAT_W_NOM;
+    s->wAcc[k]  = (int32_t)HALL_STAT_W_NOM << HALL_STAT_EMA;
+    s->wLast[k] = 0;
+  }
+  s->asym = s->jitAvg = s->jitMax = 0;
+  s->jAcc = 0;
+  s->run  = 0;
+  s->dir  = 0;
+}
+
+/* Control interrupt, at a hall edge from hall position prev to cur (hall2pos, 6 = invalid) at time now, dir the
+ * odometry step of it (0 for invalid states and skips). The time units only need to be the same for all edges */
+static inline void hallStatEdge(HallStat *s, uint8_t cur, uint8_t prev, int8_t dir, uint32_t now) {
+  uint32_t d = now - s->tick;
+  s->tick = now;
+  s->edges++;
+  if (cur >= 6 || prev >= 6 || dir == 0) {
+    s->invalid += cur >= 6;
+    s->skips   += cur < 6 && prev < 6;
+    s->run      = 0;                    // the next pass through a sector is not a whole one
+    return;
+  }
+  if (dir != s->dir) {
+    s->reversals += s->dir != 0;
+    s->dir        = dir;
+    s->run        = 0;
+  }
+  s->run       += s->run < HALL_STAT_RUN;
+  s->dur[prev]  = d;                    // a whole pass from the second edge in a row on
+  if (s->run < 7) {
+    return;
+  }
+  uint32_t per  = s->dur[0] + s->dur[1] + s->dur[2] + s->dur[3] + s->dur[4] + s->dur[5];
+  uint32_t last = s->per[prev];
+  uint32_t dPer = per > last ? per - last : last - per;
+  s->per[prev]  = per;
+  if (s->run < HALL_STAT_RUN || dPer > per >> 3 || per < HALL_STAT_PER_MIN || per > HALL_STAT_PER_MAX) {
+    s->wLast[prev] = 0;
+    return;
+  }
+  int16_t w = (int16_t)(d * (6 * HALL_STAT_W_NOM) / per);
+  s->steady++;
+  s->wAcc[prev]  += w - (s->wAcc[prev] >> HALL_STAT_EMA);
+  s->width[prev]  = (int16_t)(s->wAcc[prev] >> HALL_STAT_EMA);
+  uint16_t asym = 0;
+  for (uint8_t k = 0; k < 6; k++) {
+    uint16_t e = (uint16_t)(s->width[k] > HALL_STAT_W_NOM ? s->width[k] - HALL_STAT_W_NOM : HALL_STAT_W_NOM - s->width[k]);
+    asym = e > asym ? e : asym;
+  }
+  s->asym = asym;
+  if (s->wLast[prev]) {
+    uint16_t j = (uint16_t)(w > s->wLast[prev] ? w - s->wLast[prev] : s->wLast[prev] - w);
+    uint8_t  b = 0;
+    while (b < HALL_STAT_JIT_BINS - 1 && j >= (HALL_STAT_JIT_BIN0 << b)) {
+      b++;
+    }
+    s->jitHist[b]++;
+    s->jAcc   += j - (s->jAcc >> HALL_STAT_EMA);
+    s->jitAvg  = (uint16_t)(s->jAcc >> HALL_STAT_EMA);
+    s->jitMax  = j > s->jitMax ? j : s->jitMax;
+  }
+  s->wLast[prev] = w;
+}
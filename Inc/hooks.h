@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+
+// Control interrupt hooks, CTRL_HOOKS. The hooks of hooks.def run per motor before and after the controller step
+// with the values of the step in a CtrlHookIo. Each run is timed with the cycle counter, a run over the budget of
+// the hook switches it off (see hooks.c). Statistics and the restart through "$HOOKS".
+enum ctrlHookStages {CTRL_HOOK_PRE, CTRL_HOOK_POST};
+#define CTRL_HOOK_LEFT          1       // [-] motors of a hook
+#define CTRL_HOOK_RIGHT         2
+#define CTRL_HOOK_BOTH          3
+
+typedef struct {
+  uint8_t  motor;                       // [-] 0 = left, 1 = right
+  uint8_t  hall;                        // [-] hall state, bit 0 = A
+  uint8_t  err;                         // [-] z_errCode of the last step (pre), of this step (post)
+  uint8_t  ctrlMod;                     // [-] pre: z_ctrlModReq of the step, may be changed
+  int16_t  iA, iB, iC, iDC;             // [ADC bits] phase and DC link currents of this tick
+  int16_t  n;                           // [rpm] n_mot of the last step (pre), of this step (post)
+  int16_t  iq, id;                      // [-] iq, id of the controller, as n
+  int16_t  angle;                       // [-] a_elecAngle, as n
+  int16_t  inpTgt;                      // [-] pre: r_inpTgt of the step, may be changed
+  int16_t  iMax;                        // [-] pre: current limit of the step in the scale of rtP.i_max, may only be lowered
+  int      u, v, w;                     // [-] post: phase duties, may be changed
+} CtrlHookIo;
+
+typedef void (*CtrlHookFn)(CtrlHookIo *io);
+
+typedef struct {
+  CtrlHookFn  fn;
+  uint16_t    budget;                   // [cycles] longest allowed run, CTRL_HOOK_BUDGET for a 0 in hooks.def
+  uint8_t     stage;                    // [-] ctrlHookStages
+  uint8_t     motors;                   // [-] CTRL_HOOK_LEFT / _RIGHT / _BOTH
+  const char *name;
+} CtrlHookDef;
+
+typedef struct {
+  uint16_t last;                        // [cycles] last run
+  uint16_t max;                         // [cycles] longest run since the restart
+  uint32_t runs;                        // [-] runs since the restart
+  uint16_t over;                        // [cycles] the run that switched the hook off, 0 = on
+} CtrlHookStat;
+
+#define HOOK(stage, motors, fn, budget, name) void fn(CtrlHookIo *io);
+#include "hooks.def"
+#define HOOK(stage, motors, fn, budget, name) CTRL_HOOK_ID_##fn,
+enum ctrlHookIds {
+#include "hooks.def"
+  CTRL_HOOK_COUNT
+};
+
+extern const CtrlHookDef ctrlHookDefs[CTRL_HOOK_COUNT + 1];
+extern CtrlHookStat      ctrlHookStats[CTRL_HOOK_COUNT + 1];
+extern volatile uint8_t  ctrlHookRst;   // set by the main loop, the control interrupt then restarts the hooks
+
+/* Control interrupt, after a run of a hook that took cycles. A run over the budget switches the hook off */
+static inline void ctrlHookDone(CtrlHookStat *s, uint16_t budget, uint32_t cycles) {
+  s->last = (uint16_t)(cycles < UINT16_MAX ? cycles : UINT16_MAX);
+  s->runs++;
+  if (s->last > s->max) {
+    s->max = s->last;
+  }
+  if (s->last > budget) {
+    s->over = s->last;
+  }
+}
+
+void ctrlHookReset(void);
@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+
+// Input to PWM latency measurement, LATENCY_MEAS. An input change is tagged with the time of its sample, the tag
+// follows the command through the main loop until pwml / pwmr change, the control interrupt stamps the tick that
+// writes the duties from them (see latency.c). Percentiles per input index, read through params[] and "$LAT".
+#define LAT_SRCS                2       // [-] input indexes, primary and auxiliary (DUAL_INPUTS)
+#define LAT_BINS                48      // [-] histogram bins, 4 per octave from 64 us, the last one up to 131 ms and above
+
+enum latStates {LAT_IDLE, LAT_INPUT, LAT_OUTPUT, LAT_APPLIED};
+
+typedef struct {
+  uint16_t hist[LAT_BINS];              // [-] samples per latencyBin, halved when one saturates
+  uint32_t n;                           // [-] samples since the last reset
+  uint16_t drop;                        // [-] tags that did not reach the duties within LATENCY_TIMEOUT
+  uint16_t p50, p90, p99;               // [us] percentiles, upper edge of the bin
+  uint16_t max;                         // [us] largest sample, saturated
+} LatStat;
+
+typedef struct {
+  volatile uint8_t state;               // [-] latStates, LAT_OUTPUT -> LAT_APPLIED in the control interrupt
+  uint8_t  src;                         // [-] input index of the tag
+  uint8_t  steady;                      // [-] the outputs did not change in the last main loop step
+  uint32_t tagUs;                       // [us] sample time of the tagged input change
+  volatile uint32_t applyUs;            // [us] control tick that took over the outputs of the tag
+  int16_t  ref[2];                      // [-] input values at the last tag
+  int16_t  cmd[2];                      // [-] commands of the selected input in the last main loop step
+  int16_t  out[2];                      // [-] pwml, pwmr of the last main loop step
+  uint8_t  cmdMoved;                    // [-] the tagged change moved the command
+  LatStat  stat[LAT_SRCS];
+} LatMeas;
+
+/* Control interrupt, after both duties are written */
+static inline void latApplied(LatMeas *l, uint32_t now) {
+  l->applyUs = now;
+  l->state   = LAT_APPLIED;
+}
+
+void latReset(LatMeas *l);
+void latInput(LatMeas *l, uint8_t src, int16_t in1, int16_t in2, uint32_t sampleUs, uint32_t now);
+void latOutput(LatMeas *l, int16_t cmd1, int16_t cmd2, int16_t pwmL, int16_t pwmR);
+uint32_t latBinLow(uint8_t bin);
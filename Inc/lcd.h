@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+#include "config.h"
+
+// Character LCD layer on top of the hd44780/pcf8574 driver.
+// With LCD_ASYNC the calls only write a RAM shadow of the display and lcdTask() pushes the
+// changed cells by I2C DMA. Without it they are forwarded to the blocking driver.
+#if defined(DEBUG_I2C_LCD) || defined(SUPPORT_LCD)
+#define LCD_COLS                16    // [-] characters per row
+#define LCD_ROWS                2     // [-] rows
+
+void lcdInit(void);
+void lcdClear(void);
+void lcdSetLocation(uint8_t x, uint8_t y);
+void lcdWriteString(const char *s);
+void lcdWriteFixed(int32_t value, uint8_t digits);
+void lcdTask(void);
+void lcdFlush(void);
+#endif
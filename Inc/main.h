@@ -5,6 +5,9 @@
 extern uint8_t backwardDrive;
 extern int16_t batVoltageCalib;
 extern int16_t board_temp_deg_c;
+#if defined(ADC_TEMP_DECIM)
+extern int16_t adcVdda;
+#endif
 extern int16_t left_dc_curr;
 extern int16_t right_dc_curr;
 extern int16_t dc_curr;
@@ -12,3 +15,20 @@ extern int16_t cmdL;
 extern int16_t cmdR; 
 
 extern volatile uint32_t main_loop_counter;
+
+#ifdef MULTI_MODE_DRIVE
+#include "util.h"
+extern DriveProfile driveProfiles[DRIVE_PROFILES];
+extern uint8_t driveProfile;            // active drive profile
+extern uint8_t driveProfileReq;         // requested drive profile, taken over at standstill
+void driveProfileChanged(void);
+#endif
+#if defined(BALANCE_CONTROL)
+#include "balance.h"
+extern Balance balance_L;               // left half, left sideboard
+extern Balance balance_R;               // right half, right sideboard
+#endif
+#if defined(EFF_ESTIMATE)
+#include "eff.h"
+extern Eff eff;                         // efficiency estimate, effStep in the monitor task
+#endif
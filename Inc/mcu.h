@@ -0,0 +1,23 @@
+#pragma once
+#include "stm32f1xx_hal.h"
+#include "config.h"
+
+// Mainboard MCU, the MCU_ options of config.h. The GD32F103 and AT32F403 have the STM32F103 peripherals this firmware
+// uses at the same addresses with the same registers: TIM1 / TIM8 PWM with the TRGO chain, ADC1 / ADC2 dual mode with
+// DMA1, USART2 / USART3 with DMA, the flash controller with 2 kB pages of the EEPROM emulation. setup.c, bldc.c,
+// eeprom.c and the HAL drivers run unchanged on them, as do the startup code and the linker script of the STM32F103RC.
+// The clock tree is where they differ: PLL multipliers above x16 in extra CFGR bits, bus and ADC clock limits, the
+// AT32 clock step up. These are here, SystemClock_Config (main.c) sets them by register on those parts, the HAL clock
+// functions do not know the extra bits. All run from the HSI / 2 = 4 MHz PLL input, as the STM32F103 default.
+#if defined(MCU_AT32F403)
+  #define MCU_CFGR_PLL          ((1UL << 31) | (3UL << 29) | (11UL << 18))  // PLLRANGE above 72 MHz, PLLMULT 59 = x60: 240 MHz
+  #define MCU_CFGR_PPRE2        RCC_CFGR_PPRE2_DIV2   // APB2 120 MHz maximum, TIM1 / TIM8 run at twice that
+  #define MCU_CFGR_ADCPRE       RCC_CFGR_ADCPRE_DIV6  // 20 MHz, ADC_CLOCK_DIV
+  #define MCU_RCC_MISC2         (*(__IO uint32_t *)(RCC_BASE + 0x54U))
+  #define MCU_MISC2_AUTO_STEP   (3UL << 4)            // AHB clock raised in steps on a switch above 108 MHz
+#elif defined(MCU_GD32F103)
+  #define MCU_CFGR_PLL          ((1UL << 27) | (10UL << 18))  // PLLMF 26 = x27: 108 MHz
+  #define MCU_CFGR_PPRE2        RCC_CFGR_PPRE2_DIV1   // APB2 108 MHz
+  #define MCU_CFGR_ADCPRE       RCC_CFGR_ADCPRE_DIV8  // 13.5 MHz, ADC_CLOCK_DIV
+  #define MCU_FLASH_LATENCY     FLASH_ACR_LATENCY_1   // 2 wait states, the first 256 kB run without any
+#endif
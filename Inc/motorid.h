@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+
+// Motor constant identification, MOTOR_IDENT. A DC current along phase A measures the phase resistance, a square wave
+// voltage on top of it the inductance, then the motor turns in VLT_MODE and the back-EMF gives the rotor flux linkage
+// (see motorid.c). The results are the star equivalent values of OBS_R, OBS_L and OBS_FLUX.
+#define MOT_ID_HF_TICKS         20      // [ticks] square wave period of the inductance measurement, 18 deg per tick
+
+enum motIdStates {MOT_ID_IDLE, MOT_ID_ALIGN, MOT_ID_RES_LO, MOT_ID_RES_HI, MOT_ID_IND_RAMP, MOT_ID_IND, MOT_ID_STOP,
+                  MOT_ID_SPIN, MOT_ID_FLUX, MOT_ID_COAST, MOT_ID_DONE, MOT_ID_FAIL};
+
+typedef struct {
+  int64_t  sv[2];                       // [dc * V*100 * 3] phase A voltage sums at the low and the high test current
+  int64_t  si[2];                       // [ADC bits] phase A current sums at the low and the high test current
+  int64_t  hv[2];                       // [dc * V*100 * 3, Q14] square wave fundamental of the phase A voltage, cos / sin
+  int64_t  hi[2];                       // [ADC bits, Q14] same for the phase A current
+  int64_t  fv[2];                       // [dc * V*100 * 3, Q14] voltage d / q sums while the motor turns
+  int64_t  fi[2];                       // [ADC bits, Q14] current d / q sums while the motor turns
+  int32_t  vPrev[2];                    // [dc * V*100 * 3] alpha / beta voltage of the previous tick
+  int32_t  angleSum;                    // [deg] controller angle advance
+  int32_t  rot;                         // [-] sum of the voltage vector rotation directions
+  int32_t  acc;                         // [dc, Q8] phase A current regulator
+  uint32_t ticks;                       // [ticks] time in the current state
+  int16_t  amp;                         // [dc] DC voltage along phase A, rtY.DC_pha* range
+  int16_t  hf;                          // [dc] square wave amplitude on top of amp
+  int16_t  iTgt;                        // [ADC bits] phase A current target
+  int16_t  iMin, iMax;                  // [ADC bits] phase A current range of the running square wave period
+  int16_t  vlt;                         // [-] VLT_MODE input target while the motor turns
+  int16_t  anglePrev;                   // [deg] controller angle of the previous tick
+  int8_t   sign;                        // [-] controller angle direction relative to the voltage vector rotation
+  uint8_t  state;                       // [-] motIdStates
+  uint8_t  failState;                   // [-] motIdStates of the step that failed
+  uint16_t r;                           // [mOhm] result: phase resistance
+  uint16_t l;                           // [uH] result: phase inductance
+  uint16_t flux;                        // [uV s] result: rotor flux linkage per phase, peak
+} MotId;
+
+void    motIdStart(MotId *c);
+void    motIdInput(const MotId *c, uint8_t *mode, int16_t *inpTgt);
+uint8_t motIdStep(MotId *c, const int16_t i[3], int16_t vbat, int16_t angle, int16_t n, int16_t dc[3]);
+uint8_t motIdResult(MotId *c);
+void    motIdGains(const MotId *c, int16_t vbat, uint16_t bw, uint16_t *kp, uint16_t *ki);
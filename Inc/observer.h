@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+
+// Rotor flux observer, ANGLE_OBSERVER. Estimates the electrical angle from the measured phase currents and
+// the applied duty cycles (voltage model flux observer, see observer.c). Above OBS_SPD_HI it replaces the hall
+// angle estimate of the controller through a_mechAngle / b_angleMeasEna, below OBS_SPD_LO the hall angle is used.
+typedef struct {
+  int32_t  x[2];                        // [Q24 of OBS_FLUX] stator flux alpha, beta: integral of v - R i
+  int32_t  mag;                         // [Q24] squared rotor flux magnitude, about 0.94 with exact motor constants
+  int32_t  speed;                       // [2^16 per turn per tick, Q8] filtered electrical speed of the observer angle
+  int32_t  hallSpeed;                   // [2^16 per turn per tick, Q8] same for the hall angle of the controller
+  int32_t  offset;                      // [2^16 per turn, Q8] learned hall angle minus observer angle
+  uint16_t angle;                       // [2^16 per turn] rotor flux angle
+  uint16_t anglePrev;                   // [2^16 per turn] observer angle of the previous tick
+  uint16_t hallPrev;                    // [2^16 per turn] hall angle of the previous tick
+  int16_t  bump;                        // [2^16 per turn] remaining angle step of the hall to observer hand over
+  uint16_t learn;                       // [ticks] offset learning ticks, saturated
+  uint8_t  active;                      // [-] 1 = the observer angle is fed to the controller
+} Observer;
+
+void    obsInit(Observer *o);
+void    obsReset(Observer *o);
+void    obsStep(Observer *o, const int16_t i[3], const uint16_t ccr[3], int16_t vdc);
+uint8_t obsAngle(Observer *o, int16_t elecAngle, int16_t n_mot, uint16_t *angle);
@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+
+// Position loop of POS_MODE, POS_CTRL. Every POS_CTRL_DIV ticks it turns the hall step position error into a SPD_MODE
+// speed target with the POS_SPD_MAX and POS_ACC limits (see posctrl.c), the controller's speed loop follows it.
+
+typedef struct {
+  int32_t  v;                           // [rpm, fixdt(1,32,16)] speed target, acceleration limited
+} PosCtrl;
+
+void    posCtrlReset(PosCtrl *c, int16_t n);
+int16_t posCtrlStep(PosCtrl *c, int32_t tgt, int32_t pos, int16_t nMax, uint8_t polePairs);
@@ -0,0 +1,15 @@
+#pragma once
+#include <stdio.h>                      // before the printf macro below, so the C library prototype keeps its name
+#include <stdarg.h>
+#include <stdint.h>
+
+// Minimal formatter for the debug serial output (see print.c), replacing the newlib printf.
+// Supported: %d %i %u %c %s %%, the flags '-' and '0', a width and the 'l' length modifier.
+// Differs from C: a precision on %d %i %u prints the integer as fixed-point with that many decimals,
+// e.g. debugPrintf("%.2i", 1234) gives "12.34" and ("%.2i", -5) gives "-0.05". Other conversions are copied as is.
+#define PRINT_CHUNK             48      // [bytes] stack buffer of debugPrintf, handed to debugTxWrite when full
+
+int debugPrintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+int printFormat(char *buf, int size, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+#define printf debugPrintf              // all firmware text output, include this header last
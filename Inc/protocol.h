@@ -0,0 +1,266 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Serial command / feedback wire format, shared by the firmware and External_Controllers.
+// Little-endian, packed. The checksum is calc_crc32 (CRC32C) over all bytes before checksumL,
+// or the STM32 CRC unit for frames starting with PROTO_START_FRAME_HWCRC (see SERIAL_HW_CRC).
+// Bump PROTO_VERSION on any layout change: frames of another version are dropped and counted.
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+#define PROTO_START_FRAME       0x7A7A  // [-] start of frame, software CRC32C
+#define PROTO_START_FRAME_HWCRC 0x7B7B  // [-] start of frame, STM32 hardware CRC
+#define PROTO_VERSION           10      // [-] wire format version
+
+// Capability flags (caps field)
+#define PROTO_CAP_HW_CRC        0x01    // sender understands PROTO_START_FRAME_HWCRC frames
+#define PROTO_CAP_ISR_PROF      0x02    // feedback: isrCycMean/isrCycMax are valid
+#define PROTO_CAP_LED           0x04    // feedback: cmdLed carries the sideboard LED state
+#define PROTO_CAP_BAUD          0x08    // feedback: the PROTO_CMD_BAUD frame cmdSeq was accepted, the board switches after this frame
+#define PROTO_CAP_BAT_SOC       0x20    // feedback: batSoc is the estimated state of charge
+#define PROTO_BAT_SOC_NONE      0xFFFF  // [-] batSoc without the state of charge estimation
+#define PROTO_CAP_REGEN         0x40    // feedback: regenWh is the energy recovered by braking
+#define PROTO_CAP_FAULT         0x80    // feedback: a motor reports an error (z_errCode), the board has switched both motors off
+
+// Command flags (caps field of ProtoCommand), for controllers driving several boards.
+// A HOLD frame is stored but not applied. A LATCH frame applies the last held steer/speed and
+// its own steer/speed are ignored. Sending HOLD to every board, then LATCH to every board right
+// after, makes all boards switch to the new targets within one control tick of each other.
+#define PROTO_CMD_HOLD          0x10    // command: keep steer/speed until the next LATCH frame
+#define PROTO_CMD_LATCH         0x20    // command: apply the held steer/speed now
+#define PROTO_CMD_ECHO          0x40    // command: fbEcho is valid, the board measures the round trip from it
+
+// Position command (POS_CTRL). steer and speed are the left and right position targets in hall steps, the low 16 bits
+// of the target in the odo0 / odo1 frame of the feedback. The board takes the target nearest to the present position,
+// so a move must be shorter than 32767 steps. Works with HOLD / LATCH, a normal frame goes back to CTRL_MOD.
+#define PROTO_CMD_POS           0x08    // command: steer / speed are position targets, POS_MODE
+
+// Compact feedback (FEEDBACK_COMPACT). A controller that sets PROTO_CMD_FB_COMPACT in its commands gets
+// ProtoFeedbackCompact frames on that port instead of ProtoFeedback: the fast fields in every frame, then the slow
+// fields of the fields bitmap, 2 bytes each in bit order, then checksumL / checksumH over all bytes before them.
+// A slow field is sent when it changed and one more field round robin per frame, so all are refreshed every
+// PROTO_FB_SLOW_N frames. The receiver keeps the last value of the others.
+#define PROTO_START_FRAME_COMPACT       0x7E7E  // [-] start of a compact feedback frame, software CRC32C
+#define PROTO_START_FRAME_COMPACT_HWCRC 0x7F7F  // [-] start of a compact feedback frame, STM32 hardware CRC
+#define PROTO_CMD_FB_COMPACT    0x04    // command: answer with compact feedback frames
+#define PROTO_FB_BAT_VOLTAGE    0x01    // fields: slow ProtoFeedback fields, in the order they follow the fast part
+#define PROTO_FB_BOARD_TEMP     0x02
+#define PROTO_FB_BAT_SOC        0x04
+#define PROTO_FB_REGEN_WH       0x08
+#define PROTO_FB_ISR_CYC_MEAN   0x10
+#define PROTO_FB_ISR_CYC_MAX    0x20
+#define PROTO_FB_CMD_LED        0x40
+#define PROTO_FB_CPU_LOAD       0x80
+#define PROTO_FB_SLOW_N         8       // [-] number of slow fields
+
+// Baud rate negotiation (SERIAL_BAUD_NEGOTIATION). Both sides start at the configured rate. The controller sends a
+// PROTO_CMD_BAUD frame with the rate / 100 in speed (steer ignored, no target change), the board answers with
+// PROTO_CAP_BAUD and cmdSeq = seq of that frame, then both switch. The board goes back to the configured rate
+// when no valid frame arrives for SERIAL_BAUD_FALLBACK ms, the controller should do the same for the feedback.
+#define PROTO_CMD_BAUD          0x80    // command: switch to the baud rate (uint16_t)speed * 100
+
+// Trip statistics (TRIP_STATS). A command with PROTO_CMD_TRIP (steer / speed are applied as usual) gets one ProtoTrip frame
+// with the lifetime totals of the board instead of the next feedback frame on that port. Not used on the bus.
+#define PROTO_START_FRAME_TRIP  0x7676  // [-] start of a trip frame, software CRC32C
+#define PROTO_CMD_TRIP          0x02    // command: answer with one ProtoTrip frame
+
+// Multi-drop bus (SERIAL_BUS). One controller UART drives up to PROTO_BUS_MAX boards: the controller TX goes to the RX
+// of every board, the TX of every board to the controller RX (pull-up on that line). A board drives its TX pin only
+// while it answers, otherwise the pin is an input. Per cycle the controller sends one ProtoBusCommand with the targets
+// of all boards, indexed by the board id (BUS_ID), so all boards apply their targets from the same frame. The poll
+// board alone answers, with a ProtoFeedback whose cmdSeq is the seq of that frame, right after the frame. Polling the
+// boards round robin, one per cycle, with a cycle longer than the command plus the feedback frame, keeps the answers apart.
+// caps apply to every board, except PROTO_CMD_ECHO: fbEcho is the fbTime of the board polled in the previous frame,
+// only that board takes it. PROTO_CMD_POS / FB_COMPACT / BAUD are not used on the bus.
+#define PROTO_START_FRAME_BUS   0x7878  // [-] start of a bus command frame, software CRC32C
+#define PROTO_BUS_MAX           6       // [-] board ids 0..PROTO_BUS_MAX-1
+#define PROTO_BUS_NO_POLL       0xFF    // [-] poll: no board answers
+
+// Extended command (SERIAL_EXT_CMD). A ProtoCommandExt starts like a ProtoCommand, same fields and caps, and adds the
+// control mode, per wheel targets and limit overrides, so one frame per cycle replaces the "$SET" round trips of the
+// debug protocol. ext has the PROTO_EXT_* of the valid extra fields, the others keep their present value. The mode and
+// limits of a frame reach both controllers in the same control tick (with SERIAL_FAST_CMD also its targets), they stay
+// until changed, like a "$SET" without "$SAVE". Out of range values are clamped to the ranges of the parameters.
+// A HOLD frame keeps its extra fields for the LATCH. A ProtoCommand frame goes back to the mixed steer / speed.
+#define PROTO_START_FRAME_EXT   0x7979  // [-] start of an extended command frame, software CRC32C
+#define PROTO_EXT_WHEEL         0x01    // ext: steer / speed are the left / right wheel targets, no mixing
+#define PROTO_EXT_MODE          0x02    // ext: ctrlMod is the control mode, 1 = VLT, 2 = SPD, 3 = TRQ (CTRL_MOD)
+#define PROTO_EXT_I_MAX         0x04    // ext: iMax is the phase current limit (I_MOT_MAX)
+#define PROTO_EXT_N_MAX         0x08    // ext: nMax is the speed limit (N_MOT_MAX)
+#define PROTO_EXT_FIELD_WEAK    0x10    // ext: fieldWeakEna and fieldWeakMax are the field weakening (FI_WEAK_ENA, FI_WEAK_MAX)
+
+// Sideboard frame v2 (sideboard to board). v1 sideboards send the 14 byte PROTO_START_FRAME frame with a 16-bit XOR
+// checksum, the board tells both apart by the start frame. The checksum is calc_crc32 over all bytes before checksumL,
+// or the STM32 CRC unit when caps has PROTO_SB_CAP_HW_CRC. seq counts up by one per frame, gaps are lost frames.
+// High rate mode: the board asks with PROTO_CAP_SB_FAST in the feedback frames, a sideboard with PROTO_SB_CAP_FAST
+// then sends every PROTO_SB_FAST_PERIOD ms (back to back if the baud rate is too low for it) and sets PROTO_SB_CAP_FAST_ON.
+// It goes back to its normal rate when no feedback with PROTO_CAP_SB_FAST arrived for PROTO_SB_FAST_HOLD ms.
+#define PROTO_SB_START_FRAME    0x7575  // [-] start of a v2 sideboard frame
+#define PROTO_SB_VERSION        2       // [-] sideboard frame version
+#define PROTO_SB_CAP_HW_CRC     0x01    // sideboard: the checksum is the STM32 hardware CRC
+#define PROTO_SB_CAP_FAST       0x02    // sideboard: supports the high rate mode
+#define PROTO_SB_CAP_FAST_ON    0x04    // sideboard: this frame was sent in the high rate mode
+#define PROTO_SB_FAST_PERIOD    1       // [ms] frame period of the high rate mode
+#define PROTO_SB_FAST_HOLD      1000    // [ms] high rate mode timeout
+#define PROTO_CAP_SB_FAST       0x10    // feedback: ask the sideboard for the high rate mode
+
+// Clock synchronisation (TIME_SYNC). The controller puts its microsecond clock at the start bit of a command frame in
+// syncTime, 0 for none. The board takes the frame end from its own clock, less the frame and one IDLE character at the
+// port baud rate, as the same instant, and follows the controller clock from these references (offset and drift).
+// Its feedback then carries syncTime, the fbTime instant in the controller clock, so the frames of all boards of a
+// controller share one timebase. A controller driving boards on several ports sends the same clock on all of them.
+// syncTime of the feedback stays 0 until the first reference, and for about a second after it the error is larger.
+
+// COBS framing (SERIAL_COBS). The port sends the frames below without start frame and checksum: type, the low byte of
+// the start frame (PROTO_START_FRAME for ProtoCommand and ProtoFeedback, _EXT, _COMPACT, _TRIP), then the bytes from
+// version up to checksumL, then the CRC-16/CCITT-FALSE of type and bytes (poly 0x1021, init 0xFFFF, little-endian),
+// all COBS encoded (consistent overhead byte stuffing) and ended by a PROTO_COBS_DELIM byte. The encoding has no
+// other 0x00, so a receiver takes the next frame from the next delimiter wherever it started listening, and a frame
+// is one byte shorter than with start frame and CRC32. Several delimiters in a row are allowed. A port uses one
+// framing, the start frame frames are not taken on a COBS port. The hardware CRC and the bus are not used with it.
+#define PROTO_COBS_DELIM        0x00    // [-] end of a COBS frame
+
+typedef struct __attribute__((packed)) {
+  uint16_t  start;
+  uint8_t   version;
+  uint8_t   caps;
+  int16_t   steer;
+  int16_t   speed;
+  uint16_t  seq;                        // [-] controller sequence number, echoed in ProtoFeedback.cmdSeq
+  uint16_t  fbEcho;                     // [us] fbTime of the last feedback frame the controller received, with PROTO_CMD_ECHO
+  uint32_t  syncTime;                   // [us] controller clock at the start bit of this frame, 0 for none
+  uint16_t  checksumL;
+  uint16_t  checksumH;
+} ProtoCommand;
+
+typedef struct __attribute__((packed)) {
+  uint16_t  start;                      // PROTO_START_FRAME_EXT
+  uint8_t   version;
+  uint8_t   caps;                       // PROTO_CMD_* as in ProtoCommand
+  int16_t   steer;                      // left wheel target with PROTO_EXT_WHEEL
+  int16_t   speed;                      // right wheel target with PROTO_EXT_WHEEL
+  uint16_t  seq;
+  uint16_t  fbEcho;
+  uint32_t  syncTime;
+  uint8_t   ext;                        // PROTO_EXT_* of the valid fields below
+  uint8_t   ctrlMod;                    // [-] control mode, 1 = VLT, 2 = SPD, 3 = TRQ
+  uint16_t  iMax;                       // [A*100] phase current limit, 1 to 40 A
+  uint16_t  nMax;                       // [rpm] speed limit, 10 to 2000 rpm
+  uint8_t   fieldWeakEna;               // [-] 0 = off, 1 = linear, 2 = map (FOC)
+  uint8_t   reserved;                   // 0
+  uint16_t  fieldWeakMax;               // [A*100] field weakening current, 0 to 20 A
+  uint16_t  checksumL;
+  uint16_t  checksumH;
+} ProtoCommandExt;
+
+typedef struct __attribute__((packed)) {
+  uint16_t  start;                      // PROTO_START_FRAME_BUS
+  uint8_t   version;
+  uint8_t   caps;
+  uint8_t   poll;                       // [-] id of the board that answers, PROTO_BUS_NO_POLL for none
+  uint8_t   reserved;                   // 0
+  uint16_t  seq;                        // [-] controller sequence number, echoed in the poll board's cmdSeq
+  uint16_t  fbEcho;                     // [us] fbTime of the feedback to the previous frame, with PROTO_CMD_ECHO
+  uint32_t  syncTime;                   // [us] controller clock at the start bit of this frame, 0 for none
+  struct __attribute__((packed)) {
+    int16_t steer;
+    int16_t speed;
+  } target[PROTO_BUS_MAX];              // by board id, zero for ids without a board
+  uint16_t  checksumL;
+  uint16_t  checksumH;
+} ProtoBusCommand;
+
+typedef struct __attribute__((packed)) {
+  uint16_t  start;                      // PROTO_SB_START_FRAME
+  uint8_t   version;                    // PROTO_SB_VERSION
+  uint8_t   caps;                       // PROTO_SB_CAP_*
+  uint16_t  seq;                        // [-] frame counter
+  int16_t   pitch;                      // Angle
+  int16_t   dPitch;                     // Angle derivative
+  int16_t   cmd1;                       // RC Channel 1
+  int16_t   cmd2;                       // RC Channel 2
+  uint16_t  sensors;                    // RC Switches and Optical sideboard sensors
+  uint16_t  checksumL;
+  uint16_t  checksumH;
+} ProtoSideboard;
+
+typedef struct __attribute__((packed)) {
+  uint16_t  start;
+  uint8_t   version;
+  uint8_t   caps;
+  int16_t   odo0;                       // [hall steps] left motor position, low 16 bits. Accumulate (int16_t)(odo0 - previous odo0), wraps cancel out
+  int16_t   odo1;                       // [hall steps] right motor position, same sign as speedR_meas
+  uint16_t  odoTime;                    // [ticks] board tick of this frame, low 16 bits, PWM_FREQ ticks per second (16 kHz by default)
+  uint16_t  edgeAge0;                   // [ticks] odoTime minus the left motor's last hall edge, saturated at 0xFFFF
+  uint16_t  edgeAge1;                   // [ticks] same for the right motor. Velocity = delta odo / delta (odoTime - edgeAge)
+  int16_t   speedR_meas;                // [rpm]
+  int16_t   speedL_meas;                // [rpm]
+  int16_t   batVoltage;                 // [V*100]
+  int16_t   boardTemp;                  // [degC*10]
+  uint16_t  batSoc;                     // [0.1 %] battery state of charge, PROTO_BAT_SOC_NONE if not estimated
+  uint16_t  regenWh;                    // [0.01 Wh] energy recovered by braking since power on, saturated
+  uint16_t  isrCycMean;                 // [cycles] control interrupt mean runtime
+  uint16_t  isrCycMax;                  // [cycles] control interrupt max runtime
+  uint16_t  cpuLoad;                    // [0.1 %] main loop time outside WFI during the last second
+  uint16_t  cmdSeq;                     // [-] seq of the last valid command on this port
+  uint16_t  cmdAge;                     // [ms] time since that command was received. Controller round trip = now - send time of cmdSeq - cmdAge
+  uint16_t  fbTime;                     // [us] board time when this frame was sent, low 16 bits. Board round trip = command arrival - fbEcho
+  uint32_t  syncTime;                   // [us] fbTime in the controller clock, 0 without a reference (TIME_SYNC)
+  uint16_t  cmdLed;
+  uint16_t  checksumL;
+  uint16_t  checksumH;
+} ProtoFeedback;
+
+typedef struct __attribute__((packed)) {
+  uint16_t  start;                      // PROTO_START_FRAME_COMPACT or PROTO_START_FRAME_COMPACT_HWCRC
+  uint8_t   version;
+  uint8_t   caps;
+  uint8_t   fields;                     // PROTO_FB_* slow fields following this header
+  int16_t   odo0;                       // fast fields, as in ProtoFeedback
+  int16_t   odo1;
+  uint16_t  odoTime;
+  uint16_t  edgeAge0;
+  uint16_t  edgeAge1;
+  int16_t   speedR_meas;
+  int16_t   speedL_meas;
+  uint16_t  cmdSeq;
+  uint16_t  cmdAge;
+  uint16_t  fbTime;
+  uint32_t  syncTime;
+} ProtoFeedbackCompact;                 // followed by the slow fields and checksumL, checksumH
+
+#define PROTO_FB_COMPACT_MAX    (sizeof(ProtoFeedbackCompact) + PROTO_FB_SLOW_N * 2 + 4)  // [bytes] longest compact frame
+
+typedef struct __attribute__((packed)) {
+  uint16_t  start;                      // PROTO_START_FRAME_TRIP
+  uint8_t   version;
+  uint8_t   caps;
+  uint32_t  odoM;                       // [m] distance, mean of both wheels
+  uint32_t  usedMWh;                    // [mWh] energy drawn from the battery
+  uint32_t  regenMWh;                   // [mWh] energy fed back into the battery
+  uint32_t  onTime;                     // [s] time powered on
+  uint32_t  errTime;                    // [s] time with a motor error
+  int16_t   maxTemp;                    // [degC*10] highest board temperature
+  int16_t   maxCurr;                    // [A*100] highest battery current
+  uint16_t  cmdSeq;                     // [-] seq of the command that asked for this frame
+  uint16_t  checksumL;
+  uint16_t  checksumH;
+} ProtoTrip;
+
+#endif // PROTOCOL_H
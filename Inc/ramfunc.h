@@ -0,0 +1,18 @@
+#pragma once
+
+// Code and constants run from SRAM, shared by defines.h and the modules the host simulator builds without the HAL
+// (observer.c, ...). Include it after config.h, FLASH_SAFE_WRITE comes from there.
+
+// Execute function from SRAM (no flash wait states). FOC_IN_RAM is set by the Makefile: make -e FOC_IN_RAM=1
+#if defined(FOC_IN_RAM) && defined(__GNUC__)
+  #define RAMFUNC __attribute__((section(".ramfunc"), long_call, noinline))
+#else
+  #define RAMFUNC
+#endif
+
+// Constant table read by the hot path, copied to SRAM with FLASH_SAFE_WRITE (.ramfunc section, see config.h)
+#if defined(FLASH_SAFE_WRITE) && defined(__GNUC__)
+  #define RAMCONST __attribute__((section(".ramfunc.rodata")))
+#else
+  #define RAMCONST
+#endif
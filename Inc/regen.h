@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+
+// Regenerative braking manager, REGEN_LIMIT. Counts the energy fed back into the battery and lowers the braking torque
+// when the battery voltage gets near REGEN_V_MAX, so braking on a full battery cannot push it over the limit (see regen.c).
+// regenStep runs in the monitor task, the control interrupt scales the braking torque targets with fac.
+#define REGEN_FAC_ONE           32768   // [-] fac of the full braking torque
+
+typedef struct {
+  int32_t  regenRest;                   // [V*100*A*100*ms] recovered energy not yet counted in regenMWh
+  uint32_t regenMWh;                    // [mWh] energy recovered since power on
+  int32_t  usedRest;                    // [V*100*A*100*ms] drawn energy not yet counted in usedMWh
+  uint32_t usedMWh;                     // [mWh] energy drawn since power on
+  uint16_t fac;                         // [Q15] braking torque factor read by the control interrupt
+} Regen;
+
+void regenInit(Regen *r);
+void regenStep(Regen *r, int16_t vBat, int16_t iBat, uint16_t dt);
@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include "stm32f1xx_hal.h"      // CMSIS __DMB, on the host the version of host/halsim
+
+// Single producer / single consumer queue of a power of 2 number of slots, bytes or fixed size frames in a static
+// array of the user. The indices run free, the slot is the index masked by the size: head - tail is the fill, all
+// slots are usable. The producer only writes head, the consumer only tail, so either side may be an interrupt and
+// neither masks the other. A slot is filled and read in place, the pool of frames between the two without a copy:
+//   producer: if (!ringFull(&r, N)) { fill pool[ringIn(&r, N)]; ringPush(&r, 1); }
+//   consumer: while (!ringEmpty(&r)) { use pool[ringOut(&r, N)]; ringPop(&r, 1); }
+// Push and pop order the slot accesses before the index write (__DMB), the other side then sees the complete slot.
+typedef struct {
+  volatile uint16_t head;               // [-] next slot to fill, written by the producer only
+  volatile uint16_t tail;               // [-] next slot to take, written by the consumer only
+} Ring;
+
+static inline uint16_t ringCount(const Ring *r) {
+  return (uint16_t)(r->head - r->tail);
+}
+
+static inline uint8_t ringEmpty(const Ring *r) {
+  return r->head == r->tail;
+}
+
+static inline uint16_t ringFree(const Ring *r, uint16_t size) {
+  return size - ringCount(r);
+}
+
+static inline uint8_t ringFull(const Ring *r, uint16_t size) {
+  return ringCount(r) >= size;
+}
+
+/* Slot of the producer */
+static inline uint16_t ringIn(const Ring *r, uint16_t size) {
+  return r->head & (size - 1);
+}
+
+/* Slot of the consumer */
+static inline uint16_t ringOut(const Ring *r, uint16_t size) {
+  return r->tail & (size - 1);
+}
+
+/* Filled slots from the consumer slot to the end of the array, the part a DMA transfer can take at once */
+static inline uint16_t ringLinear(const Ring *r, uint16_t size) {
+  uint16_t n   = ringCount(r);
+  uint16_t end = size - ringOut(r, size);
+  return n < end ? n : end;
+}
+
+/* Publish n filled slots */
+static inline void ringPush(Ring *r, uint16_t n) {
+  __DMB();
+  r->head = r->head + n;
+}
+
+/* Release n slots to the producer */
+static inline void ringPop(Ring *r, uint16_t n) {
+  __DMB();
+  r->tail = r->tail + n;
+}
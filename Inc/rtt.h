@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+
+// Debug channel in RAM, DEBUG_RTT (see rtt.c). A control block in the SEGGER RTT layout, found by the debugger by its
+// id string, with one up buffer (debugTxWrite, the debug text, stream and protocol answers) and one down buffer (the
+// commands, read by rttPoll). The debugger moves the data over SWD while the core runs.
+typedef struct {
+  const char       *name;               // [-] channel name shown by the debugger
+  uint8_t          *buf;
+  uint32_t          size;               // [bytes]
+  volatile uint32_t wrOff;              // [bytes] written by the producer: the firmware up, the debugger down
+  volatile uint32_t rdOff;              // [bytes] written by the consumer
+  uint32_t          flags;              // [-] RTT_MODE_* of the channel
+} RttBuf;
+
+typedef struct {
+  char     id[16];                      // [-] "SEGGER RTT", the debugger searches the RAM for it
+  int32_t  upN;                         // [-] up buffers, target to debugger
+  int32_t  downN;                       // [-] down buffers, debugger to target
+  RttBuf   up[1];
+  RttBuf   down[1];
+} RttCb;
+
+extern RttCb rttCb;
+
+void rttInit(void);
+void rttPoll(void);
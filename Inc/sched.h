@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+#include "config.h"
+
+// Cooperative main loop scheduler on the microsecond timebase (timeUs), woken by the control interrupt
+#define SCHED_TICKS_PER_MS      1000                  // [us] scheduler time per millisecond
+#define SCHED_PHASE_US          (1000000 / PWM_FREQ)  // [us] phase step of the task table, one control period
+#define SCHED_HIST_BINS         8                     // [-] runtime histogram bins (SCHED_STATS), bin k holds runs shorter than SCHED_HIST_US << k, the last one the rest
+#define SCHED_HIST_US           32                    // [us] upper edge of the first bin
+
+typedef struct {
+  void    (*fn)(void);                  // task function, runs to completion
+  uint32_t period;                      // [us] release period
+  uint32_t phase;                       // [SCHED_PHASE_US] offset of the first release, spreads the tasks over the period
+  uint32_t next;                        // [us] next release time
+  uint32_t runLast;                     // [cycles] duration of the last run
+  uint32_t runMax;                      // [cycles] longest run
+  uint32_t overrun;                     // [-] number of skipped releases (task started more than one period late)
+  #if defined(SCHED_STATS)
+  uint32_t runMin;                      // [cycles] shortest run
+  uint16_t hist[SCHED_HIST_BINS];       // [-] runs per runtime bin, saturated
+  #endif
+} SchedTask;
+
+// Main loop load, measured around the WFI: the interrupts that preempt a task count as busy, those that wake the
+// sleeping loop as idle. A load near 1000 means the tasks no longer fit into their periods (see the overrun counters)
+typedef struct {
+  uint16_t load;                        // [0.1 %] time outside WFI during the last second
+  uint16_t loadMax;                     // [0.1 %] highest load
+  uint32_t worst;                       // [cycles] longest single task run, the worst blocking call
+  uint8_t  worstTask;                   // [-] schedTasks index of that run
+} SchedLoad;
+
+// Main loop task table, defined in main.c
+enum schedTasks {SCHED_TASK_CONTROL, SCHED_TASK_SIDEBOARD, SCHED_TASK_MONITOR, SCHED_TASK_FEEDBACK, SCHED_TASK_DEBUG, SCHED_TASK_STREAM, SCHED_TASK_COMMAND, SCHED_TASK_LCD, SCHED_TASK_BALANCE, SCHED_TASK_INPUTCAL, SCHED_TASKS};
+
+extern SchedTask schedTasks[SCHED_TASKS];
+extern SchedLoad schedLoad;
+extern uint8_t   schedRst;              // [-] set to 1 to reset the runtime statistics
+
+void schedInit(SchedTask *tasks, uint8_t num);
+void schedRun(SchedTask *tasks, uint8_t num);
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdint.h>
+
+// Boot self-test, SELF_TEST. Plausibility of the ADC offsets and hall inputs at the end of the offset calibration,
+// then short low duty pulses on every phase that each shunt has to see, and the hall positions seen while driving
+// (see selftest.c). A board that passed and showed all 6 hall positions without a fault skips the pulses next boot.
+#define SELF_TEST_KEY       0x5E1F      // [-] EEPROM word of a board found healthy at the last power on
+#define SELF_TEST_OFF       (-1)        // [-] selfTestStep: outputs at zero voltage
+#define SELF_TEST_END       (-2)        // [-] selfTestStep: test done, outputs off
+
+enum selfTestStates {SELF_TEST_IDLE, SELF_TEST_PULSE, SELF_TEST_DONE};
+enum selfTestErrors {                   // bits of err, per motor
+  SELF_TEST_ERR_OFFSET = 1,             // phase or DC link current offset far from mid scale: amplifier or ADC channel
+  SELF_TEST_ERR_HALL   = 2,             // invalid hall state (000 or 111) at standstill: sensor or cable
+  SELF_TEST_ERR_PHASE  = 4,             // a phase pulse not or wrongly seen by the shunts: gate driver, FET or shunt
+  SELF_TEST_ERR_DC     = 8              // DC link current while the low side FETs carry the phase current
+};
+
+typedef struct {
+  volatile uint8_t state;               // [-] selfTestStates, written by the control interrupt
+  uint8_t  motors;                      // [-] bit per tested motor, 1 = left, 2 = right
+  uint8_t  slot;                        // [-] pulsed phase, 0..2 = U, V, W
+  uint16_t ticks;                       // [ticks] time in the slot
+  int32_t  sum[2][2];                   // [ADC bits] shunt currents summed at the end of the pulse, per motor
+  int16_t  resp[2][3][2];               // [ADC bits] mean shunt currents per motor, pulsed phase and shunt
+  int16_t  dcMax[2];                    // [ADC bits] largest DC link current during the pulses
+  uint8_t  err[2];                      // [-] selfTestErrors, left / right
+  uint8_t  hallSeen[2];                 // [-] bit per hall2pos position seen since power on, bit 6 = invalid state
+  uint8_t  fault;                       // [-] set by the main loop on a controller error: the next boot runs the pulses
+  uint16_t cached;                      // [-] EEPROM word of the last power on, SELF_TEST_KEY = healthy
+} SelfTest;
+
+/* Control interrupt, on every hall position change of motor m, pos = hall2pos[hall] */
+static inline void selfTestHall(SelfTest *s, uint8_t m, uint8_t pos) {
+  s->hallSeen[m] |= (uint8_t)(1 << pos);
+}
+
+void     selfTestBegin(SelfTest *s, uint8_t motors, const uint16_t offset[6], const uint8_t pos[2]);
+int8_t   selfTestStep(SelfTest *s, const int16_t cur[2][2], const int16_t dc[2]);
+uint16_t selfTestCache(const SelfTest *s);
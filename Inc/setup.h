@@ -29,8 +29,14 @@ void MX_GPIO_Init(void);
 void MX_TIM_Init(void);
 void MX_ADC1_Init(void);
 void MX_ADC2_Init(void);
+#if defined(ADC_INPUT_OVS)
+void MX_ADC3_Init(void);
+#endif
 void UART2_Init(void);
 void UART3_Init(void);
+void UART_SetBaud(UART_HandleTypeDef *huart, uint32_t baud);
+HAL_StatusTypeDef UART_TxDma(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size);
+void UART_RxDma(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
 
 
 extern TIM_HandleTypeDef htim_left;
@@ -38,6 +44,11 @@ extern TIM_HandleTypeDef htim_right;
 extern ADC_HandleTypeDef hadc1;
 extern ADC_HandleTypeDef hadc2;
 extern volatile adc_buf_t adc_buffer;
+extern volatile uint32_t  adc_dma[2][ADC_REG_WORDS];
+#if defined(ADC_INPUT_OVS)
+extern ADC_HandleTypeDef hadc3;
+extern volatile uint32_t  adc_ovs[ADC_INPUT_OVS];
+#endif
 
 extern UART_HandleTypeDef huart2;
 extern UART_HandleTypeDef huart3;
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+
+// Speed loop filters, SPD_FILT. A notch and a low pass biquad on the speed error of SPD_MODE, run by the controller step
+// before the speed PI with the cf_nFilt coefficients of its parameters, and the resonance search of "$SPDID" (see spdfilt.c).
+#define SPD_FILT_COEFS          10      // [-] b0, b1, b2, a1, a2 of the notch, then of the low pass
+#define SPD_FILT_Q              28      // [-] fraction bits of the coefficients
+#define SPD_ID_BINS             24      // [-] frequencies of the $SPDID sweep
+
+enum spdFiltIdx {SF_NOTCH_HZ, SF_NOTCH_BW, SF_NOTCH_DEPTH, SF_LP_HZ, SF_N};
+enum spdIdStates {SPD_ID_IDLE, SPD_ID_RUN, SPD_ID_DONE, SPD_ID_FAIL};
+
+typedef struct {
+  int64_t  sum[2];                      // [rpm, Q14] response of the running frequency times its cos / sin
+  uint32_t phase;                       // [2^-32 turn] excitation phase
+  uint32_t ticks;                       // [ticks] summed in the running frequency
+  uint16_t gain[SPD_ID_BINS];           // [rpm per 100 r_inpTgt] response amplitude of each frequency
+  int16_t  exc;                         // [-] excitation of this tick, r_inpTgt units
+  uint8_t  cycles;                      // [-] excitation periods in the running frequency
+  uint8_t  bin;                         // [-] running frequency
+  uint8_t  state;                       // [-] spdIdStates
+} SpdId;
+
+void     spdFiltDesign(int32_t c[SPD_FILT_COEFS], const uint16_t cfg[SF_N], uint32_t fs);
+uint16_t spdIdPlan(void);
+uint16_t spdIdFreq(uint8_t bin);
+void     spdIdStart(SpdId *c);
+void     spdIdInput(const SpdId *c, int16_t *inpTgt);
+uint8_t  spdIdStep(SpdId *c, uint8_t run, int16_t n);
+uint16_t spdIdPeak(const SpdId *c, uint8_t *bin);
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+
+// Main stack high-water mark and guard (see stackmon.c). The STM32F103 has no MPU: the guard is a painted
+// canary between the heap reserve and the stack, checked by the main loop, not a trapping region.
+#define STACK_PAINT             0xC5C5C5C5U     // [-] fill pattern of the unused stack
+#define ERR_STACK_GUARD         16      // z_errCode bit set when the guard was overwritten (8 is ERR_DEADLINE_MISS)
+
+typedef struct {
+  uint32_t size;                        // [bytes] painted area from the heap reserve up to the stack pointer at boot
+  uint32_t free;                        // [bytes] painted bytes never written since boot, the high-water mark is size - free
+  uint8_t  fault;                       // [-] guard overwritten, latched until power cycle
+} StackMon;
+
+extern StackMon stackMon;
+
+void stackPaint(void);
+void stackCheck(void);
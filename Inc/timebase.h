@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+
+// Monotonic microsecond timebase (see timebase.c): TIM3 counts microseconds, TIM4 counts its overflows.
+// The two 16 bit counters read as one 32 bit value without locking, in any context, from timeInit on.
+// timeUs wraps after 71 minutes, which is fine for differences; timeUs64 and timeMs add the software epoch.
+#define TIME_TIM_LO             TIM3            // [us] low 16 bits, master
+#define TIME_TIM_HI             TIM4            // [65.536 ms] high 16 bits, slave clocked by the TIM3 update (ITR2)
+#define TIME_TIM_HI_IRQn        TIM4_IRQn
+
+extern volatile uint32_t timeEpoch;   // [-] TIM4 overflows, i.e. timeUs wraps
+
+void     timeInit(void);
+uint32_t timeUs(void);
+uint64_t timeUs64(void);
+uint32_t timeMs(void);
+void     timeEpochIrq(void);
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+
+// Clock synchronisation, TIME_SYNC (see timesync.c). Follows the controller clock from the syncTime of its command
+// frames: the offset and the drift of timeUs against it, so the feedback of all boards of a vehicle is stamped in one
+// timebase.
+typedef struct {
+  uint32_t local;                       // [us] timeUs of the last reference
+  uint32_t host;                        // [us] controller time at local, filtered
+  int32_t  drift;                       // [2^-20] controller clock rate / board clock rate - 1
+  int32_t  err;                         // [us] last reference minus its prediction
+  uint16_t steps;                       // [-] restarts on a reference further off than TIME_SYNC_STEP
+  uint8_t  valid;                       // [-] at least one reference taken
+} TimeSync;
+
+void     timeSyncRef(TimeSync *s, uint32_t local, uint32_t host);
+uint32_t timeSyncHost(const TimeSync *s, uint32_t local);
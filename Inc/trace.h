@@ -0,0 +1,40 @@
+#pragma once
+#include <stdint.h>
+#include "config.h"
+
+// SWO trace, TRACE_ITM (see trace.c). Events are single bytes on the ITM stimulus ports, timestamped by the ITM and
+// sent on the SWO pin of the SWD header, so they cost no UART bandwidth. A write never waits: with the FIFO full the
+// event is dropped and counted in traceDrop. TRACE_ITM_PRINTF also moves the debug text (printf) to port 0.
+#define TRACE_PORT_TEXT         0       // [-] debug text, TRACE_ITM_PRINTF
+#define TRACE_PORT_ISR          1       // [-] interrupt enter / exit, traceIsrs
+#define TRACE_PORT_TASK         2       // [-] scheduler task start / end, schedTasks index
+#define TRACE_END               0x80    // [-] event bit of an exit or task end
+
+enum traceIsrs {TRACE_ISR_CONTROL, TRACE_ISR_DEFERRED, TRACE_ISR_COMMUT};
+
+#if defined(TRACE_ITM)
+#include "stm32f1xx_hal.h"
+
+extern uint32_t traceDrop;              // [-] events dropped on a full ITM FIFO
+
+void traceInit(void);
+void traceWrite(const uint8_t *data, int len);
+
+static inline void traceEvent(uint8_t port, uint8_t ev) {
+  if (ITM->PORT[port].u32) {            // reads 1 while the FIFO takes a write
+    ITM->PORT[port].u8 = ev;
+  } else {
+    traceDrop++;
+  }
+}
+
+  #define TRACE_ISR_ENTER(id)   traceEvent(TRACE_PORT_ISR,  (id))
+  #define TRACE_ISR_EXIT(id)    traceEvent(TRACE_PORT_ISR,  (id) | TRACE_END)
+  #define TRACE_TASK_START(i)   traceEvent(TRACE_PORT_TASK, (i))
+  #define TRACE_TASK_END(i)     traceEvent(TRACE_PORT_TASK, (i) | TRACE_END)
+#else
+  #define TRACE_ISR_ENTER(id)
+  #define TRACE_ISR_EXIT(id)
+  #define TRACE_TASK_START(i)
+  #define TRACE_TASK_END(i)
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+
+// Trip statistics, TRIP_STATS. Lifetime totals of the vehicle for maintenance: distance, energy drawn and recovered,
+// time powered on and with a motor error, highest board temperature and battery current (see trip.c). tripStep runs
+// in the monitor task, the totals go to a flash log at standstill every TRIP_SAVE_PERIOD and at poweroff.
+
+typedef struct {
+  uint32_t odoM;                        // [m] distance, mean of both wheels
+  uint32_t usedMWh;                     // [mWh] energy drawn from the battery
+  uint32_t regenMWh;                    // [mWh] energy fed back into the battery
+  uint32_t onTime;                      // [s] time powered on
+  uint32_t errTime;                     // [s] time with a motor error (z_errCode)
+  int16_t  maxTemp;                     // [°C*10] highest board temperature
+  int16_t  maxCurr;                     // [A*100] highest battery current, discharge or charge
+} TripStats;
+
+typedef struct {
+  TripStats tot;                        // totals, restored from the flash log at power on
+  uint32_t  odoRest;                    // [hall steps*mm] distance not yet counted in odoM
+  int32_t   usedRest;                   // [V*100*A*100*ms] drawn energy not yet counted in usedMWh
+  int32_t   regenRest;                  // [V*100*A*100*ms] recovered energy not yet counted in regenMWh
+  uint16_t  onRest;                     // [ms] on time not yet counted in onTime
+  uint16_t  errRest;                    // [ms] error time not yet counted in errTime
+  uint32_t  saveTime;                   // [s] onTime at the last save
+  uint8_t   dirty;                      // [-] the totals changed since the last save, besides onTime
+} Trip;
+
+void    tripInit(Trip *t, const TripStats *saved);
+void    tripStep(Trip *t, uint16_t steps, uint16_t stepsPerTurn, int16_t vBat, int16_t iBat, int16_t temp, uint8_t err, uint16_t dt);
+uint8_t tripSaveDue(Trip *t, uint8_t standstill);
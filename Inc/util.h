@@ -25,6 +25,14 @@
 #include "BLDC_controller.h"
 #include "config.h"
 #include "eeprom.h"
+#include "bldc.h"
+#include "protocol.h"
+#include "battery.h"
+#include "trip.h"
+#include "gainsched.h"
+#include "spdfilt.h"
+#include "timesync.h"
+#include "latency.h"
 // Rx Structures USART
 #if defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)
   #ifdef CONTROL_IBUS
@@ -36,13 +44,7 @@
       uint8_t  checksumh;
     } SerialCommand;
   #else
-    typedef struct{
-      uint16_t  start;
-      int16_t   steer;
-      int16_t   speed;
-      uint16_t  checksumL;
-      uint16_t  checksumH;
-    } SerialCommand;
+    typedef ProtoCommand SerialCommand;
   #endif
 #endif
 #if defined(SIDEBOARD_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART3)
@@ -57,6 +59,149 @@
     } SerialSideboard;
 #endif
 
+#if defined(SERIAL_HW_CRC)
+extern uint8_t serialHwCrc_L;
+extern uint8_t serialHwCrc_R;
+#endif
+#if defined(FEEDBACK_COMPACT)
+extern uint8_t serialFbCompact_L;
+extern uint8_t serialFbCompact_R;
+#endif
+#if (defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)) && !defined(CONTROL_IBUS)
+extern uint16_t serialSeq_L;
+extern uint16_t serialSeq_R;
+extern uint32_t serialSeqTick_L;
+extern uint32_t serialSeqTick_R;
+
+// Serial command latency, mean and max over blocks of 2^SERIAL_LAT_SHIFT samples
+#define SERIAL_LAT_SHIFT        4
+typedef struct {
+  uint16_t last;                        // [us] last sample, saturated
+  uint16_t mean;                        // [us] mean of the last block
+  uint16_t max;                         // [us] max of the last block
+  uint16_t blockMax;
+  uint32_t sum;
+  uint16_t cnt;
+} SerialLatStat;
+
+typedef struct {
+  SerialLatStat apply;                  // command frame received to target taken over by the control task
+  SerialLatStat rtt;                    // feedback frame sent to the command echoing its fbTime received
+  uint32_t rxUs;                        // [us] receive time of the command not taken over yet
+  uint8_t  pending;                     // [-] rxUs is valid
+} SerialLatency;
+
+extern SerialLatency serialLat_L;
+extern SerialLatency serialLat_R;
+#endif
+#if defined(LATENCY_MEAS)
+extern LatMeas latMeas;                 // input to PWM latency, latInput / latOutput in the control task
+#endif
+#if defined(TIME_SYNC)
+extern TimeSync timeSync;               // controller clock of the command frames
+uint32_t usart_sync_time(uint32_t local);
+#endif
+#if defined(SERIAL_BUS)
+extern uint8_t busId;                   // [-] id of this board on the bus, BUS_ID parameter
+void usart_bus_feedback(const ProtoFeedback *fb);
+#elif defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3)
+// Feedback Tx of a port: the feedback task fills one buffer while the other is on the wire
+typedef struct {
+  UART_HandleTypeDef *huart;
+  IRQn_Type irq;
+  union {
+    ProtoFeedback fb;
+    #if defined(FEEDBACK_COMPACT)
+    uint8_t compact[PROTO_FB_COMPACT_MAX];
+    #endif
+    #if defined(TRIP_STATS)
+    ProtoTrip trip;
+    #endif
+  } buf[2];
+  uint16_t  len[2];
+  volatile uint8_t tx;      // buffer started last, on the wire while the USART is busy
+  volatile uint8_t queued;  // the other buffer is complete, it goes out on the Tx complete of this one
+  uint32_t  sent;           // frames started
+  uint32_t  late;           // frames that waited for the previous one, started on its Tx complete
+  uint32_t  skipped;        // queued frames replaced by a newer one before they went out
+} SerialTx;
+#if defined(FEEDBACK_SERIAL_USART2)
+extern SerialTx fbTx_L;
+#endif
+#if defined(FEEDBACK_SERIAL_USART3)
+extern SerialTx fbTx_R;
+#endif
+uint8_t *usart_tx_buf(SerialTx *t);
+void usart_tx_send(SerialTx *t, uint16_t len);
+uint8_t usart_tx_idle(const SerialTx *t);
+#endif
+
+#if defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
+// Rx frame parser state
+typedef struct {
+  uint8_t  *buf;    // USART Rx DMA circular buffer
+  uint32_t  size;   // buffer size
+  uint32_t  rd;     // parser read position
+  uint32_t  good;   // valid frames
+  uint32_t  bad;    // frames with correct start frame but wrong checksum
+  uint32_t  resync; // number of times bytes were skipped to find a start frame
+  uint32_t  version; // frames with a valid checksum but another PROTO_VERSION
+  uint32_t  latch;   // latch frames that applied a held command
+  uint32_t  lost;    // sideboard v2 frames missing in the seq count
+  uint16_t  seq;     // seq of the last sideboard v2 frame
+  uint8_t   sbCaps;  // caps of the last sideboard v2 frame, 0 after a v1 frame
+  uint8_t   sbV2;    // the last valid sideboard frame was v2: seq is valid
+} SerialRx;
+#endif
+#if defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
+extern SerialRx rxFrame_L;
+#endif
+#if defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
+extern SerialRx rxFrame_R;
+#endif
+
+#if defined(SERIAL_TIMEOUT_ADAPTIVE)
+// Adaptive timeout supervision of a serial input (CONTROL or SIDEBOARD port)
+typedef struct {
+  uint8_t   idx;      // [-] input index of the port, the ramp down applies while it is selected
+  uint32_t  rxUs;     // [us] time of the last frame that reset the timeout
+  uint32_t  periodUs; // [us] learned frame interval, 0 = not learned yet
+  uint16_t  limit;    // [loops] main loops without a frame before the ramp down
+  uint16_t  scale;    // [1/256] target scale of the ramp down
+} SerialSup;
+#if defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
+extern SerialSup serialSup_L;
+#endif
+#if defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
+extern SerialSup serialSup_R;
+#endif
+#endif
+
+#if defined(SERIAL_BAUD_NEGOTIATION)
+enum serialBaudStates {SERIAL_BAUD_IDLE, SERIAL_BAUD_ACK, SERIAL_BAUD_SWITCH};
+
+// Baud rate negotiation state of a command port
+typedef struct {
+  UART_HandleTypeDef *huart;
+  SerialRx *rx;
+  uint32_t  base;     // [baud] configured rate USARTx_BAUD, used at startup and as fallback
+  uint32_t  baud;     // [baud] current rate
+  uint32_t  req;      // [baud] accepted request, set after the acknowledging feedback frame
+  uint8_t   state;    // serialBaudStates
+  uint32_t  good;     // rx->good at the last valid frame
+  uint32_t  err;      // rx->bad + rx->resync at the last valid frame
+  uint32_t  goodTick; // [ms] time of the last valid frame
+  uint32_t  fallbacks; // number of returns to the configured rate
+} SerialBaud;
+#if defined(CONTROL_SERIAL_USART2)
+extern SerialBaud serialBaud_L;
+#endif
+#if defined(CONTROL_SERIAL_USART3)
+extern SerialBaud serialBaud_R;
+#endif
+uint8_t usart_baud_task(SerialBaud *b);
+#endif
+
 // Input Structure
 typedef struct {
   int16_t   raw;    // raw input
@@ -67,13 +212,79 @@ typedef struct {
   int16_t   mid;    // middle
   int16_t   max;    // maximum
   int16_t   dband;  // deadband
+  int32_t   rcpPos; // 2^30 / span above mid (whole span for a normal pot), set by Input_Scale_Init
+  int32_t   rcpNeg; // 2^30 / span below mid
 } InputStruct;
 
+// Input source descriptor, one per input index (inputSrc in util.c)
+enum inputTimeouts {INPUT_TMO_NONE, INPUT_TMO_ADC, INPUT_TMO_SERIAL, INPUT_TMO_GEN};
+typedef struct {
+  void    (*read)(InputStruct *in1, InputStruct *in2);  // copy the latest source values to raw, NULL = no source
+  uint8_t   scale;  // 1 = calcInputCmd scales raw to cmd, 0 = the variant uses raw as it is
+  uint8_t   timeout; // inputTimeouts: supervision of the source, INPUT_TMO_ADC also checks the raw range
+} InputSource;
+
+// Drive profile of MULTI_MODE_DRIVE, DRV_Mx_* parameters (comms.c)
+#define DRIVE_PROFILES          3
+typedef struct {
+  uint16_t  rate;       // [-] rate limiter of the inputs, see RATE
+  int16_t   maxSpeed;   // [-] max throttle command of the VARIANT_HOVERCAR pedals
+  int16_t   iMax;       // [A] max phase current
+  int16_t   nMax;       // [rpm] max motor speed
+  uint16_t  filter;     // [-] input low pass, see FILTER
+  uint8_t   fieldWeak;  // [-] 1 = field weakening / phase advance enabled
+} DriveProfile;
+
+// Board configuration descriptor: mixer and motor directions of the main loop, the serial fast command path and the
+// feedback, and the auxiliary input of DUAL_INPUTS. The defaults come from config.h, the BOARD_CFG parameter (comms.c)
+// overrides them from the EEPROM store, so boards that differ only in these run the same binary
+#define BCFG_TANK               0x01    // tank steering: input1 drives the left wheel, input2 the right, no mixer
+#define BCFG_INV_L              0x02    // invert the left motor
+#define BCFG_INV_R              0x04    // invert the right motor
+#define BCFG_DUAL               0x08    // DUAL_INPUTS: switch to the auxiliary input while it is valid, else primary only
+#if defined(TANK_STEERING) && !defined(VARIANT_HOVERCAR) && !defined(VARIANT_SKATEBOARD)
+  #define BCFG_DEF_TANK         BCFG_TANK
+#else
+  #define BCFG_DEF_TANK         0
+#endif
+#if defined(INVERT_L_DIRECTION)
+  #define BCFG_DEF_INV_L        BCFG_INV_L
+#else
+  #define BCFG_DEF_INV_L        0
+#endif
+#if defined(INVERT_R_DIRECTION)
+  #define BCFG_DEF_INV_R        BCFG_INV_R
+#else
+  #define BCFG_DEF_INV_R        0
+#endif
+#if defined(DUAL_INPUTS)
+  #define BCFG_DEF_DUAL         BCFG_DUAL
+#else
+  #define BCFG_DEF_DUAL         0
+#endif
+#if defined(VARIANT_HOVERCAR) || defined(VARIANT_SKATEBOARD)
+  #define BCFG_MASK             (BCFG_INV_L | BCFG_INV_R | BCFG_DEF_DUAL)     // pedals: throttle and brake, no tank steering
+#else
+  #define BCFG_MASK             (BCFG_TANK | BCFG_INV_L | BCFG_INV_R | BCFG_DEF_DUAL)
+#endif
+#define BCFG_DEFAULT            (BCFG_DEF_TANK | BCFG_DEF_INV_L | BCFG_DEF_INV_R | BCFG_DEF_DUAL)
+typedef struct {
+  uint8_t   flags;      // [-] BCFG_* bits
+  int8_t    dirL;       // [-] sign from a left command or speed to pwml and the feedback, -1 or 1
+  int8_t    dirR;       // [-] sign from a right command or speed to pwmr and the feedback, -1 or 1
+} BoardCfg;
+extern BoardCfg boardCfg;
+extern uint8_t  boardCfgFlags;
+
+static inline int16_t boardOutL(int16_t v) { return (int16_t)(boardCfg.dirL * v); }
+static inline int16_t boardOutR(int16_t v) { return (int16_t)(boardCfg.dirR * v); }
+
 // Initialization Functions
 void BLDC_Init(void);
+void Board_Cfg_Init(void);
 void Input_Lim_Init(void);
 void Input_Init(void);
-void UART_DisableRxErrors(UART_HandleTypeDef *huart);
+void Input_Scale_Init(void);
 
 // General Functions
 void poweronMelody(void);
@@ -81,6 +292,7 @@ void beepCount(uint8_t cnt, uint8_t freq, uint8_t pattern);
 void beepLong(uint8_t freq);
 void beepShort(uint8_t freq);
 void beepShortMany(uint8_t cnt, int8_t dir);
+void beepWait(void);
 void calcAvgSpeed(void);
 void adcCalibLim(void);
 void updateCurSpdLim(void);
@@ -89,6 +301,7 @@ void electricBrake(uint16_t speedBlend, uint8_t reverseDir);
 void cruiseControl(uint8_t button);
 int  checkInputType(int16_t min, int16_t mid, int16_t max);
 
+
 // Input Functions
 void calcInputCmd(InputStruct *in, int16_t out_min, int16_t out_max);
 void readInputRaw(void);
@@ -96,29 +309,165 @@ void handleTimeout(void);
 void readCommand(void);
 void usart2_rx_check(void);
 void usart3_rx_check(void);
+#if defined(SERIAL_RX_DMA_IRQ) && (defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2))
+extern volatile uint8_t rxDmaHalf_L;
+extern uint32_t rxOverflow_L;
+#endif
+#if defined(SERIAL_RX_DMA_IRQ) && (defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3))
+extern volatile uint8_t rxDmaHalf_R;
+extern uint32_t rxOverflow_R;
+#endif
 #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
 void usart_process_debug(uint8_t *userCommand, uint32_t len);
 #endif
 #if defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)
-void usart_process_command(SerialCommand *command_in, SerialCommand *command_out, uint8_t usart_idx);
+uint8_t usart_process_command(const uint8_t *frame, SerialCommand *command_out, uint8_t usart_idx);
+#if defined(SERIAL_COBS)
+uint8_t usart_process_cobs(uint8_t *enc, uint16_t len, uint8_t *raw, uint16_t max, SerialCommand *command_out, uint8_t usart_idx);
+#endif
+#endif
+#if defined(SERIAL_FAST_CMD)
+uint8_t serialFastCmdActive(void);
+#endif
+#if defined(SERIAL_EXT_CMD)
+uint8_t serialExtWheel(void);
 #endif
 #if defined(SIDEBOARD_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART3)
-void usart_process_sideboard(SerialSideboard *Sideboard_in, SerialSideboard *Sideboard_out, uint8_t usart_idx);
+uint8_t usart_process_sideboard(const uint8_t *frame, SerialSideboard *Sideboard_out, uint8_t usart_idx);
 #endif
 
+// Battery level, batLevels of battery.h: the state of charge with BAT_SOC_ENABLE, else the BAT_LVLx voltages
+#if defined(BAT_SOC_ENABLE)
+extern BatSoc batSoc;
+void batSocLoad(void);
+#endif
+uint8_t batLevel(void);
+
 // Sideboard functions
-void sideboardLeds(uint8_t *leds);
+uint8_t sideboardLeds(void);
 void sideboardSensors(uint8_t sensors);
 
 // Poweroff Functions
+enum poweroffCauses {POWEROFF_BUTTON, POWEROFF_TEMP, POWEROFF_BAT_DEAD, POWEROFF_INACTIVITY, POWEROFF_DISTANCE};
 void saveConfig(void);
-void poweroff(void);
+#if defined(HALL_CALIB)
+void hallCalLoad(void);
+void hallCalSave(uint8_t done);
+#endif
+#if defined(MOTOR_IDENT)
+void motIdLoad(void);
+void motIdTune(uint8_t m);
+void motIdSave(uint8_t done);
+#endif
+#if defined(COGGING_COMP)
+void cogLoad(void);
+void cogSave(uint8_t done);
+#endif
+#if defined(CTRL_GAINS)
+enum ctrlGainIdx {CG_ID_KP, CG_ID_KI, CG_IQ_KP, CG_IQ_KI, CG_N_KP, CG_N_KI, CG_FILT, CG_N};
+extern uint16_t ctrlGains[CG_N];
+void ctrlGainsApply(void);
+#endif
+#if defined(SPD_FILT)
+extern uint16_t spdFilt[SF_N];
+void spdFiltApply(void);
+#endif
+#if defined(GAIN_SCHED)
+extern GainSched gainSched[2];
+void gainSchedStart(void);
+void gainSchedUpdate(int16_t nL, int16_t nR);
+#endif
+void poweroff(uint8_t cause);
 void poweroffPressCheck(void);
 
+// Power button state machine of poweroffPressCheck
+#define BTN_DEBOUNCE            80      // [ms] shorter presses are ignored
+#define BTN_LONG                5000    // [ms] long press, after the beep: input calibration or, with a second press, limits
+#define BTN_DOUBLE              1000    // [ms] window for the second press after a long press
+#define BTN_DOUBLE_TRANSPOTTER  400     // [ms] window for the second press of the power off double press
+#define BTN_CALIB_TIMEOUT       20000   // [ms] end of the input calibration without a confirming press
+#define BTN_LIMITS_TIMEOUT      10000   // [ms] end of the limits adjustment without a confirming press
+enum buttonStates {BTN_IDLE, BTN_PRESSED, BTN_LONG_HELD, BTN_WAIT_2ND, BTN_PRESSED_2ND, BTN_MODE, BTN_RELEASE};
+enum buttonModes  {BTN_MODE_NONE, BTN_MODE_WAIT, BTN_MODE_CALIB, BTN_MODE_LIMITS};
+extern uint8_t buttonMode;              // buttonModes, the motors stay disabled while an input mode runs
+
+// Input calibration modes, started by the power button or the $INCAL / $INLIM commands, sampled by inputCalTask
+enum inputCalResults {INPUT_CAL_NONE, INPUT_CAL_SAVED, INPUT_CAL_REJECTED};
+extern uint8_t inputCalProg;            // [%] elapsed part of the sampling time of the running mode
+extern uint8_t inputCalRes;             // inputCalResults of the last mode
+uint8_t inputCalStart(uint8_t mode);
+void    inputCalStop(void);
+void    inputCalTask(void);
+
+#if defined(FAULTLOG_ENABLE)
+  #define FAULTLOG_MAGIC        0xFA17  // [-] first half-word of a written record, 0xFFFF = erased slot
+
+  typedef struct {
+    uint16_t magic;                     // [-] FAULTLOG_MAGIC
+    uint16_t seq;                       // [-] record counter, increments with every record
+    uint32_t uptime;                    // [ms] timeMs() at poweroff
+    uint8_t  cause;                     // [-] see poweroffCauses
+    uint8_t  bboxCnt;                   // [-] number of valid black box samples
+    uint8_t  errCodeL;                  // [-] z_errCode at poweroff
+    uint8_t  errCodeR;
+    uint8_t  errLatchL;                 // [-] all z_errCode bits seen since power-on
+    uint8_t  errLatchR;
+    int16_t  batVoltage;                // [V*100] calibrated battery voltage
+    int16_t  boardTemp;                 // [°C*10] board temperature
+    int16_t  speedL;                    // [rpm] n_mot at poweroff
+    int16_t  speedR;
+    #if defined(BLACKBOX_ENABLE)
+    BlackBoxSample bbox[FAULTLOG_BBOX_SAMPLES];
+    #endif
+    uint32_t crc;                       // [-] CRC32 of the record, written last so an interrupted write is detected
+  } FaultRecord;
+
+  extern uint8_t errLatch_L;
+  extern uint8_t errLatch_R;
+  void faultLogWrite(uint8_t cause);
+  const FaultRecord *faultLogGet(uint8_t n);
+#endif
+
+#if defined(FLASH_SAFE_WRITE)
+  void flashSafeInit(void);
+#endif
+
+#if defined(TRIP_STATS)
+  #define TRIP_MAGIC            0x7219  // [-] first half-word of a written record, 0xFFFF = erased slot
+
+  typedef struct {
+    uint16_t  magic;                    // [-] TRIP_MAGIC
+    uint16_t  seq;                      // [-] record counter, increments with every record
+    TripStats stats;
+    uint32_t  crc;                      // [-] CRC32 of the record, written last so an interrupted write is detected
+  } TripRecord;
+
+  extern Trip trip;
+  void tripLoad(void);
+  void tripSave(void);
+  uint8_t tripEraseDue(void);
+  #if !defined(SERIAL_BUS) && (defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3))
+  extern uint8_t serialTripReq_L;
+  extern uint8_t serialTripReq_R;
+  #endif
+#endif
+
 // Filtering Functions
 void filtLowPass32(int32_t u, uint16_t coef, int32_t *y);
+void filtLowPass32Fast(int32_t u, uint16_t coef, int32_t *y);
 void rateLimiter16(int16_t u, int16_t rate, int16_t *y);
+typedef struct {
+  int32_t   y;      // reference, fixdt(1,32,16)
+  int32_t   a;      // reference change per step, fixdt(1,32,16)
+} RefGen;
+void refGenStep(int16_t u, int32_t accMax, int32_t jerkMax, RefGen *g);
 void mixerFcn(int16_t rtu_speed, int16_t rtu_steer, int16_t *rty_speedR, int16_t *rty_speedL);
+#define INPUT_CURVE_N     5             // [-] points of the input response curve
+#define INPUT_CURVE_STEP  (1000 / INPUT_CURVE_N)
+int16_t inputCurveStep(int16_t u, const int16_t *pts);
+#if defined(INPUT_CURVE)
+extern int16_t inputCurve[INPUT_CURVE_N];
+#endif
 
 // Multiple Tap Function
 typedef struct {
@@ -129,14 +478,38 @@ typedef struct {
 } MultipleTap;
 void multipleTapDet(int16_t u, uint32_t timeNow, MultipleTap *x);
 
+// ADC input pre-filters, ADC_INPUT_FILT
+typedef struct {
+  uint16_t  buf[1 << ADC_INPUT_FILT_SHIFT]; // last samples
+  uint32_t  sum;                            // sum of buf
+  uint16_t  idx;                            // oldest sample
+} BoxcarFilt;
+typedef struct {
+  uint16_t  y1;     // first EMA, fixdt(0,16,4)
+  uint16_t  y2;     // second EMA, fixdt(0,16,4)
+} Ema2Filt;
+void boxcarInit(BoxcarFilt *f, uint16_t u);
+uint16_t boxcarStep(BoxcarFilt *f, uint16_t u);
+void ema2Init(Ema2Filt *f, uint16_t u);
+uint16_t ema2Step(Ema2Filt *f, uint16_t u);
+
 #if defined(DEBUG_I2C_LCD) || defined(SUPPORT_LCD)
+  #include "hd44780.h"
   extern LCD_PCF8574_HandleTypeDef lcd;
 #endif
 
 extern int16_t speedAvg;                // Average measured speed
 extern int16_t speedAvgAbs;             // Average measured speed in absolute
+#if defined(HALL_SPEED_EST)
+extern int16_t hallSpeed[2];            // [rpm] hall edge timing speed estimate, left and right
+#endif
 extern uint8_t timeoutFlgADC;           // Timeout Flag for for ADC Protection: 0 = OK, 1 = Problem detected (line disconnected or wrong ADC data)
 extern uint8_t timeoutFlgSerial;        // Timeout Flag for Rx Serial command: 0 = OK, 1 = Problem detected (line disconnected or wrong Rx data)
+#if defined(DEBUG_OUT)
+extern uint32_t debugTxDrop;            // Number of debug printf characters dropped because the TX queue was full
+int  debugTxFree(void);
+int  debugTxWrite(const uint8_t *data, int len);
+#endif
 
 extern uint8_t     inIdx;               // input index used for dual-inputs
 extern uint8_t     inIdx_prev;
@@ -158,7 +531,27 @@ extern ExtY rtY_Right;                  /* External outputs */
 
 /* Virtual address defined by the user: 0xFFFF value is prohibited */
 extern uint16_t VirtAddVarTab[NB_OF_VAR];
+#define EE_ADDR_LEGACY_LAST     18      // Last address of the layout saved before the schema words were added
+#define EE_ADDR_SCHEMA          30      // CRC of the persisted parameter names and addresses (see comms.c)
+#define EE_ADDR_CRC             31      // CRC of the schema and the stored values, written last
+#define EE_ADDR_CALIB           32      // First of the CALIB_CH ADC offsets saved for the warm start of CALIBRATION_ADAPTIVE
+#define EE_ADDR_HALL            38      // First of the 2 x 6 hall edge corrections of HALL_CALIB, left then right
+#define EE_ADDR_CURVE           76      // First of the INPUT_CURVE_N points of INPUT_CURVE (IN_CRVx parameters)
+#define EE_ADDR_DRIVE           50      // First of the DRIVE_PROFILES x 6 words of the MULTI_MODE_DRIVE profiles (DRV_Mx_* parameters)
+#define EE_ADDR_BAT             68      // Remaining charge [mAh] and internal resistance [mOhm] of BAT_SOC_ENABLE
+#define EE_ADDR_MOTOR           70      // First of the 2 x 3 motor constants R, L, flux of MOTOR_IDENT, left then right
+#define EE_ADDR_BUS             81      // Board id of SERIAL_BUS (BUS_ID parameter)
+#define EE_ADDR_GAINS           82      // First of the CG_N controller gains of CTRL_GAINS (ID_KP ... CUR_FILT parameters)
+#define EE_ADDR_SELFTEST        89      // SELF_TEST_KEY if SELF_TEST found the board healthy at the last power on
+#define EE_ADDR_SPD_FILT        90      // First of the SF_N speed loop filter parameters of SPD_FILT (NF_FREQ ... NLP_FREQ)
+#define EE_ADDR_COG             96      // First of the 2 x COG_WORDS packed cogging tables of COGGING_COMP, left then right
 
+#if defined(CONTROL_IBUS) && defined(CONTROL_SERIAL_USART2)
+extern uint16_t ibusCh_L[IBUS_NUM_CHANNELS];   // [0-1000] iBUS channels of the last valid frame on USART2
+#endif
+#if defined(CONTROL_IBUS) && defined(CONTROL_SERIAL_USART3)
+extern uint16_t ibusCh_R[IBUS_NUM_CHANNELS];   // [0-1000] iBUS channels of the last valid frame on USART3
+#endif
 #if defined(SIDEBOARD_SERIAL_USART2)
 extern SerialSideboard Sideboard_L;
 #endif
@@ -167,10 +560,12 @@ extern SerialSideboard Sideboard_R;
 #endif
 
 #ifdef VARIANT_TRANSPOTTER
-  extern float    setDistance;
+  extern uint16_t setDistance;          // [mm]
 #endif
 
 extern uint8_t ctrlModReqRaw;
+extern int16_t INPUT_MAX;               // Input target limitation, set by Input_Lim_Init
+extern int16_t INPUT_MIN;
 
 #endif
 
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdint.h>
+
+// Motor winding temperature, WINDING_TEMP. The phase resistance, measured with a d axis current at standstill and from
+// the voltage equation while the motor turns slowly, corrects an I^2R thermal model of the winding (see wtemp.c).
+// The control interrupt sums the phase power and currents (wtempAcc), wtempStep takes the sums in the monitor task.
+enum wtempStates {WTEMP_IDLE, WTEMP_LO_SETTLE, WTEMP_LO, WTEMP_HI_SETTLE, WTEMP_HI};
+
+typedef struct {
+  int64_t  p;                           // [dc * ADC bits] phase voltage times phase current, over the three phases
+  int64_t  i2;                          // [ADC bits^2] squared phase currents, over the three phases
+  int64_t  e;                           // [rpm * fixdt(1,16,4) ADC bits] speed times iq, the back-EMF power
+  int32_t  n;                           // [rpm] absolute speed
+  uint16_t ticks;                       // [ticks] control interrupt ticks of the sums
+} WTempSum;
+
+typedef struct {
+  WTempSum acc;                         // sums of the running period, control interrupt only
+  volatile WTempSum sum;                // sums of the last period, written while ready is clear, read while it is set
+  volatile uint8_t ready;               // [-] set by the control interrupt, cleared by wtempStep once it took sum
+  int16_t  dcPrev[3];                   // [dc] duties of the previous tick, the voltages of the currents of this one
+  int16_t  idInj;                       // [fixdt(1,16,4) ADC bits] standstill d axis current, read by the control interrupt
+  uint8_t  state;                       // [-] wtempStates of the standstill measurement
+  uint8_t  meas;                        // [-] standstill measurements since power on, saturates at 255
+  uint32_t timer;                       // [ms] time since the last standstill measurement
+  int64_t  uLo;                         // [uV] resistive and dead time voltage at half the measurement current
+  int32_t  iLo;                         // [mA] the current of it
+  int32_t  v0;                          // [uV] dead time voltage in the current direction, from the standstill measurement
+  int32_t  r;                           // [uOhm] last measured phase resistance, 0 = none yet
+  int32_t  tempQ;                       // [degC*10, Q16] winding temperature estimate
+  int32_t  ambQ;                        // [degC*10, Q16] learned ambient temperature of the thermal model
+  int16_t  temp;                        // [degC*10] winding temperature estimate
+} WTemp;
+
+/* Control interrupt, once per tick: duties dc [rtY.DC_pha*], phase currents i [ADC bits], speed n [rpm] and iq
+ * [fixdt(1,16,4)] of the tick. The sums of period ticks are handed over in sum if wtempStep took the last ones */
+static inline void wtempAcc(WTemp *w, const int16_t dc[3], const int16_t i[3], int16_t n, int16_t iq, uint16_t period) {
+  WTempSum *a = &w->acc;
+  a->p  += (int32_t)w->dcPrev[0] * i[0] + (int32_t)w->dcPrev[1] * i[1] + (int32_t)w->dcPrev[2] * i[2];
+  a->i2 += (int32_t)i[0] * i[0] + (int32_t)i[1] * i[1] + (int32_t)i[2] * i[2];
+  a->e  += (int32_t)n * iq;
+  a->n  += n < 0 ? -n : n;
+  w->dcPrev[0] = dc[0];
+  w->dcPrev[1] = dc[1];
+  w->dcPrev[2] = dc[2];
+  if (++a->ticks >= period) {
+    if (!w->ready) {
+      w->sum   = *a;
+      w->ready = 1;
+    }
+    a->p = a->i2 = a->e = 0;
+    a->n = 0;
+    a->ticks = 0;
+  }
+}
+
+void    wtempInit(WTemp *w);
+int16_t wtempStep(WTemp *w, int16_t vbat, uint16_t r0, uint16_t flux, uint8_t polePairs, uint8_t active);
@@ -17,8 +17,15 @@
  * Validation result: Not run
  */
 
+#include "config.h"                    /* CTRL_FIXED, CTRL_TYP_SEL, CTRL_MOD_REQ */
 #include "BLDC_controller.h"
 
+/* The mode names are defined again below with the generated types */
+#undef OPEN_MODE
+#undef VLT_MODE
+#undef SPD_MODE
+#undef TRQ_MODE
+
 /* Named constants for Chart: '<S5>/F03_02_Control_Mode_Manager' */
 #define IN_ACTIVE                      ((uint8_T)1U)
 #define IN_NO_ACTIVE_CHILD             ((uint8_T)0U)
@@ -34,6 +41,25 @@
 #include <limits.h>
 #endif
 
+/* Control type and mode request. With CTRL_FIXED they are compile-time constants, so the
+ * branches of the other control types and modes are removed by the compiler.
+ * The mode request can still be OPEN_MODE (motor disabled, timeouts, errors) */
+#if defined(CTRL_FIXED)
+#define CTRL_TYP(p)                    ((uint8_T)CTRL_TYP_SEL)
+#define CTRL_MOD(u)                    ((uint8_T)((u)->z_ctrlModReq != OPEN_MODE ? CTRL_MOD_REQ : OPEN_MODE))
+#else
+#define CTRL_TYP(p)                    ((p)->z_ctrlTypSel)
+#define CTRL_MOD(u)                    ((u)->z_ctrlModReq)
+#endif
+
+/* Task_Scheduler. The model runs F02_Diagnostics + F03_Control_Mode_Manager, F04_Field_Weakening +
+ * Motor_Limitations and FOC on every third tick each. With CTRL_MULTIRATE FOC runs every tick and the
+ * two slow groups once per CTRL_SLOW_DIV ticks, half a period apart (z_taskCnt 0 and CTRL_SLOW_DIV / 2) */
+#if defined(CTRL_MULTIRATE)
+#define TASK_SLOW_A(cnt)               ((cnt) == 0)
+#define TASK_SLOW_B(cnt)               ((cnt) == CTRL_SLOW_DIV / 2)
+#endif
+
 #if ( UCHAR_MAX != (0xFFU) ) || ( SCHAR_MAX != (0x7F) )
 #error Code was generated for compiler with different sized uchar/char. \
 Consider adjusting Test hardware word size settings on the \
@@ -134,6 +160,25 @@ extern void PI_clamp_fixdt_g_Reset(DW_PI_clamp_fixdt_g *localDW);
 extern void PI_clamp_fixdt_k(int16_T rtu_err, uint16_T rtu_P, uint16_T rtu_I,
   int16_T rtu_init, int16_T rtu_satMax, int16_T rtu_satMin, int32_T
   rtu_ext_limProt, int16_T *rty_out, DW_PI_clamp_fixdt_g *localDW);
+
+/* Hot path functions of BLDC_controller_step placed in SRAM when building with FOC_IN_RAM (not generated, keep when re-generating the code) */
+#if defined(FOC_IN_RAM) && defined(__GNUC__)
+#define RAMFUNC_FOC __attribute__((section(".ramfunc"), long_call))
+uint8_T plook_u8s16_evencka(int16_T u, int16_T bp0, uint16_T bpSpace, uint32_T maxIndex) RAMFUNC_FOC;
+uint8_T plook_u8u16_evencka(uint16_T u, uint16_T bp0, uint16_T bpSpace, uint32_T maxIndex) RAMFUNC_FOC;
+int32_T div_nde_s32_floor(int32_T numerator, int32_T denominator) RAMFUNC_FOC;
+extern int16_T Counter(int16_T rtu_inc, int16_T rtu_max, boolean_T rtu_rst, DW_Counter *localDW) RAMFUNC_FOC;
+extern void Low_Pass_Filter(const int16_T rtu_u[2], uint16_T rtu_coef, int16_T rty_y[2], DW_Low_Pass_Filter *localDW) RAMFUNC_FOC;
+extern void Counter_n(uint16_T rtu_inc, uint16_T rtu_max, boolean_T rtu_rst, uint16_T *rty_cnt, DW_Counter_b *localDW) RAMFUNC_FOC;
+extern void either_edge(boolean_T rtu_u, boolean_T *rty_y, DW_either_edge *localDW) RAMFUNC_FOC;
+extern void Debounce_Filter(boolean_T rtu_u, uint16_T rtu_tAcv, uint16_T rtu_tDeacv, boolean_T *rty_y, DW_Debounce_Filter *localDW) RAMFUNC_FOC;
+extern void I_backCalc_fixdt(int16_T rtu_err, uint16_T rtu_I, uint16_T rtu_Kb, int16_T rtu_satMax, int16_T rtu_satMin, int16_T *rty_out, DW_I_backCalc_fixdt *localDW) RAMFUNC_FOC;
+extern void PI_clamp_fixdt(int16_T rtu_err, uint16_T rtu_P, uint16_T rtu_I, int32_T rtu_init, int16_T rtu_satMax, int16_T rtu_satMin, int32_T rtu_ext_limProt, int16_T *rty_out, DW_PI_clamp_fixdt *localDW) RAMFUNC_FOC;
+extern void PI_clamp_fixdt_l(int16_T rtu_err, uint16_T rtu_P, uint16_T rtu_I, int16_T rtu_init, int16_T rtu_satMax, int16_T rtu_satMin, int32_T rtu_ext_limProt, int16_T *rty_out, DW_PI_clamp_fixdt_m *localDW) RAMFUNC_FOC;
+extern void PI_clamp_fixdt_k(int16_T rtu_err, uint16_T rtu_P, uint16_T rtu_I, int16_T rtu_init, int16_T rtu_satMax, int16_T rtu_satMin, int32_T rtu_ext_limProt, int16_T *rty_out, DW_PI_clamp_fixdt_g *localDW) RAMFUNC_FOC;
+extern void BLDC_controller_step(RT_MODEL *const rtM) RAMFUNC_FOC;
+#endif
+
 uint8_T plook_u8s16_evencka(int16_T u, int16_T bp0, uint16_T bpSpace, uint32_T
   maxIndex)
 {
@@ -188,12 +233,181 @@ uint8_T plook_u8u16_evencka(uint16_T u, uint16_T bp0, uint16_T bpSpace, uint32_T
   return bpIndex;
 }
 
+/* Prelookup for a power of two breakpoint spacing: shift instead of divide (not generated, keep when re-generating
+ * the code). The macros below pick it at compile time when bpSpace is such a constant (the 128U electrical angle
+ * lookups), the other call sites keep the generated functions */
+#if defined(__GNUC__)
+static inline uint8_T plook_u8s16_evenckp(int16_T u, int16_T bp0, uint8_T bpShift, uint32_T maxIndex)
+{
+  uint16_T fbpIndex;
+  if (u <= bp0) {
+    return 0U;
+  }
+  fbpIndex = (uint16_T)((uint16_T)(u - bp0) >> bpShift);
+  return (uint8_T)(fbpIndex < maxIndex ? fbpIndex : maxIndex);
+}
+
+static inline uint8_T plook_u8u16_evenckp(uint16_T u, uint16_T bp0, uint8_T bpShift, uint32_T maxIndex)
+{
+  uint16_T fbpIndex;
+  if (u <= bp0) {
+    return 0U;
+  }
+  fbpIndex = (uint16_T)((uint16_T)((uint32_T)u - bp0) >> bpShift);
+  return (uint8_T)(fbpIndex < maxIndex ? fbpIndex : maxIndex);
+}
+
+#define PLOOK_POW2(s)                  (__builtin_constant_p(s) && (s) != 0U && ((s) & ((s) - 1U)) == 0U)
+#define plook_u8s16_evencka(u, bp0, bpSpace, maxIndex) (PLOOK_POW2(bpSpace) ? \
+  plook_u8s16_evenckp((u), (bp0), (uint8_T)__builtin_ctz(bpSpace), (maxIndex)) : \
+  plook_u8s16_evencka((u), (bp0), (bpSpace), (maxIndex)))
+#define plook_u8u16_evencka(u, bp0, bpSpace, maxIndex) (PLOOK_POW2(bpSpace) ? \
+  plook_u8u16_evenckp((u), (bp0), (uint8_T)__builtin_ctz(bpSpace), (maxIndex)) : \
+  plook_u8u16_evencka((u), (bp0), (bpSpace), (maxIndex)))
+#endif
+
+/* sin and cos of the electrical angle for the Park transforms (not generated, keep when re-generating the code).
+ * Linear interpolation in the quarter wave table r_sinQuarter_Table (1 deg steps, fixdt(1,16,14)).
+ * a is the angle in fixdt(1,16,6) deg. r_sin_M1_Table / r_cos_M1_Table, which this replaces, are sampled
+ * at a + 30 deg in 2 deg steps without interpolation */
+#define SINCOS_QUARTER                 5760     /* 90 deg in fixdt(1,16,6) */
+
+static inline int16_T sinQuarter(int32_T x)     /* x in [0, SINCOS_QUARTER] */
+{
+  const int16_T *p = &rtConstP.r_sinQuarter_Table[x >> 6];
+  return (int16_T)(p[0] + (((p[1] - p[0]) * (x & 63)) >> 6));
+}
+
+static inline void sincos_interp(int16_T a, int16_T *rty_sin, int16_T *rty_cos)
+{
+  int32_T x = (int32_T)a + 30 * 64;
+  uint8_T q;
+  int16_T s;
+  int16_T c;
+  if (x < 0) {
+    x += 4 * SINCOS_QUARTER;
+  }
+
+  q = (uint8_T)((uint32_T)x / SINCOS_QUARTER);  /* constant divisor: multiply and shift */
+  x -= q * SINCOS_QUARTER;
+
+  s = sinQuarter(x);
+  c = sinQuarter(SINCOS_QUARTER - x);
+  switch (q & 3U) {
+   case 0:
+    *rty_sin = s;
+    *rty_cos = c;
+    break;
+
+   case 1:
+    *rty_sin = c;
+    *rty_cos = (int16_T)-s;
+    break;
+
+   case 2:
+    *rty_sin = (int16_T)-s;
+    *rty_cos = (int16_T)-c;
+    break;
+
+   default:
+    *rty_sin = (int16_T)-c;
+    *rty_cos = s;
+    break;
+  }
+}
+
+#if defined(CTRL_DSP)
+/* Paired Park products (not generated, keep when re-generating the code). x and y hold two int16 in the low and
+ * high halfword: smuad = x.lo y.lo + x.hi y.hi, smusd = x.lo y.lo - x.hi y.hi, one instruction each on a Cortex-M4
+ * (make MCU_TYPE=AT32F403), the same sums in plain C elsewhere. The sin / cos of the Park transforms are at most 2^14,
+ * so the sums do not overflow */
+#define PAIR16(lo, hi)                 ((uint32_T)(uint16_T)(lo) | ((uint32_T)(uint16_T)(hi) << 16))
+
+static inline int32_T smuad16(uint32_T x, uint32_T y)
+{
+#if defined(__ARM_FEATURE_DSP)
+  int32_T r;
+  __asm__ ("smuad %0, %1, %2" : "=r" (r) : "r" (x), "r" (y));
+  return r;
+#else
+  return (int16_T)x * (int16_T)y + (int16_T)(x >> 16) * (int16_T)(y >> 16);
+#endif
+}
+
+static inline int32_T smusd16(uint32_T x, uint32_T y)
+{
+#if defined(__ARM_FEATURE_DSP)
+  int32_T r;
+  __asm__ ("smusd %0, %1, %2" : "=r" (r) : "r" (x), "r" (y));
+  return r;
+#else
+  return (int16_T)x * (int16_T)y - (int16_T)(x >> 16) * (int16_T)(y >> 16);
+#endif
+}
+#endif
+
+/* Field weakening map (not generated, keep when re-generating the code): bilinear interpolation of
+ * r_fieldWeakMap_Table over the speed n = |n_mot| * r_fieldWeakMapSca and the input target r = |r_inpTgt|,
+ * both fixdt(1,16,4) and clipped to the last breakpoints. The caller limits the result to id_fieldWeakMax */
+static inline int16_T fieldWeakMap(int16_T n, int16_T r)
+{
+  const int16_T *t = rtConstP.r_fieldWeakMap_Table;
+  int32_T xn = n < ((FW_MAP_N - 1) << FW_MAP_N_SHIFT) ? n : ((FW_MAP_N - 1) << FW_MAP_N_SHIFT) - 1;
+  int32_T xr = r < ((FW_MAP_R - 1) << FW_MAP_R_SHIFT) ? r : ((FW_MAP_R - 1) << FW_MAP_R_SHIFT) - 1;
+  int32_T in = xn >> FW_MAP_N_SHIFT;
+  int32_T ir = xr >> FW_MAP_R_SHIFT;
+  int32_T fn = xn & ((1 << FW_MAP_N_SHIFT) - 1);
+  int32_T fr = xr & ((1 << FW_MAP_R_SHIFT) - 1);
+  const int16_T *p = &t[ir * FW_MAP_N + in];
+  int32_T lo = p[0] + (((p[1] - p[0]) * fn) >> FW_MAP_N_SHIFT);
+  int32_T hi = p[FW_MAP_N] + (((p[FW_MAP_N + 1] - p[FW_MAP_N]) * fn) >> FW_MAP_N_SHIFT);
+  return (int16_T)(lo + (((hi - lo) * fr) >> FW_MAP_R_SHIFT));
+}
+
+#if defined(SPD_FILT)
+/* Speed error filters of SPD_FILT (not generated, keep when re-generating the code): the notch and the low pass
+ * biquads of cf_nFilt (b0, b1, b2, a1, a2 in Q28, direct form I, b0 = 0 skips a stage) on the speed error e
+ * [fixdt(1,16,4)]. The signals between and in the states carry 8 more fraction bits, so the rounding of the poles
+ * close to the unit circle stays below the input resolution. Returns the filtered error, saturated like e */
+static inline int32_T spdErrFilt(const int32_T c[10], int32_T s[8], int32_T e)
+{
+  int32_T x = e << 8;
+  for (uint8_T k = 0U; k < 2U; k++, c += 5, s += 4) {
+    if (c[0] != 0) {
+      int64_T acc = (int64_T)c[0] * x + (int64_T)c[1] * s[0] + (int64_T)c[2] * s[1] -
+                    (int64_T)c[3] * s[2] - (int64_T)c[4] * s[3];
+      acc  >>= 28;
+      s[1] = s[0];
+      s[0] = x;
+      s[3] = s[2];
+      s[2] = (int32_T)(acc > (32767 << 8) ? (32767 << 8) : acc < (-32768 * 256) ? (-32768 * 256) : acc);
+      x    = s[2];
+    }
+  }
+  return (x + 128) >> 8;
+}
+#endif
+
 int32_T div_nde_s32_floor(int32_T numerator, int32_T denominator)
 {
   return (((numerator < 0) != (denominator < 0)) && (numerator % denominator !=
            0) ? -1 : 0) + numerator / denominator;
 }
 
+#if defined(__GNUC__)
+/* Floor division by a positive constant, used to wrap the electrical angle to one period
+ * (not generated, keep when re-generating the code). Inlined, the compiler replaces the division by a
+ * multiply and shift and the remainder comes from q * d, instead of a call doing a division and a modulo */
+static inline int32_T div_nde_s32_floor_k(int32_T numerator, int32_T denominator)
+{
+  int32_T q = numerator / denominator;
+  return q - (numerator - q * denominator < 0);
+}
+
+#define div_nde_s32_floor(numerator, denominator) ((__builtin_constant_p(denominator) && (denominator) > 0) ? \
+  div_nde_s32_floor_k((numerator), (denominator)) : div_nde_s32_floor((numerator), (denominator)))
+#endif
+
 /* System initialize for atomic system: '<S13>/Counter' */
 void Counter_Init(DW_Counter *localDW, int16_T rtp_z_cntInit)
 {
@@ -1008,7 +1222,9 @@ void BLDC_controller_step(RT_MODEL *const rtM)
   boolean_T rtb_LogicalOperator;
   int8_T rtb_Sum2_h;
   boolean_T rtb_RelationalOperator4_d;
+#if !defined(CTRL_MULTIRATE)
   boolean_T rtb_UnitDelay5_e;
+#endif
   uint8_T rtb_a_elecAngle_XA_g;
   boolean_T rtb_LogicalOperator1_j;
   boolean_T rtb_LogicalOperator2_p;
@@ -1257,8 +1473,10 @@ void BLDC_controller_step(RT_MODEL *const rtM)
   /* UnitDelay: '<S2>/UnitDelay2' */
   rtb_RelationalOperator4_d = rtDW->UnitDelay2_DSTATE_c;
 
+#if !defined(CTRL_MULTIRATE)
   /* UnitDelay: '<S2>/UnitDelay5' */
   rtb_UnitDelay5_e = rtDW->UnitDelay5_DSTATE_m;
+#endif
 
   /* DataTypeConversion: '<S1>/Data Type Conversion2' incorporates:
    *  Inport: '<Root>/r_inpTgt'
@@ -1367,6 +1585,45 @@ void BLDC_controller_step(RT_MODEL *const rtM)
      */
     rtb_Merge_m = (int16_T)((15 * rtb_Merge_m) >> 4);
 
+#if defined(HALL_CALIB)
+    /* Measured hall edge angles (not generated, keep when re-generating the code):
+     * start at the corrected angle of the last edge and interpolate with the time
+     * and the corrected width of the previous position, up to the next edge. The
+     * counter is not limited to the previous time here, the next edge limits */
+    {
+      int16_T k = rtb_Sum2_h;
+      int16_T d = rtDW->Switch2_e;
+      int16_T ce = rtP->a_hallCorr[k % 6];
+      int16_T cb = rtP->a_hallCorr[(k - d + 6) % 6];
+      int16_T cn = rtP->a_hallCorr[(k + d + 6) % 6];
+      int32_T f = 0;
+      int32_T m;
+      int32_T lim;
+      if (rtb_LogicalOperator) {
+        f = rtb_Switch1_l;
+        if (f > 2 * rtDW->z_counterRawPrev) {
+          f = 2 * rtDW->z_counterRawPrev;
+        }
+
+        f = f * (3840 + d * (ce - cb)) / rtDW->z_counterRawPrev;
+      }
+
+      m = k * 3840 + ce + d * f;
+      lim = (k + d) * 3840 + cn;
+      if (d * (m - lim) > 0) {
+        m = lim;
+      }
+
+      if (m < 0) {
+        m += 23040;
+      } else if (m >= 23040) {
+        m -= 23040;
+      }
+
+      rtb_Merge_m = (int16_T)m;
+    }
+#endif
+
     /* End of Outputs for SubSystem: '<S3>/F01_05_Electrical_Angle_Estimation' */
   } else {
     /* Outputs for IfAction SubSystem: '<S3>/F01_06_Electrical_Angle_Measurement' incorporates:
@@ -1399,7 +1656,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
    */
   rtb_Sum2_h = rtDW->If1_ActiveSubsystem;
   UnitDelay3 = -1;
-  if (rtP->z_ctrlTypSel == 2) {
+  if (CTRL_TYP(rtP) == 2) {
     UnitDelay3 = 0;
   }
 
@@ -1538,14 +1795,9 @@ void BLDC_controller_step(RT_MODEL *const rtM)
 
     /* End of If: '<S49>/If1' */
 
-    /* PreLookup: '<S52>/a_elecAngle_XA' */
-    rtb_a_elecAngle_XA_g = plook_u8s16_evencka(rtb_Merge_m, 0, 128U, 180U);
-
-    /* Interpolation_n-D: '<S52>/r_sin_M1' */
-    rtDW->r_sin_M1 = rtConstP.r_sin_M1_Table[rtb_a_elecAngle_XA_g];
-
-    /* Interpolation_n-D: '<S52>/r_cos_M1' */
-    rtDW->r_cos_M1 = rtConstP.r_cos_M1_Table[rtb_a_elecAngle_XA_g];
+    /* Electrical angle sin and cos, replaces PreLookup: '<S52>/a_elecAngle_XA' and
+     * Interpolation_n-D: '<S52>/r_sin_M1', '<S52>/r_cos_M1' */
+    sincos_interp(rtb_Merge_m, &rtDW->r_sin_M1, &rtDW->r_cos_M1);
 
     /* If: '<S45>/If2' incorporates:
      *  Constant: '<S50>/cf_currFilt'
@@ -1589,8 +1841,13 @@ void BLDC_controller_step(RT_MODEL *const rtM)
        *  Product: '<S51>/Divide1'
        *  Product: '<S51>/Divide4'
        */
+#if defined(CTRL_DSP)
+      rtb_Gain3 = smusd16(PAIR16(rtb_Merge1, rtb_Saturation), PAIR16(rtDW->r_cos_M1,
+        rtDW->r_sin_M1)) >> 14;
+#else
       rtb_Gain3 = (int16_T)((rtb_Merge1 * rtDW->r_cos_M1) >> 14) - (int16_T)
         ((rtb_Saturation * rtDW->r_sin_M1) >> 14);
+#endif
       if (rtb_Gain3 > 32767) {
         rtb_Gain3 = 32767;
       } else {
@@ -1613,8 +1870,13 @@ void BLDC_controller_step(RT_MODEL *const rtM)
        *  Product: '<S51>/Divide2'
        *  Product: '<S51>/Divide3'
        */
+#if defined(CTRL_DSP)
+      rtb_Gain3 = smuad16(PAIR16(rtb_Merge1, rtb_Saturation), PAIR16(rtDW->r_sin_M1,
+        rtDW->r_cos_M1)) >> 14;
+#else
       rtb_Gain3 = (int16_T)((rtb_Saturation * rtDW->r_cos_M1) >> 14) + (int16_T)
         ((rtb_Merge1 * rtDW->r_sin_M1) >> 14);
+#endif
       if (rtb_Gain3 > 32767) {
         rtb_Gain3 = 32767;
       } else {
@@ -1770,7 +2032,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
      *  RelationalOperator: '<S31>/Relational Operator10'
      */
     rtb_RelationalOperator1_mv = (rtDW->Merge_p || (!rtU->b_motEna) ||
-      (rtU->z_ctrlModReq == 0));
+      (CTRL_MOD(rtU) == 0));
 
     /* Logic: '<S31>/Logical Operator1' incorporates:
      *  Constant: '<S1>/b_cruiseCtrlEna'
@@ -1778,7 +2040,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
      *  Inport: '<Root>/z_ctrlModReq'
      *  RelationalOperator: '<S31>/Relational Operator1'
      */
-    rtb_LogicalOperator1_j = ((rtU->z_ctrlModReq == 2) || rtP->b_cruiseCtrlEna);
+    rtb_LogicalOperator1_j = ((CTRL_MOD(rtU) == 2) || rtP->b_cruiseCtrlEna);
 
     /* Logic: '<S31>/Logical Operator2' incorporates:
      *  Constant: '<S1>/b_cruiseCtrlEna'
@@ -1787,7 +2049,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
      *  Logic: '<S31>/Logical Operator5'
      *  RelationalOperator: '<S31>/Relational Operator4'
      */
-    rtb_LogicalOperator2_p = ((rtU->z_ctrlModReq == 3) && (!rtP->b_cruiseCtrlEna));
+    rtb_LogicalOperator2_p = ((CTRL_MOD(rtU) == 3) && (!rtP->b_cruiseCtrlEna));
 
     /* Chart: '<S5>/F03_02_Control_Mode_Manager' incorporates:
      *  Constant: '<S31>/constant5'
@@ -1856,7 +2118,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
       }
     } else {
       rtDW->z_ctrlMod = OPEN_MODE;
-      if ((!rtb_RelationalOperator1_mv) && ((rtU->z_ctrlModReq == 1) ||
+      if ((!rtb_RelationalOperator1_mv) && ((CTRL_MOD(rtU) == 1) ||
            rtb_LogicalOperator1_j || rtb_LogicalOperator2_p)) {
         rtDW->is_c1_BLDC_controller = IN_ACTIVE;
         if (rtb_LogicalOperator2_p) {
@@ -1879,7 +2141,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
      *  Inport: '<S34>/r_inpTgt'
      *  Saturate: '<S33>/Saturation'
      */
-    if (rtP->z_ctrlTypSel == 2) {
+    if (CTRL_TYP(rtP) == 2) {
       /* Outputs for IfAction SubSystem: '<S33>/FOC_Control_Type' incorporates:
        *  ActionPort: '<S36>/Action Port'
        */
@@ -1913,7 +2175,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
        *  Product: '<S36>/Divide4'
        *  Selector: '<S36>/Selector'
        */
-      rtb_Saturation = (int16_T)(((uint16_T)((tmp[rtU->z_ctrlModReq] << 5) / 125)
+      rtb_Saturation = (int16_T)(((uint16_T)((tmp[CTRL_MOD(rtU)] << 5) / 125)
         * DataTypeConversion2) >> 12);
 
       /* End of Outputs for SubSystem: '<S33>/FOC_Control_Type' */
@@ -2185,7 +2447,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
        *  Constant: '<S42>/id_fieldWeakMax'
        *  RelationalOperator: '<S42>/Relational Operator1'
        */
-      if (rtP->z_ctrlTypSel == 2) {
+      if (CTRL_TYP(rtP) == 2) {
         rtb_Saturation1 = rtP->id_fieldWeakMax;
       } else {
         rtb_Saturation1 = rtP->a_phaAdvMax;
@@ -2196,6 +2458,17 @@ void BLDC_controller_step(RT_MODEL *const rtM)
       /* Product: '<S42>/Divide3' */
       rtDW->Divide3 = (int16_T)((rtb_Saturation1 * rtb_Divide14_e) >> 15);
 
+      /* FI_WEAK_ENA 2, FOC: d axis current from the field weakening map instead of the
+       * linear blending (not generated, keep when re-generating the code) */
+      if ((rtP->b_fieldWeakEna == 2) && (CTRL_TYP(rtP) == 2)) {
+        int32_T n = ((int32_T)Abs5 * rtP->r_fieldWeakMapSca) >> 12;
+        rtDW->Divide3 = fieldWeakMap((int16_T)(n < 32767 ? n : 32767), (int16_T)
+          (rtU->r_inpTgt < 0 ? -rtU->r_inpTgt << 4 : rtU->r_inpTgt << 4));
+        if (rtDW->Divide3 > rtP->id_fieldWeakMax) {
+          rtDW->Divide3 = rtP->id_fieldWeakMax;
+        }
+      }
+
       /* End of Outputs for SubSystem: '<S6>/Field_Weakening_Enabled' */
     }
 
@@ -2210,7 +2483,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
      */
     rtb_Sum2_h = rtDW->If1_ActiveSubsystem_o;
     UnitDelay3 = -1;
-    if (rtP->z_ctrlTypSel == 2) {
+    if (CTRL_TYP(rtP) == 2) {
       UnitDelay3 = 0;
     }
 
@@ -2424,15 +2697,22 @@ void BLDC_controller_step(RT_MODEL *const rtM)
 
     /* End of If: '<S48>/If1' */
     /* End of Outputs for SubSystem: '<S7>/Motor_Limitations' */
+#if defined(CTRL_MULTIRATE)
+  }
+
+  {
+    {
+#else
   } else {
     if (rtDW->UnitDelay6_DSTATE) {
+#endif
       /* Outputs for Function Call SubSystem: '<S7>/FOC' */
       /* If: '<S47>/If1' incorporates:
        *  Constant: '<S1>/z_ctrlTypSel'
        */
       rtb_Sum2_h = rtDW->If1_ActiveSubsystem_j;
       UnitDelay3 = -1;
-      if (rtP->z_ctrlTypSel == 2) {
+      if (CTRL_TYP(rtP) == 2) {
         UnitDelay3 = 0;
       }
 
@@ -2539,6 +2819,12 @@ void BLDC_controller_step(RT_MODEL *const rtM)
 
             /* SystemReset for SwitchCase: '<S59>/Switch Case' */
             PI_clamp_fixdt_b_Reset(&rtDW->PI_clamp_fixdt_l4);
+#if defined(SPD_FILT)
+            /* Speed error filter states (not generated, keep when re-generating the code) */
+            for (uint8_T k = 0U; k < 8U; k++) {
+              rtDW->n_errFiltState[k] = 0;
+            }
+#endif
 
             /* End of SystemReset for SubSystem: '<S61>/PI_clamp_fixdt' */
 
@@ -2611,12 +2897,20 @@ void BLDC_controller_step(RT_MODEL *const rtM)
             }
           }
 
+#if defined(SPD_FILT)
+          /* Speed error filters (not generated, keep when re-generating the code): SPD_FILT notch and low pass */
+          rtb_Gain3 = spdErrFilt(rtP->cf_nFilt, rtDW->n_errFiltState, rtb_Gain3);
+#endif
+
           /* Outputs for Atomic SubSystem: '<S61>/PI_clamp_fixdt' */
+          /* Voltage feedforward Vq_ff (not generated, keep when re-generating the code): the PI works
+           * around it within the same limits, Vq_ff = 0 is the generated behaviour */
           PI_clamp_fixdt_l((int16_T)rtb_Gain3, rtP->cf_nKp, rtP->cf_nKi,
-                           rtDW->UnitDelay4_DSTATE_eu,
-                           rtb_TmpSignalConversionAtLow_Pa[0],
-                           rtb_TmpSignalConversionAtLow_Pa[1], rtDW->Divide1,
+                           (int16_T)(rtDW->UnitDelay4_DSTATE_eu - rtU->Vq_ff),
+                           (int16_T)(rtb_TmpSignalConversionAtLow_Pa[0] - rtU->Vq_ff),
+                           (int16_T)(rtb_TmpSignalConversionAtLow_Pa[1] - rtU->Vq_ff), rtDW->Divide1,
                            &rtDW->Merge, &rtDW->PI_clamp_fixdt_l4);
+          rtDW->Merge = (int16_T)(rtDW->Merge + rtU->Vq_ff);
 
           /* End of Outputs for SubSystem: '<S61>/PI_clamp_fixdt' */
 
@@ -2696,10 +2990,14 @@ void BLDC_controller_step(RT_MODEL *const rtM)
            *  Sum: '<S62>/Sum2'
            *  UnitDelay: '<S8>/UnitDelay4'
            */
+          /* Decoupling voltage Vq_dec (not generated, keep when re-generating the code): back-EMF and
+           * cross coupling, the PI works around it like Vq_ff, Vq_dec = 0 is the generated behaviour */
           PI_clamp_fixdt_k((int16_T)rtb_Gain3, rtP->cf_iqKp, rtP->cf_iqKi,
-                           rtDW->UnitDelay4_DSTATE_eu, rtb_Saturation1,
-                           rtb_Saturation, 0, &rtDW->Merge,
+                           (int16_T)(rtDW->UnitDelay4_DSTATE_eu - rtU->Vq_dec),
+                           (int16_T)(rtb_Saturation1 - rtU->Vq_dec),
+                           (int16_T)(rtb_Saturation - rtU->Vq_dec), 0, &rtDW->Merge,
                            &rtDW->PI_clamp_fixdt_kh);
+          rtDW->Merge = (int16_T)(rtDW->Merge + rtU->Vq_dec);
 
           /* End of Outputs for SubSystem: '<S62>/PI_clamp_fixdt' */
 
@@ -2752,7 +3050,9 @@ void BLDC_controller_step(RT_MODEL *const rtM)
            *  ActionPort: '<S63>/Action Port'
            */
           /* Gain: '<S63>/toNegative' */
-          rtb_Saturation = (int16_T)-rtDW->Divide3;
+          /* Injected current id_inj (not generated, keep when re-generating the code): the resistance measurement
+           * of WINDING_TEMP at standstill, id_inj = 0 is the generated behaviour */
+          rtb_Saturation = (int16_T)(rtU->id_inj - rtDW->Divide3);
 
           /* Switch: '<S75>/Switch2' incorporates:
            *  RelationalOperator: '<S75>/LowerRelop1'
@@ -2781,9 +3081,13 @@ void BLDC_controller_step(RT_MODEL *const rtM)
           }
 
           /* Outputs for Atomic SubSystem: '<S63>/PI_clamp_fixdt' */
-          PI_clamp_fixdt((int16_T)rtb_Gain3, rtP->cf_idKp, rtP->cf_idKi, 0,
-                         rtDW->Vd_max1, rtDW->Gain3, 0, &rtDW->Switch1,
+          /* Decoupling voltage Vd_dec (not generated, keep when re-generating the code): cross coupling,
+           * the PI works around it within the same limits, Vd_dec = 0 is the generated behaviour */
+          PI_clamp_fixdt((int16_T)rtb_Gain3, rtP->cf_idKp, rtP->cf_idKi, -rtU->Vd_dec,
+                         (int16_T)(rtDW->Vd_max1 - rtU->Vd_dec),
+                         (int16_T)(rtDW->Gain3 - rtU->Vd_dec), 0, &rtDW->Switch1,
                          &rtDW->PI_clamp_fixdt_i);
+          rtDW->Switch1 = (int16_T)(rtDW->Switch1 + rtU->Vd_dec);
 
           /* End of Outputs for SubSystem: '<S63>/PI_clamp_fixdt' */
 
@@ -2809,7 +3113,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
    */
   rtb_Sum2_h = rtDW->If2_ActiveSubsystem;
   UnitDelay3 = -1;
-  if (rtP->z_ctrlTypSel == 2) {
+  if (CTRL_TYP(rtP) == 2) {
     rtb_Saturation = rtDW->Merge;
     UnitDelay3 = 0;
   } else {
@@ -2825,6 +3129,15 @@ void BLDC_controller_step(RT_MODEL *const rtM)
   }
 
   if (UnitDelay3 == 0) {
+    int16_T r_sinAdv = rtDW->r_sin_M1;
+    int16_T r_cosAdv = rtDW->r_cos_M1;
+
+    /* Angle advance a_elecAdv (not generated, keep when re-generating the code): the voltage is applied at
+     * the angle the rotor has when the duties take effect, a_elecAdv = 0 is the generated behaviour */
+    if (rtU->a_elecAdv != 0) {
+      sincos_interp((int16_T)(rtb_Merge_m + rtU->a_elecAdv), &r_sinAdv, &r_cosAdv);
+    }
+
     /* Outputs for IfAction SubSystem: '<S7>/Clarke_Park_Transform_Inverse' incorporates:
      *  ActionPort: '<S46>/Action Port'
      */
@@ -2832,8 +3145,12 @@ void BLDC_controller_step(RT_MODEL *const rtM)
      *  Product: '<S58>/Divide1'
      *  Product: '<S58>/Divide4'
      */
-    rtb_Gain3 = (int16_T)((rtDW->Switch1 * rtDW->r_cos_M1) >> 14) - (int16_T)
-      ((rtDW->Merge * rtDW->r_sin_M1) >> 14);
+#if defined(CTRL_DSP)
+    rtb_Gain3 = smusd16(PAIR16(rtDW->Switch1, rtDW->Merge), PAIR16(r_cosAdv, r_sinAdv)) >> 14;
+#else
+    rtb_Gain3 = (int16_T)((rtDW->Switch1 * r_cosAdv) >> 14) - (int16_T)
+      ((rtDW->Merge * r_sinAdv) >> 14);
+#endif
     if (rtb_Gain3 > 32767) {
       rtb_Gain3 = 32767;
     } else {
@@ -2846,8 +3163,12 @@ void BLDC_controller_step(RT_MODEL *const rtM)
      *  Product: '<S58>/Divide2'
      *  Product: '<S58>/Divide3'
      */
-    rtb_Sum1_jt = (int16_T)((rtDW->Switch1 * rtDW->r_sin_M1) >> 14) + (int16_T)
-      ((rtDW->Merge * rtDW->r_cos_M1) >> 14);
+#if defined(CTRL_DSP)
+    rtb_Sum1_jt = smuad16(PAIR16(rtDW->Switch1, rtDW->Merge), PAIR16(r_sinAdv, r_cosAdv)) >> 14;
+#else
+    rtb_Sum1_jt = (int16_T)((rtDW->Switch1 * r_sinAdv) >> 14) + (int16_T)
+      ((rtDW->Merge * r_cosAdv) >> 14);
+#endif
     if (rtb_Sum1_jt > 32767) {
       rtb_Sum1_jt = 32767;
     } else {
@@ -3007,7 +3328,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
    * About '<S94>/z_commutMap_M1':
    *  2-dimensional Direct Look-Up returning a Column
    */
-  if (rtb_LogicalOperator && (rtP->z_ctrlTypSel == 2)) {
+  if (rtb_LogicalOperator && (CTRL_TYP(rtP) == 2)) {
     /* Outputs for IfAction SubSystem: '<S8>/FOC_Method' incorporates:
      *  ActionPort: '<S95>/Action Port'
      */
@@ -3016,7 +3337,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
     rtb_Merge1 = rtDW->Gain4_e[2];
 
     /* End of Outputs for SubSystem: '<S8>/FOC_Method' */
-  } else if (rtb_LogicalOperator && (rtP->z_ctrlTypSel == 1)) {
+  } else if (rtb_LogicalOperator && (CTRL_TYP(rtP) == 1)) {
     /* Outputs for IfAction SubSystem: '<S8>/SIN_Method' incorporates:
      *  ActionPort: '<S96>/Action Port'
      */
@@ -3143,6 +3464,12 @@ void BLDC_controller_step(RT_MODEL *const rtM)
   /* Update for UnitDelay: '<S13>/UnitDelay4' */
   rtDW->UnitDelay4_DSTATE_e = Abs5;
 
+#if defined(CTRL_MULTIRATE)
+  /* Update for Chart: '<S1>/Task_Scheduler', multi-rate */
+  rtDW->z_taskCnt = (uint8_T)(rtDW->z_taskCnt + 1U < CTRL_SLOW_DIV ? rtDW->z_taskCnt + 1U : 0U);
+  rtDW->UnitDelay2_DSTATE_c = TASK_SLOW_A(rtDW->z_taskCnt);
+  rtDW->UnitDelay5_DSTATE_m = TASK_SLOW_B(rtDW->z_taskCnt);
+#else
   /* Update for UnitDelay: '<S2>/UnitDelay2' incorporates:
    *  UnitDelay: '<S2>/UnitDelay6'
    */
@@ -3153,6 +3480,7 @@ void BLDC_controller_step(RT_MODEL *const rtM)
 
   /* Update for UnitDelay: '<S2>/UnitDelay6' */
   rtDW->UnitDelay6_DSTATE = rtb_UnitDelay5_e;
+#endif
 
   /* Update for UnitDelay: '<S8>/UnitDelay4' */
   rtDW->UnitDelay4_DSTATE_eu = rtb_Saturation;
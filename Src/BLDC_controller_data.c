@@ -19,49 +19,39 @@
 
 #include "BLDC_controller.h"
 
+/* Placed in SRAM with FLASH_SAFE_WRITE, the controller reads it while the flash is programmed (not generated, keep when re-generating the code) */
+#if defined(FLASH_SAFE_WRITE) && defined(__GNUC__)
+#define RAMCONST_FOC __attribute__((section(".ramfunc.rodata")))
+#else
+#define RAMCONST_FOC
+#endif
+
 /* Constant parameters (auto storage) */
-const ConstP rtConstP = {
-  /* Computed Parameter: r_sin_M1_Table
-   * Referenced by: '<S52>/r_sin_M1'
-   */
-  { 8192, 8682, 9162, 9630, 10087, 10531, 10963, 11381, 11786, 12176, 12551,
-    12911, 13255, 13583, 13894, 14189, 14466, 14726, 14968, 15191, 15396, 15582,
-    15749, 15897, 16026, 16135, 16225, 16294, 16344, 16374, 16384, 16374, 16344,
-    16294, 16225, 16135, 16026, 15897, 15749, 15582, 15396, 15191, 14968, 14726,
-    14466, 14189, 13894, 13583, 13255, 12911, 12551, 12176, 11786, 11381, 10963,
-    10531, 10087, 9630, 9162, 8682, 8192, 7692, 7182, 6664, 6138, 5604, 5063,
-    4516, 3964, 3406, 2845, 2280, 1713, 1143, 572, 0, -572, -1143, -1713, -2280,
-    -2845, -3406, -3964, -4516, -5063, -5604, -6138, -6664, -7182, -7692, -8192,
-    -8682, -9162, -9630, -10087, -10531, -10963, -11381, -11786, -12176, -12551,
-    -12911, -13255, -13583, -13894, -14189, -14466, -14726, -14968, -15191,
-    -15396, -15582, -15749, -15897, -16026, -16135, -16225, -16294, -16344,
-    -16374, -16384, -16374, -16344, -16294, -16225, -16135, -16026, -15897,
-    -15749, -15582, -15396, -15191, -14968, -14726, -14466, -14189, -13894,
-    -13583, -13255, -12911, -12551, -12176, -11786, -11381, -10963, -10531,
-    -10087, -9630, -9162, -8682, -8192, -7692, -7182, -6664, -6138, -5604, -5063,
-    -4516, -3964, -3406, -2845, -2280, -1713, -1143, -572, 0, 572, 1143, 1713,
-    2280, 2845, 3406, 3964, 4516, 5063, 5604, 6138, 6664, 7182, 7692, 8192 },
-
-  /* Computed Parameter: r_cos_M1_Table
-   * Referenced by: '<S52>/r_cos_M1'
-   */
-  { 14189, 13894, 13583, 13255, 12911, 12551, 12176, 11786, 11381, 10963, 10531,
-    10087, 9630, 9162, 8682, 8192, 7692, 7182, 6664, 6138, 5604, 5063, 4516,
-    3964, 3406, 2845, 2280, 1713, 1143, 572, 0, -572, -1143, -1713, -2280, -2845,
-    -3406, -3964, -4516, -5063, -5604, -6138, -6664, -7182, -7692, -8192, -8682,
-    -9162, -9630, -10087, -10531, -10963, -11381, -11786, -12176, -12551, -12911,
-    -13255, -13583, -13894, -14189, -14466, -14726, -14968, -15191, -15396,
-    -15582, -15749, -15897, -16026, -16135, -16225, -16294, -16344, -16374,
-    -16384, -16374, -16344, -16294, -16225, -16135, -16026, -15897, -15749,
-    -15582, -15396, -15191, -14968, -14726, -14466, -14189, -13894, -13583,
-    -13255, -12911, -12551, -12176, -11786, -11381, -10963, -10531, -10087,
-    -9630, -9162, -8682, -8192, -7692, -7182, -6664, -6138, -5604, -5063, -4516,
-    -3964, -3406, -2845, -2280, -1713, -1143, -572, 0, 572, 1143, 1713, 2280,
-    2845, 3406, 3964, 4516, 5063, 5604, 6138, 6664, 7182, 7692, 8192, 8682, 9162,
-    9630, 10087, 10531, 10963, 11381, 11786, 12176, 12551, 12911, 13255, 13583,
-    13894, 14189, 14466, 14726, 14968, 15191, 15396, 15582, 15749, 15897, 16026,
-    16135, 16225, 16294, 16344, 16374, 16384, 16374, 16344, 16294, 16225, 16135,
-    16026, 15897, 15749, 15582, 15396, 15191, 14968, 14726, 14466, 14189 },
+const ConstP rtConstP RAMCONST_FOC = {
+  /* sin(0..91 deg) for the Park transforms, see BLDC_controller.h
+   */
+  { 0, 286, 572, 857, 1143, 1428, 1713, 1997, 2280, 2563, 2845, 3126, 3406,
+    3686, 3964, 4240, 4516, 4790, 5063, 5334, 5604, 5872, 6138, 6402, 6664,
+    6924, 7182, 7438, 7692, 7943, 8192, 8438, 8682, 8923, 9162, 9397, 9630,
+    9860, 10087, 10311, 10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982,
+    12176, 12365, 12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894,
+    14044, 14189, 14330, 14466, 14598, 14726, 14849, 14968, 15082, 15191, 15296,
+    15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083, 16135,
+    16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382, 16384,
+    16382 },
+
+  /* r_fieldWeakMap_Table, host/sil -w: R 0.12, L 0.00025, Ke 0.38, i_max 20, fi_weak_max 10
+   */
+  { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 264, 5736, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 3304, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    480, 6880, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    4480, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1040,
+    8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000, 8000 },
 
   /* Computed Parameter: r_sin3PhaA_M1_Table
    * Referenced by: '<S96>/r_sin3PhaA_M1'
@@ -376,7 +366,16 @@ P rtP_Left = {
    *   '<S6>/b_fieldWeakEna'
    *   '<S97>/b_fieldWeakEna'
    */
-  0
+  0,
+
+  /* a_hallCorr, set by the hall calibration (not generated, keep when re-generating the code) */
+  { 0, 0, 0, 0, 0, 0 },
+
+  /* r_fieldWeakMapSca, 1.0 (not generated, keep when re-generating the code) */
+  4096U,
+
+  /* cf_nFilt, both stages skipped (not generated, keep when re-generating the code) */
+  { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
 };                                     /* Modifiable parameters */
 
 /*
@@ -0,0 +1,93 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Anti-lock braking (ANTILOCK_BRAKE). Only uses config.h, so it also builds on the host.
+//
+// Both wheels carry the same vehicle, so while both grip they decelerate alike, also in a curve where their speeds
+// differ by a fixed ratio. A wheel that starts to lock on a slippery patch falls behind within a few ms: its
+// deceleration exceeds the one of the other wheel by more than ANTILOCK_DECEL. Its braking torque is then released at
+// ANTILOCK_RELEASE per ms and held off until its speed is back within ANTILOCK_SLIP of the other wheel, then applied
+// again at ANTILOCK_APPLY per second. The other wheel keeps its full braking torque. Below ANTILOCK_N_MIN of the faster
+// wheel the vehicle is stopping anyway and the full torque stays on.
+// Braking means a command against the last direction of motion of the wheel, so a locked wheel at 0 rpm still counts.
+
+#include <stdint.h>
+#include "config.h"
+#include "antilock.h"
+
+#if defined(ANTILOCK_BRAKE)
+
+#define ANTILOCK_FILT_SHIFT     3                                                   // [-] deceleration filter, EMA over 8 ms
+#define ANTILOCK_RELEASE_STEP   ((int32_t)ANTILOCK_FAC_ONE * ANTILOCK_RELEASE / 100)     // [Q15 per ms]
+#define ANTILOCK_APPLY_STEP     ((int32_t)ANTILOCK_FAC_ONE * ANTILOCK_APPLY / 100000)    // [Q15 per ms]
+
+void antilockInit(Antilock *a) {
+  for (uint8_t m = 0; m < 2; m++) {
+    a->w[m].nAbs  = 0;
+    a->w[m].dir   = 0;
+    a->w[m].slip  = 0;
+    a->w[m].decel = 0;
+    a->w[m].fac   = ANTILOCK_FAC_ONE;
+  }
+  a->events = 0;
+}
+
+/* One update every 1 ms with the motor speeds n [rpm] and the TORQUE mode commands, 0 in the other modes */
+void antilockStep(Antilock *a, int16_t nL, int16_t nR, int16_t cmdL, int16_t cmdR) {
+  const int16_t n[2]   = {nL, nR};
+  const int16_t cmd[2] = {cmdL, cmdR};
+
+  for (uint8_t m = 0; m < 2; m++) {
+    AntilockWheel *w = &a->w[m];
+    int16_t nAbs = (n[m] < 0) ? -n[m] : n[m];
+    w->decel += ((int32_t)(w->nAbs - nAbs) * 1000 - w->decel) >> ANTILOCK_FILT_SHIFT;
+    w->nAbs   = nAbs;
+    if (n[m] != 0) {
+      w->dir = (n[m] > 0) ? 1 : -1;
+    }
+  }
+
+  for (uint8_t m = 0; m < 2; m++) {
+    AntilockWheel *w = &a->w[m];
+    const AntilockWheel *o = &a->w[1 - m];
+    uint8_t brake  = (cmd[m] > 0 && w->dir < 0) || (cmd[m] < 0 && w->dir > 0);
+    uint8_t moving = w->nAbs >= ANTILOCK_N_MIN || o->nAbs >= ANTILOCK_N_MIN;
+    uint8_t slip   = 0;
+    int32_t fac    = w->fac;
+
+    if (brake && moving) {
+      slip = (w->decel - o->decel > ANTILOCK_DECEL) ||
+             (w->slip && (int32_t)w->nAbs * 100 < (int32_t)o->nAbs * (100 - ANTILOCK_SLIP));
+    }
+    if (slip) {
+      if (!w->slip) {
+        a->events++;
+      }
+      fac -= ANTILOCK_RELEASE_STEP;
+      if (fac < 0) { fac = 0; }
+    } else if (!brake) {
+      fac = ANTILOCK_FAC_ONE;
+    } else {
+      fac += ANTILOCK_APPLY_STEP;
+      if (fac > ANTILOCK_FAC_ONE) { fac = ANTILOCK_FAC_ONE; }
+    }
+    w->slip = slip;
+    w->fac  = (uint16_t)fac;
+  }
+}
+
+#endif
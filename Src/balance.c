@@ -0,0 +1,82 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// On-board balance controller (BALANCE_CONTROL). Only uses config.h, so it also builds on the host.
+//
+// One PID per board half, run every millisecond by the balance task on the latest sideboard frame:
+//   trq = KP pitch + KD rate + KI sum(pitch)
+// pitch and dPitch are in the units of the sideboard firmware, the gains are Q8 torque per unit. rate is dPitch through a
+// first order low pass of 2^BALANCE_RATE_FILT ticks against the gyro noise. The output goes straight to the motor
+// controller in TRQ_MODE, the main loop rate limiter and filters are not used.
+// A half engages only when its rider is on (ok) and the pitch is within BALANCE_PITCH_START, then the gains ramp up
+// over BALANCE_RAMP ticks. Beyond BALANCE_PITCH_MAX (fallen over) or without a rider the torque drops to 0 at once.
+
+#include <stdint.h>
+#include "config.h"
+#include "balance.h"
+
+#if defined(BALANCE_CONTROL)
+
+void balanceInit(Balance *b) {
+  b->rate  = 0;
+  b->integ = 0;
+  b->ramp  = BALANCE_RAMP;
+  b->trq   = 0;
+  b->state = BAL_OFF;
+}
+
+/* One 1 ms step. ok = rider on and the sideboard data is fresh. Returns the torque target [-1000, 1000] */
+int16_t balanceStep(Balance *b, int16_t pitch, int16_t dPitch, uint8_t ok) {
+  int32_t trq;
+  int16_t absPitch = pitch < 0 ? -pitch : pitch;
+
+  b->rate += (((int32_t)dPitch << 8) - b->rate) >> BALANCE_RATE_FILT;
+
+  if (!ok || absPitch > BALANCE_PITCH_MAX) {
+    balanceInit(b);
+    b->rate = (int32_t)dPitch << 8;
+    return 0;
+  }
+  if (b->state == BAL_OFF) {
+    if (absPitch > BALANCE_PITCH_START) {
+      return 0;                         // wait until the board is about level
+    }
+    b->state = BAL_ON;
+  }
+
+  b->integ += (int32_t)BALANCE_KI * pitch;
+  if (b->integ > ((int32_t)BALANCE_TRQ_MAX << 8)) {
+    b->integ = (int32_t)BALANCE_TRQ_MAX << 8;
+  } else if (b->integ < -((int32_t)BALANCE_TRQ_MAX << 8)) {
+    b->integ = -((int32_t)BALANCE_TRQ_MAX << 8);
+  }
+  trq = ((int32_t)BALANCE_KP * pitch + ((BALANCE_KD * (b->rate >> 4)) >> 4) + b->integ) >> 8;
+
+  if (b->ramp) {
+    b->ramp--;
+    trq = trq * (BALANCE_RAMP - b->ramp) / BALANCE_RAMP;
+  }
+  if (trq > BALANCE_TRQ_MAX) {
+    trq = BALANCE_TRQ_MAX;
+  } else if (trq < -BALANCE_TRQ_MAX) {
+    trq = -BALANCE_TRQ_MAX;
+  }
+  b->trq = (int16_t)trq;
+  return b->trq;
+}
+
+#endif
@@ -0,0 +1,151 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Battery state of charge estimation (BAT_SOC_ENABLE). Only uses config.h, so it also builds on the host.
+//
+// The remaining charge is counted from the battery current, the sum of both DC link currents plus BAT_I_BOARD.
+// Counting alone drifts with the current offsets and a wrong BAT_CAPACITY, so the count is pulled towards the charge
+// of the open circuit voltage: the measured voltage plus the drop over the internal resistance, through a Li-ion
+// open circuit voltage curve. The pull is fast at rest, where that voltage is reliable, and very slow under load.
+// The internal resistance is learned from the voltage steps of current steps. When the sag compensated voltage stays
+// at the empty point of the curve, the battery is empty whatever the count says.
+
+#include <stdint.h>
+#include "config.h"
+#include "battery.h"
+
+#if defined(BAT_SOC_ENABLE)
+
+#define BAT_SOC_CAP         ((int32_t)BAT_CAPACITY * 3600)       // [mAs] full charge
+#define BAT_SOC_I_SHIFT     1                                     // [-] current filter, about the corner of the batVoltage filter
+#define BAT_SOC_R_PERIOD    100                                   // [ms] resistance sample period
+#define BAT_SOC_R_DI        300                                   // [A*100] minimum current step for a resistance sample
+#define BAT_SOC_R_MIN       20                                    // [mOhm] plausible internal resistance
+#define BAT_SOC_R_MAX       2000
+#define BAT_SOC_REST_CURR   50                                    // [A*100] below this the battery is at rest
+#define BAT_SOC_REST_MS     2000                                  // [ms] rest time before the fast correction
+#define BAT_SOC_PULL_REST   14                                    // [-] correction time constant 2^x ms at rest, 16 s
+#define BAT_SOC_PULL_LOAD   18                                    // [-] same under load, 4.4 min
+#define BAT_SOC_EMPTY_MS    2000                                  // [ms] time at the empty voltage for an empty battery
+#define BAT_SOC_RESYNC      100                                   // [0.1 %] saved charge to power on voltage mismatch that restarts the count
+
+// [V*100 per cell] Li-ion open circuit voltage at 0, 10, .. 100 % charge. 0 % is the default BAT_DEAD level
+static const int16_t batOcv[11] = {300, 345, 360, 368, 374, 379, 385, 392, 400, 408, 418};
+
+/* State of charge [0.1 %] of the open circuit battery voltage v [V*100] */
+static uint16_t batSocOcv(int16_t v) {
+  int32_t cell = (int32_t)v * 16 / BAT_CELLS;                     // [V*100 per cell, Q4]
+  if (cell <= batOcv[0] * 16) {
+    return 0;
+  }
+  for (uint8_t k = 1; k < 11; k++) {
+    if (cell < batOcv[k] * 16) {
+      return (uint16_t)((k - 1) * 100 + (cell - batOcv[k - 1] * 16) * 100 / ((batOcv[k] - batOcv[k - 1]) * 16));
+    }
+  }
+  return 1000;
+}
+
+/* Power on, the battery is at rest. stored / storedR are the saved batSocStored / rInt words, BAT_SOC_NONE if never saved */
+void batSocInit(BatSoc *b, int16_t vBat, uint16_t stored, uint16_t storedR) {
+  int32_t socV = batSocOcv(vBat);
+  b->charge     = socV * BAT_SOC_CAP / 1000;
+  if (stored != BAT_SOC_NONE && stored <= BAT_CAPACITY) {
+    int32_t socStored = (int32_t)stored * 1000 / BAT_CAPACITY;
+    if (socStored - socV <= BAT_SOC_RESYNC && socV - socStored <= BAT_SOC_RESYNC) {
+      b->charge = (int32_t)stored * 3600;                         // the count is better, unless the battery was charged or swapped
+    }
+  }
+  b->rInt       = (storedR >= BAT_SOC_R_MIN && storedR <= BAT_SOC_R_MAX) ? storedR : BAT_R_INT;
+  b->rest       = 0;
+  b->iFixdt     = 0;
+  b->vPrev      = vBat;
+  b->iPrev      = 0;
+  b->vOcv       = vBat;
+  b->soc        = (uint16_t)((int64_t)b->charge * 1000 / BAT_SOC_CAP);
+  b->ticks      = 0;
+  b->restTicks  = 0;
+  b->emptyTicks = 0;
+}
+
+/* One update every dt ms with the battery voltage vBat [V*100] and the DC link current iBat [A*100], positive = discharge */
+void batSocStep(BatSoc *b, int16_t vBat, int16_t iBat, uint16_t dt) {
+  int32_t i, socV, target;
+
+  // Coulomb counting of the unfiltered current, a filter would only delay the count
+  b->rest   += ((int32_t)iBat + BAT_I_BOARD) * dt;
+  b->charge -= b->rest / 100;                                     // A*100*ms to mAs
+  b->rest   %= 100;
+  if (b->charge < 0)           { b->charge = 0; }
+  if (b->charge > BAT_SOC_CAP) { b->charge = BAT_SOC_CAP; }
+
+  // Internal resistance from the voltage step of a current step, both filtered about the same
+  b->iFixdt += (((int32_t)iBat << 16) - b->iFixdt) >> BAT_SOC_I_SHIFT;
+  i          = (b->iFixdt >> 16) + BAT_I_BOARD;
+  b->ticks  += dt;
+  if (b->ticks >= BAT_SOC_R_PERIOD) {
+    int32_t di = i - b->iPrev;
+    if (di >= BAT_SOC_R_DI || di <= -BAT_SOC_R_DI) {
+      int32_t r = -((int32_t)vBat - b->vPrev) * 1000 / di;        // V*100 / A*100 to mOhm
+      if (r >= BAT_SOC_R_MIN && r <= BAT_SOC_R_MAX) {
+        b->rInt = (uint16_t)((int32_t)b->rInt + (r - (int32_t)b->rInt) / 8);
+      }
+    }
+    b->vPrev = vBat;
+    b->iPrev = (int16_t)i;
+    b->ticks = 0;
+  }
+
+  // Pull the count towards the charge of the sag compensated voltage
+  b->vOcv = (int16_t)(vBat + i * b->rInt / 1000);
+  socV    = batSocOcv(b->vOcv);
+  if (i < BAT_SOC_REST_CURR && i > -BAT_SOC_REST_CURR) {
+    b->restTicks = b->restTicks < BAT_SOC_REST_MS ? b->restTicks + dt : BAT_SOC_REST_MS;
+  } else {
+    b->restTicks = 0;
+  }
+  target     = socV * BAT_SOC_CAP / 1000;
+  b->charge += ((target - b->charge) / 16 * dt) >> ((b->restTicks >= BAT_SOC_REST_MS ? BAT_SOC_PULL_REST : BAT_SOC_PULL_LOAD) - 4);
+
+  if (socV == 0) {
+    b->emptyTicks = b->emptyTicks < BAT_SOC_EMPTY_MS ? b->emptyTicks + dt : BAT_SOC_EMPTY_MS;
+    if (b->emptyTicks >= BAT_SOC_EMPTY_MS) {
+      b->charge = 0;
+    }
+  } else {
+    b->emptyTicks = 0;
+  }
+  b->soc = (uint16_t)((int64_t)b->charge * 1000 / BAT_SOC_CAP);
+}
+
+/* Battery level for the LEDs, beeps and the undervoltage poweroff, same meaning as the BAT_LVLx voltage levels */
+uint8_t batSocLevel(const BatSoc *b) {
+  if (b->soc == 0)                  { return BAT_LEVEL_DEAD; }
+  if (b->soc < BAT_SOC_LVL1 * 10)   { return BAT_LEVEL_1; }
+  if (b->soc < BAT_SOC_LVL2 * 10)   { return BAT_LEVEL_2; }
+  if (b->soc < BAT_SOC_LVL3 * 10)   { return BAT_LEVEL_3; }
+  if (b->soc < BAT_SOC_LVL4 * 10)   { return BAT_LEVEL_4; }
+  if (b->soc < BAT_SOC_LVL5 * 10)   { return BAT_LEVEL_5; }
+  return BAT_LEVEL_FULL;
+}
+
+/* [mAh] remaining charge to save at power off */
+uint16_t batSocStored(const BatSoc *b) {
+  return (uint16_t)(b->charge / 3600);
+}
+
+#endif
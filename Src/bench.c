@@ -0,0 +1,215 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// On-target benchmark (VARIANT_BENCH). main() calls benchRun after the initialization, the ADCs are not started and
+// the motor outputs stay off, so no control interrupt runs. Every case is called BENCH_RUNS times with the interrupts
+// masked, the DWT cycle counter gives the min / mean / max cycles of one call, minus the cost of the measurement.
+// The table is printed on the debug USART every BENCH_PERIOD ms, a press of the power button switches the board off.
+//
+// bldc_control and BLDC_controller_step are fed with the vectors below: one electrical revolution of hall states and
+// sinusoidal phase currents of 5 A (250 ADC bits), the same inputs as the synthetic mode of host/bench.c. Each vector
+// is held BENCH_HOLD ticks, 333 rpm at 16 kHz.
+
+#include <stdio.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "setup.h"
+#include "timebase.h"
+#include "config.h"
+#include "util.h"
+#include "bldc.h"
+#include "comms.h"
+#include "crc32.h"
+#include "eeprom.h"
+#include "bench.h"
+#include "print.h"
+
+#if defined(VARIANT_BENCH)
+
+#define BENCH_HOLD      4               // [ticks] control ticks per vector
+#define BENCH_ADC_MID   2048            // [ADC bits] current offset, see bldc_bench_init
+
+typedef struct {
+  uint8_t hall;                         // [-] hallA | hallB << 1 | hallC << 2 as read by bldc.c
+  int16_t iA;                           // [ADC bits] phase currents, iC = -iA - iB
+  int16_t iB;
+} BenchVec;
+
+static const BenchVec benchVec[] = {
+  {6,  250, -125}, {6,  248,  -96}, {6,  241,  -65}, {6,  231,  -33}, {6,  217,    0}, {6,  198,   33},
+  {6,  177,   65}, {6,  152,   96}, {4,  125,  125}, {4,   96,  152}, {4,   65,  177}, {4,   33,  198},
+  {4,    0,  217}, {4,  -33,  231}, {4,  -65,  241}, {4,  -96,  248}, {5, -125,  250}, {5, -152,  248},
+  {5, -177,  241}, {5, -198,  231}, {5, -217,  217}, {5, -231,  198}, {5, -241,  177}, {5, -248,  152},
+  {1, -250,  125}, {1, -248,   96}, {1, -241,   65}, {1, -231,   33}, {1, -217,    0}, {1, -198,  -33},
+  {1, -177,  -65}, {1, -152,  -96}, {3, -125, -125}, {3,  -96, -152}, {3,  -65, -177}, {3,  -33, -198},
+  {3,    0, -217}, {3,   33, -231}, {3,   65, -241}, {3,   96, -248}, {2,  125, -250}, {2,  152, -248},
+  {2,  177, -241}, {2,  198, -231}, {2,  217, -217}, {2,  231, -198}, {2,  241, -177}, {2,  248, -152},
+};
+#define BENCH_VECS      (sizeof(benchVec) / sizeof(benchVec[0]))
+
+typedef struct {
+  const char *name;
+  void (*prep)(void);                   // sets the inputs of the next call, not measured, may be NULL
+  void (*fn)(void);                     // measured call
+} BenchCase;
+
+static uint16_t benchTick;              // [ticks] replay position
+static uint8_t  benchBuf[64];           // crc input, the size of a long serial frame
+static int32_t  benchFilt;
+static int16_t  benchCmdL, benchCmdR, benchIn;
+static uint16_t benchEE;
+static volatile uint32_t benchSink;     // keeps the results of the calls alive
+
+// Next vector into the ADC buffer and the hall inputs, like the DMA and the hall ports in the control interrupt
+static void benchPrepVec(void) {
+  const BenchVec *v = &benchVec[(benchTick++ / BENCH_HOLD) % BENCH_VECS];
+  int16_t iC = -v->iA - v->iB;
+  benchHall[0] = benchHall[1] = v->hall;
+  adc_buffer.rlA = BENCH_ADC_MID - v->iA;
+  adc_buffer.rlB = BENCH_ADC_MID - v->iB;
+  adc_buffer.rrB = BENCH_ADC_MID - v->iB;
+  adc_buffer.rrC = BENCH_ADC_MID - iC;
+  adc_buffer.dcl = BENCH_ADC_MID - 75;  // 1.5 A DC link current
+  adc_buffer.dcr = BENCH_ADC_MID - 75;
+}
+
+// Same inputs for the controller step alone, the left motor
+static void benchPrepStep(void) {
+  const BenchVec *v = &benchVec[(benchTick++ / BENCH_HOLD) % BENCH_VECS];
+  rtU_Left.b_motEna     = 1;
+  rtU_Left.z_ctrlModReq = CTRL_MOD_REQ;
+  rtU_Left.r_inpTgt     = 500;
+  rtU_Left.b_hallA      =  v->hall       & 1;
+  rtU_Left.b_hallB      = (v->hall >> 1) & 1;
+  rtU_Left.b_hallC      =  v->hall >> 2;
+  rtU_Left.i_phaAB      = v->iA;
+  rtU_Left.i_phaBC      = v->iB;
+  rtU_Left.i_DCLink     = 75;
+}
+
+static void benchPrepInput(void) {
+  benchIn = (int16_t)((benchIn + 37) & 0x3FF) - 512;
+}
+
+static void benchEmpty(void) {}
+
+static void benchStep(void) {
+  BLDC_controller_step(rtM_Left);
+}
+
+static void benchCrc(void) {
+  benchSink = calc_crc32(benchBuf, sizeof(benchBuf));
+}
+
+static void benchFiltLowPass(void) {
+  filtLowPass32(benchIn, FILTER, &benchFilt);
+}
+
+static void benchMixer(void) {
+  mixerFcn(benchIn << 4, (benchIn >> 1) << 4, &benchCmdR, &benchCmdL);
+}
+
+static void benchEERead(void) {
+  benchSink = EE_ReadVariable(VirtAddVarTab[0], &benchEE);
+}
+
+#if defined(DEBUG_SERIAL_PROTOCOL)
+static void benchParse(void) {
+  uint8_t size;
+  benchSink = (uint32_t)findCommand((uint8_t *)"GET I_MOT_MAX\r\n", 15) + (uint32_t)findParam((uint8_t *)"I_MOT_MAX\r\n", 11, &size);
+}
+#endif
+
+static const BenchCase benchCases[] = {
+  {"bldc_control",        benchPrepVec,   bldc_control},
+  {"BLDC_controller_step", benchPrepStep, benchStep},
+  {"calc_crc32 64 B",     NULL,           benchCrc},
+  {"filtLowPass32",       benchPrepInput, benchFiltLowPass},
+  {"mixerFcn",            benchPrepInput, benchMixer},
+  {"EE_ReadVariable",     NULL,           benchEERead},
+#if defined(DEBUG_SERIAL_PROTOCOL)
+  {"findCommand+findParam", NULL,         benchParse},
+#endif
+};
+
+// Cycles of one call of fn, interrupts masked
+static inline uint32_t benchMeasure(void (*fn)(void)) {
+  uint32_t t0, dt;
+  __disable_irq();
+  t0 = DWT->CYCCNT;
+  fn();
+  dt = DWT->CYCCNT - t0;
+  __enable_irq();
+  return dt;
+}
+
+static void benchCase(const BenchCase *c, uint32_t overhead) {
+  uint32_t dt, min = UINT32_MAX, max = 0, sum = 0;
+  for (uint16_t i = 0; i < BENCH_RUNS; i++) {
+    if (c->prep) c->prep();
+    dt  = benchMeasure(c->fn);
+    dt  = dt > overhead ? dt - overhead : 0;
+    min = MIN(min, dt);
+    max = MAX(max, dt);
+    sum += dt;
+  }
+  printf("%-22s %6lu %6lu %6lu\r\n", c->name, (unsigned long)min, (unsigned long)(sum / BENCH_RUNS), (unsigned long)max);
+}
+
+static void benchTable(void) {
+  uint32_t overhead = UINT32_MAX;
+  for (uint16_t i = 0; i < BENCH_RUNS; i++) {
+    overhead = MIN(overhead, benchMeasure(benchEmpty));
+  }
+  printf("\r\n-- bench %u runs, %lu MHz, %lu cycles per control tick --\r\n", BENCH_RUNS,
+         (unsigned long)(SYSCLK_HZ / 1000000), (unsigned long)(SYSCLK_HZ / PWM_FREQ));
+  printf("%-22s %6s %6s %6s\r\n", "case [cycles]", "min", "mean", "max");
+  benchTick = 0;
+  for (uint8_t i = 0; i < sizeof(benchCases) / sizeof(benchCases[0]); i++) {
+    benchCase(&benchCases[i], overhead);
+  }
+  printf("n_mot L:%i R:%i errCode L:%i R:%i overhead:%lu\r\n", rtY_Left.n_mot, rtY_Right.n_mot,
+         rtY_Left.z_errCode, rtY_Right.z_errCode, (unsigned long)overhead);
+}
+
+void benchRun(void) {
+  uint32_t tick;
+
+  HAL_NVIC_DisableIRQ(DMA1_Channel1_IRQn);  // no control interrupt, bldc_control is called from here only
+  LEFT_TIM->BDTR  &= ~TIM_BDTR_MOE;     // HAL_TIM_PWM_Start sets MOE, the control interrupt that clears it does not run
+  RIGHT_TIM->BDTR &= ~TIM_BDTR_MOE;
+  bldc_bench_init();
+  enable = 1;                           // the controller runs as when driving, bldc.c keeps the outputs off
+  for (uint8_t i = 0; i < sizeof(benchBuf); i++) {
+    benchBuf[i] = (uint8_t)(i * 7 + 1);
+  }
+  while (HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) { HAL_Delay(10); }
+
+  while (1) {
+    benchTable();
+    tick = timeMs();
+    while (timeMs() - tick < BENCH_PERIOD) {
+      if (HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) {
+        HAL_GPIO_WritePin(OFF_PORT, OFF_PIN, GPIO_PIN_RESET);   // no beep: the buzzer runs from the control interrupt
+        while (1) {}
+      }
+      HAL_Delay(10);
+    }
+  }
+}
+
+#endif
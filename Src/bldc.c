@@ -23,10 +23,30 @@
 */
 
 #include "stm32f1xx_hal.h"
+#include "bldc.h"
 #include "defines.h"
 #include "setup.h"
 #include "config.h"
 #include "util.h"
+#include "observer.h"
+#include "hallcal.h"
+#include "hallstat.h"
+#include "motorid.h"
+#include "cogging.h"
+#include "posctrl.h"
+#include "derate.h"
+#include "wtemp.h"
+#include "regen.h"
+#include "antilock.h"
+#include "hooks.h"
+#include "fixpt.h"
+#include "ring.h"
+#include "timebase.h"
+#include "stackmon.h"
+#include "trace.h"
+#if defined(SCOPE_ENABLE)
+#include "comms.h"
+#endif
 #include "BLDC_controller_data.h"
 
 // Matlab includes and defines - from auto-code generation
@@ -43,14 +63,69 @@ static uint32_t offsetrrC    = 0;
 static uint32_t offsetdcl    = 0;
 static uint32_t offsetdcr    = 0;
 
+AdcCalib adcCalib;
+#if defined(ADC_INPUT_OVS)
+uint16_t adcInOvs[2];
+#endif
+#if defined(OFFSET_TRACK)
+static uint32_t *const trkOffset[CALIB_CH] RAMCONST = {&offsetrlA, &offsetrlB, &offsetrrB, &offsetrrC, &offsetdcl, &offsetdcr};
+static const uint8_t   trkCh[2][3] RAMCONST = {{CALIB_RLA, CALIB_RLB, CALIB_DCL}, {CALIB_RRB, CALIB_RRC, CALIB_DCR}};
+static uint32_t trkSum[2][3];           // [ADC counts] sample sums of the running step, left / right
+static uint16_t trkN[2];                // [samples] samples of the running step
+static uint8_t  trkBad[2];              // [-] a sample of the running step was outside OFFSET_TRACK_BAND
+#endif
+#if defined(CALIBRATION_ADAPTIVE)
+static uint16_t calibRef[CALIB_CH];     // first sample of each channel, the sums are taken relative to it to stay in 32 bits
+static int32_t  calibSum[CALIB_CH];
+static uint32_t calibSq[CALIB_CH];
+#endif
+
+#if defined(CTRL_FIXED)
+static const int16_t pwm_margin = (CTRL_TYP_SEL == FOC_CTRL) ? PWM_MARGIN : 0; /* Fixed control type, see the margin below */
+#else
 static int16_t pwm_margin;              /* This margin allows to have a window in the PWM signal for proper FOC Phase currents measurement */
+#endif
 
 
 static int16_t curDC_max = (I_DC_MAX * A2BIT_CONV);
+#if defined(DC_FOLDBACK)
+static int16_t curDC_fold = (I_DC_FOLD * A2BIT_CONV);
+#endif
 int16_t curL_phaA = 0, curL_phaB = 0, curL_DC = 0;
 int16_t curR_phaB = 0, curR_phaC = 0, curR_DC = 0;
 
-volatile uint16_t steps[2] = {0,0};
+Odometry odo[2];                        // read by the main loop through bldc_state_read
+
+#if defined(HALL_STATS)
+HallStat         hallStat[2];
+volatile uint8_t hallStatReq[2] = {1, 1};
+#endif
+
+// Seqlock of the published state: odd while the interrupt writes. The interrupt never waits, the reader retries
+static volatile uint32_t stateSeq;
+static BldcState         state;
+
+#if defined(HALL_SPEED_EST)
+// Ticks of the last hall edges per motor, the interrupt only stores them. The speed is calculated when read
+#define HALL_RING               (HALL_SPEED_EDGES + 1)
+typedef struct {
+  uint32_t tick[HALL_RING];
+  uint8_t  wr;                          // [-] next write index
+  uint8_t  cnt;                         // [-] valid ticks, restarts at a direction change
+  int8_t   dir;                         // [-] direction of the last edge
+} HallTiming;
+
+static HallTiming hallTiming[2];
+#endif
+
+#if defined(HALL_COM_HW)
+// Hall edge commutation: the EXTI interrupt of a hall edge writes the duties of the new sector at once. The control
+// interrupt leaves the duties of its controller step per commutation role of the phases (see comStep)
+static uint8_t           comHw[2];      // [-] the edge interrupt commutates the motor: COM_CTRL, outputs on, no test run
+static int               comLvl[2][3];  // [timer counts] duties around pwm_res / 2 of the roles -1, 0, +1 of z_commutMap
+static volatile uint8_t  comSeq[2];     // [-] hall edge interrupts, the control interrupt writes again if one came in between
+static volatile uint32_t comEdgeUs[2];  // [us] time of the last hall edge
+#endif
 
 volatile uint8_t pos[2][2];
 
@@ -64,49 +139,688 @@ volatile uint32_t buzzerTimer = 0;
 static uint8_t  buzzerPrev  = 0;
 static uint8_t  buzzerIdx   = 0;
 
+// Tone sequencer: beepNote queues, the slow task plays. Single producer (main loop), single consumer (slow task)
+static BeepNote          beepQueue[BEEP_QUEUE_LEN];
+static Ring              beepRing;
+static volatile uint32_t beepNoteTicks; // [PWM_FREQ_BASE ticks] rest of the playing note
+static uint8_t           beepNoteFreq;
+
 uint8_t        enable       = 0;        // initially motors are disabled for SAFETY
 static uint8_t enableFin    = 0;
 
-static const uint16_t pwm_res  = 64000000 / 2 / PWM_FREQ; // = 2000
+#if defined(PWM_CARRIER_DOUBLE)
+static uint16_t pwm_res  = PWM_RES;     // = 2000 at 64 MHz and 16 kHz, half of it at the doubled carrier
+static uint8_t  pwmShift;               // [-] duty output shift of the controller, 1 at the doubled carrier
+static uint8_t  pwmCarrierPend;         // [-] the master timer RCR of the requested carrier is written, the periods follow
+uint8_t         pwmCarrierReq = 1;      // [-] PWM_FREQ multiple requested by the main loop, 1 or 2
+uint8_t         pwmCarrier    = 1;      // [-] PWM_FREQ multiple of the running carrier
+#define PWM_SHIFT               pwmShift
+#else
+static const uint16_t pwm_res  = PWM_RES;   // = 2000 at 64 MHz and 16 kHz
+#define PWM_SHIFT               0
+#endif
+
+uint8_t pwmZeroSeq = PWM_ZSEQ;          // [-] output stage zero sequence, PWM_ZSEQ_MID or PWM_ZSEQ_LOW
+static uint16_t pwmCcr[2][3];           // [timer counts] left, right CCR1..CCR3 last written by pwmApply
+int16_t dtComp = DT_COMP;               // [timer counts] dead time compensation, runtime parameter DT_COMP
+#if defined(ADC_SAMPLE_ALIGN)
+int16_t adcSmpOfs = ADC_SAMPLE_OFFSET;  // [timer counts] ADC trigger before the top, runtime parameter ADC_SMP
+AdcSweep adcSweep;
+static volatile uint8_t adcSweepReq;    // [-] set by bldc_adc_sweep_start
+#endif
+#define DT_COMP_BITS  (DT_COMP_BAND * A2BIT_CONV / 1000)  // [ADC bits] DT_COMP_BAND
+
+#if defined(SPD_REF_GEN)
+volatile int16_t spdFfAcc[2];           // set by the main loop from the speed reference acceleration
+volatile int32_t spdFfKv;               // set by the main loop from n_max and the battery voltage
+
+// SPD_MODE voltage feedforward Vq_ff: back-EMF at the speed target plus the acceleration term
+static int16_t spdFf(int16_t inpTgt, int16_t acc) {
+  int32_t v = (((int32_t)inpTgt * spdFfKv) >> 8) + acc;
+  return (int16_t)clampSym(v, 16000);
+}
+#endif
+
+#if defined(CTRL_PREDICT)
+volatile CtrlPredict ctrlPred[2];       // set by the main loop from the motor parameters and the battery voltage
+
+// Half PWM periods from the current sampling at the top to the middle of the period the new duties apply in
+#if defined(CTRL_VALLEY_LOAD)
+#define PRED_HALF_L             2
+#define PRED_HALF_R             2
+#elif defined(CTRL_RIGHT_FIRST)
+#define PRED_HALF_L             3
+#define PRED_HALF_R             2
+#else
+#define PRED_HALF_L             3
+#define PRED_HALF_R             3
+#endif
+
+// Predictive current control: the inverse Park angle advanced by the rotation over the current-to-PWM delay, and
+// the back-EMF and cross coupling voltages of the dq model added to the current PI outputs. From the last tick
+static inline void ctrlPredict(ExtU *u, const ExtY *y, const volatile CtrlPredict *k, int32_t half) {
+  int32_t n = y->n_mot;
+  int32_t a = (n * k->kA * half) >> 16;
+  if (pwm_res != PWM_RES) {
+    a = a * pwm_res / PWM_RES;          // doubled carrier
+  }
+  u->a_elecAdv = (int16_t)clampSym(a, 90 * 64);
+  u->Vd_dec    = (int16_t)clampSym((int32_t)(-((int64_t)n * y->iq * k->kL) >> 24), 16000);
+  u->Vq_dec    = (int16_t)clampSym(((n * k->kE) >> 8) + (int32_t)(((int64_t)n * y->id * k->kL) >> 24), 16000);
+}
+#endif
+
+#define VDC_RCP         RCP16(BAT_CALIB_REAL_VOLTAGE, BAT_CALIB_ADC)  // batVoltage ADC bits to V * 100
+
+#if defined(ANGLE_OBSERVER)
+static Observer obs[2];                 // [-] left, right rotor flux observer
+#endif
+
+#if defined(HALL_CALIB)
+HallCal                 hallCal[2];
+static volatile uint8_t hallCalReq;     // [-] set by bldc_hall_calib_start, the control interrupt starts both calibrations
+#endif
+
+#if defined(MOTOR_IDENT)
+MotId                   motId[2];
+static volatile uint8_t motIdReq;       // [-] set by bldc_motor_ident_start, the control interrupt starts both identifications
+#endif
+
+#if defined(SPD_FILT)
+SpdId                   spdId[2];
+static volatile uint8_t spdIdReq;       // [-] set by bldc_spd_ident_start, the control interrupt starts both sweeps
+#endif
+
+#if defined(COGGING_COMP)
+Cogging                 cogging[2];
+static volatile uint8_t cogReq;         // [-] set by bldc_cogging_start, the control interrupt starts both recordings
+#endif
+
+#if defined(POS_CTRL)
+static PosCtrl          posCtrl[2];     // [-] left, right position loop
+static volatile int32_t posTgt[2];      // [hall steps] set by bldc_pos_target
+static int16_t          posInpTgt[2];   // [-] SPD_MODE r_inpTgt of the position loop
+static uint8_t          posDiv;         // [ticks] POS_CTRL_DIV divider
+#endif
+
+#if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+// Hold steps, every POS_CTRL_DIV ticks: the cruise reference [rpm fixdt(1,32,16)] per step and step^2
+#define HOLD_ACC                ((int32_t)((int64_t)SPD_REF_ACC * 65536 * POS_CTRL_DIV / PWM_FREQ))
+#define HOLD_JERK               ((int32_t)((int64_t)SPD_REF_JERK * 65536 * POS_CTRL_DIV * POS_CTRL_DIV / ((int64_t)PWM_FREQ * PWM_FREQ)))
+#define HOLD_ACC_SHIFT          5       // [-] n_mot acceleration low pass, 2^5 hold steps
+#define HOLD_BAND               1       // [hall steps] standstill hold error taken as none, no limit cycle over one hall step
+
+volatile uint8_t holdReq;               // [-] bldcHolds, set by the main loop
+volatile int16_t holdTgt[2];            // [rpm] cruise speed target of the hold step, left / right
+static uint8_t   holdMode;              // [-] bldcHolds, the engaged hold
+static uint8_t   holdDiv;               // [ticks] POS_CTRL_DIV divider
+static int16_t   holdN[2];              // [rpm] n_mot of the last hold step
+static int32_t   holdAcc[2];            // [rpm fixdt(1,32,16)] n_mot change per hold step, low pass
+static RefGen    holdRef[2];            // cruise speed reference
+#if defined(STANDSTILL_HOLD_ENABLE)
+static PosCtrl   holdCtrl[2];           // standstill position loop
+static int32_t   holdPos[2];            // [hall steps] held position
+static int16_t   holdInpTgt[2];         // [-] SPD_MODE r_inpTgt of the standstill position loop
+#endif
+#endif
+
+#if defined(CURRENT_DERATING)
+Derate                  derate;
+#endif
+
+#if defined(DC_BUDGET)
+DcBudget                dcBudget;
+#endif
+
+#if defined(WINDING_TEMP)
+#define WTEMP_SUM_TICKS (PWM_FREQ / 10) // [ticks] 100 ms sums of the winding temperature
+WTemp                   wtemp[2];
+#endif
 
-static uint64_t mainCounter = 0;
+#if defined(SELF_TEST)
+#if defined(MOTOR_LEFT_ENA) && defined(MOTOR_RIGHT_ENA)
+#define SELF_TEST_MOTORS 3              // [-] motors pulsed and evaluated by the self-test, 1 = left, 2 = right
+#elif defined(MOTOR_LEFT_ENA)
+#define SELF_TEST_MOTORS 1
+#else
+#define SELF_TEST_MOTORS 2
+#endif
+SelfTest                selfTest;
+#endif
+
+#if defined(HW_BREAK)
+uint32_t                hwBreakTrips[2];  // [ticks] control ticks that found the break input tripped, left / right
+#endif
+
+#if defined(DC_FOLDBACK)
+uint16_t                dcFold[2] = {32768, 32768};
+#endif
+
+#if defined(OVERMOD)
+uint16_t                overmodGain[2] = {1024, 1024};
+#endif
+
+#if defined(DC_LINK_EST)
+int16_t                 dcEstShunt[2];  // [ADC bits, Q4] filtered DC link shunt current, left / right
+int16_t                 dcEstDev[2];    // [ADC bits, Q4] filtered estimate minus shunt, left / right
+static int32_t          dcEstAcc[2][2]; // [ADC bits, Q4 + DC_EST_FILT] filters of the shunt and of the deviation
+#endif
+
+#if defined(IDLE_POWER_SAVE)
+uint8_t                 idleReq;        // [-] set by the main loop while parked, the control interrupt slows down to PWM_FREQ / IDLE_DIV
+uint8_t                 idleWake;       // [-] set by the control interrupt on a hall edge in idle, cleared by the main loop
+uint32_t                idleTicks;      // [ticks] time spent in idle
+#endif
+
+#if defined(REGEN_LIMIT)
+Regen                   regen;
+#endif
+
+#if defined(ANTILOCK_BRAKE)
+Antilock                antilock;
+#endif
+
+// The controller duty outputs are scaled for the PWM_FREQ_BASE timer period at 64 MHz (+-1000 = full duty at 2000)
+#if PWM_RES != PWM_RES_BASE
+  #define PWM_DUTY_Q15          ((PWM_RES << 15) / PWM_RES_BASE)
+  #define PWM_DUTY(x)           ((((x) * PWM_DUTY_Q15) >> 15) >> PWM_SHIFT)
+#else
+  #define PWM_DUTY(x)           ((x) >> PWM_SHIFT)
+#endif
+
+static uint32_t mainCounter = 0;        // [ticks] control domain clock, wraps after 3 days, only calibration_func() reads it
+                                        // absolutely and bldc_start_calibration() resets it first
+
+IsrDeadlineMiss isrMiss;
 
 int16_t        batVoltage       = (400 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE;
 static int32_t batVoltageFixdt  = (400 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE << 16;  // Fixed-point filter output initialized at 400 V*100/cell = 4 V/cell converted to fixed-point
 
-const uint8_t hall2pos[2][2][2] = {
-  {
-    {
-      6,
-      2
-    },
-    {
-      4,
-      3
-    }
-  },
-  {
-    {
-      0,
-      1
-    },
-    {
-      5,
-      6
+#if defined(VBAT_COMP)
+// Fast battery voltage of VBAT_COMP: the slow task averages PWM_FREQ / 1000 samples and filters the 1 kHz averages by 1/4
+#define VBAT_COMP_ADC   ((int32_t)VBAT_COMP_NOM * BAT_CALIB_ADC / BAT_CALIB_REAL_VOLTAGE)  // [ADC bits]
+static int32_t           vbatFast = VBAT_COMP_ADC << 8;   // [ADC bits << 8]
+static volatile int16_t  vbatK    = 1 << 12;              // [Q12] duty scale VBAT_COMP_NOM / battery voltage
+#define VBAT_NOW        ((int16_t)(vbatFast >> 8))        // [ADC bits] battery voltage of the duties
+#define PWM_DUTY_V(x)   PWM_DUTY(((int32_t)(x) * vbatK) >> 12)
+#else
+#define VBAT_NOW        batVoltage
+#define PWM_DUTY_V(x)   PWM_DUTY(x)
+#endif
+
+#if defined(SCOPE_ENABLE)
+Scope scope = {.pre = 25, .decim = 1};
+#endif
+
+#if defined(BLACKBOX_ENABLE)
+BlackBox blackbox;
+#endif
+
+#if defined(ISR_PROFILING)
+IsrProfPhase isrProf[ISR_PROF_PHASES];
+uint32_t     isrProfHist[ISR_PROF_HIST_BINS];
+uint8_t      isrProfRst = 1;
+
+  #define ISR_PROF_START(t)         uint32_t t = DWT->CYCCNT
+  #define ISR_PROF_STOP(t, phase)   isrProfUpdate(&isrProf[phase], DWT->CYCCNT - (t))
+#else
+  #define ISR_PROF_START(t)
+  #define ISR_PROF_STOP(t, phase)
+#endif
+
+// Record the first stage after which the next conversion was already complete
+#define ISR_DEADLINE_CHECK(miss, stage)  if ((miss) == ISR_STAGE_NONE && (DMA1->ISR & DMA_ISR_TCIF1)) (miss) = (stage)
+
+// Hall index: bit0 = U, bit1 = V, bit2 = W (1 = hall sensor active)
+#define HALL_IDX(u, v, w)   ((u) | ((v) << 1) | ((w) << 2))
+
+const uint8_t hall2pos[8] RAMCONST = {
+  [HALL_IDX(0,0,0)] = 6,
+  [HALL_IDX(0,0,1)] = 2,
+  [HALL_IDX(0,1,0)] = 4,
+  [HALL_IDX(0,1,1)] = 3,
+  [HALL_IDX(1,0,0)] = 0,
+  [HALL_IDX(1,0,1)] = 1,
+  [HALL_IDX(1,1,0)] = 5,
+  [HALL_IDX(1,1,1)] = 6
+};
+
+// One hall edge: hall2pos decreases while the BLDC controller detects the positive direction.
+// Invalid hall states (position 6) and skipped positions only update the edge time.
+static inline void odoStep(uint8_t m, uint8_t cur, uint8_t prev) {
+  int8_t dir = 0;
+  if (cur < 6 && prev < 6) {
+    int8_t d = (int8_t)cur - (int8_t)prev;
+    if (d == -1 || d == 5) {
+      dir = 1;
+    } else if (d == 1 || d == -5) {
+      dir = -1;
     }
   }
-};
+  odo[m].pos     += dir;
+  odo[m].edgeTick = mainCounter;
+
+  #if defined(HALL_STATS)
+  if (hallStatReq[m]) {
+    hallStatReset(&hallStat[m]);
+    hallStatReq[m] = 0;
+  }
+  #if defined(HALL_COM_HW)
+  hallStatEdge(&hallStat[m], cur, prev, dir, comEdgeUs[m]);
+  #else
+  hallStatEdge(&hallStat[m], cur, prev, dir, odo[m].edgeTick);
+  #endif
+  #endif
+
+  #if defined(HALL_SPEED_EST)
+  HallTiming *h = &hallTiming[m];
+  if (dir != h->dir) {
+    h->dir = dir;
+    h->cnt = 0;                         // The intervals before a reversal or a bad hall state say nothing about the speed
+  }
+  #if defined(HALL_COM_HW)
+  h->tick[h->wr] = comEdgeUs[m];        // timed by the edge interrupt
+  #else
+  h->tick[h->wr] = odo[m].edgeTick;
+  #endif
+  h->wr  = (h->wr == HALL_RING - 1) ? 0 : h->wr + 1;
+  h->cnt = MIN(h->cnt + 1, HALL_RING);
+  #endif
+}
+
+// Compile-time check that the hall pins are consecutive starting at LEFT_HALL_SHIFT / RIGHT_HALL_SHIFT
+typedef char hallPinCheck[(LEFT_HALL_U_PIN  == (1 << LEFT_HALL_SHIFT))  && (LEFT_HALL_V_PIN  == (LEFT_HALL_U_PIN  << 1)) && (LEFT_HALL_W_PIN  == (LEFT_HALL_U_PIN  << 2)) &&
+                          (RIGHT_HALL_U_PIN == (1 << RIGHT_HALL_SHIFT)) && (RIGHT_HALL_V_PIN == (RIGHT_HALL_U_PIN << 1)) && (RIGHT_HALL_W_PIN == (RIGHT_HALL_U_PIN << 2)) ? 1 : -1];
+
+// Read the three hall sensors of one motor with a single port access. Hall inputs are active low
+#if defined(VARIANT_BENCH)
+uint8_t benchHall[2];                   // hall inputs replayed by bench.c, left and right
+#define HALL_READ(port, shift)  (benchHall[(shift) == RIGHT_HALL_SHIFT])
+#else
+#define HALL_READ(port, shift)  ((uint8_t)((~(port)->IDR >> (shift)) & 0x07))
+#endif
+
+// Switch the motor outputs on. The benchmark steps the controller with the outputs off
+#if defined(VARIANT_BENCH)
+#define PWM_OUT_ENA(tim)
+#else
+#define PWM_OUT_ENA(tim)        ((tim)->BDTR |= TIM_BDTR_MOE)
+#endif
 
 
 void nullFunc(){}  // Function for empty funktionpointer becasue Jump NULL != ret
 
 void bldc_control(void);
 static void calibration_func();
+#if defined(SELF_TEST)
+static void selftest_func();
+#define CALIB_NEXT      selftest_func   // the self-test pulses run between the calibration and the controller
+#else
+#define CALIB_NEXT      bldc_control
+#endif
 
 typedef void (*IsrPtr)();
 volatile IsrPtr timer_brushless = nullFunc;
 volatile IsrPtr buzzerFunc = nullFunc;
 
+/* Queue a note of pitch freq (buzzerFreq units, 0 = rest) for ms milliseconds. Returns at once, 0 if the queue is full */
+uint8_t beepNote(uint8_t freq, uint16_t ms) {
+  BeepNote *n;
+  if (ringFull(&beepRing, BEEP_QUEUE_LEN)) {
+    return 0;
+  }
+  n       = &beepQueue[ringIn(&beepRing, BEEP_QUEUE_LEN)];
+  n->freq = freq;
+  n->ms   = ms;
+  ringPush(&beepRing, 1);
+  return 1;
+}
+
+/* 1 while queued notes are still playing */
+uint8_t beepBusy(void) {
+  return beepNoteTicks != 0 || !ringEmpty(&beepRing);
+}
+
+void bldc_cycle_counter_init(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;   // enable the DWT unit
+  DWT->CYCCNT       = 0;
+  DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;       // start the cycle counter
+}
+
+// Publish the state of this tick. The barriers keep the compiler and the bus from moving the stores out of the odd phase
+static inline void bldc_state_publish(void) {
+  stateSeq++;
+  __DMB();
+  state.tick        = mainCounter;
+  state.odo[0]      = odo[0];
+  state.odo[1]      = odo[1];
+  state.n_mot[0]    = rtY_Left.n_mot;
+  state.n_mot[1]    = rtY_Right.n_mot;
+  state.i_DCLink[0] = rtU_Left.i_DCLink;
+  state.i_DCLink[1] = rtU_Right.i_DCLink;
+  state.iq[0]       = rtY_Left.iq;
+  state.iq[1]       = rtY_Right.iq;
+  state.id[0]       = rtY_Left.id;
+  state.id[1]       = rtY_Right.id;
+  state.errCode[0]  = rtY_Left.z_errCode;
+  state.errCode[1]  = rtY_Right.z_errCode;
+  state.batVoltage  = batVoltage;
+  __DMB();
+  stateSeq++;
+}
+
+// Consistent copy of the last published state, without masking the interrupts. The copy takes well under one tick, so
+// it is repeated at most once per control interrupt that hits it
+void bldc_state_read(BldcState *out) {
+  uint32_t seq;
+  do {
+    seq = stateSeq;
+    __DMB();
+    *out = state;
+    __DMB();
+  } while ((seq & 1) || seq != stateSeq);
+}
+
+#if defined(PARAM_STAGED)
+/* Staged parameters: the main loop edits rtP_Left / rtP_Right, bldc_param_commit copies both into the idle bank and the
+ * control interrupt switches both controllers to it at the start of the next tick. The controllers run on the banks only */
+static P                paramBank[2][2];        // [motor][bank]
+static uint8_t          paramActive = 1;        // bank the controllers run on, the first commit fills bank 0
+static volatile uint8_t paramSwap;              // 1 = the idle bank is complete
+
+uint8_t bldc_param_commit(void) {
+  if (paramSwap) {
+    return 0;                           // the previous commit is not taken yet, its bank must not change
+  }
+  uint8_t idle = paramActive ^ 1;
+  paramBank[0][idle] = rtP_Left;
+  paramBank[1][idle] = rtP_Right;
+  __DMB();
+  paramSwap = 1;
+  return 1;
+}
+
+static inline void bldc_param_swap(void) {
+  if (paramSwap) {
+    paramActive ^= 1;
+    rtM_Left->defaultParam  = &paramBank[0][paramActive];
+    rtM_Right->defaultParam = &paramBank[1][paramActive];
+    paramSwap = 0;
+  }
+}
+#endif
+
+#if defined(SERIAL_EXT_CMD)
+/* Extended serial command: the Rx processing posts the mode and limits of a frame, the next control tick writes them
+ * to the parameters of both motors before the controllers step, so they never take effect apart. With PARAM_STAGED
+ * to both banks as well: rtP_Left / rtP_Right for the next commit, the running bank for this tick */
+static BldcExtCmd       extCmd;
+static volatile uint8_t extCmdReq;      // [-] extCmd is complete and not taken yet
+
+void bldc_ext_command(const BldcExtCmd *c) {
+  extCmdReq = 0;                        // the control interrupt preempts the Rx processing, never reads a half copy
+  __DMB();
+  extCmd    = *c;
+  __DMB();
+  extCmdReq = 1;
+}
+
+static void extCmdParam(P *p, const BldcExtCmd *c) {
+  if (c->ext & PROTO_EXT_I_MAX) {
+    p->i_max = c->iMax;
+  }
+  if (c->ext & PROTO_EXT_N_MAX) {
+    p->n_max = c->nMax;
+  }
+  if (c->ext & PROTO_EXT_FIELD_WEAK) {
+    p->b_fieldWeakEna  = c->fieldWeakEna;
+    p->id_fieldWeakMax = c->fieldWeakMax;
+  }
+}
+
+static inline void extCmdTick(void) {
+  const BldcExtCmd *c = &extCmd;
+  if (!extCmdReq) {
+    return;
+  }
+  if (c->ext & PROTO_EXT_MODE) {
+    if (ctrlModReq == ctrlModReqRaw) {
+      ctrlModReq = c->ctrlMod;          // not while a timeout or POS_MODE overrides the request
+    }
+    ctrlModReqRaw = c->ctrlMod;
+  }
+  extCmdParam(&rtP_Left,  c);
+  extCmdParam(&rtP_Right, c);
+  #if defined(PARAM_STAGED)
+  for (uint8_t b = 0; b < 2; b++) {
+    extCmdParam(&paramBank[0][b], c);
+    extCmdParam(&paramBank[1][b], c);
+  }
+  #endif
+  if (c->ext & PROTO_EXT_FIELD_WEAK) {
+    Input_Lim_Init();                   // the input range follows the field weakening
+  }
+  extCmdReq = 0;
+}
+#endif
+
+// Consistent copy of both odometry counters and their tick, for the main loop
+void bldc_odo_snapshot(Odometry *out, uint32_t *tick) {
+  BldcState st;
+  bldc_state_read(&st);
+  out[0] = st.odo[0];
+  out[1] = st.odo[1];
+  *tick  = st.tick;
+}
+
+#if defined(HALL_SPEED_EST)
+#if defined(HALL_COM_HW)
+  #define HALL_TIME_HZ          1000000 // [Hz] edge times of the edge interrupt
+  #define HALL_TIME_NOW()       timeUs()
+#else
+  #define HALL_TIME_HZ          PWM_FREQ
+  #define HALL_TIME_NOW()       mainCounter
+#endif
+
+/*
+ * Speed from the mean interval of the last HALL_SPEED_EDGES hall edges, cf_speedCoef / interval like n_mot.
+ * Once the time since the last edge exceeds that interval the motor is slower than estimated,
+ * so the estimate follows cf_speedCoef / time since the last edge down to zero at HALL_SPEED_TIMEOUT.
+ * The edge times are control ticks, or microseconds with HALL_COM_HW: cf_speedCoef is scaled to them.
+ */
+void bldc_hall_speed(int16_t *rpm) {
+  HallTiming h;
+  uint32_t   now;
+
+  for (uint8_t m = 0; m < 2; m++) {
+    __disable_irq();
+    h   = hallTiming[m];
+    now = HALL_TIME_NOW();
+    __enable_irq();
+
+    uint32_t coef = (uint32_t)((uint64_t)((m == 0) ? rtP_Left.cf_speedCoef : rtP_Right.cf_speedCoef) * HALL_TIME_HZ / PWM_FREQ);
+    uint8_t  n    = h.cnt - 1;          // intervals available
+    uint32_t last = h.tick[(h.wr + HALL_RING - 1) % HALL_RING];
+    uint32_t age  = now - last;
+
+    if (h.cnt < 2 || h.dir == 0 || age > (uint32_t)HALL_SPEED_TIMEOUT * HALL_TIME_HZ / 1000) {
+      rpm[m] = 0;
+      continue;
+    }
+    uint32_t span = last - h.tick[(h.wr + HALL_RING - 1 - n) % HALL_RING];
+    // Compare age with span / n without dividing: the larger of the two gives the lower speed
+    uint32_t est  = (age * n > span) ? coef / MAX(age, 1) : coef * n / MAX(span, 1);
+    rpm[m] = (int16_t)(h.dir * (int32_t)MIN(est, N_MOT_MAX * 2));
+  }
+}
+#endif
+
+/* =========================== Deadline Monitor ===========================
+ * A deadline miss is detected when the next ADC conversion has already completed (DMA TC flag pending again)
+ * before the control interrupt is finished, or when the interrupt is re-entered while still running.
+ * The stage running when the deadline expired is recorded for the worst miss.
+ */
+RAMFUNC static void isrMissTrack(uint8_t stage, uint32_t cycles) {
+  isrMiss.cnt++;
+  isrMiss.cntWin++;
+  if (cycles >= isrMiss.worstCycles) {
+    isrMiss.worstCycles = cycles;
+    isrMiss.worstTime   = mainCounter;
+    isrMiss.worstStage  = stage;
+  }
+}
+
+RAMFUNC static void isrMissWindow(uint8_t ticks) {
+  isrMiss.winTicks += ticks;
+  if (isrMiss.winTicks >= PWM_FREQ) {     // evaluate misses every 1 s
+    #if defined(DEADLINE_MISS_FAULT)
+    if (isrMiss.cntWin > DEADLINE_MISS_FAULT) {
+      isrMiss.fault = 1;                    // latched until power cycle
+    }
+    #endif
+    isrMiss.rate     = isrMiss.cntWin;
+    isrMiss.cntWin   = 0;
+    isrMiss.winTicks = 0;
+  }
+}
+
+#if defined(ISR_PROFILING)
+/* =========================== ISR Profiling =========================== */
+
+static void isrProfReset(void) {
+  for (uint8_t i = 0; i < ISR_PROF_PHASES; i++) {
+    isrProf[i].last = isrProf[i].max = isrProf[i].mean = 0;
+    isrProf[i].min  = UINT16_MAX;
+    isrProf[i].sum  = isrProf[i].cnt = 0;
+  }
+  for (uint8_t i = 0; i < ISR_PROF_HIST_BINS; i++) {
+    isrProfHist[i] = 0;
+  }
+  isrProfRst = 0;
+}
+
+static inline void isrProfUpdate(IsrProfPhase *p, uint32_t cycles) {
+  if (cycles > UINT16_MAX) cycles = UINT16_MAX;
+  p->last = (uint16_t)cycles;
+  if (p->last < p->min) p->min = p->last;
+  if (p->last > p->max) p->max = p->last;
+  p->sum += cycles;
+  if (++p->cnt >= (1U << ISR_PROF_MEAN_SHIFT)) {
+    p->mean = (uint16_t)(p->sum >> ISR_PROF_MEAN_SHIFT);
+    p->sum  = 0;
+    p->cnt  = 0;
+  }
+}
+#endif
+
+#if defined(BLACKBOX_ENABLE)
+/* =========================== Black Box Recorder =========================== */
+
+static inline void blackboxMotor(BlackBoxMotor *m, int16_t curA, int16_t curB, int16_t curDC, const ExtU *u, const ExtY *y, uint8_t hall, uint8_t chop) {
+  m->curA   = curA;
+  m->curB   = curB;
+  m->curDC  = curDC;
+  m->dutyA  = y->DC_phaA;
+  m->dutyB  = y->DC_phaB;
+  m->dutyC  = y->DC_phaC;
+  m->n_mot  = y->n_mot;
+  m->hall   = hall;
+  m->flags  = y->z_errCode | (u->z_ctrlModReq << BLACKBOX_MODE_SHIFT) | (u->b_motEna ? BLACKBOX_ENA : 0) | (chop ? BLACKBOX_CHOP : 0);
+  m->inpTgt = u->r_inpTgt;
+}
+
+RAMFUNC static void blackboxRecord(uint8_t hall_l, uint8_t hall_r, uint8_t chopL, uint8_t chopR) {
+  if (blackbox.arm) {
+    blackbox.wr = blackbox.cnt = 0;
+    blackbox.state = BLACKBOX_ARMED;
+    blackbox.arm = 0;
+  }
+  if (blackbox.state == BLACKBOX_FROZEN || ++blackbox.decim < BLACKBOX_DECIM) {
+    return;
+  }
+  blackbox.decim = 0;
+
+  BlackBoxSample *s = &blackbox.buf[blackbox.wr];
+  blackboxMotor(&s->left,  curL_phaA, curL_phaB, curL_DC, &rtU_Left,  &rtY_Left,  hall_l, chopL);
+  blackboxMotor(&s->right, curR_phaB, curR_phaC, curR_DC, &rtU_Right, &rtY_Right, hall_r, chopR);
+  if (blackbox.cnt < BLACKBOX_DEPTH) blackbox.cnt++;
+
+  if (blackbox.state == BLACKBOX_ARMED && ((s->left.flags | s->right.flags) & (BLACKBOX_ERR | BLACKBOX_CHOP))) {
+    blackbox.state    = BLACKBOX_TRIGGERED;
+    blackbox.trig     = blackbox.wr;
+    blackbox.trigTime = buzzerTimer;
+    blackbox.post     = BLACKBOX_POST;
+  }
+  if (++blackbox.wr >= BLACKBOX_DEPTH) blackbox.wr = 0;
+  if (blackbox.state == BLACKBOX_TRIGGERED && --blackbox.post == 0) {
+    blackbox.state = BLACKBOX_FROZEN;
+  }
+}
+#endif
+
+#if defined(SCOPE_ENABLE)
+static inline int32_t scopeRead(const volatile void *p, uint8_t type) {
+  switch (type) {
+    case UINT8_T:  return *(const volatile uint8_t *)p;
+    case UINT16_T: return *(const volatile uint16_t *)p;
+    case INT8_T:   return *(const volatile int8_t *)p;
+    case INT16_T:  return *(const volatile int16_t *)p;
+    default:       return *(const volatile int32_t *)p;             // UINT32_T, INT32_T, INT
+  }
+}
+
+/* Scope capture, every control cycle. Armed, the buffer is a ring of depth samples. The trigger needs preN samples before it,
+ * a command trigger takes what is there. The depth - preN - 1 samples after the trigger complete the capture */
+RAMFUNC static void scopeRecord(void) {
+  uint8_t force = 0;
+  if (scope.arm) {
+    if ((scope.arm == 1 || scope.state != SCOPE_ARMED) && scope.n) {
+      scope.depth = SCOPE_WORDS / scope.n;
+      scope.preN  = (uint16_t)((uint32_t)scope.depth * scope.pre / 100);
+      scope.preN  = MIN(scope.preN, scope.depth - 1);
+      scope.wr    = scope.cnt = scope.dec = 0;
+      scope.prev  = scope.level;
+      scope.state = SCOPE_ARMED;
+    }
+    force     = (scope.arm == 2);
+    scope.arm = 0;
+  }
+  if ((scope.state != SCOPE_ARMED && scope.state != SCOPE_TRIGGERED) || ++scope.dec < scope.decim) {
+    return;
+  }
+  scope.dec = 0;
+
+  int32_t *s = &scope.buf[scope.wr * scope.n];
+  for (uint8_t i = 0; i < scope.n; i++) {
+    s[i] = scopeRead(scope.src[i], scope.type[i]);
+  }
+  if (scope.cnt < scope.depth) scope.cnt++;
+
+  if (scope.state == SCOPE_ARMED) {
+    uint8_t hit = force;
+    if (scope.trigCh) {
+      int32_t v    = s[scope.trigCh - 1];
+      uint8_t rise = scope.prev <  scope.level && v >= scope.level;
+      uint8_t fall = scope.prev >  scope.level && v <= scope.level;
+      hit |= scope.cnt > scope.preN && (scope.edge == SCOPE_RISE ? rise : scope.edge == SCOPE_FALL ? fall : (rise | fall));
+      scope.prev = v;
+    }
+    if (hit) {
+      scope.state    = SCOPE_TRIGGERED;
+      scope.trig     = scope.wr;
+      scope.trigTime = timeUs();
+      scope.post     = scope.depth - MIN(scope.cnt, scope.preN + 1);
+    }
+  } else {
+    scope.post--;
+  }
+  if (++scope.wr >= scope.depth) scope.wr = 0;
+  if (scope.state == SCOPE_TRIGGERED && scope.post == 0) {
+    scope.state = SCOPE_DONE;
+  }
+}
+#endif
+
 void bldc_start_calibration(){
   mainCounter = 0;
   offsetrlA    = 0;
@@ -115,34 +829,77 @@ void bldc_start_calibration(){
   offsetrrC    = 0;
   offsetdcl    = 0;
   offsetdcr    = 0;
-  uint8_t hall_ul = !(LEFT_HALL_U_PORT->IDR & LEFT_HALL_U_PIN);
-  uint8_t hall_vl = !(LEFT_HALL_V_PORT->IDR & LEFT_HALL_V_PIN);
-  uint8_t hall_wl = !(LEFT_HALL_W_PORT->IDR & LEFT_HALL_W_PIN);
-  pos[0][0] = pos[0][1] = hall2pos[hall_ul][hall_vl][hall_wl];
-  uint8_t hall_ur = !(RIGHT_HALL_U_PORT->IDR & RIGHT_HALL_U_PIN);
-  uint8_t hall_vr = !(RIGHT_HALL_V_PORT->IDR & RIGHT_HALL_V_PIN);
-  uint8_t hall_wr = !(RIGHT_HALL_W_PORT->IDR & RIGHT_HALL_W_PIN);
-  pos[1][0] = pos[1][1] = hall2pos[hall_ur][hall_vr][hall_wr];
+  adcCalib.done = 0;
+  pos[0][0] = pos[0][1] = hall2pos[HALL_READ(LEFT_HALL_PORT, LEFT_HALL_SHIFT)];
+  pos[1][0] = pos[1][1] = hall2pos[HALL_READ(RIGHT_HALL_PORT, RIGHT_HALL_SHIFT)];
   timer_brushless = calibration_func;
 }
 
-static void calibration_func(){
-  uint8_t hall_ul = !(LEFT_HALL_U_PORT->IDR & LEFT_HALL_U_PIN);
-  uint8_t hall_vl = !(LEFT_HALL_V_PORT->IDR & LEFT_HALL_V_PIN);
-  uint8_t hall_wl = !(LEFT_HALL_W_PORT->IDR & LEFT_HALL_W_PIN);
-  uint8_t current_posl = hall2pos[hall_ul][hall_vl][hall_wl];
+#if defined(VARIANT_BENCH)
+/* Benchmark start: mid scale offsets like a calibrated board, bldc_control is called by bench.c, not by the interrupt */
+void bldc_bench_init(void) {
+  offsetrlA = offsetrlB = offsetrrB = offsetrrC = offsetdcl = offsetdcr = 2048;
+  for (uint8_t i = 0; i < CALIB_CH; i++) adcCalib.offset[i] = 2048;
+  adcCalib.done = 1;
+}
+#endif
 
+/* Offsets done: the self-test checks them and the halls, then the pulses or the controller take over */
+static void calibration_end(void) {
+  #if defined(SELF_TEST)
+  selfTestBegin(&selfTest, SELF_TEST_MOTORS, adcCalib.offset, (const uint8_t[2]){pos[0][0], pos[1][0]});
+  #endif
+  timer_brushless = CALIB_NEXT;
+}
 
-  uint8_t hall_ur = !(RIGHT_HALL_U_PORT->IDR & RIGHT_HALL_U_PIN);
-  uint8_t hall_vr = !(RIGHT_HALL_V_PORT->IDR & RIGHT_HALL_V_PIN);
-  uint8_t hall_wr = !(RIGHT_HALL_W_PORT->IDR & RIGHT_HALL_W_PIN);
-  uint8_t current_posr = hall2pos[hall_ur][hall_vr][hall_wr];
+static void calibration_func(){
+  uint8_t current_posl = hall2pos[HALL_READ(LEFT_HALL_PORT, LEFT_HALL_SHIFT)];
+  uint8_t current_posr = hall2pos[HALL_READ(RIGHT_HALL_PORT, RIGHT_HALL_SHIFT)];
   //reset if motors are moving
   if(current_posl != pos[0][0])
     bldc_start_calibration();
   if(current_posr != pos[1][0])
     bldc_start_calibration();
 
+#if defined(CALIBRATION_ADAPTIVE)
+  // Running mean and variance per channel. Every 32 samples after CALIBRATION_MIN_SAMPLES the calibration
+  // stops if all offsets match the warm start, or if the standard error of every mean is below 1/4 count
+  const uint16_t raw[CALIB_CH] = {adc_buffer.rlA, adc_buffer.rlB, adc_buffer.rrB, adc_buffer.rrC, adc_buffer.dcl, adc_buffer.dcr};
+  uint32_t n = mainCounter;
+  uint8_t  settled = 1, warmOk = adcCalib.warmValid;
+  int32_t  d, mean[CALIB_CH];
+
+  for (uint8_t i = 0; i < CALIB_CH; i++) {
+    if (n <= 1) {
+      calibRef[i] = raw[i];
+      calibSum[i] = 0;
+      calibSq[i]  = 0;
+    }
+    d = (int32_t)raw[i] - calibRef[i];
+    calibSum[i] += d;
+    calibSq[i]  += (uint32_t)(d * d);
+  }
+  if (n < CALIBRATION_SAMPLES && (n < CALIBRATION_MIN_SAMPLES || (n & 31))) return;
+
+  for (uint8_t i = 0; i < CALIB_CH; i++) {
+    uint32_t var = (uint32_t)((calibSq[i] - (uint32_t)(((int64_t)calibSum[i] * calibSum[i]) / n)) / n);
+    mean[i]  = calibRef[i] + calibSum[i] / (int32_t)n;
+    settled &= (var * 16 <= n);                                                 // var / n <= (1/4)^2
+    warmOk  &= (ABS(mean[i] - (int32_t)adcCalib.warm[i]) <= CALIBRATION_WARM_TOL);
+  }
+  if (settled || warmOk || n >= CALIBRATION_SAMPLES) {
+    for (uint8_t i = 0; i < CALIB_CH; i++) adcCalib.offset[i] = (uint16_t)mean[i];
+    offsetrlA = adcCalib.offset[CALIB_RLA];
+    offsetrlB = adcCalib.offset[CALIB_RLB];
+    offsetrrB = adcCalib.offset[CALIB_RRB];
+    offsetrrC = adcCalib.offset[CALIB_RRC];
+    offsetdcl = adcCalib.offset[CALIB_DCL];
+    offsetdcr = adcCalib.offset[CALIB_DCR];
+    adcCalib.samples = (uint16_t)n;
+    adcCalib.done    = 1;
+    calibration_end();
+  }
+#else
   if(mainCounter < CALIBRATION_SAMPLES) {  // calibrate ADC offsets
     offsetrlA += adc_buffer.rlA;
     offsetrlB += adc_buffer.rlB;
@@ -165,138 +922,1287 @@ static void calibration_func(){
     offsetrrC /= CALIBRATION_SAMPLES;
     offsetdcl /= CALIBRATION_SAMPLES;
     offsetdcr /= CALIBRATION_SAMPLES;
-    timer_brushless = bldc_control;
+    adcCalib.offset[CALIB_RLA] = (uint16_t)offsetrlA;
+    adcCalib.offset[CALIB_RLB] = (uint16_t)offsetrlB;
+    adcCalib.offset[CALIB_RRB] = (uint16_t)offsetrrB;
+    adcCalib.offset[CALIB_RRC] = (uint16_t)offsetrrC;
+    adcCalib.offset[CALIB_DCL] = (uint16_t)offsetdcl;
+    adcCalib.offset[CALIB_DCR] = (uint16_t)offsetdcr;
+    adcCalib.samples = CALIBRATION_SAMPLES;
+    adcCalib.done    = 1;
+    calibration_end();
   }
+#endif
 }
 
+#if defined(SELF_TEST)
+/* Boot self-test pulses (selftest.c), SELF_TEST_DUTY of the phase returned by selfTestStep against the two others */
+static void selftest_func() {
+  const int16_t cur[2][2] = {{(int16_t)(offsetrlA - adc_buffer.rlA), (int16_t)(offsetrlB - adc_buffer.rlB)},
+                             {(int16_t)(offsetrrB - adc_buffer.rrB), (int16_t)(offsetrrC - adc_buffer.rrC)}};
+  const int16_t dc[2]     = {(int16_t)(offsetdcl - adc_buffer.dcl), (int16_t)(offsetdcr - adc_buffer.dcr)};
+  int8_t   phase = selfTestStep(&selfTest, cur, dc);
+  uint16_t d     = (uint16_t)((uint32_t)pwm_res * SELF_TEST_DUTY / 2000);
+  uint16_t duty[3];
+
+  if (phase == SELF_TEST_END) {
+    LEFT_TIM->BDTR  &= ~TIM_BDTR_MOE;
+    RIGHT_TIM->BDTR &= ~TIM_BDTR_MOE;
+    timer_brushless  = bldc_control;
+    return;
+  }
+  for (uint8_t k = 0; k < 3; k++) {
+    duty[k] = phase == SELF_TEST_OFF ? pwm_res / 2 : (k == phase ? pwm_res / 2 + d : pwm_res / 2 - d);
+  }
+  #if defined(MOTOR_LEFT_ENA)
+  LEFT_TIM->CCR1  = duty[0];
+  LEFT_TIM->CCR2  = duty[1];
+  LEFT_TIM->CCR3  = duty[2];
+  PWM_OUT_ENA(LEFT_TIM);
+  #endif
+  #if defined(MOTOR_RIGHT_ENA)
+  RIGHT_TIM->CCR1 = duty[0];
+  RIGHT_TIM->CCR2 = duty[1];
+  RIGHT_TIM->CCR3 = duty[2];
+  PWM_OUT_ENA(RIGHT_TIM);
+  #endif
+}
+#endif
+
+#if defined(OFFSET_TRACK)
+/* ADC offset drift tracking of motor m (0: left, 1: right) with the samples a, b, dc of this tick.
+ * While the outputs are off the mean of 2^OFFSET_TRACK_SHIFT samples moves each offset by at most OFFSET_TRACK_SLEW,
+ * within OFFSET_TRACK_MAX of the power-on calibration. A step with a sample outside OFFSET_TRACK_BAND is dropped,
+ * with the outputs on the running step starts over */
+static inline void offsetTrackRestart(uint8_t m) {
+  trkN[m]   = 0;
+  trkBad[m] = 0;
+  trkSum[m][0] = trkSum[m][1] = trkSum[m][2] = 0;
+}
+
+RAMFUNC static void offsetTrack(uint8_t m, uint8_t off, uint16_t a, uint16_t b, uint16_t dc) {
+  const uint16_t smp[3] = {a, b, dc};
+  if (!off) {
+    offsetTrackRestart(m);
+    return;
+  }
+  for (uint8_t k = 0; k < 3; k++) {
+    trkBad[m]    |= (ABS((int32_t)smp[k] - (int32_t)*trkOffset[trkCh[m][k]]) > OFFSET_TRACK_BAND);
+    trkSum[m][k] += smp[k];
+  }
+  if (++trkN[m] < (1U << OFFSET_TRACK_SHIFT)) return;
+
+  if (!trkBad[m]) {
+    uint16_t drift = 0;
+    for (uint8_t k = 0; k < 3; k++) {
+      uint8_t c    = trkCh[m][k];
+      int32_t mean = (int32_t)((trkSum[m][k] + (1U << (OFFSET_TRACK_SHIFT - 1))) >> OFFSET_TRACK_SHIFT);
+      int32_t o    = (int32_t)*trkOffset[c];
+      o += clampSym(mean - o, OFFSET_TRACK_SLEW);
+      o  = adcCalib.offset[c] + clampSym(o - adcCalib.offset[c], OFFSET_TRACK_MAX);
+      *trkOffset[c] = (uint32_t)o;
+    }
+    for (uint8_t c = 0; c < CALIB_CH; c++) {
+      drift = MAX(drift, (uint16_t)ABS((int32_t)*trkOffset[c] - adcCalib.offset[c]));
+    }
+    adcCalib.drift = drift;
+  }
+  offsetTrackRestart(m);
+}
+#endif
+
+#if defined(IDLE_POWER_SAVE)
+/* =========================== Idle Power Save ===========================
+ * The update event of the master timer starts the ADC conversions, whose DMA transfer raises the control interrupt.
+ * Its repetition counter decimates the update event, RCR = 2 * div - 1 gives one update every 2 * div half periods of
+ * the center aligned timer, the odd RCR keeps the sampling point. A new RCR is taken over at the next update, so it sets the interval that ends
+ * at the interrupt after the next one. Returns the ticks (PWM periods) since the previous interrupt.
+ */
+static inline uint8_t idleRate(void) {
+  static uint8_t div1 = 1, div2 = 1;    // [ticks] dividers written by the last and by the previous interrupt
+  uint8_t ticks = div2;
+  uint8_t div   = (idleReq && !idleWake && timer_brushless == bldc_control) ? IDLE_DIV : 1;
+
+  #if defined(PWM_CARRIER_DOUBLE)
+  if (pwmCarrierPend) {
+    div = 1;                            // the carrier change owns the RCR for one more interrupt
+  }
+  if (div != div1) {
+    LEFT_TIM->RCR = 2 * div * pwmCarrier - 1;
+  }
+  #else
+  if (div != div1) {
+    LEFT_TIM->RCR = 2 * div - 1;
+  }
+  #endif
+  div2 = div1;
+  div1 = div;
+  return ticks;
+}
+
+/* Idle interrupt instead of the controller: outputs off, a hall edge ends the idle mode at the next interrupt and
+ * bldc_control counts it once the full rate is back */
+static inline void idleStep(uint8_t ticks) {
+  LEFT_TIM->BDTR  &= ~TIM_BDTR_MOE;
+  RIGHT_TIM->BDTR &= ~TIM_BDTR_MOE;
+  if (hall2pos[HALL_READ(LEFT_HALL_PORT, LEFT_HALL_SHIFT)] != pos[0][0] ||
+      hall2pos[HALL_READ(RIGHT_HALL_PORT, RIGHT_HALL_SHIFT)] != pos[1][0]) {
+    idleWake = 1;
+  }
+  #if defined(HALL_COM_HW)
+  comHw[0] = comHw[1] = 0;
+  #endif
+  idleTicks += ticks;
+}
+#endif
+
+#if defined(PWM_CARRIER_DOUBLE)
+/* =========================== PWM Carrier ===========================
+ * The carrier runs at PWM_FREQ (pwmCarrier 1) or at twice that (2), the control interrupt at PWM_FREQ in both: the
+ * timer period halves and the master timer repetition counter doubles. A change takes two interrupts. The first one
+ * writes the RCR of the new carrier, the next update takes it over for the interval the second one switches: both
+ * timers are stopped (the master is gated by the enable of the other one), get the new ARR and keep their counts
+ * since the top, so the interval keeps its length and the offset of the timers stays. The running duties are
+ * rescaled with the compare preload off, the half period in progress continues at the same duty ratio and the next
+ * update takes the duties of this tick. Dead time, dtComp and pwm_margin are times and stay as they are.
+ * Only from the full rate, idleRate leaves the RCR alone while a change is pending.
+ */
+RAMFUNC static void carrierSwitch(uint8_t c) {
+  TIM_TypeDef *const tim[2] = {LEFT_TIM, RIGHT_TIM};
+  uint16_t arr = PWM_RES / c;
+
+  RIGHT_TIM->CR1 &= ~TIM_CR1_CEN;       // both timers stop at once
+  for (uint8_t m = 0; m < 2; m++) {
+    TIM_TypeDef *t   = tim[m];
+    uint16_t    old  = (uint16_t)t->ARR;
+    uint16_t    cnt  = (uint16_t)t->CNT;
+    uint16_t    past = old - cnt;       // [timer counts] since the top, counting down
+    t->ARR = arr;
+    t->CNT = ((t->CR1 & TIM_CR1_DIR) && past < arr) ? arr - past : (uint32_t)cnt * arr / old;  // else a late interrupt
+    t->CCMR1 &= ~(TIM_CCMR1_OC1PE | TIM_CCMR1_OC2PE);
+    t->CCMR2 &= ~TIM_CCMR2_OC3PE;
+    for (uint8_t i = 0; i < 3; i++) {
+      pwmCcr[m][i] = clampU16((int32_t)pwmCcr[m][i] * arr / old, arr - pwm_margin);
+    }
+    t->CCR1 = pwmCcr[m][0];
+    t->CCR2 = pwmCcr[m][1];
+    t->CCR3 = pwmCcr[m][2];
+    t->CCMR1 |= TIM_CCMR1_OC1PE | TIM_CCMR1_OC2PE;
+    t->CCMR2 |= TIM_CCMR2_OC3PE;
+  }
+  RIGHT_TIM->CR1 |= TIM_CR1_CEN;
+
+  pwm_res    = arr;
+  pwmShift   = c - 1;
+  pwmCarrier = c;
+}
+
+static inline void carrierStep(void) {
+  if (pwmCarrierPend) {
+    pwmCarrierPend = 0;
+    carrierSwitch(3 - pwmCarrier);
+  } else if (pwmCarrierReq != pwmCarrier && LEFT_TIM->RCR == 2u * pwmCarrier - 1) {
+    LEFT_TIM->RCR  = 2 * (3 - pwmCarrier) - 1;
+    pwmCarrierPend = 1;
+  }
+}
+#endif
+
+// Result of slow channel r (1 = battery voltage) of the injected group, behind the DC link currents with DC_LINK_EST
+#define ADC_SLOW_JDR(adc, r)    ((uint16_t)(&(adc)->JDR1)[(r) - 1 + ADC_DC_INJ])
+
+#if defined(ADC_TEMP_DECIM)
+/* The last rank of the ADC1 injected group (JSQ4, rank 2 of the slow channels) converts the battery voltage (JSQ3) again,
+ * every ADC_TEMP_PERIOD ms the temperature sensor or VREFINT in turn, with their long sampling. The previous group ended long before this interrupt: its result is taken
+ * before the next group starts, so it belongs to the channel selected then */
+static inline void adcSlowSel(uint8_t ticks) {
+  static uint16_t cnt;                  // [ticks] since the last temperature or VREFINT group
+  static uint8_t  sel  = ADC_CHANNEL_TEMPSENSOR;  // [-] channel of the last rank in the running group, 0 = battery voltage
+  static uint8_t  next = ADC_CHANNEL_VREFINT;
+  uint32_t jsqr = ADC1->JSQR & ~ADC_JSQR_JSQ4;
+
+  if (sel == ADC_CHANNEL_TEMPSENSOR) {
+    adc_buffer.temp = ADC_SLOW_JDR(ADC1, 2);
+  } else if (sel == ADC_CHANNEL_VREFINT) {
+    adc_buffer.vref = ADC_SLOW_JDR(ADC1, 2);
+  }
+  cnt += ticks;
+  if (cnt >= ADC_TEMP_PERIOD * PWM_FREQ / 1000) {
+    cnt        = 0;
+    sel        = next;
+    next       = (next == ADC_CHANNEL_TEMPSENSOR) ? ADC_CHANNEL_VREFINT : ADC_CHANNEL_TEMPSENSOR;
+    ADC1->JSQR = jsqr | ((uint32_t)sel << ADC_JSQR_JSQ4_Pos);
+  } else if (sel) {
+    sel        = 0;
+    ADC1->JSQR = jsqr | (((jsqr & ADC_JSQR_JSQ3) >> ADC_JSQR_JSQ3_Pos) << ADC_JSQR_JSQ4_Pos);  // battery voltage channel
+  }
+}
+#endif
+
+/* Ping-pong DMA: the regular group of each PWM period fills one half of adc_dma, the half transfer and the transfer
+ * complete interrupts alternate. The half completed last is latched into the adc_buffer fields the controller reads
+ * while the DMA fills the other one, so a late interrupt still sees one coherent sample set. The remaining count tells
+ * the half, also when an interrupt was missed. With ADC_OVERSAMPLE the samples are averaged: a DMA word holds ADC1 in the
+ * low and ADC2 in the high half, 4 12-bit samples sum to less than 16 bits, so both halves are summed in one add.
+ * With DC_LINK_EST the DC link currents come from the injected group started by the last interrupt, long ended */
+static inline void adcLatch(void) {
+  const volatile uint32_t *w = adc_dma[DMA1_Channel1->CNDTR > ADC_REG_WORDS];
+  uint32_t sumL = 0, sumR = 0;
+  for (uint8_t i = 0; i < ADC_OVERSAMPLE; i++) {
+    sumL += w[ADC_DC_REG + 2 * i];
+    sumR += w[ADC_DC_REG + 1 + 2 * i];
+  }
+  #if defined(DC_LINK_EST)
+  adc_buffer.dcr = (uint16_t)ADC1->JDR1;
+  adc_buffer.dcl = (uint16_t)ADC2->JDR1;
+  #else
+  adc_buffer.dcr = (uint16_t)w[0];
+  adc_buffer.dcl = (uint16_t)(w[0] >> 16);
+  #endif
+  adc_buffer.rlA = (uint16_t)(((sumL & 0xFFFF) + ADC_OVERSAMPLE / 2) / ADC_OVERSAMPLE);
+  adc_buffer.rlB = (uint16_t)(((sumL >> 16)    + ADC_OVERSAMPLE / 2) / ADC_OVERSAMPLE);
+  adc_buffer.rrB = (uint16_t)(((sumR & 0xFFFF) + ADC_OVERSAMPLE / 2) / ADC_OVERSAMPLE);
+  adc_buffer.rrC = (uint16_t)(((sumR >> 16)    + ADC_OVERSAMPLE / 2) / ADC_OVERSAMPLE);
+}
 
 // =================================
-// DMA interrupt frequency =~ 16 kHz
+// DMA interrupt frequency = PWM_FREQ, PWM_FREQ / IDLE_DIV in idle
 // =================================
-void DMA1_Channel1_IRQHandler() {
-  DMA1->IFCR = DMA_IFCR_CTCIF1;
-  mainCounter++;
+RAMFUNC void DMA1_Channel1_IRQHandler() {
+  uint32_t tIsr = DWT->CYCCNT;
+  uint8_t  missStage = ISR_STAGE_NONE;
+  TRACE_ISR_ENTER(TRACE_ISR_CONTROL);
+  DMA1->IFCR = DMA_IFCR_CHTIF1 | DMA_IFCR_CTCIF1;
+  adcLatch();
+  #if defined(PARAM_STAGED)
+  bldc_param_swap();
+  #endif
+  #if defined(SERIAL_EXT_CMD)
+  extCmdTick();
+  #endif
+  uint8_t ticks = 1;                              // [ticks] PWM periods since the last interrupt
+  #if defined(IDLE_POWER_SAVE)
+  ticks = idleRate();
+  #endif
+  #if defined(PWM_CARRIER_DOUBLE)
+  carrierStep();
+  #endif
+  #if defined(ADC_TEMP_DECIM)
+  adcSlowSel(ticks);
+  #endif
+  ADC1->CR2 |= ADC_CR2_JSWSTART;                  // currents are sampled, start the slow channels (injected group, ADC1 + ADC2)
+  mainCounter += ticks;
   static boolean_T OverrunFlag = false; //looks very ugly
   /* Check for overrun */
   if (OverrunFlag) {
+    isrMissTrack(ISR_STAGE_REENTRY, 0);
+    TRACE_ISR_EXIT(TRACE_ISR_CONTROL);
     return;
   }
   OverrunFlag = true;
-  timer_brushless();
+  #if defined(ISR_PROFILING)
+  if (isrProfRst) isrProfReset();
+  #endif
+  #if defined(IDLE_POWER_SAVE)
+  if (ticks > 1) {
+    idleStep(ticks);                              // the controller waits for the full rate, its time steps are fixed
+  } else
+  #endif
+  {
+    ISR_PROF_START(tCtrl);
+    timer_brushless();
+    ISR_PROF_STOP(tCtrl, ISR_PROF_CTRL);
+    ISR_DEADLINE_CHECK(missStage, ISR_STAGE_CTRL);
+  }
+  bldc_state_publish();
     /* Indicate task complete */
   OverrunFlag = false;
-  buzzerFunc();
 
+  buzzerTimer += ticks;
+  SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;             // trigger the low priority slow task (buzzer, battery filter)
+
+  uint32_t cycIsr = DWT->CYCCNT - tIsr;
+  if (missStage != ISR_STAGE_NONE) {
+    isrMissTrack(missStage, cycIsr);
+  }
+  isrMissWindow(ticks);
+
+  #if defined(ISR_PROFILING)
+  isrProfUpdate(&isrProf[ISR_PROF_TOTAL], cycIsr);
+  isrProfHist[MIN(cycIsr * ISR_PROF_HIST_BINS / ISR_PERIOD_CYCLES, ISR_PROF_HIST_BINS - 1)]++;
+  #endif
+  TRACE_ISR_EXIT(TRACE_ISR_CONTROL);
+}
+
+// =================================
+// Slow task, runs in PendSV at lowest interrupt priority
+// It is triggered by every control interrupt and catches up if ticks were missed
+// =================================
+void bldc_slow_task(void) {
+  static uint32_t slowTimer       = 0;
+  static uint16_t buzzerPatCnt    = 0;
+  static uint8_t  buzzerPatIdx    = 0;
+  static uint8_t  buzzerFreqCnt   = 0;
+  static uint16_t batFiltCnt      = 0;
+  #if defined(ADC_INPUT_OVS)
+  static uint8_t  adcOvsCnt       = 0;
+  #endif
+  #if defined(ANTILOCK_BRAKE)
+  static uint8_t  antilockCnt     = 0;
+  #endif
+  #if defined(VBAT_COMP)
+  static uint32_t vbatSum         = 0;
+  static uint8_t  vbatCnt         = 0;
+  #endif
+  #if PWM_FREQ != PWM_FREQ_BASE
+  static uint16_t buzzerTickAcc   = 0;
+  #endif
+
+  // Get the slow ADC channels (injected group) started by the control interrupt
+  if (ADC1->SR & ADC_SR_JEOC) {
+    adc_buffer.batt1 = ADC_SLOW_JDR(ADC1, 1);
+    #if !defined(ADC_TEMP_DECIM)
+    adc_buffer.temp  = ADC_SLOW_JDR(ADC1, 2);     // else taken by adcSlowSel
+    #endif
+    #if !defined(ADC_INPUT_OVS)
+    adc_buffer.l_tx2 = ADC_SLOW_JDR(ADC2, 1);
+    adc_buffer.l_rx2 = ADC_SLOW_JDR(ADC2, 2);
+    #endif
+    ADC1->SR = ~ADC_SR_JEOC;
+  }
+
+  #if defined(ADC_INPUT_OVS)
+  // Pot inputs from the ADC3 stream: the last ADC_INPUT_OVS pairs, summed as words like the phase currents
+  if (++adcOvsCnt >= PWM_FREQ / 1000) {
+    uint32_t sum = 0;
+    adcOvsCnt = 0;
+    for (uint8_t i = 0; i < ADC_INPUT_OVS; i++) {
+      sum += adc_ovs[i];
+    }
+    adcInOvs[0]      = (uint16_t)(sum & 0xFFFF);
+    adcInOvs[1]      = (uint16_t)(sum >> 16);
+    adc_buffer.l_tx2 = (uint16_t)((adcInOvs[0] + ADC_INPUT_OVS / 2) / ADC_INPUT_OVS);
+    adc_buffer.l_rx2 = (uint16_t)((adcInOvs[1] + ADC_INPUT_OVS / 2) / ADC_INPUT_OVS);
+  }
+  #endif
+
+  while (slowTimer != buzzerTimer) {
+    slowTimer++;
+    buzzerFunc();
+
+    if (++batFiltCnt >= PWM_FREQ / 16) {            // Filter battery voltage at a slower sampling rate (16 Hz)
+      batFiltCnt = 0;
+      ISR_PROF_START(tBat);
+      filtLowPass32Fast(adc_buffer.batt1, BAT_FILT_COEF, &batVoltageFixdt);
+      batVoltage = (int16_t)(batVoltageFixdt >> 16);  // convert fixed-point to integer
+      ISR_PROF_STOP(tBat, ISR_PROF_BAT);
+    }
+
+    #if defined(VBAT_COMP)
+    vbatSum += adc_buffer.batt1;
+    if (++vbatCnt >= PWM_FREQ / 1000) {             // Fast battery voltage and the duty scale of VBAT_COMP at 1 kHz
+      vbatFast += (int32_t)((vbatSum << 8) / (PWM_FREQ / 1000) - vbatFast) >> 2;
+      vbatSum   = 0;
+      vbatCnt   = 0;
+      vbatK     = (int16_t)CLAMP(((uint32_t)VBAT_COMP_ADC << 16) / (uint32_t)MAX(vbatFast >> 4, 1), 1 << 10, 5 << 10);
+    }
+    #endif
+
+    #if defined(ANTILOCK_BRAKE)
+    if (++antilockCnt >= PWM_FREQ / 1000) {         // Wheel slip check at 1 kHz, TORQUE mode commands only
+      antilockCnt = 0;
+      uint8_t trq = (ctrlModReq == TRQ_MODE);
+      antilockStep(&antilock, rtY_Left.n_mot, rtY_Right.n_mot, trq ? (int16_t)pwml : 0, trq ? (int16_t)pwmr : 0);
+    }
+    #endif
 
-  // Create square wave for buzzer
-  buzzerTimer++;
-  if (buzzerFreq != 0 && (buzzerTimer / 5000) % (buzzerPattern + 1) == 0) {
-    if (buzzerPrev == 0) {
-      buzzerPrev = 1;
-      if (++buzzerIdx > (buzzerCount + 2)) {    // pause 2 periods
-        buzzerIdx = 1;
+    // The buzzer steps at PWM_FREQ_BASE, so buzzerFreq gives the same pitch at any PWM_FREQ
+    #if PWM_FREQ != PWM_FREQ_BASE
+    buzzerTickAcc += PWM_FREQ_BASE;
+    if (buzzerTickAcc < PWM_FREQ) {
+      continue;
+    }
+    buzzerTickAcc -= PWM_FREQ;
+    #endif
+
+    // Create square wave for buzzer
+    ISR_PROF_START(tBuzzer);
+    if (beepNoteTicks == 0 && !ringEmpty(&beepRing)) {  // next queued note of beepNote
+      const BeepNote *n = &beepQueue[ringOut(&beepRing, BEEP_QUEUE_LEN)];
+      beepNoteFreq  = n->freq;
+      beepNoteTicks = (uint32_t)n->ms * (PWM_FREQ_BASE / 1000);
+      ringPop(&beepRing, 1);
+    }
+    if (beepNoteTicks) {                            // the queued notes have priority over the buzzerFreq patterns
+      if (++buzzerFreqCnt >= beepNoteFreq) {
+        buzzerFreqCnt = 0;
+      }
+      if (beepNoteFreq != 0 && buzzerFreqCnt == 0) {
+        HAL_GPIO_TogglePin(BUZZER_PORT, BUZZER_PIN);
       }
+      if (--beepNoteTicks == 0) {
+        HAL_GPIO_WritePin(BUZZER_PORT, BUZZER_PIN, GPIO_PIN_RESET);
+        buzzerPrev = 0;
+      }
+    } else {
+      if (++buzzerPatCnt >= 5000) {                 // buzzer pattern period is 5000 ticks
+        buzzerPatCnt = 0;
+        if (++buzzerPatIdx > buzzerPattern) {
+          buzzerPatIdx = 0;
+        }
+      }
+      if (++buzzerFreqCnt >= buzzerFreq) {
+        buzzerFreqCnt = 0;
+      }
+      if (buzzerFreq != 0 && buzzerPatIdx == 0) {
+        if (buzzerPrev == 0) {
+          buzzerPrev = 1;
+          if (++buzzerIdx > (buzzerCount + 2)) {  // pause 2 periods
+            buzzerIdx = 1;
+          }
+        }
+        if (buzzerFreqCnt == 0 && (buzzerIdx <= buzzerCount || buzzerCount == 0)) {
+          HAL_GPIO_TogglePin(BUZZER_PORT, BUZZER_PIN);
+        }
+      } else if (buzzerPrev) {
+          HAL_GPIO_WritePin(BUZZER_PORT, BUZZER_PIN, GPIO_PIN_RESET);
+          buzzerPrev = 0;
+      }
+    }
+    ISR_PROF_STOP(tBuzzer, ISR_PROF_BUZZER);
+  }
+}
+
+/* Clamp the three phase duties around pwm_res / 2 and write them to CCR1..CCR3 (U, V, W, see defines.h).
+ * The phase currents are sampled at the counter peak, while the low side FETs are on. Only the two phases with a
+ * shunt need the sampling window: they are limited to pwm_res - pwm_margin, the phase without a shunt (noShunt,
+ * its current is reconstructed from the other two) and the bottom of all phases are not limited.
+ * The three duties can be shifted together without changing the line-to-line voltages and so the phase currents:
+ * with PWM_ZSEQ_MID only as far as needed to bring the shunt phases into their window, with PWM_ZSEQ_LOW always
+ * to put the lowest phase on the bottom (COM, SIN: it stops switching).
+ * With rail (OVERMOD) the highest shunt phase may go to the rail as well, if it is above its window by half the margin
+ * and the two other phases leave the sampling window: its current then is the one of the DC link shunt.
+ * CCRx are preloaded and take effect at the next update event. With hold the update event is disabled (UDIS)
+ * during the writes, so an update in between keeps the three old values for one more update instead of mixing them.
+ * Only for TIM1: UDIS would also drop the TIM8 update that triggers the ADC, and TIM8 updates only once per period,
+ * so a left duty write across its update is already a deadline miss. The written CCR values are returned in d */
+static inline void pwmApply(TIM_TypeDef *tim, uint16_t d[3], int u, int v, int w, uint8_t noShunt, uint8_t hold,
+                                     uint8_t rail) {
+  int duty[3] = {u + pwm_res / 2, v + pwm_res / 2, w + pwm_res / 2};
+  int top[3]  = {pwm_res - pwm_margin, pwm_res - pwm_margin, pwm_res - pwm_margin};
+  int low     = MIN3(duty[0], duty[1], duty[2]);
+  int shift;
+  top[noShunt] = pwm_res;
+  if (pwmZeroSeq == PWM_ZSEQ_LOW) {
+    shift = -low;
+  } else {
+    int over = MAX(duty[0] - top[0], MAX(duty[1] - top[1], duty[2] - top[2]));
+    if (over > 0) {
+      shift = -MIN(over, MAX(low, 0));  // down into the window, as far as the bottom allows
+    } else if (low < 0) {
+      shift = MIN(-low, -over);         // up from below the bottom, as far as the window allows
+    } else {
+      shift = 0;
     }
-    if (buzzerTimer % buzzerFreq == 0 && (buzzerIdx <= buzzerCount || buzzerCount == 0)) {
-      HAL_GPIO_TogglePin(BUZZER_PORT, BUZZER_PIN);
+  }
+  if (rail) {
+    uint8_t a = (noShunt + 1) % 3, b = (noShunt + 2) % 3;
+    uint8_t h = (duty[a] >= duty[b]) ? a : b;
+    if (duty[h] + shift > top[h] + pwm_margin / 2 && duty[noShunt] + shift <= pwm_res - pwm_margin) {
+      top[h] = pwm_res;
     }
-  } else if (buzzerPrev) {
-      HAL_GPIO_WritePin(BUZZER_PORT, BUZZER_PIN, GPIO_PIN_RESET);
-      buzzerPrev = 0;
   }
+  for (uint8_t i = 0; i < 3; i++) {
+    d[i] = clampU16(duty[i] + shift, top[i]);
+  }
+  if (hold) {
+    tim->CR1 |= TIM_CR1_UDIS;
+  }
+  tim->CCR1 = d[0];
+  tim->CCR2 = d[1];
+  tim->CCR3 = d[2];
+  if (hold) {
+    tim->CR1 &= ~TIM_CR1_UDIS;
+  }
+}
 
+#if defined(ADC_SAMPLE_ALIGN)
+/* =========================== ADC Sample Point ===========================
+ * TIM8 channel 4 in PWM mode 2 rises at its compare on the way up, its OC4REF is the TRGO that starts the conversions.
+ * The compare is preloaded like the duties, the next update (the top, the valley with CTRL_VALLEY_LOAD) takes both.
+ * ADC_SAMPLE_SETTLE keeps the trigger behind the last low side switch-on of the shunt phases: left U, V and right V, W,
+ * whose top comes ADC_TOTAL_CONV_TIME after the left one (setup.c). The window is symmetric around the top, so the offset only ever moves towards it.
+ * $ADCSWEEP takes over the offset: ADC_SWEEP_POINTS points from ADC_SAMPLE_SWEEP to the top, each ADC_SWEEP_TICKS
+ * ticks after ADC_SWEEP_SKIP ticks for the new compare to apply, and sums the four shunt currents and their squares.
+ */
+static inline void adcSweepStep(void) {
+  AdcSweep *w = &adcSweep;
+  const int16_t cur[4] = {curL_phaA, curL_phaB, curR_phaB, curR_phaC};
 
+  if (adcSweepReq) {
+    for (uint8_t k = 0; k < 4; k++) {
+      w->sum[k] = 0;
+      w->sq[k]  = 0;
+    }
+    w->ticks = 0;
+    w->point = 0;
+    w->state = ADC_SWEEP_RUN;
+    adcSweepReq = 0;
+  }
+  if (w->state != ADC_SWEEP_RUN) {
+    return;
+  }
+  if (!enableFin) {
+    w->state = ADC_SWEEP_FAIL;
+    return;
+  }
+  if (++w->ticks > ADC_SWEEP_SKIP) {
+    for (uint8_t k = 0; k < 4; k++) {
+      int32_t x = CLAMP(cur[k], -2047, 2047);
+      w->sum[k] += x;
+      w->sq[k]  += (uint32_t)(x * x);
+    }
+  }
+  if (w->ticks == ADC_SWEEP_SKIP + ADC_SWEEP_TICKS) {
+    for (uint8_t k = 0; k < 4; k++) {   // [ADC bits^2 * 16] N sq - sum^2 over N^2
+      int64_t v = (int64_t)ADC_SWEEP_TICKS * w->sq[k] - (int64_t)w->sum[k] * w->sum[k];
+      w->var[w->point][k] = (uint32_t)(v >> (2 * ADC_SWEEP_TICKS_LOG2 - 4));
+      w->sum[k] = 0;
+      w->sq[k]  = 0;
+    }
+    w->ticks = 0;
+    if (++w->point == ADC_SWEEP_POINTS) {
+      w->state = ADC_SWEEP_DONE;
+    }
+  }
+}
 
-  //HAL_GPIO_WritePin(LED_PORT, LED_PIN, 1);
-  //HAL_GPIO_WritePin(LED_PORT, LED_PIN, 0);
-  if (buzzerTimer % 1000 == 0) {  // Filter battery voltage at a slower sampling rate
-    filtLowPass32(adc_buffer.batt1, BAT_FILT_COEF, &batVoltageFixdt);
-    batVoltage = (int16_t)(batVoltageFixdt >> 16);  // convert fixed-point to integer
+#define SMP_CCR(c)      ((c) < pwm_res ? (c) : 0)  // a shunt phase at the rail (OVERMOD) does not switch near the top
+static inline void adcSampleStep(void) {
+  int32_t ofs = adcSmpOfs;
+  #if ADC_SAMPLE_SETTLE > 0
+  int32_t winL = pwm_res - MAX(SMP_CCR(pwmCcr[0][0]), SMP_CCR(pwmCcr[0][1])) - DEAD_TIME;
+  int32_t winR = pwm_res - MAX(SMP_CCR(pwmCcr[1][1]), SMP_CCR(pwmCcr[1][2])) - DEAD_TIME - ADC_TOTAL_CONV_TIME;
+  ofs = MIN(ofs, MIN(winL, winR) - ADC_SAMPLE_SETTLE);
+  #endif
+  adcSweepStep();
+  if (adcSweep.state == ADC_SWEEP_RUN) {
+    ofs = ADC_SAMPLE_SWEEP - ADC_SAMPLE_SWEEP * adcSweep.point / (ADC_SWEEP_POINTS - 1);
   }
+  LEFT_TIM->CCR4 = pwm_res - CLAMP(ofs, 0, pwm_res / 2);
 }
 
-void bldc_control(void) {
-    /* Make sure to stop BOTH motors in case of an error */
-  enableFin = enable && !rtY_Left.z_errCode && !rtY_Right.z_errCode;
+void bldc_adc_sweep_start(void) {
+  adcSweepReq = 1;
+}
+#endif
+
+#if defined(HALL_COM_HW)
+/* =========================== Hall Edge Commutation ===========================
+ * COM_CTRL drives the phases of a hall sector with the z_commutMap roles +1, 0 and -1 times one voltage, each row is
+ * a permutation of the three. The control interrupt keeps the duties of its step per role, a hall edge interrupt
+ * writes them in the roles of the new sector with the compare preload off: the phases switch at the edge instead of
+ * at the next control interrupt and the update after it. A controller step stays in charge of the voltage.
+ * The interrupts do not mask each other: comSeq counts the edges, the control interrupt writes again if one came
+ * while it wrote, the edge interrupt always leaves the sector the hall sensors show.
+ */
+static inline const int8_t *comRoles(uint8_t hall) {
+  int8_t pos = rtConstP.vec_hallToPos_Value[((hall & 1) << 2) | (hall & 2) | (hall >> 2)];   // hall index of the controller
+  return &rtConstP.z_commutMap_M1_table[3 * (pos > 5 ? 5 : (pos < 0 ? 0 : pos))];
+}
+
+RAMFUNC static void comApply(uint8_t m, uint8_t now) {
+  TIM_TypeDef  *t = m ? RIGHT_TIM : LEFT_TIM;
+  const int8_t *r = comRoles(m ? HALL_READ(RIGHT_HALL_PORT, RIGHT_HALL_SHIFT) : HALL_READ(LEFT_HALL_PORT, LEFT_HALL_SHIFT));
+  if (now) {
+    t->CCMR1 &= ~(TIM_CCMR1_OC1PE | TIM_CCMR1_OC2PE);
+    t->CCMR2 &= ~TIM_CCMR2_OC3PE;
+  }
+  pwmApply(t, pwmCcr[m], comLvl[m][r[0] + 1], comLvl[m][r[1] + 1], comLvl[m][r[2] + 1], m ? 0 : 2, m && !now, 0);
+  if (now) {
+    t->CCMR1 |= TIM_CCMR1_OC1PE | TIM_CCMR1_OC2PE;
+    t->CCMR2 |= TIM_CCMR2_OC3PE;
+  }
+}
+
+/* Control interrupt, duties u, v, w of the controller step of motor m at the hall state of the tick. Returns 0 if the
+ * step is not a block commutation (other control type, outputs off, hall calibration or motor identification running),
+ * the control interrupt then writes the duties itself */
+static inline uint8_t comStep(uint8_t m, const P *p, uint8_t hall, int u, int v, int w) {
+  const int8_t *r   = comRoles(hall);
+  uint8_t       own = (p->z_ctrlTypSel == COM_CTRL) && enableFin;
+  uint8_t       seq;
+  #if defined(HALL_CALIB)
+  own &= !(hallCal[m].state >= HALL_CAL_ALIGN && hallCal[m].state <= HALL_CAL_STOP);
+  #endif
+  #if defined(MOTOR_IDENT)
+  own &= !(motId[m].state >= MOT_ID_ALIGN && motId[m].state <= MOT_ID_COAST);
+  #endif
+  if (!own) {
+    comHw[m] = 0;
+    return 0;
+  }
+  comLvl[m][r[0] + 1] = u;
+  comLvl[m][r[1] + 1] = v;
+  comLvl[m][r[2] + 1] = w;
+  comHw[m] = 1;
+  do {
+    seq = comSeq[m];
+    comApply(m, 0);
+  } while (seq != comSeq[m]);
+  return 1;
+}
+
+static inline void comEdge(uint8_t m) {
+  TRACE_ISR_ENTER(TRACE_ISR_COMMUT);
+  comEdgeUs[m] = timeUs();
+  comSeq[m]++;
+  if (comHw[m]) {
+    comApply(m, 1);
+  }
+  TRACE_ISR_EXIT(TRACE_ISR_COMMUT);
+}
+
+/* Hall edges of the left motor (EXTI lines 5..7) and of the right motor (EXTI lines 10..12) */
+RAMFUNC void EXTI9_5_IRQHandler(void) {
+  EXTI->PR = LEFT_HALL_U_PIN | LEFT_HALL_V_PIN | LEFT_HALL_W_PIN;
+  comEdge(0);
+}
+
+RAMFUNC void EXTI15_10_IRQHandler(void) {
+  EXTI->PR = RIGHT_HALL_U_PIN | RIGHT_HALL_V_PIN | RIGHT_HALL_W_PIN;
+  comEdge(1);
+}
+#endif
+
+#if defined(DC_FOLDBACK)
+/* Soft stage2 current limit of motor m: the duties u, v, w [timer counts around the centre] are scaled by dcFold,
+ * which drops by DC_FOLD_ATTACK per ADC count of DC current above I_DC_FOLD and recovers by DC_FOLD_RELEASE per tick.
+ * The voltage follows the current within a few ticks instead of the on / off of the MOE cut */
+static inline void dcFoldApply(uint8_t m, int16_t iDc, int *u, int *v, int *w) {
+  int32_t over = ABS(iDc) - curDC_fold;
+  int32_t f    = (over > 0) ? (int32_t)dcFold[m] - over * DC_FOLD_ATTACK : (int32_t)dcFold[m] + DC_FOLD_RELEASE;
+  dcFold[m]    = clampU16(f, 32768);
+  if (dcFold[m] < 32768) {
+    *u = (*u * dcFold[m]) >> 15;
+    *v = (*v * dcFold[m]) >> 15;
+    *w = (*w * dcFold[m]) >> 15;
+  }
+}
+#endif
+
+#if defined(DC_LINK_EST)
+/* DC link current of motor m [ADC bits, negative = discharge] from its phase currents a, b, c and the duties of the
+ * period they were sampled in: a phase carries its current to the battery while its high side is on, CCR / ARR of the
+ * period. The currents sum to zero, so the duties count from the centre. COM and SIN (no pwm_margin) do not sample in
+ * the low side window and keep the shunt, which is filtered by the board and a tick old. The shunt cross-checks both */
+static inline int16_t dcEstimate(uint8_t m, int16_t a, int16_t b, int16_t c, int16_t shunt) {
+  const int32_t h = pwm_res / 2;
+  int32_t s   = ((int32_t)pwmCcr[m][0] - h) * a + ((int32_t)pwmCcr[m][1] - h) * b + ((int32_t)pwmCcr[m][2] - h) * c;
+  int16_t iDc = pwm_margin ? (int16_t)clampSym(-s / pwm_res, INT16_MAX) : shunt;
+  dcEstAcc[m][0] += shunt * 16 - (dcEstAcc[m][0] >> DC_EST_FILT);
+  dcEstAcc[m][1] += (iDc - shunt) * 16 - (dcEstAcc[m][1] >> DC_EST_FILT);
+  dcEstShunt[m]   = (int16_t)(dcEstAcc[m][0] >> DC_EST_FILT);
+  dcEstDev[m]     = (int16_t)(dcEstAcc[m][1] >> DC_EST_FILT);
+  return iDc;
+}
+#endif
+
+#if defined(OVERMOD)
+/* Overmodulation of motor m (FOC): while the voltage vector of the controller outputs y is at OVERMOD_ENTER % of
+ * FOC_VOLT_MAX the gain rises by OVERMOD_RATE per tick up to OVERMOD_GAIN_MAX, below OVERMOD_EXIT % it falls back to 1.0.
+ * The duties u, v, w [timer counts around the centre] are scaled by it, pwmApply clips them to the PWM range.
+ * (2a - b - c)^2 + 3 (b - c)^2 of the phase outputs = 12 |V|^2: the zero sequence cancels, the inverse Clarke transform
+ * of the controller scales the phases by 2 / sqrt(3) (Gain4), a vector at FOC_VOLT_MAX spans 2 FOC_VOLT_MAX. Returns 1 in overmodulation */
+#define OM_SAT(pct)     (12L * (FOC_VOLT_MAX * (pct) / 100) * (FOC_VOLT_MAX * (pct) / 100))
+static inline uint8_t overmodApply(uint8_t m, const P *p, const ExtY *y, int *u, int *v, int *w) {
+  int32_t al = 2 * y->DC_phaA - y->DC_phaB - y->DC_phaC;
+  int32_t be = y->DC_phaB - y->DC_phaC;
+  int32_t v2 = al * al + 3 * be * be;
+  int32_t g  = overmodGain[m];
+  if (!enableFin || p->z_ctrlTypSel != FOC_CTRL) {
+    g = 1024;
+  } else if (v2 >= OM_SAT(OVERMOD_ENTER)) {
+    g = MIN(g + OVERMOD_RATE, OVERMOD_GAIN_MAX);
+  } else if (v2 < OM_SAT(OVERMOD_EXIT)) {
+    g = MAX(g - OVERMOD_RATE, 1024);
+  }
+  overmodGain[m] = (uint16_t)g;
+  if (g == 1024) {
+    return 0;
+  }
+  *u = (*u * g) >> 10;
+  *v = (*v * g) >> 10;
+  *w = (*w * g) >> 10;
+  return 1;
+}
+#endif
+
+/* Dead time compensation of the duties u, v, w [timer counts] from the phase currents of this tick [ADC bits, + = into the motor].
+ * A current into the motor loses the dead time from its high time, one out of the motor gains it. Within DT_COMP_BAND of zero
+ * the compensation is scaled with the current, the sign of a small sampled current is not reliable.
+ * FOC only: COM and SIN run without pwm_margin, so the phase currents are not valid at high duties */
+static inline void dtCompApply(const P *p, int *u, int *v, int *w, int16_t ia, int16_t ib, int16_t ic) {
+  if (dtComp != 0 && p->z_ctrlTypSel == FOC_CTRL) {
+    *u += dtComp * clampSym(ia, DT_COMP_BITS) / DT_COMP_BITS;
+    *v += dtComp * clampSym(ib, DT_COMP_BITS) / DT_COMP_BITS;
+    *w += dtComp * clampSym(ic, DT_COMP_BITS) / DT_COMP_BITS;
+  }
+}
+
+#if defined(ANGLE_OBSERVER)
+/* Observer update before the controller step. The observer restarts while the outputs are off, its angle is
+ * fed through a_mechAngle (mechanical degrees, fixdt(1,16,4), see the controller angle input) while it is active */
+static inline void obsMotor(Observer *o, P *p, ExtU *u, const ExtY *y, int16_t ia, int16_t ib, int16_t ic,
+                                    const uint16_t ccr[3], uint8_t chop) {
+  uint16_t angle;
+  if (chop || enable == 0) {
+    obsReset(o);
+  } else {
+    const int16_t i[3] = {ia, ib, ic};
+    obsStep(o, i, ccr, (int16_t)((((int32_t)VBAT_NOW * VDC_RCP) >> 16) << PWM_SHIFT));  // duties of the carrier period
+  }
+  p->b_angleMeasEna = obsAngle(o, y->a_elecAngle, y->n_mot, &angle);
+  u->a_mechAngle    = (int16_t)((((uint32_t)angle * 5760 >> 16) + 480) / p->n_polePairs);
+}
+#endif
+
+#if defined(HALL_CALIB)
+void bldc_hall_calib_start(void) {
+  hallCalReq = 1;
+}
+
+/* Open loop duties while the calibration runs. The result is applied as long as it is not saved (HALL_CAL_DONE) */
+static inline void hallCalMotor(HallCal *c, P *p, uint8_t hall, int *u, int *v, int *w) {
+  int16_t dc[3];
+  if (hallCalReq) {
+    hallCalStart(c, hall, p->n_polePairs);
+  }
+  if (enable == 0 && c->state >= HALL_CAL_ALIGN && c->state <= HALL_CAL_STOP) {
+    c->state = HALL_CAL_FAIL;
+  }
+  if (hallCalStep(c, hall, dc)) {
+    *u = PWM_DUTY(dc[0]);
+    *v = PWM_DUTY(dc[1]);
+    *w = PWM_DUTY(dc[2]);
+  } else if (c->state == HALL_CAL_DONE) {
+    for (uint8_t k = 0; k < 6; k++) {
+      p->a_hallCorr[k] = c->corr[k];
+    }
+  }
+}
+#endif
+
+#if defined(MOTOR_IDENT)
+void bldc_motor_ident_start(void) {
+  motIdReq = 1;
+}
+
+/* Test duties while the identification injects its own voltage, VLT_MODE of the controller while the motor turns */
+static inline void motIdMotor(MotId *c, const ExtY *y, int16_t ia, int16_t ib, int16_t ic, int *u, int *v, int *w) {
+  const int16_t i[3] = {ia, ib, ic};
+  int16_t dc[3];
+  if (motIdReq) {
+    motIdStart(c);
+  }
+  if (enable == 0 && c->state >= MOT_ID_ALIGN && c->state <= MOT_ID_COAST) {
+    c->failState = c->state;
+    c->state     = MOT_ID_FAIL;
+  }
+  if (motIdStep(c, i, (int16_t)(((int32_t)VBAT_NOW * VDC_RCP) >> 16), y->a_elecAngle, y->n_mot, dc)) {
+    *u = PWM_DUTY(dc[0]);
+    *v = PWM_DUTY(dc[1]);
+    *w = PWM_DUTY(dc[2]);
+  }
+}
+#endif
+
+#if defined(SPD_FILT)
+void bldc_spd_ident_start(void) {
+  spdIdReq = 1;
+}
+
+/* Resonance sweep after the controller step: runs while the motor is on in SPD_MODE (FOC) */
+static inline void spdIdMotor(SpdId *c, const P *p, const ExtU *u, const ExtY *y) {
+  if (spdIdReq) {
+    spdIdStart(c);
+  }
+  spdIdStep(c, enableFin && u->z_ctrlModReq == SPD_MODE && p->z_ctrlTypSel == FOC_CTRL, y->n_mot);
+}
+#endif
+
+#if defined(WINDING_TEMP)
+/* Winding temperature sums of the tick: the controller duties, the phase currents ia, ib, ic, speed and iq */
+static inline void wtempMotor(WTemp *w, const ExtY *y, int16_t ia, int16_t ib, int16_t ic) {
+  const int16_t i[3]  = {ia, ib, ic};
+  const int16_t dc[3] = {y->DC_phaA, y->DC_phaB, y->DC_phaC};
+  wtempAcc(w, dc, i, y->n_mot, y->iq, WTEMP_SUM_TICKS);
+}
+#endif
+
+#if defined(COGGING_COMP)
+void bldc_cogging_start(void) {
+  cogReq = 1;
+}
+
+/* Controller inputs: the cogging compensation of a TORQUE mode target, or the SPD_MODE run while the table is recorded */
+static inline void cogMotorInput(Cogging *c, const P *p, ExtU *u, const ExtY *y) {
+  if (cogReq) {
+    cogStart(c);
+  }
+  if (enable == 0 && c->state >= COG_SETTLE_FWD && c->state <= COG_REV) {
+    c->state = COG_FAIL;
+  }
+  if (u->z_ctrlModReq == TRQ_MODE) {
+    u->r_inpTgt += cogComp(c, y->a_elecAngle, y->n_mot);
+  }
+  cogInput(c, p->n_max, &u->z_ctrlModReq, &u->r_inpTgt);
+}
+#endif
+
+#if defined(CTRL_HOOKS)
+static uint32_t hookCycles;             // [cycles] all hooks of this tick, for ISR_PROF_HOOKS
+
+/* Runs the hooks of stage for motor m on io, in table order, and switches off a hook that ran over its budget */
+RAMFUNC static void ctrlHooksRun(uint8_t stage, uint8_t m, CtrlHookIo *io) {
+  for (uint8_t i = 0; i < CTRL_HOOK_COUNT; i++) {
+    const CtrlHookDef *d = &ctrlHookDefs[i];
+    CtrlHookStat      *s = &ctrlHookStats[i];
+    if (d->stage != stage || !(d->motors & (1 << m)) || s->over) {
+      continue;
+    }
+    uint32_t t = DWT->CYCCNT;
+    d->fn(io);
+    t = DWT->CYCCNT - t;
+    ctrlHookDone(s, d->budget, t);
+    hookCycles += t;
+  }
+}
 
+/* Pre-step hooks of motor m: inputs u of the step, outputs y of the last one, currents of this tick. iLim is the
+ * current limit of the step, a hook can only lower it */
+static inline void hookPre(uint8_t m, ExtU *u, const ExtY *y, uint8_t hall, int16_t ia, int16_t ib, int16_t ic,
+                                   int16_t idc, int16_t *iLim) {
+  CtrlHookIo io = {m, hall, y->z_errCode, u->z_ctrlModReq, ia, ib, ic, idc, y->n_mot, y->iq, y->id, y->a_elecAngle,
+                   u->r_inpTgt, *iLim, 0, 0, 0};
+  ctrlHooksRun(CTRL_HOOK_PRE, m, &io);
+  u->z_ctrlModReq = io.ctrlMod;
+  u->r_inpTgt     = io.inpTgt;
+  *iLim           = CLAMP(io.iMax, 0, *iLim);
+}
+
+/* Post-step hooks of motor m: outputs y of this step, duties u, v, w */
+static inline void hookPost(uint8_t m, const ExtU *in, const ExtY *y, uint8_t hall, int16_t ia, int16_t ib,
+                                    int16_t ic, int *u, int *v, int *w) {
+  CtrlHookIo io = {m, hall, y->z_errCode, in->z_ctrlModReq, ia, ib, ic, in->i_DCLink, y->n_mot, y->iq, y->id,
+                   y->a_elecAngle, in->r_inpTgt, 0, *u, *v, *w};
+  ctrlHooksRun(CTRL_HOOK_POST, m, &io);
+  *u = io.u;
+  *v = io.v;
+  *w = io.w;
+}
+#endif
+
+// Left motor: currents, hall, controller step and duty update. Returns the chopping state
+/* Controller step with i_max clamped to iLim (CURRENT_DERATING, the pre-step hooks), the configured i_max stays in rtP
+ * for the parameters, the profiles and the EEPROM */
+static inline void motorStep(RT_MODEL *const m, P *p, int16_t iLim) {
+  #if defined(CURRENT_DERATING) || defined(CTRL_HOOKS)
+  int16_t iMax = p->i_max;
+  if (iMax > iLim) {
+    p->i_max = iLim;
+  }
+  BLDC_controller_step(m);
+  p->i_max = iMax;
+  #else
+  (void)p;
+  (void)iLim;
+  BLDC_controller_step(m);
+  #endif
+}
+
+/* Current limit of the controller step of motor m, before the pre-step hooks */
+static inline int16_t motorILim(uint8_t m, const P *p) {
+  int16_t iLim = p->i_max;
+  #if defined(CURRENT_DERATING)
+  iLim = MIN(iLim, derate.iMax);
+  #endif
+  #if defined(DC_BUDGET)
+  iLim = MIN(iLim, dcBudget.iMax[m]);
+  #else
+  (void)m;
+  #endif
+  return iLim;
+}
+
+#if defined(CMD_INTERP)
+// Command interpolation: a new pwml / pwmr target is reached in a linear ramp over the learned interval of the target
+// changes instead of in one step, the command frames arrive at 50..100 Hz. Intervals longer than CMD_INTERP_MAX (a held
+// command) are not learned. With the motors off or on a mode change the target is taken at once
+#define CMD_INTERP_TICKS  ((uint32_t)PWM_FREQ * CMD_INTERP_MAX / 1000)   // [ticks]
+typedef struct {
+  int32_t  out;                         // [Q12] interpolated target
+  int32_t  step;                        // [Q12] per control tick
+  int      tgt;                         // [-] last pwml / pwmr
+  uint16_t cnt;                         // [ticks] since the last target change
+  uint16_t period;                      // [ticks] learned interval of the target changes
+  uint8_t  mode;                        // [-] ctrlModReq of the ramp
+} CmdInterp;
+static CmdInterp cmdInterp[2] = {
+  {0, 0, 0, 0, PWM_FREQ * DELAY_IN_MAIN_LOOP / 1000, 0}, {0, 0, 0, 0, PWM_FREQ * DELAY_IN_MAIN_LOOP / 1000, 0}};
+
+static inline int cmdInterpStep(uint8_t m, int tgt) {
+  CmdInterp *c = &cmdInterp[m];
+  int32_t    t = (int32_t)tgt << 12;
+
+  if (c->cnt < CMD_INTERP_TICKS + 1) {
+    c->cnt++;
+  }
+  if (enable == 0 || c->mode != ctrlModReq) {
+    c->mode = ctrlModReq;
+    c->out  = t;
+    c->step = 0;
+  } else if (tgt != c->tgt) {
+    if (c->cnt <= CMD_INTERP_TICKS) {
+      c->period += ((int32_t)c->cnt - c->period) >> 2;
+    }
+    c->cnt  = 0;
+    c->step = (t - c->out) / MAX(c->period, 1);
+  }
+  c->tgt  = tgt;
+  c->out += c->step;
+  if ((c->step > 0 && c->out > t) || (c->step < 0 && c->out < t)) {
+    c->out  = t;
+    c->step = 0;
+  }
+  return (int)(c->out >> 12);
+}
+#define CMD_TGT(m, x)     cmdInterpStep(m, x)
+#else
+#define CMD_TGT(m, x)     (x)
+#endif
+
+/* Target of the controller step of motor m. With REGEN_LIMIT a TORQUE mode target against the direction of motion
+ * n [rpm], a braking torque, is scaled with the regen factor. With ANTILOCK_BRAKE every TORQUE mode target is scaled
+ * with the anti-lock factor of the motor, which is below full only while antilockStep releases a braking wheel */
+static inline int regenCmd(uint8_t m, int cmd, int16_t n) {
+  #if defined(ANTILOCK_BRAKE)
+  if (ctrlModReq == TRQ_MODE) {
+    cmd = (int)(((int32_t)cmd * antilock.w[m].fac) >> 15);
+  }
+  #else
+  (void)m;
+  #endif
+  #if defined(REGEN_LIMIT)
+  if (ctrlModReq == TRQ_MODE && ((cmd > 0 && n < 0) || (cmd < 0 && n > 0))) {
+    return (int)(((int32_t)cmd * regen.fac) >> 15);
+  }
+  #else
+  (void)n;
+  #endif
+  return cmd;
+}
+
+#if defined(POS_CTRL)
+/* Position target of a PROTO_CMD_POS frame (serial Rx interrupt), left / right as the low 16 bits in the odo0 / odo1
+ * frame of the feedback. The full target is the one nearest to the present odometry */
+void bldc_pos_target(int16_t l, int16_t r) {
+  posTgt[0] = odo[0].pos + (int16_t)((uint16_t)boardOutL(l) - (uint16_t)odo[0].pos);
+  posTgt[1] = odo[1].pos + (int16_t)((uint16_t)boardOutR(r) - (uint16_t)odo[1].pos);
+}
+
+/* POS_MODE: the position loop gives the speed target every POS_CTRL_DIV ticks. In the other modes and while disabled
+ * it follows the motor speed, so the speed loop sees no step when the mode starts */
+static inline void posCtrlTick(void) {
+  const P *pl = rtM_Left->defaultParam, *pr = rtM_Right->defaultParam;
+  if (ctrlModReq != POS_MODE || !enableFin) {
+    posCtrlReset(&posCtrl[0], rtY_Left.n_mot);
+    posCtrlReset(&posCtrl[1], rtY_Right.n_mot);
+    posDiv = 0;
+    return;
+  }
+  if (posDiv == 0) {
+    posInpTgt[0] = posCtrlStep(&posCtrl[0], posTgt[0], odo[0].pos, pl->n_max, pl->n_polePairs);
+    posInpTgt[1] = posCtrlStep(&posCtrl[1], posTgt[1], odo[1].pos, pr->n_max, pr->n_polePairs);
+  }
+  posDiv = (posDiv == POS_CTRL_DIV - 1) ? 0 : posDiv + 1;
+}
+#endif
+
+#if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+/* Speed target of the cruise control: jerk limited from the speed and acceleration at the engagement to the speed
+ * where that acceleration can end, so the motor eases into the cruise speed */
+RAMFUNC static void holdCruiseStart(uint8_t i, int16_t n) {
+  int32_t a = clampSym(holdAcc[i], HOLD_ACC);
+  int32_t d = (int32_t)(((int64_t)ABS(a) * (ABS(a) / HOLD_JERK + 1)) >> 17);   // [rpm] distance of a, a - jerk, ... 0
+  holdRef[i].y = (int32_t)n << 16;
+  holdRef[i].a = a;
+  holdTgt[i]   = (int16_t)clampSym(n + (a < 0 ? -d : d), N_MOT_MAX);
+}
+
+/* Standstill and cruise hold of the main loop request (holdReq), engaged and run here every POS_CTRL_DIV ticks so
+ * neither depends on the main loop timing. BLDC_HOLD_POS holds the hall step position with the position loop of
+ * posctrl.c in SPD_MODE, no drift on a slope. BLDC_HOLD_SPD is the cruise control of the controller (b_cruiseCtrlEna,
+ * the driver can still give more) on a jerk limited reference. Not in POS_MODE and while disabled */
+static inline void holdTick(void) {
+  uint8_t req = (enableFin && ctrlModReq != POS_MODE) ? holdReq : BLDC_HOLD_NONE;
+  uint8_t div = holdDiv;
+  int16_t n[2];
+
+  holdDiv = (div == POS_CTRL_DIV - 1) ? 0 : div + 1;
+  if (div != 0) {
+    return;
+  }
+  n[0] = rtY_Left.n_mot;
+  n[1] = rtY_Right.n_mot;
+  for (uint8_t i = 0; i < 2; i++) {
+    holdAcc[i] += ((((int32_t)n[i] - holdN[i]) << 16) - holdAcc[i]) >> HOLD_ACC_SHIFT;
+    holdN[i]    = n[i];
+    if (req != holdMode) {
+      #if defined(STANDSTILL_HOLD_ENABLE)
+      holdPos[i] = odo[i].pos;
+      posCtrlReset(&holdCtrl[i], n[i]);
+      #endif
+      holdCruiseStart(i, n[i]);
+    }
+    if (req == BLDC_HOLD_SPD) {
+      refGenStep(holdTgt[i], HOLD_ACC, HOLD_JERK, &holdRef[i]);
+    }
+    #if defined(STANDSTILL_HOLD_ENABLE)
+    if (req == BLDC_HOLD_POS) {
+      const P *p = i ? rtM_Right->defaultParam : rtM_Left->defaultParam;
+      int32_t  e = holdPos[i] - odo[i].pos;
+      holdInpTgt[i] = posCtrlStep(&holdCtrl[i], ABS(e) <= HOLD_BAND ? odo[i].pos : holdPos[i], odo[i].pos, p->n_max, p->n_polePairs);
+    }
+    #endif
+  }
+  holdMode = req;
+}
+
+/* Controller inputs and parameters of the engaged hold, after the mode inputs of a motor */
+static inline void holdInput(uint8_t i, P *p, ExtU *u) {
+  p->b_cruiseCtrlEna = (holdMode == BLDC_HOLD_SPD);
+  p->n_cruiseMotTgt  = (int16_t)((holdRef[i].y + 32768) >> 16);
+  #if defined(STANDSTILL_HOLD_ENABLE)
+  if (holdMode == BLDC_HOLD_POS) {
+    u->z_ctrlModReq = SPD_MODE;
+    u->r_inpTgt     = holdInpTgt[i];
+  }
+  #else
+  (void)u;
+  #endif
+}
+#endif
+
+static inline uint8_t bldc_motor_left(uint8_t *hall) {
+  P *p = rtM_Left->defaultParam;        // parameters of the controller step, a staged bank with PARAM_STAGED
   // Get Left motor currents
   curL_phaA = (int16_t)(offsetrlA - adc_buffer.rlA);
   curL_phaB = (int16_t)(offsetrlB - adc_buffer.rlB);
+  #if defined(DC_LINK_EST)
+  curL_DC   = dcEstimate(0, curL_phaA, curL_phaB, -curL_phaA - curL_phaB, (int16_t)(offsetdcl - adc_buffer.dcl));
+  #else
   curL_DC   = (int16_t)(offsetdcl - adc_buffer.dcl);
+  #endif
+  #if defined(OVERMOD)
+  if (overmodGain[0] > 1024) {          // a shunt phase at the rail carries the DC link current into the motor
+    if (pwmCcr[0][0] == pwm_res) {
+      curL_phaA = -curL_DC;
+    } else if (pwmCcr[0][1] == pwm_res) {
+      curL_phaB = -curL_DC;
+    }
+  }
+  #endif
   
   // Disable PWM when current limit is reached (current chopping)
-  // This is the Level 2 of current protection. The Level 1 should kick in first given by I_MOT_MAX
-  if(ABS(curL_DC) > curDC_max || enable == 0) {
+  // This is the Level 2 of current protection. The Level 1 should kick in first given by I_MOT_MAX, DC_FOLDBACK before the chopping
+  uint8_t chopL = (ABS(curL_DC) > curDC_max);
+  #if defined(HW_BREAK)
+  if (LEFT_TIM->SR & TIM_SR_BIF) {      // BKIN has switched the outputs off since the last tick: count it, re-arm on the next tick as for chopping
+    LEFT_TIM->SR = ~TIM_SR_BIF;
+    hwBreakTrips[0]++;
+    chopL = 1;
+  }
+  #endif
+  if(chopL || enable == 0) {
     LEFT_TIM->BDTR &= ~TIM_BDTR_MOE;
   } else {
-    LEFT_TIM->BDTR |= TIM_BDTR_MOE;
+    PWM_OUT_ENA(LEFT_TIM);
   }
+  #if defined(OFFSET_TRACK)
+  offsetTrack(0, enable == 0, adc_buffer.rlA, adc_buffer.rlB, adc_buffer.dcl);
+  #endif
 
   int ul, vl, wl;
 
    // ========================= LEFT MOTOR ============================
        // Adjust pwm_margin depending on the selected Control Type
-  if (rtP_Left.z_ctrlTypSel == FOC_CTRL) {
-    pwm_margin = 110;
+  #if !defined(CTRL_FIXED)
+  if (p->z_ctrlTypSel == FOC_CTRL) {
+    pwm_margin = PWM_MARGIN;
   } else {
     pwm_margin = 0;
   }
+  #endif
     // Get hall sensors values
-    uint8_t hall_ul = !(LEFT_HALL_U_PORT->IDR & LEFT_HALL_U_PIN);
-    uint8_t hall_vl = !(LEFT_HALL_V_PORT->IDR & LEFT_HALL_V_PIN);
-    uint8_t hall_wl = !(LEFT_HALL_W_PORT->IDR & LEFT_HALL_W_PIN);
-
-    uint8_t current_posl = hall2pos[hall_ul][hall_vl][hall_wl];
+    uint8_t hall_l       = HALL_READ(LEFT_HALL_PORT, LEFT_HALL_SHIFT);
+    *hall                = hall_l;
+    uint8_t current_posl = hall2pos[hall_l];
     if(current_posl != pos[0][0]){
-      if(current_posl != pos[0][1])
-        steps[0]++;
+      odoStep(0, current_posl, pos[0][0]);
+      #if defined(SELF_TEST)
+      selfTestHall(&selfTest, 0, current_posl);
+      #endif
       pos[0][1] = pos[0][0];
       pos[0][0] = current_posl;
     }
     /* Set motor inputs here */
     rtU_Left.b_motEna     = enableFin;
     rtU_Left.z_ctrlModReq = ctrlModReq;  
-    rtU_Left.r_inpTgt     = pwml;
-    rtU_Left.b_hallA      = hall_ul;
-    rtU_Left.b_hallB      = hall_vl;
-    rtU_Left.b_hallC      = hall_wl;
+    rtU_Left.r_inpTgt     = regenCmd(0, CMD_TGT(0, pwml), rtY_Left.n_mot);
+    #if defined(POS_CTRL)
+    if (ctrlModReq == POS_MODE) {
+      rtU_Left.z_ctrlModReq = SPD_MODE;
+      rtU_Left.r_inpTgt     = posInpTgt[0];
+    }
+    #endif
+    #if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+    holdInput(0, p, &rtU_Left);
+    #endif
+    #if defined(MOTOR_IDENT)
+    motIdInput(&motId[0], &rtU_Left.z_ctrlModReq, &rtU_Left.r_inpTgt);
+    #endif
+    #if defined(COGGING_COMP)
+    cogMotorInput(&cogging[0], p, &rtU_Left, &rtY_Left);
+    #endif
+    #if defined(SPD_REF_GEN)
+    rtU_Left.Vq_ff        = spdFf(rtU_Left.r_inpTgt, spdFfAcc[0]);
+    #endif
+    #if defined(CTRL_PREDICT)
+    ctrlPredict(&rtU_Left, &rtY_Left, &ctrlPred[0], PRED_HALF_L);
+    #endif
+    #if defined(SPD_FILT)
+    spdIdInput(&spdId[0], &rtU_Left.r_inpTgt);
+    #endif
+    rtU_Left.b_hallA      =  hall_l       & 1;
+    rtU_Left.b_hallB      = (hall_l >> 1) & 1;
+    rtU_Left.b_hallC      =  hall_l >> 2;
     rtU_Left.i_phaAB      = curL_phaA;
     rtU_Left.i_phaBC      = curL_phaB;
     rtU_Left.i_DCLink     = curL_DC;
+    #if defined(WINDING_TEMP)
+    rtU_Left.id_inj       = wtemp[0].idInj;
+    #endif
     // rtU_Left.a_mechAngle   = ...; // Angle input in DEGREES [0,360] in fixdt(1,16,4) data type. If `angle` is float use `= (int16_t)floor(angle * 16.0F)` If `angle` is integer use `= (int16_t)(angle << 4)`
+    #if defined(ANGLE_OBSERVER)
+    obsMotor(&obs[0], p, &rtU_Left, &rtY_Left, curL_phaA, curL_phaB, -curL_phaA - curL_phaB, pwmCcr[0], chopL);
+    #endif
     
     /* Step the controller */
+    int16_t iLim = motorILim(0, p);
+    #if defined(CTRL_HOOKS)
+    hookPre(0, &rtU_Left, &rtY_Left, hall_l, curL_phaA, curL_phaB, -curL_phaA - curL_phaB, curL_DC, &iLim);
+    #endif
     #ifdef MOTOR_LEFT_ENA    
-    BLDC_controller_step(rtM_Left);
+    ISR_PROF_START(tMotL);
+    motorStep(rtM_Left, p, iLim);
+    ISR_PROF_STOP(tMotL, ISR_PROF_MOT_L);
     #endif
 
     /* Get motor outputs here */
-    ul            = rtY_Left.DC_phaA;
-    vl            = rtY_Left.DC_phaB;
-    wl            = rtY_Left.DC_phaC;
+    ul            = PWM_DUTY_V(rtY_Left.DC_phaA);
+    vl            = PWM_DUTY_V(rtY_Left.DC_phaB);
+    wl            = PWM_DUTY_V(rtY_Left.DC_phaC);
+    uint8_t railL = 0;
+    #if defined(OVERMOD)
+    railL         = overmodApply(0, p, &rtY_Left, &ul, &vl, &wl);
+    #endif
   // errCodeLeft  = rtY_Left.z_errCode;
   // motSpeedLeft = rtY_Left.n_mot;
   // motAngleLeft = rtY_Left.a_elecAngle;
+    #if defined(HALL_CALIB)
+    hallCalMotor(&hallCal[0], p, hall_l, &ul, &vl, &wl);
+    #endif
+    #if defined(MOTOR_IDENT)
+    motIdMotor(&motId[0], &rtY_Left, curL_phaA, curL_phaB, -curL_phaA - curL_phaB, &ul, &vl, &wl);
+    #endif
+    #if defined(COGGING_COMP)
+    cogStep(&cogging[0], rtY_Left.a_elecAngle, rtY_Left.n_mot, rtY_Left.iq, p->i_max);
+    #endif
+    #if defined(SPD_FILT)
+    spdIdMotor(&spdId[0], p, &rtU_Left, &rtY_Left);
+    #endif
+    #if defined(WINDING_TEMP)
+    wtempMotor(&wtemp[0], &rtY_Left, curL_phaA, curL_phaB, -curL_phaA - curL_phaB);
+    #endif
+    #if defined(CTRL_HOOKS)
+    hookPost(0, &rtU_Left, &rtY_Left, hall_l, curL_phaA, curL_phaB, -curL_phaA - curL_phaB, &ul, &vl, &wl);
+    #endif
+    #if defined(DC_FOLDBACK)
+    dcFoldApply(0, curL_DC, &ul, &vl, &wl);
+    #endif
+    dtCompApply(p, &ul, &vl, &wl, curL_phaA, curL_phaB, -curL_phaA - curL_phaB);
 
     /* Apply commands */
-    LEFT_TIM->LEFT_TIM_U    = (uint16_t)CLAMP(ul + pwm_res / 2, pwm_margin, pwm_res-pwm_margin);
-    LEFT_TIM->LEFT_TIM_V    = (uint16_t)CLAMP(vl + pwm_res / 2, pwm_margin, pwm_res-pwm_margin);
-    LEFT_TIM->LEFT_TIM_W    = (uint16_t)CLAMP(wl + pwm_res / 2, pwm_margin, pwm_res-pwm_margin);
+    #if defined(HALL_COM_HW)
+    if (!comStep(0, p, hall_l, ul, vl, wl))
+    #endif
+    #if defined(CTRL_VALLEY_LOAD)
+    pwmApply(LEFT_TIM, pwmCcr[0], ul, vl, wl, 2, 1, railL);   // shunts on U, V
+    if (!(LEFT_TIM->CR1 & TIM_CR1_DIR) && LEFT_TIM->CNT < pwm_res / 2u) {
+      isrMiss.pwmLate[0]++;           // TIM8 (RCR = 0) is counting up again, the valley update was missed
+    }
+    #else
+    pwmApply(LEFT_TIM, pwmCcr[0], ul, vl, wl, 2, 0, railL);   // shunts on U, V
+    if (DMA1->ISR & DMA_ISR_TCIF1) {
+      isrMiss.pwmLate[0]++;           // TIM8 loads the new duty once per period, together with the next ADC trigger
+    }
+    #endif
   // =================================================================
 
+  return chopL;
+}
+
+// Right motor, dir0 is the TIM1 count direction at the start of the interrupt
+static inline uint8_t bldc_motor_right(uint8_t *hall, uint32_t dir0) {
+  P *p = rtM_Right->defaultParam;
   // Get Right motor currents
   curR_phaB = (int16_t)(offsetrrB - adc_buffer.rrB);
   curR_phaC = (int16_t)(offsetrrC - adc_buffer.rrC);
+  #if defined(DC_LINK_EST)
+  curR_DC   = dcEstimate(1, -curR_phaB - curR_phaC, curR_phaB, curR_phaC, (int16_t)(offsetdcr - adc_buffer.dcr));
+  #else
   curR_DC   = (int16_t)(offsetdcr - adc_buffer.dcr);
+  #endif
+  #if defined(OVERMOD)
+  if (overmodGain[1] > 1024) {          // a shunt phase at the rail carries the DC link current into the motor
+    if (pwmCcr[1][1] == pwm_res) {
+      curR_phaB = -curR_DC;
+    } else if (pwmCcr[1][2] == pwm_res) {
+      curR_phaC = -curR_DC;
+    }
+  }
+  #endif
 
   // Disable PWM when current limit is reached (current chopping)
   // This is the Level 2 of current protection. The Level 1 should kick in first given by I_MOT_MAX
 
-  if(ABS(curR_DC)  > curDC_max || enable == 0) {
+  uint8_t chopR = (ABS(curR_DC) > curDC_max);
+  #if defined(HW_BREAK)
+  if (RIGHT_TIM->SR & TIM_SR_BIF) {
+    RIGHT_TIM->SR = ~TIM_SR_BIF;
+    hwBreakTrips[1]++;
+    chopR = 1;
+  }
+  #endif
+  if(chopR || enable == 0) {
     RIGHT_TIM->BDTR &= ~TIM_BDTR_MOE;
   } else {
-    RIGHT_TIM->BDTR |= TIM_BDTR_MOE;
+    PWM_OUT_ENA(RIGHT_TIM);
   }
+  #if defined(OFFSET_TRACK)
+  offsetTrack(1, enable == 0, adc_buffer.rrB, adc_buffer.rrC, adc_buffer.dcr);
+  #endif
 
   // ############################### MOTOR CONTROL ###############################
   int ur, vr, wr;
@@ -304,20 +2210,22 @@ void bldc_control(void) {
 
   // ========================= RIGHT MOTOR ===========================  
       // Adjust pwm_margin depending on the selected Control Type
-  if (rtP_Right.z_ctrlTypSel == FOC_CTRL) {
-    pwm_margin = 110;
+  #if !defined(CTRL_FIXED)
+  if (p->z_ctrlTypSel == FOC_CTRL) {
+    pwm_margin = PWM_MARGIN;
   } else {
     pwm_margin = 0;
   }
+  #endif
     // Get hall sensors values
-    uint8_t hall_ur = !(RIGHT_HALL_U_PORT->IDR & RIGHT_HALL_U_PIN);
-    uint8_t hall_vr = !(RIGHT_HALL_V_PORT->IDR & RIGHT_HALL_V_PIN);
-    uint8_t hall_wr = !(RIGHT_HALL_W_PORT->IDR & RIGHT_HALL_W_PIN);
-
-    uint8_t current_posr = hall2pos[hall_ur][hall_vr][hall_wr];
+    uint8_t hall_r       = HALL_READ(RIGHT_HALL_PORT, RIGHT_HALL_SHIFT);
+    *hall                = hall_r;
+    uint8_t current_posr = hall2pos[hall_r];
     if(current_posr != pos[1][0]){
-      if(current_posr != pos[1][1])
-        steps[1]++;
+      odoStep(1, current_posr, pos[1][0]);
+      #if defined(SELF_TEST)
+      selfTestHall(&selfTest, 1, current_posr);
+      #endif
       pos[1][1] = pos[1][0];
       pos[1][0] = current_posr;
     }
@@ -325,35 +2233,178 @@ void bldc_control(void) {
     /* Set motor inputs here */
     rtU_Right.b_motEna      = enableFin;
     rtU_Right.z_ctrlModReq  = ctrlModReq;
-    rtU_Right.r_inpTgt      = pwmr;
-    rtU_Right.b_hallA       = hall_ur;
-    rtU_Right.b_hallB       = hall_vr;
-    rtU_Right.b_hallC       = hall_wr;
+    rtU_Right.r_inpTgt      = regenCmd(1, CMD_TGT(1, pwmr), rtY_Right.n_mot);
+    #if defined(POS_CTRL)
+    if (ctrlModReq == POS_MODE) {
+      rtU_Right.z_ctrlModReq = SPD_MODE;
+      rtU_Right.r_inpTgt     = posInpTgt[1];
+    }
+    #endif
+    #if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+    holdInput(1, p, &rtU_Right);
+    #endif
+    #if defined(MOTOR_IDENT)
+    motIdInput(&motId[1], &rtU_Right.z_ctrlModReq, &rtU_Right.r_inpTgt);
+    #endif
+    #if defined(COGGING_COMP)
+    cogMotorInput(&cogging[1], p, &rtU_Right, &rtY_Right);
+    #endif
+    #if defined(SPD_REF_GEN)
+    rtU_Right.Vq_ff         = spdFf(rtU_Right.r_inpTgt, spdFfAcc[1]);
+    #endif
+    #if defined(CTRL_PREDICT)
+    ctrlPredict(&rtU_Right, &rtY_Right, &ctrlPred[1], PRED_HALF_R);
+    #endif
+    #if defined(SPD_FILT)
+    spdIdInput(&spdId[1], &rtU_Right.r_inpTgt);
+    #endif
+    rtU_Right.b_hallA       =  hall_r       & 1;
+    rtU_Right.b_hallB       = (hall_r >> 1) & 1;
+    rtU_Right.b_hallC       =  hall_r >> 2;
     rtU_Right.i_phaAB       = curR_phaB;
     rtU_Right.i_phaBC       = curR_phaC;
     rtU_Right.i_DCLink      = curR_DC;
+    #if defined(WINDING_TEMP)
+    rtU_Right.id_inj        = wtemp[1].idInj;
+    #endif
     // rtU_Right.a_mechAngle   = ...; // Angle input in DEGREES [0,360] in fixdt(1,16,4) data type. If `angle` is float use `= (int16_t)floor(angle * 16.0F)` If `angle` is integer use `= (int16_t)(angle << 4)`
+    #if defined(ANGLE_OBSERVER)
+    obsMotor(&obs[1], p, &rtU_Right, &rtY_Right, -curR_phaB - curR_phaC, curR_phaB, curR_phaC, pwmCcr[1], chopR);
+    #endif
     
     /* Step the controller */
+    int16_t iLim = motorILim(1, p);
+    #if defined(CTRL_HOOKS)
+    hookPre(1, &rtU_Right, &rtY_Right, hall_r, -curR_phaB - curR_phaC, curR_phaB, curR_phaC, curR_DC, &iLim);
+    #endif
     #ifdef MOTOR_RIGHT_ENA
-    BLDC_controller_step(rtM_Right);
+    ISR_PROF_START(tMotR);
+    motorStep(rtM_Right, p, iLim);
+    ISR_PROF_STOP(tMotR, ISR_PROF_MOT_R);
     #endif
 
     /* Get motor outputs here */
-    ur            = rtY_Right.DC_phaA;
-    vr            = rtY_Right.DC_phaB;
-    wr            = rtY_Right.DC_phaC;
+    ur            = PWM_DUTY_V(rtY_Right.DC_phaA);
+    vr            = PWM_DUTY_V(rtY_Right.DC_phaB);
+    wr            = PWM_DUTY_V(rtY_Right.DC_phaC);
+    uint8_t railR = 0;
+    #if defined(OVERMOD)
+    railR         = overmodApply(1, p, &rtY_Right, &ur, &vr, &wr);
+    #endif
  // errCodeRight  = rtY_Right.z_errCode;
  // motSpeedRight = rtY_Right.n_mot;
  // motAngleRight = rtY_Right.a_elecAngle;
+    #if defined(HALL_CALIB)
+    hallCalMotor(&hallCal[1], p, hall_r, &ur, &vr, &wr);
+    #endif
+    #if defined(MOTOR_IDENT)
+    motIdMotor(&motId[1], &rtY_Right, -curR_phaB - curR_phaC, curR_phaB, curR_phaC, &ur, &vr, &wr);
+    #endif
+    #if defined(COGGING_COMP)
+    cogStep(&cogging[1], rtY_Right.a_elecAngle, rtY_Right.n_mot, rtY_Right.iq, p->i_max);
+    #endif
+    #if defined(SPD_FILT)
+    spdIdMotor(&spdId[1], p, &rtU_Right, &rtY_Right);
+    #endif
+    #if defined(WINDING_TEMP)
+    wtempMotor(&wtemp[1], &rtY_Right, -curR_phaB - curR_phaC, curR_phaB, curR_phaC);
+    #endif
+    #if defined(CTRL_HOOKS)
+    hookPost(1, &rtU_Right, &rtY_Right, hall_r, -curR_phaB - curR_phaC, curR_phaB, curR_phaC, &ur, &vr, &wr);
+    #endif
+    #if defined(DC_FOLDBACK)
+    dcFoldApply(1, curR_DC, &ur, &vr, &wr);
+    #endif
+    dtCompApply(p, &ur, &vr, &wr, -curR_phaB - curR_phaC, curR_phaB, curR_phaC);
 
     /* Apply commands */
-    RIGHT_TIM->RIGHT_TIM_U  = (uint16_t)CLAMP(ur + pwm_res / 2, pwm_margin, pwm_res-pwm_margin);
-    RIGHT_TIM->RIGHT_TIM_V  = (uint16_t)CLAMP(vr + pwm_res / 2, pwm_margin, pwm_res-pwm_margin);
-    RIGHT_TIM->RIGHT_TIM_W  = (uint16_t)CLAMP(wr + pwm_res / 2, pwm_margin, pwm_res-pwm_margin);
+    #if defined(HALL_COM_HW)
+    if (!comStep(1, p, hall_r, ur, vr, wr))
+    #endif
+    pwmApply(RIGHT_TIM, pwmCcr[1], ur, vr, wr, 0, 1, railR); // shunts on V, W
+    if ((RIGHT_TIM->CR1 ^ dir0) & TIM_CR1_DIR) {
+      isrMiss.pwmLate[1]++;           // TIM1 (RCR = 0) loads the new duty at every under- and overflow, the half period one was missed
+    }
   // =================================================================
+  return chopR;
+}
+
+RAMFUNC void bldc_control(void) {
+  uint32_t dir0 = RIGHT_TIM->CR1;
+  uint8_t  hall_l, hall_r, chopL, chopR;
+
+    /* Make sure to stop BOTH motors in case of an error */
+  enableFin = enable && !rtY_Left.z_errCode && !rtY_Right.z_errCode;
 
+  #if defined(POS_CTRL)
+  posCtrlTick();
+  #endif
+  #if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+  holdTick();
+  #endif
+  #if defined(CTRL_HOOKS)
+  if (ctrlHookRst) {
+    ctrlHookReset();
+  }
+  hookCycles = 0;
+  #endif
+
+  #if defined(CTRL_RIGHT_FIRST)
+  chopR = bldc_motor_right(&hall_r, dir0);
+  chopL = bldc_motor_left(&hall_l);
+  #else
+  chopL = bldc_motor_left(&hall_l);
+  chopR = bldc_motor_right(&hall_r, dir0);
+  #endif
+  #if defined(HALL_CALIB)
+  hallCalReq = 0;                       // both calibrations started
+  #endif
+  #if defined(MOTOR_IDENT)
+  motIdReq = 0;                         // both identifications started
+  #endif
+  #if defined(COGGING_COMP)
+  cogReq = 0;                           // both recordings started
+  #endif
+  #if defined(SPD_FILT)
+  spdIdReq = 0;                         // both sweeps started
+  #endif
+  #if defined(DC_BUDGET)
+  dcBudgetStep(&dcBudget, rtU_Left.i_DCLink, rtU_Right.i_DCLink, rtY_Left.iq, rtY_Right.iq);   // limits of the next tick
+  #endif
+  #if defined(ADC_SAMPLE_ALIGN)
+  adcSampleStep();                      // trigger of the next period, with its duties
+  #endif
+  #if defined(LATENCY_MEAS)
+  if (latMeas.state == LAT_OUTPUT) {
+    latApplied(&latMeas, timeUs());     // the controllers stepped with the outputs of the tagged input change
+  }
+  #endif
+
+  #if defined(DEADLINE_MISS_FAULT)
+  // Report the deadline miss fault as motor error, this will disable both motors from the next step on
+  if (isrMiss.fault) {
+    rtY_Left.z_errCode  |= ERR_DEADLINE_MISS;
+    rtY_Right.z_errCode |= ERR_DEADLINE_MISS;
+  }
+  #endif
+  #if defined(STACK_MONITOR)
+  if (stackMon.fault) {
+    rtY_Left.z_errCode  |= ERR_STACK_GUARD;
+    rtY_Right.z_errCode |= ERR_STACK_GUARD;
+  }
+  #endif
 
+  #if defined(BLACKBOX_ENABLE)
+  blackboxRecord(hall_l, hall_r, chopL && enable, chopR && enable);
+  #else
+  (void)chopL; (void)chopR;
+  #endif
+  #if defined(SCOPE_ENABLE)
+  scopeRecord();
+  #endif
+  #if defined(CTRL_HOOKS) && defined(ISR_PROFILING)
+  isrProfUpdate(&isrProf[ISR_PROF_HOOKS], hookCycles);
+  #endif
  
  // ###############################################################################
 
@@ -0,0 +1,119 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// COBS framing (SERIAL_COBS). Only uses stdint, so it also builds on the host.
+//
+// Consistent overhead byte stuffing: the message is cut at its 0x00 bytes, each block is sent behind a code byte
+// with its length + 1, blocks of 254 bytes without a 0x00 get code 0xFF. The encoding has no 0x00, the frame ends
+// with one, so a receiver finds the next frame from any byte of the stream. One byte of overhead per 254.
+// The messages are the start / checksum frames of protocol.h converted by cobsFrame / cobsUnframe: the start frame
+// becomes a one byte type, its low byte, the CRC32 a CRC-16/CCITT-FALSE over type and body. The STM32F1 CRC unit
+// only does CRC32, the CRC-16 takes a nibble table of 32 bytes, about 20 cycles per byte.
+
+#include <stdint.h>
+#include <string.h>
+#include "cobs.h"
+
+static const uint16_t crc16Tab[16] = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+/* CRC-16/CCITT-FALSE: polynomial 0x1021, init 0xFFFF, no reflection, no final xor */
+uint16_t crc16(const uint8_t *buf, uint16_t len) {
+  uint16_t crc = 0xFFFF;
+  while (len--) {
+    crc = (uint16_t)(crc << 4) ^ crc16Tab[(crc >> 12) ^ (*buf >> 4)];
+    crc = (uint16_t)(crc << 4) ^ crc16Tab[(crc >> 12) ^ (*buf & 0x0F)];
+    buf++;
+  }
+  return crc;
+}
+
+/* Encoding of len bytes of src to dst, at most COBS_ENC_MAX(len) bytes. Returns the length, delimiter included */
+uint16_t cobsEncode(const uint8_t *src, uint16_t len, uint8_t *dst) {
+  uint16_t code = 0;                    // code byte of the block
+  uint16_t out  = 1;
+
+  for (uint16_t i = 0; i < len; i++) {
+    if (src[i] == 0) {
+      dst[code] = (uint8_t)(out - code);
+      code      = out++;
+    } else {
+      dst[out++] = src[i];
+      if (out - code == 0xFF) {
+        dst[code] = 0xFF;
+        code      = out++;
+      }
+    }
+  }
+  dst[code]  = (uint8_t)(out - code);
+  dst[out++] = 0;
+  return out;
+}
+
+/* Decoding of len bytes of src without the delimiter to dst, may be src. Returns the length, 0 if the encoding is broken */
+uint16_t cobsDecode(const uint8_t *src, uint16_t len, uint8_t *dst) {
+  uint16_t i   = 0;
+  uint16_t out = 0;
+
+  while (i < len) {
+    uint8_t code = src[i++];
+    if (code == 0 || i + code - 1 > len) {
+      return 0;
+    }
+    for (uint8_t k = 1; k < code; k++) {
+      if (src[i] == 0) {
+        return 0;
+      }
+      dst[out++] = src[i++];
+    }
+    if (code != 0xFF && i < len) {
+      dst[out++] = 0;
+    }
+  }
+  return out;
+}
+
+/* COBS frame of the start / checksum frame of len bytes (protocol.h) to dst, at most COBS_ENC_MAX(len - 3) bytes,
+ * dst may be frame. The checksum of the frame is not read. Returns the length, delimiter included */
+uint16_t cobsFrame(const uint8_t *frame, uint16_t len, uint8_t *dst) {
+  uint8_t  msg[COBS_MSG_MAX];
+  uint16_t n = len - 5;                 // type and body
+  uint16_t crc;
+
+  msg[0] = frame[0];
+  memcpy(&msg[1], &frame[2], n - 1);
+  crc      = crc16(msg, n);
+  msg[n]   = (uint8_t)crc;
+  msg[n+1] = (uint8_t)(crc >> 8);
+  return cobsEncode(msg, n + 2, dst);
+}
+
+/* Start / checksum frame of the COBS frame of len bytes without the delimiter, decoded in enc, to frame (max bytes).
+ * The checksum of the frame is left as it is. Returns the frame length, 0 if the encoding or the CRC-16 is wrong */
+uint16_t cobsUnframe(uint8_t *enc, uint16_t len, uint8_t *frame, uint16_t max) {
+  uint16_t n = cobsDecode(enc, len, enc);
+
+  if (n < 3 || n + 3 > max || crc16(enc, n - 2) != (uint16_t)(enc[n-2] | (enc[n-1] << 8))) {
+    return 0;
+  }
+  frame[0] = enc[0];
+  frame[1] = enc[0];
+  memcpy(&frame[2], &enc[1], n - 3);
+  return n + 3;
+}
@@ -0,0 +1,151 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Cogging torque compensation (COGGING_COMP). Only uses config.h, so it also builds on the host.
+//
+// The cogging torque of the hub motor depends on the rotor position only and repeats every electrical turn. At a
+// constant low speed the speed loop has to supply it: the q axis current, averaged per angle bin over many turns, is
+// the cogging torque plus the friction. The mean over all bins is the friction and is removed. The motor turns
+// COGGING_TIME forward, then backward, and the two tables are averaged, which also cancels the lag of the
+// controller angle estimation. The result is converted to r_inpTgt units, so cogComp is a table lookup every tick.
+// The compensation is full up to COGGING_N_MAX and fades out at twice that, above it the cogging averages out.
+
+#include <stdint.h>
+#include "config.h"
+#include "cogging.h"
+
+#if defined(COGGING_COMP)
+
+#define COG_SETTLE_TICKS        ((uint32_t)PWM_FREQ * 2)                  // [ticks] speed settling before each direction
+#define COG_LEARN_TICKS         ((uint32_t)PWM_FREQ * COGGING_TIME)       // [ticks] recording time per direction
+#define COG_BIN_SCALE           ((int32_t)COG_BINS * 65536 / 360)         // [bins per deg, Q16]
+#define COG_TAB_MAX             127
+
+static uint8_t cogBin(int16_t angle) {
+  int32_t a = angle;
+  if (a < 0) {
+    a += 360;
+  } else if (a >= 360) {
+    a -= 360;
+  }
+  return (uint8_t)((a * COG_BIN_SCALE) >> 16);
+}
+
+void cogStart(Cogging *c) {
+  for (uint8_t k = 0; k < COG_BINS; k++) {
+    c->sum[k] = 0;
+    c->cnt[k] = 0;
+    c->res[0][k] = c->res[1][k] = 0;
+  }
+  c->ticks = 0;
+  c->state = COG_SETTLE_FWD;
+}
+
+/* Controller inputs while the table is recorded: SPD_MODE at COGGING_SPEED, nMax is P.n_max, fixdt(1,16,4) */
+void cogInput(const Cogging *c, int16_t nMax, uint8_t *mode, int16_t *inpTgt) {
+  if (c->state >= COG_SETTLE_FWD && c->state <= COG_REV) {
+    int16_t tgt = (int16_t)((int32_t)COGGING_SPEED * 16000 / nMax);
+    *mode   = SPD_MODE;
+    *inpTgt = c->state <= COG_FWD ? tgt : -tgt;
+  }
+}
+
+/* End of a direction: the bin averages minus their mean to res[rev]. The controller angle may jump a bin at a hall
+ * edge, such a bin gets the mean of its neighbours. Returns 0 if the angle did not cover the turn */
+static uint8_t cogFold(Cogging *c, uint8_t rev) {
+  int32_t avg[COG_BINS], mean = 0;
+  for (uint8_t k = 0; k < COG_BINS; k++) {
+    uint8_t up = (k + 1) % COG_BINS, dn = (k + COG_BINS - 1) % COG_BINS;
+    if (c->cnt[k]) {
+      avg[k] = c->sum[k] / c->cnt[k];
+    } else if (c->cnt[up] && c->cnt[dn]) {
+      avg[k] = (c->sum[up] / c->cnt[up] + c->sum[dn] / c->cnt[dn]) / 2;
+    } else {
+      return 0;
+    }
+    mean += avg[k];
+  }
+  mean /= COG_BINS;
+  for (uint8_t k = 0; k < COG_BINS; k++) {
+    c->res[rev][k] = (int16_t)(avg[k] - mean);
+    c->sum[k]  = 0;
+    c->cnt[k]  = 0;
+  }
+  return 1;
+}
+
+/* Table from the forward and reverse recordings, in r_inpTgt units. The lag of the angle estimation shifts the two
+ * recordings in opposite directions, the average keeps the part that is locked to the rotor position */
+static void cogTable(Cogging *c, int16_t iMax) {
+  for (uint8_t k = 0; k < COG_BINS; k++) {
+    int32_t v = (int32_t)(c->res[0][k] + c->res[1][k]) * 500 / iMax;   // 1000 = i_max
+    c->tab[k] = (int8_t)(v > COG_TAB_MAX ? COG_TAB_MAX : (v < -COG_TAB_MAX ? -COG_TAB_MAX : v));
+  }
+}
+
+/* One control tick after the controller step. angle, n and iq are the controller outputs a_elecAngle [deg],
+ * n_mot [rpm] and iq, iMax is P.i_max, both fixdt(1,16,4). The table is replaced when the state goes to COG_DONE */
+void cogStep(Cogging *c, int16_t angle, int16_t n, int16_t iq, int16_t iMax) {
+  if (c->state < COG_SETTLE_FWD || c->state > COG_REV) {
+    return;
+  }
+  c->ticks++;
+  if (c->state == COG_SETTLE_FWD || c->state == COG_SETTLE_REV) {
+    if (c->ticks >= COG_SETTLE_TICKS) {
+      c->state++;
+      c->ticks = 0;
+    }
+    return;
+  }
+  if ((n < 0 ? -n : n) < COGGING_SPEED / 2) {
+    c->state = COG_FAIL;                // blocked wheel or speed loop too weak for the cogging
+    return;
+  }
+  uint8_t k = cogBin(angle);
+  c->sum[k] += iq;
+  c->cnt[k]++;
+  if (c->ticks < COG_LEARN_TICKS) {
+    return;
+  }
+  if (!cogFold(c, c->state == COG_REV)) {
+    c->state = COG_FAIL;
+    return;
+  }
+  c->ticks = 0;
+  if (c->state == COG_FWD) {
+    c->state = COG_SETTLE_REV;
+    return;
+  }
+  cogTable(c, iMax);
+  c->state = COG_DONE;
+}
+
+/* TORQUE mode target correction [r_inpTgt units] at the controller angle [deg] and speed n [rpm] */
+int16_t cogComp(const Cogging *c, int16_t angle, int16_t n) {
+  int16_t nAbs = n < 0 ? -n : n;
+  int16_t v;
+  if (nAbs >= 2 * COGGING_N_MAX) {
+    return 0;
+  }
+  v = c->tab[cogBin(angle)];
+  if (nAbs > COGGING_N_MAX) {
+    v = (int16_t)(v * (2 * COGGING_N_MAX - nAbs) / COGGING_N_MAX);
+  }
+  return v;
+}
+
+#endif
@@ -26,12 +26,21 @@
 #include "defines.h"
 #include "eeprom.h"
 #include "BLDC_controller.h"
+#include "BLDC_controller_data.h"
 #include "util.h"
+#include "timebase.h"
+#include "stackmon.h"
 #include "comms.h"
 #include "main.h"
+#include "bldc.h"
+#include "sched.h"
+#include "crc32.h"
+#include "boot.h"
+#include "print.h"
+#include "ring.h"
 
 #if defined(DEBUG_SERIAL_PROTOCOL)
-#if defined(DEBUG_SERIAL_PROTOCOL) && (defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3))
+#if defined(DEBUG_SERIAL_PROTOCOL) && defined(DEBUG_OUT)
 
 #ifdef CONTROL_ADC
   #define RAW_MIN 0
@@ -43,6 +52,7 @@
 
 
 #define MAX_PARAM_WATCH 15
+#define MAX_PARAM_STREAM 16
 
 enum commandTypes {READ,WRITE};
 // Function0 - Function with 0 parameter
@@ -50,78 +60,79 @@ enum commandTypes {READ,WRITE};
 // Function2 - Function with 2 parameter (e.g. SET PARAM XXXX)
 const command_entry commands[] = {
   // Type   ,Name      ,Function0         ,Function1       ,Function2      ,Help     
-    {READ   ,"GET"     ,printAllParamDef  ,printParamDef   ,NULL           ,"Get Parameter/Variable"},
-    {READ   ,"HELP"    ,printAllParamHelp ,printParamHelp  ,NULL           ,"Command/Parameter/Variable Help"},
-    {READ   ,"WATCH"   ,NULL              ,watchParamVal   ,NULL           ,"Toggle Parameter/Variable Watch"},
-    {WRITE  ,"SET"     ,NULL              ,NULL            ,setParamValExt ,"Set Parameter"},
-    {WRITE  ,"INIT"    ,NULL              ,initParamVal    ,NULL           ,"Init Parameter from EEPROM or CONFIG.H"},
-    {WRITE  ,"SAVE"    ,saveAllParamVal   ,NULL            ,NULL           ,"Save Parameters to EEPROM"},
+    {READ   ,"GET"     ,printAllParamDef  ,printParamDef   ,NULL           ,HELP("Get Parameter/Variable")},
+    {READ   ,"HELP"    ,printAllParamHelp ,printParamHelp  ,NULL           ,HELP("Command/Parameter/Variable Help")},
+    {READ   ,"WATCH"   ,NULL              ,watchParamVal   ,NULL           ,HELP("Toggle Parameter/Variable Watch")},
+    {READ   ,"STREAM"  ,NULL              ,streamParamVal  ,NULL           ,HELP("Toggle Parameter/Variable in binary stream")},
+#if defined(BLACKBOX_ENABLE)
+    {READ   ,"BBOX"    ,dumpBlackbox      ,NULL            ,NULL           ,HELP("Freeze and dump the black box recorder")},
+#endif
+#if defined(SCOPE_ENABLE)
+    {READ   ,"SCOPE"   ,dumpScope         ,scopeParamVal   ,NULL           ,HELP("Dump the scope capture / add or remove a channel")},
+#endif
+#if defined(SCHED_STATS)
+    {READ   ,"SCHED"   ,dumpSched         ,NULL            ,NULL           ,HELP("Print the main loop task statistics")},
+#endif
+#if defined(LATENCY_MEAS)
+    {READ   ,"LAT"     ,dumpLat           ,NULL            ,NULL           ,HELP("Print the input to PWM latency and restart it")},
+#endif
+#if defined(CTRL_HOOKS)
+    {READ   ,"HOOKS"   ,dumpHooks         ,NULL            ,NULL           ,HELP("Print the control hooks and switch them on again")},
+#endif
+#if defined(FAULTLOG_ENABLE)
+    {READ   ,"FLOG"    ,dumpFaultLog      ,NULL            ,NULL           ,HELP("Dump the flash fault log")},
+#endif
+#if defined(HALL_CALIB)
+    {WRITE  ,"HALLCAL" ,startHallCalib    ,NULL            ,NULL           ,HELP("Calibrate the hall edges, turns the wheels!")},
+#endif
+#if defined(HALL_STATS)
+    {READ   ,"HALLST"  ,dumpHallStat      ,NULL            ,NULL           ,HELP("Print the hall sensor statistics and restart them")},
+#endif
+#if defined(MOTOR_IDENT)
+    {WRITE  ,"MOTID"   ,startMotorIdent   ,NULL            ,NULL           ,HELP("Measure motor R, L and flux, turns the wheels!")},
+#endif
+#if defined(ADC_SAMPLE_ALIGN)
+    {WRITE  ,"ADCSWEEP",startAdcSweep     ,NULL            ,NULL           ,HELP("Sweep the ADC trigger and print the current noise")},
+#endif
+#if defined(COGGING_COMP)
+    {WRITE  ,"COGCAL"  ,startCogCalib     ,NULL            ,NULL           ,HELP("Record the cogging tables, turns the wheels!")},
+#endif
+#if defined(SPD_FILT)
+    {WRITE  ,"SPDID"   ,startSpdIdent     ,NULL            ,NULL           ,HELP("Sweep the speed target and set the speed notch, turns the wheels!")},
+#endif
+#if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+#if defined(AUTO_CALIBRATION_ENA)
+    {WRITE  ,"INCAL"   ,startInputCalib   ,NULL            ,NULL           ,HELP("Start/confirm the input limits calibration")},
+#endif
+    {WRITE  ,"INLIM"   ,startInputLimits  ,NULL            ,NULL           ,HELP("Start/confirm the current and speed limits update")},
+#endif
+    {WRITE  ,"SET"     ,NULL              ,NULL            ,setParamValExt ,HELP("Set Parameter")},
+    {WRITE  ,"INIT"    ,NULL              ,initParamVal    ,NULL           ,HELP("Init Parameter from EEPROM or CONFIG.H")},
+    {WRITE  ,"SAVE"    ,saveAllParamVal   ,NULL            ,NULL           ,HELP("Save Parameters to EEPROM")},
+#if defined(BOOTLOADER)
+    {WRITE  ,"BOOT"    ,startBoot         ,NULL            ,NULL           ,HELP("Restart into the UART bootloader, at standstill")},
+#endif
 };
 
-enum paramTypes {PARAMETER,VARIABLE};
+// Generated from Inc/params.def, see there for the columns
+#if defined(DEBUG_NO_HELP)
+  #define PARAM_HELP(text)
+#else
+  #define PARAM_HELP(text)  .help = text,
+#endif
 const parameter_entry params[] = {
-  // CONTROL PARAMETERS
-  // Type       ,Name                 ,Datatype ,ValueL ptr                  ,ValueR                    ,EEPRM Addr ,Init              Int/Ext ,Min    ,Max    ,Div             ,Mul  ,Fix   ,Callback Function  ,Help text
-    {PARAMETER  ,"CTRL_MOD"           ,ADD_PARAM(ctrlModReqRaw)              ,NULL                      ,0          ,CTRL_MOD_REQ      ,0      ,1      ,3      ,0               ,0    ,0     ,NULL               ,"Ctrl mode 1:VLT 2:SPD 3:TRQ"},
-    {PARAMETER  ,"CTRL_TYP"           ,ADD_PARAM(rtP_Left.z_ctrlTypSel)      ,&rtP_Right.z_ctrlTypSel   ,0          ,CTRL_TYP_SEL      ,0      ,0      ,2      ,0               ,0    ,0     ,NULL               ,"Ctrl type 0:COM 1:SIN 2:FOC"},
-    {PARAMETER  ,"I_MOT_MAX"          ,ADD_PARAM(rtP_Left.i_max)             ,&rtP_Right.i_max          ,1          ,I_MOT_MAX         ,1      ,1      ,40     ,A2BIT_CONV      ,0    ,4     ,NULL               ,"Max phase current A"},
-    {PARAMETER  ,"N_MOT_MAX"          ,ADD_PARAM(rtP_Left.n_max)             ,&rtP_Right.n_max          ,2          ,N_MOT_MAX         ,1      ,10     ,2000   ,0               ,0    ,4     ,NULL               ,"Max motor RPM"},
-    {PARAMETER  ,"FI_WEAK_ENA"        ,ADD_PARAM(rtP_Left.b_fieldWeakEna)    ,&rtP_Right.b_fieldWeakEna ,0          ,FIELD_WEAK_ENA    ,0      ,0      ,1      ,0               ,0    ,0     ,NULL               ,"Enable field weak"},
-  	{PARAMETER  ,"FI_WEAK_HI"         ,ADD_PARAM(rtP_Left.r_fieldWeakHi)     ,&rtP_Right.r_fieldWeakHi  ,0          ,FIELD_WEAK_HI     ,1      ,0      ,1500   ,0               ,0    ,4     ,Input_Lim_Init     ,"Field weak high RPM"},
-	  {PARAMETER  ,"FI_WEAK_LO"         ,ADD_PARAM(rtP_Left.r_fieldWeakLo)     ,&rtP_Right.r_fieldWeakLo  ,0          ,FIELD_WEAK_LO     ,1      ,0      ,1000   ,0               ,0    ,4     ,Input_Lim_Init     ,"Field weak low RPM"},
-    {PARAMETER  ,"FI_WEAK_MAX"        ,ADD_PARAM(rtP_Left.id_fieldWeakMax)   ,&rtP_Right.id_fieldWeakMax,0          ,FIELD_WEAK_MAX    ,1      ,0      ,20     ,A2BIT_CONV      ,0    ,4     ,NULL               ,"Field weak max current A(FOC)"},
-    {PARAMETER  ,"PHA_ADV_MAX"        ,ADD_PARAM(rtP_Left.a_phaAdvMax)       ,&rtP_Right.a_phaAdvMax    ,0          ,PHASE_ADV_MAX     ,1      ,0      ,55     ,0               ,0    ,4     ,NULL               ,"Max Phase Adv angle Deg(SIN)"},     
-  // INPUT PARAMETERS
-  // Type       ,Name                 ,ValueL ptr                            ,ValueR                    ,EEPRM Addr ,Init              Int/Ext ,Min    ,Max    ,Div             ,Mul  ,Fix   ,Callback Function  ,Help text
-    {VARIABLE   ,"IN1_RAW"            ,ADD_PARAM(input1[0].raw)              ,NULL                      ,0          ,0                 ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Input1 raw"},        
-    {PARAMETER  ,"IN1_TYP"            ,ADD_PARAM(input1[0].typ)              ,NULL                      ,3          ,0                 ,0      ,0      ,3      ,0               ,0    ,0     ,0                  ,"Input1 type"},        
-    {PARAMETER  ,"IN1_MIN"            ,ADD_PARAM(input1[0].min)              ,NULL                      ,4          ,RAW_MIN           ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Input1 min"},        
-    {PARAMETER  ,"IN1_MID"            ,ADD_PARAM(input1[0].mid)              ,NULL                      ,5          ,0                 ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Input1 mid"},
-    {PARAMETER  ,"IN1_MAX"            ,ADD_PARAM(input1[0].max)              ,NULL                      ,6          ,RAW_MAX           ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Input1 max"},        
-    {VARIABLE   ,"IN1_CMD"            ,ADD_PARAM(input1[0].cmd)              ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,0                  ,"Input1 cmd"},        
-    
-    {VARIABLE   ,"IN2_RAW"            ,ADD_PARAM(input2[0].raw)              ,NULL                      ,0          ,0                 ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Input2 raw"},   
-    {PARAMETER  ,"IN2_TYP"            ,ADD_PARAM(input2[0].typ)              ,NULL                      ,7          ,0                 ,0      ,0      ,3      ,0               ,0    ,0     ,0                  ,"Input2 type"},        
-    {PARAMETER  ,"IN2_MIN"            ,ADD_PARAM(input2[0].min)              ,NULL                      ,8          ,RAW_MIN           ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Input2 min"},        
-    {PARAMETER  ,"IN2_MID"            ,ADD_PARAM(input2[0].mid)              ,NULL                      ,9          ,0                 ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Input2 mid"},
-    {PARAMETER  ,"IN2_MAX"            ,ADD_PARAM(input2[0].max)              ,NULL                      ,10         ,RAW_MAX           ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Input2 max"},
-    {VARIABLE   ,"IN2_CMD"            ,ADD_PARAM(input2[0].cmd)              ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,0                  ,"Input2 cmd"},
-#if defined(PRI_INPUT1) && defined(PRI_INPUT2) && defined(AUX_INPUT1) && defined(AUX_INPUT2)  
-  // Type       ,Name                 ,ValueL ptr                            ,ValueR                    ,EEPRM Addr ,Init              Int/Ext ,Min    ,Max    ,Div             ,Mul  ,Fix   ,Callback Function  ,Help text
-    {VARIABLE   ,"AUX_IN1_RAW"        ,ADD_PARAM(input1[1].raw)              ,NULL                      ,0          ,0                 ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Aux. input1 raw"},        
-    {PARAMETER  ,"AUX_IN1_TYP"        ,ADD_PARAM(input1[1].typ)              ,NULL                      ,11         ,0                 ,0      ,0      ,3      ,0               ,0    ,0     ,0                  ,"Aux. input1 type"},        
-    {PARAMETER  ,"AUX_IN1_MIN"        ,ADD_PARAM(input1[1].min)              ,NULL                      ,12         ,RAW_MIN           ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Aux. input1 min"},        
-    {PARAMETER  ,"AUX_IN1_MID"        ,ADD_PARAM(input1[1].mid)              ,NULL                      ,13         ,0                 ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Aux. input1 mid"},
-    {PARAMETER  ,"AUX_IN1_MAX"        ,ADD_PARAM(input1[1].max)              ,NULL                      ,14         ,RAW_MAX           ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Aux. input1 max"},        
-    {VARIABLE   ,"AUX_IN1_CMD"        ,ADD_PARAM(input1[1].cmd)              ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,0                  ,"Aux. input1 cmd"},        
-    
-    {VARIABLE   ,"AUX_IN2_RAW"        ,ADD_PARAM(input2[1].raw)              ,NULL                      ,0          ,0                 ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Aux. input2 raw"},        
-    {PARAMETER  ,"AUX_IN2_TYP"        ,ADD_PARAM(input2[1].typ)              ,NULL                      ,15         ,0                 ,0      ,0      ,3      ,0               ,0    ,0     ,0                  ,"Aux. input2 type"},        
-    {PARAMETER  ,"AUX_IN2_MIN"        ,ADD_PARAM(input2[1].min)              ,NULL                      ,16         ,RAW_MIN           ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Aux. input2 min"},        
-    {PARAMETER  ,"AUX_IN2_MID"        ,ADD_PARAM(input2[1].mid)              ,NULL                      ,17         ,0                 ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Aux. input2 mid"},
-    {PARAMETER  ,"AUX_IN2_MAX"        ,ADD_PARAM(input2[1].max)              ,NULL                      ,18         ,RAW_MAX           ,0      ,RAW_MIN,RAW_MAX,0               ,0    ,0     ,0                  ,"Aux. input2 max"},
-    {VARIABLE   ,"AUX_IN2_CMD"        ,ADD_PARAM(input2[1].cmd)              ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,0                  ,"Aux. input2 cmd"},
-#endif  
-  // FEEDBACK
-  // Type       ,Name                 ,Datatype, ValueL ptr                  ,ValueR                    ,EEPRM Addr ,Init              Int/Ext ,Min    ,Max    ,Div             ,Mul  ,Fix   ,Callback Function  ,Help text
-    {VARIABLE   ,"DC_CURR"            ,ADD_PARAM(dc_curr)                    ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,NULL               ,"Total DC Link current A *100"},
-    {VARIABLE   ,"RDC_CURR"           ,ADD_PARAM(right_dc_curr)              ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,NULL               ,"Right DC Link current A *100"},
-    {VARIABLE   ,"LDC_CURR"           ,ADD_PARAM(left_dc_curr)               ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,NULL               ,"Left DC Link current A *100"},
-    {VARIABLE   ,"CMDL"               ,ADD_PARAM(cmdL)                       ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,NULL               ,"Left Motor Command"},
-    {VARIABLE   ,"CMDR"               ,ADD_PARAM(cmdR)                       ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,NULL               ,"Right Motor Command"},
-    {VARIABLE   ,"SPD_AVG"            ,ADD_PARAM(speedAvg)                   ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,NULL               ,"Motor Measured Avg RPM"},
-    {VARIABLE   ,"SPDL"               ,ADD_PARAM(rtY_Left.n_mot)             ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,NULL               ,"Left Motor Measured RPM"},
-    {VARIABLE   ,"SPDR"               ,ADD_PARAM(rtY_Right.n_mot)            ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,NULL               ,"Right Motor Measured RPM"},
-    {VARIABLE   ,"RATE"               ,0       , NULL                        ,NULL                      ,0          ,RATE              ,0      ,0      ,0      ,0               ,0    ,4     ,NULL               ,"Rate *10"},
-    {VARIABLE   ,"SPD_COEF"           ,0       , NULL                        ,NULL                      ,0          ,SPEED_COEFFICIENT ,0      ,0      ,0      ,0               ,10   ,14    ,NULL               ,"Speed Coefficient *10"},
-    {VARIABLE   ,"STR_COEF"           ,0       , NULL                        ,NULL                      ,0          ,STEER_COEFFICIENT ,0      ,0      ,0      ,0               ,10   ,14    ,NULL               ,"Steer Coefficient *10"},
-    {VARIABLE   ,"BATV"               ,ADD_PARAM(batVoltageCalib)            ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,NULL               ,"Calibrated Battery voltage *100"},       
-    {VARIABLE   ,"TEMP"               ,ADD_PARAM(board_temp_deg_c)           ,NULL                      ,0          ,0                 ,0      ,0      ,0      ,0               ,0    ,0     ,NULL               ,"Calibrated Temperature °C *10"},       
-
+  #define PARAM(type_, name_, var, varR, addr_, init_, ext, min_, max_, div_, mul_, fix_, callback, help_) \
+    {.name = #name_, .valueL = &(var), .valueR = varR, .callback_function = callback, PARAM_HELP(help_) \
+     .init = init_, .min = min_, .max = max_, .addr = addr_, .type = type_, .initFormat = ext, .datatype = typename(var), \
+     .div = div_, .mul = mul_, .fix = fix_},
+  #define PARAM_CONST(name_, init_, mul_, fix_, help_) \
+    {.name = #name_, PARAM_HELP(help_) .init = init_, .type = VARIABLE, .mul = mul_, .fix = fix_},
+  #include "params.def"
 };
 
 
-const char *errors[9] = {
+#if !defined(DEBUG_NO_HELP)
+const char *errors[11] = {
   "Command not found", // Err1
   "Parameter not found", // Err2
   "This command cannot be used with a Variable", // Err3
@@ -130,12 +141,37 @@ const char *errors[9] = {
   "Start of line expected", // Err6
   "End of line expected", // Err7
   "Parameter expected", // Err8
-  "Uncaught error" // Err9
-  "Watch list is full" // Err10
+  "Uncaught error", // Err9
+  "Watch list is full", // Err10
+  "Not an integer variable" // Err11
 };
+#endif
 
-debug_command command;
+// Received commands, filled by handle_input (PendSV), drained by process_commands (main loop)
+static debug_command cmdQueue[DEBUG_CMD_QUEUE_SIZE];
+static Ring    cmdRing;
+uint32_t cmdQueueDrop;                  // commands dropped because the queue was full
+static int16_t cmdId = -1;              // response ID of the command being executed
+static uint8_t cmdLine[DEBUG_CMD_LINE_MAX];
+static uint8_t cmdLineLen;
+
+// Binary requests, same single producer/single consumer scheme as the text commands
+#define BIN_FRAME_MAX   (4 + 5 * DEBUG_BIN_MAX_ITEMS + 4)
+static uint8_t binQueue[2][BIN_FRAME_MAX];
+static Ring    binRing;
+static uint8_t binFrame[BIN_FRAME_MAX]; // binary request being received
+static uint8_t binFrameLen;             // received bytes, 0 = no binary request in progress
+static uint8_t binFrameSize;            // expected bytes, known after the header
+uint32_t binReqDrop;                     // binary requests dropped: bad header, checksum or queue full
 int8_t watchParamList[MAX_PARAM_WATCH] = {-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1}; 
+int8_t streamParamList[MAX_PARAM_STREAM] = {-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1};
+uint16_t streamRate;            // [Hz] binary stream rate, 0 = off
+static uint16_t streamSeq;      // binary stream frame counter
+static uint16_t streamAcc;      // rate accumulator, process_stream runs every 1 ms
+static const uint8_t streamTypeSize[] = {1, 2, 4, 1, 2, 4, 4, 4};   // Bytes per value, indexed by enum types
+
+enum paramStoreStates {PARAM_STORE_DEFAULT, PARAM_STORE_VALID, PARAM_STORE_LEGACY};
+static uint8_t paramStoreState; // result of the stored configuration checks, see paramStoreStates
 
 // Set Param with Value from external format
 int8_t setParamValExt(uint8_t index, int32_t value) {   
@@ -150,37 +186,39 @@ int8_t setParamValExt(uint8_t index, int32_t value) {
   return ret;
 }
 
+// Typed accessors of the params[] values, indexed by enum types: one load / store per type instead of a switch per
+// access. INT is int32_t on the ARM toolchain, FLOAT values are not accessed through params[]
+static int32_t ldU8 (const void *p) { return *(const uint8_t  *)p; }
+static int32_t ldU16(const void *p) { return *(const uint16_t *)p; }
+static int32_t ldU32(const void *p) { return (int32_t)*(const uint32_t *)p; }
+static int32_t ldI8 (const void *p) { return *(const int8_t   *)p; }
+static int32_t ldI16(const void *p) { return *(const int16_t  *)p; }
+static int32_t ldI32(const void *p) { return *(const int32_t  *)p; }
+static int32_t ldNone(const void *p) { (void)p; return 0; }
+static void stU8 (void *p, int32_t v) { *(uint8_t  *)p = (uint8_t)v; }
+static void stU16(void *p, int32_t v) { *(uint16_t *)p = (uint16_t)v; }
+static void stU32(void *p, int32_t v) { *(uint32_t *)p = (uint32_t)v; }
+static void stI8 (void *p, int32_t v) { *(int8_t   *)p = (int8_t)v; }
+static void stI16(void *p, int32_t v) { *(int16_t  *)p = (int16_t)v; }
+static void stI32(void *p, int32_t v) { *(int32_t  *)p = v; }
+static void stNone(void *p, int32_t v) { (void)p; (void)v; }
+static int32_t (*const paramLoad[])(const void *p)   = {ldU8, ldU16, ldU32, ldI8, ldI16, ldI32, ldI32, ldNone};
+static void    (*const paramStore[])(void *p, int32_t v) = {stU8, stU16, stU32, stI8, stI16, stI32, stI32, stNone};
+
+// Cast and assign value in internal format to the Left and Right variables
+static void writeParamValInt(uint8_t index, int32_t newValue) {
+  const parameter_entry *p = &params[index];
+  if (p->valueL == NULL) return;                      // PARAM_CONST
+  paramStore[p->datatype](p->valueL, newValue);
+  if (p->valueR != NULL) paramStore[p->datatype](p->valueR, newValue);
+}
+
 // Set Param with value from internal format
 int8_t setParamValInt(uint8_t index, int32_t newValue) {
   int32_t oldValue = getParamValInt(index);
   if (oldValue != newValue){ 
     // if value is different, beep, cast and assign new value
-    switch (params[index].datatype){
-      case UINT8_T:
-        if (params[index].valueL != NULL) *(uint8_t*)params[index].valueL = newValue;
-        if (params[index].valueR != NULL) *(uint8_t*)params[index].valueR = newValue;
-        break;
-      case UINT16_T:
-        if (params[index].valueL != NULL) *(uint16_t*)params[index].valueL = newValue; 
-        if (params[index].valueR != NULL) *(uint16_t*)params[index].valueR = newValue;
-        break;
-      case UINT32_T:
-        if (params[index].valueL != NULL) *(uint32_t*)params[index].valueL = newValue; 
-        if (params[index].valueR != NULL) *(uint32_t*)params[index].valueR = newValue;
-        break;
-      case INT8_T:
-        if (params[index].valueL != NULL) *(int8_t*)params[index].valueL = newValue; 
-        if (params[index].valueR != NULL) *(int8_t*)params[index].valueR = newValue;
-        break;
-      case INT16_T:
-        if (params[index].valueL != NULL) *(int16_t*)params[index].valueL = newValue; 
-        if (params[index].valueR != NULL) *(int16_t*)params[index].valueR = newValue;
-        break;
-      case INT32_T:
-        if (params[index].valueL != NULL) *(int32_t*)params[index].valueL = newValue; 
-        if (params[index].valueR != NULL) *(int32_t*)params[index].valueR = newValue;
-        break;
-    }
+    writeParamValInt(index, newValue);
 
     // Beep if value was modified
     beepShort(5);
@@ -196,54 +234,13 @@ int32_t getParamValExt(uint8_t index) {
   return intToExt(index,getParamValInt(index));
 }
 
-// Get Parameter Internal Value
+// Get Parameter Internal Value: the mean of the Left and Right variables, the init value of a PARAM_CONST
 int32_t getParamValInt(uint8_t index) {
-  int32_t value = 0;
-
-  int8_t countVar = 0;
-  if (params[index].valueL != NULL) countVar++;
-  if (params[index].valueR != NULL) countVar++;
-
-  if (countVar > 0){
-    // Read Left and Right values and calculate average 
-    // If left and right have to be summed up, DIV field could be adapted to multiply by 2
-    // Cast to parameter datatype
-    switch (params[index].datatype){
-      case UINT8_T:
-        if (params[index].valueL != NULL) value += *(uint8_t*)params[index].valueL;
-        if (params[index].valueR != NULL) value += *(uint8_t*)params[index].valueR;
-        break;
-      case UINT16_T:
-        if (params[index].valueL != NULL) value += *(uint16_t*)params[index].valueL;
-        if (params[index].valueR != NULL) value += *(uint16_t*)params[index].valueR;
-        break;
-      case UINT32_T:
-        if (params[index].valueL != NULL) value += *(uint32_t*)params[index].valueL;
-        if (params[index].valueR != NULL) value += *(uint32_t*)params[index].valueR;
-        break;
-      case INT8_T:
-        if (params[index].valueL != NULL) value += *(int8_t*)params[index].valueL;
-        if (params[index].valueR != NULL) value += *(int8_t*)params[index].valueR;
-        break;
-      case INT16_T:
-        if (params[index].valueL != NULL) value += *(int16_t*)params[index].valueL;
-        if (params[index].valueR != NULL) value += *(int16_t*)params[index].valueR;
-        break;
-      case INT32_T:
-        if (params[index].valueL != NULL) value += *(int32_t*)params[index].valueL;
-        if (params[index].valueR != NULL) value += *(int32_t*)params[index].valueR;
-        break;
-      default:
-        value = 0;
-    }
-
-    // Divide by number of values provided for the parameter
-    value /= countVar;
-  }else{
-    // No variable was provided, return init value that might contain a macro
-    value = params[index].init;
-  }
-
+  const parameter_entry *p = &params[index];
+  int32_t value;
+  if (p->valueL == NULL) return p->init;              // No variable, the init value might contain a macro
+  value = paramLoad[p->datatype](p->valueL);
+  if (p->valueR != NULL) value = (value + paramLoad[p->datatype](p->valueR)) / 2;
   return value;
 }
 
@@ -275,15 +272,376 @@ int8_t printParamVal(){
   return 1;
 }
 
-// Print help for Command
+// Add or remove parameter from binary stream
+int8_t streamParamVal(uint8_t index){
+  int8_t i,found = 0;
+  for(i=0;i < MAX_PARAM_STREAM && streamParamList[i]>-1;i++){
+    if (streamParamList[i] == index) found = 1;
+    if (found) streamParamList[i] = (i < MAX_PARAM_STREAM-1)?streamParamList[i+1]:-1;
+  }
+  if (!found){
+    if (i < MAX_PARAM_STREAM){
+      streamParamList[i] = index;
+    } else {
+      printError(10);
+      return 0;
+    }
+  }
+  // Print the new frame layout so the host can decode it
+  printf("# stream");
+  for(i=0;i < MAX_PARAM_STREAM && streamParamList[i]>-1;i++){
+    printf(" %s:%i",params[streamParamList[i]].name,streamTypeSize[params[streamParamList[i]].datatype]);
+  }
+  printf("\r\n");
+  return 1;
+}
+
+/*
+ * Binary stream frame, all fields little-endian:
+ *   uint16 start      DEBUG_STREAM_START_FRAME
+ *   uint8  channels   number of values
+ *   uint8  length     payload length in bytes
+ *   uint16 seq        frame counter, incremented also for frames dropped because the TX queue was full
+ *   uint32 time       [us] timebase, timeUs()
+ *   values...         internal value of each stream channel, 1, 2 or 4 bytes as listed by $STREAM
+ *   uint32 checksum   CRC32 (same as the serial feedback) over all previous bytes
+ */
+void process_stream(){
+  if (streamRate == 0 || streamParamList[0] == -1) return;
+  streamAcc += streamRate;
+  if (streamAcc < 1000) return;
+  streamAcc -= 1000;
+
+  uint8_t  frame[10 + MAX_PARAM_STREAM * 4 + 4];
+  uint8_t  len = 10;
+  uint8_t  i, n = 0;
+  uint32_t value;
+  uint32_t time = timeUs();
+
+  for(i=0;i < MAX_PARAM_STREAM && streamParamList[i]>-1;i++){
+    value = (uint32_t)getParamValInt(streamParamList[i]);
+    switch (streamTypeSize[params[streamParamList[i]].datatype]){
+      case 4:
+        frame[len++] = (uint8_t)value; frame[len++] = (uint8_t)(value >> 8); value >>= 16;
+        // fall through
+      case 2:
+        frame[len++] = (uint8_t)value; value >>= 8;
+        // fall through
+      default:
+        frame[len++] = (uint8_t)value;
+    }
+    n++;
+  }
+  frame[0] = (uint8_t)DEBUG_STREAM_START_FRAME;
+  frame[1] = (uint8_t)(DEBUG_STREAM_START_FRAME >> 8);
+  frame[2] = n;
+  frame[3] = len - 10;
+  frame[4] = (uint8_t)streamSeq;
+  frame[5] = (uint8_t)(streamSeq >> 8);
+  frame[6] = (uint8_t)time;
+  frame[7] = (uint8_t)(time >> 8);
+  frame[8] = (uint8_t)(time >> 16);
+  frame[9] = (uint8_t)(time >> 24);
+  value = calc_crc32(frame, len);
+  frame[len++] = (uint8_t)value;
+  frame[len++] = (uint8_t)(value >> 8);
+  frame[len++] = (uint8_t)(value >> 16);
+  frame[len++] = (uint8_t)(value >> 24);
+  streamSeq++;
+
+  if (debugTxFree() >= len) {   // Never block or split a frame, the host detects the gap in seq
+    debugTxWrite(frame, len);
+  } else {
+    debugTxDrop += len;
+  }
+}
+
+#if defined(BLACKBOX_ENABLE)
+static int16_t bboxDumpIdx = -1;    // next sample to print, -1 = no dump in progress
+
+// Freeze the black box and start the dump, the samples are printed by process_blackbox
+int8_t dumpBlackbox(){
+  int16_t trigPos = -1;
+  if (blackbox.state != BLACKBOX_ARMED) {
+    trigPos = (blackbox.trig + BLACKBOX_DEPTH - (blackbox.wr + BLACKBOX_DEPTH - blackbox.cnt)) % BLACKBOX_DEPTH;
+  }
+  blackbox.state = BLACKBOX_FROZEN;
+  printf("# bbox samples:%i trig:%i time:%lu decim:%i\r\n", blackbox.cnt, trigPos, blackbox.trigTime, BLACKBOX_DECIM);
+  printf("# curAL curBL curDCL dutyAL dutyBL dutyCL nL hallL flagsL cmdL curBR curCR curDCR dutyAR dutyBR dutyCR nR hallR flagsR cmdR\r\n");
+  bboxDumpIdx = 0;
+  return 1;
+}
+
+// Print the black box samples, oldest first, as fast as the debug TX queue allows
+void process_blackbox(){
+  if (bboxDumpIdx < 0) return;
+  while (bboxDumpIdx < blackbox.cnt && debugTxFree() >= 160) {
+    const BlackBoxSample *b = &blackbox.buf[(blackbox.wr + BLACKBOX_DEPTH - blackbox.cnt + bboxDumpIdx) % BLACKBOX_DEPTH];
+    printf("%i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i\r\n",
+      b->left.curA,  b->left.curB,  b->left.curDC,  b->left.dutyA,  b->left.dutyB,  b->left.dutyC,  b->left.n_mot,  b->left.hall,  b->left.flags,  b->left.inpTgt,
+      b->right.curA, b->right.curB, b->right.curDC, b->right.dutyA, b->right.dutyB, b->right.dutyC, b->right.n_mot, b->right.hall, b->right.flags, b->right.inpTgt);
+    bboxDumpIdx++;
+  }
+  if (bboxDumpIdx >= blackbox.cnt) {
+    printf("# bbox end\r\n");
+    bboxDumpIdx = -1;
+  }
+}
+#endif
+
+#if defined(SCOPE_ENABLE)
+static int8_t  scopeList[SCOPE_CH];     // params[] index of each scope channel
+static int16_t scopeDumpIdx = -1;       // next sample to print, -1 = no dump in progress
+
+// Add or remove a scope channel, disarms the scope. Integer variables of up to 32 bits, the left value of a pair
+int8_t scopeParamVal(uint8_t index){
+  uint8_t i, found = 0;
+  if (params[index].datatype == FLOAT || params[index].valueL == NULL) {
+    printError(11);
+    return 0;
+  }
+  scope.state = SCOPE_IDLE;             // the control interrupt leaves the channels alone from here
+  scopeDumpIdx = -1;
+  for (i = 0; i < scope.n; i++) {
+    if (scopeList[i] == index) found = 1;
+    if (found && i + 1 < scope.n) {
+      scopeList[i] = scopeList[i + 1];
+      scope.src[i] = scope.src[i + 1];
+      scope.type[i] = scope.type[i + 1];
+    }
+  }
+  if (found) {
+    scope.n--;
+  } else if (scope.n < SCOPE_CH) {
+    scopeList[scope.n] = index;
+    scope.src[scope.n] = params[index].valueL;
+    scope.type[scope.n] = params[index].datatype;
+    scope.n++;
+  } else {
+    printError(10);
+    return 0;
+  }
+  if (scope.trigCh > scope.n) scope.trigCh = 0;
+  printf("# scope");
+  for (i = 0; i < scope.n; i++) printf(" %s", params[scopeList[i]].name);
+  printf("\r\n");
+  return 1;
+}
+
+// Print the scope state, or start the dump of a finished capture. The samples are printed by process_scope
+int8_t dumpScope(){
+  if (scope.state != SCOPE_DONE) {
+    printf("# scope state:%i samples:%i\r\n", scope.state, scope.cnt);
+    return 1;
+  }
+  printf("# scope samples:%i trig:%i time:%lu decim:%i\r\n#", scope.cnt,
+    (scope.trig + scope.depth - (scope.wr + scope.depth - scope.cnt)) % scope.depth, scope.trigTime, scope.decim);
+  for (uint8_t i = 0; i < scope.n; i++) printf(" %s", params[scopeList[i]].name);
+  printf("\r\n");
+  scopeDumpIdx = 0;
+  return 1;
+}
+
+// Print the captured samples, oldest first, as fast as the debug TX queue allows. Values are internal values
+void process_scope(){
+  if (scopeDumpIdx < 0) return;
+  while (scopeDumpIdx < scope.cnt && debugTxFree() >= 12 * SCOPE_CH + 2) {
+    const int32_t *s = &scope.buf[((scope.wr + scope.depth - scope.cnt + scopeDumpIdx) % scope.depth) * scope.n];
+    for (uint8_t i = 0; i < scope.n; i++) printf(i ? " %li" : "%li", s[i]);
+    printf("\r\n");
+    scopeDumpIdx++;
+  }
+  if (scopeDumpIdx >= scope.cnt) {
+    printf("# scope end\r\n");
+    scopeDumpIdx = -1;
+  }
+}
+#endif
+
+#if defined(SCHED_STATS)
+static const char *const schedNames[SCHED_TASKS] = {"CTRL", "SIDE", "MON", "FDBK", "DBG", "STRM", "CMD", "LCD", "BAL", "ICAL"};
+static int8_t schedDumpIdx = -1;        // next task to print, -1 = no dump in progress
+
+// Print the load and the table header, the task lines are printed by process_sched
+int8_t dumpSched(){
+  printf("# sched load:%i max:%i worst:%lu task:%s\r\n", schedLoad.load, schedLoad.loadMax, schedLoad.worst, schedNames[schedLoad.worstTask]);
+  printf("# task period last min max ovr hist(<%ius..)\r\n", SCHED_HIST_US);
+  schedDumpIdx = 0;
+  return 1;
+}
+
+// Print one line per task, runtimes in cycles, histogram bins doubling from SCHED_HIST_US
+void process_sched(){
+  if (schedDumpIdx < 0) return;
+  while (schedDumpIdx < SCHED_TASKS && debugTxFree() >= 160) {
+    const SchedTask *t = &schedTasks[schedDumpIdx];
+    printf("%s %lu %lu %lu %lu %lu", schedNames[schedDumpIdx], t->period, t->runLast,
+      (t->runMin == UINT32_MAX) ? 0 : t->runMin, t->runMax, t->overrun);
+    for (uint8_t b = 0; b < SCHED_HIST_BINS; b++) printf(" %u", t->hist[b]);
+    printf("\r\n");
+    schedDumpIdx++;
+  }
+  if (schedDumpIdx >= SCHED_TASKS) {
+    printf("# sched end\r\n");
+    schedDumpIdx = -1;
+  }
+}
+#endif
+
+#if defined(LATENCY_MEAS)
+static const char *const latNames[INPUTS_NR] = {    // input sources by input index, as inputSrc in util.c
+  #if defined(CONTROL_ADC)
+  [CONTROL_ADC]             = "ADC",
+  #endif
+  #if defined(CONTROL_NUNCHUK)
+  [CONTROL_NUNCHUK]         = "NUNCHUK",
+  #endif
+  #if defined(CONTROL_SERIAL_USART2)
+  [CONTROL_SERIAL_USART2]   = "USART2",
+  #endif
+  #if defined(CONTROL_SERIAL_USART3)
+  [CONTROL_SERIAL_USART3]   = "USART3",
+  #endif
+  #if defined(SIDEBOARD_SERIAL_USART2)
+  [SIDEBOARD_SERIAL_USART2] = "SIDE2",
+  #endif
+  #if defined(SIDEBOARD_SERIAL_USART3)
+  [SIDEBOARD_SERIAL_USART3] = "SIDE3",
+  #endif
+  #if defined(CONTROL_PPM_LEFT)
+  [CONTROL_PPM_LEFT]        = "PPM",
+  #endif
+  #if defined(CONTROL_PPM_RIGHT)
+  [CONTROL_PPM_RIGHT]       = "PPM",
+  #endif
+  #if defined(CONTROL_PWM_LEFT)
+  [CONTROL_PWM_LEFT]        = "PWM",
+  #endif
+  #if defined(CONTROL_PWM_RIGHT)
+  [CONTROL_PWM_RIGHT]       = "PWM",
+  #endif
+};
+static int8_t latDumpIdx = -1;          // next input index to print, -1 = no dump in progress
+
+// Print the table header, the input lines are printed by process_lat
+int8_t dumpLat(){
+  printf("# lat input src n drop p50 p90 p99 max hist(us:");
+  for (uint8_t b = 0; b < LAT_BINS; b += 8) printf(" %lu", latBinLow(b));
+  printf(" ..)\r\n");
+  latDumpIdx = 0;
+  return 1;
+}
+
+// Print one line per input index, latencies in us, then restart the measurement
+void process_lat(){
+  if (latDumpIdx < 0) return;
+  while (latDumpIdx < INPUTS_NR && debugTxFree() >= 400) {
+    const LatStat *t = &latMeas.stat[latDumpIdx];
+    printf("IN%i %s %lu %u %u %u %u %u", latDumpIdx + 1, latNames[latDumpIdx] ? latNames[latDumpIdx] : "-", t->n, t->drop,
+      t->p50, t->p90, t->p99, t->max);
+    for (uint8_t b = 0; b < LAT_BINS; b++) printf(" %u", t->hist[b]);
+    printf("\r\n");
+    latDumpIdx++;
+  }
+  if (latDumpIdx >= INPUTS_NR) {
+    printf("# lat end\r\n");
+    latReset(&latMeas);
+    latDumpIdx = -1;
+  }
+}
+#endif
+
+#if defined(CTRL_HOOKS)
+static int8_t hookDumpIdx = -1;         // next hook to print, -1 = no dump in progress
+
+// Print the table header, the hook lines are printed by process_hooks
+int8_t dumpHooks(){
+  printf("# hooks n:%i stage(0:PRE 1:POST) motors(1:L 2:R) budget last max runs over(cycles, 0 = on)\r\n", CTRL_HOOK_COUNT);
+  hookDumpIdx = 0;
+  return 1;
+}
+
+// Print one line per hook, then switch the hooks that ran over their budget on again
+void process_hooks(){
+  if (hookDumpIdx < 0) return;
+  while (hookDumpIdx < CTRL_HOOK_COUNT && debugTxFree() >= 80) {
+    const CtrlHookDef  *d = &ctrlHookDefs[hookDumpIdx];
+    const CtrlHookStat *t = &ctrlHookStats[hookDumpIdx];
+    printf("%s %u %u %u %u %u %lu %u\r\n", d->name, d->stage, d->motors, d->budget, t->last, t->max, t->runs, t->over);
+    hookDumpIdx++;
+  }
+  if (hookDumpIdx >= CTRL_HOOK_COUNT) {
+    printf("# hooks end\r\n");
+    ctrlHookRst = 1;
+    hookDumpIdx = -1;
+  }
+}
+#endif
+
+#if defined(FAULTLOG_ENABLE)
+static int16_t flogDumpIdx = -1;    // next record to print, -1 = no dump in progress
+static uint8_t flogDumpLine;        // next line of the record: 0 = header, 1.. = black box samples
+static const FaultRecord *flogRec;  // record being printed
+
+// Start the fault log dump, the records are printed by process_faultlog
+int8_t dumpFaultLog(){
+  printf("# flog seq cause(0:BTN 1:TEMP 2:BAT 3:IDLE 4:DIST) uptime errL errR latchL latchR bat temp nL nR\r\n");
+  flogDumpIdx  = 0;
+  flogDumpLine = 0;
+  return 1;
+}
+
+// Print the fault log records, oldest first, one line at a time as the debug TX queue allows
+void process_faultlog(){
+  const FaultRecord *rec;
+  if (flogDumpIdx < 0) return;
+  while (debugTxFree() >= 160) {
+    if (flogDumpLine == 0) {
+      flogRec = faultLogGet(flogDumpIdx);   // Scans the whole log, only once per record
+    }
+    rec = flogRec;
+    if (rec == NULL) {
+      printf("# flog end\r\n");
+      flogDumpIdx = -1;
+      return;
+    }
+    if (flogDumpLine == 0) {
+      printf("F %u %u %lu %u %u %u %u %i %i %i %i\r\n", rec->seq, rec->cause, rec->uptime, rec->errCodeL, rec->errCodeR,
+        rec->errLatchL, rec->errLatchR, rec->batVoltage, rec->boardTemp, rec->speedL, rec->speedR);
+    }
+    #if defined(BLACKBOX_ENABLE)
+    else {
+      const BlackBoxSample *b = &rec->bbox[flogDumpLine - 1];
+      printf("%i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i %i\r\n",
+        b->left.curA,  b->left.curB,  b->left.curDC,  b->left.dutyA,  b->left.dutyB,  b->left.dutyC,  b->left.n_mot,  b->left.hall,  b->left.flags,  b->left.inpTgt,
+        b->right.curA, b->right.curB, b->right.curDC, b->right.dutyA, b->right.dutyB, b->right.dutyC, b->right.n_mot, b->right.hall, b->right.flags, b->right.inpTgt);
+    }
+    if (flogDumpLine++ < rec->bboxCnt) continue;
+    #endif
+    flogDumpLine = 0;
+    flogDumpIdx++;
+    return;                           // One record per call, keeps the 1 ms task short
+  }
+}
+#endif
+
+// Print help for Command. With DEBUG_NO_HELP the host tool looks the text up by the command index
 int8_t printCommandHelp(uint8_t index){
+  #if defined(DEBUG_NO_HELP)
+  printf("? %s:#%i\r\n",commands[index].name,index);
+  #else
   printf("? %s:\"%s\"\r\n",commands[index].name,commands[index].help);
+  #endif
   return 1;
 }
 
-// Print help for parameter
+// Print help for parameter. With DEBUG_NO_HELP the host tool looks the text up by the parameter id
 int8_t printParamHelp(uint8_t index){
+  #if defined(DEBUG_NO_HELP)
+  printf("? %s:#%i ",params[index].name,index);
+  #else
   printf("? %s:\"%s\" ",params[index].name,params[index].help);
+  #endif
   if (params[index].type == PARAMETER) printf("[min:%li max:%li]",params[index].min,params[index].max);
   printf("\r\n");
   return 1;
@@ -313,8 +671,9 @@ int8_t printAllParamHelp(){
 
 // Print definition(name,value,initial value, min, max) for parameter
 int8_t printParamDef(uint8_t index){
-  printf("# name:\"%s\" value:%li init:%li min:%li max:%li\r\n",
+  printf("# name:\"%s\" id:%i value:%li init:%li min:%li max:%li\r\n",
          params[index].name,     // Parameter Name
+         index,                  // Parameter ID, can be used as "#<id>" instead of the name
          getParamValExt(index),  // Parameter Value translated to external format
          getParamInitExt(index), // Parameter Init Value translated to external format
          params[index].min,      // Parameter Min Value with External format 
@@ -328,10 +687,364 @@ int8_t printAllParamDef(){
   return 1;
 }
 
+// End a reply line, with the response ID of the command if it had one
+static void printReplyEnd(){
+  if (cmdId >= 0) printf(" @%i\r\n", cmdId); else printf("\r\n");
+}
+
 void printError(uint8_t errornum ){
-  printf("! Err%i:\"%s\"\r\n",errornum,errors[errornum-1]);
+  #if defined(DEBUG_NO_HELP)
+  printf("! Err%i",errornum);
+  #else
+  printf("! Err%i:\"%s\"",errornum,errors[errornum-1]);
+  #endif
+  printReplyEnd();
+}
+
+#if defined(HALL_CALIB)
+static uint8_t hallCalRun;          // a $HALLCAL is running, the result is printed and saved by process_hallcal
+
+// Start the hall calibration of both motors: enabled, at standstill, wheels off the ground
+int8_t startHallCalib(){
+  if (!enable || rtY_Left.n_mot != 0 || rtY_Right.n_mot != 0 || hallCalRun) {
+    printf("! Motors must be enabled and at standstill");
+    printReplyEnd();
+    return 0;
+  }
+  printf("# hallcal %i s\r\n", 3 + 2 * (rtP_Left.n_polePairs + 1) * 60 / (HALL_CALIB_SPEED * rtP_Left.n_polePairs));
+  bldc_hall_calib_start();
+  hallCalRun = 1;
+  return 1;
+}
+
+// Wait for both calibrations, print the corrections [deg] and save the successful ones
+void process_hallcal(){
+  uint8_t done = 0;
+  if (!hallCalRun || debugTxFree() < 160) return;
+  for (uint8_t m = 0; m < 2; m++) {
+    if (hallCal[m].state != HALL_CAL_DONE && hallCal[m].state != HALL_CAL_FAIL) return;
+  }
+  for (uint8_t m = 0; m < 2; m++) {
+    if (hallCal[m].state == HALL_CAL_DONE) {
+      const int16_t *c = hallCal[m].corr;
+      printf("# hallcal %c %i %i %i %i %i %i\r\n", m ? 'R' : 'L', c[0] * 10 / 64, c[1] * 10 / 64, c[2] * 10 / 64,
+        c[3] * 10 / 64, c[4] * 10 / 64, c[5] * 10 / 64);
+      done |= 1 << m;
+    } else {
+      printf("# hallcal %c failed\r\n", m ? 'R' : 'L');
+    }
+  }
+  if (done) {
+    hallCalSave(done);              // hallCalMotor has applied the results while HALL_CAL_DONE
+  }
+  hallCal[0].state = hallCal[1].state = HALL_CAL_IDLE;
+  hallCalRun = 0;
+}
+#endif
+
+#if defined(HALL_STATS)
+static int8_t hallStatDumpIdx = -1;     // next motor to print, -1 = no dump in progress
+
+// Print the table header, the motor lines are printed by process_hallstat
+int8_t dumpHallStat(){
+  printf("# hallst motor edges inv skip rev steady jit jitmax asym width(deg*10 of pos 0..5) hist(deg*10:");
+  for (uint8_t b = 0; b < HALL_STAT_JIT_BINS - 1; b++) printf(" %i", HALL_STAT_JIT_BIN0 << b);
+  printf(" ..)\r\n");
+  hallStatDumpIdx = 0;
+  return 1;
+}
+
+// Print one line per motor, then restart the statistics at the next hall edge
+void process_hallstat(){
+  if (hallStatDumpIdx < 0) return;
+  while (hallStatDumpIdx < 2 && debugTxFree() >= 200) {
+    const HallStat *h = &hallStat[hallStatDumpIdx];
+    printf("%c %lu %lu %lu %lu %lu %u %u %u", hallStatDumpIdx ? 'R' : 'L', h->edges, h->invalid, h->skips, h->reversals,
+      h->steady, h->jitAvg, h->jitMax, h->asym);
+    for (uint8_t k = 0; k < 6; k++) printf(" %i", h->width[k]);
+    for (uint8_t b = 0; b < HALL_STAT_JIT_BINS; b++) printf(" %lu", h->jitHist[b]);
+    printf("\r\n");
+    hallStatDumpIdx++;
+  }
+  if (hallStatDumpIdx >= 2) {
+    printf("# hallst end\r\n");
+    hallStatReq[0] = hallStatReq[1] = 1;
+    hallStatDumpIdx = -1;
+  }
+}
+#endif
+
+#if defined(MOTOR_IDENT)
+static uint8_t motIdRun;            // a $MOTID is running, the result is computed, printed and saved by process_motid
+
+// Start the identification of both motors: enabled, at standstill, wheels off the ground
+int8_t startMotorIdent(){
+  uint8_t busy = motIdRun;
+  #if defined(HALL_CALIB)
+  busy |= hallCalRun;
+  #endif
+  if (!enable || rtY_Left.n_mot != 0 || rtY_Right.n_mot != 0 || busy) {
+    printf("! Motors must be enabled and at standstill");
+    printReplyEnd();
+    return 0;
+  }
+  printf("# motid 8 s\r\n");
+  bldc_motor_ident_start();
+  motIdRun = 1;
+  return 1;
 }
 
+// Wait for both identifications, print R [mOhm], L [uH], flux [uV s] and the current PI gains, save the successful ones
+void process_motid(){
+  uint8_t done = 0;
+  if (!motIdRun || debugTxFree() < 160) return;
+  for (uint8_t m = 0; m < 2; m++) {
+    if (motId[m].state != MOT_ID_DONE && motId[m].state != MOT_ID_FAIL) return;
+  }
+  for (uint8_t m = 0; m < 2; m++) {
+    if (motIdResult(&motId[m])) {
+      const P *p = m ? &rtP_Right : &rtP_Left;
+      motIdTune(m);
+      printf("# motid %c R:%u L:%u flux:%u Kp:%u Ki:%u\r\n", m ? 'R' : 'L', motId[m].r, motId[m].l, motId[m].flux,
+        p->cf_iqKp, p->cf_iqKi);
+      done |= 1 << m;
+    } else {
+      printf("# motid %c failed in step %u\r\n", m ? 'R' : 'L', motId[m].failState);
+    }
+  }
+  if (done) {
+    motIdSave(done);
+  }
+  motId[0].state = motId[1].state = MOT_ID_IDLE;
+  motIdRun = 0;
+}
+#endif
+
+#if defined(COGGING_COMP)
+static uint8_t cogRun;              // a $COGCAL is running, the tables are printed and saved by process_cogcal
+
+// Start the cogging table recording of both motors: enabled, at standstill, wheels off the ground
+int8_t startCogCalib(){
+  uint8_t busy = cogRun;
+  #if defined(HALL_CALIB)
+  busy |= hallCalRun;
+  #endif
+  #if defined(MOTOR_IDENT)
+  busy |= motIdRun;
+  #endif
+  if (!enable || rtY_Left.n_mot != 0 || rtY_Right.n_mot != 0 || busy) {
+    printf("! Motors must be enabled and at standstill");
+    printReplyEnd();
+    return 0;
+  }
+  printf("# cogcal %i s\r\n", 2 * (COGGING_TIME + 2));
+  bldc_cogging_start();
+  cogRun = 1;
+  return 1;
+}
+
+// Wait for both recordings, print the peak to peak compensation [r_inpTgt units] and save the successful tables
+void process_cogcal(){
+  uint8_t done = 0;
+  if (!cogRun || debugTxFree() < 160) return;
+  for (uint8_t m = 0; m < 2; m++) {
+    if (cogging[m].state != COG_DONE && cogging[m].state != COG_FAIL) return;
+  }
+  for (uint8_t m = 0; m < 2; m++) {
+    if (cogging[m].state == COG_DONE) {
+      int8_t lo = 0, hi = 0;
+      for (uint8_t k = 0; k < COG_BINS; k++) {
+        lo = MIN(lo, cogging[m].tab[k]);
+        hi = MAX(hi, cogging[m].tab[k]);
+      }
+      printf("# cogcal %c pp:%i min:%i max:%i\r\n", m ? 'R' : 'L', hi - lo, lo, hi);
+      done |= 1 << m;
+    } else {
+      printf("# cogcal %c failed\r\n", m ? 'R' : 'L');
+    }
+  }
+  if (done) {
+    cogSave(done);                  // cogStep has replaced the table of a motor in COG_DONE
+  }
+  cogging[0].state = cogging[1].state = COG_IDLE;
+  cogRun = 0;
+}
+#endif
+
+#if defined(ADC_SAMPLE_ALIGN)
+static uint8_t adcSweepRun;         // a $ADCSWEEP is running, process_adcsweep prints one point per call
+static uint8_t adcSweepOut;         // [-] next point to print
+
+// Sweep the ADC trigger: motors enabled and at standstill, the noise comes from the switching at zero command
+int8_t startAdcSweep(){
+  if (!enable || rtY_Left.n_mot != 0 || rtY_Right.n_mot != 0 || adcSweepRun) {
+    printf("! Motors must be enabled and at standstill");
+    printReplyEnd();
+    return 0;
+  }
+  printf("# adcsweep %i s\r\n", 1 + ADC_SWEEP_POINTS * (ADC_SWEEP_SKIP + ADC_SWEEP_TICKS) / PWM_FREQ);
+  bldc_adc_sweep_start();
+  adcSweepRun = 1;
+  adcSweepOut = 0;
+  return 1;
+}
+
+static uint32_t isqrt32(uint32_t x) {
+  uint32_t r = 0;
+  for (uint32_t b = 1UL << 30; b; b >>= 2) {
+    if (x >= r + b) {
+      x -= r + b;
+      r  = (r >> 1) + b;
+    } else {
+      r >>= 1;
+    }
+  }
+  return r;
+}
+
+// Print the RMS noise [mA] of the shunts left A, B, right B, C per trigger point [timer counts before the top],
+// then the point with the lowest worst shunt
+void process_adcsweep(){
+  if (!adcSweepRun || debugTxFree() < 80 || adcSweep.state == ADC_SWEEP_RUN) return;
+  if (adcSweep.state != ADC_SWEEP_DONE) {
+    printf("# adcsweep failed\r\n");
+    adcSweepRun = 0;
+    return;
+  }
+  if (adcSweepOut < ADC_SWEEP_POINTS) {
+    uint32_t n[4];
+    for (uint8_t k = 0; k < 4; k++) {
+      n[k] = isqrt32((uint32_t)((uint64_t)adcSweep.var[adcSweepOut][k] * 1000000 / (16UL * A2BIT_CONV * A2BIT_CONV)));
+    }
+    printf("# adcsweep %i %lu %lu %lu %lu\r\n", ADC_SAMPLE_SWEEP - ADC_SAMPLE_SWEEP * adcSweepOut / (ADC_SWEEP_POINTS - 1),
+      n[0], n[1], n[2], n[3]);
+    adcSweepOut++;
+    return;
+  }
+  uint8_t  best  = 0;
+  uint32_t bestV = UINT32_MAX;
+  for (uint8_t i = 0; i < ADC_SWEEP_POINTS; i++) {
+    uint32_t v = MAX(MAX(adcSweep.var[i][0], adcSweep.var[i][1]), MAX(adcSweep.var[i][2], adcSweep.var[i][3]));
+    if (v < bestV) {
+      bestV = v;
+      best  = i;
+    }
+  }
+  printf("# adcsweep best %i, ADC_SMP %i\r\n", ADC_SAMPLE_SWEEP - ADC_SAMPLE_SWEEP * best / (ADC_SWEEP_POINTS - 1), adcSmpOfs);
+  adcSweep.state = ADC_SWEEP_IDLE;
+  adcSweepRun = 0;
+}
+#endif
+
+#if defined(SPD_FILT)
+static uint8_t  spdIdRun;           // a $SPDID is running, process_spdid prints the gains and sets the notch
+static uint8_t  spdIdOut;           // [-] next frequency to print
+static uint16_t spdIdNotch;         // [Hz] NF_FREQ before the sweep, kept without a resonance
+
+// Sweep the speed target of both motors: enabled, SPD_MODE of FOC, wheels off the ground. The notch is off for the sweep
+int8_t startSpdIdent(){
+  uint8_t busy = spdIdRun;
+  #if defined(HALL_CALIB)
+  busy |= hallCalRun;
+  #endif
+  #if defined(MOTOR_IDENT)
+  busy |= motIdRun;
+  #endif
+  #if defined(COGGING_COMP)
+  busy |= cogRun;
+  #endif
+  if (!enable || ctrlModReq != SPD_MODE || rtP_Left.z_ctrlTypSel != FOC_CTRL || busy) {
+    printf("! Motors must be enabled in SPD_MODE of FOC");
+    printReplyEnd();
+    return 0;
+  }
+  spdIdNotch = spdFilt[SF_NOTCH_HZ];
+  spdFilt[SF_NOTCH_HZ] = 0;
+  spdFiltApply();
+  printf("# spdid %u s\r\n", spdIdPlan());
+  bldc_spd_ident_start();
+  #if defined(SCOPE_ENABLE)
+  if (scope.n) scope.arm = 2;       // the capture starts with the sweep, SID_EXC shows the excitation
+  #endif
+  spdIdRun = 1;
+  spdIdOut = 0;
+  return 1;
+}
+
+// Wait for both sweeps, print the gain [% of the excitation] per frequency [Hz * 10], then set NF_FREQ to the
+// resonance of the motor with the higher peak over SPD_ID_PEAK % of the lowest frequency. "$SAVE" keeps it
+void process_spdid(){
+  if (!spdIdRun || debugTxFree() < 80) return;
+  for (uint8_t m = 0; m < 2; m++) {
+    if (spdId[m].state != SPD_ID_DONE && spdId[m].state != SPD_ID_FAIL) return;
+  }
+  if (spdId[0].state == SPD_ID_FAIL || spdId[1].state == SPD_ID_FAIL) {
+    printf("# spdid failed L:%i R:%i\r\n", spdId[0].state == SPD_ID_FAIL, spdId[1].state == SPD_ID_FAIL);
+    spdIdOut = SPD_ID_BINS;
+  }
+  if (spdIdOut < SPD_ID_BINS) {
+    printf("# spdid %u %u %u\r\n", spdIdFreq(spdIdOut), spdId[0].gain[spdIdOut], spdId[1].gain[spdIdOut]);
+    spdIdOut++;
+    return;
+  }
+  uint8_t  bin[2] = {0, 0};
+  uint16_t peak[2] = {0, 0};
+  for (uint8_t m = 0; m < 2; m++) {
+    if (spdId[m].state == SPD_ID_DONE) peak[m] = spdIdPeak(&spdId[m], &bin[m]);
+  }
+  uint8_t m = peak[1] > peak[0];
+  if (peak[m] >= SPD_ID_PEAK) {
+    spdFilt[SF_NOTCH_HZ] = (spdIdFreq(bin[m]) + 5) / 10;
+    printf("# spdid %c peak:%u%% NF_FREQ:%u\r\n", m ? 'R' : 'L', peak[m], spdFilt[SF_NOTCH_HZ]);
+  } else {
+    spdFilt[SF_NOTCH_HZ] = spdIdNotch;
+    printf("# spdid no resonance, peak:%u%%\r\n", peak[m]);
+  }
+  spdFiltApply();
+  spdId[0].state = spdId[1].state = SPD_ID_IDLE;
+  spdIdRun = 0;
+}
+#endif
+
+#if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+// Start an input mode, or confirm it when it is already running. Progress and result are in CAL_PROG / CAL_RES
+static int8_t startInputMode(uint8_t mode){
+  if (buttonMode == mode) {
+    inputCalStop();
+    return 1;
+  }
+  if (buttonMode != BTN_MODE_NONE || !inputCalStart(mode)) {
+    printf("! Motors must be at standstill, no other input mode running");
+    printReplyEnd();
+    return 0;
+  }
+  return 1;
+}
+
+int8_t startInputCalib(){
+  return startInputMode(BTN_MODE_CALIB);
+}
+
+int8_t startInputLimits(){
+  return startInputMode(BTN_MODE_LIMITS);
+}
+#endif
+
+#if defined(BOOTLOADER)
+// Reply first, then restart into the UART bootloader (boot.h)
+int8_t startBoot(){
+  if (speedAvgAbs > 10) {
+    printf("! Motors must be at standstill");
+    printReplyEnd();
+    return 0;
+  }
+  printf("OK");
+  printReplyEnd();
+  bootEnter();
+  return 0;
+}
+#endif
+
 // Function to increment a value
 // Get Parameter in External format, check max value, increment, set Parameter
 // Not used in the protocol yet 
@@ -347,17 +1060,68 @@ int8_t incrParamVal(uint8_t index) {
   } 
 }
 
+// CRC of the persisted layout (names and addresses) or, with values, of the values stored at those addresses
+static uint16_t paramStoreCrc(const uint16_t *values) {
+  uint32_t buf[2] = {0, 0};
+  for(int i=0;i<PARAM_SIZE(params);i++){
+    if (params[i].type == PARAMETER && params[i].addr){
+      buf[1] = values ? values[params[i].addr] : calc_crc32((const uint8_t *)params[i].name, strlen(params[i].name)) ^ params[i].addr;
+      buf[0] = calc_crc32((const uint8_t *)buf, sizeof(buf));
+    }
+  }
+  return (uint16_t)(buf[0] ^ (buf[0] >> 16));
+}
+
+// Check the stored configuration: the write key, then the schema and the CRC written last by saveAllParamVal
+// A configuration saved before the schema words existed is used for the legacy addresses only
+static uint8_t paramStoreCheck(uint16_t *values) {
+  uint16_t schema, crc;
+  for (uint8_t i = 0; i < NB_OF_VAR; i++) {
+    if (EE_ReadVariable(VirtAddVarTab[i], &values[i])) values[i] = 0xFFFF;
+  }
+  if (values[0] != FLASH_WRITE_KEY) return PARAM_STORE_DEFAULT;
+  if (EE_ReadVariable(VirtAddVarTab[EE_ADDR_SCHEMA], &schema)) return PARAM_STORE_LEGACY;
+  if (schema != paramStoreCrc(NULL)) return PARAM_STORE_DEFAULT;        // Parameter layout changed by a firmware update
+  values[EE_ADDR_SCHEMA] = schema;
+  values[EE_ADDR_CRC]    = 0xFFFF;
+  if (EE_ReadVariable(VirtAddVarTab[EE_ADDR_CRC], &crc) || crc != (uint16_t)(paramStoreCrc(values) ^ schema)) return PARAM_STORE_DEFAULT;
+  return PARAM_STORE_VALID;
+}
+
+// Load all parameters with an EEPROM address from the stored configuration, returns 0 if config.h values are used
+uint8_t loadAllParamVal() {
+  uint16_t values[NB_OF_VAR];
+  paramStoreState = paramStoreCheck(values);
+  if (paramStoreState == PARAM_STORE_DEFAULT) return 0;
+  for(int i=0;i<PARAM_SIZE(params);i++){
+    if (params[i].type == PARAMETER && params[i].addr && (paramStoreState == PARAM_STORE_VALID || params[i].addr <= EE_ADDR_LEGACY_LAST)){
+      writeParamValInt(i, (int16_t)values[params[i].addr]);
+      if (params[i].callback_function) (*params[i].callback_function)();
+    }
+  }
+  return 1;
+}
+
 // Get internal Parameter value and save it to EEprom for all paraemeter with an address assigned 
+// The values are collected in the EEPROM RAM cache and committed with the schema and the CRC as the last words
 int8_t saveAllParamVal() {
-  HAL_FLASH_Unlock();
-  EE_WriteVariable(VirtAddVarTab[0] , (uint16_t)FLASH_WRITE_KEY);
+  uint16_t values[NB_OF_VAR];
+  uint16_t schema = paramStoreCrc(NULL);
+  memset(values, 0xFF, sizeof(values));
+  values[0] = FLASH_WRITE_KEY;
   for(int i=0;i<PARAM_SIZE(params);i++){ 
     // Only Parameters with eeprom address can be saved
-    if (params[i].addr){
-      EE_WriteVariable(VirtAddVarTab[params[i].addr] , (uint16_t)getParamValInt(i));    
+    if (params[i].type == PARAMETER && params[i].addr){
+      values[params[i].addr] = (uint16_t)getParamValInt(i);
+      EE_WriteVariable(VirtAddVarTab[params[i].addr] , values[params[i].addr]);    
     }
   }
-  HAL_FLASH_Lock();
+  values[EE_ADDR_SCHEMA] = schema;
+  EE_WriteVariable(VirtAddVarTab[0]             , (uint16_t)FLASH_WRITE_KEY);
+  EE_WriteVariable(VirtAddVarTab[EE_ADDR_SCHEMA], schema);
+  EE_WriteVariable(VirtAddVarTab[EE_ADDR_CRC]   , (uint16_t)(paramStoreCrc(values) ^ schema));
+  EE_Save();                        // Program only the changed values, the CRC has the last address
+  paramStoreState = PARAM_STORE_VALID;
   return 1;
 }
 
@@ -392,15 +1156,12 @@ int32_t getParamInitExt(uint8_t index) {
 int16_t getParamInitInt(uint8_t index){
   if (params[index].addr){
     // if EEPROM address is specified, init from EEPROM address
-    uint16_t writeCheck, readVal;
+    uint16_t readVal;
     
-    HAL_FLASH_Unlock();
-    EE_ReadVariable(VirtAddVarTab[0], &writeCheck);
     EE_ReadVariable(VirtAddVarTab[params[index].addr] , &readVal);
-    HAL_FLASH_Lock();
     
-    // EEPROM was written, use stored value
-    if (writeCheck == FLASH_WRITE_KEY){
+    // EEPROM was written and passed the checks of loadAllParamVal, use stored value
+    if (paramStoreState == PARAM_STORE_VALID || (paramStoreState == PARAM_STORE_LEGACY && params[index].addr <= EE_ADDR_LEGACY_LAST)){
       return readVal;
     }else{
       // Use init value from array
@@ -430,48 +1191,105 @@ int8_t initParamVal(uint8_t index) {
   return ret;
 }
 
+// params[] indexes sorted by name for the binary search in findParam, built on first use
+static uint8_t paramSorted[PARAM_SIZE(params)];
+static uint8_t paramSortedInit = 0;
+
+// Parameter indexes are int8_t in the protocol (-1 = none)
+_Static_assert(PARAM_COUNT <= 127, "params[] has more than 127 entries, the protocol ids are int8_t");
+_Static_assert(PARAM_SIZE(params) == PARAM_COUNT, "PARAM_ID_* out of step with params[]");
+
+// Length of the token at userCommand: up to a space or the end of line
+static uint32_t tokenLen(const uint8_t *userCommand, uint32_t len){
+  uint32_t n = 0;
+  while (n < len && userCommand[n] != ' ' && userCommand[n] != '\r' && userCommand[n] != '\n') n++;
+  return n;
+}
+
+// Compare a token with a name like strcmp, without strlen. Not strncmp: a NUL byte in the token would end the
+// comparison early and name[len] would then read past the end of a shorter name
+static int tokenCmp(const uint8_t *token, uint32_t len, const char *name){
+  uint32_t i;
+  for (i = 0; i < len && name[i]; i++){
+    if (token[i] != (uint8_t)name[i]) return token[i] - (uint8_t)name[i];
+  }
+  if (i < len) return 1;                              // name ended first, a longer token compares greater
+  return name[i] ? -1 : 0;                            // token is a prefix of name
+}
+
+// Insertion sort of the params[] indexes by name, runs once
+static void paramSortInit(){
+  for(int i=0;i<PARAM_SIZE(params);i++){
+    int j = i;
+    while (j > 0 && strcmp(params[paramSorted[j-1]].name, params[i].name) > 0){
+      paramSorted[j] = paramSorted[j-1];
+      j--;
+    }
+    paramSorted[j] = i;
+  }
+  paramSortedInit = 1;
+}
+
 // Find command in commands array and return index
 int8_t findCommand(uint8_t *userCommand, uint32_t len){
+  uint32_t tlen = tokenLen(userCommand, len);
   for(int index=0;index<COMMAND_SIZE(commands);index++){
-    uint8_t command_len = strlen(commands[index].name);
-    if (command_len < len){
-      if (memcmp(userCommand,commands[index].name,command_len)==0){
-        return index;
-      }
+    if (tokenCmp(userCommand, tlen, commands[index].name) == 0){
+      return index;
     }
   }
   return -1; // Not found
 }
 
-// Find parameter in params array and return index
-int8_t findParam(uint8_t *userCommand, uint32_t len){
-  for(int index=0;index<PARAM_SIZE(params);index++){
-    uint8_t param_len = strlen(params[index].name);
-    if (param_len < len){
-      if (memcmp(userCommand,params[index].name,param_len)==0){
-        return index;
-      }
+// Find parameter by name (binary search) or by numeric ID "#<index>" and return index
+// size returns the number of characters used
+int8_t findParam(uint8_t *userCommand, uint32_t len, uint8_t *size){
+  uint32_t tlen = tokenLen(userCommand, len);
+  *size = tlen;
+  if (tlen > 1 && *userCommand == '#'){
+    int32_t id = 0;
+    for (uint32_t i = 1; i < tlen; i++){
+      if ((unsigned)userCommand[i]-'0' >= 10) return -1;
+      id = 10*id + (userCommand[i]-'0');
+      if (id >= PARAM_SIZE(params)) return -1;
     }
+    return id;
+  }
+
+  if (!paramSortedInit) paramSortInit();
+  int lo = 0, hi = PARAM_SIZE(params) - 1;
+  while (lo <= hi){
+    int mid = (lo + hi) / 2;
+    int c = tokenCmp(userCommand, tlen, params[paramSorted[mid]].name);
+    if (c == 0) return paramSorted[mid];
+    if (c < 0) hi = mid - 1; else lo = mid + 1;
   }
   return -1; // Not found
 }
 
-// Parse and save the command to be executed
-void handle_input(uint8_t *userCommand, uint32_t len)
+// Parse the command line into cmd: semaphore is set for a valid command, error otherwise
+static void parse_input(uint8_t *userCommand, uint32_t len, debug_command *cmd)
 {
-
-  // If there is already an unprocessed command, exit
-  if (command.semaphore == 1) return;
-  if (*userCommand != '$') return; // reject if first character is not $ 
-  
   // Check end of line
   userCommand+=len-1; // Go to last char
   if (*userCommand != '\n' && *userCommand != '\r'){
-    command.error = 7; // Error - End of line expected
+    cmd->error = 7; // Error - End of line expected
     return;
   }
   userCommand-=len-1; // Come back
   userCommand++; // Skip $
+  len--;
+
+  // Optional response ID: "$@<id> "
+  if (*userCommand == '@'){
+    int32_t id = 0;
+    for (userCommand++,len--; (unsigned)*userCommand-'0'<10; userCommand++,len--){
+      id = 10*id+(*userCommand-'0');
+      if (id>MAX_int16_T){cmd->error = 4;return;}
+    }
+    cmd->id = id;
+    if (*userCommand == 0x20){len-=1;userCommand+=1;}
+  }
 
   int8_t  cindex = -1;
   int8_t  pindex = -1;
@@ -481,12 +1299,12 @@ void handle_input(uint8_t *userCommand, uint32_t len)
   cindex = findCommand(userCommand,len);
   if (cindex == -1){
     // Error - Command not found
-    command.error = 1;
+    cmd->error = 1;
     return;
   }
 
   // Skip command characters
-  size = strlen(commands[cindex].name);
+  size = tokenLen(userCommand,len);
   {len-=size;userCommand+=size;}
   // Skip if space
   if (*userCommand == 0x20){len-=1;userCommand+=1;}
@@ -494,45 +1312,44 @@ void handle_input(uint8_t *userCommand, uint32_t len)
   if (*userCommand == '\n' || *userCommand == '\r'){
     if (commands[cindex].callback_function0 != NULL){
       // Command without parameter
-      command.semaphore = 1;
-      command.command_index = cindex;
-      command.param_index   = -1;
-      command.param_value   = 0;
+      cmd->semaphore = 1;
+      cmd->command_index = cindex;
+      cmd->param_index   = -1;
+      cmd->param_value   = 0;
     }else{
-      command.error = 8; // Error - Parameter expected
+      cmd->error = 8; // Error - Parameter expected
     }
     return;
   }
 
   // Find parameter
-  pindex = findParam(userCommand,len);
+  pindex = findParam(userCommand,len,&size);
   if (pindex == -1){
     // Error - Parameter not found
-    command.error = 2;
+    cmd->error = 2;
     return;
   }
 
   // Skip parameter characters
-  size = strlen(params[pindex].name);
   {len-=size;userCommand+=size;}
   // Skip if space
   if (*userCommand == 0x20){len-=1;userCommand+=1;}
    
   if (commands[cindex].type == WRITE && params[pindex].type == VARIABLE){
     // Error - This command cannot be used with a Variable
-    command.error = 3;
+    cmd->error = 3;
     return;
   }
   
   if (commands[cindex].callback_function1 != NULL){
     if (*userCommand == '\n' || *userCommand == '\r'){
       // Command with parameter
-      command.semaphore = 1;
-      command.command_index = cindex;
-      command.param_index   = pindex;
-      command.param_value   = 0;
+      cmd->semaphore = 1;
+      cmd->command_index = cindex;
+      cmd->param_index   = pindex;
+      cmd->param_value   = 0;
     }else{
-      command.error = 7; // Error - End of line expected
+      cmd->error = 7; // Error - End of line expected
     }
     return;
   }
@@ -548,12 +1365,12 @@ void handle_input(uint8_t *userCommand, uint32_t len)
     value = 10*value+(*userCommand-'0');
     count++;
     // Error - Value out of range
-    if (value>MAX_int16_T){command.error = 4;return;}
+    if (value>MAX_int16_T){cmd->error = 4;return;}
   }
 
   if (count == 0){
     // Error - Value required
-    command.error = 5;
+    cmd->error = 5;
     return;
   }
       
@@ -563,62 +1380,186 @@ void handle_input(uint8_t *userCommand, uint32_t len)
   // Command with parameter and value
   if (commands[cindex].callback_function2 != NULL){
     if (*userCommand == '\n' || *userCommand == '\r'){
-      command.semaphore = 1;
-      command.command_index = cindex;
-      command.param_index   = pindex;
-      command.param_value   = value;
+      cmd->semaphore = 1;
+      cmd->command_index = cindex;
+      cmd->param_index   = pindex;
+      cmd->param_value   = value;
     }else{
-      command.error = 7; // Error - End of line expected
+      cmd->error = 7; // Error - End of line expected
     }
     return;
   }
 
   // Uncaught error
-  command.error = 9;
+  cmd->error = 9;
 
 }
 
-void process_debug()
+// Parse a received line and queue it for process_commands. Called from PendSV (single producer)
+void handle_input(uint8_t *userCommand, uint32_t len)
 {
-  
-  // Print parameters from watch list
-  printParamVal();
+  if (len == 0) return;
+  if (ringFull(&cmdRing, DEBUG_CMD_QUEUE_SIZE)){
+    cmdQueueDrop++;                                 // Queue full
+    return;
+  }
+  debug_command *cmd = &cmdQueue[ringIn(&cmdRing, DEBUG_CMD_QUEUE_SIZE)];  // parsed in place
+  cmd->semaphore = 0;
+  cmd->error     = 0;
+  cmd->id        = -1;
+  if (*userCommand != '$') return;                  // reject if first character is not $
+  parse_input(userCommand, len, cmd);
+  if (cmd->semaphore || cmd->error){
+    ringPush(&cmdRing, 1);
+  }
+}
 
-  // Show Error if any
-  if(command.error> 0){
-    printError(command.error);
-    command.error = 0;
+// Collect one byte of a binary request, queue the request when it is complete and valid
+static void handle_bin_byte(uint8_t c)
+{
+  binFrame[binFrameLen++] = c;
+  if (binFrameLen == 2 && c != (uint8_t)(DEBUG_BIN_START_FRAME >> 8)){
+    binFrameLen = 0;                                // Not a start frame, drop
     return;
   }
+  if (binFrameLen == 4){
+    uint8_t n = binFrame[3];
+    if (n == 0 || n > DEBUG_BIN_MAX_ITEMS || (binFrame[2] != BIN_OP_GET && binFrame[2] != BIN_OP_SET)){
+      binReqDrop++;
+      binFrameLen = 0;
+      return;
+    }
+    binFrameSize = 4 + n * (binFrame[2] == BIN_OP_SET ? 5 : 1) + 4;
+  }
+  if (binFrameLen < 4 || binFrameLen < binFrameSize) return;
 
-  // Nothing to do
-  if (command.semaphore == 0) return;
+  uint32_t crc = calc_crc32(binFrame, binFrameSize - 4);
+  if (memcmp(&binFrame[binFrameSize - 4], &crc, 4) == 0 && !ringFull(&binRing, 2)){
+    memcpy(binQueue[ringIn(&binRing, 2)], binFrame, binFrameSize);
+    ringPush(&binRing, 1);
+  }else{
+    binReqDrop++;
+  }
+  binFrameLen = 0;
+}
 
-  int8_t ret = 0;
-  if (commands[command.command_index].callback_function0 != NULL && 
-      command.param_index == -1){
-    // This function needs no parameter
-    ret = (*commands[command.command_index].callback_function0)();
-    if (ret==1){printf("OK\r\n");}
-    command.semaphore = 0;
-    return;
+// Split received data into lines for handle_input. Lines may be split over several chunks
+// and one chunk may contain several lines. Binary requests start with DEBUG_BIN_START_FRAME between lines
+void handle_input_chunk(const uint8_t *data, uint32_t len)
+{
+  for (uint32_t i = 0; i < len; i++){
+    if (binFrameLen > 0 || (cmdLineLen == 0 && data[i] == (uint8_t)DEBUG_BIN_START_FRAME)){
+      handle_bin_byte(data[i]);
+      continue;
+    }
+    if (cmdLineLen < DEBUG_CMD_LINE_MAX) cmdLine[cmdLineLen++] = data[i];
+    if (data[i] == '\n' || data[i] == '\r'){
+      if (cmdLineLen < DEBUG_CMD_LINE_MAX || cmdLine[cmdLineLen-1] == data[i]) handle_input(cmdLine, cmdLineLen);
+      cmdLineLen = 0;
+    }
   }
+}
 
-  if (commands[command.command_index].callback_function1 != NULL &&
-      command.param_index != -1){
-    // This function needs only a parameter
-    ret = (*commands[command.command_index].callback_function1)(command.param_index);
-    if (ret==1){printf("OK\r\n");}
-    command.semaphore = 0;
-    return;
-  }  
-
-  if (commands[command.command_index].callback_function2 != NULL && 
-      command.param_index != -1){
-    // This function needs an additional parameter
-    ret = (*commands[command.command_index].callback_function2)(command.param_index,command.param_value);
-    if (ret==1){printf("OK\r\n");}
-    command.semaphore = 0;
+/*
+ * Binary parameter protocol, all fields little-endian, parameters addressed by their index in params[] (id printed by GET):
+ *   request:  uint16 start DEBUG_BIN_START_FRAME, uint8 op, uint8 n, payload, uint32 checksum
+ *     BIN_OP_GET  payload n x (uint8 index)
+ *     BIN_OP_SET  payload n x (uint8 index, int32 value)
+ *   response: uint16 start DEBUG_BIN_START_FRAME, uint8 op | BIN_OP_REPLY, uint8 n, payload, uint32 checksum
+ *     BIN_OP_GET  payload n x (int32 value)
+ *     BIN_OP_SET  payload n x (uint8 result: 1 = written, 0 = rejected: variable or out of range)
+ *   A GET with an unknown index is answered with op | BIN_OP_REPLY | BIN_OP_ERROR and n = 0.
+ * Values are internal (not scaled by mul/div). Checksum is CRC32 (same as the serial feedback) over all previous bytes.
+ * Requests with a bad checksum are dropped and counted in BIN_DROP.
+ */
+static void process_bin_request(const uint8_t *req)
+{
+  uint8_t  frame[4 + 4 * DEBUG_BIN_MAX_ITEMS + 4];
+  uint8_t  op = req[2];
+  uint8_t  n  = req[3];
+  uint8_t  len = 4;
+  uint8_t  i;
+  int32_t  value;
+  uint32_t crc;
+
+  frame[0] = (uint8_t)DEBUG_BIN_START_FRAME;
+  frame[1] = (uint8_t)(DEBUG_BIN_START_FRAME >> 8);
+  frame[2] = op | BIN_OP_REPLY;
+  frame[3] = n;
+  if (op == BIN_OP_GET){
+    for (i = 0; i < n; i++){
+      if (req[4 + i] >= PARAM_SIZE(params)){
+        frame[2] |= BIN_OP_ERROR;
+        frame[3] = 0;
+        len = 4;
+        break;
+      }
+      value = getParamValInt(req[4 + i]);
+      memcpy(&frame[len], &value, 4);
+      len += 4;
+    }
+  }else{
+    for (i = 0; i < n; i++){
+      const uint8_t *item = &req[4 + 5 * i];
+      uint8_t ok = 0;
+      memcpy(&value, &item[1], 4);
+      if (item[0] < PARAM_SIZE(params) && params[item[0]].type == PARAMETER &&
+          IN_RANGE(intToExt(item[0], value), params[item[0]].min, params[item[0]].max)){
+        ok = setParamValInt(item[0], value);
+      }
+      frame[len++] = ok;
+    }
+  }
+  crc = calc_crc32(frame, len);
+  memcpy(&frame[len], &crc, 4);
+  len += 4;
+  debugTxWrite(frame, len);
+}
+
+// Execute the queued binary requests, answered as soon as there is room for the response
+void process_bin_commands()
+{
+  while (!ringEmpty(&binRing) && debugTxFree() >= (int)(4 + 4 * DEBUG_BIN_MAX_ITEMS + 4)){
+    process_bin_request(binQueue[ringOut(&binRing, 2)]);
+    ringPop(&binRing, 1);                           // Request processed before the slot is released to the producer
+  }
+}
+
+void process_debug()
+{
+  // Print parameters from watch list
+  printParamVal();
+}
+
+// Execute the queued commands. Stops while the debug TX queue is less than half free, so the replies are not dropped
+void process_commands()
+{
+  while (!ringEmpty(&cmdRing) && debugTxFree() >= DEBUG_TX_BUFFER_SIZE / 2){
+    const debug_command *cmd = &cmdQueue[ringOut(&cmdRing, DEBUG_CMD_QUEUE_SIZE)];  // executed in place
+    cmdId = cmd->id;
+
+    // Show Error if any
+    if(cmd->error> 0){
+      printError(cmd->error);
+    }else{
+      int8_t ret = 0;
+      if (commands[cmd->command_index].callback_function0 != NULL && 
+          cmd->param_index == -1){
+        // This function needs no parameter
+        ret = (*commands[cmd->command_index].callback_function0)();
+      }else if (commands[cmd->command_index].callback_function1 != NULL &&
+          cmd->param_index != -1){
+        // This function needs only a parameter
+        ret = (*commands[cmd->command_index].callback_function1)(cmd->param_index);
+      }else if (commands[cmd->command_index].callback_function2 != NULL && 
+          cmd->param_index != -1){
+        // This function needs an additional parameter
+        ret = (*commands[cmd->command_index].callback_function2)(cmd->param_index,cmd->param_value);
+      }
+      if (ret==1){printf("OK");printReplyEnd();}
+    }
+    ringPop(&cmdRing, 1);
+    cmdId = -1;
   }
 }
 
@@ -4,6 +4,7 @@
 #include "stm32f1xx_hal.h"
 #include "defines.h"
 #include "setup.h"
+#include "timebase.h"
 #include "config.h"
 
 #define NUNCHUK_I2C_ADDRESS 0xA4
@@ -22,18 +23,23 @@ nunchuk_state nunchukState = NUNCHUK_CONNECTING;
 #if defined(CONTROL_PPM_LEFT) || defined(CONTROL_PPM_RIGHT)
 uint16_t ppm_captured_value[PPM_NUM_CHANNELS + 1] = {500, 500};
 uint16_t ppm_captured_value_buffer[PPM_NUM_CHANNELS+1] = {500, 500};
-uint32_t ppm_timeout = 0;
+uint32_t ppm_time = 0;                  // [us] timeUs() of the last valid frame
 
 bool ppm_valid = true;
 
-void PPM_ISR_Callback(void) {
-  // Dummy loop with 16 bit count wrap around
-  uint16_t rc_delay = TIM2->CNT;
-  TIM2->CNT = 0;
+#if defined(PPM_DMA)
+#define PPM_DMA_BUF_SIZE 32             // captured falling edges, power of 2. A frame has PPM_NUM_CHANNELS + 1 edges
+static uint16_t ppm_dma_buf[PPM_DMA_BUF_SIZE];
+static uint16_t ppm_dma_rd;             // next capture to decode
+static uint16_t ppm_edge_prev;          // capture of the previous edge
+DMA_HandleTypeDef hdma_tim2_ch4;
+#endif
 
+// Time between two falling edges in us: a sync gap ends the frame, the others are the channels
+static void PPM_Edge(uint16_t rc_delay) {
   if (rc_delay > 3000) {
     if (ppm_valid && ppm_count == PPM_NUM_CHANNELS) {
-      ppm_timeout = 0;
+      ppm_time = timeUs();
       timeoutCntGen = 0;
       timeoutFlgGen = 0;
       memcpy(ppm_captured_value, ppm_captured_value_buffer, sizeof(ppm_captured_value));
@@ -48,16 +54,36 @@ void PPM_ISR_Callback(void) {
   }
 }
 
-// SysTick executes once each ms
-void PPM_SysTick_Callback(void) {
-  ppm_timeout++;
-  // Stop after 500 ms without PPM signal
-  if(ppm_timeout > 500) {
+void PPM_ISR_Callback(void) {
+  // Dummy loop with 16 bit count wrap around
+  uint16_t rc_delay = TIM2->CNT;
+  TIM2->CNT = 0;
+  PPM_Edge(rc_delay);
+}
+
+#if defined(PPM_DMA)
+// Main loop: decode the edges captured by TIM2 CH4 since the last call. The free running
+// 16 bit counter wraps like the EXTI version, the difference of two captures is the pulse time
+void PPM_Decode(void) {
+  uint16_t wr = (PPM_DMA_BUF_SIZE - __HAL_DMA_GET_COUNTER(&hdma_tim2_ch4)) & (PPM_DMA_BUF_SIZE - 1);
+  while (ppm_dma_rd != wr) {
+    uint16_t edge = ppm_dma_buf[ppm_dma_rd];
+    PPM_Edge(edge - ppm_edge_prev);
+    ppm_edge_prev = edge;
+    ppm_dma_rd    = (ppm_dma_rd + 1) & (PPM_DMA_BUF_SIZE - 1);
+  }
+}
+#endif
+
+// Main loop: stop after 500 ms without PPM signal
+void PPM_Timeout(void) {
+  uint32_t last = ppm_time;
+  if (timeUs() - last > 500000) {
     int i;
     for(i = 0; i < PPM_NUM_CHANNELS; i++) {
       ppm_captured_value[i] = 500;
     }
-    ppm_timeout = 0;
+    ppm_time = last + 500000;
   }
 }
 
@@ -65,7 +91,11 @@ void PPM_Init(void) {
   GPIO_InitTypeDef GPIO_InitStruct = {0};
   /*Configure GPIO pin : PA3 */
   GPIO_InitStruct.Pin = PPM_PIN;
+  #if defined(PPM_DMA)
+  GPIO_InitStruct.Mode = GPIO_MODE_AF_INPUT;      // TIM2 CH4 input capture
+  #else
   GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
+  #endif
   GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
   GPIO_InitStruct.Pull = GPIO_PULLDOWN;
   HAL_GPIO_Init(PPM_PORT, &GPIO_InitStruct);
@@ -78,19 +108,46 @@ void PPM_Init(void) {
   TimHandle.Init.CounterMode = TIM_COUNTERMODE_UP;
   HAL_TIM_Base_Init(&TimHandle);
 
+  #if defined(PPM_DMA)
+  #if defined(CONTROL_PPM_RIGHT)
+  __HAL_AFIO_REMAP_TIM2_PARTIAL_2();              // TIM2 CH4 on PB11, CH1 and CH2 stay on PA0 and PA1
+  #endif
+  TIM_IC_InitTypeDef sConfigIC = {0};
+  HAL_TIM_IC_Init(&TimHandle);
+  sConfigIC.ICPolarity  = TIM_ICPOLARITY_FALLING;
+  sConfigIC.ICSelection = TIM_ICSELECTION_DIRECTTI;
+  sConfigIC.ICPrescaler = TIM_ICPSC_DIV1;
+  sConfigIC.ICFilter    = 3;                      // 8 samples at 72 MHz, rejects glitches shorter than 111 ns
+  HAL_TIM_IC_ConfigChannel(&TimHandle, &sConfigIC, TIM_CHANNEL_4);
+
+  __HAL_RCC_DMA1_CLK_ENABLE();
+  hdma_tim2_ch4.Instance                 = DMA1_Channel7;
+  hdma_tim2_ch4.Init.Direction           = DMA_PERIPH_TO_MEMORY;
+  hdma_tim2_ch4.Init.PeriphInc           = DMA_PINC_DISABLE;
+  hdma_tim2_ch4.Init.MemInc              = DMA_MINC_ENABLE;
+  hdma_tim2_ch4.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+  hdma_tim2_ch4.Init.MemDataAlignment    = DMA_MDATAALIGN_HALFWORD;
+  hdma_tim2_ch4.Init.Mode                = DMA_CIRCULAR;
+  hdma_tim2_ch4.Init.Priority            = DMA_PRIORITY_LOW;
+  HAL_DMA_Init(&hdma_tim2_ch4);
+  HAL_DMA_Start(&hdma_tim2_ch4, (uint32_t)&TIM2->CCR4, (uint32_t)ppm_dma_buf, PPM_DMA_BUF_SIZE);  // no DMA interrupts
+  __HAL_TIM_ENABLE_DMA(&TimHandle, TIM_DMA_CC4);
+  HAL_TIM_IC_Start(&TimHandle, TIM_CHANNEL_4);
+  #else
   #if defined(CONTROL_PPM_LEFT)  
   /* EXTI interrupt init*/
-  HAL_NVIC_SetPriority(EXTI3_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(EXTI3_IRQn, IRQ_PRIO_INPUT, 0);
   HAL_NVIC_EnableIRQ(EXTI3_IRQn);
   #endif
 
   #if defined(CONTROL_PPM_RIGHT)  
   /* EXTI interrupt init*/
-  HAL_NVIC_SetPriority(EXTI15_10_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(EXTI15_10_IRQn, IRQ_PRIO_INPUT, 0);
   HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
   #endif
 
   HAL_TIM_Base_Start(&TimHandle);
+  #endif
 }
 #endif
 
@@ -108,8 +165,8 @@ uint16_t pwm_captured_ch1_value = 500;
 uint16_t pwm_captured_ch2_value = 500;
 uint16_t pwm_CNT_prev_ch1 = 0;
 uint16_t pwm_CNT_prev_ch2 = 0;
-uint32_t pwm_timeout_ch1 = 0;
-uint32_t pwm_timeout_ch2 = 0;
+uint32_t pwm_time_ch1 = 0;              // [us] timeUs() of the last valid pulse
+uint32_t pwm_time_ch2 = 0;
 
 void PWM_ISR_CH1_Callback(void) {
   // Dummy loop with 16 bit count wrap around
@@ -125,7 +182,7 @@ void PWM_ISR_CH1_Callback(void) {
     if (IN_RANGE(rc_signal, 900, 2100)){
       timeoutCntGen = 0;
       timeoutFlgGen = 0;
-      pwm_timeout_ch1 = 0;
+      pwm_time_ch1 = timeUs();
       pwm_captured_ch1_value = CLAMP(rc_signal, 1000, 2000) - 1000;
     }
   }
@@ -145,28 +202,90 @@ void PWM_ISR_CH2_Callback(void) {
     if (IN_RANGE(rc_signal, 900, 2100)){
       timeoutCntGen = 0;
       timeoutFlgGen = 0;
-      pwm_timeout_ch2 = 0;
+      pwm_time_ch2 = timeUs();
       pwm_captured_ch2_value = CLAMP(rc_signal, 1000, 2000) - 1000;
     }
   }
 }
 
-// SysTick executes once each ms
-void PWM_SysTick_Callback(void) {
-  pwm_timeout_ch1++;
-  pwm_timeout_ch2++;
-  // Stop after 500 ms without PWM signal
-  if(pwm_timeout_ch1 > 500) {
+#if defined(PWM_CAPTURE)
+ /*
+  * Hardware capture of both edges of one RC channel: IC3 latches the rising and IC4 the falling edge,
+  * one of them mapped on the other's input (TI3 on TIM2 for PA2, TI4 on TIM5 for PA3).
+  * The timer slave reset of the PWM input mode is only available for CH1/CH2, which are not on the sensor cables.
+  * A new falling edge (CC4IF, cleared by reading CCR4) gives the pulse width of the last pulse.
+  */
+static void PWM_Capture(TIM_TypeDef *tim, uint16_t *value, uint32_t *time) {
+  if (tim->SR & TIM_SR_CC4IF) {
+    uint16_t rise = tim->CCR3;
+    uint16_t fall = tim->CCR4;
+    uint16_t rc_signal = fall - rise;         // 16 bit count wrap around
+    if (IN_RANGE(rc_signal, 900, 2100)){
+      timeoutCntGen = 0;
+      timeoutFlgGen = 0;
+      *time = timeUs();
+      *value = CLAMP(rc_signal, 1000, 2000) - 1000;
+    }
+  }
+}
+
+// Main loop: read the pulse widths latched by TIM2 (channel 1) and TIM5 (channel 2)
+void PWM_Read(void) {
+  PWM_Capture(TIM2, &pwm_captured_ch1_value, &pwm_time_ch1);
+  PWM_Capture(TIM5, &pwm_captured_ch2_value, &pwm_time_ch2);
+}
+
+static void PWM_Capture_Init(TIM_HandleTypeDef *htim, TIM_TypeDef *tim, uint32_t icRise, uint32_t icFall) {
+  TIM_IC_InitTypeDef sConfigIC = {0};
+  htim->Instance            = tim;
+  htim->Init.Period         = UINT16_MAX;
+  htim->Init.Prescaler      = (SystemCoreClock/DELAY_TIM_FREQUENCY_US)-1;
+  htim->Init.ClockDivision  = 0;
+  htim->Init.CounterMode    = TIM_COUNTERMODE_UP;
+  HAL_TIM_IC_Init(htim);
+
+  sConfigIC.ICPrescaler     = TIM_ICPSC_DIV1;
+  sConfigIC.ICFilter        = 3;                // 8 samples at 72 MHz, rejects glitches shorter than 111 ns
+  sConfigIC.ICPolarity      = TIM_ICPOLARITY_RISING;
+  sConfigIC.ICSelection     = icRise;
+  HAL_TIM_IC_ConfigChannel(htim, &sConfigIC, TIM_CHANNEL_3);
+  sConfigIC.ICPolarity      = TIM_ICPOLARITY_FALLING;
+  sConfigIC.ICSelection     = icFall;
+  HAL_TIM_IC_ConfigChannel(htim, &sConfigIC, TIM_CHANNEL_4);
+
+  HAL_TIM_IC_Start(htim, TIM_CHANNEL_3);
+  HAL_TIM_IC_Start(htim, TIM_CHANNEL_4);
+}
+#endif
+
+// Main loop: stop after 500 ms without PWM signal
+void PWM_Timeout(void) {
+  uint32_t last1 = pwm_time_ch1, last2 = pwm_time_ch2;  // before now, a pulse in between must not look 71 min old
+  uint32_t now = timeUs();
+  if(now - last1 > 500000) {
     pwm_captured_ch1_value = 500;
-    pwm_timeout_ch1 = 0;
+    pwm_time_ch1 = last1 + 500000;
   }
-  if(pwm_timeout_ch2 > 500) {
+  if(now - last2 > 500000) {
     pwm_captured_ch2_value = 500;
-    pwm_timeout_ch2 = 0;
+    pwm_time_ch2 = last2 + 500000;
   }
 }
 
 void PWM_Init(void) {
+  #if defined(PWM_CAPTURE)
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+  GPIO_InitStruct.Pin           = PWM_PIN_CH1 | PWM_PIN_CH2;   // PA2 and PA3, input capture
+  GPIO_InitStruct.Mode          = GPIO_MODE_AF_INPUT;
+  GPIO_InitStruct.Pull          = GPIO_PULLDOWN;
+  GPIO_InitStruct.Speed         = GPIO_SPEED_FREQ_HIGH;
+  HAL_GPIO_Init(PWM_PORT_CH1, &GPIO_InitStruct);
+
+  __HAL_RCC_TIM2_CLK_ENABLE();
+  __HAL_RCC_TIM5_CLK_ENABLE();
+  PWM_Capture_Init(&TimHandle,  TIM2, TIM_ICSELECTION_DIRECTTI,   TIM_ICSELECTION_INDIRECTTI);  // channel 1 on TI3: PA2
+  PWM_Capture_Init(&TimHandle2, TIM5, TIM_ICSELECTION_INDIRECTTI, TIM_ICSELECTION_DIRECTTI);    // channel 2 on TI4: PA3
+  #else
   // PWM Timer (TIM2)
   __HAL_RCC_TIM2_CLK_ENABLE();
   TimHandle.Instance            = TIM2;
@@ -196,20 +315,21 @@ void PWM_Init(void) {
 
   #ifdef CONTROL_PWM_LEFT
   /* EXTI interrupt init*/
-  HAL_NVIC_SetPriority(EXTI2_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(EXTI2_IRQn, IRQ_PRIO_INPUT, 0);
   HAL_NVIC_EnableIRQ(EXTI2_IRQn);
-  HAL_NVIC_SetPriority(EXTI3_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(EXTI3_IRQn, IRQ_PRIO_INPUT, 0);
   HAL_NVIC_EnableIRQ(EXTI3_IRQn);
   #endif
 
   #ifdef CONTROL_PWM_RIGHT
   /* EXTI interrupt init*/
-  HAL_NVIC_SetPriority(EXTI15_10_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(EXTI15_10_IRQn, IRQ_PRIO_INPUT, 0);
   HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
   #endif
 
   // Start timer
   HAL_TIM_Base_Start(&TimHandle);
+  #endif
 }
 #endif
 
@@ -261,6 +381,187 @@ uint8_t Nunchuk_Connect() {
   }
 }
 
+#if defined(NUNCHUK_ASYNC)
+/* Interrupt driven Nunchuk polling. SysTick starts each transfer once its delay has
+ * elapsed, the I2C callbacks advance the steps and Nunchuk_Read only takes the last
+ * checked sample, so the main loop never waits on the bus.
+ */
+#define NUNCHUK_CONV_MS   3             // conversion time between the read address and the data read
+#define NUNCHUK_INIT_MS   10            // settle time after each init write
+#define NUNCHUK_RETRY_MS  500           // wait before reconnecting a Nunchuk that failed again
+#define NUNCHUK_XFER_MS   5             // a transfer taking longer than this is a hung bus
+
+enum {
+  NUNCHUK_I2C_IDLE,                     // bus off, SysTick keeps away
+  NUNCHUK_I2C_INIT1,                    // write 0xF0 0x55
+  NUNCHUK_I2C_INIT2,                    // write 0xFB 0x00
+  NUNCHUK_I2C_ADDR,                     // write the read address 0x00
+  NUNCHUK_I2C_DATA                      // read the 6 data bytes
+};
+
+static volatile uint8_t  nunchuk_step = NUNCHUK_I2C_IDLE;
+static volatile uint8_t  nunchuk_busy;  // transfer in flight
+static volatile uint8_t  nunchuk_err;   // NACK, bus error, hung transfer or bad checksum
+static volatile uint8_t  nunchuk_new;   // nunchuk_sample holds a sample not yet taken
+static volatile uint16_t nunchuk_wait;  // ms before the next transfer
+static volatile uint16_t nunchuk_xfer_ms;
+static uint8_t nunchuk_rx_buf[6];
+static uint8_t nunchuk_sample[6];
+
+static void Nunchuk_Start(void) {
+  HAL_StatusTypeDef status;
+
+  nunchuk_busy    = 1;
+  nunchuk_xfer_ms = 0;
+  switch (nunchuk_step) {
+    case NUNCHUK_I2C_INIT1:
+      i2cBuffer[0] = 0xF0;
+      i2cBuffer[1] = 0x55;
+      status = HAL_I2C_Master_Transmit_IT(&hi2c2, NUNCHUK_I2C_ADDRESS, i2cBuffer, 2);
+      break;
+    case NUNCHUK_I2C_INIT2:
+      i2cBuffer[0] = 0xFB;
+      i2cBuffer[1] = 0x00;
+      status = HAL_I2C_Master_Transmit_IT(&hi2c2, NUNCHUK_I2C_ADDRESS, i2cBuffer, 2);
+      break;
+    case NUNCHUK_I2C_ADDR:
+      i2cBuffer[0] = 0x00;
+      status = HAL_I2C_Master_Transmit_IT(&hi2c2, NUNCHUK_I2C_ADDRESS, i2cBuffer, 1);
+      break;
+    default:
+      status = HAL_I2C_Master_Receive_IT(&hi2c2, NUNCHUK_I2C_ADDRESS, nunchuk_rx_buf, 6);
+      break;
+  }
+  if (status != HAL_OK) {
+    nunchuk_busy = 0;
+    nunchuk_err  = 1;
+  }
+}
+
+void Nunchuk_SysTick_Callback(void) {
+  if (nunchuk_step == NUNCHUK_I2C_IDLE || nunchuk_err) {
+    return;
+  }
+  if (nunchuk_busy) {
+    if (++nunchuk_xfer_ms > NUNCHUK_XFER_MS) {
+      nunchuk_err = 1;
+    }
+    return;
+  }
+  if (nunchuk_wait) {
+    nunchuk_wait--;
+    return;
+  }
+  Nunchuk_Start();
+}
+
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c) {
+  nunchuk_busy = 0;
+  switch (nunchuk_step) {
+    case NUNCHUK_I2C_INIT1:
+      nunchuk_step = NUNCHUK_I2C_INIT2;
+      nunchuk_wait = NUNCHUK_INIT_MS;
+      break;
+    case NUNCHUK_I2C_INIT2:
+      nunchuk_step = NUNCHUK_I2C_ADDR;
+      nunchuk_wait = NUNCHUK_INIT_MS;
+      break;
+    case NUNCHUK_I2C_ADDR:
+      nunchuk_step = NUNCHUK_I2C_DATA;
+      nunchuk_wait = NUNCHUK_CONV_MS;
+      break;
+  }
+}
+
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c) {
+  uint16_t checksum = 0;
+  uint8_t i;
+
+  nunchuk_busy = 0;
+  /* All 0x00 or 0xFF is a Nunchuk in an error condition */
+  for (i = 0; i < 6; i++) {
+    checksum += nunchuk_rx_buf[i];
+  }
+  if (checksum == 0 || checksum == 0x5FA) {
+    nunchuk_err = 1;
+    return;
+  }
+  memcpy(nunchuk_sample, nunchuk_rx_buf, 6);
+  nunchuk_new  = 1;
+  nunchuk_step = NUNCHUK_I2C_ADDR;
+  nunchuk_wait = 0;
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+  nunchuk_busy = 0;
+  nunchuk_err  = 1;
+}
+
+/* Recover and re-initialise the bus, then redo the handshake after delay ms */
+static void Nunchuk_Restart(uint16_t delay) {
+  nunchuk_step = NUNCHUK_I2C_IDLE;
+  I2C_Bus_Recover();
+  I2C_Init();
+  nunchuk_busy = 0;
+  nunchuk_new  = 0;
+  nunchuk_wait = delay;
+  nunchuk_err  = 0;
+  nunchuk_step = NUNCHUK_I2C_INIT1;
+}
+
+nunchuk_state Nunchuk_Read(void) {
+  uint8_t success = false;
+
+  if (nunchuk_step == NUNCHUK_I2C_IDLE) {
+    Nunchuk_Restart(0);
+  }
+
+  switch(nunchukState) {
+    case NUNCHUK_DISCONNECTED:
+    case NUNCHUK_CONNECTING:
+    case NUNCHUK_RECONNECTING:
+      if (nunchuk_err) {
+        /* Failed again, fall back to disconnected and retry later */
+        nunchukState = NUNCHUK_DISCONNECTED;
+        Nunchuk_Restart(NUNCHUK_RETRY_MS);
+      } else if (nunchuk_step >= NUNCHUK_I2C_ADDR) {
+        nunchukState = NUNCHUK_CONNECTED;
+        success = true;
+      }
+      break;
+
+    case NUNCHUK_CONNECTED:
+      if (nunchuk_new && !nunchuk_err) {
+        __disable_irq();
+        memcpy(nunchuk_data, nunchuk_sample, 6);
+        nunchuk_new = 0;
+        __enable_irq();
+        success = true;
+      }
+
+      /* Comms failure or timeout counter reached timeout limit */
+      if (nunchuk_err || (!success && timeoutCntGen > 3)) {
+        /* Brings motors to safe stop */
+        /* Expected values from nunchuk for stopped (mid) position */
+        memset(nunchuk_data, 0, 6);
+        nunchuk_data[0] = 127;
+        nunchuk_data[1] = 128;
+        timeoutFlgGen = 1;
+        nunchukState = NUNCHUK_RECONNECTING;
+        Nunchuk_Restart(0);
+        success = false;
+      }
+      break;
+  }
+  /* Reset the timeout flag and counter if successful communication */
+  if(success == true) {
+    timeoutCntGen = 0;
+    timeoutFlgGen = 0;
+  }
+  return nunchukState;
+}
+
+#else
 nunchuk_state Nunchuk_Read(void) {
   static uint8_t delay_counter = 0;
   uint16_t checksum = 0;
@@ -339,3 +640,4 @@ nunchuk_state Nunchuk_Read(void) {
   //setScopeChannel(2, (int)nunchuk_data[5] & 1);
   //setScopeChannel(3, ((int)nunchuk_data[5] >> 1) & 1);
 }
+#endif
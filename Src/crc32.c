@@ -47,6 +47,7 @@ __FBSDID("$FreeBSD: head/sys/libkern/crc32.c 233517 2012-03-26 18:22:04Z marius
 
 #include <sys/param.h>
 #include <stdint.h>
+#include "config.h"
 
 const uint32_t crc32_tab[] = {
 	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
@@ -134,6 +135,7 @@ const uint32_t crc32_tab[] = {
 /*                                                               */
 /*****************************************************************/
 
+#if CRC32_TABLES == 1
 static const uint32_t crc32Table[256] = {
 	0x00000000L, 0xF26B8303L, 0xE13B70F7L, 0x1350F3F4L,
 	0xC79A971FL, 0x35F1141CL, 0x26A1E7E8L, 0xD4CA64EBL,
@@ -200,6 +202,11 @@ static const uint32_t crc32Table[256] = {
 	0x79B737BAL, 0x8BDCB4B9L, 0x988C474DL, 0x6AE7C44EL,
 	0xBE2DA0A5L, 0x4C4623A6L, 0x5F16D052L, 0xAD7D5351L
 };
+#define CRC32_TAB1	crc32Table
+#else
+static const uint32_t sctp_crc_tableil8_o32[256];	/* same table, the first of the slicing-by-8 set below */
+#define CRC32_TAB1	sctp_crc_tableil8_o32
+#endif
 
 static uint32_t
 singletable_crc32c(uint32_t crc, const void *buf, size_t size)
@@ -208,12 +215,13 @@ singletable_crc32c(uint32_t crc, const void *buf, size_t size)
 
 
 	while (size--)
-		crc = crc32Table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		crc = CRC32_TAB1[(crc ^ *p++) & 0xff] ^ (crc >> 8);
 
 	return crc;
 }
 
 
+#if CRC32_TABLES != 1
 /*
  * Copyright (c) 2004-2006 Intel Corporation - All Rights Reserved
  *
@@ -744,19 +752,61 @@ multitable_crc32c(uint32_t crc32c,
 	return (crc32c_sb8_64_bit(crc32c, buffer, length, to_even_word));
 }
 
+#endif
+
 uint32_t
 calculate_crc32c(uint32_t crc32c,
     const unsigned char *buffer,
     unsigned int length)
 {
+#if CRC32_TABLES == 1
+	return (singletable_crc32c(crc32c, buffer, length));
+#else
 	if (length < 4) {
 		return (singletable_crc32c(crc32c, buffer, length));
 	} else {
 		return (multitable_crc32c(crc32c, buffer, length));
 	}
+#endif
 }
 
 uint32_t calc_crc32(const unsigned char *buffer,
     unsigned int length){
 		return calculate_crc32c(1,buffer,length);
 }
+
+#if defined(SERIAL_HW_CRC)
+#include "stm32f1xx_hal.h"
+
+/*
+ * STM32 CRC unit: CRC-32/MPEG-2 fed one 32-bit word per write.
+ * Bytes are packed little-endian into words, the last word is zero padded.
+ * The unit is shared by PendSV (frame processing) and the main loop, so interrupts are
+ * masked for the few cycles it is in use.
+ */
+uint32_t calc_crc32_hw(const unsigned char *buffer,
+    unsigned int length){
+	uint32_t primask = __get_PRIMASK();
+	uint32_t word;
+	uint32_t crc;
+
+	__disable_irq();
+	CRC->CR = CRC_CR_RESET;
+	while (length >= 4) {
+		CRC->DR = (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) |
+		    ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+		buffer += 4;
+		length -= 4;
+	}
+	if (length) {
+		word = 0;
+		while (length--) {
+			word |= (uint32_t)buffer[length] << (8 * length);
+		}
+		CRC->DR = word;
+	}
+	crc = CRC->DR;
+	__set_PRIMASK(primask);
+	return crc;
+}
+#endif
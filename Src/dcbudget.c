@@ -0,0 +1,87 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Shared DC link budget (DC_BUDGET). Only uses config.h, so it also builds on the host.
+//
+// I_DC_MAX and I_MOT_MAX hold per motor, the battery sees the sum. DC_BUDGET_I (and DC_BUDGET_P at the present battery
+// voltage) is the limit of that sum, split between the motors every control tick:
+// - demand: the battery current of each motor (discharge only, braking is left to REGEN_LIMIT), low pass filtered
+// - share: a motor gets what the other one does not draw, and at least half of the budget. Both pulling hard get half
+//   each, a light wheel leaves the rest to the loaded one. The share is capped below I_DC_MAX, the stage2 chopping stays
+//   the last resort
+// - limit: the battery current of a motor is about |iq| times its modulation, so the phase current that draws the
+//   share is |iq| share / I_DC, both filtered. It clamps i_max of the next controller step like CURRENT_DERATING.
+//   At low speed the modulation is low and the limit high: full torque from standstill without loading the battery
+// Below an eighth of its share the ratio is too noisy and a motor is not limited, it is far from the budget anyway.
+
+#include <stdint.h>
+#include "config.h"
+#include "dcbudget.h"
+#include "ramfunc.h"
+
+#if defined(DC_BUDGET)
+
+#define DC_BUDGET_CAP       ((int32_t)I_DC_MAX * A2BIT_CONV * 16 / 10 * 9)   // [ADC bits, Q4] largest share, 90 % of I_DC_MAX
+
+void dcBudgetInit(DcBudget *b) {
+  for (uint8_t m = 0; m < 2; m++) {
+    b->iDc[m]   = 0;
+    b->iq[m]    = 0;
+    b->share[m] = 0;
+    b->iMax[m]  = INT16_MAX;
+  }
+  b->total = (int32_t)DC_BUDGET_I * A2BIT_CONV * 16;
+}
+
+/* Monitor task: the budget of both motors from DC_BUDGET_I and DC_BUDGET_P at the battery voltage vBat [V*100] */
+void dcBudgetTotal(DcBudget *b, int16_t vBat) {
+  int32_t i = (int32_t)DC_BUDGET_I * 100;                           // [A*100]
+  #if DC_BUDGET_P > 0
+  int32_t p = (int32_t)DC_BUDGET_P * 10000 / (vBat > 100 ? vBat : 100);
+  i = (p < i) ? p : i;
+  #else
+  (void)vBat;
+  #endif
+  b->total = i * A2BIT_CONV * 16 / 100;
+}
+
+/* Control interrupt, after both controller steps: DC link currents iDcL, iDcR [ADC bits, negative = discharge] and
+ * iqL, iqR [fixdt(1,16,4)] of this tick, the limits apply to the next one */
+RAMFUNC void dcBudgetStep(DcBudget *b, int16_t iDcL, int16_t iDcR, int16_t iqL, int16_t iqR) {
+  const int16_t iDc[2] = {iDcL, iDcR}, iq[2] = {iqL, iqR};
+  int32_t d[2];
+  for (uint8_t m = 0; m < 2; m++) {
+    int32_t dis = (iDc[m] < 0) ? -(int32_t)iDc[m] * 16 : 0;
+    b->iDc[m] += dis - (b->iDc[m] >> DC_BUDGET_FILT);
+    b->iq[m]  += ((iq[m] < 0) ? -iq[m] : iq[m]) - (b->iq[m] >> DC_BUDGET_FILT);
+    d[m]       = b->iDc[m] >> DC_BUDGET_FILT;
+  }
+  for (uint8_t m = 0; m < 2; m++) {
+    int32_t s   = b->total - d[!m];
+    int32_t lim = INT16_MAX;
+    s = (s > b->total / 2) ? s : b->total / 2;
+    s = (s < DC_BUDGET_CAP) ? s : DC_BUDGET_CAP;
+    if (d[m] > s / 8) {
+      lim = (b->iq[m] >> DC_BUDGET_FILT) * s / d[m];
+      lim = (lim < INT16_MAX) ? lim : INT16_MAX;
+    }
+    b->share[m] = s;
+    b->iMax[m]  = (int16_t)lim;
+  }
+}
+
+#endif
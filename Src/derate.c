@@ -0,0 +1,122 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Phase current derating (CURRENT_DERATING). Only uses config.h, so it also builds on the host.
+//
+// Three limits below the configured i_max, four with WINDING_TEMP, the lowest one wins:
+// - temperature: the board temperature DERATE_TEMP_AHEAD seconds ahead on its rising trend. The limit falls linearly
+//   from i_max at DERATE_TEMP_START to DERATE_MIN % of it at TEMP_POWEROFF, so the board slows down instead of
+//   switching off. Only with DERATE_TEMP_ENABLE, the sensor needs the temperature calibration.
+// - battery: the loaded battery voltage, falls from i_max at DERATE_BAT_START to DERATE_MIN % at DERATE_BAT_END.
+//   Less current means less sag, the limit settles where the cells stay above DERATE_BAT_END.
+// - I^2t: a first order thermal model, heat' = (i^2 / DERATE_I_CONT^2 - heat) / DERATE_I2T_TAU. Currents above
+//   DERATE_I_CONT are allowed until the heat gets near the steady state of DERATE_I_CONT, then the limit falls to it.
+// - winding: the hotter motor winding of WINDING_TEMP (wtemp.c), falls from i_max at WTEMP_START to DERATE_MIN % at
+//   WTEMP_MAX. Unlike the I^2t estimate it knows the ambient temperature and the heat left from an earlier ride.
+// The limit follows a falling target within a few tens of ms and recovers at DERATE_RISE A/s.
+
+#include <stdint.h>
+#include "config.h"
+#include "derate.h"
+
+#if defined(CURRENT_DERATING)
+
+#define DERATE_BITS(a)      ((int32_t)(a) * A2BIT_CONV << 4)      // [A] to fixdt(1,16,4) ADC bits
+#define DERATE_I_CONT_SQ    ((int32_t)DERATE_I_CONT * A2BIT_CONV * DERATE_I_CONT * A2BIT_CONV)  // [ADC bits^2]
+#define DERATE_HEAT_ONE     (1L << 24)                            // [Q24] steady state heat of DERATE_I_CONT
+#define DERATE_HEAT_START   (DERATE_HEAT_ONE / 10 * 8)            // [Q24] the I^2t limit starts to fall
+#define DERATE_HEAT_MAX     (DERATE_HEAT_ONE * 16)                // [Q24] saturation, 4 x DERATE_I_CONT forever
+#define DERATE_TREND_MS     1000                                  // [ms] temperature trend sample period
+#define DERATE_RISE_Q8      ((int32_t)DERATE_RISE * A2BIT_CONV * 16 * 256 / 1000)  // [fixdt(1,16,4), Q8 per ms]
+
+#define DERATE_HEAT_SAT(x)         ((x) < DERATE_HEAT_MAX ? (x) : DERATE_HEAT_MAX)
+
+/* Linear fall of the limit from 100 % at x = start to DERATE_MIN % at x = end, in % */
+static int32_t derateLin(int32_t x, int32_t start, int32_t end) {
+  int32_t f;
+  if ((end > start && x <= start) || (end < start && x >= start)) {
+    return 100;
+  }
+  f = 100 - (100 - DERATE_MIN) * (x - start) / (end - start);
+  return f < DERATE_MIN ? DERATE_MIN : f;
+}
+
+void derateInit(Derate *d, int16_t iMaxBase, int16_t temp) {
+  d->iMaxQ8    = (int32_t)iMaxBase << 8;
+  d->heat      = 0;
+  d->tempSlope = 0;
+  d->tempPrev  = temp;
+  d->tempTicks = 0;
+  d->iMax      = iMaxBase;
+  d->src       = DERATE_SRC_NONE;
+}
+
+/* One update every dt ms. iMaxBase [fixdt(1,16,4)] is the configured limit, temp [degC*10] the board temperature,
+ * vBat [V*100] the battery voltage, iSq [ADC bits^2] the larger squared phase current of both motors and tWind
+ * [degC*10] the hotter winding (WINDING_TEMP only). Returns the derated limit, also published in d->iMax for the
+ * control interrupt */
+int16_t derateStep(Derate *d, int16_t iMaxBase, int16_t temp, int16_t vBat, int32_t iSq, int16_t tWind, uint16_t dt) {
+  int32_t lim = iMaxBase, l, x;
+  uint8_t src = DERATE_SRC_NONE;
+
+  // Temperature trend, a rising slope predicts the temperature DERATE_TEMP_AHEAD s ahead
+  d->tempTicks += dt;
+  if (d->tempTicks >= DERATE_TREND_MS) {
+    d->tempSlope += (((int32_t)(temp - d->tempPrev) << 8) - d->tempSlope) >> 3;
+    d->tempPrev   = temp;
+    d->tempTicks  = 0;
+  }
+  #if DERATE_TEMP_ENABLE
+  x = temp + (d->tempSlope > 0 ? (d->tempSlope * DERATE_TEMP_AHEAD) >> 8 : 0);
+  l = iMaxBase * derateLin(x, DERATE_TEMP_START, TEMP_POWEROFF) / 100;
+  if (l < lim) { lim = l; src = DERATE_SRC_TEMP; }
+  #endif
+
+  // Battery sag
+  l = iMaxBase * derateLin(vBat / BAT_CELLS, DERATE_BAT_START, DERATE_BAT_END) / 100;
+  if (l < lim) { lim = l; src = DERATE_SRC_BAT; }
+
+  // I^2t heat, the limit falls from iMaxBase to DERATE_I_CONT between DERATE_HEAT_START and DERATE_HEAT_ONE
+  x        = (int32_t)DERATE_HEAT_SAT(((int64_t)iSq << 24) / DERATE_I_CONT_SQ);
+  d->heat += (int32_t)((int64_t)(x - d->heat) * dt / (DERATE_I2T_TAU * 1000L));
+  if (d->heat > DERATE_HEAT_MAX) { d->heat = DERATE_HEAT_MAX; }
+  if (d->heat < 0)               { d->heat = 0; }
+  if (d->heat > DERATE_HEAT_START && iMaxBase > DERATE_BITS(DERATE_I_CONT)) {
+    x = d->heat < DERATE_HEAT_ONE ? d->heat : DERATE_HEAT_ONE;
+    l = iMaxBase - (int32_t)((int64_t)(iMaxBase - DERATE_BITS(DERATE_I_CONT)) * (x - DERATE_HEAT_START) / (DERATE_HEAT_ONE - DERATE_HEAT_START));
+    if (l < lim) { lim = l; src = DERATE_SRC_I2T; }
+  }
+
+  // Winding temperature
+  #if defined(WINDING_TEMP)
+  l = iMaxBase * derateLin(tWind, WTEMP_START, WTEMP_MAX) / 100;
+  if (l < lim) { lim = l; src = DERATE_SRC_WIND; }
+  #endif
+
+  // Smoothing: fast down, DERATE_RISE up, never above the configured limit
+  if ((lim << 8) < d->iMaxQ8) {
+    d->iMaxQ8 -= (d->iMaxQ8 - (lim << 8)) >> 3;
+  } else {
+    d->iMaxQ8 += DERATE_RISE_Q8 * dt;
+    if (d->iMaxQ8 > (lim << 8)) { d->iMaxQ8 = lim << 8; }
+  }
+  d->src  = src;
+  d->iMax = (int16_t)(d->iMaxQ8 >> 8);
+  return d->iMax;
+}
+
+#endif
@@ -41,15 +41,42 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "eeprom.h"
+#include "defines.h"
 #include "util.h"
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
 
+#if defined(__GNUC__) && !defined(__ARMCC_VERSION)
+/* EEPROM emulation region reserved by STM32F103RCTx_FLASH.ld */
+extern const uint8_t _seeprom[];
+extern const uint8_t _eeeprom[];
+#endif
+
 /* Global variable used to store variable value in read sequence */
 uint16_t DataVar = 0;
 
+/* RAM shadow of the VirtAddVarTab variables: reads are served from RAM, writes are
+   collected and programmed by EE_Commit */
+#define EE_CACHE_FOUND        ((uint8_t)0x01)   /* Variable exists (in flash or written since) */
+#define EE_CACHE_DIRTY        ((uint8_t)0x02)   /* Variable changed since the last commit */
+static uint16_t EE_CacheData[NB_OF_VAR];
+static uint8_t  EE_CacheState[NB_OF_VAR];
+static uint8_t  EE_CacheLoaded = 0;
+
+#if defined(FLASH_SAFE_WRITE)
+/* Background commit by EE_Service, one step per call */
+#define EE_SVC_IDLE           ((uint8_t)0x00)   /* Changed variables are appended to the valid page */
+#define EE_SVC_PREPARE        ((uint8_t)0x01)   /* Erasing the other bank, left over from an interrupted transfer */
+#define EE_SVC_TRANSFER       ((uint8_t)0x02)   /* Copying the variables to the receive bank */
+#define EE_SVC_ERASE          ((uint8_t)0x03)   /* Erasing the old bank, then the receive bank becomes valid */
+static uint8_t  EE_SvcState = EE_SVC_IDLE;
+static uint16_t EE_SvcIdx;                      /* Next variable to copy, or next flash page of the bank to erase */
+static uint32_t EE_SvcAddr;                     /* Next free location of the receive bank */
+static uint32_t EE_SvcOld, EE_SvcNew;           /* Bank addresses of the transfer */
+#endif
+
 
 
 /* Private function prototypes -----------------------------------------------*/
@@ -57,8 +84,14 @@ uint16_t DataVar = 0;
 static HAL_StatusTypeDef EE_Format(void);
 static uint16_t EE_FindValidPage(uint8_t Operation);
 static uint16_t EE_VerifyPageFullWriteVariable(uint16_t VirtAddress, uint16_t Data);
-static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data);
+static uint16_t EE_PageTransfer(void);
 static uint16_t EE_VerifyPageFullyErased(uint32_t Address);
+static uint16_t EE_ReadFlashVariable(uint16_t VirtAddress, uint16_t* Data);
+static uint16_t EE_FindIndex(uint16_t VirtAddress);
+static void     EE_CacheLoad(void);
+#if defined(FLASH_SAFE_WRITE)
+static uint16_t EE_ServiceStep(uint8_t Standstill);
+#endif
 
 /**
   * @brief  Restore the pages to a known good state in case of page's status
@@ -77,6 +110,13 @@ uint16_t EE_Init(void)
   uint32_t page_error = 0;
   FLASH_EraseInitTypeDef s_eraseinit;
 
+#if defined(__GNUC__) && !defined(__ARMCC_VERSION)
+  /* The pages must lie in the region reserved by the linker script, else code could be erased */
+  if ((uint32_t)_seeprom != EEPROM_START_ADDRESS || (uint32_t)_eeeprom != EE_FLASH_END)
+  {
+    return NO_VALID_PAGE;
+  }
+#endif
 
   /* Get Page0 status */
   pagestatus0 = (*(__IO uint16_t*)PAGE0_BASE_ADDRESS);
@@ -86,7 +126,7 @@ uint16_t EE_Init(void)
   /* Fill EraseInit structure*/
   s_eraseinit.TypeErase   = FLASH_TYPEERASE_PAGES;
   s_eraseinit.PageAddress = PAGE0_ID;
-  s_eraseinit.NbPages     = 1;
+  s_eraseinit.NbPages     = EE_BANK_PAGES;
 
   /* Check for invalid header states and repair if necessary */
   switch (pagestatus0)
@@ -150,7 +190,7 @@ uint16_t EE_Init(void)
           if (varidx != x)
           {
             /* Read the last variables' updates */
-            readstatus = EE_ReadVariable(VirtAddVarTab[varidx], &DataVar);
+            readstatus = EE_ReadFlashVariable(VirtAddVarTab[varidx], &DataVar);
             /* In case variable corresponding to the virtual address was found */
             if (readstatus != 0x1)
             {
@@ -173,7 +213,7 @@ uint16_t EE_Init(void)
         }
         s_eraseinit.TypeErase   = FLASH_TYPEERASE_PAGES;
         s_eraseinit.PageAddress = PAGE1_ID;
-        s_eraseinit.NbPages     = 1;
+        s_eraseinit.NbPages     = EE_BANK_PAGES;
         /* Erase Page1 */
         if(!EE_VerifyPageFullyErased(PAGE1_BASE_ADDRESS))
         {
@@ -189,7 +229,7 @@ uint16_t EE_Init(void)
       {
         s_eraseinit.TypeErase   = FLASH_TYPEERASE_PAGES;
         s_eraseinit.PageAddress = PAGE1_ID;
-        s_eraseinit.NbPages     = 1;
+        s_eraseinit.NbPages     = EE_BANK_PAGES;
         /* Erase Page1 */
         if(!EE_VerifyPageFullyErased(PAGE1_BASE_ADDRESS))
         {
@@ -235,7 +275,7 @@ uint16_t EE_Init(void)
       {
         s_eraseinit.TypeErase   = FLASH_TYPEERASE_PAGES;
         s_eraseinit.PageAddress = PAGE1_ID;
-        s_eraseinit.NbPages     = 1;
+        s_eraseinit.NbPages     = EE_BANK_PAGES;
         /* Erase Page1 */
         if(!EE_VerifyPageFullyErased(PAGE1_BASE_ADDRESS))
         {
@@ -259,7 +299,7 @@ uint16_t EE_Init(void)
           if (varidx != x)
           {
             /* Read the last variables' updates */
-            readstatus = EE_ReadVariable(VirtAddVarTab[varidx], &DataVar);
+            readstatus = EE_ReadFlashVariable(VirtAddVarTab[varidx], &DataVar);
             /* In case variable corresponding to the virtual address was found */
             if (readstatus != 0x1)
             {
@@ -282,7 +322,7 @@ uint16_t EE_Init(void)
         }
         s_eraseinit.TypeErase   = FLASH_TYPEERASE_PAGES;
         s_eraseinit.PageAddress = PAGE0_ID;
-        s_eraseinit.NbPages     = 1;
+        s_eraseinit.NbPages     = EE_BANK_PAGES;
         /* Erase Page0 */
         if(!EE_VerifyPageFullyErased(PAGE0_BASE_ADDRESS))
         {
@@ -307,6 +347,9 @@ uint16_t EE_Init(void)
       break;
   }
 
+  /* Load the RAM shadow from the repaired valid page */
+  EE_CacheLoad();
+
   return HAL_OK;
 }
 
@@ -324,9 +367,10 @@ uint16_t EE_VerifyPageFullyErased(uint32_t Address)
 {
   uint32_t readstatus = 1;
   uint16_t addressvalue = 0x5555;
+  uint32_t endaddress = Address + (PAGE_SIZE - 1);
 
   /* Check each active page address starting from end */
-  while (Address <= PAGE0_END_ADDRESS)
+  while (Address <= endaddress)
   {
     /* Get the current location content to be compared with virtual address */
     addressvalue = (*(__IO uint16_t*)Address);
@@ -349,8 +393,8 @@ uint16_t EE_VerifyPageFullyErased(uint32_t Address)
 }
 
 /**
-  * @brief  Returns the last stored variable data, if found, which correspond to
-  *   the passed virtual address
+  * @brief  Returns the last stored variable data in flash, if found, which correspond to
+  *   the passed virtual address. Scans the valid page backward, used while repairing the pages
   * @param  VirtAddress: Variable virtual address
   * @param  Data: Global variable contains the read variable value
   * @retval Success or error status:
@@ -358,7 +402,7 @@ uint16_t EE_VerifyPageFullyErased(uint32_t Address)
   *           - 1: if the variable was not found
   *           - NO_VALID_PAGE: if no valid page was found.
   */
-uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data)
+static uint16_t EE_ReadFlashVariable(uint16_t VirtAddress, uint16_t* Data)
 {
   uint16_t validpage = PAGE0;
   uint16_t addressvalue = 0x5555, readstatus = 1;
@@ -408,32 +452,469 @@ uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data)
 }
 
 /**
-  * @brief  Writes/upadtes variable data in EEPROM.
+  * @brief  Returns the index of the virtual address in VirtAddVarTab
+  * @param  VirtAddress: Variable virtual address
+  * @retval Index, or NB_OF_VAR if the virtual address is not in VirtAddVarTab
+  */
+static uint16_t EE_FindIndex(uint16_t VirtAddress)
+{
+  uint16_t varidx;
+
+  for (varidx = 0; varidx < NB_OF_VAR; varidx++)
+  {
+    if (VirtAddVarTab[varidx] == VirtAddress)
+    {
+      break;
+    }
+  }
+  return varidx;
+}
+
+/**
+  * @brief  Loads the RAM shadow with one forward scan of the valid page.
+  *   Later entries overwrite earlier ones, so the last update of each variable wins.
+  * @param  None
+  * @retval None
+  */
+static void EE_CacheLoad(void)
+{
+  uint16_t validpage = PAGE0, varidx = 0;
+  uint32_t address = EEPROM_START_ADDRESS, pageendaddress = EEPROM_START_ADDRESS + PAGE_SIZE;
+
+  for (varidx = 0; varidx < NB_OF_VAR; varidx++)
+  {
+    EE_CacheState[varidx] = 0;
+  }
+  EE_CacheLoaded = 1;
+
+  /* Get active Page for read operation */
+  validpage = EE_FindValidPage(READ_FROM_VALID_PAGE);
+
+  /* Check if there is no valid page */
+  if (validpage == NO_VALID_PAGE)
+  {
+    return;
+  }
+
+  /* Get the first variable and the end address of the valid Page */
+  address = (uint32_t)(EEPROM_START_ADDRESS + (uint32_t)(validpage * PAGE_SIZE)) + 4;
+  pageendaddress = (uint32_t)(EEPROM_START_ADDRESS + (uint32_t)((validpage + 1) * PAGE_SIZE));
+
+  /* The variables are appended, the first erased location ends the scan */
+  while (address < pageendaddress && (*(__IO uint32_t*)address) != 0xFFFFFFFF)
+  {
+    varidx = EE_FindIndex(*(__IO uint16_t*)(address + 2));
+    if (varidx < NB_OF_VAR)
+    {
+      EE_CacheData[varidx]  = (*(__IO uint16_t*)address);
+      EE_CacheState[varidx] = EE_CACHE_FOUND;
+    }
+    address = address + 4;
+  }
+}
+
+/**
+  * @brief  Returns the last stored variable data, if found, which correspond to
+  *   the passed virtual address. Served from the RAM shadow, including values
+  *   written but not committed yet
+  * @param  VirtAddress: Variable virtual address
+  * @param  Data: Global variable contains the read variable value
+  * @retval Success or error status:
+  *           - 0: if variable was found
+  *           - 1: if the variable was not found
+  */
+uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data)
+{
+  uint16_t varidx;
+
+  if (!EE_CacheLoaded)
+  {
+    EE_CacheLoad();
+  }
+
+  varidx = EE_FindIndex(VirtAddress);
+  if (varidx >= NB_OF_VAR || !(EE_CacheState[varidx] & EE_CACHE_FOUND))
+  {
+    return 1;
+  }
+  *Data = EE_CacheData[varidx];
+  return 0;
+}
+
+/**
+  * @brief  Writes/upadtes variable data in the RAM shadow. The flash is only
+  *   programmed by EE_Commit, and only if the value changed
   * @param  VirtAddress: Variable virtual address
   * @param  Data: 16 bit data to be written
   * @retval Success or error status:
-  *           - FLASH_COMPLETE: on success
-  *           - PAGE_FULL: if valid page is full
+  *           - 0: on success
+  *           - 1: if the virtual address is not in VirtAddVarTab
+  */
+uint16_t EE_WriteVariable(uint16_t VirtAddress, uint16_t Data)
+{
+  uint16_t varidx;
+
+  if (!EE_CacheLoaded)
+  {
+    EE_CacheLoad();
+  }
+
+  varidx = EE_FindIndex(VirtAddress);
+  if (varidx >= NB_OF_VAR)
+  {
+    return 1;
+  }
+  if (!(EE_CacheState[varidx] & EE_CACHE_FOUND) || EE_CacheData[varidx] != Data)
+  {
+    EE_CacheData[varidx]   = Data;
+    EE_CacheState[varidx] |= EE_CACHE_FOUND | EE_CACHE_DIRTY;
+  }
+  return 0;
+}
+
+/**
+  * @brief  Programs the changed variables of the RAM shadow into the valid page.
+  *   If they do not fit, all variables are moved to the other page with a single
+  *   page transfer. The Flash has to be unlocked by the caller.
+  * @param  None
+  * @retval Success or error status:
+  *           - FLASH_COMPLETE: on success, also if nothing changed
   *           - NO_VALID_PAGE: if no valid page was found
   *           - Flash error code: on write Flash error
   */
-uint16_t EE_WriteVariable(uint16_t VirtAddress, uint16_t Data)
+uint16_t EE_Commit(void)
 {
-  uint16_t Status = 0;
+  HAL_StatusTypeDef flashstatus = HAL_OK;
+  uint16_t validpage = PAGE0, varidx = 0, dirtycnt = 0;
+  uint32_t address = EEPROM_START_ADDRESS, pageendaddress = EEPROM_START_ADDRESS + PAGE_SIZE;
 
-  /* Write the variable virtual address and value in the EEPROM */
-  Status = EE_VerifyPageFullWriteVariable(VirtAddress, Data);
+#if defined(FLASH_SAFE_WRITE)
+  /* Complete a page transfer of the background commit first, erases included */
+  while (EE_SvcState != EE_SVC_IDLE)
+  {
+    EE_ServiceStep(1);
+  }
+#endif
 
-  /* In case the EEPROM active page is full */
-  if (Status == PAGE_FULL)
+  for (varidx = 0; varidx < NB_OF_VAR; varidx++)
+  {
+    if (EE_CacheState[varidx] & EE_CACHE_DIRTY)
+    {
+      dirtycnt++;
+    }
+  }
+  if (dirtycnt == 0)
   {
-    /* Perform Page transfer */
-    Status = EE_PageTransfer(VirtAddress, Data);
+    return HAL_OK;
+  }
+
+  /* Get valid Page for write operation */
+  validpage = EE_FindValidPage(WRITE_IN_VALID_PAGE);
+
+  /* Check if there is no valid page */
+  if (validpage == NO_VALID_PAGE)
+  {
+    return  NO_VALID_PAGE;
+  }
+
+  /* Find the first erased location of the valid Page */
+  address = (uint32_t)(EEPROM_START_ADDRESS + (uint32_t)(validpage * PAGE_SIZE)) + 4;
+  pageendaddress = (uint32_t)(EEPROM_START_ADDRESS + (uint32_t)((validpage + 1) * PAGE_SIZE));
+  while (address < pageendaddress && (*(__IO uint32_t*)address) != 0xFFFFFFFF)
+  {
+    address = address + 4;
+  }
+
+  /* In case the changed variables do not fit in the active page */
+  if ((pageendaddress - address) / 4 < dirtycnt)
+  {
+    return EE_PageTransfer();
+  }
+
+  for (varidx = 0; varidx < NB_OF_VAR; varidx++)
+  {
+    if (EE_CacheState[varidx] & EE_CACHE_DIRTY)
+    {
+      /* Set variable data */
+      flashstatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address, EE_CacheData[varidx]);
+      /* If program operation was failed, a Flash error code is returned */
+      if (flashstatus != HAL_OK)
+      {
+        return flashstatus;
+      }
+      /* Set variable virtual address */
+      flashstatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address + 2, VirtAddVarTab[varidx]);
+      if (flashstatus != HAL_OK)
+      {
+        return flashstatus;
+      }
+      EE_CacheState[varidx] &= ~EE_CACHE_DIRTY;
+      address = address + 4;
+    }
   }
 
   /* Return last operation status */
-  return Status;
+  return flashstatus;
+}
+
+/**
+  * @brief  Commits the changed variables of the RAM shadow: with FLASH_SAFE_WRITE
+  *   they are left to EE_Service, else they are programmed at once by EE_Commit
+  * @param  None
+  * @retval None
+  */
+void EE_Save(void)
+{
+#if !defined(FLASH_SAFE_WRITE)
+  HAL_FLASH_Unlock();
+  EE_Commit();
+  HAL_FLASH_Lock();
+#endif
+}
+
+#if defined(FLASH_SAFE_WRITE)
+/**
+  * @brief  Waits for the end of the flash operation. Polled from SRAM: the CPU
+  *   does not read the flash meanwhile and the interrupts whose code and data
+  *   are in SRAM are taken as usual
+  * @param  None
+  * @retval HAL_OK, or HAL_ERROR on a programming or write protection error
+  */
+RAMFUNC static HAL_StatusTypeDef EE_FlashWait(void)
+{
+  uint32_t sr;
+
+  while (FLASH->SR & FLASH_SR_BSY)
+  {
+  }
+  sr = FLASH->SR;
+  FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+  return (sr & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR)) ? HAL_ERROR : HAL_OK;
+}
+
+/**
+  * @brief  Programs a half-word from SRAM. The Flash has to be unlocked by the caller
+  * @param  Address: half-word address
+  * @param  Data: 16 bit data
+  * @retval HAL_OK, or HAL_ERROR on a Flash error
+  */
+RAMFUNC uint16_t EE_ProgramHalfWord(uint32_t Address, uint16_t Data)
+{
+  HAL_StatusTypeDef flashstatus;
+
+  EE_FlashWait();
+  FLASH->CR |= FLASH_CR_PG;
+  *(__IO uint16_t*)Address = Data;
+  flashstatus = EE_FlashWait();
+  FLASH->CR &= ~FLASH_CR_PG;
+  return flashstatus;
+}
+
+/**
+  * @brief  Erases one flash page from SRAM. Code and data outside SRAM wait
+  *   about 20 ms. The Flash has to be unlocked by the caller
+  * @param  PageAddress: page start address
+  * @retval HAL_OK, or HAL_ERROR on a Flash error
+  */
+RAMFUNC uint16_t EE_ErasePage(uint32_t PageAddress)
+{
+  HAL_StatusTypeDef flashstatus;
+
+  EE_FlashWait();
+  FLASH->CR |= FLASH_CR_PER;
+  FLASH->AR  = PageAddress;
+  FLASH->CR |= FLASH_CR_STRT;
+  flashstatus = EE_FlashWait();
+  FLASH->CR &= ~FLASH_CR_PER;
+  return flashstatus;
+}
+#else
+/**
+  * @brief  Programs a half-word. The Flash has to be unlocked by the caller
+  * @param  Address: half-word address
+  * @param  Data: 16 bit data
+  * @retval HAL_OK, or the Flash error
+  */
+uint16_t EE_ProgramHalfWord(uint32_t Address, uint16_t Data)
+{
+  return HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, Address, Data);
+}
+
+/**
+  * @brief  Erases one flash page, the CPU stalls meanwhile. The Flash has to be
+  *   unlocked by the caller
+  * @param  PageAddress: page start address
+  * @retval HAL_OK, or the Flash error
+  */
+uint16_t EE_ErasePage(uint32_t PageAddress)
+{
+  uint32_t page_error = 0;
+  FLASH_EraseInitTypeDef s_eraseinit;
+
+  s_eraseinit.TypeErase   = FLASH_TYPEERASE_PAGES;
+  s_eraseinit.PageAddress = PageAddress;
+  s_eraseinit.NbPages     = 1;
+  return HAL_FLASHEx_Erase(&s_eraseinit, &page_error);
+}
+#endif
+
+#if defined(FLASH_SAFE_WRITE)
+/**
+  * @brief  Programs one variable of the RAM shadow at Address. It stays dirty if
+  *   the frame processing (PendSV) changed it meanwhile
+  * @param  Address: free location
+  * @param  VarIdx: index of the variable
+  * @retval HAL_OK, or HAL_ERROR on a Flash error
+  */
+static HAL_StatusTypeDef EE_ProgramVar(uint32_t Address, uint16_t VarIdx)
+{
+  uint16_t data = EE_CacheData[VarIdx];
+  uint32_t basepri;
+
+  if (EE_ProgramHalfWord(Address, data) != HAL_OK || EE_ProgramHalfWord(Address + 2, VirtAddVarTab[VarIdx]) != HAL_OK)
+  {
+    return HAL_ERROR;
+  }
+  basepri = __get_BASEPRI();
+  __set_BASEPRI(IRQ_BASEPRI(IRQ_PRIO_DEFERRED));
+  if (EE_CacheData[VarIdx] == data)
+  {
+    EE_CacheState[VarIdx] &= ~EE_CACHE_DIRTY;
+  }
+  __set_BASEPRI(basepri);
+  return HAL_OK;
+}
+
+/**
+  * @brief  One step of the background commit, see EE_Service. The Flash has to
+  *   be unlocked by the caller
+  * @param  Standstill: 1 if a page erase may be done now
+  * @retval 1 while changed variables or a transfer are pending, else 0
+  */
+static uint16_t EE_ServiceStep(uint8_t Standstill)
+{
+  uint16_t validpage = PAGE0, varidx = 0;
+  uint32_t address = EEPROM_START_ADDRESS, pageendaddress = EEPROM_START_ADDRESS + PAGE_SIZE;
+
+  switch (EE_SvcState)
+  {
+    case EE_SVC_PREPARE:
+      if (Standstill)
+      {
+        EE_ErasePage(EE_SvcNew + EE_SvcIdx * FLASH_PAGE_SIZE);
+        if (++EE_SvcIdx >= EE_BANK_PAGES)
+        {
+          EE_ProgramHalfWord(EE_SvcNew, RECEIVE_DATA);
+          EE_SvcAddr  = EE_SvcNew + 4;
+          EE_SvcIdx   = 0;
+          EE_SvcState = EE_SVC_TRANSFER;
+        }
+      }
+      return 1;
+
+    case EE_SVC_TRANSFER:
+      /* The last value of every variable, one per step. A variable changed after its copy stays dirty */
+      while (EE_SvcIdx < NB_OF_VAR && !(EE_CacheState[EE_SvcIdx] & EE_CACHE_FOUND))
+      {
+        EE_SvcIdx++;
+      }
+      if (EE_SvcIdx < NB_OF_VAR)
+      {
+        EE_ProgramVar(EE_SvcAddr, EE_SvcIdx++);
+        EE_SvcAddr += 4;
+      }
+      else
+      {
+        EE_SvcIdx   = 0;
+        EE_SvcState = EE_SVC_ERASE;
+      }
+      return 1;
+
+    case EE_SVC_ERASE:
+      /* Nothing is appended to the receive bank before it is valid: after a power loss, EE_Init copies the old
+         bank into it again and would overwrite newer values */
+      if (Standstill)
+      {
+        EE_ErasePage(EE_SvcOld + EE_SvcIdx * FLASH_PAGE_SIZE);
+        if (++EE_SvcIdx >= EE_BANK_PAGES)
+        {
+          EE_ProgramHalfWord(EE_SvcNew, VALID_PAGE);
+          EE_SvcState = EE_SVC_IDLE;
+        }
+      }
+      return 1;
+
+    default:
+      break;
+  }
+
+  for (varidx = 0; varidx < NB_OF_VAR && !(EE_CacheState[varidx] & EE_CACHE_DIRTY); varidx++)
+  {
+  }
+  if (varidx >= NB_OF_VAR)
+  {
+    return 0;
+  }
+
+  validpage = EE_FindValidPage(WRITE_IN_VALID_PAGE);
+  if (validpage == NO_VALID_PAGE)
+  {
+    return 0;
+  }
+  address = (uint32_t)(EEPROM_START_ADDRESS + (uint32_t)(validpage * PAGE_SIZE)) + 4;
+  pageendaddress = (uint32_t)(EEPROM_START_ADDRESS + (uint32_t)((validpage + 1) * PAGE_SIZE));
+  while (address < pageendaddress && (*(__IO uint32_t*)address) != 0xFFFFFFFF)
+  {
+    address = address + 4;
+  }
+
+  if (address < pageendaddress)
+  {
+    EE_ProgramVar(address, varidx);
+    return 1;
+  }
+
+  /* The valid page is full: page transfer to the other bank */
+  EE_SvcOld = EEPROM_START_ADDRESS + (uint32_t)(validpage * PAGE_SIZE);
+  EE_SvcNew = (validpage == PAGE0) ? PAGE1_BASE_ADDRESS : PAGE0_BASE_ADDRESS;
+  EE_SvcIdx = 0;
+  if (EE_VerifyPageFullyErased(EE_SvcNew))
+  {
+    EE_ProgramHalfWord(EE_SvcNew, RECEIVE_DATA);
+    EE_SvcAddr  = EE_SvcNew + 4;
+    EE_SvcState = EE_SVC_TRANSFER;
+  }
+  else
+  {
+    EE_SvcState = EE_SVC_PREPARE;
+  }
+  return 1;
+}
+
+/**
+  * @brief  Background commit of FLASH_SAFE_WRITE, called from the main loop.
+  *   One step per call: one changed variable is appended to the valid page, or
+  *   one variable of a page transfer is copied, or one flash page is erased.
+  *   Erases only if Standstill, the transfer waits for it. The transfer goes
+  *   through the page states of EE_PageTransfer, EE_Init completes it after a
+  *   power loss
+  * @param  Standstill: 1 if a page erase may stall the code outside SRAM now
+  * @retval 1 while changed variables or a transfer are pending, else 0
+  */
+uint16_t EE_Service(uint8_t Standstill)
+{
+  uint16_t pending;
+
+  if (!EE_CacheLoaded)
+  {
+    return 0;
+  }
+  HAL_FLASH_Unlock();
+  pending = EE_ServiceStep(Standstill);
+  HAL_FLASH_Lock();
+  return pending;
 }
+#endif
 
 /**
   * @brief  Erases PAGE and PAGE1 and writes VALID_PAGE header to PAGE
@@ -449,7 +930,7 @@ static HAL_StatusTypeDef EE_Format(void)
 
   s_eraseinit.TypeErase   = FLASH_TYPEERASE_PAGES;
   s_eraseinit.PageAddress = PAGE0_ID;
-  s_eraseinit.NbPages     = 1;
+  s_eraseinit.NbPages     = EE_BANK_PAGES;
   /* Erase Page0 */
   if(!EE_VerifyPageFullyErased(PAGE0_BASE_ADDRESS))
   {
@@ -615,23 +1096,21 @@ static uint16_t EE_VerifyPageFullWriteVariable(uint16_t VirtAddress, uint16_t Da
 }
 
 /**
-  * @brief  Transfers last updated variables data from the full Page to
+  * @brief  Transfers all variables of the RAM shadow from the full Page to
   *   an empty one.
-  * @param  VirtAddress: 16 bit virtual address of the variable
-  * @param  Data: 16 bit data to be written as variable value
+  * @param  None
   * @retval Success or error status:
   *           - FLASH_COMPLETE: on success
   *           - PAGE_FULL: if valid page is full
   *           - NO_VALID_PAGE: if no valid page was found
   *           - Flash error code: on write Flash error
   */
-static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data)
+static uint16_t EE_PageTransfer(void)
 {
   HAL_StatusTypeDef flashstatus = HAL_OK;
-  uint32_t newpageaddress = EEPROM_START_ADDRESS;
+  uint32_t newpageaddress = EEPROM_START_ADDRESS, address = EEPROM_START_ADDRESS;
   uint32_t oldpageid = 0;
   uint16_t validpage = PAGE0, varidx = 0;
-  uint16_t eepromstatus = 0, readstatus = 0;
   uint32_t page_error = 0;
   FLASH_EraseInitTypeDef s_eraseinit;
 
@@ -667,38 +1146,31 @@ static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data)
     return flashstatus;
   }
 
-  /* Write the variable passed as parameter in the new active page */
-  eepromstatus = EE_VerifyPageFullWriteVariable(VirtAddress, Data);
-  /* If program operation was failed, a Flash error code is returned */
-  if (eepromstatus != HAL_OK)
-  {
-    return eepromstatus;
-  }
-
-  /* Transfer process: transfer variables from old to the new active page */
+  /* Transfer process: write the last value of every variable to the new active page */
+  address = newpageaddress + 4;
   for (varidx = 0; varidx < NB_OF_VAR; varidx++)
   {
-    if (VirtAddVarTab[varidx] != VirtAddress)  /* Check each variable except the one passed as parameter */
+    if (EE_CacheState[varidx] & EE_CACHE_FOUND)
     {
-      /* Read the other last variable updates */
-      readstatus = EE_ReadVariable(VirtAddVarTab[varidx], &DataVar);
-      /* In case variable corresponding to the virtual address was found */
-      if (readstatus != 0x1)
+      flashstatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address, EE_CacheData[varidx]);
+      if (flashstatus != HAL_OK)
       {
-        /* Transfer the variable to the new active page */
-        eepromstatus = EE_VerifyPageFullWriteVariable(VirtAddVarTab[varidx], DataVar);
-        /* If program operation was failed, a Flash error code is returned */
-        if (eepromstatus != HAL_OK)
-        {
-          return eepromstatus;
-        }
+        return flashstatus;
+      }
+      flashstatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address + 2, VirtAddVarTab[varidx]);
+      /* If program operation was failed, a Flash error code is returned */
+      if (flashstatus != HAL_OK)
+      {
+        return flashstatus;
       }
+      EE_CacheState[varidx] &= ~EE_CACHE_DIRTY;
+      address = address + 4;
     }
   }
 
   s_eraseinit.TypeErase   = FLASH_TYPEERASE_PAGES;
   s_eraseinit.PageAddress = oldpageid;
-  s_eraseinit.NbPages     = 1;
+  s_eraseinit.NbPages     = EE_BANK_PAGES;
 
   /* Erase the old Page: Set old Page status to ERASED status */
   flashstatus = HAL_FLASHEx_Erase(&s_eraseinit, &page_error);
@@ -716,8 +1188,6 @@ static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data)
     return flashstatus;
   }
 
-
-
   /* Return last operation flash status */
   return flashstatus;
 }
@@ -0,0 +1,95 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Efficiency estimate (EFF_ESTIMATE). Only uses config.h, so it also builds on the host.
+//
+// Per motor and monitor step:
+// - input: battery voltage times the DC link current of the motor, what the motor and its half bridge take.
+// - copper loss: 1.5 R (iq^2 + id^2), with the amplitude invariant dq currents of the controller.
+// - output: 1.5 w flux iq, the air gap power. Iron, friction and the bearing losses are in it, so the efficiency is
+//   the one of the winding and the inverter, what the control parameters change.
+// The energies are summed over EFF_WINDOW s, then the mean powers, the efficiency and the net energy per distance of
+// both motors replace the ones of the last window. Input minus output minus copper loss is the inverter and the rest.
+
+#include <stdint.h>
+#include "config.h"
+#include "eff.h"
+
+#if defined(EFF_ESTIMATE)
+
+#define EFF_DIST_MIN        5000                                  // [mm] Wh/km only above this distance in a window
+#define EFF_ETA_MAX         1500                                  // [0.1 %] clamp, above 100 % the flux is too high
+
+void effInit(Eff *e) {
+  for (uint8_t m = 0; m < 2; m++) {
+    e->eIn[m]   = e->eCu[m] = e->eMech[m] = 0;
+    e->pIn[m]   = e->pCu[m] = e->pMech[m] = 0;
+    e->eta[m]   = 0;
+  }
+  e->steps = 0;
+  e->time  = 0;
+  e->whKm  = 0;
+}
+
+/* Efficiency [0.1 %] of a window, output over input while driving and input over output while braking */
+static int16_t effEta(int64_t in, int64_t out) {
+  int64_t eta = 0;
+  if (in > 0 && out > 0) {
+    eta = out * 1000 / in;
+  } else if (in < 0 && out < 0) {
+    eta = in * 1000 / out;
+  }
+  return (int16_t)(eta < EFF_ETA_MAX ? eta : EFF_ETA_MAX);
+}
+
+/* One update every dt ms. vBat [V*100] is the battery voltage, per motor iDc [A*100] the DC link current, positive =
+ * discharge, iq / id [fixdt(1,16,4) ADC bits] the controller currents, n [rpm] the speed, r [uOhm] the phase
+ * resistance and flux [uV s] the rotor flux. steps are the hall steps of both wheels since the last update */
+void effStep(Eff *e, int16_t vBat, const int16_t iDc[2], const int16_t iq[2], const int16_t id[2], const int16_t n[2],
+             const int32_t r[2], const uint16_t flux[2], uint8_t polePairs, uint16_t steps, uint16_t dt) {
+  for (uint8_t m = 0; m < 2; m++) {
+    int32_t iSq = (int32_t)iq[m] * iq[m] + (int32_t)id[m] * id[m];
+    e->eIn[m]   += (int64_t)vBat * iDc[m] * dt / 10;
+    e->eCu[m]   += (int64_t)r[m] * iSq * 3 / (512000LL * A2BIT_CONV * A2BIT_CONV) * dt;
+    e->eMech[m] += (int64_t)n[m] * polePairs * flux[m] * iq[m] * 18849 / (1920000000LL * A2BIT_CONV) * dt;
+  }
+  e->steps += steps;
+  e->time  += dt;
+  if (e->time < EFF_WINDOW * 1000) {
+    return;
+  }
+
+  // Window done: mean powers [W] = [mW*ms] / (time [ms] * 1000)
+  for (uint8_t m = 0; m < 2; m++) {
+    e->pIn[m]   = (int16_t)(e->eIn[m]   / (e->time * 1000L));
+    e->pCu[m]   = (int16_t)(e->eCu[m]   / (e->time * 1000L));
+    e->pMech[m] = (int16_t)(e->eMech[m] / (e->time * 1000L));
+    e->eta[m]   = effEta(e->eIn[m], e->eMech[m]);
+  }
+  // Distance [mm] of the mean of both wheels, [mWh] / [m] = [Wh/km]
+  {
+    int64_t mm = (int64_t)e->steps * TRIP_WHEEL_MM / (12 * polePairs);
+    e->whKm = mm >= EFF_DIST_MIN ? (int16_t)((e->eIn[0] + e->eIn[1]) * 10 / (3600LL * mm)) : 0;
+  }
+  for (uint8_t m = 0; m < 2; m++) {
+    e->eIn[m] = e->eCu[m] = e->eMech[m] = 0;
+  }
+  e->steps = 0;
+  e->time  = 0;
+}
+
+#endif
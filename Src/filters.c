@@ -0,0 +1,284 @@
+/**
+  * This file is part of the hoverboard-firmware-hack project.
+  *
+  * Copyright (C) 2020-2021 Emanuel FERU <aerdronix@gmail.com>
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Fixed-point helpers of the main loop. They only use config.h and defines.h,
+// so they also build on the host against golden vectors (make host-test)
+
+// Includes
+#include <stdint.h>
+#include "defines.h"
+#include "config.h"
+#include "util.h"
+#include "fixpt.h"
+
+
+/* =========================== Filtering Functions =========================== */
+
+  /* Low pass filter fixed-point 32 bits: fixdt(1,32,16)
+  * Max:  32767.99998474121
+  * Min: -32768
+  * Res:  1.52587890625e-05
+  * 
+  * Inputs:       u     = int16 or int32
+  * Outputs:      y     = fixdt(1,32,16)
+  * Parameters:   coef  = fixdt(0,16,16) = [0,65535U]
+  * 
+  * Example: 
+  * If coef = 0.8 (in floating point), then coef = 0.8 * 2^16 = 52429 (in fixed-point)
+  * filtLowPass16(u, 52429, &y);
+  * yint = (int16_t)(y >> 16); // the integer output is the fixed-point ouput shifted by 16 bits
+  */
+void filtLowPass32(int32_t u, uint16_t coef, int32_t *y) {
+  int64_t tmp;  
+  tmp = ((int64_t)((u << 4) - (*y >> 12)) * coef) >> 4;
+  *y  = sat32(tmp) + (*y);  // Overflow protection
+}
+
+  /* filtLowPass32Fast: same output as filtLowPass32 without the 64-bit multiply and clamp
+  * Inputs:       u     = int32 in [-16383, 16383], e.g. ADC values or the rate limiter outputs
+  * Outputs:      y     = fixdt(1,32,16) in [-2^30, 2^30)
+  * Parameters:   coef  = fixdt(0,16,16) = [0,65535U]
+  *
+  * With these ranges |(u << 4) - (*y >> 12)| < 2^19, so the coef product is split as
+  * e * coef >> 4 = e * (coef >> 4) + (e * (coef & 15) >> 4), which fits in 32 bits and is exact.
+  * The 64-bit clamp never saturates in this range. Equality with filtLowPass32 is checked by make host-test.
+  */
+RAMFUNC void filtLowPass32Fast(int32_t u, uint16_t coef, int32_t *y) {
+  int32_t e;
+  e  = (u << 4) - (*y >> 12);
+  *y = e * (coef >> 4) + ((e * (coef & 15)) >> 4) + (*y);
+}
+  // Old filter
+  // Inputs:       u     = int16
+  // Outputs:      y     = fixdt(1,32,20)
+  // Parameters:   coef  = fixdt(0,16,16) = [0,65535U]
+  // yint = (int16_t)(y >> 20); // the integer output is the fixed-point ouput shifted by 20 bits
+  // void filtLowPass32(int16_t u, uint16_t coef, int32_t *y) {
+  //   int32_t tmp;  
+  //   tmp = (int16_t)(u << 4) - (*y >> 16);  
+  //   tmp = CLAMP(tmp, -32768, 32767);  // Overflow protection  
+  //   *y  = coef * tmp + (*y);
+  // }
+
+
+  /* rateLimiter16(int16_t u, int16_t rate, int16_t *y);
+  * Inputs:       u     = int16
+  * Outputs:      y     = fixdt(1,16,4)
+  * Parameters:   rate  = fixdt(1,16,4) = [0, 32767] Do NOT make rate negative (>32767)
+  */
+void rateLimiter16(int16_t u, int16_t rate, int16_t *y) {
+  int16_t q0;
+
+  q0 = (u << 4)  - *y;
+  *y = (int16_t)clampSym(q0, rate) + *y;
+}
+
+
+  /* refGenStep(int16_t u, int32_t accMax, int32_t jerkMax, RefGen *g);
+  * Jerk limited reference generator: y follows u with |a| <= accMax and |a - a_prev| <= jerkMax per step.
+  * Every step takes the largest change of a after which y can still stop at u, so a reference starting at rest
+  * never overshoots. a is the acceleration for a feedforward.
+  * Inputs:       u        = int16 in [-16383, 16383]
+  * Outputs:      g->y     = fixdt(1,32,16), same scaling as filtLowPass32
+  *               g->a     = fixdt(1,32,16) per step
+  * Parameters:   accMax   = fixdt(1,32,16) per step,  [1, 2^24]
+  *               jerkMax  = fixdt(1,32,16) per step², [1, accMax]
+  */
+RAMFUNC static int64_t refGenStopDist(int32_t v, int32_t jerkMax) {  // distance of v, v - jerkMax, ... down to 0
+  int64_t n;
+  if (v <= 0) {
+    return 0;
+  }
+  n = (v + jerkMax - 1) / jerkMax;
+  return n * v - jerkMax * n * (n - 1) / 2;
+}
+
+RAMFUNC void refGenStep(int16_t u, int32_t accMax, int32_t jerkMax, RefGen *g) {
+  int32_t e, d, v, vUp;
+
+  e = ((int32_t)u << 16) - g->y;
+  if (ABS(e) <= jerkMax && ABS(g->a) <= jerkMax) {     // last step, land on u
+    g->y = (int32_t)u << 16;
+    g->a = 0;
+    return;
+  }
+
+  d   = (e > 0 || (e == 0 && g->a < 0)) ? 1 : -1;       // work towards u as positive direction
+  v   = d * g->a;
+  e   = d * e;
+  vUp = MIN(v + jerkMax, accMax);
+  if (v > accMax) {                                     // accMax was lowered
+    v -= jerkMax;
+  } else if (refGenStopDist(vUp, jerkMax) <= e) {
+    v  = vUp;
+  } else if (refGenStopDist(v, jerkMax) > e) {
+    v  = MAX(v - jerkMax, -accMax);
+  }
+  g->a  = d * v;
+  g->y += g->a;
+}
+
+
+  /* mixerFcn(rtu_speed, rtu_steer, &rty_speedR, &rty_speedL); 
+  * Inputs:       rtu_speed, rtu_steer                  = fixdt(1,16,4)
+  * Outputs:      rty_speedR, rty_speedL                = int16_t
+  * Parameters:   SPEED_COEFFICIENT, STEER_COEFFICIENT  = fixdt(0,16,14)
+  */
+void mixerFcn(int16_t rtu_speed, int16_t rtu_steer, int16_t *rty_speedR, int16_t *rty_speedL) {
+    int16_t prodSpeed;
+    int16_t prodSteer;
+    int32_t tmp;
+
+    prodSpeed   = (int16_t)((rtu_speed * (int16_t)SPEED_COEFFICIENT) >> 14);
+    prodSteer   = (int16_t)((rtu_steer * (int16_t)STEER_COEFFICIENT) >> 14);
+
+    tmp         = prodSpeed - prodSteer;
+    *rty_speedR = sat16(tmp) >> 4;            // Overflow protection, convert from fixed-point to int
+    *rty_speedR = CLAMP(*rty_speedR, INPUT_MIN, INPUT_MAX);
+
+    tmp         = prodSpeed + prodSteer;
+    *rty_speedL = sat16(tmp) >> 4;            // Overflow protection, convert from fixed-point to int
+    *rty_speedL = CLAMP(*rty_speedL, INPUT_MIN, INPUT_MAX);
+}
+
+  /* inputCurveStep(int16_t u, const int16_t *pts)
+  * Input response curve, odd symmetric: linear interpolation between (0, 0) and the points pts[k] at
+  * x = (k + 1) * INPUT_CURVE_STEP, slope 1 above x = 1000 (INPUT_MAX with field weakening)
+  * INPUT_CURVE_STEP is a constant, the compiler turns the divides into multiplies
+  * Inputs:       u   = int16_t, scaled command
+  * Outputs:      y   = int16_t
+  * Parameters:   pts = int16_t[INPUT_CURVE_N]
+  */
+int16_t inputCurveStep(int16_t u, const int16_t *pts) {
+  int32_t x = ABS((int32_t)u);
+  int32_t y, y0, k;
+
+  if (x >= INPUT_CURVE_N * INPUT_CURVE_STEP) {
+    y = pts[INPUT_CURVE_N - 1] + x - INPUT_CURVE_N * INPUT_CURVE_STEP;
+  } else {
+    k  = x / INPUT_CURVE_STEP;
+    y0 = k ? pts[k - 1] : 0;
+    y  = y0 + (pts[k] - y0) * (x - k * INPUT_CURVE_STEP) / INPUT_CURVE_STEP;
+  }
+  y = clampSym(y, 32767);
+  return (int16_t)(u < 0 ? -y : y);
+}
+
+
+
+/* =========================== Multiple Tap Function =========================== */
+
+  /* multipleTapDet(int16_t u, uint32_t timeNow, MultipleTap *x)
+  * This function detects multiple tap presses, such as double tapping, triple tapping, etc.
+  * Inputs:       u = int16_t (input signal); timeNow = uint32_t (current time)  
+  * Outputs:      x->b_multipleTap (get the output here)
+  */
+void multipleTapDet(int16_t u, uint32_t timeNow, MultipleTap *x) {
+  uint8_t 	b_timeout;
+  uint8_t 	b_hyst;
+  uint8_t 	b_pulse;
+  uint8_t 	z_pulseCnt;
+  uint8_t   z_pulseCntRst;
+  uint32_t 	t_time; 
+
+  // Detect hysteresis
+  if (x->b_hysteresis) {
+    b_hyst = (u > MULTIPLE_TAP_LO);
+  } else {
+    b_hyst = (u > MULTIPLE_TAP_HI);
+  }
+
+  // Detect pulse
+  b_pulse = (b_hyst != x->b_hysteresis);
+
+  // Save time when first pulse is detected
+  if (b_hyst && b_pulse && (x->z_pulseCntPrev == 0)) {
+    t_time = timeNow;
+  } else {
+    t_time = x->t_timePrev;
+  }
+
+  // Create timeout boolean
+  b_timeout = (timeNow - t_time > MULTIPLE_TAP_TIMEOUT);
+
+  // Create pulse counter
+  if ((!b_hyst) && (x->z_pulseCntPrev == 0)) {
+    z_pulseCnt = 0U;
+  } else {
+    z_pulseCnt = b_pulse;
+  }
+
+  // Reset counter if we detected complete tap presses OR there is a timeout
+  if ((x->z_pulseCntPrev >= MULTIPLE_TAP_NR) || b_timeout) {
+    z_pulseCntRst = 0U;
+  } else {
+    z_pulseCntRst = x->z_pulseCntPrev;
+  }
+  z_pulseCnt = z_pulseCnt + z_pulseCntRst;
+
+  // Check if complete tap presses are detected AND no timeout
+  if ((z_pulseCnt >= MULTIPLE_TAP_NR) && (!b_timeout)) {
+    x->b_multipleTap = !x->b_multipleTap;	// Toggle output
+  }
+
+  // Update states
+  x->z_pulseCntPrev = z_pulseCnt;
+  x->b_hysteresis 	= b_hyst;
+  x->t_timePrev 	  = t_time;
+}
+
+
+
+/* =========================== ADC Input Filters =========================== */
+
+  /* boxcarStep(BoxcarFilt *f, uint16_t u)
+  * Moving average of the last 2^ADC_INPUT_FILT_SHIFT samples with a running sum, no division
+  * Inputs:       u = uint16_t, 12-bit ADC value
+  * Outputs:      average of the last samples
+  */
+void boxcarInit(BoxcarFilt *f, uint16_t u) {
+  for (uint16_t i = 0; i < (1 << ADC_INPUT_FILT_SHIFT); i++) {
+    f->buf[i] = u;
+  }
+  f->sum = (uint32_t)u << ADC_INPUT_FILT_SHIFT;
+  f->idx = 0;
+}
+
+uint16_t boxcarStep(BoxcarFilt *f, uint16_t u) {
+  f->sum         += u - f->buf[f->idx];   // modulo 2^32, the sum itself never wraps
+  f->buf[f->idx]  = u;
+  f->idx          = (f->idx + 1) & ((1 << ADC_INPUT_FILT_SHIFT) - 1);
+  return (uint16_t)(f->sum >> ADC_INPUT_FILT_SHIFT);
+}
+
+  /* ema2Step(Ema2Filt *f, uint16_t u)
+  * Two cascaded EMAs with coefficient 2^-ADC_INPUT_FILT_SHIFT, states in fixdt(0,16,4)
+  * Second order roll-off: the same noise rejection as a much longer moving average at a smaller delay
+  * Inputs:       u = uint16_t, 12-bit ADC value
+  * Outputs:      filtered value, rounded to integer
+  */
+void ema2Init(Ema2Filt *f, uint16_t u) {
+  f->y1 = f->y2 = (uint16_t)(u << 4);
+}
+
+uint16_t ema2Step(Ema2Filt *f, uint16_t u) {
+  f->y1 = (uint16_t)(f->y1 + (((int32_t)(u << 4) - f->y1) >> ADC_INPUT_FILT_SHIFT));
+  f->y2 = (uint16_t)(f->y2 + (((int32_t)f->y1 - f->y2) >> ADC_INPUT_FILT_SHIFT));
+  return (uint16_t)((f->y2 + 8) >> 4);
+}
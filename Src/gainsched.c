@@ -0,0 +1,98 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Gain scheduling (GAIN_SCHED). Only uses config.h, so it also builds on the host.
+//
+// One PI tuning is a compromise over the speed range: at high speed the field weakening current and the back-EMF change
+// the plant, and the speed loop sees a different load than at standstill. The GAIN_SCHED_* tables give a scale [%] of
+// each gain at the GAIN_SCHED_N speeds, linear in between and held beyond the ends. The controller outputs a voltage
+// relative to the battery voltage, so the current loop gain of the plant grows with it: with GAIN_SCHED_VBAT set, the
+// current loop gains are also scaled by GAIN_SCHED_VBAT / battery voltage, which keeps its bandwidth.
+// The base gains are the rtP values at init. A gain changed by someone else since the last step (the motor
+// identification) is taken as the new base, the schedule then applies on top of it.
+
+#include <stdint.h>
+#include "config.h"
+#include "gainsched.h"
+#include "ramfunc.h"
+
+#if defined(GAIN_SCHED)
+
+#define GS_POINTS               (sizeof(gsSpeed) / sizeof(gsSpeed[0]))
+
+static const int16_t  gsSpeed[] RAMCONST = GAIN_SCHED_N;         // [rpm]
+static const uint16_t gsIKp[]   RAMCONST = GAIN_SCHED_I_KP;      // [%]
+static const uint16_t gsIKi[]   RAMCONST = GAIN_SCHED_I_KI;
+static const uint16_t gsNKp[]   RAMCONST = GAIN_SCHED_N_KP;
+static const uint16_t gsNKi[]   RAMCONST = GAIN_SCHED_N_KI;
+static const uint16_t *const gsTab[GS_GAINS] RAMCONST = {gsIKp, gsIKi, gsIKp, gsIKi, gsNKp, gsNKi};  // d axis as q axis
+
+_Static_assert(sizeof(gsIKp) == sizeof(gsSpeed) && sizeof(gsIKi) == sizeof(gsSpeed) &&
+               sizeof(gsNKp) == sizeof(gsSpeed) && sizeof(gsNKi) == sizeof(gsSpeed),
+               "GAIN_SCHED_I_KP, _I_KI, _N_KP and _N_KI need one entry per GAIN_SCHED_N speed");
+
+void gainSchedInit(GainSched *g, uint16_t *const gain[GS_GAINS]) {
+  for (uint8_t k = 0; k < GS_GAINS; k++) {
+    g->base[k]  = *gain[k];
+    g->out[k]   = *gain[k];
+    g->scale[k] = 100;
+  }
+}
+
+/* Table k at the speed magnitude nAbs [rpm], [%] */
+RAMFUNC static uint16_t gsLookup(uint8_t k, int16_t nAbs) {
+  if (nAbs <= gsSpeed[0]) {
+    return gsTab[k][0];
+  }
+  for (uint8_t i = 1; i < GS_POINTS; i++) {
+    if (nAbs < gsSpeed[i]) {
+      int32_t d = gsTab[k][i] - gsTab[k][i - 1];
+      return (uint16_t)(gsTab[k][i - 1] + d * (nAbs - gsSpeed[i - 1]) / (gsSpeed[i] - gsSpeed[i - 1]));
+    }
+  }
+  return gsTab[k][GS_POINTS - 1];
+}
+
+/* One update of the gains of a motor, n its speed [rpm], vBat the battery voltage [V*100] */
+RAMFUNC void gainSchedStep(GainSched *g, uint16_t *const gain[GS_GAINS], int16_t n, int16_t vBat) {
+  int16_t  nAbs = (n < 0) ? -n : n;
+  uint32_t vFac = 65536;                // [Q16] current loop battery voltage factor
+  #if GAIN_SCHED_VBAT > 0
+  if (vBat > GAIN_SCHED_VBAT / 2) {     // a missing or unsettled measurement must not double the gains
+    vFac = ((uint32_t)GAIN_SCHED_VBAT << 16) / (uint16_t)vBat;
+  }
+  #else
+  (void)vBat;
+  #endif
+
+  for (uint8_t k = 0; k < GS_GAINS; k++) {
+    uint32_t v;
+    if (*gain[k] != g->out[k]) {
+      g->base[k] = *gain[k];            // written by someone else since the last step
+    }
+    g->scale[k] = gsLookup(k, nAbs);
+    v = (uint32_t)g->base[k] * g->scale[k] / 100;
+    if (k < GS_N_KP) {
+      v = (uint32_t)(((uint64_t)v * vFac) >> 16);
+    }
+    v = (v < 1) ? 1 : (v > 0xFFFF ? 0xFFFF : v);
+    *gain[k]  = (uint16_t)v;
+    g->out[k] = (uint16_t)v;
+  }
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Hall sensor placement calibration (HALL_CALIB). Only uses config.h and the controller tables, so it also builds on the host.
+//
+// The motor is turned by a rotating voltage vector of HALL_CALIB_VOLT at HALL_CALIB_SPEED, first forward, then backward.
+// The rotor lags the field by the load angle: forward edges come at true edge angle + load angle, backward ones at
+// true edge angle - load angle, so the mean of both directions is the true edge angle (also cancels the sensor hysteresis).
+// Each direction runs n_polePairs + 1 electrical turns, the first turn is not used, so every edge is averaged over one
+// mechanical turn. The controller angle estimation assumes the edge into position k at k * 60 deg. corr[k] is the
+// measured edge angle minus that, with the mean removed: the overall hall to rotor alignment is not changed.
+
+#include <stdint.h>
+#include "config.h"
+#include "BLDC_controller.h"
+#include "hallcal.h"
+
+#if defined(HALL_CALIB)
+
+#define HALL_CAL_RAMP_TICKS     (PWM_FREQ / 2)                    // [ticks] voltage ramp up at angle 0, then the same time of alignment
+#define HALL_CAL_STOP_TICKS     (PWM_FREQ / 4)                    // [ticks] voltage ramp down
+#define HALL_CAL_SKIP_EDGES     6                                 // [-] edges not used at the start of each direction
+
+void hallCalStart(HallCal *c, uint8_t hall, uint8_t polePairs) {
+  for (uint8_t k = 0; k < 6; k++) {
+    c->sum[0][k] = c->sum[1][k] = 0;
+    c->cnt[0][k] = c->cnt[1][k] = 0;
+    c->corr[k]   = 0;
+  }
+  c->angle = 0;
+  c->step  = (uint32_t)(((uint64_t)HALL_CALIB_SPEED * polePairs << 32) / (60ULL * PWM_FREQ));
+  c->ticks = 0;
+  c->ref   = 0;
+  c->edges = 0;
+  c->turns = polePairs + 1;
+  c->skip  = HALL_CAL_SKIP_EDGES;
+  c->pos   = rtConstP.vec_hallToPos_Value[((hall & 1) << 2) | (hall & 2) | (hall >> 2)];
+  c->dir   = 0;
+  c->state = HALL_CAL_ALIGN;
+}
+
+/* One hall edge seen while the field turns in direction rev (0 = forward). pos is the new controller position */
+static void hallCalEdge(HallCal *c, int8_t pos, uint8_t rev) {
+  int8_t  step = (int8_t)((pos - c->pos + 6) % 6);
+  int8_t  s, field = rev ? -1 : 1;
+  uint8_t k;
+  int16_t e;
+
+  if (step != 1 && step != 5) {
+    return;                             // a position was skipped: noise or a bad sensor, the edge angle is unknown
+  }
+  s = step == 1 ? 1 : -1;
+  if (c->dir == 0) {
+    c->dir = s * field;
+  }
+  if (s != c->dir * field) {
+    return;                             // the rotor stepped back (cogging), only edges in the field direction are used
+  }
+  c->edgeTicks = c->ticks;
+  if (c->skip) {
+    c->skip--;
+    return;
+  }
+  k = (uint8_t)(s > 0 ? pos : c->pos);  // edge into position k from below, in the controller direction
+  e = (int16_t)((uint16_t)(c->dir * (int32_t)(c->angle >> 16)) - (uint16_t)(k * 65536 / 6));
+  if (c->edges++ == 0) {
+    c->ref = e;
+  }
+  c->sum[rev][k] += (int16_t)(e - c->ref);
+  c->cnt[rev][k]++;
+}
+
+/* Mean of both directions per edge, minus the mean of all edges. 0 if an edge was not seen often enough or is implausible */
+static uint8_t hallCalResult(HallCal *c) {
+  int32_t r[6], mean = 0;
+  for (uint8_t k = 0; k < 6; k++) {
+    if (c->cnt[0][k] < c->turns - 2 || c->cnt[1][k] < c->turns - 2) {
+      return 0;
+    }
+    r[k]  = (c->sum[0][k] / c->cnt[0][k] + c->sum[1][k] / c->cnt[1][k]) / 2;
+    mean += r[k];
+  }
+  mean /= 6;
+  for (uint8_t k = 0; k < 6; k++) {
+    int32_t d = (r[k] - mean) * 45 / 128;                         // 2^16 per turn to deg*64
+    if (d > HALL_CAL_CORR_MAX || d < -HALL_CAL_CORR_MAX) {
+      return 0;
+    }
+    c->corr[k] = (int16_t)d;
+  }
+  return 1;
+}
+
+/* Open loop three phase output of amplitude amp [-1000, 1000] at the field angle, same tables as the SIN method */
+static void hallCalOutput(const HallCal *c, int16_t amp, int16_t dc[3]) {
+  const int16_T *tab[3] = {rtConstP.r_sin3PhaA_M1_Table, rtConstP.r_sin3PhaB_M1_Table, rtConstP.r_sin3PhaC_M1_Table};
+  uint32_t x    = (c->angle >> 16) * 180;                         // 2 deg table steps, Q16
+  uint8_t  i    = (uint8_t)(x >> 16);
+  int32_t  frac = (int32_t)(x & 0xFFFF);
+  for (uint8_t k = 0; k < 3; k++) {
+    int32_t v = tab[k][i] + (((tab[k][i + 1] - tab[k][i]) * frac) >> 16);
+    dc[k] = (int16_t)((amp * v) >> 14);
+  }
+}
+
+/* One control tick. hall is the sensor state (bit 0 = A), dc the duties to apply in the rtY.DC_pha* range.
+ * Returns 1 while the calibration drives the motor */
+uint8_t hallCalStep(HallCal *c, uint8_t hall, int16_t dc[3]) {
+  uint32_t turnTicks = 0xFFFFFFFFUL / c->step;
+  int16_t  amp       = HALL_CALIB_VOLT;
+  int8_t   pos       = c->pos;
+
+  if (c->state < HALL_CAL_ALIGN || c->state > HALL_CAL_STOP) {
+    return 0;
+  }
+  if (hall != 0 && hall != 7) {
+    pos = rtConstP.vec_hallToPos_Value[((hall & 1) << 2) | (hall & 2) | (hall >> 2)];
+  }
+  c->ticks++;
+  switch (c->state) {
+    case HALL_CAL_ALIGN:
+      if (c->ticks < HALL_CAL_RAMP_TICKS) {
+        amp = (int16_t)(HALL_CALIB_VOLT * (int32_t)c->ticks / HALL_CAL_RAMP_TICKS);
+      } else if (c->ticks >= 2 * HALL_CAL_RAMP_TICKS) {
+        c->state = HALL_CAL_FWD;
+        c->ticks = c->edgeTicks = 0;
+      }
+      break;
+    case HALL_CAL_FWD:
+    case HALL_CAL_REV:
+      c->angle += c->state == HALL_CAL_FWD ? c->step : -c->step;
+      if (pos != c->pos) {
+        hallCalEdge(c, pos, c->state == HALL_CAL_REV);
+      }
+      if (c->ticks - c->edgeTicks > 2 * turnTicks) {
+        c->state = HALL_CAL_FAIL;       // the rotor does not follow: blocked, HALL_CALIB_VOLT too low or hall fault
+        return 0;
+      }
+      if (c->ticks >= c->turns * turnTicks) {
+        c->state = c->state == HALL_CAL_FWD ? HALL_CAL_REV : HALL_CAL_STOP;
+        c->ticks = c->edgeTicks = 0;
+        c->skip  = HALL_CAL_SKIP_EDGES;
+      }
+      break;
+    default:                            // HALL_CAL_STOP
+      amp = (int16_t)(HALL_CALIB_VOLT * (int32_t)(HALL_CAL_STOP_TICKS - c->ticks) / HALL_CAL_STOP_TICKS);
+      if (c->ticks >= HALL_CAL_STOP_TICKS) {
+        c->state = hallCalResult(c) ? HALL_CAL_DONE : HALL_CAL_FAIL;
+        return 0;
+      }
+      break;
+  }
+  c->pos = pos;
+  hallCalOutput(c, amp, dc);
+  return 1;
+}
+
+#endif
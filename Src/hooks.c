@@ -0,0 +1,52 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Control interrupt hooks (CTRL_HOOKS). Only uses config.h, so it also builds on the host.
+//
+// The table is fixed at build time from hooks.def, nothing is registered at run time. bldc.c calls the hooks of a
+// stage in table order, per motor: the pre-step hooks after all inputs of the controller step are set (the hooks see
+// and may change the final mode, target and current limit), the post-step hooks after the duties of the controller
+// and of the calibrations (they see what would be applied, DC_FOLDBACK and the dead time compensation still follow).
+// Each run is timed with the cycle counter, interrupts of a higher priority included. The first run over the budget
+// switches the hook off: a hook that is late once is late again, and the control interrupt has no time to spare.
+// "$HOOKS" prints the table with the runtimes and restarts all hooks.
+
+#include <stdint.h>
+#include "config.h"
+#include "hooks.h"
+#include "ramfunc.h"
+
+#if defined(CTRL_HOOKS)
+
+#define HOOK(stage, motors, fn, budget, name) {fn, (budget) ? (budget) : CTRL_HOOK_BUDGET, stage, motors, name},
+const CtrlHookDef ctrlHookDefs[CTRL_HOOK_COUNT + 1] RAMCONST = {
+#include "hooks.def"
+  {0}                                   // keeps the table valid without hooks
+};
+CtrlHookStat     ctrlHookStats[CTRL_HOOK_COUNT + 1];
+volatile uint8_t ctrlHookRst;
+
+/* Control interrupt, on ctrlHookRst: statistics cleared, all hooks on again */
+RAMFUNC void ctrlHookReset(void) {
+  for (uint8_t i = 0; i < CTRL_HOOK_COUNT; i++) {
+    ctrlHookStats[i].last = ctrlHookStats[i].max = ctrlHookStats[i].over = 0;
+    ctrlHookStats[i].runs = 0;
+  }
+  ctrlHookRst = 0;
+}
+
+#endif
@@ -0,0 +1,161 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Input to PWM latency measurement (LATENCY_MEAS). Only uses config.h, so it also builds on the host.
+//
+// One tag at a time is in flight:
+// - latInput, main loop after the input read: once the selected input moved by LATENCY_STEP from the values of the
+//   last tag, and the outputs were steady in the last step, the sample time of the new values becomes the tag.
+//   The sample time is the receive or capture time where the producer keeps one (serial frames, PPM, PWM), else the
+//   time of the read. The ADC inputs are taken after ADC_INPUT_FILT, its delay is not in the numbers. Through the
+//   rate limiter and the low pass the first effect of a step is in the same main loop step, so the tag follows the
+//   command to the mixer.
+// - latOutput, after pwml / pwmr are set: a tag whose input change did not move the command (deadband) is dropped
+//   at once, else the first change of the outputs since the tag hands it to the control interrupt. Steady outputs
+//   before the tag make sure the change is caused by it.
+// - the control interrupt stamps the tick that stepped the controllers with these outputs (latApplied). The duties
+//   it writes take effect at the next timer update, up to one PWM period later.
+// - the next latInput adds the latency to the histogram of the input index and updates its percentiles.
+// A tag that has not reached the duties after LATENCY_TIMEOUT ms (motors off and the outputs held at 0) is dropped.
+
+#include <stdint.h>
+#include "config.h"
+#include "latency.h"
+
+#if defined(LATENCY_MEAS)
+
+#define LAT_BIN_SHIFT           4                                 // [-] 16 us resolution of the first bins
+
+void latReset(LatMeas *l) {
+  for (uint8_t s = 0; s < LAT_SRCS; s++) {
+    LatStat *t = &l->stat[s];
+    for (uint8_t b = 0; b < LAT_BINS; b++) {
+      t->hist[b] = 0;
+    }
+    t->n    = 0;
+    t->drop = 0;
+    t->p50  = t->p90 = t->p99 = t->max = 0;
+  }
+}
+
+/* Histogram bin of us: 16 us wide below 64 us, then 4 bins per octave */
+static uint8_t latBin(uint32_t us) {
+  uint32_t x = us >> LAT_BIN_SHIFT;
+  uint8_t  e = 2;
+  if (x < 4) {
+    return (uint8_t)x;
+  }
+  while ((x >> (e + 1)) != 0) {
+    e++;
+  }
+  x = 4 * (e - 1) + ((x >> (e - 2)) & 3);
+  return (uint8_t)(x < LAT_BINS ? x : LAT_BINS - 1);
+}
+
+/* [us] lower edge of a bin */
+uint32_t latBinLow(uint8_t bin) {
+  if (bin < 4) {
+    return (uint32_t)bin << LAT_BIN_SHIFT;
+  }
+  return (uint32_t)(4 + (bin & 3)) << (bin / 4 - 1) << LAT_BIN_SHIFT;
+}
+
+/* [us] upper edge of the bin that holds pct % of the samples, the max for the last bin */
+static uint16_t latPercentile(const LatStat *t, uint32_t total, uint8_t pct) {
+  uint32_t need = (total * pct + 99) / 100, sum = 0;
+  for (uint8_t b = 0; b < LAT_BINS - 1; b++) {
+    sum += t->hist[b];
+    if (sum >= need) {
+      uint32_t hi = latBinLow(b + 1);
+      return (uint16_t)(hi < t->max ? hi : t->max);
+    }
+  }
+  return t->max;
+}
+
+static void latAdd(LatStat *t, uint32_t us) {
+  uint8_t  bin = latBin(us);
+  uint32_t total = 0;
+  if (t->hist[bin] == UINT16_MAX) {     // keep the shape, the older samples weigh half
+    for (uint8_t b = 0; b < LAT_BINS; b++) {
+      t->hist[b] >>= 1;
+    }
+  }
+  t->hist[bin]++;
+  t->n++;
+  if (us > t->max) {
+    t->max = (uint16_t)(us < UINT16_MAX ? us : UINT16_MAX);
+  }
+  for (uint8_t b = 0; b < LAT_BINS; b++) {
+    total += t->hist[b];
+  }
+  t->p50 = latPercentile(t, total, 50);
+  t->p90 = latPercentile(t, total, 90);
+  t->p99 = latPercentile(t, total, 99);
+}
+
+/* Main loop, after the input read: values in1, in2 of the selected input src, sampled at sampleUs, now = timeUs() */
+void latInput(LatMeas *l, uint8_t src, int16_t in1, int16_t in2, uint32_t sampleUs, uint32_t now) {
+  if (src >= LAT_SRCS) {
+    return;
+  }
+  if (l->state == LAT_APPLIED) {
+    latAdd(&l->stat[l->src], l->applyUs - l->tagUs);
+    l->state = LAT_IDLE;
+  } else if (l->state != LAT_IDLE && now - l->tagUs > LATENCY_TIMEOUT * 1000UL) {
+    l->state = LAT_IDLE;                // the control interrupt may still take it: no race, it only sets LAT_APPLIED
+    l->stat[l->src].drop++;
+  }
+  if (l->state != LAT_IDLE) {
+    return;
+  }
+  if (src != l->src) {                  // input switched: new reference, no tag
+    l->src    = src;
+    l->ref[0] = in1;
+    l->ref[1] = in2;
+    return;
+  }
+  if (l->steady && (in1 - l->ref[0] >= LATENCY_STEP || l->ref[0] - in1 >= LATENCY_STEP ||
+                    in2 - l->ref[1] >= LATENCY_STEP || l->ref[1] - in2 >= LATENCY_STEP)) {
+    l->ref[0]   = in1;
+    l->ref[1]   = in2;
+    l->tagUs    = sampleUs;
+    l->cmdMoved = 0;
+    l->state    = LAT_INPUT;
+  }
+}
+
+/* Main loop, after the outputs pwml, pwmr are set from the commands cmd1, cmd2 of the selected input */
+void latOutput(LatMeas *l, int16_t cmd1, int16_t cmd2, int16_t pwmL, int16_t pwmR) {
+  uint8_t changed = pwmL != l->out[0] || pwmR != l->out[1];
+  if (l->state == LAT_INPUT && !l->cmdMoved) {
+    if (cmd1 == l->cmd[0] && cmd2 == l->cmd[1]) {
+      l->state = LAT_IDLE;              // the change stayed in the deadband: nothing to follow
+    }
+    l->cmdMoved = 1;
+  }
+  if (l->state == LAT_INPUT && changed) {
+    l->state = LAT_OUTPUT;
+  }
+  l->steady = !changed;
+  l->cmd[0] = cmd1;
+  l->cmd[1] = cmd2;
+  l->out[0] = pwmL;
+  l->out[1] = pwmR;
+}
+
+#endif
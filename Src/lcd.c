@@ -0,0 +1,202 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "setup.h"
+#include "timebase.h"
+#include "config.h"
+#include "lcd.h"
+
+#if defined(DEBUG_I2C_LCD) || defined(SUPPORT_LCD)
+#include "hd44780.h"
+
+extern LCD_PCF8574_HandleTypeDef lcd;
+
+#if defined(LCD_ASYNC)
+// One transfer: RS low, address command, RS high, then 4 port writes per character
+#define LCD_TX_SIZE             (1 + 4 + 1 + 4 * LCD_COLS)
+
+static char     lcdText[LCD_ROWS][LCD_COLS];  // wanted content, written by the main loop
+static char     lcdSent[LCD_ROWS][LCD_COLS];  // content on the display, 0 = unknown
+static uint8_t  lcdX, lcdY;                   // cursor for the next write
+static uint8_t  lcdTx[LCD_TX_SIZE];
+static uint8_t  lcdTxRow, lcdTxCol, lcdTxLen; // cells of the transfer in flight
+static volatile uint8_t lcdBusy;
+
+/* PCF8574 port value for a nibble on D4..D7, backlight kept as set by LCD_Init */
+static uint8_t lcdPort(uint8_t nibble, uint8_t rs, uint8_t e) {
+  uint8_t port = lcd.state & (1 << lcd.pins[LCD_PIN_LED]);
+  for (uint8_t i = 0; i < 4; i++) {
+    if (nibble & (1 << i)) {
+      port |= 1 << lcd.pins[LCD_PIN_D4 + i];
+    }
+  }
+  if (rs) { port |= 1 << lcd.pins[LCD_PIN_RS]; }
+  if (e)  { port |= 1 << lcd.pins[LCD_PIN_E]; }
+  return port;
+}
+
+/* The HD44780 latches each nibble on the falling edge of E */
+static uint8_t lcdPutByte(uint8_t n, uint8_t val, uint8_t rs) {
+  lcdTx[n++] = lcdPort(val >> 4,  rs, 1);
+  lcdTx[n++] = lcdPort(val >> 4,  rs, 0);
+  lcdTx[n++] = lcdPort(val & 0xF, rs, 1);
+  lcdTx[n++] = lcdPort(val & 0xF, rs, 0);
+  return n;
+}
+
+static void lcdWriteChar(char c) {
+  if (lcdX < LCD_COLS && lcdY < LCD_ROWS) {
+    lcdText[lcdY][lcdX] = c;
+  }
+  lcdX++;
+}
+
+static uint8_t lcdPending(void) {
+  return memcmp(lcdText, lcdSent, sizeof(lcdText)) != 0;
+}
+
+void lcdInit(void) {
+  memset(lcdText, ' ', sizeof(lcdText));
+  memset(lcdSent, 0, sizeof(lcdSent));   // content unknown, repaint everything
+  lcdX = lcdY = 0;
+  lcdBusy = 0;
+}
+
+/* No clear command: its 1.5 ms execution time would stall the next transfer */
+void lcdClear(void) {
+  memset(lcdText, ' ', sizeof(lcdText));
+  lcdX = lcdY = 0;
+}
+
+void lcdSetLocation(uint8_t x, uint8_t y) {
+  lcdX = x;
+  lcdY = y;
+}
+
+void lcdWriteString(const char *s) {
+  while (*s) {
+    lcdWriteChar(*s++);
+  }
+}
+
+/*
+ * Start one DMA transfer with the changed cells of the first row that has any.
+ * A full row is 70 bytes, 3.2 ms at 200 kHz, so the bus is free again before the
+ * next control task runs.
+ */
+void lcdTask(void) {
+  uint8_t row, first, last, n;
+
+  if (lcdBusy || LCDerrorFlag) {
+    return;
+  }
+  for (row = 0; row < LCD_ROWS; row++) {
+    for (first = 0; first < LCD_COLS && lcdText[row][first] == lcdSent[row][first]; first++);
+    if (first < LCD_COLS) {
+      break;
+    }
+  }
+  if (row == LCD_ROWS) {
+    return;
+  }
+  for (last = LCD_COLS - 1; lcdText[row][last] == lcdSent[row][last]; last--);
+
+  n = 0;
+  lcdTx[n++] = lcdPort(0, 0, 0);
+  n = lcdPutByte(n, 0x80 | (0x40 * row + first), 0);  // set DDRAM address
+  lcdTx[n++] = lcdPort(0, 1, 0);
+  for (uint8_t col = first; col <= last; col++) {
+    n = lcdPutByte(n, (uint8_t)lcdText[row][col], 1);
+  }
+
+  lcdTxRow = row;
+  lcdTxCol = first;
+  lcdTxLen = last - first + 1;
+  memcpy(&lcdSent[row][first], &lcdText[row][first], lcdTxLen);
+  lcdBusy  = 1;
+  if (HAL_I2C_Master_Transmit_DMA(&hi2c2, (lcd.pcf8574.PCF_I2C_ADDRESS << 1) | PCF8574_I2C_ADDRESS_MASK, lcdTx, n) != HAL_OK) {
+    memset(&lcdSent[row][first], 0, lcdTxLen);
+    lcdBusy = 0;
+  }
+}
+
+/* Push everything now, for the messages shown right before a power off */
+void lcdFlush(void) {
+  uint32_t start = timeMs();
+  while (!LCDerrorFlag && (lcdBusy || lcdPending()) && timeMs() - start < 100) {
+    lcdTask();
+  }
+}
+
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c) {
+  lcdBusy = 0;
+}
+
+/* Same as the blocking driver: a failed write disables the LCD */
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+  memset(&lcdSent[lcdTxRow][lcdTxCol], 0, lcdTxLen);
+  LCDerrorFlag = 1;
+  lcdBusy = 0;
+}
+
+#else
+
+void lcdInit(void) {}
+
+void lcdClear(void) {
+  LCD_ClearDisplay(&lcd);
+  HAL_Delay(5);
+}
+
+void lcdSetLocation(uint8_t x, uint8_t y) {
+  LCD_SetLocation(&lcd, x, y);
+}
+
+void lcdWriteString(const char *s) {
+  LCD_WriteString(&lcd, (char *)s);
+}
+
+void lcdTask(void) {}
+
+void lcdFlush(void) {}
+
+#endif
+
+/* value / 10^digits with digits decimals, the format of LCD_WriteFloat without its soft float math. The caller rounds */
+void lcdWriteFixed(int32_t value, uint8_t digits) {
+  char     buf[14];
+  uint8_t  i = sizeof(buf) - 1;
+  uint8_t  k = 0;
+  uint32_t n = (value < 0) ? -(uint32_t)value : (uint32_t)value;
+  buf[i] = 0;
+  do {
+    if (k == digits && k > 0) {
+      buf[--i] = '.';
+    }
+    buf[--i] = '0' + n % 10;
+    n /= 10;
+    k++;
+  } while (n || k <= digits);
+  if (value < 0) {
+    buf[--i] = '-';
+  }
+  lcdWriteString(&buf[i]);
+}
+#endif
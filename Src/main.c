@@ -22,21 +22,37 @@
 
 #include <stdio.h>
 #include <stdlib.h> // for abs()
+#include <string.h>
 #include "stm32f1xx_hal.h"
 #include "bldc.h"
 #include "defines.h"
 #include "setup.h"
+#include "timebase.h"
+#include "stackmon.h"
 #include "config.h"
 #include "util.h"
 #include "BLDC_controller.h"      /* BLDC's header file */
+#include "BLDC_controller_data.h"
 #include "rtwtypes.h"
 #include "comms.h"
 #include "control.h"
 #include "crc32.h"
+#include "protocol.h"
+#include "sched.h"
+#include "trace.h"
+#include "rtt.h"
+#include "mcu.h"
+#include "balance.h"
+#include "eff.h"
+#if defined(VARIANT_BENCH)
+#include "bench.h"
+#endif
 
 #if defined(DEBUG_I2C_LCD) || defined(SUPPORT_LCD)
 #include "hd44780.h"
+#include "lcd.h"
 #endif
+#include "print.h"
 
 void SystemClock_Config(void);
 
@@ -46,27 +62,12 @@ void SystemClock_Config(void);
 
 
 
-
-volatile uint8_t uart_buf[200];
-
 //---------------
 #ifdef CONTROL_ADC
   #define ADC_MID 2048
   #define THROTTLE_MAX 1000
   #define ADC_MAX 4095
   #define DEAD_ZONE 64
-  #define VAL_CNT 2
-  #define BUFFERSIZE 256  
-uint32_t index_buff_vals[VAL_CNT];
-uint32_t buff_vals[VAL_CNT][BUFFERSIZE];
-uint32_t cur_buff_val_sum[VAL_CNT];
-uint32_t value_buffer(uint32_t in, int val)
-{
-  cur_buff_val_sum[val] -= buff_vals[val][index_buff_vals[val]];
-  cur_buff_val_sum[val] += (buff_vals[val][index_buff_vals[val]] = in);
-  index_buff_vals[val] = (index_buff_vals[val] + 1) % (BUFFERSIZE);
-  return (cur_buff_val_sum[val] / (BUFFERSIZE));
-}
 
 int clean_adc_full(uint32_t inval)
 {
@@ -91,15 +92,26 @@ int clean_adc_half(uint32_t inval)
   return outval * (THROTTLE_MAX / 2) / (ADC_MAX - DEAD_ZONE * 3);
 }
 
-int PowXplusX(int cleaned_adc,int maximum_value)
-{
-  return ((cleaned_adc * cleaned_adc / maximum_value) * 2 * SIGN(cleaned_adc) * SIGN(maximum_value)  + cleaned_adc) / 3;
-}
-
 #endif
 
 
 
+// Multiply-shift forms of the constant scalings in the main loop and the monitor task, fixdt(1,32,16)
+#define SPEED_BLEND_RCP   RCP16(1 << 15, 50)                            // speedBlend: rpm above 10 to fixdt(0,16,15), 1.0 at 60 rpm
+#define DC_CURR_RCP       RCP16(100, A2BIT_CONV)                        // ADC bits to A * 100
+#define BAT_CALIB_RCP     RCP16(BAT_CALIB_REAL_VOLTAGE, BAT_CALIB_ADC)  // ADC bits to V * 100
+#if defined(VBAT_COMP)
+#define CTRL_VBAT         VBAT_COMP_NOM                                // [V*100] battery voltage the controller outputs are in
+#else
+#define CTRL_VBAT         batVoltageCalib
+#endif
+#if defined(WINDING_TEMP)
+#define WTEMP_HOT         MAX(wtemp[0].temp, wtemp[1].temp)            // [degC*10] hotter winding, derated above WTEMP_START
+#else
+#define WTEMP_HOT         0
+#endif
+#define TEMP_CAL_SLOPE    ((int32_t)(((int64_t)(TEMP_CAL_HIGH_DEG_C - TEMP_CAL_LOW_DEG_C) << 16) / (TEMP_CAL_HIGH_ADC - TEMP_CAL_LOW_ADC)))  // deg C * 10 per ADC bit
+
 //------------------------------------------------------------------------
 // Global variables set here in main.c
 //------------------------------------------------------------------------
@@ -107,6 +119,9 @@ uint8_t backwardDrive;
 volatile uint32_t main_loop_counter;
 int16_t batVoltageCalib;         // global variable for calibrated battery voltage
 int16_t board_temp_deg_c;        // global variable for calibrated temperature in degrees Celsius
+#if defined(ADC_TEMP_DECIM)
+int16_t adcVdda = 3300;          // global variable for the ADC supply voltage VDDA [mV], from VREFINT
+#endif
 int16_t left_dc_curr;            // global variable for Left DC Link current 
 int16_t right_dc_curr;           // global variable for Right DC Link current
 int16_t dc_curr;                 // global variable for Total DC Link current 
@@ -117,34 +132,40 @@ int16_t cmdR;                    // global variable for Right Command
 // Local variables
 //------------------------------------------------------------------------
 #if defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3)
-typedef struct{
-  uint16_t  start;
-  uint16_t   steps0;
-  uint16_t   steps1;
-  int16_t   speedR_meas;
-  int16_t   speedL_meas;
-  int16_t   batVoltage;
-  int16_t   boardTemp;
-  uint16_t  cmdLed;
-  uint16_t  checksumL;
-  uint16_t  checksumH;
-} SerialFeedback;
+typedef ProtoFeedback SerialFeedback;  // Wire format in protocol.h
 static SerialFeedback Feedback;
 #endif
-#if defined(FEEDBACK_SERIAL_USART2)
-static uint8_t sideboard_leds_L;
+#if defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3)
+static uint8_t sideboard_leds;
+#endif
+#if defined(FEEDBACK_COMPACT)
+typedef struct {
+  uint16_t sent[PROTO_FB_SLOW_N];       // slow field values last sent on the port
+  uint8_t  rr;                          // next slow field of the round robin
+} FeedbackCompact;
+#endif
+#if defined(FEEDBACK_COMPACT) && defined(CONTROL_SERIAL_USART2) && defined(FEEDBACK_SERIAL_USART2)
+static FeedbackCompact fbCompact_L;
 #endif
-#if defined(FEEDBACK_SERIAL_USART3)
-static uint8_t sideboard_leds_R;
+#if defined(FEEDBACK_COMPACT) && defined(CONTROL_SERIAL_USART3) && defined(FEEDBACK_SERIAL_USART3)
+static FeedbackCompact fbCompact_R;
+#endif
+#if defined(FEEDBACK_SERIAL_USART2) && defined(SIDEBOARD_SERIAL_USART2)
+static uint8_t  sideboard_ledsSent_L = 0xFF;              // LED state of the last frame to the sideboard, 0xFF = none yet
+static uint32_t sideboard_ledsTick_L;
+#endif
+#if defined(FEEDBACK_SERIAL_USART3) && defined(SIDEBOARD_SERIAL_USART3)
+static uint8_t  sideboard_ledsSent_R = 0xFF;
+static uint32_t sideboard_ledsTick_R;
 #endif
 
 #ifdef VARIANT_TRANSPOTTER
   uint8_t  nunchuk_connected;
 
   static uint8_t  checkRemote = 0;
-  static uint16_t distance;
-  static float    steering;
-  static int      distanceErr;  
+  static uint16_t distance;            // [ADC counts] gametrak cable length
+  static int16_t  steering;             // [-] gametrak angle, +-2048 = +-1
+  static int      distanceErr;          // [ADC counts]
   static int      lastDistance = 0;
   static uint16_t transpotter_counter = 0;
 #endif
@@ -152,28 +173,169 @@ static uint8_t sideboard_leds_R;
 static int16_t    speed;                // local variable for speed. -1000 to 1000
 #ifndef VARIANT_TRANSPOTTER
   static int16_t  steer;                // local variable for steering. -1000 to 1000
+  #ifndef USE_RAW_INPUT
   static int16_t  steerRateFixdt;       // local fixed-point variable for steering rate limiter
   static int16_t  speedRateFixdt;       // local fixed-point variable for speed rate limiter
+  #endif
   static int32_t  steerFixdt;           // local fixed-point variable for steering low-pass filter
   static int32_t  speedFixdt;           // local fixed-point variable for speed low-pass filter
+  #if defined(SPD_REF_GEN)
+  static RefGen   steerRef;             // SPD_MODE steering reference, replaces the rate limiter and filter
+  static RefGen   speedRef;             // SPD_MODE speed reference
+  #endif
 #endif
 
-static uint32_t    buzzerTimer_prev = 0;
 static uint32_t    inactivity_timeout_counter;
+static int32_t     board_temp_adcFixdt; // Board temperature filter state, fixdt(1,32,16)
+static int16_t     board_temp_adcFilt;  // Filtered board temperature ADC value
+#if defined(ADC_TEMP_DECIM)
+static int32_t     adc_vrefFixdt = (ADC_VREFINT_MV * 4096 / 3300) << 16;  // VREFINT filter state, fixdt(1,32,16)
+#endif
 static MultipleTap MultipleTapBrake;    // define multiple tap functionality for the Brake pedal
 
-static uint16_t rate = RATE; // Adjustable rate to support multiple drive modes on startup
+#if !defined(USE_RAW_INPUT) || defined(MULTI_MODE_DRIVE)
+static uint16_t rate   = RATE;   // Adjustable rate to support multiple drive modes
+#endif
+#ifndef USE_RAW_INPUT
+static uint16_t filter = FILTER; // Adjustable filter to support multiple drive modes
+#endif
+
+#if defined(EFF_ESTIMATE)
+  Eff             eff;
+#endif
+
+#if defined(BALANCE_CONTROL)
+  Balance         balance_L;
+  Balance         balance_R;
+  static uint8_t  balanceActive;         // [-] 1 = pwml/pwmr are set by taskBalance
+#endif
 
 #ifdef MULTI_MODE_DRIVE
-  static uint8_t drive_mode;
+  DriveProfile driveProfiles[DRIVE_PROFILES] = {
+    {MULTI_MODE_DRIVE_M1_RATE, MULTI_MODE_DRIVE_M1_MAX, MULTI_MODE_M1_I_MOT_MAX, MULTI_MODE_M1_N_MOT_MAX, MULTI_MODE_M1_FILTER, MULTI_MODE_M1_FIELD_WEAK},
+    {MULTI_MODE_DRIVE_M2_RATE, MULTI_MODE_DRIVE_M2_MAX, MULTI_MODE_M2_I_MOT_MAX, MULTI_MODE_M2_N_MOT_MAX, MULTI_MODE_M2_FILTER, MULTI_MODE_M2_FIELD_WEAK},
+    {MULTI_MODE_DRIVE_M3_RATE, MULTI_MODE_DRIVE_M3_MAX, MULTI_MODE_M3_I_MOT_MAX, MULTI_MODE_M3_N_MOT_MAX, MULTI_MODE_M3_FILTER, MULTI_MODE_M3_FIELD_WEAK},
+  };
+  uint8_t         driveProfile;           // [-] active profile
+  uint8_t         driveProfileReq;        // [-] requested profile, taken over at standstill
+  static uint8_t  driveProfileDirty;      // [-] 1 = the values of a profile changed, apply again at standstill
   static uint16_t max_speed;
 #endif
 
+static void taskControl(void);
+static void taskSideboard(void);
+static void taskMonitor(void);
+#if defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3)
+static void taskFeedback(void);
+#endif
+#if defined(DEBUG_OUT)
+static void taskDebug(void);
+#endif
+#if defined(DEBUG_SERIAL_PROTOCOL) && defined(DEBUG_OUT)
+static void taskStream(void);
+static void taskCommand(void);
+#endif
+#if defined(BALANCE_CONTROL)
+static void taskBalance(void);
+#endif
+#ifdef MULTI_MODE_DRIVE
+static void driveProfileApply(uint8_t idx);
+static void driveProfileUpdate(void);
+#endif
+static void taskIdle(void) {}
+
+// Main loop task table: function, period [us], phase [control periods]. The phases spread the tasks over the control interrupts.
+SchedTask schedTasks[SCHED_TASKS] = {
+  [SCHED_TASK_CONTROL]   = {taskControl,    DELAY_IN_MAIN_LOOP      * SCHED_TICKS_PER_MS, 0},
+  [SCHED_TASK_SIDEBOARD] = {taskSideboard,  DELAY_IN_MAIN_LOOP      * SCHED_TICKS_PER_MS, 2},
+  [SCHED_TASK_MONITOR]   = {taskMonitor,    DELAY_IN_MAIN_LOOP      * SCHED_TICKS_PER_MS, 4},
+#if (defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3)) && defined(FEEDBACK_FAST)
+  [SCHED_TASK_FEEDBACK]  = {taskFeedback,   DELAY_IN_MAIN_LOOP      * SCHED_TICKS_PER_MS, 6},   // every 5 ms
+#elif defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3)
+  [SCHED_TASK_FEEDBACK]  = {taskFeedback,   DELAY_IN_MAIN_LOOP *  4 * SCHED_TICKS_PER_MS, 6},   // every 20 ms
+#else
+  [SCHED_TASK_FEEDBACK]  = {taskIdle,       DELAY_IN_MAIN_LOOP *  4 * SCHED_TICKS_PER_MS, 6},
+#endif
+#if defined(DEBUG_OUT)
+  [SCHED_TASK_DEBUG]     = {taskDebug,      DELAY_IN_MAIN_LOOP * 25 * SCHED_TICKS_PER_MS, 8},   // every 125 ms
+#else
+  [SCHED_TASK_DEBUG]     = {taskIdle,       DELAY_IN_MAIN_LOOP * 25 * SCHED_TICKS_PER_MS, 8},
+#endif
+#if defined(DEBUG_SERIAL_PROTOCOL) && defined(DEBUG_OUT)
+  [SCHED_TASK_STREAM]    = {taskStream,                              SCHED_TICKS_PER_MS, 1},   // every 1 ms, binary stream rate divider
+#else
+  [SCHED_TASK_STREAM]    = {taskIdle,                                SCHED_TICKS_PER_MS, 1},
+#endif
+#if defined(DEBUG_SERIAL_PROTOCOL) && defined(DEBUG_OUT)
+  [SCHED_TASK_COMMAND]   = {taskCommand,    DELAY_IN_MAIN_LOOP      * SCHED_TICKS_PER_MS, 3},   // drain the debug command queue
+#else
+  [SCHED_TASK_COMMAND]   = {taskIdle,       DELAY_IN_MAIN_LOOP      * SCHED_TICKS_PER_MS, 3},
+#endif
+#if defined(LCD_ASYNC)
+  [SCHED_TASK_LCD]       = {lcdTask,        DELAY_IN_MAIN_LOOP      * SCHED_TICKS_PER_MS, 5},   // push the changed LCD cells
+#else
+  [SCHED_TASK_LCD]       = {taskIdle,       DELAY_IN_MAIN_LOOP      * SCHED_TICKS_PER_MS, 5},
+#endif
+#if defined(BALANCE_CONTROL)
+  [SCHED_TASK_BALANCE]   = {taskBalance,                             SCHED_TICKS_PER_MS, 7},   // every 1 ms, torque targets to the motors
+#else
+  [SCHED_TASK_BALANCE]   = {taskIdle,                                SCHED_TICKS_PER_MS, 7},
+#endif
+#if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+  [SCHED_TASK_INPUTCAL]  = {inputCalTask,   DELAY_IN_MAIN_LOOP      * SCHED_TICKS_PER_MS, 9},   // input calibration modes
+#else
+  [SCHED_TASK_INPUTCAL]  = {taskIdle,       DELAY_IN_MAIN_LOOP      * SCHED_TICKS_PER_MS, 9},
+#endif
+};
+
+#if defined(BOOT_PROFILE)
+// Boot phases, timed with the DWT cycle counter from the start of main. Reset_Handler (.data and .ramfunc copy) is
+// not included. Each phase is converted with the core clock at its start, the clock phase runs mostly on the 8 MHz HSI
+enum { BOOT_HAL, BOOT_CLOCK, BOOT_PERIPH, BOOT_INIT, BOOT_CALIB, BOOT_BUTTON, BOOT_READY, BOOT_PHASES };
+static const char * const bootName[BOOT_PHASES] = {"hal", "clock", "periph", "init", "calib", "button", "ready"};
+static uint32_t bootUs[BOOT_PHASES];   // [us] duration of each phase
+static uint32_t bootLast;              // [cycles] end of the previous phase
+static uint32_t bootMhz;               // [MHz] core clock at the end of the previous phase
+
+static void bootMark(uint8_t phase) {
+  uint32_t now = DWT->CYCCNT;
+  bootUs[phase] = (now - bootLast) / bootMhz;
+  bootLast = now;
+  bootMhz  = SystemCoreClock / 1000000U;
+}
+
+// Time to ready is the sum of the phases without the wait for the power button release
+static void bootReport(void) {
+  uint32_t total = 0;
+  printf("Boot [us]:");
+  for (uint8_t i = 0; i < BOOT_PHASES; i++) {
+    printf(" %s:%lu", bootName[i], (unsigned long)bootUs[i]);
+    if (i != BOOT_BUTTON) total += bootUs[i];
+  }
+  printf("\r\nBoot ready in %lu ms, budget %u ms%s\r\n", (unsigned long)(total / 1000), BOOT_BUDGET,
+         total > BOOT_BUDGET * 1000UL ? " EXCEEDED" : "");
+}
+  #define BOOT_MARK(phase)  bootMark(phase)
+#else
+  #define BOOT_MARK(phase)
+#endif
+
 
 int main(void) {
 
+  stackPaint();       // first: nothing but main uses the stack yet
+  bldc_cycle_counter_init(); // Start the DWT cycle counter for boot profiling, control interrupt deadline monitoring and profiling
+  #if defined(BOOT_PROFILE)
+  bootMhz = SystemCoreClock / 1000000U;
+  #endif
   HAL_Init();
+  #if defined(FLASH_SAFE_WRITE)
+  flashSafeInit();    // vector table to SRAM, before the control interrupt is started
+  #endif
   __HAL_RCC_AFIO_CLK_ENABLE();
+  #if defined(SERIAL_HW_CRC)
+  __HAL_RCC_CRC_CLK_ENABLE();
+  #endif
   HAL_NVIC_SetPriorityGrouping(NVIC_PRIORITYGROUP_4);
   /* System interrupt init*/
   /* MemoryManagement_IRQn interrupt configuration */
@@ -187,466 +349,1213 @@ int main(void) {
   /* DebugMonitor_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DebugMonitor_IRQn, 0, 0);
   /* PendSV_IRQn interrupt configuration */
-  HAL_NVIC_SetPriority(PendSV_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(PendSV_IRQn, IRQ_PRIO_DEFERRED, 0);   // lowest priority: slow task (buzzer, battery filter) and serial frame processing
   /* SysTick_IRQn interrupt configuration */
-  HAL_NVIC_SetPriority(SysTick_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(SysTick_IRQn, IRQ_PRIO_SYSTICK, 0);
+  BOOT_MARK(BOOT_HAL);
 
   SystemClock_Config();
+  timeInit();         // timebase, before the first timeUs() / timeMs()
+  #if defined(TRACE_ITM)
+  traceInit();        // SWO at TRACE_SWO_BAUD, needs the final core clock
+  #endif
+  #if defined(DEBUG_RTT)
+  rttInit();          // debug channel in RAM, before the first printf
+  #endif
+  BOOT_MARK(BOOT_CLOCK);
 
   __HAL_RCC_DMA1_CLK_DISABLE();
   MX_GPIO_Init();
   MX_TIM_Init();
   MX_ADC1_Init();
   MX_ADC2_Init();
+  #if defined(ADC_INPUT_OVS)
+  MX_ADC3_Init();
+  #endif
+  BOOT_MARK(BOOT_PERIPH);
   BLDC_Init();        // BLDC Controller Init
+  #if defined(BALANCE_CONTROL)
+  balanceInit(&balance_L);
+  balanceInit(&balance_R);
+  #endif
 
   HAL_GPIO_WritePin(OFF_PORT, OFF_PIN, GPIO_PIN_SET);   // Activate Latch
   Input_Lim_Init();   // Input Limitations Init
   Input_Init();       // Input Init
+  BOOT_MARK(BOOT_INIT);
 
+  #if defined(VARIANT_BENCH)
+  benchRun();         // Cycle benchmark, does not return. The ADCs stay off, so the control interrupt does not run
+  #endif
+
+  #if defined(PARAM_STAGED)
+  bldc_param_commit();                // the first control tick switches the controllers to the staged parameters
+  #endif
   HAL_ADC_Start(&hadc1);
   HAL_ADC_Start(&hadc2);
+  #if defined(ADC_INPUT_OVS)
+  HAL_ADC_Start(&hadc3);
+  #endif
 
-  poweronMelody();
-  bldc_start_calibration();
+  #if defined(FAST_BOOT)
+    bldc_start_calibration();           // No melody: one beep, ready as soon as the ADC offsets are calibrated
+    beepShort(8);
+    uint32_t calibTick = timeMs();
+    while (!adcCalib.done && timeMs() - calibTick < FAST_BOOT_CALIB_TIMEOUT) {}
+    #if defined(SELF_TEST)
+    while (adcCalib.done && selfTest.state != SELF_TEST_DONE && timeMs() - calibTick < FAST_BOOT_CALIB_TIMEOUT) {}  // 15 ms of self-test pulses, unless the board was healthy
+    #endif
+  #elif defined(CALIBRATION_ADAPTIVE)
+    bldc_start_calibration();           // Calibrate the ADC offsets in the control interrupt while the melody plays
+    poweronMelody();
+    beepWait();
+  #else
+    poweronMelody();
+    beepWait();
+    bldc_start_calibration();
+  #endif
   HAL_GPIO_WritePin(LED_PORT, LED_PIN, GPIO_PIN_SET);
+  BOOT_MARK(BOOT_CALIB);
   
-  int32_t board_temp_adcFixdt = adc_buffer.temp << 16;  // Fixed-point filter output initialized with current ADC converted to fixed-point
-  int16_t board_temp_adcFilt  = adc_buffer.temp;
-
-  #ifdef CONTROL_ADC
-    for (int i = 0; i < VAL_CNT; i++)
-    {
-      cur_buff_val_sum[i] = index_buff_vals[i] = 0;
-      for (int j = 0; j < BUFFERSIZE; j++)
-        cur_buff_val_sum[i] += (buff_vals[i][j] = ADC_MID);
-    }
+  board_temp_adcFixdt = adc_buffer.temp << 16;  // Fixed-point filter output initialized with current ADC converted to fixed-point
+  board_temp_adcFilt  = adc_buffer.temp;
+  #if defined(ADC_TEMP_DECIM)
+  adc_vrefFixdt       = adc_buffer.vref << 16;
   #endif
 
   #ifdef MULTI_MODE_DRIVE
+    #ifdef VARIANT_HOVERCAR
     if (adc_buffer.l_tx2 > input1[0].min + 50 && adc_buffer.l_rx2 > input2[0].min + 50) {
-      drive_mode = 2;
-      max_speed = MULTI_MODE_DRIVE_M3_MAX;
-      rate = MULTI_MODE_DRIVE_M3_RATE;
-      rtP_Left.n_max = rtP_Right.n_max = MULTI_MODE_M3_N_MOT_MAX << 4;
-      rtP_Left.i_max = rtP_Right.i_max = (MULTI_MODE_M3_I_MOT_MAX * A2BIT_CONV) << 4;
+      driveProfileReq = 2;
     } else if (adc_buffer.l_tx2 > input1[0].min + 50) {
-      drive_mode = 1;
-      max_speed = MULTI_MODE_DRIVE_M2_MAX;
-      rate = MULTI_MODE_DRIVE_M2_RATE;
-      rtP_Left.n_max = rtP_Right.n_max = MULTI_MODE_M2_N_MOT_MAX << 4;
-      rtP_Left.i_max = rtP_Right.i_max = (MULTI_MODE_M2_I_MOT_MAX * A2BIT_CONV) << 4;
-    } else {
-      drive_mode = 0;
-      max_speed = MULTI_MODE_DRIVE_M1_MAX;
-      rate = MULTI_MODE_DRIVE_M1_RATE;
-      rtP_Left.n_max = rtP_Right.n_max = MULTI_MODE_M1_N_MOT_MAX << 4;
-      rtP_Left.i_max = rtP_Right.i_max = (MULTI_MODE_M1_I_MOT_MAX * A2BIT_CONV) << 4;
-    }
+      driveProfileReq = 1;
+    }                                   // else the profile of DRV_PROFILE, M1 if it was not saved
+    #endif
+    driveProfileApply(driveProfileReq < DRIVE_PROFILES ? driveProfileReq : 0);
 
-    printf("Drive mode %i selected: max_speed:%i acc_rate:%i \r\n", drive_mode, max_speed, rate);
+    printf("Drive mode %i selected: max_speed:%i acc_rate:%i \r\n", driveProfile, max_speed, rate);
   #endif
 
   // Loop until button is released
   while(HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) { HAL_Delay(10); }
 
-  #ifdef MULTI_MODE_DRIVE
+  #if defined(MULTI_MODE_DRIVE) && defined(VARIANT_HOVERCAR)
     // Wait until triggers are released. Exit if timeout elapses (to unblock if the inputs are not calibrated)
     int iTimeout = 0;
     while((adc_buffer.l_rx2 + adc_buffer.l_tx2) >= (input1[0].min + input2[0].min) && iTimeout++ < 300) {
       HAL_Delay(10);
     }
   #endif
+  BOOT_MARK(BOOT_BUTTON);
 
+  #if defined(BAT_SOC_ENABLE)
+    batSocLoad();                       // the battery voltage filter has settled during the power on melody
+  #endif
+  #if defined(CURRENT_DERATING)
+    derateInit(&derate, rtP_Left.i_max, board_temp_deg_c);
+  #endif
+  #if defined(DC_BUDGET)
+    dcBudgetInit(&dcBudget);
+  #endif
+  #if defined(WINDING_TEMP)
+    wtempInit(&wtemp[0]);
+    wtempInit(&wtemp[1]);
+  #endif
+  #if defined(REGEN_LIMIT)
+    regenInit(&regen);
+  #endif
+  #if defined(ANTILOCK_BRAKE)
+    antilockInit(&antilock);
+  #endif
+  #if defined(TRIP_STATS)
+    tripLoad();
+  #endif
+  #if defined(EFF_ESTIMATE)
+    effInit(&eff);
+  #endif
+  #if defined(GAIN_SCHED)
+    gainSchedStart();                   // after motIdLoad, the identified gains are the base
+  #endif
+
+  schedInit(schedTasks, SCHED_TASKS);
+  #if defined(BOOT_PROFILE)
+  bootMark(BOOT_READY);
+  bootReport();
+  #endif
   while(1) {
-    if (buzzerTimer - buzzerTimer_prev > 16*DELAY_IN_MAIN_LOOP) {   // 1 ms = 16 ticks buzzerTimer
-
-    readCommand();                        // Read Command: input1[inIdx].cmd, input2[inIdx].cmd
-    calcAvgSpeed();                       // Calculate average measured speed: speedAvg, speedAvgAbs
-
-    #ifndef VARIANT_TRANSPOTTER
-      // ####### MOTOR ENABLING: Only if the initial input is very small (for SAFETY) #######
-      if (enable == 0 && !rtY_Left.z_errCode && !rtY_Right.z_errCode && 
-          ABS(input1[inIdx].cmd) < 50 && ABS(input2[inIdx].cmd) < 50){
-        beepShort(6);                     // make 2 beeps indicating the motor enable
-        beepShort(4); HAL_Delay(100);
-        steerFixdt = speedFixdt = 0;      // reset filters
-        enable = 1;                       // enable motors
-        #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
-        printf("-- Motors enabled --\r\n");
-        #endif
-      }
+    schedRun(schedTasks, SCHED_TASKS);  // Run the released tasks, then sleep until the next interrupt
+  }
+}
 
-      // ####### VARIANT_HOVERCAR #######
-      #if defined(VARIANT_HOVERCAR) || defined(VARIANT_SKATEBOARD) || defined(ELECTRIC_BRAKE_ENABLE)
-        uint16_t speedBlend;                                        // Calculate speed Blend, a number between [0, 1] in fixdt(0,16,15)
-        speedBlend = (uint16_t)(((CLAMP(speedAvgAbs,10,60) - 10) << 15) / 50); // speedBlend [0,1] is within [10 rpm, 60rpm]
-      #endif
+#if defined(IDLE_POWER_SAVE)
+/* Idle power save: parked is no input, no command and no motion for IDLE_DELAY, with nothing running that needs the
+ * full control rate. An input ends it at the next control task, a hall edge at the next control interrupt (idleWake) */
+static void idleUpdate(void) {
+  static uint16_t parkedMs;             // [ms] time parked, saturated at IDLE_DELAY
+  uint8_t wake = idleWake;
+  uint8_t busy = ABS(input1[inIdx].cmd) > IDLE_THRES || ABS(input2[inIdx].cmd) > IDLE_THRES ||
+                 ABS(cmdL) > IDLE_THRES || ABS(cmdR) > IDLE_THRES || speedAvgAbs > 5 || wake ||
+                 !adcCalib.done || buzzerFreq || beepBusy() || buttonMode != BTN_MODE_NONE;
+  #if defined(HALL_CALIB)
+  busy |= (hallCal[0].state != HALL_CAL_IDLE && hallCal[0].state < HALL_CAL_DONE) ||
+          (hallCal[1].state != HALL_CAL_IDLE && hallCal[1].state < HALL_CAL_DONE);
+  #endif
+  #if defined(MOTOR_IDENT)
+  busy |= (motId[0].state != MOT_ID_IDLE && motId[0].state < MOT_ID_DONE) ||
+          (motId[1].state != MOT_ID_IDLE && motId[1].state < MOT_ID_DONE);
+  #endif
+  #if defined(COGGING_COMP)
+  busy |= (cogging[0].state != COG_IDLE && cogging[0].state < COG_DONE) ||
+          (cogging[1].state != COG_IDLE && cogging[1].state < COG_DONE);
+  #endif
+  #if defined(BALANCE_CONTROL)
+  busy |= balanceActive;
+  #endif
+  #if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+  busy |= holdReq != BLDC_HOLD_NONE;
+  #endif
+
+  if (busy) {
+    parkedMs = 0;
+  } else if (parkedMs < IDLE_DELAY) {
+    parkedMs += DELAY_IN_MAIN_LOOP;
+  }
+  idleReq = parkedMs >= IDLE_DELAY;
+  if (wake) {
+    idleWake = 0;
+  }
+}
+#endif
+
+#if defined(PWM_CARRIER_DOUBLE)
+/* PWM carrier: doubled at low speed against the whine, PWM_FREQ at speed and on a hot board. Both with hysteresis,
+ * the control interrupt makes the change at a PWM boundary */
+static void pwmCarrierUpdate(void) {
+  static uint8_t hot;
+  if (board_temp_deg_c >= TEMP_WARNING - PWM_CARRIER_TEMP) {
+    hot = 1;
+  } else if (board_temp_deg_c < TEMP_WARNING - PWM_CARRIER_TEMP - 20) {
+    hot = 0;
+  }
+  if (hot || speedAvgAbs > PWM_CARRIER_N + PWM_CARRIER_HYST) {
+    pwmCarrierReq = 1;
+  } else if (speedAvgAbs < PWM_CARRIER_N) {
+    pwmCarrierReq = 2;
+  }
+}
+#endif
+
+#if defined(CTRL_PREDICT)
+/* Coefficients of the predictive current control (ctrlPredict in bldc.c) from the identified L and flux (MOTOR_IDENT)
+ * or OBS_L / OBS_FLUX. The voltages are in Vbat / 2 = 1000 << 4, w = rpm * 2 pi / 60 * pole pairs, iq / id in
+ * A2BIT_CONV << 4 per A */
+static void ctrlPredictUpdate(void) {
+  int32_t cV = MAX(CTRL_VBAT, 100);
+  for (uint8_t m = 0; m < 2; m++) {
+    int32_t pp   = m ? rtP_Right.n_polePairs : rtP_Left.n_polePairs;
+    int32_t l    = OBS_L;
+    int32_t flux = OBS_FLUX;
+    #if defined(MOTOR_IDENT)
+    if (motId[m].l)    l    = motId[m].l;
+    if (motId[m].flux) flux = motId[m].flux;
+    #endif
+    ctrlPred[m].kA = (int32_t)((int64_t)pp * 192 * 65536 / PWM_FREQ);
+    ctrlPred[m].kE = (int32_t)((int64_t)pp * flux * 6283 * 4096 / (300000LL * cV));
+    ctrlPred[m].kL = (int32_t)(((int64_t)pp * l * 6283 << 24) / (300000LL * A2BIT_CONV * cV));
+  }
+}
+#endif
+
+#if defined(SPD_REF_GEN) && !defined(VARIANT_TRANSPOTTER)
+/* SPD_MODE speed reference: steer and speed follow the commands with the SPD_REF_ACC and SPD_REF_JERK limits instead
+ * of the rate limiter and filter outputs (raw inputs), and the feedforward of the control interrupt is updated (spdFf in
+ * bldc.c). In the other modes the references track steer and speed, so a mode change does not step the command */
+static void spdRefUpdate(int16_t *steerOut, int16_t *speedOut) {
+  int32_t nMax = MAX(rtP_Left.n_max >> 4, 10);                                 // [rpm] at command 1000
+  int32_t cV   = MAX(CTRL_VBAT, 100);
+  int32_t acc, jerk, accL, accR;
+  #ifndef USE_RAW_INPUT
+  int16_t steerTgt = input1[inIdx].cmd, speedTgt = input2[inIdx].cmd;
+  #else
+  int16_t steerTgt = *steerOut, speedTgt = *speedOut;
+  #endif
+
+  // Back-EMF voltage per command unit: n_max / 1000 * 2 pi / 60 * polePairs * OBS_FLUX, in Vbat / 2 = 1000 << 4
+  spdFfKv = (int32_t)((int64_t)nMax * rtP_Left.n_polePairs * OBS_FLUX * 6283 * 4096 / (300000000LL * cV));
+
+  if (ctrlModReq != SPD_MODE) {
+    steerRef.y = (int32_t)*steerOut << 16;
+    speedRef.y = (int32_t)*speedOut << 16;
+    steerRef.a = speedRef.a = 0;
+    spdFfAcc[0] = spdFfAcc[1] = 0;
+    return;
+  }
+
+  // [command fixdt(1,32,16) per main loop step] and per step^2
+  acc  = (int32_t)CLAMP((int64_t)SPD_REF_ACC * 65536 * DELAY_IN_MAIN_LOOP / nMax, 1, 1 << 24);
+  jerk = (int32_t)CLAMP((int64_t)SPD_REF_JERK * 65536 * DELAY_IN_MAIN_LOOP * DELAY_IN_MAIN_LOOP / (1000 * nMax), 1, acc);
+  refGenStep(steerTgt, acc, jerk, &steerRef);
+  refGenStep(speedTgt, acc, jerk, &speedRef);
+  *steerOut = (int16_t)(steerRef.y >> 16);
+  *speedOut = (int16_t)(speedRef.y >> 16);
+  #ifndef USE_RAW_INPUT
+  steerFixdt     = steerRef.y;                                                 // the filters go on from here
+  speedFixdt     = speedRef.y;
+  steerRateFixdt = (int16_t)(steerRef.y >> 12);
+  speedRateFixdt = (int16_t)(speedRef.y >> 12);
+  #endif
+
+  // Wheel accelerations as mixed in taskControl, then OBS_R * SPD_FF_ACC * acceleration in Vbat / 2 = 1000 << 4
+  if (boardCfg.flags & BCFG_TANK) {
+    accL = steerRef.a;
+    accR = speedRef.a;
+  } else {
+    accR = (int32_t)(((int64_t)speedRef.a * SPEED_COEFFICIENT - (int64_t)steerRef.a * STEER_COEFFICIENT) >> 14);
+    accL = (int32_t)(((int64_t)speedRef.a * SPEED_COEFFICIENT + (int64_t)steerRef.a * STEER_COEFFICIENT) >> 14);
+  }
+  accL = (int32_t)((int64_t)accL * nMax * SPD_FF_ACC * OBS_R / (20480LL * DELAY_IN_MAIN_LOOP * cV));
+  accR = (int32_t)((int64_t)accR * nMax * SPD_FF_ACC * OBS_R / (20480LL * DELAY_IN_MAIN_LOOP * cV));
+  spdFfAcc[0] = boardOutL((int16_t)CLAMP(accL, -4000, 4000));
+  spdFfAcc[1] = boardOutR((int16_t)CLAMP(accR, -4000, 4000));
+}
+#endif
+
+// ===========================================================
+/* Main loop tasks, see schedTasks[] for the rates */
+// ####### CONTROL: read inputs, filter, mix and set the motor outputs #######
+#ifdef VARIANT_TRANSPOTTER
+#define TRANSPOTTER_ROT_P       ((int32_t)(ROT_P * 256))    // [-] ROT_P in Q8, folded by the compiler
 
-      #ifdef STANDSTILL_HOLD_ENABLE
-        standstillHold();                                           // Apply Standstill Hold functionality. Only available and makes sense for VOLTAGE or TORQUE Mode
+/* Follow command: 0.8 * cmd - 0.2 * the clamped distance error, truncated like the float blend it replaces */
+static int16_t transpotterCmd(int16_t cmd, int err) {
+  return (int16_t)((cmd * 4 - CLAMP(err, -850, 850)) / 5);
+}
+#endif
+
+static void taskControl(void) {
+  readCommand();                        // Read Command: input1[inIdx].cmd, input2[inIdx].cmd
+  calcAvgSpeed();                       // Calculate average measured speed: speedAvg, speedAvgAbs
+  #ifdef MULTI_MODE_DRIVE
+  driveProfileUpdate();                 // Take over a requested drive profile at standstill
+  #endif
+
+  #ifndef VARIANT_TRANSPOTTER
+    // ####### MOTOR ENABLING: Only if the initial input is very small (for SAFETY) #######
+    if (enable == 0 && !rtY_Left.z_errCode && !rtY_Right.z_errCode && buttonMode == BTN_MODE_NONE &&
+        ABS(input1[inIdx].cmd) < 50 && ABS(input2[inIdx].cmd) < 50){
+      beepShort(6);                     // make 2 beeps indicating the motor enable, queued, the loop does not wait
+      beepShort(4);
+      steerFixdt = speedFixdt = 0;      // reset filters
+      #if defined(SPD_REF_GEN)
+      steerRef.y = speedRef.y = steerRef.a = speedRef.a = 0;
+      #endif
+      enable = 1;                       // enable motors
+      #if defined(DEBUG_OUT)
+      printf("-- Motors enabled --\r\n");
       #endif
+    }
 
-      #ifdef VARIANT_HOVERCAR
-      if (inIdx == CONTROL_ADC) {                                   // Only use use implementation below if pedals are in use (ADC input)
-        if (speedAvgAbs < 60) {                                     // Check if Hovercar is physically close to standstill to enable Double tap detection on Brake pedal for Reverse functionality
-          multipleTapDet(input1[inIdx].cmd, HAL_GetTick(), &MultipleTapBrake); // Brake pedal in this case is "input1" variable
-        }
+    // ####### VARIANT_HOVERCAR #######
+    #if defined(VARIANT_HOVERCAR) || defined(VARIANT_SKATEBOARD) || defined(ELECTRIC_BRAKE_ENABLE)
+      uint16_t speedBlend;                                        // Calculate speed Blend, a number between [0, 1] in fixdt(0,16,15)
+      speedBlend = (uint16_t)(((uint32_t)(CLAMP(speedAvgAbs,10,60) - 10) * SPEED_BLEND_RCP) >> 16); // speedBlend [0,1] is within [10 rpm, 60rpm]
+    #endif
 
-        if (input1[inIdx].cmd > 30) {                               // If Brake pedal (input1) is pressed, bring to 0 also the Throttle pedal (input2) to avoid "Double pedal" driving
-          input2[inIdx].cmd = (int16_t)((input2[inIdx].cmd * speedBlend) >> 15);
-          cruiseControl((uint8_t)rtP_Left.b_cruiseCtrlEna);         // Cruise control deactivated by Brake pedal if it was active
-        }
+    #ifdef STANDSTILL_HOLD_ENABLE
+      standstillHold();                                           // Apply Standstill Hold functionality. Only available and makes sense for VOLTAGE or TORQUE Mode
+    #endif
+
+    #ifdef VARIANT_HOVERCAR
+    if (inIdx == CONTROL_ADC) {                                   // Only use use implementation below if pedals are in use (ADC input)
+      if (speedAvgAbs < 60) {                                     // Check if Hovercar is physically close to standstill to enable Double tap detection on Brake pedal for Reverse functionality
+        multipleTapDet(input1[inIdx].cmd, timeMs(), &MultipleTapBrake); // Brake pedal in this case is "input1" variable
       }
-      #endif
 
-      #ifdef ELECTRIC_BRAKE_ENABLE
-        electricBrake(speedBlend, MultipleTapBrake.b_multipleTap);  // Apply Electric Brake. Only available and makes sense for TORQUE Mode
-      #endif
+      if (input1[inIdx].cmd > 30) {                               // If Brake pedal (input1) is pressed, bring to 0 also the Throttle pedal (input2) to avoid "Double pedal" driving
+        input2[inIdx].cmd = (int16_t)((input2[inIdx].cmd * speedBlend) >> 15);
+        #if defined(CRUISE_CONTROL_SUPPORT)
+        cruiseControl(holdReq == BLDC_HOLD_SPD);                  // Cruise control deactivated by Brake pedal if it was active
+        #endif
+      }
+    }
+    #endif
+
+    #ifdef ELECTRIC_BRAKE_ENABLE
+      electricBrake(speedBlend, MultipleTapBrake.b_multipleTap);  // Apply Electric Brake. Only available and makes sense for TORQUE Mode
+    #endif
+
+    #ifdef VARIANT_HOVERCAR
+    if (inIdx == CONTROL_ADC) {                                   // Only use use implementation below if pedals are in use (ADC input)
+      if (speedAvg > 0) {                                         // Make sure the Brake pedal is opposite to the direction of motion AND it goes to 0 as we reach standstill (to avoid Reverse driving by Brake pedal) 
+        input1[inIdx].cmd = (int16_t)((-input1[inIdx].cmd * speedBlend) >> 15);
+      } else {
+        input1[inIdx].cmd = (int16_t)(( input1[inIdx].cmd * speedBlend) >> 15);
+      }
+    }
+    #endif
 
-      #ifdef VARIANT_HOVERCAR
-      if (inIdx == CONTROL_ADC) {                                   // Only use use implementation below if pedals are in use (ADC input)
-        if (speedAvg > 0) {                                         // Make sure the Brake pedal is opposite to the direction of motion AND it goes to 0 as we reach standstill (to avoid Reverse driving by Brake pedal) 
-          input1[inIdx].cmd = (int16_t)((-input1[inIdx].cmd * speedBlend) >> 15);
+    #ifdef VARIANT_SKATEBOARD
+      if (input2[inIdx].cmd < 0) {                                // When Throttle is negative, it acts as brake. This condition is to make sure it goes to 0 as we reach standstill (to avoid Reverse driving) 
+        if (speedAvg > 0) {                                       // Make sure the braking is opposite to the direction of motion
+          input2[inIdx].cmd  = (int16_t)(( input2[inIdx].cmd * speedBlend) >> 15);
         } else {
-          input1[inIdx].cmd = (int16_t)(( input1[inIdx].cmd * speedBlend) >> 15);
+          input2[inIdx].cmd  = (int16_t)((-input2[inIdx].cmd * speedBlend) >> 15);
         }
       }
+    #endif
+
+    #ifndef USE_RAW_INPUT
+    // ####### LOW-PASS FILTER #######
+    rateLimiter16(input1[inIdx].cmd, rate, &steerRateFixdt);
+    rateLimiter16(input2[inIdx].cmd, rate, &speedRateFixdt);
+    filtLowPass32Fast(steerRateFixdt >> 4, filter, &steerFixdt);  // rate limiter output >> 4 is within [-2048, 2047]
+    filtLowPass32Fast(speedRateFixdt >> 4, filter, &speedFixdt);
+    steer = (int16_t)(steerFixdt >> 16);  // convert fixed-point to integer
+    speed = (int16_t)(speedFixdt >> 16);  // convert fixed-point to integer
+    #else
+    steer = input1[inIdx].raw;  // convert fixed-point to integer
+    speed = input2[inIdx].raw;  // convert fixed-point to integer
+    #endif
+    #if defined(SPD_REF_GEN)
+    spdRefUpdate(&steer, &speed);       // SPD_MODE: jerk limited references replace steer and speed
+    #endif
+    // ####### VARIANT_HOVERCAR #######
+    #ifdef VARIANT_HOVERCAR
+    if (inIdx == CONTROL_ADC) {               // Only use use implementation below if pedals are in use (ADC input)
+
+      #ifdef MULTI_MODE_DRIVE
+      if (speed >= max_speed) {
+        speed = max_speed;
+      }
       #endif
 
-      #ifdef VARIANT_SKATEBOARD
-        if (input2[inIdx].cmd < 0) {                                // When Throttle is negative, it acts as brake. This condition is to make sure it goes to 0 as we reach standstill (to avoid Reverse driving) 
-          if (speedAvg > 0) {                                       // Make sure the braking is opposite to the direction of motion
-            input2[inIdx].cmd  = (int16_t)(( input2[inIdx].cmd * speedBlend) >> 15);
+      if (!MultipleTapBrake.b_multipleTap) {  // Check driving direction
+        speed = steer + speed;                // Forward driving: in this case steer = Brake, speed = Throttle
+      } else {
+        speed = steer - speed;                // Reverse driving: in this case steer = Brake, speed = Throttle
+      }
+      steer = 0;                              // Do not apply steering to avoid side effects if STEER_COEFFICIENT is NOT 0
+    }
+    #endif
+
+    #if defined(SERIAL_FAST_CMD)
+    if (!serialFastCmdActive()) {       // else cmdL, cmdR and the outputs are set by the serial Rx interrupt
+    #elif defined(BALANCE_CONTROL)
+    if (!balanceActive) {               // else the outputs are set by taskBalance
+    #endif
+    #if defined(SERIAL_EXT_CMD)
+    if ((boardCfg.flags & BCFG_TANK) || serialExtWheel()) {
+    #else
+    if (boardCfg.flags & BCFG_TANK) {
+    #endif
+      // Tank steering (no mixing), or the wheel targets of an extended serial command
+      cmdL = steer; 
+      cmdR = speed;
+    } else {
+      // ####### MIXER #######
+      mixerFcn(speed << 4, steer << 4, &cmdR, &cmdL);   // This function implements the equations above
+    }
+
+
+    // ####### SET OUTPUTS (if the target change is less than +/- 100) #######
+    pwmr = boardOutR(cmdR);
+    pwml = boardOutL(cmdL);
+    #if defined(LATENCY_MEAS)
+    latOutput(&latMeas, input1[inIdx].cmd, input2[inIdx].cmd, (int16_t)pwml, (int16_t)pwmr);
+    #endif
+    #if defined(SERIAL_FAST_CMD) || defined(BALANCE_CONTROL)
+    }
+    #endif
+  #endif
+
+  #ifdef VARIANT_TRANSPOTTER
+    distance    = CLAMP(input1[inIdx].cmd - 180, 0, 4095);
+    steering    = input2[inIdx].cmd - 2048;
+    distanceErr = distance - (int)((uint32_t)setDistance * GAMETRAK_CNT_PER_M / 1000);
+
+    if (nunchuk_connected == 0) {
+      int rot = steering * MAX(ABS(distanceErr), 50) / 2048 * TRANSPOTTER_ROT_P / 256;
+      cmdL = transpotterCmd(cmdL, distanceErr + rot);
+      cmdR = transpotterCmd(cmdR, distanceErr - rot);
+      if (distanceErr > 0) {
+        enable = 1;
+      }
+      if (distanceErr > -300) {
+        pwmr = boardOutR(cmdR);
+        pwml = boardOutL(cmdL);
+
+        if (checkRemote) {
+          if (!HAL_GPIO_ReadPin(LED_PORT, LED_PIN)) {
+            //enable = 1;
           } else {
-            input2[inIdx].cmd  = (int16_t)((-input2[inIdx].cmd * speedBlend) >> 15);
+            enable = 0;
           }
         }
+      } else {
+        enable = 0;
+      }
+      timeoutCntGen = 0;
+      timeoutFlgGen = 0;
+    }
+
+    if (timeoutFlgGen) {
+      pwml = 0;
+      pwmr = 0;
+      enable = 0;
+      #ifdef SUPPORT_LCD
+        lcdSetLocation( 0, 0); lcdWriteString("Len:");
+        lcdSetLocation( 8, 0); lcdWriteString("m(");
+        lcdSetLocation(14, 0); lcdWriteString("m)");
       #endif
+      HAL_Delay(1000);
+      nunchuk_connected = 0;
+    }
 
-      #ifndef USE_RAW_INPUT
-      // ####### LOW-PASS FILTER #######
-      rateLimiter16(input1[inIdx].cmd, rate, &steerRateFixdt);
-      rateLimiter16(input2[inIdx].cmd, rate, &speedRateFixdt);
-      filtLowPass32(steerRateFixdt >> 4, FILTER, &steerFixdt);
-      filtLowPass32(speedRateFixdt >> 4, FILTER, &speedFixdt);
-      steer = (int16_t)(steerFixdt >> 16);  // convert fixed-point to integer
-      speed = (int16_t)(speedFixdt >> 16);  // convert fixed-point to integer
-      #else
-      steer = input1[inIdx].raw;  // convert fixed-point to integer
-      speed = input2[inIdx].raw;  // convert fixed-point to integer
+    if (distance     * 1000 > (setDistance + 500) * (int32_t)GAMETRAK_CNT_PER_M &&
+        lastDistance * 1000 > (setDistance + 500) * (int32_t)GAMETRAK_CNT_PER_M) {  // Error, robot too far away!
+      enable = 0;
+      beepLong(5);
+      #ifdef SUPPORT_LCD
+        lcdClear();
+        lcdSetLocation(0, 0); lcdWriteString("Emergency Off!");
+        lcdSetLocation(0, 1); lcdWriteString("Keeper too fast.");
+        lcdFlush();
       #endif
-      // ####### VARIANT_HOVERCAR #######
-      #ifdef VARIANT_HOVERCAR
-      if (inIdx == CONTROL_ADC) {               // Only use use implementation below if pedals are in use (ADC input)
+      poweroff(POWEROFF_DISTANCE);
+    }
 
-        #ifdef MULTI_MODE_DRIVE
-        if (speed >= max_speed) {
-          speed = max_speed;
+    #ifdef SUPPORT_NUNCHUK
+      if (transpotter_counter % 500 == 0) {
+        if (nunchuk_connected == 0 && enable == 0) {
+            if(Nunchuk_Read() == NUNCHUK_CONNECTED) {
+              #ifdef SUPPORT_LCD
+                lcdSetLocation(0, 0); lcdWriteString("Nunchuk Control");
+              #endif
+              nunchuk_connected = 1;
+	      }
+	    } else {
+            nunchuk_connected = 0;
+	    }
         }
-        #endif
+      }   
+    #endif
+
+    #ifdef SUPPORT_LCD
+      if (transpotter_counter % 100 == 0) {
+        if (LCDerrorFlag == 1 && enable == 0) {
 
-        if (!MultipleTapBrake.b_multipleTap) {  // Check driving direction
-          speed = steer + speed;                // Forward driving: in this case steer = Brake, speed = Throttle
         } else {
-          speed = steer - speed;                // Reverse driving: in this case steer = Brake, speed = Throttle
+          if (nunchuk_connected == 0) {
+            lcdSetLocation( 4, 0); lcdWriteFixed(((int32_t)distance * 100 + GAMETRAK_CNT_PER_M / 2) / GAMETRAK_CNT_PER_M, 2);
+            lcdSetLocation(10, 0); lcdWriteFixed((setDistance + 5) / 10, 2);
+          }
+          lcdSetLocation( 4, 1); lcdWriteFixed((int32_t)batVoltage * 10, 1);
+          // lcdSetLocation(11, 1); lcdWriteFixed(MAX(ABS(currentR), ABS(currentL)), 2);
         }
-        steer = 0;                              // Do not apply steering to avoid side effects if STEER_COEFFICIENT is NOT 0
       }
-      #endif
+    #endif
+    transpotter_counter++;
+  #endif
 
-      #if defined(TANK_STEERING) && !defined(VARIANT_HOVERCAR) && !defined(VARIANT_SKATEBOARD) 
-        // Tank steering (no mixing)
-        cmdL = steer; 
-        cmdR = speed;
-      #else 
-        // ####### MIXER #######
-        mixerFcn(speed << 4, steer << 4, &cmdR, &cmdL);   // This function implements the equations above
-      #endif
+  // ####### CALC DC LINK CURRENT #######
+  BldcState st;
+  bldc_state_read(&st);                 // both currents of the same control tick
+  left_dc_curr  = (int16_t)((-(int64_t)st.i_DCLink[0] * DC_CURR_RCP) >> 16);  // Left DC Link Current * 100
+  right_dc_curr = (int16_t)((-(int64_t)st.i_DCLink[1] * DC_CURR_RCP) >> 16);  // Right DC Link Current * 100
+  dc_curr       = left_dc_curr + right_dc_curr;            // Total DC Link Current * 100
 
+  #if defined(IDLE_POWER_SAVE)
+  idleUpdate();                         // Slow down the control interrupt while parked
+  #endif
 
-      // ####### SET OUTPUTS (if the target change is less than +/- 100) #######
-      #ifdef INVERT_R_DIRECTION
-        pwmr = cmdR;
-      #else
-        pwmr = -cmdR;
-      #endif
-      #ifdef INVERT_L_DIRECTION
-        pwml = -cmdL;
-      #else
-        pwml = cmdL;
-      #endif
+  // Update states
+  inIdx_prev = inIdx;
+  main_loop_counter++;
+
+  #if defined(GAIN_SCHED)
+  gainSchedUpdate(st.n_mot[0], st.n_mot[1]);
+  #endif
+
+  #if defined(PARAM_STAGED)
+  bldc_param_commit();                  // everything written to rtP_Left / rtP_Right since the last commit, in one tick
+  #endif
+}
+
+// ####### SIDEBOARDS HANDLING #######
+static void taskSideboard(void) {
+  #if defined(SIDEBOARD_SERIAL_USART2)
+    sideboardSensors((uint8_t)Sideboard_L.sensors);
+  #endif
+  #if defined(SIDEBOARD_SERIAL_USART3)
+    sideboardSensors((uint8_t)Sideboard_R.sensors);
+  #endif
+  #if defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3)
+    sideboard_leds = sideboardLeds();
+  #endif
+}
+
+#if defined(BALANCE_CONTROL)
+// ####### BALANCE CONTROL: one PID per half on the latest sideboard pitch, straight to the torque targets #######
+static void taskBalance(void) {
+  uint8_t ok   = enable && !timeoutFlgSerial && ctrlModReq == TRQ_MODE;
+  int16_t trqL = balanceStep(&balance_L, Sideboard_L.pitch, Sideboard_L.dPitch, ok && (Sideboard_L.sensors & (SENSOR1_SET | SENSOR2_SET)));
+  int16_t trqR = balanceStep(&balance_R, Sideboard_R.pitch, Sideboard_R.dPitch, ok && (Sideboard_R.sensors & (SENSOR1_SET | SENSOR2_SET)));
+
+  uint8_t wasActive = balanceActive;
+
+  balanceActive = balance_L.state == BAL_ON || balance_R.state == BAL_ON;
+  if (balanceActive || wasActive) {     // one zero torque step when both halves turn off, then the main loop takes over
+    pwmr = boardOutR(trqR);
+    pwml = boardOutL(trqL);
+  }
+}
+#endif
+
+#if defined(CURRENT_DERATING)
+/* [ADC bits^2] squared phase current of one motor, FOC from iq and id, COM and SIN from the DC link current */
+static int32_t derateISq(const P *p, const ExtU *u, const ExtY *y) {
+  if (p->z_ctrlTypSel == FOC_CTRL) {
+    return (int32_t)(y->iq >> 4) * (y->iq >> 4) + (int32_t)(y->id >> 4) * (y->id >> 4);
+  }
+  return (int32_t)u->i_DCLink * u->i_DCLink;
+}
+#endif
+
+#if defined(WINDING_TEMP)
+/* Winding temperature of both motors from the sums of the control interrupt, with the identified R and flux
+ * (MOTOR_IDENT) or OBS_R / OBS_FLUX */
+static void wtempUpdate(void) {
+  for (uint8_t m = 0; m < 2; m++) {
+    const P    *p    = m ? &rtP_Right : &rtP_Left;
+    const ExtY *y    = m ? &rtY_Right : &rtY_Left;
+    uint16_t    r    = OBS_R;
+    uint16_t    flux = OBS_FLUX;
+    #if defined(MOTOR_IDENT)
+    if (motId[m].r)    r    = motId[m].r;
+    if (motId[m].flux) flux = motId[m].flux;
     #endif
+    wtempStep(&wtemp[m], CTRL_VBAT, r, flux, p->n_polePairs,
+              enable && p->z_ctrlTypSel == FOC_CTRL && y->z_errCode == 0 && (ctrlModReq == TRQ_MODE || ctrlModReq == SPD_MODE));
+  }
+}
+#endif
 
-    #ifdef VARIANT_TRANSPOTTER
-      distance    = CLAMP(input1[inIdx].cmd - 180, 0, 4095);
-      steering    = (input2[inIdx].cmd - 2048) / 2048.0;
-      distanceErr = distance - (int)(setDistance * 1345);
+#if defined(EFF_ESTIMATE)
+/* Efficiency estimate of both motors with the measured (WINDING_TEMP) or identified (MOTOR_IDENT) motor constants,
+ * else OBS_R and OBS_FLUX */
+static void effUpdate(const BldcState *st) {
+  static int32_t effPos[2];             // [hall steps] positions at the last update
+  const int16_t  iDc[2] = {left_dc_curr, right_dc_curr};
+  int32_t        r[2];
+  uint16_t       flux[2];
+  uint32_t       steps = (uint32_t)ABS(st->odo[0].pos - effPos[0]) + (uint32_t)ABS(st->odo[1].pos - effPos[1]);
+
+  effPos[0] = st->odo[0].pos;
+  effPos[1] = st->odo[1].pos;
+  for (uint8_t m = 0; m < 2; m++) {
+    r[m]    = OBS_R * 1000L;
+    flux[m] = OBS_FLUX;
+    #if defined(MOTOR_IDENT)
+    if (motId[m].r)    r[m]    = motId[m].r * 1000L;
+    if (motId[m].flux) flux[m] = motId[m].flux;
+    #endif
+    #if defined(WINDING_TEMP)
+    if (wtemp[m].r)    r[m]    = wtemp[m].r;
+    #endif
+  }
+  effStep(&eff, batVoltageCalib, iDc, st->iq, st->id, st->n_mot, r, flux, rtP_Left.n_polePairs,
+          (uint16_t)MIN(steps, 0xFFFF), DELAY_IN_MAIN_LOOP);
+}
+#endif
 
-      if (nunchuk_connected == 0) {
-        cmdL = cmdL * 0.8f + (CLAMP(distanceErr + (steering*((float)MAX(ABS(distanceErr), 50)) * ROT_P), -850, 850) * -0.2f);
-        cmdR = cmdR * 0.8f + (CLAMP(distanceErr - (steering*((float)MAX(ABS(distanceErr), 50)) * ROT_P), -850, 850) * -0.2f);
-        if (distanceErr > 0) {
-          enable = 1;
-        }
-        if (distanceErr > -300) {
-          #ifdef INVERT_R_DIRECTION
-            pwmr = cmdR;
-          #else
-            pwmr = -cmdR;
-          #endif
-          #ifdef INVERT_L_DIRECTION
-            pwml = -cmdL;
-          #else
-            pwml = cmdL;
-          #endif
-
-          if (checkRemote) {
-            if (!HAL_GPIO_ReadPin(LED_PORT, LED_PIN)) {
-              //enable = 1;
-            } else {
-              enable = 0;
-            }
-          }
-        } else {
-          enable = 0;
-        }
-        timeoutCntGen = 0;
-        timeoutFlgGen = 0;
-      }
+// ####### MONITOR: temperature, battery, power button, beeps and inactivity #######
+static void taskMonitor(void) {
+  BldcState st;
+  bldc_state_read(&st);                 // battery voltage and error codes of one control tick
+  stackCheck();                         // stack guard and high-water mark (STACK_MONITOR)
+
+  // ####### CALC BOARD TEMPERATURE #######
+  int32_t tempAdc = adc_buffer.temp;
+  #if defined(ADC_TEMP_DECIM)
+  filtLowPass32Fast(adc_buffer.vref, TEMP_FILT_COEF, &adc_vrefFixdt);
+  adcVdda = (int16_t)((int32_t)ADC_VREFINT_MV * 4096 / MAX(adc_vrefFixdt >> 16, 1));
+  #if TEMP_VREF_COMP
+  tempAdc = tempAdc * adcVdda / 3300;   // sensor voltage in ADC bits at VDDA = 3.3 V
+  #endif
+  #endif
+  filtLowPass32Fast(tempAdc, TEMP_FILT_COEF, &board_temp_adcFixdt);
+  board_temp_adcFilt  = (int16_t)(board_temp_adcFixdt >> 16);  // convert fixed-point to integer
+  board_temp_deg_c    = (int16_t)(((int64_t)(board_temp_adcFilt - TEMP_CAL_LOW_ADC) * TEMP_CAL_SLOPE) >> 16) + TEMP_CAL_LOW_DEG_C;
+
+  // ####### CALC CALIBRATED BATTERY VOLTAGE #######
+  batVoltageCalib = (int16_t)(((int64_t)st.batVoltage * BAT_CALIB_RCP) >> 16);
+  rtP_Left.r_fieldWeakMapSca = rtP_Right.r_fieldWeakMapSca =    // field weakening map speed at FIELD_WEAK_MAP_VBAT
+    (uint16_t)CLAMP(((int32_t)FIELD_WEAK_MAP_VBAT << 12) / MAX(batVoltageCalib, 1), 2048, 8192);
+  #if defined(BAT_SOC_ENABLE)
+  batSocStep(&batSoc, batVoltageCalib, dc_curr, DELAY_IN_MAIN_LOOP);
+  #endif
+  uint8_t bat = batLevel();
 
-      if (timeoutFlgGen) {
-        pwml = 0;
-        pwmr = 0;
-        enable = 0;
-        #ifdef SUPPORT_LCD
-          LCD_SetLocation(&lcd,  0, 0); LCD_WriteString(&lcd, "Len:");
-          LCD_SetLocation(&lcd,  8, 0); LCD_WriteString(&lcd, "m(");
-          LCD_SetLocation(&lcd, 14, 0); LCD_WriteString(&lcd, "m)");
-        #endif
-        HAL_Delay(1000);
-        nunchuk_connected = 0;
-      }
+  // ####### WINDING TEMPERATURE #######
+  #if defined(WINDING_TEMP)
+  wtempUpdate();
+  #endif
 
-      if ((distance / 1345.0) - setDistance > 0.5 && (lastDistance / 1345.0) - setDistance > 0.5) { // Error, robot too far away!
-        enable = 0;
-        beepLong(5);
-        #ifdef SUPPORT_LCD
-          LCD_ClearDisplay(&lcd);
-          HAL_Delay(5);
-          LCD_SetLocation(&lcd, 0, 0); LCD_WriteString(&lcd, "Emergency Off!");
-          LCD_SetLocation(&lcd, 0, 1); LCD_WriteString(&lcd, "Keeper too fast.");
-        #endif
-        poweroff();
-      }
+  // ####### CURRENT DERATING #######
+  #if defined(CURRENT_DERATING)
+  int32_t iSqL = derateISq(&rtP_Left,  &rtU_Left,  &rtY_Left);
+  int32_t iSqR = derateISq(&rtP_Right, &rtU_Right, &rtY_Right);
+  derateStep(&derate, rtP_Left.i_max, board_temp_deg_c, batVoltageCalib, MAX(iSqL, iSqR), WTEMP_HOT, DELAY_IN_MAIN_LOOP);
+  #endif
 
-      #ifdef SUPPORT_NUNCHUK
-        if (transpotter_counter % 500 == 0) {
-          if (nunchuk_connected == 0 && enable == 0) {
-              if(Nunchuk_Read() == NUNCHUK_CONNECTED) {
-                #ifdef SUPPORT_LCD
-                  LCD_SetLocation(&lcd, 0, 0); LCD_WriteString(&lcd, "Nunchuk Control");
-                #endif
-                nunchuk_connected = 1;
-	      }
-	    } else {
-              nunchuk_connected = 0;
-	    }
-          }
-        }   
-      #endif
+  // ####### DC LINK BUDGET #######
+  #if defined(DC_BUDGET)
+  dcBudgetTotal(&dcBudget, batVoltageCalib);
+  #endif
 
-      #ifdef SUPPORT_LCD
-        if (transpotter_counter % 100 == 0) {
-          if (LCDerrorFlag == 1 && enable == 0) {
+  // ####### EFFICIENCY #######
+  #if defined(EFF_ESTIMATE)
+  effUpdate(&st);
+  #endif
 
-          } else {
-            if (nunchuk_connected == 0) {
-              LCD_SetLocation(&lcd,  4, 0); LCD_WriteFloat(&lcd,distance/1345.0,2);
-              LCD_SetLocation(&lcd, 10, 0); LCD_WriteFloat(&lcd,setDistance,2);
-            }
-            LCD_SetLocation(&lcd,  4, 1); LCD_WriteFloat(&lcd,batVoltage, 1);
-            // LCD_SetLocation(&lcd, 11, 1); LCD_WriteFloat(&lcd,MAX(ABS(currentR), ABS(currentL)),2);
-          }
-        }
-      #endif
-      transpotter_counter++;
+  // ####### REGENERATIVE BRAKING #######
+  #if defined(REGEN_LIMIT)
+  regenStep(&regen, batVoltageCalib, dc_curr, DELAY_IN_MAIN_LOOP);
+  #endif
+
+  // ####### PWM CARRIER #######
+  #if defined(PWM_CARRIER_DOUBLE)
+  pwmCarrierUpdate();
+  #endif
+
+  // ####### PREDICTIVE CURRENT CONTROL #######
+  #if defined(CTRL_PREDICT)
+  ctrlPredictUpdate();
+  #endif
+
+  // ####### TRIP STATISTICS #######
+  #if defined(TRIP_STATS)
+  {
+    static int32_t tripPos[2];          // [hall steps] positions at the last update
+    uint32_t steps = (uint32_t)ABS(st.odo[0].pos - tripPos[0]) + (uint32_t)ABS(st.odo[1].pos - tripPos[1]);
+    tripPos[0] = st.odo[0].pos;
+    tripPos[1] = st.odo[1].pos;
+    tripStep(&trip, (uint16_t)MIN(steps, 0xFFFF), (uint16_t)(6 * rtP_Left.n_polePairs), batVoltageCalib, dc_curr,
+             board_temp_deg_c, st.errCode[0] || st.errCode[1], DELAY_IN_MAIN_LOOP);
+    uint8_t standstill = speedAvgAbs == 0 && ABS(cmdL) < IDLE_THRES && ABS(cmdR) < IDLE_THRES;
+    #if defined(FLASH_SAFE_WRITE)
+    standstill |= !tripEraseDue();      // an append without erase does not stall the control interrupt
     #endif
+    if (tripSaveDue(&trip, standstill)) {
+      tripSave();                       // stalls the main loop and the control interrupt for the page erase
+    }
+  }
+  #endif
 
-    // ####### SIDEBOARDS HANDLING #######
-    #if defined(SIDEBOARD_SERIAL_USART2)
-      sideboardSensors((uint8_t)Sideboard_L.sensors);
+  // ####### FLASH WRITES #######
+  #if defined(FLASH_SAFE_WRITE)
+  EE_Service(speedAvgAbs == 0 && ABS(cmdL) < IDLE_THRES && ABS(cmdR) < IDLE_THRES);  // page erases only at standstill
+  #endif
+
+  // ####### POWEROFF BY POWER-BUTTON #######
+  poweroffPressCheck();
+
+  // ####### BEEP AND EMERGENCY POWEROFF #######
+  if (TEMP_POWEROFF_ENABLE && board_temp_deg_c >= TEMP_POWEROFF && speedAvgAbs < 20){  // poweroff before mainboard burns OR low bat 3
+    #if defined(DEBUG_OUT)
+      printf("Powering off, temperature is too high\r\n");
     #endif
-    #if defined(FEEDBACK_SERIAL_USART2)
-      sideboardLeds(&sideboard_leds_L);
+    poweroff(POWEROFF_TEMP);
+  } else if ( BAT_DEAD_ENABLE && bat == BAT_LEVEL_DEAD && speedAvgAbs < 20){
+    #if defined(DEBUG_OUT)
+      printf("Powering off, battery voltage is too low\r\n");
     #endif
-    #if defined(SIDEBOARD_SERIAL_USART3)
-      sideboardSensors((uint8_t)Sideboard_R.sensors);
+    poweroff(POWEROFF_BAT_DEAD);
+  } else if (st.errCode[0] || st.errCode[1]) {                                                      // 1 beep (low pitch): Motor error, disable motors
+    enable = 0;
+    #if defined(FAULTLOG_ENABLE)
+      errLatch_L |= st.errCode[0];
+      errLatch_R |= st.errCode[1];
     #endif
-    #if defined(FEEDBACK_SERIAL_USART3)
-      sideboardLeds(&sideboard_leds_R);
+    #if defined(SELF_TEST)
+      selfTest.fault = 1;               // the next boot runs the self-test pulses again
     #endif
-    
-
-    // ####### CALC BOARD TEMPERATURE #######
-    filtLowPass32(adc_buffer.temp, TEMP_FILT_COEF, &board_temp_adcFixdt);
-    board_temp_adcFilt  = (int16_t)(board_temp_adcFixdt >> 16);  // convert fixed-point to integer
-    board_temp_deg_c    = (TEMP_CAL_HIGH_DEG_C - TEMP_CAL_LOW_DEG_C) * (board_temp_adcFilt - TEMP_CAL_LOW_ADC) / (TEMP_CAL_HIGH_ADC - TEMP_CAL_LOW_ADC) + TEMP_CAL_LOW_DEG_C;
-
-    // ####### CALC CALIBRATED BATTERY VOLTAGE #######
-    batVoltageCalib = batVoltage * BAT_CALIB_REAL_VOLTAGE / BAT_CALIB_ADC;
-
-    // ####### CALC DC LINK CURRENT #######
-    left_dc_curr  = -(rtU_Left.i_DCLink * 100) / A2BIT_CONV;   // Left DC Link Current * 100 
-    right_dc_curr = -(rtU_Right.i_DCLink * 100) / A2BIT_CONV;  // Right DC Link Current * 100
-    dc_curr       = left_dc_curr + right_dc_curr;            // Total DC Link Current * 100
-
-    // ####### DEBUG SERIAL OUT #######
-    #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
-      if (main_loop_counter % 25 == 0) {    // Send data periodically every 125 ms      
-        #if defined(DEBUG_SERIAL_PROTOCOL)
-          process_debug();
-        #else
-          printf("in1:%i in2:%i cmdL:%i cmdR:%i BatADC:%i BatV:%i TempADC:%i Temp:%i \r\n",
-            input1[inIdx].raw,        // 1: INPUT1
-            input2[inIdx].raw,        // 2: INPUT2
-            cmdL,                     // 3: output command: [-1000, 1000]
-            cmdR,                     // 4: output command: [-1000, 1000]
-            adc_buffer.batt1,         // 5: for battery voltage calibration
-            batVoltageCalib,          // 6: for verifying battery voltage calibration
-            board_temp_adcFilt,       // 7: for board temperature calibration
-            board_temp_deg_c);        // 8: for verifying board temperature calibration
-        #endif
-      }
+    beepCount(1, 24, 1);
+  #if defined(SELF_TEST)
+  } else if (selfTest.err[0] || selfTest.err[1]) {                                                  // 6 beeps (low pitch): Boot self-test failed, disable motors
+    enable = 0;
+    beepCount(6, 24, 1);
+  #endif
+  } else if (timeoutFlgADC) {                                                                       // 2 beeps (low pitch): ADC timeout
+    beepCount(2, 24, 1);
+  } else if (timeoutFlgSerial) {                                                                    // 3 beeps (low pitch): Serial timeout
+    beepCount(3, 24, 1);
+  } else if (timeoutFlgGen) {                                                                       // 4 beeps (low pitch): General timeout (PPM, PWM, Nunchuk)
+    beepCount(4, 24, 1);
+  } else if (TEMP_WARNING_ENABLE && board_temp_deg_c >= TEMP_WARNING) {                             // 5 beeps (low pitch): Mainboard temperature warning
+    beepCount(5, 24, 1);
+  } else if (BAT_LVL1_ENABLE && bat <= BAT_LEVEL_1) {                                               // 1 beep fast (medium pitch): Low bat 1
+    beepCount(0, 10, 6);
+  } else if (BAT_LVL2_ENABLE && bat <= BAT_LEVEL_2) {                                               // 1 beep slow (medium pitch): Low bat 2
+    beepCount(0, 10, 30);
+  } else if (BEEPS_BACKWARD && (((cmdR < -50 || cmdL < -50) && speedAvg < 0) || MultipleTapBrake.b_multipleTap)) { // 1 beep fast (high pitch): Backward spinning motors
+    beepCount(0, 5, 1);
+    backwardDrive = 1;
+  } else {  // do not beep
+    beepCount(0, 0, 0);
+    backwardDrive = 0;
+  }
+
+
+  inactivity_timeout_counter++;
+
+  // ####### INACTIVITY TIMEOUT #######
+  if (abs(cmdL) > 50 || abs(cmdR) > 50) {
+    inactivity_timeout_counter = 0;
+  }
+
+  #if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+    if (holdReq == BLDC_HOLD_SPD && (abs(holdTgt[0]) > 50 || abs(holdTgt[1]) > 50)) {
+      inactivity_timeout_counter = 0;
+    }
+  #endif
+
+  if (inactivity_timeout_counter > (INACTIVITY_TIMEOUT * 60 * 1000) / DELAY_IN_MAIN_LOOP) {  // monitor task runs every DELAY_IN_MAIN_LOOP ms
+    #if defined(DEBUG_OUT)
+      printf("Powering off, wheels were inactive for too long\r\n");
     #endif
+    poweroff(POWEROFF_INACTIVITY);
+  }
+}
 
-    // ####### FEEDBACK SERIAL OUT #######
-    #if defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3)
-      if (main_loop_counter % 4 == 0) {    // Send data periodically every 10 ms
-        Feedback.start	        = (uint16_t)SERIAL_START_FRAME;
-        Feedback.steps0           = steps[0];
-        Feedback.steps1           = steps[1];
-        #ifdef INVERT_R_DIRECTION
-          Feedback.speedR_meas = (int16_t)rtY_Right.n_mot;
+#if defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3)
+#if (defined(FEEDBACK_SERIAL_USART2) && defined(SIDEBOARD_SERIAL_USART2)) || (defined(FEEDBACK_SERIAL_USART3) && defined(SIDEBOARD_SERIAL_USART3))
+/* A sideboard only uses the LED state of the feedback: send it when it changed, else every SIDEBOARD_LED_REFRESH ms
+ * so a restarted sideboard catches up */
+static uint8_t sideboardLedsDue(uint8_t *sent, uint32_t *tick) {
+  if (sideboard_leds == *sent && timeMs() - *tick < SIDEBOARD_LED_REFRESH) {
+    return 0;
+  }
+  *sent = sideboard_leds;
+  *tick = timeMs();
+  return 1;
+}
+#endif
+
+#if defined(FEEDBACK_COMPACT)
+/* ProtoFeedbackCompact frame from Feedback into buf: the fast fields, the slow fields that changed since the last frame
+ * on this port and one more round robin. Returns the frame length */
+static uint16_t feedbackCompact(FeedbackCompact *c, uint8_t *buf, uint8_t hwCrc) {
+  const uint16_t slow[PROTO_FB_SLOW_N] = {(uint16_t)Feedback.batVoltage, (uint16_t)Feedback.boardTemp, Feedback.batSoc,
+                                          Feedback.regenWh, Feedback.isrCycMean, Feedback.isrCycMax, Feedback.cmdLed,
+                                          Feedback.cpuLoad};
+  ProtoFeedbackCompact *f = (ProtoFeedbackCompact *)buf;
+  uint8_t  *p      = buf + sizeof(ProtoFeedbackCompact);
+  uint8_t  fields  = 1 << c->rr;
+  uint32_t checksum;
+
+  c->rr = (c->rr == PROTO_FB_SLOW_N - 1) ? 0 : c->rr + 1;
+  for (uint8_t i = 0; i < PROTO_FB_SLOW_N; i++) {
+    if (slow[i] != c->sent[i] || (fields & (1 << i))) {
+      fields    |= 1 << i;
+      c->sent[i] = slow[i];
+      *p++       = (uint8_t)slow[i];
+      *p++       = (uint8_t)(slow[i] >> 8);
+    }
+  }
+  f->start       = hwCrc ? (uint16_t)PROTO_START_FRAME_COMPACT_HWCRC : (uint16_t)PROTO_START_FRAME_COMPACT;
+  f->version     = Feedback.version;
+  f->caps        = Feedback.caps;
+  f->fields      = fields;
+  f->odo0        = Feedback.odo0;
+  f->odo1        = Feedback.odo1;
+  f->odoTime     = Feedback.odoTime;
+  f->edgeAge0    = Feedback.edgeAge0;
+  f->edgeAge1    = Feedback.edgeAge1;
+  f->speedR_meas = Feedback.speedR_meas;
+  f->speedL_meas = Feedback.speedL_meas;
+  f->cmdSeq      = Feedback.cmdSeq;
+  f->cmdAge      = Feedback.cmdAge;
+  f->fbTime      = Feedback.fbTime;
+  f->syncTime    = Feedback.syncTime;
+  #if defined(SERIAL_HW_CRC)
+  checksum = hwCrc ? calc_crc32_hw(buf, p - buf) : calc_crc32(buf, p - buf);
+  #else
+  checksum = calc_crc32(buf, p - buf);
+  #endif
+  *p++ = (uint8_t)checksum;
+  *p++ = (uint8_t)(checksum >> 8);
+  *p++ = (uint8_t)(checksum >> 16);
+  *p++ = (uint8_t)(checksum >> 24);
+  return (uint16_t)(p - buf);
+}
+#endif
+
+#if defined(TRIP_STATS) && !defined(SERIAL_BUS) && (defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3))
+/* ProtoTrip frame with the trip totals into buf, the answer to a PROTO_CMD_TRIP command. Returns the frame length */
+static uint16_t feedbackTrip(uint8_t *buf) {
+  ProtoTrip *f = (ProtoTrip *)buf;
+  uint32_t checksum;
+  f->start    = (uint16_t)PROTO_START_FRAME_TRIP;
+  f->version  = Feedback.version;
+  f->caps     = Feedback.caps;
+  f->odoM     = trip.tot.odoM;
+  f->usedMWh  = trip.tot.usedMWh;
+  f->regenMWh = trip.tot.regenMWh;
+  f->onTime   = trip.tot.onTime;
+  f->errTime  = trip.tot.errTime;
+  f->maxTemp  = trip.tot.maxTemp;
+  f->maxCurr  = trip.tot.maxCurr;
+  f->cmdSeq   = Feedback.cmdSeq;
+  checksum    = calc_crc32(buf, sizeof(ProtoTrip) - sizeof(uint16_t) * 2);
+  f->checksumL = (uint16_t)checksum;
+  f->checksumH = (uint16_t)(checksum >> 16);
+  return sizeof(ProtoTrip);
+}
+#endif
+
+// ####### FEEDBACK SERIAL OUT #######
+static void taskFeedback(void) {
+  Feedback.start	        = (uint16_t)SERIAL_START_FRAME;
+  Feedback.version          = PROTO_VERSION;
+  Feedback.caps             = PROTO_CAP_LED;
+  #if defined(SERIAL_HW_CRC)
+  Feedback.caps            |= PROTO_CAP_HW_CRC;
+  #endif
+  #if defined(ISR_PROFILING)
+  Feedback.caps            |= PROTO_CAP_ISR_PROF;
+  #endif
+  if (rtY_Left.z_errCode || rtY_Right.z_errCode) {
+    Feedback.caps          |= PROTO_CAP_FAULT;      // same condition as enableFin in bldc.c
+  }
+  #if defined(BAT_SOC_ENABLE)
+  Feedback.caps            |= PROTO_CAP_BAT_SOC;
+  Feedback.batSoc           = batSoc.soc;
+  #else
+  Feedback.batSoc           = PROTO_BAT_SOC_NONE;
+  #endif
+  #if defined(REGEN_LIMIT)
+  Feedback.caps            |= PROTO_CAP_REGEN;
+  Feedback.regenWh          = (uint16_t)MIN(regen.regenMWh / 10, 0xFFFF);
+  #else
+  Feedback.regenWh          = 0;
+  #endif
+  BldcState st;                         // odometry and speeds of the same control tick
+  bldc_state_read(&st);
+  Feedback.odoTime          = (uint16_t)st.tick;
+  Feedback.edgeAge0         = (uint16_t)MIN(st.tick - st.odo[0].edgeTick, 0xFFFF);
+  Feedback.edgeAge1         = (uint16_t)MIN(st.tick - st.odo[1].edgeTick, 0xFFFF);
+  Feedback.odo1             = boardOutR((int16_t)st.odo[1].pos);
+  Feedback.odo0             = boardOutL((int16_t)st.odo[0].pos);
+  Feedback.speedR_meas = boardOutR((int16_t)st.n_mot[1]);
+  Feedback.speedL_meas = boardOutL((int16_t)st.n_mot[0]);
+  Feedback.batVoltage	    = (int16_t)batVoltageCalib;
+  Feedback.boardTemp	    = (int16_t)board_temp_deg_c;
+  #if defined(ISR_PROFILING)
+  Feedback.isrCycMean     = isrProf[ISR_PROF_TOTAL].mean;
+  Feedback.isrCycMax      = isrProf[ISR_PROF_TOTAL].max;
+  #endif
+  Feedback.cpuLoad          = schedLoad.load;
+
+  #if defined(SERIAL_BUS)
+  Feedback.cmdLed           = (uint16_t)sideboard_leds;
+  usart_bus_feedback(&Feedback);        // sent when a bus frame polls this board, with its cmdSeq, fbTime and checksum
+  #else
+  #if defined(FEEDBACK_SERIAL_USART2)
+    #if defined(SIDEBOARD_SERIAL_USART2)
+    if(sideboardLedsDue(&sideboard_ledsSent_L, &sideboard_ledsTick_L)) {
+    #else
+    {
+    #endif
+      uint8_t *buf        = usart_tx_buf(&fbTx_L);   // never the frame on the wire, the frame is sent now or on its Tx complete
+      Feedback.cmdLed     = (uint16_t)sideboard_leds;
+      #if defined(CONTROL_SERIAL_USART2) && !defined(CONTROL_IBUS)
+      Feedback.cmdSeq     = serialSeq_L;
+      Feedback.cmdAge     = (uint16_t)MIN(timeMs() - serialSeqTick_L, 0xFFFF);
+      #endif
+      #if defined(SERIAL_BAUD_NEGOTIATION) && defined(CONTROL_SERIAL_USART2)
+      Feedback.caps      &= ~PROTO_CAP_BAUD;
+      if (usart_tx_idle(&fbTx_L)) {                // the rate switches only between frames
+        Feedback.caps    |= usart_baud_task(&serialBaud_L);
+      }
+      #endif
+      #if defined(SIDEBOARD_FAST) && defined(SIDEBOARD_SERIAL_USART2)
+      Feedback.caps       = (Feedback.caps & ~PROTO_CAP_SB_FAST) | ((rxFrame_L.sbCaps & PROTO_SB_CAP_FAST) ? PROTO_CAP_SB_FAST : 0);
+      #elif defined(SIDEBOARD_FAST)
+      Feedback.caps      &= ~PROTO_CAP_SB_FAST;
+      #endif
+      uint32_t fbNow      = timeUs();
+      Feedback.fbTime     = (uint16_t)fbNow;
+      #if defined(TIME_SYNC)
+      Feedback.syncTime   = usart_sync_time(fbNow);
+      #endif
+      #if defined(TRIP_STATS)
+      if (serialTripReq_L) {
+        serialTripReq_L = 0;
+        usart_tx_send(&fbTx_L, feedbackTrip(buf));
+      } else
+      #endif
+      #if defined(FEEDBACK_COMPACT) && defined(CONTROL_SERIAL_USART2)
+      if (serialFbCompact_L) {
+        #if defined(SERIAL_HW_CRC)
+        usart_tx_send(&fbTx_L, feedbackCompact(&fbCompact_L, buf, serialHwCrc_L));
         #else
-          Feedback.speedR_meas = -(int16_t)rtY_Right.n_mot;
+        usart_tx_send(&fbTx_L, feedbackCompact(&fbCompact_L, buf, 0));
         #endif
-        #ifdef INVERT_L_DIRECTION
-          Feedback.speedL_meas = -(int16_t)rtY_Left.n_mot;
+      } else
+      #endif
+      {
+        #if defined(SERIAL_HW_CRC)
+        Feedback.start    = serialHwCrc_L ? (uint16_t)SERIAL_START_FRAME_HWCRC : (uint16_t)SERIAL_START_FRAME;
+        uint32_t checksum = serialHwCrc_L ? calc_crc32_hw((uint8_t*)&Feedback,sizeof(SerialFeedback) - sizeof(uint16_t)*2)
+                                            : calc_crc32((uint8_t*)&Feedback,sizeof(SerialFeedback) - sizeof(uint16_t)*2);
         #else
-          Feedback.speedL_meas = (int16_t)rtY_Left.n_mot;
-        #endif
-        Feedback.batVoltage	    = (int16_t)batVoltageCalib;
-        Feedback.boardTemp	    = (int16_t)board_temp_deg_c;
-
-        #if defined(FEEDBACK_SERIAL_USART2)
-          if(__HAL_DMA_GET_COUNTER(huart2.hdmatx) == 0) {
-            Feedback.cmdLed     = (uint16_t)sideboard_leds_L;
-            uint32_t checksum = calc_crc32((uint8_t*)&Feedback,sizeof(SerialFeedback) - sizeof(uint16_t)*2);
-            Feedback.checksumL   =  checksum & 0xFFFF;
-            Feedback.checksumH   =  checksum >> 16;
-            HAL_UART_Transmit_DMA(&huart2, (uint8_t *)&Feedback, sizeof(SerialFeedback));
-          }
-        #endif
-        #if defined(FEEDBACK_SERIAL_USART3)
-          if(__HAL_DMA_GET_COUNTER(huart3.hdmatx) == 0) {
-            Feedback.cmdLed     = (uint16_t)sideboard_leds_R;
-            uint32_t checksum = calc_crc32((uint8_t*)&Feedback,sizeof(SerialFeedback) - sizeof(uint16_t)*2);
-            Feedback.checksumL   =  checksum & 0xFFFF;
-            Feedback.checksumH   =  checksum >> 16;
-            HAL_UART_Transmit_DMA(&huart3, (uint8_t *)&Feedback, sizeof(SerialFeedback));
-          }
+        uint32_t checksum = calc_crc32((uint8_t*)&Feedback,sizeof(SerialFeedback) - sizeof(uint16_t)*2);
         #endif
+        Feedback.checksumL =  checksum & 0xFFFF;
+        Feedback.checksumH =  checksum >> 16;
+        memcpy(buf, &Feedback, sizeof(SerialFeedback));
+        usart_tx_send(&fbTx_L, sizeof(SerialFeedback));
       }
+    }
+  #endif
+  #if defined(FEEDBACK_SERIAL_USART3)
+    #if defined(SIDEBOARD_SERIAL_USART3)
+    if(sideboardLedsDue(&sideboard_ledsSent_R, &sideboard_ledsTick_R)) {
+    #else
+    {
     #endif
-
-    // ####### POWEROFF BY POWER-BUTTON #######
-    poweroffPressCheck();
-
-    // ####### BEEP AND EMERGENCY POWEROFF #######
-    if (TEMP_POWEROFF_ENABLE && board_temp_deg_c >= TEMP_POWEROFF && speedAvgAbs < 20){  // poweroff before mainboard burns OR low bat 3
-      #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
-        printf("Powering off, temperature is too high\r\n");
+      uint8_t *buf        = usart_tx_buf(&fbTx_R);   // never the frame on the wire, the frame is sent now or on its Tx complete
+      Feedback.cmdLed     = (uint16_t)sideboard_leds;
+      #if defined(CONTROL_SERIAL_USART3) && !defined(CONTROL_IBUS)
+      Feedback.cmdSeq     = serialSeq_R;
+      Feedback.cmdAge     = (uint16_t)MIN(timeMs() - serialSeqTick_R, 0xFFFF);
       #endif
-      poweroff();
-    } else if ( BAT_DEAD_ENABLE && batVoltage < BAT_DEAD && speedAvgAbs < 20){
-      #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
-        printf("Powering off, battery voltage is too low\r\n");
+      #if defined(SERIAL_BAUD_NEGOTIATION) && defined(CONTROL_SERIAL_USART3)
+      Feedback.caps      &= ~PROTO_CAP_BAUD;
+      if (usart_tx_idle(&fbTx_R)) {                // the rate switches only between frames
+        Feedback.caps    |= usart_baud_task(&serialBaud_R);
+      }
       #endif
-      poweroff();
-    } else if (rtY_Left.z_errCode || rtY_Right.z_errCode) {                                           // 1 beep (low pitch): Motor error, disable motors
-      enable = 0;
-      beepCount(1, 24, 1);
-    } else if (timeoutFlgADC) {                                                                       // 2 beeps (low pitch): ADC timeout
-      beepCount(2, 24, 1);
-    } else if (timeoutFlgSerial) {                                                                    // 3 beeps (low pitch): Serial timeout
-      beepCount(3, 24, 1);
-    } else if (timeoutFlgGen) {                                                                       // 4 beeps (low pitch): General timeout (PPM, PWM, Nunchuk)
-      beepCount(4, 24, 1);
-    } else if (TEMP_WARNING_ENABLE && board_temp_deg_c >= TEMP_WARNING) {                             // 5 beeps (low pitch): Mainboard temperature warning
-      beepCount(5, 24, 1);
-    } else if (BAT_LVL1_ENABLE && batVoltage < BAT_LVL1) {                                            // 1 beep fast (medium pitch): Low bat 1
-      beepCount(0, 10, 6);
-    } else if (BAT_LVL2_ENABLE && batVoltage < BAT_LVL2) {                                            // 1 beep slow (medium pitch): Low bat 2
-      beepCount(0, 10, 30);
-    } else if (BEEPS_BACKWARD && (((cmdR < -50 || cmdL < -50) && speedAvg < 0) || MultipleTapBrake.b_multipleTap)) { // 1 beep fast (high pitch): Backward spinning motors
-      beepCount(0, 5, 1);
-      backwardDrive = 1;
-    } else {  // do not beep
-      beepCount(0, 0, 0);
-      backwardDrive = 0;
+      #if defined(SIDEBOARD_FAST) && defined(SIDEBOARD_SERIAL_USART3)
+      Feedback.caps       = (Feedback.caps & ~PROTO_CAP_SB_FAST) | ((rxFrame_R.sbCaps & PROTO_SB_CAP_FAST) ? PROTO_CAP_SB_FAST : 0);
+      #elif defined(SIDEBOARD_FAST)
+      Feedback.caps      &= ~PROTO_CAP_SB_FAST;
+      #endif
+      uint32_t fbNow      = timeUs();
+      Feedback.fbTime     = (uint16_t)fbNow;
+      #if defined(TIME_SYNC)
+      Feedback.syncTime   = usart_sync_time(fbNow);
+      #endif
+      #if defined(TRIP_STATS)
+      if (serialTripReq_R) {
+        serialTripReq_R = 0;
+        usart_tx_send(&fbTx_R, feedbackTrip(buf));
+      } else
+      #endif
+      #if defined(FEEDBACK_COMPACT) && defined(CONTROL_SERIAL_USART3)
+      if (serialFbCompact_R) {
+        #if defined(SERIAL_HW_CRC)
+        usart_tx_send(&fbTx_R, feedbackCompact(&fbCompact_R, buf, serialHwCrc_R));
+        #else
+        usart_tx_send(&fbTx_R, feedbackCompact(&fbCompact_R, buf, 0));
+        #endif
+      } else
+      #endif
+      {
+        #if defined(SERIAL_HW_CRC)
+        Feedback.start    = serialHwCrc_R ? (uint16_t)SERIAL_START_FRAME_HWCRC : (uint16_t)SERIAL_START_FRAME;
+        uint32_t checksum = serialHwCrc_R ? calc_crc32_hw((uint8_t*)&Feedback,sizeof(SerialFeedback) - sizeof(uint16_t)*2)
+                                            : calc_crc32((uint8_t*)&Feedback,sizeof(SerialFeedback) - sizeof(uint16_t)*2);
+        #else
+        uint32_t checksum = calc_crc32((uint8_t*)&Feedback,sizeof(SerialFeedback) - sizeof(uint16_t)*2);
+        #endif
+        Feedback.checksumL =  checksum & 0xFFFF;
+        Feedback.checksumH =  checksum >> 16;
+        memcpy(buf, &Feedback, sizeof(SerialFeedback));
+        usart_tx_send(&fbTx_R, sizeof(SerialFeedback));
+      }
     }
+  #endif
+  #endif // SERIAL_BUS
+}
+#endif
 
+#if defined(DEBUG_OUT)
+// ####### DEBUG SERIAL OUT #######
+static void taskDebug(void) {
+  #if defined(DEBUG_SERIAL_PROTOCOL)
+    process_debug();
+  #else
+    printf("in1:%i in2:%i cmdL:%i cmdR:%i BatADC:%i BatV:%i TempADC:%i Temp:%i \r\n",
+      input1[inIdx].raw,        // 1: INPUT1
+      input2[inIdx].raw,        // 2: INPUT2
+      cmdL,                     // 3: output command: [-1000, 1000]
+      cmdR,                     // 4: output command: [-1000, 1000]
+      adc_buffer.batt1,         // 5: for battery voltage calibration
+      batVoltageCalib,          // 6: for verifying battery voltage calibration
+      board_temp_adcFilt,       // 7: for board temperature calibration
+      board_temp_deg_c);        // 8: for verifying board temperature calibration
+  #endif
+}
+#endif
 
-    inactivity_timeout_counter++;
-
-    // ####### INACTIVITY TIMEOUT #######
-    if (abs(cmdL) > 50 || abs(cmdR) > 50) {
-      inactivity_timeout_counter = 0;
-    }
-
-    #if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
-      if ((abs(rtP_Left.n_cruiseMotTgt)  > 50 && rtP_Left.b_cruiseCtrlEna) || 
-          (abs(rtP_Right.n_cruiseMotTgt) > 50 && rtP_Right.b_cruiseCtrlEna)) {
-        inactivity_timeout_counter = 0;
-      }
-    #endif
+#if defined(DEBUG_SERIAL_PROTOCOL) && defined(DEBUG_OUT)
+// ####### BINARY STREAM, BLACK BOX AND SCOPE DUMP #######
+static void taskStream(void) {
+  process_stream();
+  #if defined(BLACKBOX_ENABLE)
+  process_blackbox();
+  #endif
+  #if defined(SCOPE_ENABLE)
+  process_scope();
+  #endif
+  #if defined(SCHED_STATS)
+  process_sched();
+  #endif
+  #if defined(LATENCY_MEAS)
+  process_lat();
+  #endif
+  #if defined(CTRL_HOOKS)
+  process_hooks();
+  #endif
+  #if defined(FAULTLOG_ENABLE)
+  process_faultlog();
+  #endif
+  #if defined(HALL_CALIB)
+  process_hallcal();
+  #endif
+  #if defined(HALL_STATS)
+  process_hallstat();
+  #endif
+  #if defined(MOTOR_IDENT)
+  process_motid();
+  #endif
+  #if defined(COGGING_COMP)
+  process_cogcal();
+  #endif
+  #if defined(SPD_FILT)
+  process_spdid();
+  #endif
+  #if defined(ADC_SAMPLE_ALIGN)
+  process_adcsweep();
+  #endif
+}
 
-    if (inactivity_timeout_counter > (INACTIVITY_TIMEOUT * 60 * 1000) / (DELAY_IN_MAIN_LOOP + 1)) {  // rest of main loop needs maybe 1ms
-      #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
-        printf("Powering off, wheels were inactive for too long\r\n");
-      #endif
-      poweroff();
-    }
+// ####### DEBUG COMMANDS #######
+static void taskCommand(void) {
+  #if defined(DEBUG_RTT)
+  rttPoll();
+  #endif
+  process_bin_commands();
+  process_commands();
+}
+#endif
 
+#ifdef MULTI_MODE_DRIVE
+// ####### DRIVE PROFILES: limits, rate and filter of MULTI_MODE_DRIVE #######
+static void driveProfileApply(uint8_t idx) {
+  const DriveProfile *p = &driveProfiles[idx];
+
+  driveProfile      = driveProfileReq = idx;
+  driveProfileDirty = 0;
+  max_speed         = p->maxSpeed;
+  rate              = p->rate;
+  #ifndef USE_RAW_INPUT
+  filter            = p->filter;
+  #endif
+  rtP_Left.i_max          = rtP_Right.i_max          = (p->iMax * A2BIT_CONV) << 4;
+  rtP_Left.n_max          = rtP_Right.n_max          = p->nMax << 4;
+  rtP_Left.b_fieldWeakEna = rtP_Right.b_fieldWeakEna = p->fieldWeak;
+  Input_Lim_Init();
+}
 
-    // HAL_GPIO_TogglePin(LED_PORT, LED_PIN);                 // This is to measure the main() loop duration with an oscilloscope connected to LED_PIN
-    // Update states
-    inIdx_prev = inIdx;
-    buzzerTimer_prev = buzzerTimer;
-    main_loop_counter++;
+/* Requests come from the DRV_PROFILE parameter, the iBUS switch and the sideboard button (sideboardSensors).
+ * They are taken over at standstill only, the control task keeps running meanwhile */
+static void driveProfileUpdate(void) {
+  #if defined(DRIVE_PROFILE_IBUS_CH)
+    static uint8_t ibusSel = 0xFF;      // the switch position only requests a profile when it moves
+    #if defined(CONTROL_SERIAL_USART2)
+    if (rxFrame_L.good && !timeoutFlgSerial) {
+      uint8_t sel = (uint8_t)(ibusCh_L[DRIVE_PROFILE_IBUS_CH - 1] * DRIVE_PROFILES / 1001);
+    #else
+    if (rxFrame_R.good && !timeoutFlgSerial) {
+      uint8_t sel = (uint8_t)(ibusCh_R[DRIVE_PROFILE_IBUS_CH - 1] * DRIVE_PROFILES / 1001);
+    #endif
+      if (sel != ibusSel) {
+        ibusSel         = sel;
+        driveProfileReq = sel;
+      }
     }
+  #endif
+  if (driveProfileReq >= DRIVE_PROFILES) {
+    driveProfileReq = driveProfile;
   }
+  if ((driveProfileReq != driveProfile || driveProfileDirty) && speedAvgAbs < 5) {
+    driveProfileApply(driveProfileReq);
+  }
+}
+
+/* DRV_Mx_* parameter callback: apply the changed values at the next standstill */
+void driveProfileChanged(void) {
+  driveProfileDirty = 1;
 }
+#endif
 
 
 // ===========================================================
 /** System Clock Configuration
 */
 void SystemClock_Config(void) {
+  #if defined(MCU_CFGR_PLL)
+  // GD32F103 / AT32F403 by register, see mcu.h. The HAL would read back the PLL multiplier without the extra bits
+  RCC->CR |= RCC_CR_HSION;
+  while (!(RCC->CR & RCC_CR_HSIRDY)) {}
+  RCC->CFGR &= ~RCC_CFGR_SW;                            // on the HSI while the PLL is set up
+  while (RCC->CFGR & RCC_CFGR_SWS) {}
+  RCC->CR   &= ~RCC_CR_PLLON;
+  while (RCC->CR & RCC_CR_PLLRDY) {}
+  RCC->CFGR  = MCU_CFGR_PLL | RCC_CFGR_PPRE1_DIV2 | MCU_CFGR_PPRE2 | MCU_CFGR_ADCPRE;  // PLL source HSI / 2, APB1 half
+  RCC->CR   |= RCC_CR_PLLON;
+  while (!(RCC->CR & RCC_CR_PLLRDY)) {}
+  #if defined(MCU_FLASH_LATENCY)
+  FLASH->ACR = (FLASH->ACR & ~FLASH_ACR_LATENCY) | MCU_FLASH_LATENCY;
+  #endif
+  #if defined(MCU_MISC2_AUTO_STEP)
+  MCU_RCC_MISC2 |= MCU_MISC2_AUTO_STEP;
+  #endif
+  RCC->CFGR |= RCC_CFGR_SW_PLL;
+  while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL) {}
+  #if defined(MCU_MISC2_AUTO_STEP)
+  MCU_RCC_MISC2 &= ~MCU_MISC2_AUTO_STEP;
+  #endif
+  SystemCoreClock = SYSCLK_HZ;                          // the bus clocks of the HAL (UART baud rates) follow from it
+  #else
   RCC_OscInitTypeDef RCC_OscInitStruct;
   RCC_ClkInitTypeDef RCC_ClkInitStruct;
   RCC_PeriphCLKInitTypeDef PeriphClkInit;
 
   /**Initializes the CPU, AHB and APB busses clocks
     */
-  RCC_OscInitStruct.OscillatorType      = RCC_OSCILLATORTYPE_HSI;
-  RCC_OscInitStruct.HSIState            = RCC_HSI_ON;
-  RCC_OscInitStruct.HSICalibrationValue = 16;
+  #if defined(CLOCK_HSE)
+  // 8 MHz crystal x9 = 72 MHz. If the crystal does not start, fall back to the HSI below
+  RCC_OscInitStruct.OscillatorType      = RCC_OSCILLATORTYPE_HSE;
+  RCC_OscInitStruct.HSEState            = RCC_HSE_ON;
+  RCC_OscInitStruct.HSEPredivValue      = RCC_HSE_PREDIV_DIV1;
   RCC_OscInitStruct.PLL.PLLState        = RCC_PLL_ON;
-  RCC_OscInitStruct.PLL.PLLSource       = RCC_PLLSOURCE_HSI_DIV2;
-  RCC_OscInitStruct.PLL.PLLMUL          = RCC_PLL_MUL16;
-  HAL_RCC_OscConfig(&RCC_OscInitStruct);
+  RCC_OscInitStruct.PLL.PLLSource       = RCC_PLLSOURCE_HSE;
+  RCC_OscInitStruct.PLL.PLLMUL          = RCC_PLL_MUL9;
+  if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
+  #endif
+  {
+    RCC_OscInitStruct.OscillatorType      = RCC_OSCILLATORTYPE_HSI;
+    RCC_OscInitStruct.HSIState            = RCC_HSI_ON;
+    RCC_OscInitStruct.HSICalibrationValue = 16;
+    RCC_OscInitStruct.PLL.PLLState        = RCC_PLL_ON;
+    RCC_OscInitStruct.PLL.PLLSource       = RCC_PLLSOURCE_HSI_DIV2;
+    RCC_OscInitStruct.PLL.PLLMUL          = RCC_PLL_MUL16;
+    HAL_RCC_OscConfig(&RCC_OscInitStruct);
+  }
 
   /**Initializes the CPU, AHB and APB busses clocks
     */
@@ -660,8 +1569,13 @@ void SystemClock_Config(void) {
 
   PeriphClkInit.PeriphClockSelection    = RCC_PERIPHCLK_ADC;
   // PeriphClkInit.AdcClockSelection    = RCC_ADCPCLK2_DIV8;  // 8 MHz
-  PeriphClkInit.AdcClockSelection       = RCC_ADCPCLK2_DIV4;  // 16 MHz
+  #if defined(CLOCK_HSE)
+  PeriphClkInit.AdcClockSelection       = RCC_ADCPCLK2_DIV6;  // 12 MHz, ADC_CLOCK_DIV
+  #else
+  PeriphClkInit.AdcClockSelection       = RCC_ADCPCLK2_DIV4;  // 16 MHz, ADC_CLOCK_DIV
+  #endif
   HAL_RCCEx_PeriphCLKConfig(&PeriphClkInit);
+  #endif
 
   /**Configure the Systick interrupt time
     */
@@ -672,5 +1586,5 @@ void SystemClock_Config(void) {
   HAL_SYSTICK_CLKSourceConfig(SYSTICK_CLKSOURCE_HCLK);
 
   /* SysTick_IRQn interrupt configuration */
-  HAL_NVIC_SetPriority(SysTick_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(SysTick_IRQn, IRQ_PRIO_SYSTICK, 0);
 }
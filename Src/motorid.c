@@ -0,0 +1,361 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Motor constant identification (MOTOR_IDENT). Only uses config.h and the controller tables, so it also builds on the host.
+//
+// Resistance: a DC voltage along phase A (B and C return the current) is regulated to MOTOR_IDENT_CUR / 2 and to
+// MOTOR_IDENT_CUR, the rotor turns onto phase A and stays there. R is the voltage difference over the current difference,
+// so the dead time and switch drops, the same at both currents, cancel. What is left of them at the test current is v0.
+// Inductance: at the high current a square wave of MOT_ID_HF_TICKS is added to the phase A voltage. The fundamental of
+// voltage and current (one DFT bin, independent of the sampling delay) gives the impedance R + j w L at that frequency.
+// The current does not cross zero, so the dead time only shifts the mean and is not seen by the fundamental.
+// Flux: the controller turns the motor in VLT_MODE at MOTOR_IDENT_VLT. Voltage and current are averaged in a frame that
+// turns with the controller angle, then E = V - (R + j w L) I, flux = |E| / w. The dead time voltage v0 of the DC test
+// is removed in the current direction (fundamental of its square wave, 3 v0 / pi). w comes from the controller angle.
+// Voltages are the duties times the bus voltage: +-1000 of rtY.DC_pha* is +-Vbat / 2 on the phase.
+
+#include <stdint.h>
+#include "config.h"
+#include "BLDC_controller.h"
+#include "motorid.h"
+
+#if defined(MOTOR_IDENT)
+
+#define MOT_ID_RAMP_TICKS       (PWM_FREQ / 2)                    // [ticks] current ramp up along phase B, then twice the time on phase A
+#define MOT_ID_HOLD_TICKS       (PWM_FREQ / 4)                    // [ticks] settling time at a new test current
+#define MOT_ID_MEAS_TICKS       (PWM_FREQ / 2)                    // [ticks] averaging time of each resistance measurement
+#define MOT_ID_HF_SETTLE        (MOT_ID_HF_TICKS * (PWM_FREQ / 10 / MOT_ID_HF_TICKS))   // [ticks] whole square wave periods
+#define MOT_ID_HF_MEAS          (MOT_ID_HF_TICKS * (PWM_FREQ / 2 / MOT_ID_HF_TICKS))
+#define MOT_ID_STOP_TICKS       (PWM_FREQ / 4)                    // [ticks] voltage ramp down before the motor turns
+#define MOT_ID_SPIN_TICKS       PWM_FREQ                          // [ticks] VLT_MODE ramp up, then the same time to reach a constant speed
+#define MOT_ID_FLUX_TICKS       PWM_FREQ                          // [ticks] averaging time of the flux measurement
+#define MOT_ID_COAST_TICKS      PWM_FREQ                          // [ticks] VLT_MODE ramp down
+#define MOT_ID_KI_SHIFT         8                                 // [-] current regulator: 1 / 256 dc per tick and ADC bit of error
+#define MOT_ID_AMP_MAX          400                               // [dc] voltage limit, the test current is not reached: open phase
+#define MOT_ID_HF_MIN           10                                // [ADC bits] smallest usable square wave current
+#define MOT_ID_N_MIN            20                                // [rpm] the motor must turn faster than this in VLT_MODE
+#define MOT_ID_CUR              (MOTOR_IDENT_CUR * A2BIT_CONV)    // [ADC bits] high test current
+#if defined(CTRL_MULTIRATE)
+  #define MOT_ID_FOC_RATE       PWM_FREQ                          // [Hz] current PI step rate
+#else
+  #define MOT_ID_FOC_RATE       (PWM_FREQ / 3)
+#endif
+
+void motIdStart(MotId *c) {
+  for (uint8_t k = 0; k < 2; k++) {
+    c->sv[k] = c->si[k] = 0;
+    c->hv[k] = c->hi[k] = 0;
+    c->fv[k] = c->fi[k] = 0;
+    c->vPrev[k] = 0;
+  }
+  c->angleSum  = 0;
+  c->rot       = 0;
+  c->acc       = 0;
+  c->ticks     = 0;
+  c->amp       = 0;
+  c->hf        = 0;
+  c->iTgt      = 0;
+  c->vlt       = 0;
+  c->sign      = 1;
+  c->failState = MOT_ID_IDLE;
+  c->state     = MOT_ID_ALIGN;
+}
+
+/* sin of an angle in degrees, Q14, from the quarter wave table of the controller */
+static int16_t motIdSin(int32_t deg) {
+  const int16_T *tab = rtConstP.r_sinQuarter_Table;
+  deg %= 360;
+  if (deg < 0)   { deg += 360; }
+  if (deg < 90)  { return tab[deg]; }
+  if (deg < 180) { return tab[180 - deg]; }
+  if (deg < 270) { return (int16_t)-tab[deg - 180]; }
+  return (int16_t)-tab[360 - deg];
+}
+
+static void motIdNext(MotId *c, uint8_t state) {
+  c->state = state;
+  c->ticks = 0;
+}
+
+static void motIdFail(MotId *c) {
+  c->failState = c->state;
+  c->state     = MOT_ID_FAIL;
+}
+
+/* Integral regulator of the phase A current ia to iTgt. 0 if the voltage limit is reached */
+static uint8_t motIdRegulate(MotId *c, int16_t ia) {
+  c->acc += c->iTgt - ia;
+  if (c->acc < 0) {
+    c->acc = 0;
+  }
+  c->amp = (int16_t)(c->acc >> MOT_ID_KI_SHIFT);
+  return c->amp < MOT_ID_AMP_MAX;
+}
+
+/* Overrides the controller inputs while the motor turns for the flux measurement */
+void motIdInput(const MotId *c, uint8_t *mode, int16_t *inpTgt) {
+  if (c->state >= MOT_ID_SPIN && c->state <= MOT_ID_COAST) {
+    *mode   = VLT_MODE;
+    *inpTgt = c->vlt;
+  }
+}
+
+/* Controller in VLT_MODE: direction of the voltage vector, then d / q averages in the frame of the controller angle */
+static void motIdTurn(MotId *c, const int16_t i[3], int16_t vbat, int16_t angle, int16_t n, const int16_t dc[3]) {
+  int32_t v[2], d = angle - c->anglePrev;
+
+  d -= d >= 180 ? 360 : (d < -180 ? -360 : 0);
+  // Clarke transforms, voltage times 3
+  v[0] = (2 * dc[0] - dc[1] - dc[2]) * vbat;
+  v[1] = (((dc[1] - dc[2]) * 28378) >> 14) * vbat;               // sqrt(3), Q14
+  switch (c->state) {
+    case MOT_ID_SPIN:
+      c->vlt = (int16_t)(MOTOR_IDENT_VLT * (int32_t)(c->ticks < MOT_ID_SPIN_TICKS ? c->ticks : MOT_ID_SPIN_TICKS) / MOT_ID_SPIN_TICKS);
+      if (c->ticks > MOT_ID_SPIN_TICKS) {
+        int64_t cross = (int64_t)c->vPrev[0] * v[1] - (int64_t)c->vPrev[1] * v[0];
+        c->rot      += cross > 0 ? 1 : (cross < 0 ? -1 : 0);
+        c->angleSum += d;
+      }
+      if (c->ticks >= 2 * MOT_ID_SPIN_TICKS) {
+        if (n < MOT_ID_N_MIN && n > -MOT_ID_N_MIN) {
+          motIdFail(c);                 // blocked, or the controller is in an error state
+          return;
+        }
+        c->sign     = (c->rot > 0) == (c->angleSum > 0) ? 1 : -1;
+        c->angleSum = 0;
+        motIdNext(c, MOT_ID_FLUX);
+      }
+      break;
+    case MOT_ID_FLUX: {
+      // The current of this tick follows the voltage of the previous one, both in the frame of the previous angle
+      int32_t phi = c->sign * c->anglePrev;
+      int32_t s   = motIdSin(phi), co = motIdSin(phi + 90);
+      int32_t ib  = ((i[1] - i[2]) * 9459) >> 14;                  // 1 / sqrt(3), Q14
+      c->fv[0]   += (int64_t)c->vPrev[0] * co + (int64_t)c->vPrev[1] * s;
+      c->fv[1]   += (int64_t)c->vPrev[1] * co - (int64_t)c->vPrev[0] * s;
+      c->fi[0]   += i[0] * co + ib * s;
+      c->fi[1]   += ib * co - i[0] * s;
+      c->angleSum += d;
+      if (c->ticks >= MOT_ID_FLUX_TICKS) {
+        motIdNext(c, MOT_ID_COAST);
+      }
+      break;
+    }
+    default:                            // MOT_ID_COAST
+      c->vlt = (int16_t)(MOTOR_IDENT_VLT * (int32_t)(MOT_ID_COAST_TICKS - c->ticks) / MOT_ID_COAST_TICKS);
+      if (c->ticks >= MOT_ID_COAST_TICKS) {
+        c->vlt   = 0;
+        c->state = MOT_ID_DONE;
+      }
+      break;
+  }
+  c->vPrev[0]  = v[0];
+  c->vPrev[1]  = v[1];
+  c->anglePrev = angle;
+}
+
+/* Voltage a [dc] along phase k, the other two return the current. Returns the phase voltage times 3 [dc * V*100 * 3] */
+static int32_t motIdOutput(int32_t a, uint8_t k, int16_t vbat, int16_t dc[3]) {
+  dc[0] = dc[1] = dc[2] = (int16_t)(-a / 2);
+  dc[k] = (int16_t)a;
+  return (2 * dc[k] + 2 * (a / 2)) * vbat;
+}
+
+/* One control tick. i are the phase currents [ADC bits], vbat the bus voltage [V*100], angle and n the controller
+ * outputs a_elecAngle [deg] and n_mot [rpm], dc the controller duties in the rtY.DC_pha* range.
+ * Returns 1 with the identification duties in dc, 0 while the controller drives the motor (motIdInput) or when stopped */
+uint8_t motIdStep(MotId *c, const int16_t i[3], int16_t vbat, int16_t angle, int16_t n, int16_t dc[3]) {
+  uint32_t p;
+  int32_t  v3;
+  uint8_t  hi;
+
+  if (c->state < MOT_ID_ALIGN || c->state > MOT_ID_COAST) {
+    return 0;
+  }
+  c->ticks++;
+  if (c->state >= MOT_ID_SPIN) {
+    motIdTurn(c, i, vbat, angle, n, dc);
+    return 0;
+  }
+  switch (c->state) {
+    case MOT_ID_ALIGN:                  // along phase B first: the rotor may rest opposite to phase A, where it has no torque
+      hi      = c->ticks > MOT_ID_RAMP_TICKS;
+      c->iTgt = (int16_t)(hi ? MOT_ID_CUR / 2 : MOT_ID_CUR / 2 * (int32_t)c->ticks / MOT_ID_RAMP_TICKS);
+      if (!motIdRegulate(c, i[!hi])) {
+        motIdFail(c);                   // open phase or MOTOR_IDENT_CUR too high for the motor
+        return 0;
+      }
+      motIdOutput(c->amp, !hi, vbat, dc);
+      if (c->ticks >= 3 * MOT_ID_RAMP_TICKS) {
+        motIdNext(c, MOT_ID_RES_LO);
+      }
+      break;
+    case MOT_ID_RES_LO:
+    case MOT_ID_RES_HI:
+      hi      = c->state == MOT_ID_RES_HI;
+      c->iTgt = hi ? MOT_ID_CUR : MOT_ID_CUR / 2;
+      if (!motIdRegulate(c, i[0])) {
+        motIdFail(c);
+        return 0;
+      }
+      v3 = motIdOutput(c->amp, 0, vbat, dc);
+      if (c->ticks > MOT_ID_HOLD_TICKS) {
+        c->sv[hi] += v3;
+        c->si[hi] += i[0];
+      }
+      if (c->ticks >= MOT_ID_HOLD_TICKS + MOT_ID_MEAS_TICKS) {
+        motIdNext(c, hi ? MOT_ID_IND_RAMP : MOT_ID_RES_HI);
+        c->iMin = c->iMax = i[0];
+      }
+      break;
+    case MOT_ID_IND_RAMP:               // raise the square wave until its current is a quarter of the high test current
+    case MOT_ID_IND:
+      p  = (c->ticks - 1) % MOT_ID_HF_TICKS;
+      v3 = motIdOutput(c->amp + (p < MOT_ID_HF_TICKS / 2 ? c->hf : -c->hf), 0, vbat, dc);
+      c->iMin = i[0] < c->iMin ? i[0] : c->iMin;
+      c->iMax = i[0] > c->iMax ? i[0] : c->iMax;
+      if (c->state == MOT_ID_IND && c->ticks > MOT_ID_HF_SETTLE) {
+        int32_t k  = (int32_t)p * 360 / MOT_ID_HF_TICKS;
+        int32_t co = motIdSin(k + 90), s = motIdSin(k);
+        c->hv[0] += (int64_t)v3 * co;
+        c->hv[1] += (int64_t)v3 * s;
+        c->hi[0] += i[0] * co;
+        c->hi[1] += i[0] * s;
+        if (c->ticks >= MOT_ID_HF_SETTLE + MOT_ID_HF_MEAS) {
+          motIdNext(c, MOT_ID_STOP);
+        }
+      }
+      if (p == MOT_ID_HF_TICKS - 1) {   // end of a square wave period
+        if (c->state == MOT_ID_IND_RAMP) {
+          if (c->iMax - c->iMin >= MOT_ID_CUR / 4 || c->amp + c->hf >= MOT_ID_AMP_MAX) {
+            if (c->iMax - c->iMin < MOT_ID_HF_MIN) {
+              motIdFail(c);             // no current change: inductance far too high or a measurement fault
+              return 0;
+            }
+            motIdNext(c, MOT_ID_IND);
+          } else {
+            c->hf++;
+          }
+        }
+        c->iMin = c->iMax = i[0];
+      }
+      break;
+    default:                            // MOT_ID_STOP
+      motIdOutput(c->amp * (int32_t)(MOT_ID_STOP_TICKS - c->ticks) / MOT_ID_STOP_TICKS, 0, vbat, dc);
+      if (c->ticks >= MOT_ID_STOP_TICKS) {
+        motIdNext(c, MOT_ID_SPIN);
+        c->anglePrev = angle;
+      }
+      break;
+  }
+  return 1;
+}
+
+static uint32_t motIdSqrt(uint64_t x) {
+  uint64_t r = 0, b = 1ULL << 62;
+  while (b > x) {
+    b >>= 2;
+  }
+  while (b) {
+    if (x >= r + b) {
+      x -= r + b;
+      r  = (r >> 1) + b;
+    } else {
+      r >>= 1;
+    }
+    b >>= 2;
+  }
+  return (uint32_t)r;
+}
+
+// Sums to means: [dc * V*100 * 3] is 5 / 3 uV, ADC bits are 1e6 / A2BIT_CONV uA
+#define MOT_ID_UV(sum, n, q)    ((sum) * 5 / (3LL * (n)) >> (q))
+#define MOT_ID_UA(sum, n, q)    (((sum) * 1000000 / ((int64_t)A2BIT_CONV * (n))) >> (q))
+
+/* Resistance, inductance and flux from the sums of a finished run (MOT_ID_DONE). Not for the control interrupt:
+ * 64-bit divisions. Returns 1 and the results in r, l and flux if they are plausible, else MOT_ID_FAIL */
+uint8_t motIdResult(MotId *c) {
+  int64_t v[2], i[2], r, v0, z, x, l, w, vd, vq, id, iq, im, ed, eq, flux;
+
+  if (c->state != MOT_ID_DONE) {
+    return 0;
+  }
+  c->failState = MOT_ID_DONE;
+  c->state     = MOT_ID_FAIL;
+  // Resistance [uOhm] and the voltage offset v0 [uV] at the low test current
+  for (uint8_t k = 0; k < 2; k++) {
+    v[k] = MOT_ID_UV(c->sv[k], MOT_ID_MEAS_TICKS, 0);
+    i[k] = MOT_ID_UA(c->si[k], MOT_ID_MEAS_TICKS, 0);
+  }
+  if (i[1] - i[0] < 1000000LL * MOTOR_IDENT_CUR / 4) {
+    return 0;
+  }
+  r  = (v[1] - v[0]) * 1000000 / (i[1] - i[0]);
+  v0 = v[0] - r * i[0] / 1000000;
+  // Inductance [uH] from the impedance at the square wave frequency
+  v[0] = MOT_ID_UV(c->hv[0], MOT_ID_HF_MEAS, 14);
+  v[1] = MOT_ID_UV(c->hv[1], MOT_ID_HF_MEAS, 14);
+  i[0] = MOT_ID_UA(c->hi[0], MOT_ID_HF_MEAS, 14);
+  i[1] = MOT_ID_UA(c->hi[1], MOT_ID_HF_MEAS, 14);
+  im   = motIdSqrt((uint64_t)(i[0] * i[0] + i[1] * i[1]));
+  if (im == 0) {
+    return 0;
+  }
+  z = (int64_t)motIdSqrt((uint64_t)(v[0] * v[0] + v[1] * v[1])) * 1000000 / im;
+  x = z > r ? motIdSqrt((uint64_t)(z * z - r * r)) : 0;
+  l = x * MOT_ID_HF_TICKS * 1000 / (6283LL * PWM_FREQ);
+  // Flux [uV s]: electrical speed [mrad/s] of the frame, back-EMF [uV]
+  w  = (int64_t)c->sign * c->angleSum * 17453 * PWM_FREQ / (1000LL * MOT_ID_FLUX_TICKS);
+  vd = MOT_ID_UV(c->fv[0], MOT_ID_FLUX_TICKS, 14);
+  vq = MOT_ID_UV(c->fv[1], MOT_ID_FLUX_TICKS, 14);
+  id = MOT_ID_UA(c->fi[0], MOT_ID_FLUX_TICKS, 14);
+  iq = MOT_ID_UA(c->fi[1], MOT_ID_FLUX_TICKS, 14);
+  im = motIdSqrt((uint64_t)(id * id + iq * iq));
+  if (im > 0) {
+    vd -= v0 * 30000 / 31416 * id / im;
+    vq -= v0 * 30000 / 31416 * iq / im;
+  }
+  ed = vd - r * id / 1000000 + w * l * iq / 1000000000;
+  eq = vq - r * iq / 1000000 - w * l * id / 1000000000;
+  if (w == 0) {
+    return 0;
+  }
+  flux = (int64_t)motIdSqrt((uint64_t)(ed * ed + eq * eq)) * 1000 / (w < 0 ? -w : w);
+  r   /= 1000;
+  if (r < 5 || r > 5000 || l < 5 || l > 20000 || flux < 1000 || flux > 65535) {
+    return 0;
+  }
+  c->r     = (uint16_t)r;
+  c->l     = (uint16_t)l;
+  c->flux  = (uint16_t)flux;
+  c->state = MOT_ID_DONE;
+  return 1;
+}
+
+/* Current PI gains in the controller scaling for a bandwidth of bw [Hz] at the bus voltage vbat [V*100]: Kp = w L and
+ * Ki = w R / 4. The PI zero sits at a quarter of the R / L pole instead of cancelling it: the current filter
+ * (cf_currFilt) and the PI step delay add enough lag to overshoot by 10 % and more otherwise. The PI output is
+ * +-1000 = +-vbat / 2 on the phase, Kp out = err * kp >> 11 and the integral err * ki >> 16 per current PI step */
+void motIdGains(const MotId *c, int16_t vbat, uint16_t bw, uint16_t *kp, uint16_t *ki) {
+  int64_t den = (int64_t)vbat * A2BIT_CONV;
+  int64_t p   = 6283LL * bw * c->l * 4096 / (10000 * den);
+  int64_t i   = 65536LL * 6283 * bw * c->r * 50 / (1000LL * MOT_ID_FOC_RATE * den);
+  *kp = (uint16_t)(p > 65535 ? 65535 : p);
+  *ki = (uint16_t)(i > 65535 ? 65535 : (i < 1 ? 1 : i));
+}
+
+#endif
@@ -0,0 +1,170 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Rotor flux observer (ANGLE_OBSERVER). Only uses config.h, so it also builds on the host (make host-sil).
+//
+// Voltage model flux observer in the stator frame, flux normalised to OBS_FLUX:
+//   x'  = v - R i - wc eta                      stator flux, integral of the phase voltage
+//   eta = x - L i                               rotor flux
+// so eta is the rotor flux through a first order high pass at wc, which removes the drift of the pure integral
+// (current offsets, R error). wc follows the electrical speed, wc = w / OBS_CUT, so the angle of eta lags the
+// rotor flux by the constant atan(1 / OBS_CUT) and its magnitude does not depend on OBS_FLUX being exact.
+// The lag, the hall mounting and the angle conventions are one offset to the hall angle of the controller.
+// It is learned between OBS_SPD_LO and OBS_SPD_HI and the observer takes over above OBS_SPD_HI.
+
+#include <stdint.h>
+#include "config.h"
+#include "observer.h"
+#include "ramfunc.h"
+
+#if defined(ANGLE_OBSERVER)
+
+#define OBS_ONE         (1L << 24)                                // [Q24] normalised rotor flux
+// Per tick flux change for 3x the Clarke voltage in timer counts times the bus voltage [V*100], Q16
+#define OBS_KV          ((int32_t)((1LL << 40) / (9600LL * OBS_FLUX)))
+// Per tick flux change of the resistive drop for 1 ADC bit of current, Q16
+#define OBS_KR          ((int32_t)(((int64_t)OBS_R << 40) * 1000 / ((int64_t)A2BIT_CONV * PWM_FREQ * OBS_FLUX)))
+// Inductive flux for 1 ADC bit of current, Q4
+#define OBS_KL          ((int32_t)(((int64_t)OBS_L << 28) / ((int64_t)A2BIT_CONV * OBS_FLUX)))
+#define OBS_CUT         4                                         // [-] electrical speed / high pass corner, 14 deg lag
+#define OBS_KC          ((int32_t)(2.0 * 3.14159265 / OBS_CUT * 16384))  // 2 pi / OBS_CUT, Q14: 2^16 per turn speed to rad
+#define OBS_SPEED_CUT   (10 << 8)                                 // [2^16 per turn per tick, Q8] minimum corner, 2.4 Hz at 16 kHz
+#define OBS_MAG_MIN     (OBS_ONE / 4)                             // [Q24] plausible squared rotor flux magnitude, 0.5 .. 1.5 OBS_FLUX
+#define OBS_MAG_MAX     (OBS_ONE * 9 / 4)
+#define OBS_LEARN_TICKS (PWM_FREQ / 10)                           // [ticks] offset learning time before the first take over
+#define OBS_SPEED_MIN   (5 << 8)                                  // [2^16 per turn per tick, Q8] both angles must turn faster than this to learn
+
+/* atan2 in 2^16 per turn, max error 0.3 deg: atan(r) = pi/4 r + 0.273 r (1 - r) on the first octant */
+static uint16_t obsAtan2(int32_t y, int32_t x) {
+  uint32_t ax = (uint32_t)(x < 0 ? -x : x);
+  uint32_t ay = (uint32_t)(y < 0 ? -y : y);
+  uint32_t mn = ax < ay ? ax : ay;
+  uint32_t mx = ax < ay ? ay : ax;
+  uint32_t r, a;
+
+  if (mx == 0) {
+    return 0;
+  }
+  while (mx > 0xFFFF) {                 // keep mn << 15 in 32 bits
+    mx >>= 1;
+    mn >>= 1;
+  }
+  r = (mn << 15) / mx;                  // Q15, [0, 1]
+  a = (r >> 2) + ((2847 * ((r * (32768 - r)) >> 15)) >> 15);
+  if (ay > ax)  { a = 16384 - a; }
+  if (x < 0)    { a = 32768 - a; }
+  if (y < 0)    { a = 65536 - a; }
+  return (uint16_t)a;
+}
+
+void obsInit(Observer *o) {
+  o->x[0]      = 0;
+  o->x[1]      = 0;
+  o->mag       = 0;
+  o->speed     = 0;
+  o->hallSpeed = 0;
+  o->offset    = 0;
+  o->angle     = 0;
+  o->anglePrev = 0;
+  o->hallPrev  = 0;
+  o->bump      = 0;
+  o->learn     = 0;
+  o->active    = 0;
+}
+
+/* Restart the flux estimate, e.g. while the PWM outputs are off. The learned hall offset is kept */
+void obsReset(Observer *o) {
+  o->x[0]   = 0;
+  o->x[1]   = 0;
+  o->mag    = 0;
+  o->bump   = 0;
+  o->active = 0;
+}
+
+/* One observer update with the phase currents i [ADC bits] sampled at the start of this tick, the duties ccr
+ * [timer counts] applied since the previous tick and the bus voltage vdc [V*100] */
+RAMFUNC void obsStep(Observer *o, const int16_t i[3], const uint16_t ccr[3], int16_t vdc) {
+  int32_t v[2], ia[2], eta[2], w;
+
+  // Clarke transforms, voltages times 3. The zero sequence of the duties cancels
+  v[0]  = 2 * ccr[0] - ccr[1] - ccr[2];
+  v[1]  = (((int32_t)ccr[1] - ccr[2]) * 28378) >> 14;             // sqrt(3), Q14
+  ia[0] = i[0];
+  ia[1] = ((i[1] - i[2]) * 9459) >> 14;                           // 1 / sqrt(3), Q14
+
+  for (uint8_t k = 0; k < 2; k++) {
+    eta[k]  = o->x[k] - ((OBS_KL * ia[k]) >> 4);
+  }
+  o->mag = (int32_t)(((int64_t)eta[0] * eta[0] + (int64_t)eta[1] * eta[1]) >> 24);
+
+  // High pass corner from the faster of the observer and hall speeds, the hall one starts the observer up
+  w = o->speed < 0 ? -o->speed : o->speed;
+  if (w < (o->hallSpeed < 0 ? -o->hallSpeed : o->hallSpeed)) {
+    w = o->hallSpeed < 0 ? -o->hallSpeed : o->hallSpeed;
+  }
+  if (w < OBS_SPEED_CUT) {
+    w = OBS_SPEED_CUT;
+  }
+  for (uint8_t k = 0; k < 2; k++) {
+    int32_t hp = (int32_t)(((int64_t)eta[k] * w * OBS_KC) >> 38);  // wc eta per tick: Q8 speed, 2^16 per turn, Q14
+    o->x[k] += (int32_t)(((int64_t)v[k] * vdc * OBS_KV) >> 16) - ((OBS_KR * ia[k]) >> 16) - hp;
+  }
+
+  o->anglePrev = o->angle;
+  o->angle     = obsAtan2(eta[1], eta[0]);
+  o->speed    += (((int32_t)(int16_t)(o->angle - o->anglePrev) << 8) - o->speed) >> 6;
+}
+
+/* Hall to observer hand over. elecAngle [deg] and n_mot [rpm] are the controller outputs of the previous tick.
+ * Returns 1 and the angle to feed to the controller in the hall angle frame [2^16 per turn] when the observer is active */
+RAMFUNC uint8_t obsAngle(Observer *o, int16_t elecAngle, int16_t n_mot, uint16_t *angle) {
+  uint16_t hall  = (uint16_t)(((int32_t)elecAngle * 11651) >> 6);  // 65536 / 360, Q6
+  int16_t  spd   = n_mot < 0 ? -n_mot : n_mot;
+  uint8_t  valid = o->mag > OBS_MAG_MIN && o->mag < OBS_MAG_MAX &&
+                   ((o->speed > OBS_SPEED_MIN && o->hallSpeed > OBS_SPEED_MIN) ||
+                    (o->speed < -OBS_SPEED_MIN && o->hallSpeed < -OBS_SPEED_MIN));
+
+  o->hallSpeed += (((int32_t)(int16_t)(hall - o->hallPrev) << 8) - o->hallSpeed) >> 6;
+  o->hallPrev   = hall;
+
+  if (!valid || spd < OBS_SPD_LO) {
+    o->active = 0;
+    if (!valid) {
+      o->learn = 0;
+    }
+  } else if (!o->active) {
+    // The hall angle is the one of the previous tick, compare it with the observer angle of that tick
+    int16_t err = (int16_t)(hall - o->anglePrev - (uint16_t)(o->offset >> 8));
+    o->offset   = (o->offset + ((int32_t)err << 1)) & 0xFFFFFF;   // time constant 128 ticks
+    if (o->learn < OBS_LEARN_TICKS) {
+      o->learn++;
+    } else if (spd >= OBS_SPD_HI) {
+      o->active = 1;
+      o->bump   = (int16_t)(hall + (o->hallSpeed >> 8) - o->angle - (uint16_t)(o->offset >> 8));
+    }
+  }
+
+  if (o->active) {
+    o->bump -= o->bump / 32;            // hand over step removed within about 2 ms
+  } else {
+    o->bump  = 0;
+  }
+  *angle = (uint16_t)(o->angle + (uint16_t)(o->offset >> 8) + o->bump);
+  return o->active;
+}
+
+#endif
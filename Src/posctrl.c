@@ -0,0 +1,88 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Position loop of POS_MODE (POS_CTRL) and of the standstill hold (STANDSTILL_HOLD_ENABLE). Only uses config.h, so it also builds on the host.
+//
+// The position is the hall odometry: 6 * polePairs steps per turn, one step is 10 / polePairs rpm per step and second.
+// The speed target is POS_KP |e| close to the target, up to the speed POS_ACC / POS_KP where braking along it needs
+// POS_ACC. Further out it is the speed from which POS_ACC stops on that line, sqrt(2 POS_ACC |e| - (POS_ACC / POS_KP)^2)
+// with the distance |e| in rpm * s, both meet with the same slope. POS_SPD_MAX limits it.
+// Its change per step is limited to POS_ACC, so a new target far away starts with the same ramp as it stops.
+
+#include <stdint.h>
+#include "config.h"
+#include "posctrl.h"
+#include "ramfunc.h"
+
+#if defined(POS_CTRL) || defined(STANDSTILL_HOLD_ENABLE)
+
+#define POS_DV                  ((int32_t)((int64_t)POS_ACC * 65536 * POS_CTRL_DIV / PWM_FREQ))   // [rpm, fixdt(1,32,16)] speed change per step
+#define POS_LIN                 ((uint32_t)POS_ACC * POS_ACC / ((uint32_t)POS_KP * POS_KP))          // [rpm^2] top of the linear range squared
+
+RAMFUNC static uint32_t isqrt32(uint32_t x) {
+  uint32_t r = 0, b = 1UL << 30;
+  while (b > x) {
+    b >>= 2;
+  }
+  while (b) {
+    if (x >= r + b) {
+      x -= r + b;
+      r  = (r >> 1) + b;
+    } else {
+      r >>= 1;
+    }
+    b >>= 2;
+  }
+  return r;
+}
+
+// Entry into POS_MODE at the speed n [rpm] the motor has, so the speed loop sees no step
+RAMFUNC void posCtrlReset(PosCtrl *c, int16_t n) {
+  c->v = (int32_t)n << 16;
+}
+
+/* One position loop step. tgt and pos [hall steps], nMax = rtP n_max [rpm, fixdt(1,16,4)].
+ * Returns the SPD_MODE r_inpTgt, 1000 = nMax. 32-bit only, it runs in the control interrupt */
+RAMFUNC int16_t posCtrlStep(PosCtrl *c, int32_t tgt, int32_t pos, int16_t nMax, uint8_t polePairs) {
+  int32_t  e   = tgt - pos;
+  uint32_t ea  = (uint32_t)(e < 0 ? -e : e);
+  uint32_t lim = ((uint32_t)POS_SPD_MAX * POS_SPD_MAX + POS_LIN) * polePairs;   // 20 POS_ACC |e| at POS_SPD_MAX
+  uint32_t vT;
+  int32_t  dv;
+
+  if (ea > 65535) {
+    ea = 65535;                         // far beyond the POS_SPD_MAX and POS_KP limits, keeps the products in 32 bits
+  }
+  if ((uint32_t)POS_KP * 10 * ea <= (uint32_t)POS_ACC * polePairs / POS_KP) {
+    vT = (uint32_t)POS_KP * 10 * ea / polePairs;                  // [rpm] linear, braking below POS_ACC
+  } else if (ea < lim / (20U * POS_ACC)) {
+    vT = isqrt32(20U * POS_ACC * ea / polePairs - POS_LIN);        // [rpm] stopping speed
+  } else {
+    vT = POS_SPD_MAX;
+  }
+  vT = vT < POS_SPD_MAX ? vT : POS_SPD_MAX;
+  dv = (e < 0 ? -(int32_t)vT : (int32_t)vT) * 65536 - c->v;
+  if ((dv < 0) == (c->v > 0)) {
+    dv = dv > 2 * POS_DV ? 2 * POS_DV : (dv < -2 * POS_DV ? -2 * POS_DV : dv);   // braking, room to catch the speed loop lag
+  } else {
+    dv = dv > POS_DV ? POS_DV : (dv < -POS_DV ? -POS_DV : dv);
+  }
+  c->v += dv;
+  return (int16_t)((c->v >> 12) * 1000 / (nMax > 16 ? nMax : 16));
+}
+
+#endif
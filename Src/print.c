@@ -0,0 +1,166 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Integer-only printf subset for the debug serial output. The newlib printf pulls in the full vfprintf,
+// a FILE buffer on the heap and a large stack frame for the handful of formats the firmware prints.
+// debugPrintf formats into a small stack buffer which goes to the DMA TX queue with debugTxWrite,
+// so the masking and dropping rules of the queue (util.c, rtt.c with DEBUG_RTT) apply unchanged. TRACE_ITM_PRINTF
+// sends it to ITM port 0.
+
+#include <string.h>
+#include "defines.h"
+#include "config.h"
+#include "util.h"
+#include "trace.h"
+#include "print.h"
+
+typedef struct {
+  char    *buf;
+  int      n;                           // characters in buf
+  int      size;                        // capacity of buf
+  int      total;                       // characters produced, including the flushed or truncated ones
+  uint8_t  flush;                       // 1: a full buffer goes to debugTxWrite, 0: the output is truncated
+} PrintOut;
+
+static void printPut(PrintOut *o, char c) {
+  if (o->n == o->size) {
+    if (!o->flush) {
+      o->total++;
+      return;
+    }
+    #if defined(TRACE_ITM_PRINTF)
+    traceWrite((const uint8_t *)o->buf, o->n);
+    #elif defined(DEBUG_OUT)
+    debugTxWrite((const uint8_t *)o->buf, o->n);
+    #endif
+    o->n = 0;
+  }
+  o->buf[o->n++] = c;
+  o->total++;
+}
+
+static void printPad(PrintOut *o, char c, int n) {
+  while (n-- > 0) printPut(o, c);
+}
+
+static void printFmt(PrintOut *o, const char *fmt, va_list ap) {
+  char tmp[24];                         // 20 digits of a 64-bit long on the host, the point and the sign
+  char c;
+  while ((c = *fmt++)) {
+    if (c != '%') {
+      printPut(o, c);
+      continue;
+    }
+    uint8_t left = 0, zero = 0, isLong = 0;
+    int width = 0, prec = 0;
+    for (;; fmt++) {
+      if (*fmt == '-') left = 1;
+      else if (*fmt == '0') zero = 1;
+      else break;
+    }
+    while (*fmt >= '0' && *fmt <= '9') width = width * 10 + (*fmt++ - '0');
+    if (*fmt == '.') {
+      fmt++;
+      while (*fmt >= '0' && *fmt <= '9') prec = prec * 10 + (*fmt++ - '0');
+      if (prec > 9) prec = 9;
+    }
+    while (*fmt == 'l') { isLong = 1; fmt++; }
+
+    const char *s;
+    int len;
+    char sign = 0;
+    switch (c = *fmt++) {
+      case 'd':
+      case 'i':
+      case 'u': {
+        unsigned long u;
+        if (c == 'u') {
+          u = isLong ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+        } else {
+          long v = isLong ? va_arg(ap, long) : va_arg(ap, int);
+          if (v < 0) sign = '-';
+          u = v < 0 ? 0UL - (unsigned long)v : (unsigned long)v;
+        }
+        int k = sizeof(tmp), d = 0;
+        do {
+          if (prec && d == prec) tmp[--k] = '.';
+          tmp[--k] = (char)('0' + u % 10U);
+          u /= 10U;
+          d++;
+        } while (u || d <= prec);
+        s   = &tmp[k];
+        len = (int)sizeof(tmp) - k;
+        break;
+      }
+      case 'c':
+        tmp[0] = (char)va_arg(ap, int);
+        s   = tmp;
+        len = 1;
+        zero = 0;
+        break;
+      case 's':
+        s   = va_arg(ap, const char *);
+        if (!s) s = "(null)";
+        len = (int)strlen(s);
+        zero = 0;
+        break;
+      case '\0':
+        return;
+      default:                          // %% and unsupported conversions
+        printPut(o, c);
+        continue;
+    }
+
+    int pad = width - len - (sign ? 1 : 0);
+    if (!left && !zero) printPad(o, ' ', pad);
+    if (sign) printPut(o, sign);
+    if (!left && zero) printPad(o, '0', pad);
+    while (len--) printPut(o, *s++);
+    if (left) printPad(o, ' ', pad);
+  }
+}
+
+int debugPrintf(const char *fmt, ...) {
+#if defined(DEBUG_OUT)
+  char     chunk[PRINT_CHUNK];
+  PrintOut o = { chunk, 0, sizeof(chunk), 0, 1 };
+  va_list  ap;
+  va_start(ap, fmt);
+  printFmt(&o, fmt, ap);
+  va_end(ap);
+  #if defined(TRACE_ITM_PRINTF)
+  if (o.n) traceWrite((const uint8_t *)chunk, o.n);
+  #else
+  if (o.n) debugTxWrite((const uint8_t *)chunk, o.n);
+  #endif
+  return o.total;
+#else
+  (void)fmt;                            // no debug serial, nothing is formatted
+  return 0;
+#endif
+}
+
+// snprintf of the same subset: always terminated, returns the length the full output would have
+int printFormat(char *buf, int size, const char *fmt, ...) {
+  PrintOut o = { buf, 0, size > 0 ? size - 1 : 0, 0, 0 };
+  va_list  ap;
+  va_start(ap, fmt);
+  printFmt(&o, fmt, ap);
+  va_end(ap);
+  if (size > 0) buf[o.n] = '\0';
+  return o.total;
+}
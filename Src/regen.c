@@ -0,0 +1,78 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Regenerative braking manager (REGEN_LIMIT). Only uses config.h, so it also builds on the host.
+//
+// While braking the DC link current flows back into the battery and its voltage rises by the current times the
+// internal resistance, on a full battery over the charge limit of the cells. The braking torque factor falls
+// linearly from 1 at REGEN_V_START to 0 at REGEN_V_MAX of the per cell voltage, the torque settles where the
+// voltage stays below REGEN_V_MAX. On a partly charged battery the factor stays 1 and the full braking is recovered.
+// The factor falls at once and recovers at REGEN_RISE per second, the voltage needs a while to fall after a step.
+// The recovered and the drawn energy are counted from the battery voltage and current.
+
+#include <stdint.h>
+#include "config.h"
+#include "regen.h"
+
+#if defined(REGEN_LIMIT)
+
+#define REGEN_MWH           36000000L                             // [V*100*A*100*ms] 1 mWh
+#define REGEN_RISE_STEP     ((int32_t)REGEN_FAC_ONE * REGEN_RISE / 100000)  // [Q15 per ms]
+
+void regenInit(Regen *r) {
+  r->regenRest = 0;
+  r->regenMWh  = 0;
+  r->usedRest  = 0;
+  r->usedMWh   = 0;
+  r->fac       = REGEN_FAC_ONE;
+}
+
+/* One update every dt ms with the battery voltage vBat [V*100] and the DC link current iBat [A*100], positive = discharge */
+void regenStep(Regen *r, int16_t vBat, int16_t iBat, uint16_t dt) {
+  int32_t cell = vBat / BAT_CELLS;
+  int32_t target, fac;
+
+  // Energy, the product of one step stays far below 2^31
+  if (iBat < 0) {
+    r->regenRest += (int32_t)vBat * -iBat * dt;
+    r->regenMWh  += (uint32_t)(r->regenRest / REGEN_MWH);
+    r->regenRest %= REGEN_MWH;
+  } else {
+    r->usedRest  += (int32_t)vBat * iBat * dt;
+    r->usedMWh   += (uint32_t)(r->usedRest / REGEN_MWH);
+    r->usedRest  %= REGEN_MWH;
+  }
+
+  // Braking torque factor from the per cell voltage
+  if (cell <= REGEN_V_START) {
+    target = REGEN_FAC_ONE;
+  } else if (cell >= REGEN_V_MAX) {
+    target = 0;
+  } else {
+    target = (int32_t)REGEN_FAC_ONE * (REGEN_V_MAX - cell) / (REGEN_V_MAX - REGEN_V_START);
+  }
+  fac = r->fac;
+  if (target < fac) {
+    fac = target;
+  } else {
+    fac += REGEN_RISE_STEP * dt;
+    if (fac > target) { fac = target; }
+  }
+  r->fac = (uint16_t)fac;
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Debug channel in RAM (DEBUG_RTT). The control block has the layout of SEGGER RTT, so the RTT support of OpenOCD,
+// pyOCD or the J-Link tools finds it by its id and serves channel 0 as a TCP port or a terminal. The debugger reads
+// the up buffer and fills the down buffer over SWD while the core runs, the firmware only copies into and out of RAM:
+// - up: debugTxWrite replaces the UART TX queue of util.c. It is called from the main loop and from PendSV, so it holds
+//   off PendSV while it copies, never the control interrupt. A full buffer drops the rest (DBG_TX_DROP) as the UART
+//   queue does, there may be no debugger reading at all
+// - down: rttPoll in the command task passes the received bytes to the protocol parser, as the UART RX does
+// Each side only writes its own offset, and the data before it, so no lock is shared with the debugger.
+
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "util.h"
+#include "comms.h"
+#include "rtt.h"
+
+#if defined(DEBUG_RTT)
+
+#define RTT_MODE_TRIM           1U      // [-] a full up buffer takes what fits, the rest is dropped
+
+static uint8_t rttUpBuf[DEBUG_TX_BUFFER_SIZE];
+static uint8_t rttDownBuf[DEBUG_RTT_RX_SIZE];
+RttCb          rttCb;
+uint32_t       debugTxDrop;             // Number of characters dropped because the up buffer was full
+
+/* Before the first printf. The id goes in last and in two parts: the debugger must not find a block without its
+ * buffers, nor a second copy of the id in a string constant */
+void rttInit(void) {
+  rttCb.upN            = 1;
+  rttCb.downN          = 1;
+  rttCb.up[0].name     = "Terminal";
+  rttCb.up[0].buf      = rttUpBuf;
+  rttCb.up[0].size     = sizeof(rttUpBuf);
+  rttCb.up[0].flags    = RTT_MODE_TRIM;
+  rttCb.down[0].name   = "Terminal";
+  rttCb.down[0].buf    = rttDownBuf;
+  rttCb.down[0].size   = sizeof(rttDownBuf);
+  rttCb.down[0].flags  = RTT_MODE_TRIM;
+  strcpy(&rttCb.id[7], "RTT");
+  __DMB();
+  memcpy(rttCb.id, "SEGGER ", 7);
+  __DMB();
+}
+
+int debugTxFree(void) {
+  const RttBuf *b = &rttCb.up[0];
+  return (int)((b->rdOff - b->wrOff - 1U) & (DEBUG_TX_BUFFER_SIZE - 1U));
+}
+
+int debugTxWrite(const uint8_t *data, int len) {
+  RttBuf  *b = &rttCb.up[0];
+  uint32_t basepri = __get_BASEPRI();
+  __set_BASEPRI(IRQ_BASEPRI(IRQ_PRIO_DEFERRED));        // main loop and PendSV both print
+  uint32_t wr    = b->wrOff;
+  uint32_t n     = MIN((uint32_t)len, (b->rdOff - wr - 1U) & (DEBUG_TX_BUFFER_SIZE - 1U));
+  uint32_t first = MIN(n, DEBUG_TX_BUFFER_SIZE - wr);   // up to the end of the buffer, the rest from its start
+  memcpy(&rttUpBuf[wr], data, first);
+  memcpy(rttUpBuf, &data[first], n - first);
+  __DMB();                                              // the data before the offset that releases it
+  b->wrOff = (wr + n) & (DEBUG_TX_BUFFER_SIZE - 1U);
+  __set_BASEPRI(basepri);
+  debugTxDrop += (uint32_t)len - n;
+  return len;
+}
+
+/* Command task: the bytes the debugger has put into the down buffer go to the protocol parser */
+void rttPoll(void) {
+  RttBuf  *b  = &rttCb.down[0];
+  uint32_t wr = b->wrOff, rd = b->rdOff;
+  if (wr == rd || wr >= DEBUG_RTT_RX_SIZE) {
+    return;
+  }
+  __DMB();                                              // the data behind the offset of the debugger
+  #if defined(DEBUG_SERIAL_PROTOCOL)
+  if (wr < rd) {
+    handle_input_chunk(&rttDownBuf[rd], DEBUG_RTT_RX_SIZE - rd);
+    rd = 0;
+  }
+  handle_input_chunk(&rttDownBuf[rd], wr - rd);
+  #endif
+  b->rdOff = wr;
+}
+
+#endif
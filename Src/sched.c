@@ -0,0 +1,134 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "stm32f1xx_hal.h"
+#include "sched.h"
+#include "timebase.h"
+#include "trace.h"
+
+uint8_t   schedRst;
+SchedLoad schedLoad;
+
+static uint32_t loadStart;              // [us] start of the load window
+static uint32_t loadIdle;               // [us] time in WFI within the window
+#if defined(SCHED_STATS)
+static uint32_t histBase;               // [cycles] SCHED_HIST_US
+#endif
+
+/*
+ * Reset the runtime statistics of all tasks and the worst blocking call
+ */
+static void schedStatsReset(SchedTask *tasks, uint8_t num) {
+  for (uint8_t i = 0; i < num; i++) {
+    tasks[i].runMax  = 0;
+    tasks[i].overrun = 0;
+    #if defined(SCHED_STATS)
+    tasks[i].runMin  = UINT32_MAX;
+    for (uint8_t b = 0; b < SCHED_HIST_BINS; b++) {
+      tasks[i].hist[b] = 0;
+    }
+    #endif
+  }
+  schedLoad.loadMax   = 0;
+  schedLoad.worst     = 0;
+  schedLoad.worstTask = 0;
+}
+
+/*
+ * Release every task on its first tick: now + phase control periods
+ */
+void schedInit(SchedTask *tasks, uint8_t num) {
+  uint32_t now = timeUs();
+  DBGMCU->CR |= DBGMCU_CR_DBG_SLEEP;    // Keep the debug port alive during WFI
+  for (uint8_t i = 0; i < num; i++) {
+    tasks[i].next    = now + tasks[i].phase * SCHED_PHASE_US;
+    tasks[i].runLast = 0;
+  }
+  schedStatsReset(tasks, num);
+  #if defined(SCHED_STATS)
+  histBase  = SCHED_HIST_US * (SystemCoreClock / 1000000U);
+  #endif
+  loadStart = now;
+  loadIdle  = 0;
+}
+
+/*
+ * Run all released tasks in table order, then sleep until the next interrupt.
+ * Release times advance by exactly one period, so the cadence does not depend on
+ * how long the previous tasks took. A task that is more than one period late skips
+ * the missed releases and counts an overrun.
+ */
+void schedRun(SchedTask *tasks, uint8_t num) {
+  uint32_t now, t0, run;
+
+  if (schedRst) {
+    schedStatsReset(tasks, num);
+    schedRst = 0;
+  }
+
+  for (uint8_t i = 0; i < num; i++) {
+    now = timeUs();
+    if ((int32_t)(now - tasks[i].next) < 0) {
+      continue;
+    }
+    tasks[i].next += tasks[i].period;
+    if ((int32_t)(now - tasks[i].next) >= 0) {
+      tasks[i].overrun++;
+      tasks[i].next = now + tasks[i].period;
+    }
+
+    TRACE_TASK_START(i);
+    t0 = DWT->CYCCNT;
+    tasks[i].fn();
+    run = DWT->CYCCNT - t0;
+    TRACE_TASK_END(i);
+    tasks[i].runLast = run;
+    if (run > tasks[i].runMax) {
+      tasks[i].runMax = run;
+    }
+    if (run > schedLoad.worst) {
+      schedLoad.worst     = run;
+      schedLoad.worstTask = i;
+    }
+    #if defined(SCHED_STATS)
+    if (run < tasks[i].runMin) {
+      tasks[i].runMin = run;
+    }
+    uint32_t q = run / histBase;        // bin k >= 1 holds [histBase << (k - 1), histBase << k)
+    uint8_t  b = q ? (uint8_t)(32 - __CLZ(q)) : 0;
+    b = (b < SCHED_HIST_BINS) ? b : SCHED_HIST_BINS - 1;
+    if (tasks[i].hist[b] < UINT16_MAX) {
+      tasks[i].hist[b]++;
+    }
+    #endif
+  }
+
+  t0 = timeUs();
+  __WFI();                              // Wake up on the next control interrupt (PWM_FREQ) or any other interrupt
+  now = timeUs();
+  loadIdle += now - t0;
+
+  if (now - loadStart >= 1000000U) {    // publish the load once per second. span / 1000 >= 1000, no overflow
+    uint32_t idle = loadIdle / ((now - loadStart) / 1000U);
+    schedLoad.load = (uint16_t)(1000U - ((idle < 1000U) ? idle : 1000U));
+    if (schedLoad.load > schedLoad.loadMax) {
+      schedLoad.loadMax = schedLoad.load;
+    }
+    loadStart = now;
+    loadIdle  = 0;
+  }
+}
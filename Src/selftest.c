@@ -0,0 +1,171 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Boot self-test (SELF_TEST). Only uses config.h, so it also builds on the host.
+//
+// The passive checks take what the offset calibration already has: every offset within SELF_TEST_OFFSET_TOL of mid
+// scale and a valid hall state (hall2pos < 6) on both motors. They cost no time and run at every boot.
+// The pulse test follows the calibration, while the power on melody still plays: one phase after the other goes to
+// +SELF_TEST_DUTY, the two others to -SELF_TEST_DUTY, for SELF_TEST_PULSE_TICKS, then all phases rest at zero voltage
+// until the current has decayed. Both motors are pulsed together. A shunt sees the current I of its own phase and
+// -I/2 of each of the two others, so each shunt must see its own pulse with at least SELF_TEST_CUR and the two other
+// pulses with the opposite sign and at least a quarter of it. The sign of I is not assumed, only the pattern.
+// The phase currents are sampled while the low side FETs carry them, the DC link shunt then carries none: more than
+// half the phase current there is a high side FET that conducts or a broken DC link measurement.
+// All 6 hall positions can only be seen while the wheels turn: the control interrupt records them, and a board that
+// passed, saw all 6 positions on every tested motor, no invalid state and no controller error is stored as healthy.
+// The next boot then skips the pulses, a fault clears it again.
+
+#include <stdint.h>
+#include "config.h"
+#include "selftest.h"
+
+#if defined(SELF_TEST)
+
+#define SELF_TEST_OFFSET_MID    2048                              // [ADC counts] mid scale of the current amplifiers
+#define SELF_TEST_OFFSET_TOL    256                               // [ADC counts] largest offset error
+#define SELF_TEST_PULSE_TICKS   (PWM_FREQ / 1000)                 // [ticks] 1 ms pulse
+#define SELF_TEST_SLOT_TICKS    (PWM_FREQ / 200)                  // [ticks] 5 ms per phase, the rest for the decay
+#define SELF_TEST_MEAS_TICKS    4                                 // [ticks] samples at the end of the pulse
+#define SELF_TEST_CUR_MIN       (SELF_TEST_CUR * A2BIT_CONV)      // [ADC bits]
+#define SELF_TEST_CUR_ABORT     (SELF_TEST_CUR_MIN * 8)           // [ADC bits] stop all pulses above this: short circuit
+#define SELF_TEST_HALL_ALL      0x3F                              // [-] hall2pos positions 0..5
+
+static const uint8_t selfTestShunt[2][2] = {{0, 1}, {1, 2}};     // phases of the two shunts, left U, V and right V, W
+
+static int16_t selfTestAbs(int16_t x) {
+  return x < 0 ? -x : x;
+}
+
+/* End of the offset calibration: offset [ADC counts] in calibChannels order (left A, B, right B, C, DC left, right),
+ * pos the hall2pos positions. motors selects the tested motors. Starts the pulse test unless the last power on found
+ * the board healthy and the passive checks pass */
+void selfTestBegin(SelfTest *s, uint8_t motors, const uint16_t offset[6], const uint8_t pos[2]) {
+  static const uint8_t chMotor[6] = {0, 0, 1, 1, 0, 1};
+
+  s->motors = motors;
+  for (uint8_t m = 0; m < 2; m++) {
+    s->err[m]      = 0;
+    s->dcMax[m]    = 0;
+    s->sum[m][0]   = s->sum[m][1] = 0;
+    s->hallSeen[m] = (uint8_t)(1 << pos[m]);
+    if (pos[m] >= 6) {
+      s->err[m] |= SELF_TEST_ERR_HALL;
+    }
+  }
+  for (uint8_t i = 0; i < 6; i++) {
+    if (selfTestAbs((int16_t)(offset[i] - SELF_TEST_OFFSET_MID)) > SELF_TEST_OFFSET_TOL) {
+      s->err[chMotor[i]] |= SELF_TEST_ERR_OFFSET;
+    }
+  }
+  for (uint8_t m = 0; m < 2; m++) {
+    if (!(motors & (1 << m))) {
+      s->err[m] = 0;
+    }
+  }
+  s->slot  = 0;
+  s->ticks = 0;
+  s->state = (s->cached == SELF_TEST_KEY && !s->err[0] && !s->err[1]) ? SELF_TEST_DONE : SELF_TEST_PULSE;
+}
+
+/* Evaluation of the responses of motor m to the three pulses */
+static void selfTestEval(SelfTest *s, uint8_t m) {
+  for (uint8_t k = 0; k < 2; k++) {
+    int16_t own = s->resp[m][selfTestShunt[m][k]][k];
+    if (selfTestAbs(own) < SELF_TEST_CUR_MIN) {
+      s->err[m] |= SELF_TEST_ERR_PHASE;
+      continue;
+    }
+    for (uint8_t p = 0; p < 3; p++) {
+      int16_t r = s->resp[m][p][k];
+      if (p != selfTestShunt[m][k] && ((r < 0) == (own < 0) || selfTestAbs(r) * 4 < selfTestAbs(own))) {
+        s->err[m] |= SELF_TEST_ERR_PHASE;
+      }
+    }
+    if (s->dcMax[m] * 2 > selfTestAbs(own)) {
+      s->err[m] |= SELF_TEST_ERR_DC;
+    }
+  }
+}
+
+/* Control interrupt, once per tick of the pulse test: shunt currents cur [ADC bits] (left A, B, right B, C) and the
+ * DC link currents dc of this tick, of the duties written one tick before. Returns the phase to pulse until the next
+ * tick, 0..2 = U, V, W, SELF_TEST_OFF or SELF_TEST_END, the result is then in err */
+int8_t selfTestStep(SelfTest *s, const int16_t cur[2][2], const int16_t dc[2]) {
+  if (s->state != SELF_TEST_PULSE) {
+    return SELF_TEST_END;
+  }
+  for (uint8_t m = 0; m < 2; m++) {
+    if (!(s->motors & (1 << m))) {
+      continue;
+    }
+    if (selfTestAbs(cur[m][0]) > SELF_TEST_CUR_ABORT || selfTestAbs(cur[m][1]) > SELF_TEST_CUR_ABORT ||
+        selfTestAbs(dc[m]) > SELF_TEST_CUR_ABORT) {
+      s->err[m] |= SELF_TEST_ERR_PHASE;
+      s->state   = SELF_TEST_DONE;
+      return SELF_TEST_END;
+    }
+    if (s->ticks >= SELF_TEST_PULSE_TICKS - SELF_TEST_MEAS_TICKS && s->ticks < SELF_TEST_PULSE_TICKS) {
+      s->sum[m][0] += cur[m][0];
+      s->sum[m][1] += cur[m][1];
+      if (selfTestAbs(dc[m]) > s->dcMax[m]) {
+        s->dcMax[m] = selfTestAbs(dc[m]);
+      }
+    }
+  }
+  if (s->ticks == SELF_TEST_PULSE_TICKS - 1) {
+    for (uint8_t m = 0; m < 2; m++) {
+      s->resp[m][s->slot][0] = (int16_t)(s->sum[m][0] / SELF_TEST_MEAS_TICKS);
+      s->resp[m][s->slot][1] = (int16_t)(s->sum[m][1] / SELF_TEST_MEAS_TICKS);
+      s->sum[m][0] = s->sum[m][1] = 0;
+    }
+  }
+  if (++s->ticks >= SELF_TEST_SLOT_TICKS) {
+    s->ticks = 0;
+    if (++s->slot >= 3) {
+      for (uint8_t m = 0; m < 2; m++) {
+        if (s->motors & (1 << m)) {
+          selfTestEval(s, m);
+        }
+      }
+      s->state = SELF_TEST_DONE;
+      return SELF_TEST_END;
+    }
+  }
+  return s->ticks < SELF_TEST_PULSE_TICKS ? (int8_t)s->slot : SELF_TEST_OFF;
+}
+
+/* EEPROM word to store at power off: SELF_TEST_KEY once the board passed and every tested motor showed all 6 hall
+ * positions and no invalid one, 0 after any fault, else the word of the last power on */
+uint16_t selfTestCache(const SelfTest *s) {
+  uint8_t seen = 1;
+  if (s->err[0] || s->err[1] || s->fault) {
+    return 0;
+  }
+  for (uint8_t m = 0; m < 2; m++) {
+    if (!(s->motors & (1 << m))) {
+      continue;
+    }
+    if (s->hallSeen[m] & ~SELF_TEST_HALL_ALL) {
+      return 0;
+    }
+    seen &= (s->hallSeen[m] == SELF_TEST_HALL_ALL);
+  }
+  return seen && s->state == SELF_TEST_DONE ? SELF_TEST_KEY : s->cached;
+}
+
+#endif
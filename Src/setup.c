@@ -38,6 +38,10 @@ pb10 usart3 dma1 channel2/3
 #include "defines.h"
 #include "config.h"
 #include "setup.h"
+#include "timebase.h"
+
+// BDTR DTG of DEAD_TIME: up to 127 counts as is, up to 254 in steps of 2 (180 at the 240 MHz of MCU_AT32F403)
+#define DEAD_TIME_DTG           (DEAD_TIME < 128 ? DEAD_TIME : 0x80 | (DEAD_TIME / 2 - 64))
 
 TIM_HandleTypeDef htim_right;
 TIM_HandleTypeDef htim_left;
@@ -52,22 +56,20 @@ DMA_HandleTypeDef hdma_usart2_tx;
 DMA_HandleTypeDef hdma_usart3_rx;
 DMA_HandleTypeDef hdma_usart3_tx;
 volatile adc_buf_t adc_buffer;
+volatile uint32_t  adc_dma[2][ADC_REG_WORDS];  // ping-pong DMA target of the regular group, latched into adc_buffer by bldc.c
+#if defined(ADC_INPUT_OVS)
+ADC_HandleTypeDef  hadc3;
+volatile uint32_t  adc_ovs[ADC_INPUT_OVS];     // circular DMA target of ADC3, one word per pair: l_tx2 low half, l_rx2 high half
+#endif
 
 
 #if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
  /* USART2 init function */
  void UART2_Init(void)
 {
-  /* DMA controller clock enable */
+  /* DMA controller clock enable. The USART interrupt handles the transfers (UART_TxDma, UART_RxDma), the Rx channel only interrupts with SERIAL_RX_DMA_IRQ */
   __HAL_RCC_DMA1_CLK_ENABLE();
-  
-  /* DMA1_Channel6_IRQn interrupt configuration */
-  HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, 0, 0);
-  HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
-  /* DMA1_Channel7_IRQn interrupt configuration */
-  HAL_NVIC_SetPriority(DMA1_Channel7_IRQn, 0, 0);
-  HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
-  
+
   huart2.Instance = USART2;
   huart2.Init.BaudRate = USART2_BAUD;
   huart2.Init.WordLength = USART2_WORDLENGTH;
@@ -84,17 +86,9 @@ volatile adc_buf_t adc_buffer;
 /* USART3 init function */
 void UART3_Init(void)
 {
-  /* DMA controller clock enable */
+  /* DMA controller clock enable. The USART interrupt handles the transfers (UART_TxDma, UART_RxDma), the Rx channel only interrupts with SERIAL_RX_DMA_IRQ */
   __HAL_RCC_DMA1_CLK_ENABLE();
 
-  /* DMA interrupt init */
-  /* DMA1_Channel2_IRQn interrupt configuration */
-  HAL_NVIC_SetPriority(DMA1_Channel2_IRQn, 0, 0);
-  HAL_NVIC_EnableIRQ(DMA1_Channel2_IRQn);
-  /* DMA1_Channel3_IRQn interrupt configuration */
-  HAL_NVIC_SetPriority(DMA1_Channel3_IRQn, 0, 0);
-  HAL_NVIC_EnableIRQ(DMA1_Channel3_IRQn);
-  
   huart3.Instance = USART3;
   huart3.Init.BaudRate = USART3_BAUD;
   huart3.Init.WordLength = USART3_WORDLENGTH;
@@ -107,8 +101,69 @@ void UART3_Init(void)
 }
 #endif
 
+#if defined(SERIAL_BAUD_NEGOTIATION)
+/* Change the baud rate of a running USART2/3 (APB1). Waits for the last byte to leave, the DMA channels keep running */
+void UART_SetBaud(UART_HandleTypeDef *huart, uint32_t baud)
+{
+  uint32_t t0 = timeMs();
+  while (!__HAL_UART_GET_FLAG(huart, UART_FLAG_TC) && timeMs() - t0 < 2) { }
+  __HAL_UART_DISABLE(huart);
+  huart->Init.BaudRate = baud;
+  huart->Instance->BRR = UART_BRR_SAMPLING16(HAL_RCC_GetPCLK1Freq(), baud);
+  __HAL_UART_ENABLE(huart);
+}
+#endif
+
 #if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2) || \
     defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(FEEDBACK_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
+/*
+ * DMA transfers by register, in place of HAL_UART_Transmit_DMA / HAL_UART_Receive_DMA. The DMA channels keep the
+ * HAL_DMA_Init setup and run without interrupts: the receive channel is circular and read on the IDLE line, the end of
+ * a transmission is the TC of the USART. One interrupt per frame each way, see USART_IRQ in stm32f1xx_it.c.
+ * gState is kept as the HAL does, the senders check it for a free transmitter.
+ */
+HAL_StatusTypeDef UART_TxDma(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size)
+{
+  DMA_Channel_TypeDef *ch = huart->hdmatx->Instance;
+
+  if (huart->gState != HAL_UART_STATE_READY) {
+    return HAL_BUSY;
+  }
+  huart->gState = HAL_UART_STATE_BUSY_TX;
+  ch->CCR  &= ~DMA_CCR_EN;
+  ch->CPAR  = (uint32_t)&huart->Instance->DR;
+  ch->CMAR  = (uint32_t)data;
+  ch->CNDTR = size;
+  ch->CCR  |= DMA_CCR_EN;
+  huart->Instance->SR = ~USART_SR_TC;
+  SET_BIT(huart->Instance->CR3, USART_CR3_DMAT);
+  SET_BIT(huart->Instance->CR1, USART_CR1_TCIE);
+  return HAL_OK;
+}
+
+/* Circular receive into data. The error interrupts stay off: a frame error or overrun only shows in the checksum.
+ * With SERIAL_RX_DMA_IRQ the half transfer and transfer complete interrupts of the channel are on as well */
+void UART_RxDma(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size)
+{
+  DMA_Channel_TypeDef *ch = huart->hdmarx->Instance;
+
+  ch->CCR  &= ~DMA_CCR_EN;
+  #if defined(SERIAL_RX_DMA_IRQ)
+  __HAL_DMA_CLEAR_FLAG(huart->hdmarx, __HAL_DMA_GET_GI_FLAG_INDEX(huart->hdmarx));
+  ch->CCR  |= DMA_CCR_HTIE | DMA_CCR_TCIE;
+  #endif
+  ch->CPAR  = (uint32_t)&huart->Instance->DR;
+  ch->CMAR  = (uint32_t)data;
+  ch->CNDTR = size;
+  ch->CCR  |= DMA_CCR_EN;
+  huart->pRxBuffPtr = data;
+  huart->RxXferSize = size;
+  huart->RxState    = HAL_UART_STATE_BUSY_RX;
+  (void)huart->Instance->SR;            // clears an overrun of the time before
+  (void)huart->Instance->DR;
+  SET_BIT(huart->Instance->CR3, USART_CR3_DMAR);
+}
+
 void HAL_UART_MspInit(UART_HandleTypeDef* uartHandle)
 {
   GPIO_InitTypeDef GPIO_InitStruct = {0};
@@ -126,7 +181,11 @@ void HAL_UART_MspInit(UART_HandleTypeDef* uartHandle)
     PA3     ------> USART2_RX 
     */
     GPIO_InitStruct.Pin = GPIO_PIN_2;
+    #if defined(SERIAL_BUS) && defined(CONTROL_SERIAL_USART2)
+    GPIO_InitStruct.Mode = GPIO_MODE_INPUT;       // Bus TX released, driven only while answering a poll (usart_bus_reply)
+    #else
     GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    #endif
     GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
     HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 
@@ -161,8 +220,12 @@ void HAL_UART_MspInit(UART_HandleTypeDef* uartHandle)
     __HAL_LINKDMA(uartHandle,hdmatx,hdma_usart2_tx);
 
     /* USART2 interrupt Init */
-    HAL_NVIC_SetPriority(USART2_IRQn, 0, 0);
+    HAL_NVIC_SetPriority(USART2_IRQn, IRQ_PRIO_COMMS, 0);
     HAL_NVIC_EnableIRQ(USART2_IRQn);
+    #if defined(SERIAL_RX_DMA_IRQ)
+    HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, IRQ_PRIO_COMMS, 0);     // Rx half transfer and transfer complete, see UART_RxDma
+    HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+    #endif
   /* USER CODE BEGIN USART2_MspInit 1 */
 	__HAL_UART_ENABLE_IT (uartHandle, UART_IT_IDLE);  // Enable the USART IDLE line detection interrupt
   /* USER CODE END USART2_MspInit 1 */
@@ -181,7 +244,11 @@ void HAL_UART_MspInit(UART_HandleTypeDef* uartHandle)
     PB11     ------> USART3_RX 
     */
     GPIO_InitStruct.Pin = GPIO_PIN_10;
+    #if defined(SERIAL_BUS) && defined(CONTROL_SERIAL_USART3)
+    GPIO_InitStruct.Mode = GPIO_MODE_INPUT;       // Bus TX released, driven only while answering a poll (usart_bus_reply)
+    #else
     GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    #endif
     GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
     HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
@@ -216,8 +283,12 @@ void HAL_UART_MspInit(UART_HandleTypeDef* uartHandle)
     __HAL_LINKDMA(uartHandle,hdmatx,hdma_usart3_tx);
 
     /* USART3 interrupt Init */
-    HAL_NVIC_SetPriority(USART3_IRQn, 0, 0);
+    HAL_NVIC_SetPriority(USART3_IRQn, IRQ_PRIO_COMMS, 0);
     HAL_NVIC_EnableIRQ(USART3_IRQn);
+    #if defined(SERIAL_RX_DMA_IRQ)
+    HAL_NVIC_SetPriority(DMA1_Channel3_IRQn, IRQ_PRIO_COMMS, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+    #endif
   /* USER CODE BEGIN USART3_MspInit 1 */
 	__HAL_UART_ENABLE_IT (uartHandle, UART_IT_IDLE);  // Enable the USART IDLE line detection interrupt
   /* USER CODE END USART3_MspInit 1 */
@@ -247,6 +318,9 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef* uartHandle)
 
     /* USART2 interrupt Deinit */
     HAL_NVIC_DisableIRQ(USART2_IRQn);
+    #if defined(SERIAL_RX_DMA_IRQ)
+    HAL_NVIC_DisableIRQ(DMA1_Channel6_IRQn);
+    #endif
   /* USER CODE BEGIN USART2_MspDeInit 1 */
 
   /* USER CODE END USART2_MspDeInit 1 */
@@ -271,6 +345,9 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef* uartHandle)
 
     /* USART3 interrupt Deinit */
     HAL_NVIC_DisableIRQ(USART3_IRQn);
+    #if defined(SERIAL_RX_DMA_IRQ)
+    HAL_NVIC_DisableIRQ(DMA1_Channel3_IRQn);
+    #endif
   /* USER CODE BEGIN USART3_MspDeInit 1 */
 
   /* USER CODE END USART3_MspDeInit 1 */
@@ -336,7 +413,13 @@ void I2C_Init(void)
   __HAL_LINKDMA(&hi2c2,hdmarx,hdma_i2c2_rx);
 */
 
-/*  hdma_i2c2_tx.Instance = DMA1_Channel4;
+#if defined(LCD_ASYNC)
+  /* I2C2_TX on DMA1 channel 4 for the LCD cell updates */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+  HAL_NVIC_SetPriority(DMA1_Channel4_IRQn, IRQ_PRIO_COMMS, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+
+  hdma_i2c2_tx.Instance = DMA1_Channel4;
   hdma_i2c2_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
   hdma_i2c2_tx.Init.PeriphInc = DMA_PINC_DISABLE;
   hdma_i2c2_tx.Init.MemInc = DMA_MINC_ENABLE;
@@ -347,13 +430,50 @@ void I2C_Init(void)
   HAL_DMA_Init(&hdma_i2c2_tx);
 
   __HAL_LINKDMA(&hi2c2,hdmatx,hdma_i2c2_tx);
-*/
+#endif
+
   /* Peripheral interrupt init */
-/*  HAL_NVIC_SetPriority(I2C2_EV_IRQn, 0, 0);
+#if defined(NUNCHUK_ASYNC) || defined(LCD_ASYNC)
+  HAL_NVIC_SetPriority(I2C2_EV_IRQn, IRQ_PRIO_COMMS, 0);
   HAL_NVIC_EnableIRQ(I2C2_EV_IRQn);
-  HAL_NVIC_SetPriority(I2C2_ER_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(I2C2_ER_IRQn, IRQ_PRIO_COMMS, 0);
   HAL_NVIC_EnableIRQ(I2C2_ER_IRQn);
-*/
+#endif
+}
+
+/* Free a bus held by a slave that lost sync in the middle of a byte:
+ * clock SCL until SDA is released, then generate a STOP. Call before I2C_Init.
+ */
+void I2C_Bus_Recover(void)
+{
+  GPIO_InitTypeDef GPIO_InitStruct;
+  uint8_t i;
+
+  HAL_NVIC_DisableIRQ(I2C2_EV_IRQn);
+  HAL_NVIC_DisableIRQ(I2C2_ER_IRQn);
+  HAL_I2C_DeInit(&hi2c2);
+
+  __HAL_RCC_GPIOB_CLK_ENABLE();
+  HAL_GPIO_WritePin(GPIOB, GPIO_PIN_10|GPIO_PIN_11, GPIO_PIN_SET);
+  GPIO_InitStruct.Pin = GPIO_PIN_10|GPIO_PIN_11;
+  GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+  HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+  /* Up to 9 clocks of about 100 kHz */
+  for (i = 0; i < 9 && HAL_GPIO_ReadPin(GPIOB, GPIO_PIN_11) == GPIO_PIN_RESET; i++) {
+    HAL_GPIO_WritePin(GPIOB, GPIO_PIN_10, GPIO_PIN_RESET);
+    for (volatile uint16_t d = 0; d < 64; d++);
+    HAL_GPIO_WritePin(GPIOB, GPIO_PIN_10, GPIO_PIN_SET);
+    for (volatile uint16_t d = 0; d < 64; d++);
+  }
+
+  /* STOP: SDA rises while SCL is high */
+  HAL_GPIO_WritePin(GPIOB, GPIO_PIN_11, GPIO_PIN_RESET);
+  for (volatile uint16_t d = 0; d < 64; d++);
+  HAL_GPIO_WritePin(GPIOB, GPIO_PIN_11, GPIO_PIN_SET);
+  for (volatile uint16_t d = 0; d < 64; d++);
 }
 
 void MX_GPIO_Init(void) {
@@ -364,7 +484,11 @@ void MX_GPIO_Init(void) {
   __HAL_RCC_GPIOB_CLK_ENABLE();
   __HAL_RCC_GPIOC_CLK_ENABLE();
 
+  #if defined(HALL_COM_HW)
+  GPIO_InitStruct.Mode  = GPIO_MODE_IT_RISING_FALLING;  // hall edges commutate in bldc.c
+  #else
   GPIO_InitStruct.Mode  = GPIO_MODE_INPUT;
+  #endif
   GPIO_InitStruct.Pull  = GPIO_NOPULL;
   GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
 
@@ -386,6 +510,14 @@ void MX_GPIO_Init(void) {
   GPIO_InitStruct.Pin = RIGHT_HALL_W_PIN;
   HAL_GPIO_Init(RIGHT_HALL_W_PORT, &GPIO_InitStruct);
 
+  #if defined(HALL_COM_HW)
+  HAL_NVIC_SetPriority(EXTI9_5_IRQn, IRQ_PRIO_COMMUT, 0);
+  HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+  HAL_NVIC_SetPriority(EXTI15_10_IRQn, IRQ_PRIO_COMMUT, 0);
+  HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
+  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  #endif
+
   GPIO_InitStruct.Pull = GPIO_PULLUP;
   GPIO_InitStruct.Pin = CHARGER_PIN;
   HAL_GPIO_Init(CHARGER_PORT, &GPIO_InitStruct);
@@ -484,6 +616,17 @@ void MX_GPIO_Init(void) {
 
   GPIO_InitStruct.Pin = RIGHT_TIM_WL_PIN;
   HAL_GPIO_Init(RIGHT_TIM_WL_PORT, &GPIO_InitStruct);
+
+  #if defined(HW_BREAK)
+  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Pull = (HW_BREAK_POLARITY == TIM_BREAKPOLARITY_LOW) ? GPIO_PULLUP : GPIO_PULLDOWN;   // inactive while open
+
+  GPIO_InitStruct.Pin = LEFT_TIM_BKIN_PIN;
+  HAL_GPIO_Init(LEFT_TIM_BKIN_PORT, &GPIO_InitStruct);
+
+  GPIO_InitStruct.Pin = RIGHT_TIM_BKIN_PIN;
+  HAL_GPIO_Init(RIGHT_TIM_BKIN_PORT, &GPIO_InitStruct);
+  #endif
 }
 
 void MX_TIM_Init(void) {
@@ -498,7 +641,7 @@ void MX_TIM_Init(void) {
   htim_right.Instance               = RIGHT_TIM;
   htim_right.Init.Prescaler         = 0;
   htim_right.Init.CounterMode       = TIM_COUNTERMODE_CENTERALIGNED1;
-  htim_right.Init.Period            = 64000000 / 2 / PWM_FREQ;
+  htim_right.Init.Period            = PWM_RES;
   htim_right.Init.ClockDivision     = TIM_CLOCKDIVISION_DIV1;
   htim_right.Init.RepetitionCounter = 0;
   htim_right.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
@@ -522,22 +665,31 @@ void MX_TIM_Init(void) {
   sBreakDeadTimeConfig.OffStateRunMode  = TIM_OSSR_ENABLE;
   sBreakDeadTimeConfig.OffStateIDLEMode = TIM_OSSI_ENABLE;
   sBreakDeadTimeConfig.LockLevel        = TIM_LOCKLEVEL_OFF;
-  sBreakDeadTimeConfig.DeadTime         = DEAD_TIME;
+  sBreakDeadTimeConfig.DeadTime         = DEAD_TIME_DTG;
+  #if defined(HW_BREAK)
+  sBreakDeadTimeConfig.BreakState       = TIM_BREAK_ENABLE;
+  sBreakDeadTimeConfig.BreakPolarity    = HW_BREAK_POLARITY;
+  #else
   sBreakDeadTimeConfig.BreakState       = TIM_BREAK_DISABLE;
   sBreakDeadTimeConfig.BreakPolarity    = TIM_BREAKPOLARITY_LOW;
-  sBreakDeadTimeConfig.AutomaticOutput  = TIM_AUTOMATICOUTPUT_DISABLE;
+  #endif
+  sBreakDeadTimeConfig.AutomaticOutput  = TIM_AUTOMATICOUTPUT_DISABLE;   // MOE also switches the motors off (enable, chopping), the next update event must not undo that
   HAL_TIMEx_ConfigBreakDeadTime(&htim_right, &sBreakDeadTimeConfig);
 
   htim_left.Instance               = LEFT_TIM;
   htim_left.Init.Prescaler         = 0;
   htim_left.Init.CounterMode       = TIM_COUNTERMODE_CENTERALIGNED1;
-  htim_left.Init.Period            = 64000000 / 2 / PWM_FREQ;
+  htim_left.Init.Period            = PWM_RES;
   htim_left.Init.ClockDivision     = TIM_CLOCKDIVISION_DIV1;
   htim_left.Init.RepetitionCounter = 0;
   htim_left.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
   HAL_TIM_PWM_Init(&htim_left);
 
+  #if defined(ADC_SAMPLE_ALIGN)
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_OC4REF;  // the channel 4 compare starts the conversions, see adcSampleStep in bldc.c
+  #else
   sMasterConfig.MasterOutputTrigger = TIM_TRGO_UPDATE;
+  #endif
   sMasterConfig.MasterSlaveMode     = TIM_MASTERSLAVEMODE_ENABLE;
   HAL_TIMEx_MasterConfigSynchronization(&htim_left, &sMasterConfig);
 
@@ -559,18 +711,32 @@ void MX_TIM_Init(void) {
   HAL_TIM_PWM_ConfigChannel(&htim_left, &sConfigOC, TIM_CHANNEL_1);
   HAL_TIM_PWM_ConfigChannel(&htim_left, &sConfigOC, TIM_CHANNEL_2);
   HAL_TIM_PWM_ConfigChannel(&htim_left, &sConfigOC, TIM_CHANNEL_3);
+  #if defined(ADC_SAMPLE_ALIGN)
+  sConfigOC.OCMode       = TIM_OCMODE_PWM2;  // OC4REF rises at the compare on the way up, the output stays disabled
+  sConfigOC.Pulse        = PWM_RES - ADC_SAMPLE_OFFSET;
+  HAL_TIM_PWM_ConfigChannel(&htim_left, &sConfigOC, TIM_CHANNEL_4);
+  #endif
 
   sBreakDeadTimeConfig.OffStateRunMode  = TIM_OSSR_ENABLE;
   sBreakDeadTimeConfig.OffStateIDLEMode = TIM_OSSI_ENABLE;
   sBreakDeadTimeConfig.LockLevel        = TIM_LOCKLEVEL_OFF;
-  sBreakDeadTimeConfig.DeadTime         = DEAD_TIME;
+  sBreakDeadTimeConfig.DeadTime         = DEAD_TIME_DTG;
+  #if defined(HW_BREAK)
+  sBreakDeadTimeConfig.BreakState       = TIM_BREAK_ENABLE;
+  sBreakDeadTimeConfig.BreakPolarity    = HW_BREAK_POLARITY;
+  #else
   sBreakDeadTimeConfig.BreakState       = TIM_BREAK_DISABLE;
   sBreakDeadTimeConfig.BreakPolarity    = TIM_BREAKPOLARITY_LOW;
+  #endif
   sBreakDeadTimeConfig.AutomaticOutput  = TIM_AUTOMATICOUTPUT_DISABLE;
   HAL_TIMEx_ConfigBreakDeadTime(&htim_left, &sBreakDeadTimeConfig);
 
   LEFT_TIM->BDTR &= ~TIM_BDTR_MOE;
   RIGHT_TIM->BDTR &= ~TIM_BDTR_MOE;
+  #if defined(HW_BREAK)
+  LEFT_TIM->SR  = ~TIM_SR_BIF;          // no trip counted before the first tick
+  RIGHT_TIM->SR = ~TIM_SR_BIF;
+  #endif
 
   HAL_TIM_PWM_Start(&htim_left, TIM_CHANNEL_1);
   HAL_TIM_PWM_Start(&htim_left, TIM_CHANNEL_2);
@@ -586,7 +752,11 @@ void MX_TIM_Init(void) {
   HAL_TIMEx_PWMN_Start(&htim_right, TIM_CHANNEL_2);
   HAL_TIMEx_PWMN_Start(&htim_right, TIM_CHANNEL_3);
 
+  #if defined(CTRL_VALLEY_LOAD)
+  htim_left.Instance->RCR = 0;          // duties loaded at the top and the valley, the ADC trigger is the channel 4 compare
+  #else
   htim_left.Instance->RCR = 1;
+  #endif
 
   __HAL_TIM_ENABLE(&htim_right);
 }
@@ -594,6 +764,7 @@ void MX_TIM_Init(void) {
 void MX_ADC1_Init(void) {
   ADC_MultiModeTypeDef multimode;
   ADC_ChannelConfTypeDef sConfig;
+  ADC_InjectionConfTypeDef sConfigInjected;
 
   __HAL_RCC_ADC1_CLK_ENABLE();
 
@@ -603,7 +774,7 @@ void MX_ADC1_Init(void) {
   hadc1.Init.DiscontinuousConvMode = DISABLE;
   hadc1.Init.ExternalTrigConv      = ADC_EXTERNALTRIGCONV_T8_TRGO;
   hadc1.Init.DataAlign             = ADC_DATAALIGN_RIGHT;
-  hadc1.Init.NbrOfConversion       = 5;
+  hadc1.Init.NbrOfConversion       = ADC_REG_WORDS;
   HAL_ADC_Init(&hadc1);
   /**Enable or disable the remapping of ADC1_ETRGREG:
     * ADC1 External Event regular conversion is connected to TIM8 TRG0
@@ -611,59 +782,87 @@ void MX_ADC1_Init(void) {
   __HAL_AFIO_REMAP_ADC1_ETRGREG_ENABLE();
 
   /**Configure the ADC multi-mode
+    * Regular group: phase and DC link currents, triggered by TIM8 TRGO, transferred by DMA
+    * Injected group: slow channels (battery, temperature, UART pins), started by software after the currents were sampled.
+    * With DC_LINK_EST the DC link currents are its first rank instead
     */
-  multimode.Mode = ADC_DUALMODE_REGSIMULT;
+  multimode.Mode = ADC_DUALMODE_REGSIMULT_INJECSIMULT;
   HAL_ADCEx_MultiModeConfigChannel(&hadc1, &multimode);
 
+  #if !defined(DC_LINK_EST)
   sConfig.SamplingTime = ADC_SAMPLETIME_1CYCLE_5;
   sConfig.Channel = ADC_CHANNEL_11;  // pc1 left cur  ->  right
   sConfig.Rank    = 1;
   HAL_ADC_ConfigChannel(&hadc1, &sConfig);
+  #endif
 
   // sConfig.SamplingTime = ADC_SAMPLETIME_1CYCLE_5;
   sConfig.SamplingTime = ADC_SAMPLETIME_7CYCLES_5;
-  sConfig.Channel = ADC_CHANNEL_0;  // pa0 right a   ->  left
-  sConfig.Rank    = 2;
-  HAL_ADC_ConfigChannel(&hadc1, &sConfig);
+  // Phase currents, ADC_OVERSAMPLE times in a row after the DC link current: ranks 2, 4, .. left, ranks 3, 5, .. right,
+  // one rank earlier with DC_LINK_EST
+  for (uint8_t i = 0; i < ADC_OVERSAMPLE; i++) {
+    sConfig.Channel = ADC_CHANNEL_0;  // pa0 right a   ->  left
+    sConfig.Rank    = 1 + ADC_DC_REG + 2 * i;
+    HAL_ADC_ConfigChannel(&hadc1, &sConfig);
+
+    sConfig.Channel = ADC_CHANNEL_14;  // pc4 left b   -> right
+    sConfig.Rank    = 2 + ADC_DC_REG + 2 * i;
+    HAL_ADC_ConfigChannel(&hadc1, &sConfig);
+  }
 
-  sConfig.Channel = ADC_CHANNEL_14;  // pc4 left b   -> right
-  sConfig.Rank    = 3;
-  HAL_ADC_ConfigChannel(&hadc1, &sConfig);
+  sConfigInjected.InjectedNbrOfConversion       = 2 + ADC_DC_INJ;
+  sConfigInjected.InjectedDiscontinuousConvMode = DISABLE;
+  sConfigInjected.AutoInjectedConv              = DISABLE;
+  sConfigInjected.ExternalTrigInjecConv         = ADC_INJECTED_SOFTWARE_START;
+  sConfigInjected.InjectedOffset                = 0;
+
+  sConfigInjected.InjectedSamplingTime = ADC_SAMPLETIME_7CYCLES_5;
+  #if defined(DC_LINK_EST)
+  sConfigInjected.InjectedChannel = ADC_CHANNEL_11;  // pc1 left cur  ->  right, the cross-check of the estimate
+  sConfigInjected.InjectedRank    = ADC_INJECTED_RANK_1;
+  HAL_ADCEx_InjectedConfigChannel(&hadc1, &sConfigInjected);
+  #endif
 
   #if BOARD_VARIANT == 0
-  sConfig.Channel = ADC_CHANNEL_12;  // pc2 vbat
+  sConfigInjected.InjectedChannel = ADC_CHANNEL_12;  // pc2 vbat
   #elif BOARD_VARIANT == 1
-  sConfig.Channel = ADC_CHANNEL_1;   // pa1 vbat
+  sConfigInjected.InjectedChannel = ADC_CHANNEL_1;   // pa1 vbat
   #endif
-  sConfig.Rank    = 4;
-  HAL_ADC_ConfigChannel(&hadc1, &sConfig);
+  sConfigInjected.InjectedRank    = ADC_INJECTED_RANK_1 + ADC_DC_INJ;
+  HAL_ADCEx_InjectedConfigChannel(&hadc1, &sConfigInjected);
 
   //temperature requires at least 17.1uS sampling time
-  sConfig.SamplingTime = ADC_SAMPLETIME_239CYCLES_5;
-  sConfig.Channel = ADC_CHANNEL_TEMPSENSOR;  // internal temp
-  sConfig.Rank    = 5;
-  HAL_ADC_ConfigChannel(&hadc1, &sConfig);
+  sConfigInjected.InjectedSamplingTime = ADC_SAMPLETIME_239CYCLES_5;
+  #if defined(ADC_TEMP_DECIM)
+  sConfigInjected.InjectedChannel = ADC_CHANNEL_VREFINT;     // only sets its sampling time, the control interrupt selects the last rank (adcSlowSel)
+  sConfigInjected.InjectedRank    = ADC_INJECTED_RANK_2 + ADC_DC_INJ;
+  HAL_ADCEx_InjectedConfigChannel(&hadc1, &sConfigInjected);
+  #endif
+  sConfigInjected.InjectedChannel = ADC_CHANNEL_TEMPSENSOR;  // internal temp
+  sConfigInjected.InjectedRank    = ADC_INJECTED_RANK_2 + ADC_DC_INJ;
+  HAL_ADCEx_InjectedConfigChannel(&hadc1, &sConfigInjected);
 
-  hadc1.Instance->CR2 |= ADC_CR2_DMA | ADC_CR2_TSVREFE;
+  hadc1.Instance->CR2 |= ADC_CR2_DMA | ADC_CR2_TSVREFE | ADC_CR2_JEXTTRIG;
 
   __HAL_ADC_ENABLE(&hadc1);
 
   __HAL_RCC_DMA1_CLK_ENABLE();
 
   DMA1_Channel1->CCR   = 0;
-  DMA1_Channel1->CNDTR = 5;
+  DMA1_Channel1->CNDTR = 2 * ADC_REG_WORDS;             // only the currents, two PWM periods. The slow channels are copied from the injected group in bldc_slow_task()
   DMA1_Channel1->CPAR  = (uint32_t) & (ADC1->DR);
-  DMA1_Channel1->CMAR  = (uint32_t)&adc_buffer;
-  DMA1_Channel1->CCR   = DMA_CCR_MSIZE_1 | DMA_CCR_PSIZE_1 | DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_TCIE;
+  DMA1_Channel1->CMAR  = (uint32_t)adc_dma;
+  DMA1_Channel1->CCR   = DMA_CCR_MSIZE_1 | DMA_CCR_PSIZE_1 | DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_HTIE | DMA_CCR_TCIE;  // one interrupt per half
   DMA1_Channel1->CCR |= DMA_CCR_EN;
 
-  HAL_NVIC_SetPriority(DMA1_Channel1_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(DMA1_Channel1_IRQn, IRQ_PRIO_CONTROL, 0);
   HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
 }
 
 /* ADC2 init function */
 void MX_ADC2_Init(void) {
   ADC_ChannelConfTypeDef sConfig;
+  ADC_InjectionConfTypeDef sConfigInjected;
 
   __HAL_RCC_ADC2_CLK_ENABLE();
 
@@ -677,34 +876,105 @@ void MX_ADC2_Init(void) {
   hadc2.Init.DiscontinuousConvMode = DISABLE;
   hadc2.Init.ExternalTrigConv      = ADC_SOFTWARE_START;
   hadc2.Init.DataAlign             = ADC_DATAALIGN_RIGHT;
-  hadc2.Init.NbrOfConversion       = 5;
+  hadc2.Init.NbrOfConversion       = ADC_REG_WORDS;
   HAL_ADC_Init(&hadc2);
 
  
+  #if !defined(DC_LINK_EST)
   sConfig.SamplingTime = ADC_SAMPLETIME_1CYCLE_5;
   sConfig.Channel = ADC_CHANNEL_10;  // pc0 right cur   -> left
   sConfig.Rank    = 1;
   HAL_ADC_ConfigChannel(&hadc2, &sConfig);
+  #endif
 
   // sConfig.SamplingTime = ADC_SAMPLETIME_1CYCLE_5;
   sConfig.SamplingTime = ADC_SAMPLETIME_7CYCLES_5;
-  sConfig.Channel = ADC_CHANNEL_13;  // pc3 right b   -> left
-  sConfig.Rank    = 2;
-  HAL_ADC_ConfigChannel(&hadc2, &sConfig);
+  for (uint8_t i = 0; i < ADC_OVERSAMPLE; i++) {
+    sConfig.Channel = ADC_CHANNEL_13;  // pc3 right b   -> left
+    sConfig.Rank    = 1 + ADC_DC_REG + 2 * i;
+    HAL_ADC_ConfigChannel(&hadc2, &sConfig);
+
+    sConfig.Channel = ADC_CHANNEL_15;  // pc5 left c   -> right
+    sConfig.Rank    = 2 + ADC_DC_REG + 2 * i;
+    HAL_ADC_ConfigChannel(&hadc2, &sConfig);
+  }
 
-  sConfig.Channel = ADC_CHANNEL_15;  // pc5 left c   -> right
-  sConfig.Rank    = 3;
-  HAL_ADC_ConfigChannel(&hadc2, &sConfig);
+  // Injected group is started together with ADC1 (injected simultaneous mode), sampling times must match the ADC1 ranks
+  sConfigInjected.InjectedNbrOfConversion       = 2 + ADC_DC_INJ;
+  sConfigInjected.InjectedDiscontinuousConvMode = DISABLE;
+  sConfigInjected.AutoInjectedConv              = DISABLE;
+  sConfigInjected.ExternalTrigInjecConv         = ADC_INJECTED_SOFTWARE_START;
+  sConfigInjected.InjectedOffset                = 0;
+
+  sConfigInjected.InjectedSamplingTime = ADC_SAMPLETIME_7CYCLES_5;
+  #if defined(DC_LINK_EST)
+  sConfigInjected.InjectedChannel = ADC_CHANNEL_10;  // pc0 right cur   -> left
+  sConfigInjected.InjectedRank    = ADC_INJECTED_RANK_1;
+  HAL_ADCEx_InjectedConfigChannel(&hadc2, &sConfigInjected);
+  #endif
+
+  #if defined(ADC_INPUT_OVS)
+  sConfigInjected.InjectedChannel = ADC_CHANNEL_13; // dummy, pa2 and pa3 belong to ADC3. pc3 is idle outside the current burst
+  #else
+  sConfigInjected.InjectedChannel = ADC_CHANNEL_2;  // pa2 uart-l-tx
+  #endif
+  sConfigInjected.InjectedRank    = ADC_INJECTED_RANK_1 + ADC_DC_INJ;
+  HAL_ADCEx_InjectedConfigChannel(&hadc2, &sConfigInjected);
+
+  #if defined(ADC_TEMP_DECIM)
+  sConfigInjected.InjectedSamplingTime = ADC_SAMPLETIME_7CYCLES_5;   // the temperature group of ADC1 is longer only every ADC_TEMP_PERIOD
+  #else
+  sConfigInjected.InjectedSamplingTime = ADC_SAMPLETIME_239CYCLES_5;
+  #endif
+  #if defined(ADC_INPUT_OVS)
+  sConfigInjected.InjectedChannel = ADC_CHANNEL_13; // dummy
+  #else
+  sConfigInjected.InjectedChannel = ADC_CHANNEL_3;  // pa3 uart-l-rx
+  #endif
+  sConfigInjected.InjectedRank    = ADC_INJECTED_RANK_2 + ADC_DC_INJ;
+  HAL_ADCEx_InjectedConfigChannel(&hadc2, &sConfigInjected);
+
+  hadc2.Instance->CR2 |= ADC_CR2_DMA | ADC_CR2_JEXTTRIG;
+  __HAL_ADC_ENABLE(&hadc2);
+}
 
+#if defined(ADC_INPUT_OVS)
+/* ADC3 init function: the pot inputs pa2 and pa3 converted back to back in continuous mode, independent of the
+ * control timing. DMA2 Channel5 fills adc_ovs in a circle without interrupts, bldc_slow_task sums it every 1 ms.
+ * Started by HAL_ADC_Start(&hadc3) with the other ADCs */
+void MX_ADC3_Init(void) {
+  ADC_ChannelConfTypeDef sConfig;
+
+  __HAL_RCC_ADC3_CLK_ENABLE();
+
+  hadc3.Instance                   = ADC3;
+  hadc3.Init.ScanConvMode          = ADC_SCAN_ENABLE;
+  hadc3.Init.ContinuousConvMode    = ENABLE;
+  hadc3.Init.DiscontinuousConvMode = DISABLE;
+  hadc3.Init.ExternalTrigConv      = ADC_SOFTWARE_START;
+  hadc3.Init.DataAlign             = ADC_DATAALIGN_RIGHT;
+  hadc3.Init.NbrOfConversion       = 2;
+  HAL_ADC_Init(&hadc3);
+
+  sConfig.SamplingTime = ADC_SAMPLETIME_239CYCLES_5;  // 252 ADC clocks per conversion, a pair every 31.5 us at 16 MHz
   sConfig.Channel = ADC_CHANNEL_2;  // pa2 uart-l-tx
-  sConfig.Rank    = 4;
-  HAL_ADC_ConfigChannel(&hadc2, &sConfig);
+  sConfig.Rank    = 1;
+  HAL_ADC_ConfigChannel(&hadc3, &sConfig);
 
-  // sConfig.SamplingTime = ADC_SAMPLETIME_239CYCLES_5;   // Commented-out to make `uart-l-rx` ADC sample time the same as `uart-l-tx`
   sConfig.Channel = ADC_CHANNEL_3;  // pa3 uart-l-rx
-  sConfig.Rank    = 5;
-  HAL_ADC_ConfigChannel(&hadc2, &sConfig);
+  sConfig.Rank    = 2;
+  HAL_ADC_ConfigChannel(&hadc3, &sConfig);
 
-  hadc2.Instance->CR2 |= ADC_CR2_DMA;
-  __HAL_ADC_ENABLE(&hadc2);
+  hadc3.Instance->CR2 |= ADC_CR2_DMA;
+  __HAL_ADC_ENABLE(&hadc3);
+
+  __HAL_RCC_DMA2_CLK_ENABLE();
+
+  DMA2_Channel5->CCR   = 0;
+  DMA2_Channel5->CNDTR = 2 * ADC_INPUT_OVS;             // half words, l_tx2 and l_rx2 alternating
+  DMA2_Channel5->CPAR  = (uint32_t) & (ADC3->DR);
+  DMA2_Channel5->CMAR  = (uint32_t)adc_ovs;
+  DMA2_Channel5->CCR   = DMA_CCR_MSIZE_0 | DMA_CCR_PSIZE_0 | DMA_CCR_MINC | DMA_CCR_CIRC;  // low priority, no interrupt
+  DMA2_Channel5->CCR |= DMA_CCR_EN;
 }
+#endif
@@ -0,0 +1,223 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Speed loop filters (SPD_FILT). Only uses config.h and the controller tables, so it also builds on the host.
+//
+// Filters: the controller step runs the two biquads on the speed error of SPD_MODE before the speed PI (spdErrFilt in
+// BLDC_controller.c), at the rate of the FOC task group. spdFiltDesign computes them in the main loop from the
+// parameters, cos and sin by their series, no soft float:
+// - notch: zeros and poles at the centre angle w, the poles at r = 1 - pi BW / fs for the -3 dB width, the zeros at
+//   1 - depth (1 - r), so the centre keeps depth % of the error. Scaled to a DC gain of 1
+// - low pass: second order Butterworth of the bilinear transform (Q = 1 / sqrt(2))
+// Resonance search: the speed target gets SPD_ID_AMP sin(phase), the phase turns at each of the SPD_ID_BINS frequencies
+// (geometric from SPD_ID_F0 to SPD_ID_F1) for SPD_ID_SETTLE + SPD_ID_MEAS periods and carries over from one to the next.
+// Over the last SPD_ID_MEAS periods the speed is summed times cos and sin of the phase (one DFT bin, the steady speed
+// cancels over whole periods), its amplitude over the excitation is the gain of that frequency. A resonance of the
+// closed speed loop stands out as a gain peak over the lowest frequency.
+
+#include <stdint.h>
+#include "config.h"
+#include "BLDC_controller.h"
+#include "spdfilt.h"
+
+#if defined(SPD_FILT)
+
+#define SF_ONE                  (1LL << 30)                       // [-] 1.0 of the design math, Q30
+#define SF_2PI                  6746518852LL                      // [-] 2 pi, Q30
+#define SPD_ID_SETTLE           2                                 // [periods] not summed after a frequency step
+#define SPD_ID_MEAS             4                                 // [periods] summed per frequency
+
+static uint32_t spdIdMhz[SPD_ID_BINS];  // [mHz] sweep frequencies
+static uint32_t spdIdInc[SPD_ID_BINS];  // [2^-32 turn per tick] phase step of each frequency
+
+/* cos and sin of w [rad, Q30, at most 1] by their series, Q30 */
+static void sfCosSin(int64_t w, int64_t *c, int64_t *s) {
+  int64_t w2 = (w * w) >> 30, tc = SF_ONE, ts = w;
+  *c = tc;
+  *s = ts;
+  for (int64_t k = 1; k <= 5; k++) {
+    tc  = -((tc * w2) >> 30) / ((2 * k - 1) * (2 * k));
+    ts  = -((ts * w2) >> 30) / ((2 * k) * (2 * k + 1));
+    *c += tc;
+    *s += ts;
+  }
+}
+
+/* Q30 product */
+static inline int64_t sfMul(int64_t a, int64_t b) {
+  return (a * b) >> 30;
+}
+
+/* Coefficients c of the notch and the low pass from the parameters cfg at the filter rate fs [Hz]. A stage at 0 Hz
+ * gets b0 = 0, the controller skips it */
+void spdFiltDesign(int32_t c[SPD_FILT_COEFS], const uint16_t cfg[SF_N], uint32_t fs) {
+  int64_t b[SPD_FILT_COEFS] = {0}, co, si;
+  if (cfg[SF_NOTCH_HZ] != 0) {
+    int64_t rp = SF_ONE - (int64_t)cfg[SF_NOTCH_BW] * (SF_2PI / 2) / fs;
+    int64_t rz = SF_ONE - (SF_ONE - rp) * cfg[SF_NOTCH_DEPTH] / 100;
+    sfCosSin((int64_t)cfg[SF_NOTCH_HZ] * SF_2PI / fs, &co, &si);
+    int64_t dp = SF_ONE - 2 * sfMul(rp, co) + sfMul(rp, rp);          // denominator and numerator at DC
+    int64_t dz = SF_ONE - 2 * sfMul(rz, co) + sfMul(rz, rz);
+    int64_t k  = (dp << 30) / dz;
+    b[0] = k;
+    b[1] = -2 * sfMul(sfMul(rz, co), k);
+    b[2] = sfMul(sfMul(rz, rz), k);
+    b[3] = -2 * sfMul(rp, co);
+    b[4] = sfMul(rp, rp);
+  }
+  if (cfg[SF_LP_HZ] != 0) {
+    sfCosSin((int64_t)cfg[SF_LP_HZ] * SF_2PI / fs, &co, &si);
+    int64_t al = sfMul(si, 759250125LL);                               // sin w / (2 Q), 1 / sqrt(2) in Q30
+    int64_t a0 = SF_ONE + al;
+    b[5] = ((SF_ONE - co) << 29) / a0;
+    b[6] = 2 * b[5];
+    b[7] = b[5];
+    b[8] = -((2 * co) << 30) / a0;
+    b[9] = ((SF_ONE - al) << 30) / a0;
+  }
+  for (uint8_t i = 0; i < SPD_FILT_COEFS; i++) {
+    c[i] = (int32_t)(b[i] >> (30 - SPD_FILT_Q));
+  }
+}
+
+static uint32_t isqrt32(uint32_t x) {
+  uint32_t r = 0;
+  for (uint32_t b = 1UL << 30; b; b >>= 2) {
+    if (x >= r + b) {
+      x -= r + b;
+      r  = (r >> 1) + b;
+    } else {
+      r >>= 1;
+    }
+  }
+  return r;
+}
+
+/* sin of phase [2^-32 turn], Q14, from the 1 deg quarter wave table of the controller */
+static int16_t spdIdSin(uint32_t phase) {
+  const int16_T *tab = rtConstP.r_sinQuarter_Table;
+  uint32_t deg = (uint32_t)(((uint64_t)phase * 360) >> 32);
+  if (deg < 90)  { return tab[deg]; }
+  if (deg < 180) { return tab[180 - deg]; }
+  if (deg < 270) { return (int16_t)-tab[deg - 180]; }
+  return (int16_t)-tab[360 - deg];
+}
+
+/* Main loop, before a sweep: the frequencies, geometric from SPD_ID_F0 to SPD_ID_F1. Returns the sweep time [s] */
+uint16_t spdIdPlan(void) {
+  uint64_t lo = 1ULL << 24, hi = 2ULL << 24, q, f;
+  uint32_t ms = 0;
+  while (hi - lo > 1) {                 // ratio of neighbouring frequencies, Q24
+    q = (lo + hi) / 2;
+    f = SPD_ID_F0 * 1000ULL;
+    for (uint8_t k = 1; k < SPD_ID_BINS; k++) {
+      f = (f * q) >> 24;
+    }
+    if (f < SPD_ID_F1 * 1000ULL) {
+      lo = q;
+    } else {
+      hi = q;
+    }
+  }
+  f = SPD_ID_F0 * 1000ULL;
+  for (uint8_t k = 0; k < SPD_ID_BINS; k++) {
+    spdIdMhz[k] = (uint32_t)f;
+    spdIdInc[k] = (uint32_t)((f << 32) / (PWM_FREQ * 1000ULL));
+    ms         += (uint32_t)((SPD_ID_SETTLE + SPD_ID_MEAS) * 1000000ULL / f);
+    f           = (f * hi) >> 24;
+  }
+  return (uint16_t)(ms / 1000 + 1);
+}
+
+/* [Hz * 10] frequency of a bin */
+uint16_t spdIdFreq(uint8_t bin) {
+  return (uint16_t)(spdIdMhz[bin] / 100);
+}
+
+void spdIdStart(SpdId *c) {
+  c->sum[0] = c->sum[1] = 0;
+  c->phase  = 0;
+  c->ticks  = 0;
+  c->exc    = 0;
+  c->cycles = 0;
+  c->bin    = 0;
+  for (uint8_t k = 0; k < SPD_ID_BINS; k++) {
+    c->gain[k] = 0;
+  }
+  c->state  = SPD_ID_RUN;
+}
+
+/* Before the controller step: the excitation on top of the SPD_MODE target */
+void spdIdInput(const SpdId *c, int16_t *inpTgt) {
+  if (c->state == SPD_ID_RUN) {
+    *inpTgt = (int16_t)(*inpTgt + c->exc);
+  }
+}
+
+/* After the controller step with the speed n [rpm] of it. run = 0 (motor off, not SPD_MODE, FOC) fails the sweep.
+ * Returns 1 once the sweep is over */
+uint8_t spdIdStep(SpdId *c, uint8_t run, int16_t n) {
+  uint32_t prev = c->phase;
+  if (c->state != SPD_ID_RUN) {
+    return 0;
+  }
+  if (!run) {
+    c->exc   = 0;
+    c->state = SPD_ID_FAIL;
+    return 1;
+  }
+  if (c->cycles >= SPD_ID_SETTLE) {
+    c->sum[0] += (int32_t)n * spdIdSin(c->phase + (1UL << 30));
+    c->sum[1] += (int32_t)n * spdIdSin(c->phase);
+    c->ticks++;
+  }
+  c->phase += spdIdInc[c->bin];
+  if (c->phase < prev && ++c->cycles == SPD_ID_SETTLE + SPD_ID_MEAS) {          // a period ended, and the frequency
+    int32_t  re  = (int32_t)((c->sum[0] / c->ticks) >> 10);                      // [rpm, Q4] half the amplitude
+    int32_t  im  = (int32_t)((c->sum[1] / c->ticks) >> 10);
+    uint32_t amp = 2 * isqrt32((uint32_t)(re * re + im * im)) * 100 / (16 * SPD_ID_AMP);
+    c->gain[c->bin] = (uint16_t)(amp < 65535 ? amp : 65535);
+    c->sum[0] = c->sum[1] = 0;
+    c->ticks  = 0;
+    c->cycles = 0;
+    if (++c->bin == SPD_ID_BINS) {
+      c->exc   = 0;
+      c->state = SPD_ID_DONE;
+      return 1;
+    }
+  }
+  c->exc = (int16_t)((SPD_ID_AMP * spdIdSin(c->phase)) >> 14);
+  return 0;
+}
+
+/* Highest gain above the lowest frequency: its bin, returns it in % of the lowest frequency, 0 without a response */
+uint16_t spdIdPeak(const SpdId *c, uint8_t *bin) {
+  uint8_t k = 1;
+  for (uint8_t i = 2; i < SPD_ID_BINS; i++) {
+    if (c->gain[i] > c->gain[k]) {
+      k = i;
+    }
+  }
+  *bin = k;
+  if (c->gain[0] == 0) {
+    return 0;
+  }
+  uint32_t r = (uint32_t)c->gain[k] * 100 / c->gain[0];
+  return (uint16_t)(r < 65535 ? r : 65535);
+}
+
+#endif
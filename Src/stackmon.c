@@ -0,0 +1,87 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "timebase.h"
+#include "stackmon.h"
+
+#if defined(STACK_MONITOR)
+
+// Linker script symbols: end of .bss / start of the heap and the heap reserve (an absolute symbol, its address is the value)
+extern uint32_t _end[];
+extern uint8_t  _Min_Heap_Size[];
+
+StackMon stackMon;
+
+static uint32_t *stackBottom;           // lowest painted word, the guard are the first STACK_GUARD bytes from here
+static uint32_t  stackWords;            // painted words
+static uint32_t  stackScanMs;
+
+/*
+ * Paint everything between the heap reserve and the stack pointer of this call, minus a margin for the frame of this
+ * function. Called first in main, before any interrupt source is enabled: the only stack in use is the one of main
+ */
+void __attribute__((noinline)) stackPaint(void) {
+  uintptr_t lo = ((uintptr_t)_end + (uintptr_t)_Min_Heap_Size + 7U) & ~7U;
+  uintptr_t hi = (__get_MSP() - 32U) & ~7U;
+
+  stackBottom  = (uint32_t *)lo;
+  stackWords   = (hi > lo) ? (hi - lo) / 4U : 0;
+  for (uint32_t i = 0; i < stackWords; i++) {
+    stackBottom[i] = STACK_PAINT;
+  }
+  stackMon.size = stackMon.free = stackWords * 4U;
+}
+
+/*
+ * Main loop: guard check at every call, high-water scan once per second. The scan walks up from the bottom to the
+ * first written word, the free part only shrinks so this is the exact mark. A heap grown past _Min_Heap_Size
+ * overwrites the guard as well and trips the same fault
+ */
+void stackCheck(void) {
+  const uint32_t guardWords = (STACK_GUARD / 4U < stackWords) ? STACK_GUARD / 4U : stackWords;
+
+  for (uint32_t i = 0; i < guardWords; i++) {
+    if (stackBottom[i] != STACK_PAINT) {
+      stackMon.fault = 1;               // reported as ERR_STACK_GUARD by bldc_control
+      stackMon.free  = 0;
+      return;
+    }
+  }
+
+  uint32_t now = timeMs();
+  if ((uint32_t)(now - stackScanMs) < 1000U) {
+    return;
+  }
+  stackScanMs = now;
+
+  uint32_t n = stackMon.free / 4U;      // words above the last mark were already written
+  uint32_t i = guardWords;
+  while (i < n && stackBottom[i] == STACK_PAINT) {
+    i++;
+  }
+  stackMon.free = i * 4U;
+}
+
+#else
+
+void stackPaint(void) {}
+void stackCheck(void) {}
+
+#endif
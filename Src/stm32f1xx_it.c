@@ -38,6 +38,9 @@
 #include "config.h"
 #include "setup.h"
 #include "util.h"
+#include "bldc.h"
+#include "timebase.h"
+#include "trace.h"
 
 /* External variables --------------------------------------------------------*/
 
@@ -62,7 +65,8 @@ void NMI_Handler(void) {
 */
 void HardFault_Handler(void) {
   /* USER CODE BEGIN HardFault_IRQn 0 */
-
+  LEFT_TIM->BDTR  &= ~TIM_BDTR_MOE;    // outputs off first, a stack overflow or a corrupted pointer ends here
+  RIGHT_TIM->BDTR &= ~TIM_BDTR_MOE;
   /* USER CODE END HardFault_IRQn 0 */
   while(1) {
   }
@@ -137,12 +141,34 @@ void DebugMon_Handler(void) {
   /* USER CODE END DebugMonitor_IRQn 1 */
 }
 
+/* IDLE line seen by the USART IRQ (or half a buffer by the Rx DMA IRQ), the frames are processed in PendSV (see IRQ_PRIO_DEFERRED) */
+#if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
+static volatile uint8_t usart2RxPend;
+#endif
+#if defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(FEEDBACK_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
+static volatile uint8_t usart3RxPend;
+#endif
+
 /**
 * @brief This function handles Pendable request for system service.
 */
 void PendSV_Handler(void) {
   /* USER CODE BEGIN PendSV_IRQn 0 */
-
+  TRACE_ISR_ENTER(TRACE_ISR_DEFERRED);
+  #if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
+  if (usart2RxPend) {                                             // Cleared first: an IDLE line during the check pends PendSV again
+    usart2RxPend = 0;
+    usart2_rx_check();
+  }
+  #endif
+  #if defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(FEEDBACK_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
+  if (usart3RxPend) {
+    usart3RxPend = 0;
+    usart3_rx_check();
+  }
+  #endif
+  bldc_slow_task();
+  TRACE_ISR_EXIT(TRACE_ISR_DEFERRED);
   /* USER CODE END PendSV_IRQn 0 */
   /* USER CODE BEGIN PendSV_IRQn 1 */
 
@@ -152,12 +178,8 @@ void PendSV_Handler(void) {
 /**
 * @brief This function handles System tick timer.
 */
-#if defined(CONTROL_PPM_LEFT) || defined(CONTROL_PPM_RIGHT)
-void PPM_SysTick_Callback(void);
-#endif
-
-#if defined(CONTROL_PWM_LEFT) || defined(CONTROL_PWM_RIGHT)
-void PWM_SysTick_Callback(void);
+#if defined(NUNCHUK_ASYNC)
+void Nunchuk_SysTick_Callback(void);
 #endif
 
 void SysTick_Handler(void) {
@@ -167,23 +189,26 @@ void SysTick_Handler(void) {
   HAL_IncTick();
   HAL_SYSTICK_IRQHandler();
   /* USER CODE BEGIN SysTick_IRQn 1 */
-#if defined(CONTROL_PPM_LEFT) || defined(CONTROL_PPM_RIGHT)
-  PPM_SysTick_Callback();
-#endif
-
-#if defined(CONTROL_PWM_LEFT) || defined(CONTROL_PWM_RIGHT)
-  PWM_SysTick_Callback();
+#if defined(NUNCHUK_ASYNC)
+  Nunchuk_SysTick_Callback();
 #endif
   /* USER CODE END SysTick_IRQn 1 */
 }
 
-#ifdef CONTROL_NUNCHUK
-void I2C1_EV_IRQHandler(void)
+/**
+* @brief This function handles the timebase high word overflow (TIM4), one epoch every 71.6 min.
+*/
+void TIM4_IRQHandler(void) {
+  timeEpochIrq();
+}
+
+#if defined(CONTROL_NUNCHUK) || defined(LCD_ASYNC)
+void I2C2_EV_IRQHandler(void)
 {
   HAL_I2C_EV_IRQHandler(&hi2c2);
 }
 
-void I2C1_ER_IRQHandler(void)
+void I2C2_ER_IRQHandler(void)
 {
   HAL_I2C_ER_IRQHandler(&hi2c2);
 }
@@ -261,100 +286,89 @@ void EXTI15_10_IRQHandler(void)
 }
 #endif
 
-#if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
-void DMA1_Channel6_IRQHandler(void)
-{
-  /* USER CODE BEGIN DMA1_Channel4_IRQn 0 */
-
-  /* USER CODE END DMA1_Channel4_IRQn 0 */
-  HAL_DMA_IRQHandler(&hdma_usart2_rx);
-  /* USER CODE BEGIN DMA1_Channel4_IRQn 1 */
-
-  /* USER CODE END DMA1_Channel4_IRQn 1 */
+#if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2) || \
+    defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(FEEDBACK_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
+/*
+ * USART interrupt of the DMA transfers (UART_TxDma, UART_RxDma in setup.c), in place of HAL_UART_IRQHandler: the IDLE
+ * line and the TC at the end of a transmission are the only sources. The SR then DR read of the IDLE also clears the
+ * error flags, their interrupts are off. A TC before the DMA is through (a stalled DMA request) is cleared and waited out
+ */
+static inline void USART_IRQ(UART_HandleTypeDef *huart, volatile uint8_t *rxPend) {
+  USART_TypeDef *u  = huart->Instance;
+  uint32_t       sr = u->SR;
+
+  if (sr & USART_SR_IDLE) {
+    (void)u->DR;
+    *rxPend   = 1;                                                // Check for data to process, in PendSV
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+  }
+  if ((sr & USART_SR_TC) && (u->CR1 & USART_CR1_TCIE)) {
+    if (huart->hdmatx->Instance->CNDTR) {
+      u->SR = ~USART_SR_TC;
+      return;
+    }
+    CLEAR_BIT(u->CR1, USART_CR1_TCIE);
+    CLEAR_BIT(u->CR3, USART_CR3_DMAT);
+    huart->hdmatx->Instance->CCR &= ~DMA_CCR_EN;
+    huart->gState = HAL_UART_STATE_READY;
+    HAL_UART_TxCpltCallback(huart);
+  }
 }
+#endif
 
+#if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
 /**
-* @brief This function handles DMA1 channel5 global interrupt.
-*/
-void DMA1_Channel7_IRQHandler(void)
+  * @brief This function handles USART2 global interrupt.
+  */
+void USART2_IRQHandler(void)
 {
-  /* USER CODE BEGIN DMA1_Channel5_IRQn 0 */
-
-  /* USER CODE END DMA1_Channel5_IRQn 0 */
-  HAL_DMA_IRQHandler(&hdma_usart2_tx);
-  /* USER CODE BEGIN DMA1_Channel5_IRQn 1 */
-
-  /* USER CODE END DMA1_Channel5_IRQn 1 */
+  USART_IRQ(&huart2, &usart2RxPend);
 }
 #endif
 
 #if defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(FEEDBACK_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
 /**
-  * @brief This function handles DMA1 channel2 global interrupt.
+  * @brief This function handles USART3 global interrupt.
   */
-void DMA1_Channel2_IRQHandler(void)
+void USART3_IRQHandler(void)
 {
-  /* USER CODE BEGIN DMA1_Channel2_IRQn 0 */
-
-  /* USER CODE END DMA1_Channel2_IRQn 0 */
-  HAL_DMA_IRQHandler(&hdma_usart3_tx);
-  /* USER CODE BEGIN DMA1_Channel2_IRQn 1 */
-
-  /* USER CODE END DMA1_Channel2_IRQn 1 */
+  USART_IRQ(&huart3, &usart3RxPend);
 }
+#endif
 
-/**
-  * @brief This function handles DMA1 channel3 global interrupt.
-  */
-void DMA1_Channel3_IRQHandler(void)
-{
-  /* USER CODE BEGIN DMA1_Channel3_IRQn 0 */
-
-  /* USER CODE END DMA1_Channel3_IRQn 0 */
-  HAL_DMA_IRQHandler(&hdma_usart3_rx);
-  /* USER CODE BEGIN DMA1_Channel3_IRQn 1 */
-
-  /* USER CODE END DMA1_Channel3_IRQn 1 */
+#if defined(SERIAL_RX_DMA_IRQ)
+/*
+ * Half transfer and transfer complete of a circular Rx DMA channel: half the buffer was filled since the last one.
+ * Processed like an IDLE line, so a stream without pauses is parsed every half buffer. half counts the interrupts,
+ * the rx check compares it with the half buffers its read position went through (see usart_rx_lap in util.c)
+ */
+static inline void USART_RX_DMA_IRQ(DMA_HandleTypeDef *hdma, volatile uint8_t *half, volatile uint8_t *rxPend) {
+  __HAL_DMA_CLEAR_FLAG(hdma, __HAL_DMA_GET_GI_FLAG_INDEX(hdma));
+  (*half)++;
+  *rxPend   = 1;
+  SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
 }
-#endif
 
-#if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
+#if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
 /**
-  * @brief This function handles USART2 global interrupt.
+  * @brief This function handles DMA1 channel6 global interrupt, USART2 Rx.
   */
-void USART2_IRQHandler(void)
+void DMA1_Channel6_IRQHandler(void)
 {
-  /* USER CODE BEGIN USART2_IRQn 0 */
-
-  /* USER CODE END USART2_IRQn 0 */
-  HAL_UART_IRQHandler(&huart2);
-  /* USER CODE BEGIN USART2_IRQn 1 */
-  if(RESET != __HAL_UART_GET_IT_SOURCE(&huart2, UART_IT_IDLE)) {  // Check for IDLE line interrupt
-      __HAL_UART_CLEAR_IDLEFLAG(&huart2);                         // Clear IDLE line flag (otherwise it will continue to enter interrupt)
-      usart2_rx_check();                                          // Check for data to process
-  }
-  /* USER CODE END USART2_IRQn 1 */
+  USART_RX_DMA_IRQ(&hdma_usart2_rx, &rxDmaHalf_L, &usart2RxPend);
 }
 #endif
 
-#if defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(FEEDBACK_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
+#if defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
 /**
-  * @brief This function handles USART3 global interrupt.
+  * @brief This function handles DMA1 channel3 global interrupt, USART3 Rx.
   */
-void USART3_IRQHandler(void)
+void DMA1_Channel3_IRQHandler(void)
 {
-  /* USER CODE BEGIN USART2_IRQn 0 */
-
-  /* USER CODE END USART2_IRQn 0 */
-  HAL_UART_IRQHandler(&huart3);
-  /* USER CODE BEGIN USART2_IRQn 1 */
-  if(RESET != __HAL_UART_GET_IT_SOURCE(&huart3, UART_IT_IDLE)) {  // Check for IDLE line interrupt  
-      __HAL_UART_CLEAR_IDLEFLAG(&huart3);                         // Clear IDLE line flag (otherwise it will continue to enter interrupt)
-      usart3_rx_check();                                          // Check for data to process
-  }
-  /* USER CODE END USART2_IRQn 1 */
+  USART_RX_DMA_IRQ(&hdma_usart3_rx, &rxDmaHalf_R, &usart3RxPend);
 }
 #endif
+#endif
 
 /******************************************************************************/
 /* STM32F1xx Peripheral Interrupt Handlers                                    */
@@ -110,8 +110,12 @@
 /*!< Uncomment the following line if you need to relocate your vector Table in
      Internal SRAM. */
 /* #define VECT_TAB_SRAM */
+#if defined(BOOTLOADER)
+#define VECT_TAB_OFFSET 0x00002800U /*!< Application behind the UART bootloader, BOOT_APP_ADDR in boot.h */
+#else
 #define VECT_TAB_OFFSET 0x00000000U /*!< Vector Table base offset field. \
                                  This value must be a multiple of 0x200. */
+#endif
 
 
 /**
@@ -173,6 +177,12 @@ static void SystemInit_ExtMemCtl(void);
   * @retval None
   */
 void SystemInit(void) {
+#if defined(__ARM_FP)
+  /* Cortex-M4F build (make MCU_TYPE=AT32F403): full access to CP10 / CP11 (CPACR) before the first FPU instruction */
+  *(__IO uint32_t *)0xE000ED88U |= (0xFU << 20);
+  __DSB();
+  __ISB();
+#endif
   /* Reset the RCC clock configuration to the default reset state(for debug purpose) */
   /* Set HSION bit */
   RCC->CR |= 0x00000001U;
@@ -0,0 +1,92 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "timebase.h"
+
+volatile uint32_t timeEpoch;
+
+/*
+ * TIM3 runs at 1 MHz and sends its update event as trigger output, TIM4 counts these events in external clock
+ * mode 1 (trigger ITR2 = TIM3). No counting in software: the only interrupt is the TIM4 overflow every 71 minutes
+ */
+void timeInit(void) {
+  __HAL_RCC_TIM3_CLK_ENABLE();
+  __HAL_RCC_TIM4_CLK_ENABLE();
+
+  TIME_TIM_LO->CR1  = TIM_CR1_URS;
+  TIME_TIM_LO->PSC  = SystemCoreClock / 1000000U - 1;   // APB1 timer clock = SystemCoreClock
+  TIME_TIM_LO->ARR  = 0xFFFF;
+  TIME_TIM_LO->EGR  = TIM_EGR_UG;                       // load PSC, before the update becomes the trigger output
+  TIME_TIM_LO->CNT  = 0;
+  TIME_TIM_LO->CR2  = TIM_TRGO_UPDATE;
+
+  TIME_TIM_HI->CR1  = TIM_CR1_URS;                      // update interrupt on overflow only, not on UG
+  TIME_TIM_HI->PSC  = 0;
+  TIME_TIM_HI->ARR  = 0xFFFF;
+  TIME_TIM_HI->EGR  = TIM_EGR_UG;
+  TIME_TIM_HI->CNT  = 0;
+  TIME_TIM_HI->SR   = 0;
+  TIME_TIM_HI->SMCR = TIM_TS_ITR2 | TIM_SLAVEMODE_EXTERNAL1;
+  TIME_TIM_HI->DIER = TIM_DIER_UIE;
+  TIME_TIM_HI->CR1 |= TIM_CR1_CEN;
+  TIME_TIM_LO->CR1 |= TIM_CR1_CEN;
+
+  HAL_NVIC_SetPriority(TIME_TIM_HI_IRQn, IRQ_PRIO_SYSTICK, 0);
+  HAL_NVIC_EnableIRQ(TIME_TIM_HI_IRQn);
+}
+
+/*
+ * The high half is read before and after the low half. TIM4 follows the TIM3 overflow within a few timer clocks,
+ * before the second read, so a changed high half means the low half may belong to either: read again
+ */
+RAMFUNC uint32_t timeUs(void) {
+  uint16_t hi, lo;
+  do {
+    hi = (uint16_t)TIME_TIM_HI->CNT;
+    lo = (uint16_t)TIME_TIM_LO->CNT;
+  } while (hi != (uint16_t)TIME_TIM_HI->CNT);
+  return ((uint32_t)hi << 16) | lo;
+}
+
+/*
+ * 64 bit time: the epoch counted by the TIM4 interrupt in front of timeUs. An overflow whose interrupt has not run yet
+ * (pending, or the caller has a higher priority) shows as UIF with a small time and counts here
+ */
+uint64_t timeUs64(void) {
+  uint32_t epoch, us, wrap;
+  do {
+    epoch = timeEpoch;
+    us    = timeUs();
+    wrap  = (TIME_TIM_HI->SR & TIM_SR_UIF) && us < 0x80000000U;
+  } while (epoch != timeEpoch);
+  return ((uint64_t)(epoch + wrap) << 32) | us;
+}
+
+/* Milliseconds since timeInit, wraps after 49 days like HAL_GetTick */
+uint32_t timeMs(void) {
+  return (uint32_t)(timeUs64() / 1000U);
+}
+
+/* TIM4 overflow interrupt */
+void timeEpochIrq(void) {
+  if (TIME_TIM_HI->SR & TIM_SR_UIF) {
+    TIME_TIM_HI->SR = ~TIM_SR_UIF;
+    timeEpoch++;
+  }
+}
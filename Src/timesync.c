@@ -0,0 +1,86 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Clock synchronisation (TIME_SYNC). Only uses config.h, so it also builds on the host.
+//
+// A reference is a pair of board time (timeUs) and controller time taken at the same instant, the start bit of a
+// command frame. The board runs on the HSI by default, up to 1 % off and changing with temperature, so a fixed
+// offset drifts by 10 ms per second. The estimate is a second order loop: each reference is compared with the
+// prediction of the last one, the phase takes 1/2^TS_KP of that error and the drift 1/2^TS_KI of the rate error.
+// The loop settles within about 30 references (1.5 s at TIME_SYNC_PERIOD 50 ms) and averages the jitter of the
+// reference timing. Boards on one bus take the same frames with the same loop, their errors mostly cancel out.
+// A reference further off than TIME_SYNC_STEP (controller restarted, long gap) restarts the phase, the drift is kept.
+
+#include <stdint.h>
+#include "config.h"
+#include "timesync.h"
+
+#if defined(TIME_SYNC)
+
+#define TS_KP                   2                         // [-] phase gain 1/4
+#define TS_KI                   4                         // [-] drift gain 1/16
+#define TS_DRIFT_MAX            ((1L << 20) * 3 / 100)    // [2^-20] 3 %, beyond the HSI tolerance
+
+/* Controller time at the board time local, extrapolated from the last reference */
+static uint32_t tsPredict(const TimeSync *s, uint32_t local) {
+  int32_t dt = (int32_t)(local - s->local);
+  return s->host + (uint32_t)dt + (uint32_t)(int32_t)(((int64_t)dt * s->drift) >> 20);
+}
+
+/* Reference: the controller time host at the board time local. References closer than TIME_SYNC_PERIOD are skipped */
+void timeSyncRef(TimeSync *s, uint32_t local, uint32_t host) {
+  int32_t  dt = (int32_t)(local - s->local);
+  uint32_t pred;
+  int32_t  err;
+
+  if (!s->valid) {
+    s->local = local;
+    s->host  = host;
+    s->drift = 0;
+    s->err   = 0;
+    s->valid = 1;
+    return;
+  }
+  if (dt < TIME_SYNC_PERIOD * 1000L) {
+    return;
+  }
+  pred   = tsPredict(s, local);
+  err    = (int32_t)(host - pred);
+  s->err = err;
+  if (err > TIME_SYNC_STEP || err < -TIME_SYNC_STEP) {
+    s->local = local;
+    s->host  = host;
+    s->steps++;
+    return;
+  }
+  s->drift += (int32_t)(((int64_t)err << 20) / dt) >> TS_KI;
+  s->drift  = (s->drift > TS_DRIFT_MAX) ? TS_DRIFT_MAX : (s->drift < -TS_DRIFT_MAX ? -TS_DRIFT_MAX : s->drift);
+  s->host   = pred + (uint32_t)(err >> TS_KP);
+  s->local  = local;
+}
+
+/* Board time local in the controller clock, 0 before the first reference. 0 is kept for that, 1 us later instead */
+uint32_t timeSyncHost(const TimeSync *s, uint32_t local) {
+  uint32_t t;
+  if (!s->valid) {
+    return 0;
+  }
+  t = tsPredict(s, local);
+  return t ? t : 1;
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// SWO trace (TRACE_ITM). The TPIU sends the ITM packets as NRZ (UART framing) at TRACE_SWO_BAUD on PB3, the
+// TRACESWO function of the JTDO pin, which the ST-LINK of the SWD header samples. The ITM adds a local timestamp
+// to every event, so the enter / exit and start / end pairs give a timeline of the interrupts and the main loop.
+// Only the ports of trace.h are enabled. The debugger may take over the configuration, its settings then apply.
+
+#include "stm32f1xx_hal.h"
+#include "config.h"
+#include "trace.h"
+
+#if defined(TRACE_ITM)
+
+#define ITM_UNLOCK              0xC5ACCE55U     // [-] ITM lock access key
+#define TPI_PIN_NRZ             2U              // [-] TPI->SPPR: asynchronous SWO, NRZ encoding
+#define TPI_FFCR_TRIGIN         0x100U          // [-] TPI->FFCR: formatter off, trigger in
+
+uint32_t traceDrop;
+
+void traceInit(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;       // trace clock, also the DWT cycle counter
+  DBGMCU->CR       |= DBGMCU_CR_TRACE_IOEN;             // TRACE_MODE 00: asynchronous, TRACESWO on PB3 only
+
+  TPI->SPPR = TPI_PIN_NRZ;
+  TPI->ACPR = SystemCoreClock / TRACE_SWO_BAUD - 1U;
+  TPI->FFCR = TPI_FFCR_TRIGIN;
+
+  ITM->LAR  = ITM_UNLOCK;
+  ITM->TCR  = 0;                                        // off while the ports are set up
+  ITM->TPR  = 0;                                        // all ports writable unprivileged
+  ITM->TER  = (1U << TRACE_PORT_TEXT) | (1U << TRACE_PORT_ISR) | (1U << TRACE_PORT_TASK);
+  DWT->CTRL |= 1U << DWT_CTRL_SYNCTAP_Pos;              // sync packets every 2^24 cycles
+  ITM->TCR  = (1U << ITM_TCR_TraceBusID_Pos) | ITM_TCR_SYNCENA_Msk | ITM_TCR_TSENA_Msk | ITM_TCR_ITMENA_Msk;
+}
+
+/* Debug text to port 0. Waits for the FIFO, one byte takes 5 us at 2 Mbit/s: only the main loop and PendSV print */
+void traceWrite(const uint8_t *data, int len) {
+  if (!(ITM->TCR & ITM_TCR_ITMENA_Msk)) {
+    return;                             // before traceInit
+  }
+  while (len-- > 0) {
+    while (ITM->PORT[TRACE_PORT_TEXT].u32 == 0) {
+    }
+    ITM->PORT[TRACE_PORT_TEXT].u8 = *data++;
+  }
+}
+
+#endif
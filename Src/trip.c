@@ -0,0 +1,114 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Trip statistics (TRIP_STATS). Only uses config.h, so it also builds on the host.
+//
+// The totals are counted in RAM from the signals the monitor task has anyway: the hall steps of both wheels, the
+// battery voltage and current, the board temperature and the motor error codes. Each total keeps the rest below its
+// unit, so nothing is lost to rounding at the 5 ms steps. Writing the flash stalls the CPU for the page erase, the
+// totals are therefore saved only at standstill, at most every TRIP_SAVE_PERIOD, and at poweroff. A power loss
+// while driving loses at most the distance since the last stop.
+
+#include <stdint.h>
+#include "config.h"
+#include "trip.h"
+
+#if defined(TRIP_STATS)
+
+#define TRIP_MWH            36000000L                             // [V*100*A*100*ms] 1 mWh
+
+/* Start from the totals of the flash log, saved NULL if the log is empty */
+void tripInit(Trip *t, const TripStats *saved) {
+  if (saved) {
+    t->tot = *saved;
+  } else {
+    t->tot.odoM     = 0;
+    t->tot.usedMWh  = 0;
+    t->tot.regenMWh = 0;
+    t->tot.onTime   = 0;
+    t->tot.errTime  = 0;
+    t->tot.maxTemp  = INT16_MIN;
+    t->tot.maxCurr  = 0;
+  }
+  t->odoRest   = 0;
+  t->usedRest  = 0;
+  t->regenRest = 0;
+  t->onRest    = 0;
+  t->errRest   = 0;
+  t->saveTime  = t->tot.onTime;
+  t->dirty     = 0;
+}
+
+/* One update every dt ms. steps is the sum of the hall steps of both wheels since the last update, stepsPerTurn the
+ * hall steps of one wheel turn, vBat [V*100], iBat [A*100] positive = discharge, temp [°C*10], err any z_errCode set */
+void tripStep(Trip *t, uint16_t steps, uint16_t stepsPerTurn, int16_t vBat, int16_t iBat, int16_t temp, uint8_t err, uint16_t dt) {
+  uint32_t meter = (uint32_t)stepsPerTurn * 2 * 1000;       // [hall steps*mm] 1 m of the mean of both wheels
+  int16_t  iAbs  = (iBat < 0) ? -iBat : iBat;
+
+  if (steps) {
+    t->odoRest   += (uint32_t)steps * TRIP_WHEEL_MM;
+    t->tot.odoM  += t->odoRest / meter;
+    t->odoRest   %= meter;
+    t->dirty      = 1;
+  }
+
+  // Energy, the product of one step stays far below 2^31
+  if (iBat < 0) {
+    t->regenRest    += (int32_t)vBat * -iBat * dt;
+    t->tot.regenMWh += (uint32_t)(t->regenRest / TRIP_MWH);
+    t->regenRest    %= TRIP_MWH;
+  } else {
+    t->usedRest     += (int32_t)vBat * iBat * dt;
+    t->tot.usedMWh  += (uint32_t)(t->usedRest / TRIP_MWH);
+    t->usedRest     %= TRIP_MWH;
+  }
+
+  t->onRest += dt;
+  if (t->onRest >= 1000) {
+    t->onRest -= 1000;
+    t->tot.onTime++;
+  }
+  if (err) {
+    t->errRest += dt;
+    if (t->errRest >= 1000) {
+      t->errRest -= 1000;
+      t->tot.errTime++;
+      t->dirty = 1;
+    }
+  }
+
+  if (temp > t->tot.maxTemp) {
+    t->tot.maxTemp = temp;
+    t->dirty       = 1;
+  }
+  if (iAbs > t->tot.maxCurr) {
+    t->tot.maxCurr = iAbs;
+    t->dirty       = 1;
+  }
+}
+
+/* 1 if the totals should be saved now, then they count as saved. standstill: the wheels stand and no motor runs */
+uint8_t tripSaveDue(Trip *t, uint8_t standstill) {
+  if (!standstill || !t->dirty || t->tot.onTime - t->saveTime < TRIP_SAVE_PERIOD) {
+    return 0;
+  }
+  t->saveTime = t->tot.onTime;
+  t->dirty    = 0;
+  return 1;
+}
+
+#endif
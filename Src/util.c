@@ -20,10 +20,12 @@
 // Includes
 #include <stdio.h>
 #include <stdlib.h> // for abs()
+#include <stddef.h> // for offsetof()
 #include <string.h>
 #include "stm32f1xx_hal.h"
 #include "defines.h"
 #include "setup.h"
+#include "timebase.h"
 #include "config.h"
 #include "eeprom.h"
 #include "util.h"
@@ -35,10 +37,15 @@
 #include "control.h"
 #include "main.h"
 #include "bldc.h"
+#include "boot.h"
 
 #if defined(DEBUG_I2C_LCD) || defined(SUPPORT_LCD)
 #include "hd44780.h"
+#include "lcd.h"
 #endif
+#include "print.h"
+#include "ring.h"
+#include "cobs.h"
 
 /* =========================== Variable Definitions =========================== */
 
@@ -79,9 +86,26 @@ InputStruct input2[INPUTS_NR] = { {0, 0, 0, PRI_INPUT2} };
 
 int16_t  speedAvg;                      // average measured speed
 int16_t  speedAvgAbs;                   // average measured speed in absolute
+#if defined(HALL_SPEED_EST)
+int16_t  hallSpeed[2];                  // [rpm] hall edge timing speed estimate, left and right, same sign as n_mot
+#endif
 uint8_t  timeoutFlgADC    = 0;          // Timeout Flag for ADC Protection:    0 = OK, 1 = Problem detected (line disconnected or wrong ADC data)
 uint8_t  timeoutFlgSerial = 0;          // Timeout Flag for Rx Serial command: 0 = OK, 1 = Problem detected (line disconnected or wrong Rx data)
 
+#if defined(FAULTLOG_ENABLE)
+uint8_t  errLatch_L;                    // z_errCode bits seen since power-on, stored in the fault log
+uint8_t  errLatch_R;
+#endif
+
+// Board configuration, see BoardCfg. boardCfgFlags is the BOARD_CFG parameter, Board_Cfg_Init derives boardCfg from it
+BoardCfg boardCfg      = {BCFG_DEFAULT, (BCFG_DEFAULT & BCFG_INV_L) ? -1 : 1, (BCFG_DEFAULT & BCFG_INV_R) ? 1 : -1};
+uint8_t  boardCfgFlags = BCFG_DEFAULT;
+
+int16_t  INPUT_MAX;                     // [-] Input target maximum limitation, used by mixerFcn
+int16_t  INPUT_MIN;                     // [-] Input target minimum limitation, used by mixerFcn
+#if defined(INPUT_CURVE)
+int16_t  inputCurve[INPUT_CURVE_N] = {INPUT_CURVE_1, INPUT_CURVE_2, INPUT_CURVE_3, INPUT_CURVE_4, INPUT_CURVE_5};   // IN_CRVx parameters
+#endif
 uint8_t  ctrlModReqRaw = CTRL_MOD_REQ;
 uint8_t  ctrlModReq    = CTRL_MOD_REQ;  // Final control mode request 
 
@@ -90,13 +114,27 @@ LCD_PCF8574_HandleTypeDef lcd;
 #endif
 
 #ifdef VARIANT_TRANSPOTTER
-float    setDistance;
+uint16_t setDistance;                   // [mm] follow distance
 uint16_t VirtAddVarTab[NB_OF_VAR] = {1337};       // Virtual address defined by the user: 0xFFFF value is prohibited
 static   uint16_t saveValue       = 0;
 static   uint8_t  saveValue_valid = 0;
 #elif !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
 uint16_t VirtAddVarTab[NB_OF_VAR] = {1000, 1001, 1002, 1003, 1004, 1005, 1006, 1007, 1008, 1009,
-                                     1010, 1011, 1012, 1013, 1014, 1015, 1016, 1017, 1018};
+                                     1010, 1011, 1012, 1013, 1014, 1015, 1016, 1017, 1018, 1019,
+                                     1020, 1021, 1022, 1023, 1024, 1025, 1026, 1027, 1028, 1029,
+                                     1030, 1031, 1032, 1033, 1034, 1035, 1036, 1037, 1038, 1039,
+                                     1040, 1041, 1042, 1043, 1044, 1045, 1046, 1047, 1048, 1049,
+                                     1050, 1051, 1052, 1053, 1054, 1055, 1056, 1057, 1058, 1059,
+                                     1060, 1061, 1062, 1063, 1064, 1065, 1066, 1067, 1068, 1069,
+                                     1070, 1071, 1072, 1073, 1074, 1075, 1076, 1077, 1078, 1079,
+                                     1080, 1081, 1082, 1083, 1084, 1085, 1086, 1087, 1088, 1089,
+                                     1090, 1091, 1092, 1093, 1094, 1095, 1096, 1097, 1098, 1099,
+                                     1100, 1101, 1102, 1103, 1104, 1105, 1106, 1107, 1108, 1109,
+                                     1110, 1111, 1112, 1113, 1114, 1115, 1116, 1117, 1118, 1119,
+                                     1120, 1121, 1122, 1123, 1124, 1125, 1126, 1127, 1128, 1129,
+                                     1130, 1131, 1132, 1133, 1134, 1135, 1136, 1137, 1138, 1139,
+                                     1140, 1141, 1142, 1143, 1144, 1145, 1146, 1147, 1148, 1149,
+                                     1150, 1151, 1152, 1153, 1154, 1155, 1156, 1157, 1158, 1159};   // 1000 + index, host/eeprom_image.c writes the same
 #else
 uint16_t VirtAddVarTab[NB_OF_VAR] = {1000};       // Dummy virtual address to avoid warnings
 #endif
@@ -105,8 +143,6 @@ uint16_t VirtAddVarTab[NB_OF_VAR] = {1000};       // Dummy virtual address to av
 //------------------------------------------------------------------------
 // Local variables
 //------------------------------------------------------------------------
-static int16_t INPUT_MAX;             // [-] Input target maximum limitation
-static int16_t INPUT_MIN;             // [-] Input target minimum limitation
 
 
 #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
@@ -121,6 +157,10 @@ static uint16_t timeoutCntADC = ADC_PROTECT_TIMEOUT;  // Timeout counter for ADC
 #if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
 static uint8_t  rx_buffer_L[SERIAL_BUFFER_SIZE];      // USART Rx DMA circular buffer
 static uint32_t rx_buffer_L_len = ARRAY_LEN(rx_buffer_L);
+#if defined(SERIAL_RX_DMA_IRQ)
+volatile uint8_t rxDmaHalf_L;                         // Half transfer and transfer complete interrupts of the Rx DMA
+uint32_t rxOverflow_L;                                // Rx DMA laps: a whole buffer went by before it was processed
+#endif
 #endif
 #if defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
 static uint16_t timeoutCntSerial_L = SERIAL_TIMEOUT;  // Timeout counter for Rx Serial command
@@ -128,13 +168,18 @@ static uint8_t  timeoutFlgSerial_L = 0;               // Timeout Flag for Rx Ser
 #endif
 #if defined(SIDEBOARD_SERIAL_USART2)
 SerialSideboard Sideboard_L;
-SerialSideboard Sideboard_L_raw;
+ProtoSideboard  Sideboard_L_raw;                     // scratch for wrapped frames, v2 is the longer one
 static uint32_t Sideboard_L_len = sizeof(Sideboard_L);
+static uint32_t Sideboard_L_len2 = sizeof(ProtoSideboard);
 #endif
 
 #if defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
 static uint8_t  rx_buffer_R[SERIAL_BUFFER_SIZE];      // USART Rx DMA circular buffer
 static uint32_t rx_buffer_R_len = ARRAY_LEN(rx_buffer_R);
+#if defined(SERIAL_RX_DMA_IRQ)
+volatile uint8_t rxDmaHalf_R;                         // Half transfer and transfer complete interrupts of the Rx DMA
+uint32_t rxOverflow_R;                                // Rx DMA laps: a whole buffer went by before it was processed
+#endif
 #endif
 #if defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
 static uint16_t timeoutCntSerial_R = SERIAL_TIMEOUT;  // Timeout counter for Rx Serial command
@@ -142,26 +187,171 @@ static uint8_t  timeoutFlgSerial_R = 0;               // Timeout Flag for Rx Ser
 #endif
 #if defined(SIDEBOARD_SERIAL_USART3)
 SerialSideboard Sideboard_R;
-SerialSideboard Sideboard_R_raw;
+ProtoSideboard  Sideboard_R_raw;                     // scratch for wrapped frames, v2 is the longer one
 static uint32_t Sideboard_R_len = sizeof(Sideboard_R);
+static uint32_t Sideboard_R_len2 = sizeof(ProtoSideboard);
+#endif
+
+#if defined(SERIAL_HW_CRC)
+uint8_t serialHwCrc_L = 0;                            // Last valid command on USART2 used the hardware CRC frame: 0 = no, 1 = yes
+uint8_t serialHwCrc_R = 0;                            // Last valid command on USART3 used the hardware CRC frame: 0 = no, 1 = yes
+#endif
+#if defined(FEEDBACK_COMPACT)
+uint8_t serialFbCompact_L = 0;                        // Last valid command on USART2 had PROTO_CMD_FB_COMPACT: 0 = full feedback, 1 = compact
+uint8_t serialFbCompact_R = 0;                        // Same for USART3
+#endif
+#if defined(TRIP_STATS) && !defined(SERIAL_BUS) && (defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3))
+uint8_t serialTripReq_L = 0;                          // A command on USART2 had PROTO_CMD_TRIP: the next feedback frame is a ProtoTrip frame
+uint8_t serialTripReq_R = 0;                          // Same for USART3
+#endif
+
+#if (defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)) && !defined(CONTROL_IBUS)
+uint16_t serialSeq_L = 0;                             // seq of the last valid command on USART2, echoed in the feedback
+uint16_t serialSeq_R = 0;                             // seq of the last valid command on USART3, echoed in the feedback
+uint32_t serialSeqTick_L = 0;                         // [ms] HAL tick when it was received
+uint32_t serialSeqTick_R = 0;                         // [ms] HAL tick when it was received
+SerialLatency serialLat_L;                            // USART2 command latency, see serialLatUpdate()
+SerialLatency serialLat_R;                            // USART3 command latency
+static SerialCommand commandL_hold;                   // PROTO_CMD_HOLD target waiting for the latch frame
+static SerialCommand commandR_hold;
+static uint8_t commandL_held = 0;
+static uint8_t commandR_held = 0;
+#endif
+#if defined(SERIAL_EXT_CMD)
+static BldcExtCmd commandL_holdExt;                   // extra fields of the held PROTO_START_FRAME_EXT frame
+static BldcExtCmd commandR_holdExt;
+static volatile uint8_t extWheel = 0;                 // inIdx + 1 of the input whose last frame had PROTO_EXT_WHEEL, 0 = none
+#endif
+#if defined(TIME_SYNC)
+TimeSync timeSync;                                    // controller clock, from the syncTime of the command frames
+#endif
+#if defined(POS_CTRL)
+static volatile uint8_t posCmd = 0;                   // inIdx + 1 of the input whose last frame was PROTO_CMD_POS, 0 = none
+#endif
+
+#if defined(SERIAL_COBS)
+#define COMMAND_COBS_MAX          COBS_ENC_MAX(sizeof(ProtoCommandExt) - 3)   // [bytes] longest COBS command frame
 #endif
 
 #if defined(CONTROL_SERIAL_USART2)
 static SerialCommand commandL;
+  #ifdef SERIAL_BUS
+static ProtoBusCommand commandL_raw;                 // scratch for wrapped frames, the bus frame is the longer one
+static uint32_t commandL_len = sizeof(ProtoBusCommand);
+  #elif defined(SERIAL_EXT_CMD)
+static ProtoCommandExt commandL_raw;                 // scratch for wrapped frames, the extended frame is the longer one
+static uint32_t commandL_len = sizeof(commandL);
+  #else
 static SerialCommand commandL_raw;
 static uint32_t commandL_len = sizeof(commandL);
+  #endif
+  #ifdef SERIAL_COBS
+static uint8_t commandL_cobs[COMMAND_COBS_MAX];      // encoded frame, copied out of the Rx buffer and decoded in place
+  #endif
   #ifdef CONTROL_IBUS
-  static uint16_t ibusL_captured_value[IBUS_NUM_CHANNELS];
+  uint16_t ibusCh_L[IBUS_NUM_CHANNELS] = {500, 500, 500, 500}; // [0-1000] iBUS channels of the last valid frame
   #endif
 #endif
 
 #if defined(CONTROL_SERIAL_USART3)
 static SerialCommand commandR;
+  #ifdef SERIAL_BUS
+static ProtoBusCommand commandR_raw;                 // scratch for wrapped frames, the bus frame is the longer one
+static uint32_t commandR_len = sizeof(ProtoBusCommand);
+  #elif defined(SERIAL_EXT_CMD)
+static ProtoCommandExt commandR_raw;                 // scratch for wrapped frames, the extended frame is the longer one
+static uint32_t commandR_len = sizeof(commandR);
+  #else
 static SerialCommand commandR_raw;
 static uint32_t commandR_len = sizeof(commandR);
+  #endif
+  #ifdef SERIAL_COBS
+static uint8_t commandR_cobs[COMMAND_COBS_MAX];      // encoded frame, copied out of the Rx buffer and decoded in place
+  #endif
   #ifdef CONTROL_IBUS
-  static uint16_t ibusR_captured_value[IBUS_NUM_CHANNELS];
+  uint16_t ibusCh_R[IBUS_NUM_CHANNELS] = {500, 500, 500, 500};
+  #endif
+#endif
+
+#if defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
+  #if defined(CONTROL_IBUS)
+    #define COMMAND_START_FRAME     (IBUS_LENGTH | (IBUS_COMMAND << 8))   // iBUS header: length byte followed by command byte
+    #define COMMAND_START_FRAME_ALT COMMAND_START_FRAME
+  #elif defined(SERIAL_BUS)
+    #define COMMAND_START_FRAME     PROTO_START_FRAME_BUS
+    #define COMMAND_START_FRAME_ALT PROTO_START_FRAME_BUS
+  #elif defined(SERIAL_HW_CRC)
+    #define COMMAND_START_FRAME     SERIAL_START_FRAME
+    #define COMMAND_START_FRAME_ALT SERIAL_START_FRAME_HWCRC
+  #elif defined(SERIAL_EXT_CMD)
+    #define COMMAND_START_FRAME     SERIAL_START_FRAME
+    #define COMMAND_START_FRAME_ALT PROTO_START_FRAME_EXT
+  #else
+    #define COMMAND_START_FRAME     SERIAL_START_FRAME
+    #define COMMAND_START_FRAME_ALT SERIAL_START_FRAME
+  #endif
+  #if defined(SERIAL_BUS)
+    #define COMMAND_LEN             sizeof(ProtoBusCommand)
+  #else
+    #define COMMAND_LEN             sizeof(SerialCommand)
   #endif
+  #if defined(SERIAL_EXT_CMD)
+    #define COMMAND_LEN_ALT         sizeof(ProtoCommandExt)
+  #else
+    #define COMMAND_LEN_ALT         COMMAND_LEN
+  #endif
+  #define COMMAND_FRAME_LEN(f)      (RX_RD16(f, 0) == COMMAND_START_FRAME_ALT ? COMMAND_LEN_ALT : COMMAND_LEN)
+  #if defined(SERIAL_COBS)
+    #define COMMAND_WIRE_LEN(f)     (COMMAND_FRAME_LEN(f) - 1)          // type and CRC-16, code byte and delimiter of the COBS frame
+  #else
+    #define COMMAND_WIRE_LEN(f)     COMMAND_FRAME_LEN(f)
+  #endif
+  #define RX_RD16(p, i)             ((uint16_t)((p)[i] | ((p)[(i) + 1] << 8)))  // Read a little-endian 16-bit field from an unaligned frame
+  #if SERIAL_START_FRAME != PROTO_START_FRAME || SERIAL_START_FRAME_HWCRC != PROTO_START_FRAME_HWCRC
+    #error SERIAL_START_FRAME and SERIAL_START_FRAME_HWCRC must match protocol.h
+  #endif
+  #if defined(SERIAL_BUS) && (BUS_ID < 0 || BUS_ID >= PROTO_BUS_MAX)
+    #error BUS_ID must be in [0, PROTO_BUS_MAX-1].
+  #endif
+#endif
+
+// All start frames share the ports in some configuration, and the receivers resync on their first byte (the COBS frame
+// type is that byte as well): a duplicate bit in the sum below is a duplicate start frame
+#define START_FRAME_BIT(f)  (1ULL << ((f) & 0x3F))
+#define START_FRAME_BITS(op) (START_FRAME_BIT(PROTO_START_FRAME) op START_FRAME_BIT(PROTO_START_FRAME_HWCRC) op \
+  START_FRAME_BIT(PROTO_START_FRAME_COMPACT) op START_FRAME_BIT(PROTO_START_FRAME_COMPACT_HWCRC) op \
+  START_FRAME_BIT(PROTO_START_FRAME_TRIP) op START_FRAME_BIT(PROTO_START_FRAME_BUS) op START_FRAME_BIT(PROTO_START_FRAME_EXT) op \
+  START_FRAME_BIT(PROTO_SB_START_FRAME) op START_FRAME_BIT(DEBUG_STREAM_START_FRAME) op START_FRAME_BIT(DEBUG_BIN_START_FRAME))
+#if START_FRAME_BITS(+) != START_FRAME_BITS(|)
+  #error The start frames of protocol.h and the DEBUG_*_START_FRAME of config.h must differ in the low 6 bits of their first byte.
+#endif
+#if defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
+SerialRx rxFrame_L = {rx_buffer_L, ARRAY_LEN(rx_buffer_L)};
+#endif
+#if defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
+SerialRx rxFrame_R = {rx_buffer_R, ARRAY_LEN(rx_buffer_R)};
+#endif
+#if defined(SERIAL_TIMEOUT_ADAPTIVE) && defined(CONTROL_SERIAL_USART2)
+SerialSup serialSup_L = {CONTROL_SERIAL_USART2, 0, 0, SERIAL_TIMEOUT, 256};
+#elif defined(SERIAL_TIMEOUT_ADAPTIVE) && defined(SIDEBOARD_SERIAL_USART2)
+SerialSup serialSup_L = {SIDEBOARD_SERIAL_USART2, 0, 0, SERIAL_TIMEOUT, 256};
+#endif
+#if defined(SERIAL_TIMEOUT_ADAPTIVE) && defined(CONTROL_SERIAL_USART3)
+SerialSup serialSup_R = {CONTROL_SERIAL_USART3, 0, 0, SERIAL_TIMEOUT, 256};
+#elif defined(SERIAL_TIMEOUT_ADAPTIVE) && defined(SIDEBOARD_SERIAL_USART3)
+SerialSup serialSup_R = {SIDEBOARD_SERIAL_USART3, 0, 0, SERIAL_TIMEOUT, 256};
+#endif
+#if defined(FEEDBACK_SERIAL_USART2) && !defined(SERIAL_BUS)
+SerialTx fbTx_L = {&huart2, USART2_IRQn};
+#endif
+#if defined(FEEDBACK_SERIAL_USART3) && !defined(SERIAL_BUS)
+SerialTx fbTx_R = {&huart3, USART3_IRQn};
+#endif
+#if defined(SERIAL_BAUD_NEGOTIATION) && defined(CONTROL_SERIAL_USART2)
+SerialBaud serialBaud_L = {&huart2, &rxFrame_L, USART2_BAUD, USART2_BAUD};
+#endif
+#if defined(SERIAL_BAUD_NEGOTIATION) && defined(CONTROL_SERIAL_USART3)
+SerialBaud serialBaud_R = {&huart3, &rxFrame_R, USART3_BAUD, USART3_BAUD};
 #endif
 
 #if defined(SUPPORT_BUTTONS) || defined(SUPPORT_BUTTONS_LEFT) || defined(SUPPORT_BUTTONS_RIGHT)
@@ -173,35 +363,78 @@ static uint8_t button2;                 // Green
 static uint8_t brakePressed;
 #endif
 
-#if defined(CRUISE_CONTROL_SUPPORT) || (defined(STANDSTILL_HOLD_ENABLE) && (CTRL_TYP_SEL == FOC_CTRL) && (CTRL_MOD_REQ != SPD_MODE))
+#if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
 static uint8_t cruiseCtrlAcv = 0;
 static uint8_t standstillAcv = 0;
 #endif
 
-/* =========================== Retargeting printf =========================== */
-/* retarget the C library printf function to the USART */
+/* =========================== Debug TX queue =========================== */
+/* Output of debugPrintf (print.c), which replaces the C library printf.
+ * Characters are queued in a ring buffer and sent by the UART TX DMA. When a transfer completes,
+ * HAL_UART_TxCpltCallback (USART IRQ) chains the next contiguous chunk. printf is called both from the
+ * main loop and from PendSV (debug protocol answers), so both mask only the debug USART IRQ while they
+ * fill the queue. The control interrupt is never blocked. */
 #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
-  #ifdef __GNUC__
-    #define PUTCHAR_PROTOTYPE int __io_putchar(int ch)
+  #if defined(DEBUG_SERIAL_USART2)
+    #define DEBUG_UART              huart2
+    #define DEBUG_UART_IRQn         USART2_IRQn
   #else
-    #define PUTCHAR_PROTOTYPE int fputc(int ch, FILE *f)
+    #define DEBUG_UART              huart3
+    #define DEBUG_UART_IRQn         USART3_IRQn
   #endif
-  PUTCHAR_PROTOTYPE {
-    #if defined(DEBUG_SERIAL_USART2)
-      HAL_UART_Transmit(&huart2, (uint8_t *)&ch, 1, 1000);
-    #elif defined(DEBUG_SERIAL_USART3)
-      HAL_UART_Transmit(&huart3, (uint8_t *)&ch, 1, 1000);
-    #endif
-    return ch;
+
+  static uint8_t           debugTxBuf[DEBUG_TX_BUFFER_SIZE];
+  static Ring              debugTxRing;                 // head written by the producers, tail on TX complete
+  static volatile uint16_t debugTxBusy;                 // Length of the DMA transfer in progress, 0 = idle
+  uint32_t debugTxDrop;                                 // Number of characters dropped because the queue was full
+
+  /* Start the next DMA transfer. Call with the debug USART IRQ masked or from it */
+  static void debugTxKick(void) {
+    uint16_t len = ringLinear(&debugTxRing, DEBUG_TX_BUFFER_SIZE);   // Contiguous part only, the wrap is sent by the next transfer
+    if (debugTxBusy || len == 0 || DEBUG_UART.gState != HAL_UART_STATE_READY) {
+      return;
+    }
+    if (UART_TxDma(&DEBUG_UART, &debugTxBuf[ringOut(&debugTxRing, DEBUG_TX_BUFFER_SIZE)], len) == HAL_OK) {
+      debugTxBusy = len;
+    }
   }
-  
-  #ifdef __GNUC__
-    int _write(int file, char *data, int len) {
-      int i;
-      for (i = 0; i < len; i++) { __io_putchar( *data++ );}
-      return len;
+
+  /* Transfer complete, from HAL_UART_TxCpltCallback */
+  static void debugTxDone(void) {
+    ringPop(&debugTxRing, debugTxBusy);
+    debugTxBusy = 0;
+    debugTxKick();
+  }
+
+  int debugTxFree(void) {
+    return ringFree(&debugTxRing, DEBUG_TX_BUFFER_SIZE);
+  }
+
+  int debugTxWrite(const uint8_t *data, int len) {
+    uint8_t mask = (__get_IPSR() != (uint32_t)DEBUG_UART_IRQn + 16U);   // Not from the debug USART IRQ itself
+    uint16_t n, at, first;
+    int i = 0;
+    while (i < len) {
+      if (mask) NVIC_DisableIRQ(DEBUG_UART_IRQn);
+      n     = MIN(ringFree(&debugTxRing, DEBUG_TX_BUFFER_SIZE), (uint16_t)MIN(len - i, 0xFFFF));
+      at    = ringIn(&debugTxRing, DEBUG_TX_BUFFER_SIZE);
+      first = MIN(n, DEBUG_TX_BUFFER_SIZE - at);        // up to the end of the buffer, the rest from its start
+      memcpy(&debugTxBuf[at], &data[i], first);
+      memcpy(debugTxBuf, &data[i + first], n - first);
+      i += n;
+      ringPush(&debugTxRing, n);
+      debugTxKick();
+      if (mask) NVIC_EnableIRQ(DEBUG_UART_IRQn);
+      #if defined(DEBUG_TX_BLOCK)
+      if (__get_IPSR() == 0) continue;                  // Thread mode: wait for the DMA to free some space
+      #endif
+      if (i < len) {
+        debugTxDrop += len - i;
+        break;
+      }
     }
-  #endif
+    return len;
+  }
 #endif
 
  
@@ -220,6 +453,63 @@ void BLDC_Init(void) {
   rtP_Left.a_phaAdvMax          = PHASE_ADV_MAX << 4;                   // fixdt(1,16,4)
   rtP_Left.r_fieldWeakHi        = FIELD_WEAK_HI << 4;                   // fixdt(1,16,4)
   rtP_Left.r_fieldWeakLo        = FIELD_WEAK_LO << 4;                   // fixdt(1,16,4)
+#if defined(CTRL_GAINS)
+  rtP_Left.cf_idKp              = CTRL_GAIN_ID_KP;                      // generated units, the rates are rescaled below
+  rtP_Left.cf_idKi              = CTRL_GAIN_ID_KI;
+  rtP_Left.cf_iqKp              = CTRL_GAIN_IQ_KP;
+  rtP_Left.cf_iqKi              = CTRL_GAIN_IQ_KI;
+  rtP_Left.cf_nKp               = CTRL_GAIN_N_KP;
+  rtP_Left.cf_nKi               = CTRL_GAIN_N_KI;
+  rtP_Left.cf_currFilt          = CTRL_GAIN_FILT;
+#endif
+
+#if PWM_FREQ != PWM_FREQ_BASE
+  // Parameters counted in control ticks scale with the rate, per tick rates and discrete integral gains inversely
+  #define TICKS_SCALE(x)    ((int32_t)(x) * PWM_FREQ / PWM_FREQ_BASE)
+  #define PER_TICK_SCALE(x) ((int32_t)(x) * PWM_FREQ_BASE / PWM_FREQ)
+  rtP_Left.cf_speedCoef         = TICKS_SCALE(rtP_Left.cf_speedCoef);   // rpm = cf_speedCoef / hall period [ticks]
+  rtP_Left.z_maxCntRst          = TICKS_SCALE(rtP_Left.z_maxCntRst);
+  rtP_Left.dz_cntTrnsDetHi      = TICKS_SCALE(rtP_Left.dz_cntTrnsDetHi);
+  rtP_Left.dz_cntTrnsDetLo      = TICKS_SCALE(rtP_Left.dz_cntTrnsDetLo);
+  rtP_Left.t_errQual            = TICKS_SCALE(rtP_Left.t_errQual);
+  rtP_Left.t_errDequal          = TICKS_SCALE(rtP_Left.t_errDequal);
+  rtP_Left.dV_openRate          = PER_TICK_SCALE(rtP_Left.dV_openRate);
+  rtP_Left.cf_currFilt          = PER_TICK_SCALE(rtP_Left.cf_currFilt); // first order filter, linear approximation of 1 - exp(-Ts / tau)
+  rtP_Left.cf_idKi              = PER_TICK_SCALE(rtP_Left.cf_idKi);
+  rtP_Left.cf_iqKi              = PER_TICK_SCALE(rtP_Left.cf_iqKi);
+  rtP_Left.cf_nKi               = PER_TICK_SCALE(rtP_Left.cf_nKi);
+  rtP_Left.cf_iqKiLimProt       = PER_TICK_SCALE(rtP_Left.cf_iqKiLimProt);
+  rtP_Left.cf_nKiLimProt        = PER_TICK_SCALE(rtP_Left.cf_nKiLimProt);
+  rtP_Left.cf_KbLimProt         = PER_TICK_SCALE(rtP_Left.cf_KbLimProt);
+#endif
+
+#if defined(CTRL_MULTIRATE)
+  // The model runs each task group every 3rd tick. FOC now runs every tick, the slow groups every CTRL_SLOW_DIV ticks
+  #define SLOW_TICKS_SCALE(x)   ((int32_t)(x) * 3 / CTRL_SLOW_DIV)
+  #define SLOW_PER_TICK_SCALE(x) ((int32_t)(x) * CTRL_SLOW_DIV / 3)
+  rtP_Left.cf_idKi              = rtP_Left.cf_idKi / 3;
+  rtP_Left.cf_iqKi              = rtP_Left.cf_iqKi / 3;
+  rtP_Left.cf_nKi               = rtP_Left.cf_nKi  / 3;
+  rtP_Left.t_errQual            = SLOW_TICKS_SCALE(rtP_Left.t_errQual);
+  rtP_Left.t_errDequal          = SLOW_TICKS_SCALE(rtP_Left.t_errDequal);
+  rtP_Left.dV_openRate          = SLOW_PER_TICK_SCALE(rtP_Left.dV_openRate);
+  rtP_Left.cf_iqKiLimProt       = SLOW_PER_TICK_SCALE(rtP_Left.cf_iqKiLimProt);
+  rtP_Left.cf_nKiLimProt        = SLOW_PER_TICK_SCALE(rtP_Left.cf_nKiLimProt);
+  rtP_Left.cf_KbLimProt         = SLOW_PER_TICK_SCALE(rtP_Left.cf_KbLimProt);
+#endif
+
+#if FOC_VOLT_MAX != 900
+  // FOC voltage limit: Vd_max and the Vq_max(|Vd|) circle of the generated 900, fixdt(1,16,4)
+  rtP_Left.Vd_max               = FOC_VOLT_MAX << 4;
+  for (uint8_t k = 0; k < sizeof(rtP_Left.Vq_max_M1) / sizeof(rtP_Left.Vq_max_M1[0]); k++) {
+    rtP_Left.Vq_max_M1[k]       = (int16_t)((int32_t)rtP_Left.Vq_max_M1[k] * FOC_VOLT_MAX / 900);
+    rtP_Left.Vq_max_XA[k]       = (int16_t)((int32_t)k * (320 * FOC_VOLT_MAX / 900));  // even spacing for the prelookup
+  }
+#endif
+
+#if defined(SPD_FILT)
+  spdFiltApply();                               // speed loop filter coefficients of the config.h values
+#endif
 
   rtP_Right                     = rtP_Left;     // Copy the Left motor parameters to the Right motor parameters
   rtP_Right.z_selPhaCurMeasABC  = 1;            // Right motor measured current phases {Blue, Yellow} = {iB, iC} -> do NOT change
@@ -239,9 +529,27 @@ void BLDC_Init(void) {
   /* Initialize BLDC controllers */
   BLDC_controller_initialize(rtM_Left);
   BLDC_controller_initialize(rtM_Right);
+
+#if defined(CTRL_MULTIRATE)
+  // Right motor slow tasks a quarter period later than the left ones, so no tick runs two of them
+  rtDW_Right.z_taskCnt           = CTRL_SLOW_DIV - CTRL_SLOW_DIV / 4;
+  rtDW_Right.UnitDelay2_DSTATE_c = 0;
+#else
+  // Right motor task ring one tick behind the left one: the heaviest group (Field Weakening + Motor
+  // Limitations) of both motors never runs in the same interrupt, which shortens the worst case tick
+  rtDW_Right.UnitDelay2_DSTATE_c = 0;
+  rtDW_Right.UnitDelay6_DSTATE   = 1;
+#endif
+}
+
+void Board_Cfg_Init(void) {     // Apply boardCfgFlags, the bits the build does not support are dropped
+  boardCfgFlags  &= BCFG_MASK;
+  boardCfg.flags  = boardCfgFlags;
+  boardCfg.dirL   = (boardCfgFlags & BCFG_INV_L) ? -1 : 1;
+  boardCfg.dirR   = (boardCfgFlags & BCFG_INV_R) ? 1 : -1;    // the right motor turns the other way
 }
 
-void Input_Lim_Init(void) {     // Input Limitations - ! Do NOT touch !
+RAMFUNC void Input_Lim_Init(void) {     // Input Limitations - ! Do NOT touch !
   if (rtP_Left.b_fieldWeakEna || rtP_Right.b_fieldWeakEna) {
     INPUT_MAX = MAX( 1000, FIELD_WEAK_HI);
     INPUT_MIN = MIN(-1000,-FIELD_WEAK_HI);
@@ -251,6 +559,31 @@ void Input_Lim_Init(void) {     // Input Limitations - ! Do NOT touch !
   }
 }
 
+  /* Reciprocal 2^30 / span of an input span, so calcInputCmd scales with a multiply instead of a division.
+  * A zero span gives 0, like the division on the Cortex-M3 */
+static int32_t inputRcp(int32_t span) {
+  if (span == 0) return 0;
+  uint32_t rcp = (uint32_t)((0x40000000U + ABS(span) - 1) / (uint32_t)ABS(span));
+  return span < 0 ? -(int32_t)rcp : (int32_t)rcp;
+}
+
+void Input_Scale_Init(void) {   // Recalculate the input scaling after a change of the input limits or type
+  InputStruct *in[2 * INPUTS_NR];
+  for (uint8_t i = 0; i < INPUTS_NR; i++) {
+    in[2*i]   = &input1[i];
+    in[2*i+1] = &input2[i];
+  }
+  for (uint8_t i = 0; i < 2 * INPUTS_NR; i++) {
+    if (in[i]->typ == 1) {
+      in[i]->rcpPos = inputRcp(in[i]->max - in[i]->min);
+      in[i]->rcpNeg = 0;
+    } else {
+      in[i]->rcpPos = inputRcp(in[i]->max - (in[i]->mid + in[i]->dband));
+      in[i]->rcpNeg = inputRcp(in[i]->min - (in[i]->mid - in[i]->dband));
+    }
+  }
+}
+
 void Input_Init(void) {
   #if defined(CONTROL_PPM_LEFT) || defined(CONTROL_PPM_RIGHT)
     PPM_Init();
@@ -267,21 +600,48 @@ void Input_Init(void) {
     UART3_Init();
   #endif
   #if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
-    HAL_UART_Receive_DMA(&huart2, (uint8_t *)rx_buffer_L, sizeof(rx_buffer_L));
-    UART_DisableRxErrors(&huart2);
+    UART_RxDma(&huart2, (uint8_t *)rx_buffer_L, sizeof(rx_buffer_L));
   #endif
   #if defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
-    HAL_UART_Receive_DMA(&huart3, (uint8_t *)rx_buffer_R, sizeof(rx_buffer_R));
-    UART_DisableRxErrors(&huart3);
+    UART_RxDma(&huart3, (uint8_t *)rx_buffer_R, sizeof(rx_buffer_R));
   #endif
 
   #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
-    uint16_t writeCheck, readVal;
     HAL_FLASH_Unlock();
     EE_Init();            /* EEPROM Init */
+    #if defined(CALIBRATION_ADAPTIVE)
+      adcCalib.warmValid = 1;                     // Warm start the ADC offset calibration from the last saved offsets
+      for (uint8_t i = 0; i < CALIB_CH; i++) {
+        if (EE_ReadVariable(VirtAddVarTab[EE_ADDR_CALIB + i], &adcCalib.warm[i])) adcCalib.warmValid = 0;
+      }
+    #endif
+    #if defined(HALL_CALIB)
+      hallCalLoad();                              // Hall edge corrections of the last $HALLCAL
+    #endif
+    #if defined(MOTOR_IDENT)
+      motIdLoad();                                // Motor constants of the last $MOTID
+    #endif
+    #if defined(SELF_TEST)
+      if (EE_ReadVariable(VirtAddVarTab[EE_ADDR_SELFTEST], &selfTest.cached)) selfTest.cached = 0;  // Self-test result of the last power on
+    #endif
+    #if defined(COGGING_COMP)
+      cogLoad();                                  // Cogging tables of the last $COGCAL
+    #endif
+    #if defined(SERIAL_BUS)
+    uint16_t busIdEE;
+    if (EE_ReadVariable(VirtAddVarTab[EE_ADDR_BUS], &busIdEE) == 0 && busIdEE < PROTO_BUS_MAX) {
+      busId = (uint8_t)busIdEE;                   // BUS_ID parameter, saved with $SAVE
+    }
+    #endif
+    #if defined(DEBUG_SERIAL_PROTOCOL) && defined(DEBUG_OUT)
+    if (loadAllParamVal()) {                      // Every parameter with an EEPROM address in params[] (comms.c)
+      printf("Using the configuration from EEprom\r\n");
+      for (uint8_t i=0; i<INPUTS_NR; i++) {
+    #else
+    uint16_t writeCheck, readVal;
     EE_ReadVariable(VirtAddVarTab[0], &writeCheck);
     if (writeCheck == FLASH_WRITE_KEY) {
-      #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+      #if defined(DEBUG_OUT)
         printf("Using the configuration from EEprom\r\n");
       #endif
 
@@ -296,13 +656,14 @@ void Input_Init(void) {
         EE_ReadVariable(VirtAddVarTab[ 8+8*i] , &readVal); input2[i].min = (int16_t)readVal;
         EE_ReadVariable(VirtAddVarTab[ 9+8*i] , &readVal); input2[i].mid = (int16_t)readVal;
         EE_ReadVariable(VirtAddVarTab[10+8*i] , &readVal); input2[i].max = (int16_t)readVal;
+    #endif
       
         printf("Limits Input1: TYP:%i MIN:%i MID:%i MAX:%i\r\nLimits Input2: TYP:%i MIN:%i MID:%i MAX:%i\r\n",
           input1[i].typ, input1[i].min, input1[i].mid, input1[i].max,
           input2[i].typ, input2[i].min, input2[i].mid, input2[i].max);
       }
     } else {
-      #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+      #if defined(DEBUG_OUT)
         printf("Using the configuration from config.h\r\n");
       #endif
 
@@ -324,6 +685,7 @@ void Input_Init(void) {
     }
     HAL_FLASH_Lock();
   #endif
+  Input_Scale_Init();
 
   #ifdef VARIANT_TRANSPOTTER
     enable = 1;
@@ -333,9 +695,9 @@ void Input_Init(void) {
     EE_ReadVariable(VirtAddVarTab[0], &saveValue);
     HAL_FLASH_Lock();
 
-    setDistance = saveValue / 1000.0;
-    if (setDistance < 0.2) {
-      setDistance = 1.0;
+    setDistance = saveValue;
+    if (setDistance < 200) {
+      setDistance = 1000;
     }
   #endif
 
@@ -353,54 +715,36 @@ void Input_Init(void) {
         //TODO while(1);
     }
 
-    LCD_ClearDisplay(&lcd);
-    HAL_Delay(5);
-    LCD_SetLocation(&lcd, 0, 0);
+    lcdInit();
+    lcdClear();
+    lcdSetLocation(0, 0);
     #ifdef VARIANT_TRANSPOTTER
-      LCD_WriteString(&lcd, "TranspOtter V2.1");
+      lcdWriteString("TranspOtter V2.1");
     #else
-      LCD_WriteString(&lcd, "Hover V2.0");
+      lcdWriteString("Hover V2.0");
     #endif
-    LCD_SetLocation(&lcd,  0, 1); LCD_WriteString(&lcd, "Initializing...");
+    lcdSetLocation( 0, 1); lcdWriteString("Initializing...");
+    lcdFlush();
   #endif
 
   #if defined(VARIANT_TRANSPOTTER) && defined(SUPPORT_LCD)
-    LCD_ClearDisplay(&lcd);
-    HAL_Delay(5);
-    LCD_SetLocation(&lcd,  0, 1); LCD_WriteString(&lcd, "Bat:");
-    LCD_SetLocation(&lcd,  8, 1); LCD_WriteString(&lcd, "V");
-    LCD_SetLocation(&lcd, 15, 1); LCD_WriteString(&lcd, "A");
-    LCD_SetLocation(&lcd,  0, 0); LCD_WriteString(&lcd, "Len:");
-    LCD_SetLocation(&lcd,  8, 0); LCD_WriteString(&lcd, "m(");
-    LCD_SetLocation(&lcd, 14, 0); LCD_WriteString(&lcd, "m)");
+    lcdClear();
+    lcdSetLocation( 0, 1); lcdWriteString("Bat:");
+    lcdSetLocation( 8, 1); lcdWriteString("V");
+    lcdSetLocation(15, 1); lcdWriteString("A");
+    lcdSetLocation( 0, 0); lcdWriteString("Len:");
+    lcdSetLocation( 8, 0); lcdWriteString("m(");
+    lcdSetLocation(14, 0); lcdWriteString("m)");
   #endif
 }
 
-/**
-  * @brief  Disable Rx Errors detection interrupts on UART peripheral (since we do not want DMA to be stopped)
-  *         The incorrect data will be filtered based on the START_FRAME and checksum.
-  * @param  huart: UART handle.
-  * @retval None
-  */
-#if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2) || \
-    defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
-void UART_DisableRxErrors(UART_HandleTypeDef *huart)
-{  
-  CLEAR_BIT(huart->Instance->CR1, USART_CR1_PEIE);    /* Disable PE (Parity Error) interrupts */  
-  CLEAR_BIT(huart->Instance->CR3, USART_CR3_EIE);     /* Disable EIE (Frame error, noise error, overrun error) interrupts */
-}
-#endif
-
-
 /* =========================== General Functions =========================== */
 
+/* The beep functions queue notes for the tone sequencer of the slow task (beepNote) and return at once */
 void poweronMelody(void) {
-    buzzerCount = 0;  // prevent interraction with beep counter
     for (int i = 8; i >= 0; i--) {
-      buzzerFreq = (uint8_t)i;
-      HAL_Delay(100);
+      beepNote((uint8_t)i, 100);
     }
-    buzzerFreq = 0;
 }
 
 void beepCount(uint8_t cnt, uint8_t freq, uint8_t pattern) {
@@ -410,17 +754,11 @@ void beepCount(uint8_t cnt, uint8_t freq, uint8_t pattern) {
 }
 
 void beepLong(uint8_t freq) {
-    buzzerCount = 0;  // prevent interraction with beep counter
-    buzzerFreq = freq;
-    HAL_Delay(500);
-    buzzerFreq = 0;
+    beepNote(freq, 500);
 }
 
 void beepShort(uint8_t freq) {
-    buzzerCount = 0;  // prevent interraction with beep counter
-    buzzerFreq = freq;
-    HAL_Delay(100);
-    buzzerFreq = 0;
+    beepNote(freq, 100);
 }
 
 void beepShortMany(uint8_t cnt, int8_t dir) {
@@ -435,22 +773,29 @@ void beepShortMany(uint8_t cnt, int8_t dir) {
     }
 }
 
+/* Wait until the queued notes are played, only where the firmware has to wait anyway (power on, power off) */
+void beepWait(void) {
+    while (beepBusy()) {}
+}
+
 void calcAvgSpeed(void) {
     // Calculate measured average speed. The minus sign (-) is because motors spin in opposite directions
+    #if defined(HALL_SPEED_EST)
+      bldc_hall_speed(hallSpeed);
+      int16_t speedL = hallSpeed[0];
+      int16_t speedR = hallSpeed[1];
+    #else
+      BldcState st;
+      bldc_state_read(&st);             // both speeds of the same control tick
+      int16_t speedL = st.n_mot[0];
+      int16_t speedR = st.n_mot[1];
+    #endif
     speedAvg = 0;
     #if defined(MOTOR_LEFT_ENA)
-      #if defined(INVERT_L_DIRECTION)
-        speedAvg -= rtY_Left.n_mot;
-      #else
-        speedAvg += rtY_Left.n_mot;
-      #endif
+      speedAvg += boardOutL(speedL);
     #endif
     #if defined(MOTOR_RIGHT_ENA)
-      #if defined(INVERT_R_DIRECTION)
-        speedAvg += rtY_Right.n_mot;
-      #else
-        speedAvg -= rtY_Right.n_mot;
-      #endif
+      speedAvg += boardOutR(speedR);
 
       // Average only if both motors are enabled
       #if defined(MOTOR_LEFT_ENA)
@@ -465,6 +810,31 @@ void calcAvgSpeed(void) {
     speedAvgAbs   = abs(speedAvg);
 }
 
+ /*
+ * Input sampling of the input calibration modes (see inputCalTask): the control task reads the raw inputs,
+ * inputCalTask filters them and tracks the limits every DELAY_IN_MAIN_LOOP ms until the mode is confirmed
+ */
+#if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+static int32_t inputCal1_fixdt, inputCal2_fixdt;
+static int16_t inputCal1Min, inputCal1Max, inputCal2Min, inputCal2Max;
+
+static void inputCalReset(void) {
+  inputCal1_fixdt = input1[inIdx].raw << 16;
+  inputCal2_fixdt = input2[inIdx].raw << 16;
+  inputCal1Min    = inputCal2Min = MAX_int16_T;   // MIN = a high value, MAX = a low value
+  inputCal1Max    = inputCal2Max = MIN_int16_T;
+}
+
+static void inputCalSample(void) {
+  filtLowPass32(input1[inIdx].raw, FILTER, &inputCal1_fixdt);
+  filtLowPass32(input2[inIdx].raw, FILTER, &inputCal2_fixdt);
+  inputCal1Min = MIN(inputCal1Min, (int16_t)(inputCal1_fixdt >> 16));
+  inputCal1Max = MAX(inputCal1Max, (int16_t)(inputCal1_fixdt >> 16));
+  inputCal2Min = MIN(inputCal2Min, (int16_t)(inputCal2_fixdt >> 16));
+  inputCal2Max = MAX(inputCal2Max, (int16_t)(inputCal2_fixdt >> 16));
+}
+#endif
+
  /*
  * Auto-calibration of the ADC Limits
  * This function finds the Minimum, Maximum, and Middle for the ADC input
@@ -474,32 +844,19 @@ void calcAvgSpeed(void) {
  * - release potentiometers to the resting postion
  * - press the power button to confirm or wait for the 20 sec timeout
  * The Values will be saved to flash. Values are persistent if you flash with platformio. To erase them, make a full chip erase.
+ * Called by inputCalStop at the end of the sampling, the main loop keeps running meanwhile. $INCAL runs the same mode.
  */
 void adcCalibLim(void) {
 #ifdef AUTO_CALIBRATION_ENA
-  calcAvgSpeed();
-  if (speedAvgAbs > 5) {    // do not enter this mode if motors are spinning
-    return;
-  }
-
 #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
 
-  #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
-  printf("Input calibration started...\r\n");
-  #endif
-
-  readInputRaw();
-  // Inititalization: MIN = a high value, MAX = a low value
-  int32_t  input1_fixdt = input1[inIdx].raw << 16;
-  int32_t  input2_fixdt = input2[inIdx].raw << 16;
-  int16_t  INPUT1_MIN_temp = MAX_int16_T;
-  int16_t  INPUT1_MID_temp = 0;
-  int16_t  INPUT1_MAX_temp = MIN_int16_T;
-  int16_t  INPUT2_MIN_temp = MAX_int16_T;
-  int16_t  INPUT2_MID_temp = 0;
-  int16_t  INPUT2_MAX_temp = MIN_int16_T;
+  int16_t  INPUT1_MIN_temp = inputCal1Min;
+  int16_t  INPUT1_MID_temp = (int16_t)(inputCal1_fixdt >> 16);
+  int16_t  INPUT1_MAX_temp = inputCal1Max;
+  int16_t  INPUT2_MIN_temp = inputCal2Min;
+  int16_t  INPUT2_MID_temp = (int16_t)(inputCal2_fixdt >> 16);
+  int16_t  INPUT2_MAX_temp = inputCal2Max;
   int16_t  input_margin    = 0;
-  uint16_t input_cal_timeout = 0;
   
   #ifdef CONTROL_ADC
   if (inIdx == CONTROL_ADC) {
@@ -507,47 +864,32 @@ void adcCalibLim(void) {
   }
   #endif
 
-  // Extract MIN, MAX and MID from ADC while the power button is not pressed
-  while (!HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN) && input_cal_timeout++ < 4000) {   // 20 sec timeout
-    readInputRaw();
-    filtLowPass32(input1[inIdx].raw, FILTER, &input1_fixdt);
-    filtLowPass32(input2[inIdx].raw, FILTER, &input2_fixdt);
-    
-    INPUT1_MID_temp = (int16_t)(input1_fixdt >> 16);// CLAMP(input1_fixdt >> 16, INPUT1_MIN, INPUT1_MAX);   // convert fixed-point to integer
-    INPUT2_MID_temp = (int16_t)(input2_fixdt >> 16);// CLAMP(input2_fixdt >> 16, INPUT2_MIN, INPUT2_MAX);
-    INPUT1_MIN_temp = MIN(INPUT1_MIN_temp, INPUT1_MID_temp);
-    INPUT1_MAX_temp = MAX(INPUT1_MAX_temp, INPUT1_MID_temp);
-    INPUT2_MIN_temp = MIN(INPUT2_MIN_temp, INPUT2_MID_temp);
-    INPUT2_MAX_temp = MAX(INPUT2_MAX_temp, INPUT2_MID_temp);
-    HAL_Delay(5);
-  }
-
-  #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+  #if defined(DEBUG_OUT)
   printf("Input1 is ");
   #endif
   uint8_t input1TypTemp = checkInputType(INPUT1_MIN_temp, INPUT1_MID_temp, INPUT1_MAX_temp);
   if (input1TypTemp == input1[inIdx].typDef || input1[inIdx].typDef == 3) {  // Accept calibration only if the type is correct OR type was set to 3 (auto)
-    #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+    #if defined(DEBUG_OUT)
     printf("..OK\r\n");
     #endif
   } else {
     input1TypTemp = 0; // Disable input
-    #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+    #if defined(DEBUG_OUT)
     printf("..NOK\r\n");
     #endif
   }
 
-  #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+  #if defined(DEBUG_OUT)
   printf("Input2 is ");
   #endif
   uint8_t input2TypTemp = checkInputType(INPUT2_MIN_temp, INPUT2_MID_temp, INPUT2_MAX_temp);
   if (input2TypTemp == input2[inIdx].typDef || input2[inIdx].typDef == 3) {  // Accept calibration only if the type is correct OR type was set to 3 (auto)
-    #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+    #if defined(DEBUG_OUT)
     printf("..OK\r\n");
     #endif
   } else {
     input2TypTemp = 0; // Disable input
-    #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+    #if defined(DEBUG_OUT)
     printf("..NOK\r\n");
     #endif
   }
@@ -564,15 +906,16 @@ void adcCalibLim(void) {
     input2[inIdx].min = INPUT2_MIN_temp + input_margin;
     input2[inIdx].mid = INPUT2_MID_temp;
     input2[inIdx].max = INPUT2_MAX_temp - input_margin;
+    Input_Scale_Init();
 
-    inp_cal_valid = 1;    // Mark calibration to be saved in Flash at shutdown
-    #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+    inp_cal_valid = 1;    // Mark calibration to be saved in Flash by inputCalStop
+    #if defined(DEBUG_OUT)
     printf("Limits Input1: TYP:%i MIN:%i MID:%i MAX:%i\r\nLimits Input2: TYP:%i MIN:%i MID:%i MAX:%i\r\n",
             input1[inIdx].typ, input1[inIdx].min, input1[inIdx].mid, input1[inIdx].max,
             input2[inIdx].typ, input2[inIdx].min, input2[inIdx].mid, input2[inIdx].max);
     #endif
   }else{
-    #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+    #if defined(DEBUG_OUT)
     printf("Both inputs cannot be ignored, calibration rejected.\r\n");
     #endif
   }
@@ -586,33 +929,17 @@ void adcCalibLim(void) {
  * - press the power button for more than 5 sec and immediatelly after the beep sound press one more time shortly
  * - move and hold the pots to a desired limit position for Current and Speed
  * - press the power button to confirm or wait for the 10 sec timeout
+ * Called by inputCalStop at the end of the sampling, the main loop keeps running meanwhile. $INLIM runs the same mode.
  */
 void updateCurSpdLim(void) {
-  calcAvgSpeed();
-  if (speedAvgAbs > 5) {    // do not enter this mode if motors are spinning
-    return;
-  }
-
 #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
 
-  #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
-  printf("Torque and Speed limits update started...\r\n");
-  #endif
-
-  int32_t  input1_fixdt = input1[inIdx].raw << 16;
-  int32_t  input2_fixdt = input2[inIdx].raw << 16;
+  int32_t  input1_fixdt = inputCal1_fixdt;
+  int32_t  input2_fixdt = inputCal2_fixdt;
   uint16_t cur_factor;    // fixdt(0,16,16)
   uint16_t spd_factor;    // fixdt(0,16,16)
-  uint16_t cur_spd_timeout = 0;
   cur_spd_valid = 0;
 
-  // Wait for the power button press
-  while (!HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN) && cur_spd_timeout++ < 2000) {  // 10 sec timeout
-    readInputRaw();
-    filtLowPass32(input1[inIdx].raw, FILTER, &input1_fixdt);
-    filtLowPass32(input2[inIdx].raw, FILTER, &input2_fixdt);
-    HAL_Delay(5);
-  }
   // Calculate scaling factors
   cur_factor = CLAMP((input1_fixdt - (input1[inIdx].min << 16)) / (input1[inIdx].max - input1[inIdx].min), 6553, 65535);    // ADC1, MIN_cur(10%) = 1.5 A 
   spd_factor = CLAMP((input2_fixdt - (input2[inIdx].min << 16)) / (input2[inIdx].max - input2[inIdx].min), 3276, 65535);    // ADC2, MIN_spd(5%)  = 50 rpm
@@ -620,16 +947,16 @@ void updateCurSpdLim(void) {
   if (input1[inIdx].typ != 0){
     // Update current limit
     rtP_Left.i_max = rtP_Right.i_max  = (int16_t)((I_MOT_MAX * A2BIT_CONV * cur_factor) >> 12);    // fixdt(0,16,16) to fixdt(1,16,4)
-    cur_spd_valid   = 1;  // Mark update to be saved in Flash at shutdown
+    cur_spd_valid   = 1;  // Mark update to be saved in Flash by inputCalStop
   }
 
   if (input2[inIdx].typ != 0){
     // Update speed limit
     rtP_Left.n_max = rtP_Right.n_max  = (int16_t)((N_MOT_MAX * spd_factor) >> 12);                 // fixdt(0,16,16) to fixdt(1,16,4)
-    cur_spd_valid  += 2;  // Mark update to be saved in Flash at shutdown
+    cur_spd_valid  += 2;  // Mark update to be saved in Flash by inputCalStop
   }
 
-  #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+  #if defined(DEBUG_OUT)
   // cur_spd_valid: 0 = No limit changed, 1 = Current limit changed, 2 = Speed limit changed, 3 = Both limits changed
   printf("Limits (%i)\r\nCurrent: fixdt:%li factor%i i_max:%i \r\nSpeed: fixdt:%li factor:%i n_max:%i\r\n",
           cur_spd_valid, input1_fixdt, cur_factor, rtP_Left.i_max, input2_fixdt, spd_factor, rtP_Left.n_max);
@@ -640,28 +967,24 @@ void updateCurSpdLim(void) {
 
  /*
  * Standstill Hold Function
- * This function uses Cruise Control to provide an anti-roll functionality at standstill.
- * Only available and makes sense for FOC VOLTAGE or FOC TORQUE mode.
+ * This function requests the standstill hold: the control interrupt holds the hall step position of both motors
+ * (bldc.c holdTick), so the board does not roll away on a slope.
  * 
  * Input:  none
  * Output: standstillAcv
  */
 void standstillHold(void) {
-  #if defined(STANDSTILL_HOLD_ENABLE) && (CTRL_TYP_SEL == FOC_CTRL) && (CTRL_MOD_REQ != SPD_MODE)
-    if (!rtP_Left.b_cruiseCtrlEna) {                                  // If Stanstill in NOT Active -> try Activation
+  #if defined(STANDSTILL_HOLD_ENABLE)
+    if (!standstillAcv && !cruiseCtrlAcv) {                           // If Stanstill in NOT Active -> try Activation
       if (((input1[inIdx].cmd > 50 || input2[inIdx].cmd < -50) && speedAvgAbs < 30) // Check if Brake is pressed AND measured speed is small
           || (input2[inIdx].cmd < 20 && speedAvgAbs < 5)) {           // OR Throttle is small AND measured speed is very small
-        rtP_Left.n_cruiseMotTgt   = 0;
-        rtP_Right.n_cruiseMotTgt  = 0;
-        rtP_Left.b_cruiseCtrlEna  = 1;
-        rtP_Right.b_cruiseCtrlEna = 1;
+        holdReq       = BLDC_HOLD_POS;
         standstillAcv = 1;
       } 
     }
-    else {                                                            // If Stanstill is Active -> try Deactivation
-      if (input1[inIdx].cmd < 20 && input2[inIdx].cmd > 50 && !cruiseCtrlAcv) { // Check if Brake is released AND Throttle is pressed AND no Cruise Control
-        rtP_Left.b_cruiseCtrlEna  = 0;
-        rtP_Right.b_cruiseCtrlEna = 0;
+    else if (standstillAcv) {                                         // If Stanstill is Active -> try Deactivation
+      if (input1[inIdx].cmd < 20 && input2[inIdx].cmd > 50) {         // Check if Brake is released AND Throttle is pressed
+        holdReq       = BLDC_HOLD_NONE;
         standstillAcv = 0;
       }
     }
@@ -672,6 +995,7 @@ void standstillHold(void) {
  * Electric Brake Function
  * In case of TORQUE mode, this function replaces the motor "freewheel" with a constant braking when the input torque request is 0.
  * This is useful when a small amount of motor braking is desired instead of "freewheel".
+ * With REGEN_LIMIT the control interrupt scales the braking torque down near the battery voltage limit (regen.c).
  * 
  * Input: speedBlend = fixdt(0,16,15), reverseDir = {0, 1}
  * Output: input2.cmd (Throtle) with brake component included
@@ -707,23 +1031,26 @@ void electricBrake(uint16_t speedBlend, uint8_t reverseDir) {
 
  /*
  * Cruise Control Function
- * This function activates/deactivates cruise control.
+ * This function activates/deactivates cruise control. The control interrupt engages it (bldc.c holdTick).
  * 
  * Input: button (as a pulse)
  * Output: cruiseCtrlAcv
  */
 void cruiseControl(uint8_t button) {
   #ifdef CRUISE_CONTROL_SUPPORT
-    if (button && !rtP_Left.b_cruiseCtrlEna) {                          // Cruise control activated
-      rtP_Left.n_cruiseMotTgt   = rtY_Left.n_mot;
-      rtP_Right.n_cruiseMotTgt  = rtY_Right.n_mot;
-      rtP_Left.b_cruiseCtrlEna  = 1;
-      rtP_Right.b_cruiseCtrlEna = 1;
+    static uint32_t buttonTick;                                         // [ms] last accepted button press
+    if (button && timeMs() - buttonTick < 200) {                   // 200 ms debounce, the beeps no longer wait
+      return;
+    }
+    if (button) {
+      buttonTick = timeMs();
+    }
+    if (button && !cruiseCtrlAcv && !standstillAcv) {                   // Cruise control activated
+      holdReq       = BLDC_HOLD_SPD;
       cruiseCtrlAcv = 1;
-      beepShortMany(2, 1);                                              // 200 ms beep delay. Acts as a debounce also.
-    } else if (button && rtP_Left.b_cruiseCtrlEna && !standstillAcv) {  // Cruise control deactivated if no Standstill Hold is active
-      rtP_Left.b_cruiseCtrlEna  = 0;
-      rtP_Right.b_cruiseCtrlEna = 0;
+      beepShortMany(2, 1);
+    } else if (button && cruiseCtrlAcv) {                               // Cruise control deactivated
+      holdReq       = BLDC_HOLD_NONE;
       cruiseCtrlAcv = 0;
       beepShortMany(2, -1);
     }
@@ -745,25 +1072,25 @@ int checkInputType(int16_t min, int16_t mid, int16_t max){
 
   if ((min / threshold) == (max / threshold) || (mid / threshold) == (max / threshold) || min > max || mid > max) {
     type = 0;
-    #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+    #if defined(DEBUG_OUT)
     printf("ignored");                // (MIN and MAX) OR (MID and MAX) are close, disable input
     #endif
   } else {
     if ((min / threshold) == (mid / threshold)){
       type = 1;
-      #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+      #if defined(DEBUG_OUT)
       printf("a normal pot");        // MIN and MID are close, it's a normal pot
       #endif
     } else {
       type = 2;
-      #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+      #if defined(DEBUG_OUT)
       printf("a mid-resting pot");   // it's a mid resting pot
       #endif
     }
 
     #ifdef CONTROL_ADC
     if ((min + ADC_MARGIN - ADC_PROTECT_THRESH) > 0 && (max - ADC_MARGIN + ADC_PROTECT_THRESH) < 4095) {
-      #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+      #if defined(DEBUG_OUT)
       printf(" AND protected");
       #endif
       beepLong(2); // Indicate protection by a beep
@@ -778,22 +1105,32 @@ int checkInputType(int16_t min, int16_t mid, int16_t max){
 
 /* =========================== Input Functions =========================== */
 
+ /*
+ * Scale n / span with the reciprocal rcp = 2^30 / span from Input_Scale_Init.
+ * The result rounds towards zero like the division and is at most one count larger in magnitude
+ */
+static int32_t scaleInput(int32_t n, int32_t rcp) {
+  uint32_t q = (uint32_t)(((uint64_t)(uint32_t)ABS(n) * (uint32_t)ABS(rcp)) >> 30);
+  return ((n ^ rcp) < 0) ? -(int32_t)q : (int32_t)q;
+}
+
  /*
  * Calculate Input Command
  * This function realizes dead-band around 0 and scales the input between [out_min, out_max]
+ * Same as MAP over the input limits, with the divisions replaced by the reciprocals from Input_Scale_Init
  */
 void calcInputCmd(InputStruct *in, int16_t out_min, int16_t out_max) {
   switch (in->typ){
     case 1: // Input is a normal pot
-      in->cmd = CLAMP(MAP(in->raw, in->min, in->max, 0, out_max), 0, out_max);
+      in->cmd = CLAMP(scaleInput((in->raw - in->min) * out_max, in->rcpPos), 0, out_max);
       break;
     case 2: // Input is a mid resting pot
       if( in->raw > in->mid - in->dband && in->raw < in->mid + in->dband ) {
         in->cmd = 0;
       } else if(in->raw > in->mid) {
-        in->cmd = CLAMP(MAP(in->raw, in->mid + in->dband, in->max, 0, out_max), 0, out_max);
+        in->cmd = CLAMP(scaleInput((in->raw - (in->mid + in->dband)) * out_max, in->rcpPos), 0, out_max);
       } else {
-        in->cmd = CLAMP(MAP(in->raw, in->mid - in->dband, in->min, 0, out_min), out_min, 0);
+        in->cmd = CLAMP(scaleInput((in->raw - (in->mid - in->dband)) * out_min, in->rcpNeg), out_min, 0);
       }
       break;
     default: // Input is ignored
@@ -805,102 +1142,243 @@ void calcInputCmd(InputStruct *in, int16_t out_min, int16_t out_max) {
  /*
  * Function to read the Input Raw values from various input devices
  */
-void readInputRaw(void) {
-    #ifdef CONTROL_ADC
-    if (inIdx == CONTROL_ADC) {
-      #ifdef ADC_ALTERNATE_CONNECT
-        input1[inIdx].raw = adc_buffer.l_rx2;
-        input2[inIdx].raw = adc_buffer.l_tx2;
-      #else
-        input1[inIdx].raw = adc_buffer.l_tx2;
-        input2[inIdx].raw = adc_buffer.l_rx2;
-      #endif
-    }
-    #endif
+#if defined(CONTROL_ADC) && (ADC_INPUT_FILT == 1)
+  static BoxcarFilt adcInFilt[2];         // ADC input pre-filters: l_tx2, l_rx2
+  #define ADC_IN_FILT_INIT(i, u)  boxcarInit(&adcInFilt[i], u)
+  #define ADC_IN_FILT(i, u)       boxcarStep(&adcInFilt[i], u)
+#elif defined(CONTROL_ADC) && (ADC_INPUT_FILT == 2)
+  static Ema2Filt   adcInFilt[2];
+  #define ADC_IN_FILT_INIT(i, u)  ema2Init(&adcInFilt[i], u)
+  #define ADC_IN_FILT(i, u)       ema2Step(&adcInFilt[i], u)
+#else
+  #define ADC_IN_FILT(i, u)       (u)
+#endif
 
-    #if defined(CONTROL_NUNCHUK) || defined(SUPPORT_NUNCHUK)
-    if (Nunchuk_Read() == NUNCHUK_CONNECTED) {
-      if (inIdx == CONTROL_NUNCHUK) {
-        input1[inIdx].raw = (nunchuk_data[0] - 127) * 8; // X axis 0-255
-        input2[inIdx].raw = (nunchuk_data[1] - 128) * 8; // Y axis 0-255
-      }
-      #ifdef SUPPORT_BUTTONS
-        button1 = (uint8_t)nunchuk_data[5] & 1;
-        button2 = (uint8_t)(nunchuk_data[5] >> 1) & 1;
-      #endif
-    }
-    #endif
+#if (defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)) && !defined(CONTROL_IBUS)
+/* One serial latency sample [us], block mean and max like the ISR profiler */
+static void serialLatUpdate(SerialLatStat *s, uint32_t us) {
+  if (us > UINT16_MAX) us = UINT16_MAX;
+  s->last = (uint16_t)us;
+  if (s->last > s->blockMax) s->blockMax = s->last;
+  s->sum += us;
+  if (++s->cnt >= (1U << SERIAL_LAT_SHIFT)) {
+    s->mean     = (uint16_t)(s->sum >> SERIAL_LAT_SHIFT);
+    s->max      = s->blockMax;
+    s->blockMax = 0;
+    s->sum      = 0;
+    s->cnt      = 0;
+  }
+}
 
-    #if defined(CONTROL_SERIAL_USART2)
-    if (inIdx == CONTROL_SERIAL_USART2) {
-      #ifdef CONTROL_IBUS
-        for (uint8_t i = 0; i < (IBUS_NUM_CHANNELS * 2); i+=2) {
-          ibusL_captured_value[(i/2)] = CLAMP(commandL.channels[i] + (commandL.channels[i+1] << 8) - 1000, 0, INPUT_MAX); // 1000-2000 -> 0-1000
-        }
-        input1[inIdx].raw = (ibusL_captured_value[0] - 500) * 2;
-        input2[inIdx].raw = (ibusL_captured_value[1] - 500) * 2; 
-      #else
-        input1[inIdx].raw = commandL.steer;
-        input2[inIdx].raw = commandL.speed;
-      #endif
+/* The control task (or the Rx interrupt with SERIAL_FAST_CMD) took over the last received target */
+static void serialLatApply(SerialLatency *l) {
+  if (l->pending) {
+    l->pending = 0;
+    serialLatUpdate(&l->apply, timeUs() - l->rxUs);
+  }
+}
+#endif
+
+/* Input sources: copy the latest producer values of one source to the raw inputs of its index */
+#if defined(CONTROL_ADC)
+static uint16_t adcIn[2];                 // filtered l_tx2, l_rx2, updated every call of readInputRaw
+static void inputReadAdc(InputStruct *in1, InputStruct *in2) {
+  #ifdef ADC_ALTERNATE_CONNECT
+    in1->raw = adcIn[1];
+    in2->raw = adcIn[0];
+  #else
+    in1->raw = adcIn[0];
+    in2->raw = adcIn[1];
+  #endif
+}
+#endif
+
+#if defined(CONTROL_NUNCHUK) || defined(SUPPORT_NUNCHUK)
+static uint8_t nunchukOk;                 // last Nunchuk_Read found the nunchuk
+#endif
+#if defined(CONTROL_NUNCHUK)
+static void inputReadNunchuk(InputStruct *in1, InputStruct *in2) {
+  if (nunchukOk) {
+    in1->raw = (nunchuk_data[0] - 127) * 8; // X axis 0-255
+    in2->raw = (nunchuk_data[1] - 128) * 8; // Y axis 0-255
+  }
+}
+#endif
+
+#if defined(CONTROL_SERIAL_USART2) && defined(CONTROL_IBUS)
+static void inputReadSerialL(InputStruct *in1, InputStruct *in2) {
+  in1->raw = (ibusCh_L[0] - 500) * 2;  // 0-1000 -> -1000-1000
+  in2->raw = (ibusCh_L[1] - 500) * 2;
+}
+#elif defined(CONTROL_SERIAL_USART2)
+static void inputReadSerialL(InputStruct *in1, InputStruct *in2) {
+  in1->raw = commandL.steer;
+  in2->raw = commandL.speed;
+  serialLatApply(&serialLat_L);
+}
+#endif
+#if defined(CONTROL_SERIAL_USART3) && defined(CONTROL_IBUS)
+static void inputReadSerialR(InputStruct *in1, InputStruct *in2) {
+  in1->raw = (ibusCh_R[0] - 500) * 2;  // 0-1000 -> -1000-1000
+  in2->raw = (ibusCh_R[1] - 500) * 2;
+}
+#elif defined(CONTROL_SERIAL_USART3)
+static void inputReadSerialR(InputStruct *in1, InputStruct *in2) {
+  in1->raw = commandR.steer;
+  in2->raw = commandR.speed;
+  serialLatApply(&serialLat_R);
+}
+#endif
+
+#if defined(SIDEBOARD_SERIAL_USART2)
+static void inputReadSideboardL(InputStruct *in1, InputStruct *in2) {
+  in1->raw = Sideboard_L.cmd1;
+  in2->raw = Sideboard_L.cmd2;
+}
+#endif
+#if defined(SIDEBOARD_SERIAL_USART3)
+static void inputReadSideboardR(InputStruct *in1, InputStruct *in2) {
+  in1->raw = Sideboard_R.cmd1;
+  in2->raw = Sideboard_R.cmd2;
+}
+#endif
+
+#if defined(CONTROL_PPM_LEFT) || defined(CONTROL_PPM_RIGHT)
+static void inputReadPpm(InputStruct *in1, InputStruct *in2) {
+  in1->raw = (ppm_captured_value[0] - 500) * 2;
+  in2->raw = (ppm_captured_value[1] - 500) * 2;
+}
+#endif
+#if defined(CONTROL_PWM_LEFT) || defined(CONTROL_PWM_RIGHT)
+static void inputReadPwm(InputStruct *in1, InputStruct *in2) {
+  in1->raw = (pwm_captured_ch1_value - 500) * 2;
+  in2->raw = (pwm_captured_ch2_value - 500) * 2;
+}
+#endif
+
+// Input source table, one entry per input index of the active configuration
+#if defined(VARIANT_HOVERBOARD) || defined(VARIANT_TRANSPOTTER)
+  #define INPUT_SRC(read, tmo)  {read, 0, tmo}              // raw values are used as they are
+#else
+  #define INPUT_SRC(read, tmo)  {read, 1, tmo}
+#endif
+#if defined(VARIANT_SKATEBOARD)
+  #define INPUT2_MIN            INPUT_BRK                   // input2 is throttle and brake
+#else
+  #define INPUT2_MIN            INPUT_MIN
+#endif
+static const InputSource inputSrc[INPUTS_NR] = {
+  #if defined(CONTROL_ADC)
+  [CONTROL_ADC]             = INPUT_SRC(inputReadAdc,        INPUT_TMO_ADC),
+  #endif
+  #if defined(CONTROL_NUNCHUK)
+  [CONTROL_NUNCHUK]         = INPUT_SRC(inputReadNunchuk,    INPUT_TMO_GEN),
+  #endif
+  #if defined(CONTROL_SERIAL_USART2)
+  [CONTROL_SERIAL_USART2]   = INPUT_SRC(inputReadSerialL,    INPUT_TMO_SERIAL),
+  #endif
+  #if defined(CONTROL_SERIAL_USART3)
+  [CONTROL_SERIAL_USART3]   = INPUT_SRC(inputReadSerialR,    INPUT_TMO_SERIAL),
+  #endif
+  #if defined(SIDEBOARD_SERIAL_USART2)
+  [SIDEBOARD_SERIAL_USART2] = INPUT_SRC(inputReadSideboardL, INPUT_TMO_SERIAL),
+  #endif
+  #if defined(SIDEBOARD_SERIAL_USART3)
+  [SIDEBOARD_SERIAL_USART3] = INPUT_SRC(inputReadSideboardR, INPUT_TMO_SERIAL),
+  #endif
+  #if defined(CONTROL_PPM_LEFT)
+  [CONTROL_PPM_LEFT]        = INPUT_SRC(inputReadPpm,        INPUT_TMO_GEN),
+  #endif
+  #if defined(CONTROL_PPM_RIGHT)
+  [CONTROL_PPM_RIGHT]       = INPUT_SRC(inputReadPpm,        INPUT_TMO_GEN),
+  #endif
+  #if defined(CONTROL_PWM_LEFT)
+  [CONTROL_PWM_LEFT]        = INPUT_SRC(inputReadPwm,        INPUT_TMO_GEN),
+  #endif
+  #if defined(CONTROL_PWM_RIGHT)
+  [CONTROL_PWM_RIGHT]       = INPUT_SRC(inputReadPwm,        INPUT_TMO_GEN),
+  #endif
+};
+
+#if defined(LATENCY_MEAS)
+LatMeas latMeas;
+
+/* [us] sample time of the latest values of the selected input: the frame receive or pulse capture time where the
+ * producer keeps one, else now (ADC, Nunchuk and sideboards are read by the main loop or have no receive time) */
+static uint32_t inputSampleUs(void) {
+  #if defined(CONTROL_SERIAL_USART2) && !defined(CONTROL_IBUS)
+  if (inIdx == CONTROL_SERIAL_USART2) return serialLat_L.rxUs;
+  #endif
+  #if defined(CONTROL_SERIAL_USART3) && !defined(CONTROL_IBUS)
+  if (inIdx == CONTROL_SERIAL_USART3) return serialLat_R.rxUs;
+  #endif
+  #if defined(CONTROL_PPM_LEFT)
+  if (inIdx == CONTROL_PPM_LEFT) return ppm_time;
+  #endif
+  #if defined(CONTROL_PPM_RIGHT)
+  if (inIdx == CONTROL_PPM_RIGHT) return ppm_time;
+  #endif
+  #if defined(CONTROL_PWM_LEFT)
+  if (inIdx == CONTROL_PWM_LEFT) return (int32_t)(pwm_time_ch2 - pwm_time_ch1) > 0 ? pwm_time_ch2 : pwm_time_ch1;
+  #endif
+  #if defined(CONTROL_PWM_RIGHT)
+  if (inIdx == CONTROL_PWM_RIGHT) return (int32_t)(pwm_time_ch2 - pwm_time_ch1) > 0 ? pwm_time_ch2 : pwm_time_ch1;
+  #endif
+  return timeUs();
+}
+#endif
+
+/*
+ * Read the Input Raw values: the producers that need polling run every call, whatever input is selected,
+ * then only the selected source is copied to input1/input2[inIdx]
+ */
+void readInputRaw(void) {
+    #ifdef CONTROL_ADC
+    #if ADC_INPUT_FILT
+    static uint8_t adcInFiltInit;
+    if (!adcInFiltInit) {                 // start the filters at the current values, the first readout is after the ADC start
+      ADC_IN_FILT_INIT(0, adc_buffer.l_tx2);
+      ADC_IN_FILT_INIT(1, adc_buffer.l_rx2);
+      adcInFiltInit = 1;
     }
     #endif
-    #if defined(CONTROL_SERIAL_USART3)
-    if (inIdx == CONTROL_SERIAL_USART3) {
-      #ifdef CONTROL_IBUS
-        for (uint8_t i = 0; i < (IBUS_NUM_CHANNELS * 2); i+=2) {
-          ibusR_captured_value[(i/2)] = CLAMP(commandR.channels[i] + (commandR.channels[i+1] << 8) - 1000, 0, INPUT_MAX); // 1000-2000 -> 0-1000
-        }
-        input1[inIdx].raw = (ibusR_captured_value[0] - 500) * 2;
-        input2[inIdx].raw = (ibusR_captured_value[1] - 500) * 2; 
-      #else
-        input1[inIdx].raw = commandR.steer;
-        input2[inIdx].raw = commandR.speed;
-      #endif
-    }
+    adcIn[0] = ADC_IN_FILT(0, adc_buffer.l_tx2);  // filter both channels every call, also when the ADC input is not selected
+    adcIn[1] = ADC_IN_FILT(1, adc_buffer.l_rx2);
     #endif
 
-    #if defined(SIDEBOARD_SERIAL_USART2)
-    if (inIdx == SIDEBOARD_SERIAL_USART2) {
-      input1[inIdx].raw = Sideboard_L.cmd1;
-      input2[inIdx].raw = Sideboard_L.cmd2;
+    #if defined(CONTROL_NUNCHUK) || defined(SUPPORT_NUNCHUK)
+    nunchukOk = (Nunchuk_Read() == NUNCHUK_CONNECTED);
+    #ifdef SUPPORT_BUTTONS
+    if (nunchukOk) {
+      button1 = (uint8_t)nunchuk_data[5] & 1;
+      button2 = (uint8_t)(nunchuk_data[5] >> 1) & 1;
     }
     #endif
-    #if defined(SIDEBOARD_SERIAL_USART3)
-    if (inIdx == SIDEBOARD_SERIAL_USART3) {
-      input1[inIdx].raw = Sideboard_R.cmd1;
-      input2[inIdx].raw = Sideboard_R.cmd2;
-    }
     #endif
 
-    #if defined(CONTROL_PPM_LEFT)
-    if (inIdx == CONTROL_PPM_LEFT) {
-      input1[inIdx].raw = (ppm_captured_value[0] - 500) * 2;
-      input2[inIdx].raw = (ppm_captured_value[1] - 500) * 2;
-    }
+    #if defined(PPM_DMA) && (defined(CONTROL_PPM_LEFT) || defined(CONTROL_PPM_RIGHT))
+    PPM_Decode();                         // frames captured since the last main loop
     #endif
-    #if defined(CONTROL_PPM_RIGHT)
-    if (inIdx == CONTROL_PPM_RIGHT) {
-      input1[inIdx].raw = (ppm_captured_value[0] - 500) * 2;
-      input2[inIdx].raw = (ppm_captured_value[1] - 500) * 2;
-    }
+    #if defined(CONTROL_PPM_LEFT) || defined(CONTROL_PPM_RIGHT)
+    PPM_Timeout();
     #endif
     #if (defined(CONTROL_PPM_LEFT) || defined(CONTROL_PPM_RIGHT)) && defined(SUPPORT_BUTTONS)
       button1 = ppm_captured_value[5] > 500;
       button2 = 0;
     #endif
 
-    #if defined(CONTROL_PWM_LEFT)
-    if (inIdx == CONTROL_PWM_LEFT) {
-      input1[inIdx].raw = (pwm_captured_ch1_value - 500) * 2;
-      input2[inIdx].raw = (pwm_captured_ch2_value - 500) * 2;
-    }
+    #if defined(PWM_CAPTURE)
+    PWM_Read();                           // pulse widths latched by the timers
+    #endif
+    #if defined(CONTROL_PWM_LEFT) || defined(CONTROL_PWM_RIGHT)
+    PWM_Timeout();
     #endif
-    #if defined(CONTROL_PWM_RIGHT)
-    if (inIdx == CONTROL_PWM_RIGHT) {
-      input1[inIdx].raw = (pwm_captured_ch1_value - 500) * 2;
-      input2[inIdx].raw = (pwm_captured_ch2_value - 500) * 2;
+
+    if (inputSrc[inIdx].read) {
+      inputSrc[inIdx].read(&input1[inIdx], &input2[inIdx]);
     }
+    #if defined(LATENCY_MEAS)
+    latInput(&latMeas, inIdx, input1[inIdx].raw, input2[inIdx].raw, inputSampleUs(), timeUs());
     #endif
 
     #ifdef VARIANT_TRANSPOTTER
@@ -915,12 +1393,50 @@ void readInputRaw(void) {
     #endif
 }
 
+#if defined(SERIAL_TIMEOUT_ADAPTIVE)
+/* Frame that resets the timeout received (Rx interrupt): learn the frame interval. Gaps longer than SERIAL_TIMEOUT are outages */
+static void serialSupFrame(SerialSup *s) {
+  uint32_t now = timeUs();
+  uint32_t dt  = now - s->rxUs;
+  if (s->rxUs != 0 && dt < SERIAL_TIMEOUT * DELAY_IN_MAIN_LOOP * 1000UL) {
+    s->periodUs = s->periodUs ? s->periodUs + ((int32_t)(dt - s->periodUs) >> 3) : dt;
+  }
+  s->rxUs = now | 1;                    // 0 is "no frame yet"
+}
+
+/* Timeout counter qualification (main loop): returns the trip count [loops], updates the ramp down scale from cnt */
+static uint16_t serialSupStep(SerialSup *s, uint16_t cnt) {
+  uint32_t lim = SERIAL_TIMEOUT;
+  if (s->periodUs) {
+    lim = (SERIAL_TIMEOUT_FRAMES * s->periodUs + DELAY_IN_MAIN_LOOP * 1000UL - 1) / (DELAY_IN_MAIN_LOOP * 1000UL);
+    lim = CLAMP(lim, SERIAL_TIMEOUT_MIN, SERIAL_TIMEOUT);
+  }
+  s->limit = (uint16_t)lim;
+  if (cnt <= s->limit) {
+    s->scale = 256;
+  } else {
+    s->scale = (uint16_t)(256 - MIN(cnt - s->limit, SERIAL_TIMEOUT_RAMP) * 256 / SERIAL_TIMEOUT_RAMP);
+  }
+  return s->limit + SERIAL_TIMEOUT_RAMP;
+}
+
+/* Ramp down of the selected input's targets while its frames are missing */
+static void serialSupRamp(const SerialSup *s) {
+  if (inIdx == s->idx && s->scale < 256) {
+    input1[inIdx].raw = (int16_t)((input1[inIdx].raw * s->scale) >> 8);
+    input2[inIdx].raw = (int16_t)((input2[inIdx].raw * s->scale) >> 8);
+    input1[inIdx].cmd = (int16_t)((input1[inIdx].cmd * s->scale) >> 8);
+    input2[inIdx].cmd = (int16_t)((input2[inIdx].cmd * s->scale) >> 8);
+  }
+}
+#endif
+
  /*
  * Function to handle the ADC, UART and General timeout (Nunchuk, PPM, PWM)
  */
 void handleTimeout(void) {
     #ifdef CONTROL_ADC
-    if (inIdx == CONTROL_ADC) {
+    if (inputSrc[inIdx].timeout == INPUT_TMO_ADC) {
       // If input1 or Input2 is either below MIN - Threshold or above MAX + Threshold, ADC protection timeout
       if (IN_RANGE(input1[inIdx].raw, input1[inIdx].min - ADC_PROTECT_THRESH, input1[inIdx].max + ADC_PROTECT_THRESH) &&
           IN_RANGE(input2[inIdx].raw, input2[inIdx].min - ADC_PROTECT_THRESH, input2[inIdx].max + ADC_PROTECT_THRESH)) {
@@ -936,9 +1452,14 @@ void handleTimeout(void) {
     #endif
 
     #if defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
-      if (timeoutCntSerial_L++ >= SERIAL_TIMEOUT) {     // Timeout qualification
+      #if defined(SERIAL_TIMEOUT_ADAPTIVE)
+      uint16_t timeoutTrip_L = serialSupStep(&serialSup_L, timeoutCntSerial_L);
+      #else
+      uint16_t timeoutTrip_L = SERIAL_TIMEOUT;
+      #endif
+      if (timeoutCntSerial_L++ >= timeoutTrip_L) {     // Timeout qualification
         timeoutFlgSerial_L = 1;                         // Timeout detected
-        timeoutCntSerial_L = SERIAL_TIMEOUT;            // Limit timout counter value
+        timeoutCntSerial_L = timeoutTrip_L;            // Limit timout counter value
         #if defined(DUAL_INPUTS) && ((defined(CONTROL_SERIAL_USART2) && CONTROL_SERIAL_USART2 == 1) || (defined(SIDEBOARD_SERIAL_USART2) && SIDEBOARD_SERIAL_USART2 == 1))
           inIdx = 0;                                    // Switch to Primary input in case of Timeout on Auxiliary input
         #endif
@@ -959,9 +1480,14 @@ void handleTimeout(void) {
     #endif
 
     #if defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
-      if (timeoutCntSerial_R++ >= SERIAL_TIMEOUT) {     // Timeout qualification
+      #if defined(SERIAL_TIMEOUT_ADAPTIVE)
+      uint16_t timeoutTrip_R = serialSupStep(&serialSup_R, timeoutCntSerial_R);
+      #else
+      uint16_t timeoutTrip_R = SERIAL_TIMEOUT;
+      #endif
+      if (timeoutCntSerial_R++ >= timeoutTrip_R) {     // Timeout qualification
         timeoutFlgSerial_R = 1;                         // Timeout detected
-        timeoutCntSerial_R = SERIAL_TIMEOUT;            // Limit timout counter value
+        timeoutCntSerial_R = timeoutTrip_R;            // Limit timout counter value
         #if defined(DUAL_INPUTS) && ((defined(CONTROL_SERIAL_USART3) && CONTROL_SERIAL_USART3 == 1) || (defined(SIDEBOARD_SERIAL_USART3) && SIDEBOARD_SERIAL_USART3 == 1))
           inIdx = 0;                                    // Switch to Primary input in case of Timeout on Auxiliary input
         #endif
@@ -1006,6 +1532,19 @@ void handleTimeout(void) {
       }
     #endif
 
+    #if defined(SERIAL_TIMEOUT_ADAPTIVE) && (defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2))
+      serialSupRamp(&serialSup_L);
+    #endif
+    #if defined(SERIAL_TIMEOUT_ADAPTIVE) && (defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3))
+      serialSupRamp(&serialSup_R);
+    #endif
+
+    #if defined(DUAL_INPUTS)
+      if (!(boardCfg.flags & BCFG_DUAL)) {
+        inIdx = 0;                                      // Auxiliary input disabled by BOARD_CFG
+      }
+    #endif
+
     // In case of timeout bring the system to a Safe State
     if (timeoutFlgADC || timeoutFlgSerial || timeoutFlgGen) {
       ctrlModReq  = OPEN_MODE;                                          // Request OPEN_MODE. This will bring the motor power to 0 in a controlled way
@@ -1013,6 +1552,11 @@ void handleTimeout(void) {
       input2[inIdx].cmd  = 0;
     } else {
       ctrlModReq  = ctrlModReqRaw;                                      // Follow the Mode request
+      #if defined(POS_CTRL)
+      if (posCmd == inIdx + 1) {
+        ctrlModReq = POS_MODE;                                          // Position targets from the selected serial input
+      }
+      #endif
     }
 
     // Beep in case of Input index change
@@ -1027,18 +1571,21 @@ void handleTimeout(void) {
  * Function to calculate the command to the motors. This function also manages:
  * - timeout detection
  * - MIN/MAX limitations and deadband
+ * - input response curve (INPUT_CURVE)
  */
 void readCommand(void) {
     readInputRaw();
 
-    #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+    if (inputSrc[inIdx].scale) {
       calcInputCmd(&input1[inIdx], INPUT_MIN, INPUT_MAX);
-      #if !defined(VARIANT_SKATEBOARD)
-        calcInputCmd(&input2[inIdx], INPUT_MIN, INPUT_MAX);
-      #else
-        calcInputCmd(&input2[inIdx], INPUT_BRK, INPUT_MAX);
+      calcInputCmd(&input2[inIdx], INPUT2_MIN, INPUT_MAX);
+      #if defined(INPUT_CURVE)
+        input2[inIdx].cmd = inputCurveStep(input2[inIdx].cmd, inputCurve);
+        #ifdef VARIANT_HOVERCAR
+        input1[inIdx].cmd = inputCurveStep(input1[inIdx].cmd, inputCurve);   // brake pedal
+        #endif
       #endif
-    #endif
+    }
 
     handleTimeout();
 
@@ -1062,66 +1609,183 @@ void readCommand(void) {
 }
 
 
+#if defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
+/*
+ * Frame parser working in place on the circular USART Rx DMA buffer
+ * - returns a pointer to the next candidate frame starting with start (frameLen bytes) or startAlt (frameLenAlt bytes), or NULL if none is complete yet
+ * - bytes that do not start a frame are skipped (resync), an incomplete frame stays in the buffer until the next IDLE event
+ * - contiguous frames are returned directly from the DMA buffer, only frames wrapping around the buffer end are copied to scratch
+ */
+static const uint8_t *usart_rx_frame(SerialRx *rx, uint32_t pos, uint32_t frameLen, uint16_t start, uint32_t frameLenAlt, uint16_t startAlt, uint8_t *scratch)
+{
+  uint32_t avail;
+  uint16_t header;
+  uint8_t  skipped = 0;
+
+  if (pos >= rx->size) {
+    pos = 0;
+  }
+  while (1) {
+    avail = (pos + rx->size - rx->rd) % rx->size;
+    if (avail < 2) {
+      break;
+    }
+    header = (uint16_t)(rx->buf[rx->rd] | (rx->buf[(rx->rd + 1) % rx->size] << 8));
+    if (header == start || header == startAlt) {
+      if (header != start) {
+        frameLen = frameLenAlt;
+      }
+      if (avail < frameLen) {
+        break;                                                          // Wait for the rest of the frame
+      }
+      rx->resync += skipped;
+      if (rx->rd + frameLen <= rx->size) {
+        return &rx->buf[rx->rd];                                        // Zero-copy: frame is contiguous
+      }
+      memcpy(scratch, &rx->buf[rx->rd], rx->size - rx->rd);            // Frame wraps around the buffer end
+      memcpy(scratch + rx->size - rx->rd, &rx->buf[0], frameLen - (rx->size - rx->rd));
+      return scratch;
+    }
+    rx->rd = (rx->rd + 1) % rx->size;                                   // Not a start frame: slide one byte
+    skipped = 1;
+  }
+  rx->resync += skipped;
+  return NULL;
+}
+
+/*
+ * Consume the frame returned by usart_rx_frame: skip the whole frame if valid, otherwise only its first byte to search for the next start frame
+ */
+static void usart_rx_frame_done(SerialRx *rx, uint32_t frameLen, uint8_t valid)
+{
+  if (valid) {
+    rx->good++;
+    rx->rd = (rx->rd + frameLen) % rx->size;
+  } else {
+    rx->bad++;
+    rx->rd = (rx->rd + 1) % rx->size;
+  }
+}
+#endif
+
+#if defined(SERIAL_COBS)
+/*
+ * COBS frame parser on the circular USART Rx DMA buffer (SERIAL_COBS)
+ * - copies the next complete frame without its delimiter to scratch (max bytes) and returns its length, 0 if none is complete yet
+ * - the frame and its delimiter are consumed, empty frames (delimiters in a row) are skipped
+ * - a frame longer than max is dropped (resync), the parser restarts at the next delimiter
+ */
+static uint16_t usart_rx_cobs(SerialRx *rx, uint32_t pos, uint8_t *scratch, uint16_t max)
+{
+  uint32_t start, end, n;
+
+  if (pos >= rx->size) {
+    pos = 0;
+  }
+  while (rx->rd != pos) {
+    start = rx->rd;
+    for (end = start, n = 0; end != pos && rx->buf[end] != PROTO_COBS_DELIM; end = (end + 1) % rx->size) {
+      n++;
+    }
+    if (end == pos) {
+      if (n > max) {
+        rx->resync++;                                                   // No delimiter within the longest frame: drop
+        rx->rd = pos;
+      }
+      break;                                                            // Wait for the rest of the frame
+    }
+    rx->rd = (end + 1) % rx->size;
+    if (n == 0) {
+      continue;
+    }
+    if (n > max) {
+      rx->resync++;
+      continue;
+    }
+    if (start + n <= rx->size) {
+      memcpy(scratch, &rx->buf[start], n);
+    } else {                                                            // Frame wraps around the buffer end
+      memcpy(scratch, &rx->buf[start], rx->size - start);
+      memcpy(scratch + rx->size - start, &rx->buf[0], n - (rx->size - start));
+    }
+    return (uint16_t)n;
+  }
+  return 0;
+}
+#endif
+
+#if defined(SERIAL_RX_DMA_IRQ) && (defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2) || \
+                                   defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3))
+/*
+ * Rx DMA lap check, SERIAL_RX_DMA_IRQ: half is the count of half transfer and transfer complete interrupts, read before
+ * the position pos. The read position went from old to pos, through 0..2 half buffer boundaries, seen keeps their
+ * count. More interrupts than boundaries is a buffer that filled up more than once between two checks: the data of
+ * the lap is lost (the parsers then resync), ovf counts it. An interrupt still on its way only shows one check later
+ */
+static void usart_rx_lap(uint8_t half, uint8_t *seen, uint32_t old, uint32_t pos, uint32_t size, uint32_t *ovf)
+{
+  uint32_t end = pos >= old ? pos : pos + size;                         // pos behind old, unwrapped
+  *seen += (uint8_t)(end / (size / 2) - old / (size / 2));
+  if ((int8_t)(half - *seen) > 0) {
+    (*ovf)++;
+    *seen = half;
+  }
+}
+#endif
+
 /*
  * Check for new data received on USART2 with DMA: refactored function from https://github.com/MaJerle/stm32-usart-uart-dma-rx-tx
- * - this function is called for every USART IDLE line detection, in the USART interrupt handler
+ * - this function is called after every USART IDLE line detection, from PendSV (the USART interrupt handler pends it)
+ * - with SERIAL_RX_DMA_IRQ also on the half transfer and transfer complete of the Rx DMA
  */
 void usart2_rx_check(void)
 {
   #if defined(DEBUG_SERIAL_USART2) || defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)  
   static uint32_t old_pos;
   uint32_t pos;
+  #if defined(SERIAL_RX_DMA_IRQ)
+  static uint8_t halfSeen;
+  uint8_t half = rxDmaHalf_L;                                           // Before the position: a boundary in between only shows in pos
+  #endif
   pos = rx_buffer_L_len - __HAL_DMA_GET_COUNTER(huart2.hdmarx);         // Calculate current position in buffer
+  #if defined(SERIAL_RX_DMA_IRQ)
+  usart_rx_lap(half, &halfSeen, old_pos, pos, rx_buffer_L_len, &rxOverflow_L);
+  #endif
   #endif
 
   #if defined(DEBUG_SERIAL_USART2)
-  uint8_t ptr_debug[SERIAL_BUFFER_SIZE];
   if (pos != old_pos) {                                                 // Check change in received data
     if (pos > old_pos) {                                                // "Linear" buffer mode: check if current position is over previous one
       usart_process_debug(&rx_buffer_L[old_pos], pos - old_pos);        // Process data
-    } else {                                                            // "Overflow" buffer mode
-      memcpy(&ptr_debug[0], &rx_buffer_L[old_pos], rx_buffer_L_len - old_pos);    // First copy data from the end of buffer
-      if (pos > 0) {                                                    // Check and continue with beginning of buffer
-        memcpy(&ptr_debug[rx_buffer_L_len - old_pos], &rx_buffer_L[0], pos);                              // Copy remaining data
+    } else {                                                            // "Overflow" buffer mode: the end of the buffer, then its beginning
+      usart_process_debug(&rx_buffer_L[old_pos], rx_buffer_L_len - old_pos);  // the line parser takes chunks, no copy needed
+      if (pos > 0) {
+        usart_process_debug(&rx_buffer_L[0], pos);
       }
-      usart_process_debug(ptr_debug, rx_buffer_L_len - old_pos + pos);        // Process data
     }
   }
   #endif // DEBUG_SERIAL_USART2
 
-  #ifdef CONTROL_SERIAL_USART2
-  uint8_t *ptr;	
-  if (pos != old_pos) {                                                 // Check change in received data
-    ptr = (uint8_t *)&commandL_raw;                                     // Initialize the pointer with command_raw address
-    if (pos > old_pos && (pos - old_pos) == commandL_len) {             // "Linear" buffer mode: check if current position is over previous one AND data length equals expected length
-      memcpy(ptr, &rx_buffer_L[old_pos], commandL_len);                 // Copy data. This is possible only if command_raw is contiguous! (meaning all the structure members have the same size)
-      usart_process_command(&commandL_raw, &commandL, 2);               // Process data
-    } else if ((rx_buffer_L_len - old_pos + pos) == commandL_len) {     // "Overflow" buffer mode: check if data length equals expected length
-      memcpy(ptr, &rx_buffer_L[old_pos], rx_buffer_L_len - old_pos);    // First copy data from the end of buffer
-      if (pos > 0) {                                                    // Check and continue with beginning of buffer
-        ptr += rx_buffer_L_len - old_pos;                               // Move to correct position in command_raw
-        memcpy(ptr, &rx_buffer_L[0], pos);                              // Copy remaining data
-      }
-      usart_process_command(&commandL_raw, &commandL, 2);               // Process data
+  #if defined(CONTROL_SERIAL_USART2) && defined(SERIAL_COBS)
+  uint16_t len;
+  while ((len = usart_rx_cobs(&rxFrame_L, pos, commandL_cobs, sizeof(commandL_cobs))) != 0) {
+    if (usart_process_cobs(commandL_cobs, len, (uint8_t *)&commandL_raw, sizeof(commandL_raw), &commandL, 2)) {
+      rxFrame_L.good++;
+    } else {
+      rxFrame_L.bad++;
     }
   }
+  #elif defined(CONTROL_SERIAL_USART2)
+  const uint8_t *frame;
+  while ((frame = usart_rx_frame(&rxFrame_L, pos, commandL_len, COMMAND_START_FRAME, COMMAND_LEN_ALT, COMMAND_START_FRAME_ALT, (uint8_t *)&commandL_raw)) != NULL) {
+    usart_rx_frame_done(&rxFrame_L, COMMAND_FRAME_LEN(frame), usart_process_command(frame, &commandL, 2));
+  }
   #endif // CONTROL_SERIAL_USART2
 
   #ifdef SIDEBOARD_SERIAL_USART2
-  uint8_t *ptr;	
-  if (pos != old_pos) {                                                 // Check change in received data
-    ptr = (uint8_t *)&Sideboard_L_raw;                                  // Initialize the pointer with Sideboard_raw address
-    if (pos > old_pos && (pos - old_pos) == Sideboard_L_len) {          // "Linear" buffer mode: check if current position is over previous one AND data length equals expected length
-      memcpy(ptr, &rx_buffer_L[old_pos], Sideboard_L_len);              // Copy data. This is possible only if Sideboard_raw is contiguous! (meaning all the structure members have the same size)
-      usart_process_sideboard(&Sideboard_L_raw, &Sideboard_L, 2);       // Process data
-    } else if ((rx_buffer_L_len - old_pos + pos) == Sideboard_L_len) {  // "Overflow" buffer mode: check if data length equals expected length
-      memcpy(ptr, &rx_buffer_L[old_pos], rx_buffer_L_len - old_pos);    // First copy data from the end of buffer
-      if (pos > 0) {                                                    // Check and continue with beginning of buffer
-        ptr += rx_buffer_L_len - old_pos;                               // Move to correct position in Sideboard_raw
-        memcpy(ptr, &rx_buffer_L[0], pos);                              // Copy remaining data
-      }
-      usart_process_sideboard(&Sideboard_L_raw, &Sideboard_L, 2);       // Process data
-    }
+  const uint8_t *frame;
+  while ((frame = usart_rx_frame(&rxFrame_L, pos, Sideboard_L_len, SERIAL_START_FRAME, Sideboard_L_len2, PROTO_SB_START_FRAME, (uint8_t *)&Sideboard_L_raw)) != NULL) {
+    usart_rx_frame_done(&rxFrame_L, RX_RD16(frame, 0) == PROTO_SB_START_FRAME ? Sideboard_L_len2 : Sideboard_L_len, usart_process_sideboard(frame, &Sideboard_L, 2));
   }
   #endif // SIDEBOARD_SERIAL_USART2
 
@@ -1136,65 +1800,57 @@ void usart2_rx_check(void)
 
 /*
  * Check for new data received on USART3 with DMA: refactored function from https://github.com/MaJerle/stm32-usart-uart-dma-rx-tx
- * - this function is called for every USART IDLE line detection, in the USART interrupt handler
+ * - this function is called after every USART IDLE line detection, from PendSV (the USART interrupt handler pends it)
+ * - with SERIAL_RX_DMA_IRQ also on the half transfer and transfer complete of the Rx DMA
  */
 void usart3_rx_check(void)
 {
   #if defined(DEBUG_SERIAL_USART3) || defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
   static uint32_t old_pos;
   uint32_t pos;  
+  #if defined(SERIAL_RX_DMA_IRQ)
+  static uint8_t halfSeen;
+  uint8_t half = rxDmaHalf_R;                                           // Before the position: a boundary in between only shows in pos
+  #endif
   pos = rx_buffer_R_len - __HAL_DMA_GET_COUNTER(huart3.hdmarx);         // Calculate current position in buffer
+  #if defined(SERIAL_RX_DMA_IRQ)
+  usart_rx_lap(half, &halfSeen, old_pos, pos, rx_buffer_R_len, &rxOverflow_R);
+  #endif
   #endif
 
   #if defined(DEBUG_SERIAL_USART3)
-  uint8_t ptr_debug[SERIAL_BUFFER_SIZE];
-
   if (pos != old_pos) {                                                 // Check change in received data
     if (pos > old_pos) {                                                // "Linear" buffer mode: check if current position is over previous one
       usart_process_debug(&rx_buffer_R[old_pos], pos - old_pos);        // Process data
-    } else {                                                            // "Overflow" buffer mode
-      memcpy(&ptr_debug[0], &rx_buffer_R[old_pos], rx_buffer_R_len - old_pos);    // First copy data from the end of buffer
-      if (pos > 0) {                                                    // Check and continue with beginning of buffer
-        memcpy(&ptr_debug[rx_buffer_R_len - old_pos], &rx_buffer_R[0], pos);                              // Copy remaining data
+    } else {                                                            // "Overflow" buffer mode: the end of the buffer, then its beginning
+      usart_process_debug(&rx_buffer_R[old_pos], rx_buffer_R_len - old_pos);  // the line parser takes chunks, no copy needed
+      if (pos > 0) {
+        usart_process_debug(&rx_buffer_R[0], pos);
       }
-      usart_process_debug(ptr_debug, rx_buffer_R_len - old_pos + pos);        // Process data
     }
   }
   #endif // DEBUG_SERIAL_USART3
 
-  #ifdef CONTROL_SERIAL_USART3
-  uint8_t *ptr;
-  if (pos != old_pos) {                                                 // Check change in received data
-    ptr = (uint8_t *)&commandR_raw;                                     // Initialize the pointer with command_raw address
-    if (pos > old_pos && (pos - old_pos) == commandR_len) {             // "Linear" buffer mode: check if current position is over previous one AND data length equals expected length
-      memcpy(ptr, &rx_buffer_R[old_pos], commandR_len);                 // Copy data. This is possible only if command_raw is contiguous! (meaning all the structure members have the same size)
-      usart_process_command(&commandR_raw, &commandR, 3);               // Process data
-    } else if ((rx_buffer_R_len - old_pos + pos) == commandR_len) {     // "Overflow" buffer mode: check if data length equals expected length
-      memcpy(ptr, &rx_buffer_R[old_pos], rx_buffer_R_len - old_pos);    // First copy data from the end of buffer
-      if (pos > 0) {                                                    // Check and continue with beginning of buffer
-        ptr += rx_buffer_R_len - old_pos;                               // Move to correct position in command_raw
-        memcpy(ptr, &rx_buffer_R[0], pos);                              // Copy remaining data
-      }
-      usart_process_command(&commandR_raw, &commandR, 3);               // Process data
+  #if defined(CONTROL_SERIAL_USART3) && defined(SERIAL_COBS)
+  uint16_t len;
+  while ((len = usart_rx_cobs(&rxFrame_R, pos, commandR_cobs, sizeof(commandR_cobs))) != 0) {
+    if (usart_process_cobs(commandR_cobs, len, (uint8_t *)&commandR_raw, sizeof(commandR_raw), &commandR, 3)) {
+      rxFrame_R.good++;
+    } else {
+      rxFrame_R.bad++;
     }
   }
+  #elif defined(CONTROL_SERIAL_USART3)
+  const uint8_t *frame;
+  while ((frame = usart_rx_frame(&rxFrame_R, pos, commandR_len, COMMAND_START_FRAME, COMMAND_LEN_ALT, COMMAND_START_FRAME_ALT, (uint8_t *)&commandR_raw)) != NULL) {
+    usart_rx_frame_done(&rxFrame_R, COMMAND_FRAME_LEN(frame), usart_process_command(frame, &commandR, 3));
+  }
   #endif // CONTROL_SERIAL_USART3
 
   #ifdef SIDEBOARD_SERIAL_USART3
-  uint8_t *ptr;
-  if (pos != old_pos) {                                                 // Check change in received data
-    ptr = (uint8_t *)&Sideboard_R_raw;                                  // Initialize the pointer with Sideboard_raw address
-    if (pos > old_pos && (pos - old_pos) == Sideboard_R_len) {          // "Linear" buffer mode: check if current position is over previous one AND data length equals expected length
-      memcpy(ptr, &rx_buffer_R[old_pos], Sideboard_R_len);              // Copy data. This is possible only if Sideboard_raw is contiguous! (meaning all the structure members have the same size)
-      usart_process_sideboard(&Sideboard_R_raw, &Sideboard_R, 3);       // Process data
-    } else if ((rx_buffer_R_len - old_pos + pos) == Sideboard_R_len) {  // "Overflow" buffer mode: check if data length equals expected length
-      memcpy(ptr, &rx_buffer_R[old_pos], rx_buffer_R_len - old_pos);    // First copy data from the end of buffer
-      if (pos > 0) {                                                    // Check and continue with beginning of buffer
-        ptr += rx_buffer_R_len - old_pos;                               // Move to correct position in Sideboard_raw
-        memcpy(ptr, &rx_buffer_R[0], pos);                              // Copy remaining data
-      }
-      usart_process_sideboard(&Sideboard_R_raw, &Sideboard_R, 3);       // Process data
-    }
+  const uint8_t *frame;
+  while ((frame = usart_rx_frame(&rxFrame_R, pos, Sideboard_R_len, SERIAL_START_FRAME, Sideboard_R_len2, PROTO_SB_START_FRAME, (uint8_t *)&Sideboard_R_raw)) != NULL) {
+    usart_rx_frame_done(&rxFrame_R, RX_RD16(frame, 0) == PROTO_SB_START_FRAME ? Sideboard_R_len2 : Sideboard_R_len, usart_process_sideboard(frame, &Sideboard_R, 3));
   }
   #endif // SIDEBOARD_SERIAL_USART3
 
@@ -1213,230 +1869,876 @@ void usart3_rx_check(void)
 void usart_process_debug(uint8_t *userCommand, uint32_t len)
 {
   #ifdef DEBUG_SERIAL_PROTOCOL
-    handle_input(userCommand, len);
+    handle_input_chunk(userCommand, len);
   #endif
 }
 
 #endif // SERIAL_DEBUG
 
+#if defined(SERIAL_FAST_CMD)
 /*
- * Process command Rx data
- * - if the command_in data is valid (correct START_FRAME and checksum) copy the command_in to command_out
+ * Returns 1 if the selected input is a serial command port: its targets are then set by usart_fast_command(),
+ * except during the SERIAL_TIMEOUT_ADAPTIVE ramp down
  */
-#if defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)
-void usart_process_command(SerialCommand *command_in, SerialCommand *command_out, uint8_t usart_idx)
-{
-  #ifdef CONTROL_IBUS
-    uint16_t ibus_chksum;
-    if (command_in->start == IBUS_LENGTH && command_in->type == IBUS_COMMAND) {
-      ibus_chksum = 0xFFFF - IBUS_LENGTH - IBUS_COMMAND;
-      for (uint8_t i = 0; i < (IBUS_NUM_CHANNELS * 2); i++) {
-        ibus_chksum -= command_in->channels[i];
-      }
-      if (ibus_chksum == (uint16_t)((command_in->checksumh << 8) + command_in->checksuml)) {
-        *command_out = *command_in;
-        if (usart_idx == 2) {             // Sideboard USART2
-          #ifdef CONTROL_SERIAL_USART2
-          timeoutFlgSerial_L = 0;         // Clear timeout flag
-          timeoutCntSerial_L = 0;         // Reset timeout counter
-          #endif
-        } else if (usart_idx == 3) {      // Sideboard USART3
-          #ifdef CONTROL_SERIAL_USART3
-          timeoutFlgSerial_R = 0;         // Clear timeout flag
-          timeoutCntSerial_R = 0;         // Reset timeout counter
-          #endif
-        }
-      }
-    }
+uint8_t serialFastCmdActive(void) {
+  #ifdef CONTROL_SERIAL_USART2
+  #ifdef SERIAL_TIMEOUT_ADAPTIVE
+  if (inIdx == CONTROL_SERIAL_USART2) { return serialSup_L.scale == 256; }  // the main loop applies the ramp down
   #else
-  if (command_in->start == SERIAL_START_FRAME) {
-    uint32_t checksum = calc_crc32((uint8_t*)command_in,sizeof(SerialCommand)-sizeof(uint16_t)*2);
-    uint32_t checksum_package = (uint32_t)command_in->checksumL | ((uint32_t)command_in->checksumH << 16);
-    if (checksum_package == checksum) {
-      *command_out = *command_in;
-      if (usart_idx == 2) {             // Sideboard USART2
-        #ifdef CONTROL_SERIAL_USART2
-        timeoutFlgSerial_L = 0;         // Clear timeout flag
-        timeoutCntSerial_L = 0;         // Reset timeout counter
-        #endif
-      } else if (usart_idx == 3) {      // Sideboard USART3
-        #ifdef CONTROL_SERIAL_USART3
-        timeoutFlgSerial_R = 0;         // Clear timeout flag
-        timeoutCntSerial_R = 0;         // Reset timeout counter
-        #endif
-      }
-    }
+  if (inIdx == CONTROL_SERIAL_USART2) { return 1; }
+  #endif
+  #endif
+  #ifdef CONTROL_SERIAL_USART3
+  #ifdef SERIAL_TIMEOUT_ADAPTIVE
+  if (inIdx == CONTROL_SERIAL_USART3) { return serialSup_R.scale == 256; }  // the main loop applies the ramp down
+  #else
+  if (inIdx == CONTROL_SERIAL_USART3) { return 1; }
+  #endif
+  #endif
+  return 0;
+}
+
+/*
+ * Low latency command path, called from the Rx interrupt for every valid command frame.
+ * Same chain as the main loop with USE_RAW_INPUT (mixer or tank steering, output inversion), so the
+ * new target reaches the controller in the next PWM period instead of the next main loop.
+ * Only for the selected input and with the motors enabled. The serial timeout is still handled in the
+ * main loop: on a timeout no frames arrive and handleTimeout() requests OPEN_MODE
+ */
+static void usart_fast_command(const SerialCommand *cmd, uint8_t usart_idx) {
+  int16_t steer, speed, l, r;
+
+  #ifdef CONTROL_SERIAL_USART2
+  if (usart_idx == 2 && inIdx != CONTROL_SERIAL_USART2) { return; }
+  #endif
+  #ifdef CONTROL_SERIAL_USART3
+  if (usart_idx == 3 && inIdx != CONTROL_SERIAL_USART3) { return; }
+  #endif
+  if (!enable || timeoutFlgADC || timeoutFlgGen) {
+    return;
   }
+  steer = CLAMP(cmd->steer, INPUT_MIN, INPUT_MAX);    // the mixer input must not overflow when shifted by 4
+  speed = CLAMP(cmd->speed, INPUT_MIN, INPUT_MAX);
+  #ifdef SERIAL_EXT_CMD
+  if ((boardCfg.flags & BCFG_TANK) || serialExtWheel()) {
+  #else
+  if (boardCfg.flags & BCFG_TANK) {
   #endif
+    l = steer;
+    r = speed;
+  } else {
+    mixerFcn(speed << 4, steer << 4, &r, &l);
+  }
+  cmdL = l;
+  cmdR = r;
+  pwmr = boardOutR(r);
+  pwml = boardOutL(l);
+  serialLatApply(usart_idx == 2 ? &serialLat_L : &serialLat_R);
 }
 #endif
 
+#if defined(POS_CTRL)
 /*
- * Process Sideboard Rx data
- * - if the Sideboard_in data is valid (correct START_FRAME and checksum) copy the Sideboard_in to Sideboard_out
+ * PROTO_CMD_POS frame (Rx interrupt): steer / speed are the position targets of the control interrupt. They are zeroed
+ * in the command, so the main loop and SERIAL_FAST_CMD have no target left when a normal frame goes back to CTRL_MOD.
+ * Only the frames of the selected input change the mode
  */
-#if defined(SIDEBOARD_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART3)
-void usart_process_sideboard(SerialSideboard *Sideboard_in, SerialSideboard *Sideboard_out, uint8_t usart_idx)
-{
-  uint16_t checksum;
-  if (Sideboard_in->start == SERIAL_START_FRAME) {
-    checksum = (uint16_t)(Sideboard_in->start ^ Sideboard_in->pitch ^ Sideboard_in->dPitch ^ Sideboard_in->cmd1 ^ Sideboard_in->cmd2 ^ Sideboard_in->sensors);
-    if (Sideboard_in->checksum == checksum) {
-      *Sideboard_out = *Sideboard_in;
-      if (usart_idx == 2) {             // Sideboard USART2
-        #ifdef SIDEBOARD_SERIAL_USART2
-        timeoutCntSerial_L  = 0;        // Reset timeout counter
-        timeoutFlgSerial_L = 0;         // Clear timeout flag
-        #endif
-      } else if (usart_idx == 3) {      // Sideboard USART3
-        #ifdef SIDEBOARD_SERIAL_USART3
-        timeoutCntSerial_R = 0;         // Reset timeout counter
-        timeoutFlgSerial_R = 0;         // Clear timeout flag
-        #endif
-      }
+static void usart_pos_command(SerialCommand *cmd, uint8_t usart_idx) {
+  uint8_t pos = (cmd->caps & PROTO_CMD_POS) != 0;
+  uint8_t sel = 1;
+
+  #ifdef CONTROL_SERIAL_USART2
+  if (usart_idx == 2 && inIdx != CONTROL_SERIAL_USART2) { sel = 0; }
+  #endif
+  #ifdef CONTROL_SERIAL_USART3
+  if (usart_idx == 3 && inIdx != CONTROL_SERIAL_USART3) { sel = 0; }
+  #endif
+  if (sel) {
+    if (pos) {
+      bldc_pos_target(cmd->steer, cmd->speed);
     }
+    posCmd = pos ? inIdx + 1 : 0;
+  }
+  if (pos) {
+    cmd->steer = 0;
+    cmd->speed = 0;
   }
 }
 #endif
 
+#if defined(SERIAL_EXT_CMD)
+/*
+ * Extra fields of a valid ProtoCommandExt frame in the units of the controller, clamped to the parameter ranges.
+ * A mode other than VLT_MODE, SPD_MODE or TRQ_MODE is ignored
+ */
+static void usart_ext_unpack(const uint8_t *frame, BldcExtCmd *ext) {
+  int32_t iMax  = CLAMP(RX_RD16(frame, offsetof(ProtoCommandExt, iMax)), 100, 4000);         // [A*100]
+  int32_t nMax  = CLAMP(RX_RD16(frame, offsetof(ProtoCommandExt, nMax)), 10, 2000);          // [rpm]
+  int32_t fwMax = MIN(RX_RD16(frame, offsetof(ProtoCommandExt, fieldWeakMax)), 2000);       // [A*100]
+  ext->ext          = frame[offsetof(ProtoCommandExt, ext)];
+  ext->ctrlMod      = frame[offsetof(ProtoCommandExt, ctrlMod)];
+  if (ext->ctrlMod < VLT_MODE || ext->ctrlMod > TRQ_MODE) {
+    ext->ext &= ~PROTO_EXT_MODE;
+  }
+  ext->iMax         = (int16_t)(iMax * A2BIT_CONV * 16 / 100);
+  ext->nMax         = (int16_t)(nMax << 4);
+  ext->fieldWeakEna = MIN(frame[offsetof(ProtoCommandExt, fieldWeakEna)], 2);
+  ext->fieldWeakMax = (int16_t)(fwMax * A2BIT_CONV * 16 / 100);
+}
+
+/*
+ * Extra fields of the last frame (Rx interrupt), only from the selected input: PROTO_EXT_WHEEL for the mixing of the
+ * main loop and SERIAL_FAST_CMD, the mode and limits to the control interrupt. A frame without them clears the wheel flag
+ */
+static void usart_ext_command(const BldcExtCmd *ext, uint8_t usart_idx) {
+  #ifdef CONTROL_SERIAL_USART2
+  if (usart_idx == 2 && inIdx != CONTROL_SERIAL_USART2) { return; }
+  #endif
+  #ifdef CONTROL_SERIAL_USART3
+  if (usart_idx == 3 && inIdx != CONTROL_SERIAL_USART3) { return; }
+  #endif
+  extWheel = (ext->ext & PROTO_EXT_WHEEL) ? inIdx + 1 : 0;
+  if (ext->ext & (PROTO_EXT_MODE | PROTO_EXT_I_MAX | PROTO_EXT_N_MAX | PROTO_EXT_FIELD_WEAK)) {
+    bldc_ext_command(ext);
+  }
+}
 
-/* =========================== Sideboard Functions =========================== */
+/* Returns 1 if the last frame of the selected input has left / right wheel targets instead of steer / speed */
+uint8_t serialExtWheel(void) {
+  return extWheel == inIdx + 1;
+}
+#endif
 
+#if defined(SERIAL_BAUD_NEGOTIATION)
 /*
- * Sideboard LEDs Handling
- * This function manages the leds behavior connected to the sideboard
+ * PROTO_CMD_BAUD frame received (Rx interrupt). The rate is accepted if the USART can make it within 2 %,
+ * the next feedback frame acknowledges it and usart_baud_task() switches after that frame is sent
  */
-void sideboardLeds(uint8_t *leds) {
-  #if defined(SIDEBOARD_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART3)
-    // Enable flag: use LED4 (bottom Blue)
-    // enable == 1, turn on led
-    // enable == 0, blink led
-    if (enable) {
-      *leds |= LED4_SET;
-    } else if (!enable && (main_loop_counter % 20 == 0)) {
-      *leds ^= LED4_SET;
-    }
+static void usart_baud_request(SerialBaud *b, uint32_t baud) {
+  uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+  uint32_t brr  = (pclk + baud / 2) / MAX(baud, 1);                   // 1/16 steps of the oversampling 16 divider
 
-    // Backward Drive: use LED5 (upper Blue)
-    // backwardDrive == 1, blink led
-    // backwardDrive == 0, turn off led
-    if (backwardDrive && (main_loop_counter % 50 == 0)) {
-      *leds ^= LED5_SET;
-    }
+  if (b->state != SERIAL_BAUD_IDLE || baud < 9600 || baud > SERIAL_BAUD_MAX || brr < 16) {
+    return;
+  }
+  if ((uint32_t)ABS((int32_t)(pclk / brr) - (int32_t)baud) > baud / 50) {
+    return;
+  }
+  b->req   = baud;
+  b->state = SERIAL_BAUD_ACK;
+}
 
-    // Brake: use LED5 (upper Blue)
-    // brakePressed == 1, turn on led
-    // brakePressed == 0, turn off led
-    #ifdef VARIANT_HOVERCAR
-      if (brakePressed) {
-        *leds |= LED5_SET;
-      } else if (!brakePressed && !backwardDrive) {
-        *leds &= ~LED5_SET;
-      }
-    #endif
+static void usart_baud_set(SerialBaud *b, uint32_t baud) {
+  UART_SetBaud(b->huart, baud);
+  b->baud     = baud;
+  b->good     = b->rx->good;
+  b->err      = b->rx->bad + b->rx->resync;
+  b->goodTick = timeMs();
+}
 
-    // Battery Level Indicator: use LED1, LED2, LED3
-    if (main_loop_counter % BAT_BLINK_INTERVAL == 0) {              //  | RED (LED1) | YELLOW (LED3) | GREEN (LED2) |
-      if (batVoltage < BAT_DEAD) {                                  //  |     0      |       0       |      0       |
-        *leds &= ~LED1_SET & ~LED3_SET & ~LED2_SET;
-      } else if (batVoltage < BAT_LVL1) {                           //  |     B      |       0       |      0       |
-        *leds ^= LED1_SET;
-        *leds &= ~LED3_SET & ~LED2_SET;
-      } else if (batVoltage < BAT_LVL2) {                           //  |     1      |       0       |      0       |
-        *leds |= LED1_SET;
-        *leds &= ~LED3_SET & ~LED2_SET;
-      } else if (batVoltage < BAT_LVL3) {                           //  |     0      |       B       |      0       |
-        *leds ^= LED3_SET;
-        *leds &= ~LED1_SET & ~LED2_SET;
-      } else if (batVoltage < BAT_LVL4) {                           //  |     0      |       1       |      0       |
-        *leds |= LED3_SET;
-        *leds &= ~LED1_SET & ~LED2_SET;
-      } else if (batVoltage < BAT_LVL5) {                           //  |     0      |       0       |      B       |
-        *leds ^= LED2_SET;
-        *leds &= ~LED1_SET & ~LED3_SET;
-      } else {                                                      //  |     0      |       0       |      1       |
-        *leds |= LED2_SET;
-        *leds &= ~LED1_SET & ~LED3_SET;
-      }
+/*
+ * Baud rate negotiation, called by the feedback task when the Tx DMA of the port is idle, right before the
+ * next feedback frame goes out. Returns the caps flags for that frame
+ */
+uint8_t usart_baud_task(SerialBaud *b) {
+  uint32_t now = timeMs();
+
+  if (b->state == SERIAL_BAUD_SWITCH) {                               // the acknowledging frame has been sent
+    usart_baud_set(b, b->req);
+    b->state = SERIAL_BAUD_IDLE;
+  } else if (b->baud != b->base) {
+    if (b->rx->good != b->good) {
+      b->good     = b->rx->good;
+      b->err      = b->rx->bad + b->rx->resync;
+      b->goodTick = now;
+    } else if (b->rx->bad + b->rx->resync - b->err >= SERIAL_BAUD_ERR_BURST || now - b->goodTick > SERIAL_BAUD_FALLBACK) {
+      usart_baud_set(b, b->base);                                     // the controller will try again at the configured rate
+      b->fallbacks++;
     }
+  }
+  if (b->state == SERIAL_BAUD_ACK) {
+    b->state = SERIAL_BAUD_SWITCH;
+    return PROTO_CAP_BAUD;
+  }
+  return 0;
+}
+#endif
 
-    // Error handling
-    // Critical error:  LED1 on (RED)     + high pitch beep (hadled in main)
-    // Soft error:      LED3 on (YELLOW)  + low  pitch beep (hadled in main)
-    if (rtY_Left.z_errCode || rtY_Right.z_errCode) {
-      *leds |= LED1_SET;
-      *leds &= ~LED3_SET & ~LED2_SET;
-    }
-    if (timeoutFlgADC || timeoutFlgSerial) {
-      *leds |= LED3_SET;
-      *leds &= ~LED1_SET & ~LED2_SET;
-    }
+#if defined(TIME_SYNC)
+/*
+ * Reference of a valid command frame (frame processing, PendSV): syncTime is the controller clock at its start bit,
+ * now the board time after the IDLE line. The frame and the IDLE character at the port baud rate are taken off
+ */
+static void usart_sync_ref(const uint8_t *frame, uint32_t now, uint8_t usart_idx) {
+  uint32_t host = RX_RD16(frame, offsetof(SerialCommand, syncTime)) | ((uint32_t)RX_RD16(frame, offsetof(SerialCommand, syncTime) + 2) << 16);
+  uint32_t baud = 0;
+  #ifdef CONTROL_SERIAL_USART2
+  if (usart_idx == 2) { baud = huart2.Init.BaudRate; }
+  #endif
+  #ifdef CONTROL_SERIAL_USART3
+  if (usart_idx == 3) { baud = huart3.Init.BaudRate; }
   #endif
+  if (host && baud) {
+    timeSyncRef(&timeSync, now - (COMMAND_WIRE_LEN(frame) + 1U) * 10U * 1000000U / baud, host);
+  }
+}
+
+/* Board time local in the controller clock, from the main loop. Holds off only PendSV, where the references are taken */
+uint32_t usart_sync_time(uint32_t local) {
+  uint32_t t;
+  uint32_t basepri = __get_BASEPRI();
+  __set_BASEPRI(IRQ_BASEPRI(IRQ_PRIO_DEFERRED));
+  t = timeSyncHost(&timeSync, local);
+  __set_BASEPRI(basepri);
+  return t;
 }
+#endif
 
+#if defined(SERIAL_BUS)
 /*
- * Sideboard Sensor Handling
- * This function manages the sideboards photo sensors.
- * In non-hoverboard variants, the sensors are used as push buttons.
+ * Multi-drop bus: the feedback task leaves its frame in busFb, the frame processing sends it when a bus frame polls
+ * this board. The TX pin is an input except while the answer is on the wire, up to HAL_UART_TxCpltCallback after the
+ * last stop bit, so the other boards can drive the line.
  */
-void sideboardSensors(uint8_t sensors) {
-  #if !defined(VARIANT_HOVERBOARD) && (defined(SIDEBOARD_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART3))
-    static uint8_t sensor1_index;                                 // holds the press index number for sensor1, when used as a button
-    static uint8_t sensor1_prev,  sensor2_prev;
-    uint8_t sensor1_trig = 0, sensor2_trig = 0;
-    #if defined(SIDEBOARD_SERIAL_USART2)
-    uint8_t  sideboardIdx = SIDEBOARD_SERIAL_USART2;
-    uint16_t sideboardSns = Sideboard_L.sensors;
-    #else
-    uint8_t  sideboardIdx = SIDEBOARD_SERIAL_USART3;
-    uint16_t sideboardSns = Sideboard_R.sensors;
-    #endif
+#if defined(CONTROL_SERIAL_USART2)
+  #define BUS_UART                huart2
+  #define BUS_TX_PORT             GPIOA
+  #define BUS_TX_PIN              GPIO_PIN_2
+#else
+  #define BUS_UART                huart3
+  #define BUS_TX_PORT             GPIOB
+  #define BUS_TX_PIN              GPIO_PIN_10
+#endif
+uint8_t busId = BUS_ID;
+static ProtoFeedback busFb;
+static uint8_t busFbReady;                            // busFb holds a frame of the feedback task
+static uint8_t busPolled;                             // the last bus frame polled this board, the next PROTO_CMD_ECHO is for it
+
+static void usart_bus_tx(uint8_t on) {
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+  GPIO_InitStruct.Pin   = BUS_TX_PIN;
+  GPIO_InitStruct.Mode  = on ? GPIO_MODE_AF_PP : GPIO_MODE_INPUT;
+  GPIO_InitStruct.Pull  = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+  HAL_GPIO_Init(BUS_TX_PORT, &GPIO_InitStruct);
+}
 
-    if (inIdx == sideboardIdx) {                                  // Use Sideboard data
-      sensor1_index = 2 + ((sideboardSns & SWB_SET) >> 9);        // SWB on RC transmitter is used to change Control Type
-      if (sensor1_index == 2) {                                   // FOC control Type
-        sensor1_index = (sideboardSns & SWC_SET) >> 11;           // SWC on RC transmitter is used to change Control Mode
-      }
-      sensor1_trig  = sensor1_index != sensor1_prev;              // rising or falling edge change detection
-      if (inIdx != inIdx_prev) {                                  // Force one update at Input idx change
-        sensor1_trig  = 1;
-      }
-      sensor1_prev  = sensor1_index;
-    } else {                                                      // Use Optical switches
-      sensor1_trig  = (sensors & SENSOR1_SET) && !sensor1_prev;   // rising edge detection
-      sensor1_prev  =  sensors & SENSOR1_SET;
-    }
+/* Called by the feedback task, not while the last answer is still being sent. Holds off only PendSV, where the polls are answered */
+void usart_bus_feedback(const ProtoFeedback *fb) {
+  uint32_t basepri = __get_BASEPRI();
+  __set_BASEPRI(IRQ_BASEPRI(IRQ_PRIO_DEFERRED));
+  if (BUS_UART.gState == HAL_UART_STATE_READY) {
+    busFb      = *fb;
+    busFbReady = 1;
+  }
+  __set_BASEPRI(basepri);
+}
 
-    // Control MODE and Control Type Handling
-    if (sensor1_trig) {
-      switch (sensor1_index) {
-        case 0:     // FOC VOLTAGE
-          rtP_Left.z_ctrlTypSel = rtP_Right.z_ctrlTypSel = FOC_CTRL;
-          ctrlModReqRaw         = VLT_MODE;
-          break;
-        case 1:     // FOC SPEED
-          rtP_Left.z_ctrlTypSel = rtP_Right.z_ctrlTypSel = FOC_CTRL;
-          ctrlModReqRaw         = SPD_MODE;
-          break;
-        case 2:     // FOC TORQUE
-          rtP_Left.z_ctrlTypSel = rtP_Right.z_ctrlTypSel = FOC_CTRL;
-          ctrlModReqRaw         = TRQ_MODE;
-          break;
-        case 3:     // SINUSOIDAL
-          rtP_Left.z_ctrlTypSel = rtP_Right.z_ctrlTypSel = SIN_CTRL;
-          break;
-        case 4:     // COMMUTATION
-          rtP_Left.z_ctrlTypSel = rtP_Right.z_ctrlTypSel = COM_CTRL;
-          break;
-      }
-      if (inIdx == inIdx_prev) { beepShortMany(sensor1_index + 1, 1); }
-      if (++sensor1_index > 4) { sensor1_index = 0; }
-    }
+/* Answer a poll from the frame processing (PendSV): cmdSeq, cmdAge, fbTime and syncTime of this frame, then the checksum */
+static void usart_bus_reply(uint16_t seq) {
+  uint32_t checksum;
+  uint32_t now;
+  if (!busFbReady || BUS_UART.gState != HAL_UART_STATE_READY) {
+    return;                                           // no feedback yet or still sending, the controller sees the answer missing
+  }
+  busFb.cmdSeq    = seq;
+  busFb.cmdAge    = 0;
+  now             = timeUs();
+  busFb.fbTime    = (uint16_t)now;
+  #if defined(TIME_SYNC)
+  busFb.syncTime  = timeSyncHost(&timeSync, now);
+  #endif
+  checksum        = calc_crc32((uint8_t *)&busFb, sizeof(busFb) - sizeof(uint16_t)*2);
+  busFb.checksumL = checksum & 0xFFFF;
+  busFb.checksumH = checksum >> 16;
+  usart_bus_tx(1);
+  UART_TxDma(&BUS_UART, (uint8_t *)&busFb, sizeof(busFb));
+}
 
-                                                             // Field Weakening Activation/Deactivation
-      static uint8_t  sensor2_index = 1;                          // holds the press index number for sensor2, when used as a button
+/*
+ * This board's part of a valid bus frame as a SerialCommand (without checksum), for the rest of usart_process_command.
+ * fbEcho is the fbTime of the board polled in the previous frame, PROTO_CMD_ECHO is dropped on the others
+ */
+static const uint8_t *usart_bus_unpack(const uint8_t *frame, SerialCommand *cmd) {
+  uint32_t target = offsetof(ProtoBusCommand, target) + 4U * busId;
+  cmd->start     = PROTO_START_FRAME_BUS;
+  cmd->version   = frame[offsetof(ProtoBusCommand, version)];
+  cmd->caps      = frame[offsetof(ProtoBusCommand, caps)] & (busPolled ? 0xFF : ~PROTO_CMD_ECHO);
+  cmd->steer     = (int16_t)RX_RD16(frame, target);
+  cmd->speed     = (int16_t)RX_RD16(frame, target + 2);
+  cmd->seq       = RX_RD16(frame, offsetof(ProtoBusCommand, seq));
+  cmd->fbEcho    = RX_RD16(frame, offsetof(ProtoBusCommand, fbEcho));
+  cmd->syncTime  = RX_RD16(frame, offsetof(ProtoBusCommand, syncTime)) | ((uint32_t)RX_RD16(frame, offsetof(ProtoBusCommand, syncTime) + 2) << 16);
+  cmd->checksumL = 0;
+  cmd->checksumH = 0;
+  busPolled      = (frame[offsetof(ProtoBusCommand, poll)] == busId);
+  if (busPolled) {
+    usart_bus_reply(cmd->seq);
+  }
+  return (const uint8_t *)cmd;
+}
+#endif
 
-      // Override in case the Sideboard control is Active
+#if !defined(SERIAL_BUS) && (defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3))
+/*
+ * Feedback Tx, double buffered: the feedback task fills the buffer that is not on the wire and sends it right away,
+ * or queues it when the previous frame is still going out. The queued frame starts on the Tx complete of that one,
+ * a newer frame replaces it before that. Nothing is skipped because of a busy DMA, and no buffer changes while the DMA reads it
+ */
+uint8_t *usart_tx_buf(SerialTx *t) {
+  NVIC_DisableIRQ(t->irq);
+  if (t->queued) {                                    // withdraw the queued frame, the new one replaces it
+    t->queued = 0;
+    t->skipped++;
+  }
+  NVIC_EnableIRQ(t->irq);
+  return (uint8_t *)&t->buf[t->tx ^ 1];
+}
+
+void usart_tx_send(SerialTx *t, uint16_t len) {
+  uint8_t next = t->tx ^ 1;
+  #if defined(SERIAL_COBS)
+  len = cobsFrame((uint8_t *)&t->buf[next], len, (uint8_t *)&t->buf[next]);   // the frame on the wire is shorter than the start frame form
+  #endif
+  t->len[next] = len;
+  NVIC_DisableIRQ(t->irq);
+  if (t->huart->gState == HAL_UART_STATE_READY) {
+    t->tx = next;
+    t->sent++;
+    UART_TxDma(t->huart, (uint8_t *)&t->buf[next], len);
+  } else {
+    t->queued = 1;
+  }
+  NVIC_EnableIRQ(t->irq);
+}
+
+/* Nothing on the wire and nothing queued, e.g. for a baud rate switch */
+uint8_t usart_tx_idle(const SerialTx *t) {
+  return !t->queued && t->huart->gState == HAL_UART_STATE_READY;
+}
+
+/* Tx complete (USART IRQ): start the queued frame */
+static void usart_tx_done(SerialTx *t) {
+  if (t->queued) {
+    t->queued = 0;
+    t->tx    ^= 1;
+    t->sent++;
+    t->late++;
+    UART_TxDma(t->huart, (uint8_t *)&t->buf[t->tx], t->len[t->tx]);
+  }
+}
+#endif
+
+#if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3) || defined(SERIAL_BUS) || defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3)
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+  #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
+  if (huart == &DEBUG_UART) {
+    debugTxDone();
+  }
+  #endif
+  #if defined(FEEDBACK_SERIAL_USART2) && !defined(SERIAL_BUS)
+  if (huart == &huart2) {
+    usart_tx_done(&fbTx_L);
+  }
+  #endif
+  #if defined(FEEDBACK_SERIAL_USART3) && !defined(SERIAL_BUS)
+  if (huart == &huart3) {
+    usart_tx_done(&fbTx_R);
+  }
+  #endif
+  #if defined(SERIAL_BUS)
+  if (huart == &BUS_UART) {
+    usart_bus_tx(0);                                  // last stop bit sent: release the line
+  }
+  #endif
+}
+#endif
+
+/*
+ * Process command Rx data
+ * - if the frame is valid (correct START_FRAME and checksum) copy it to command_out
+ * - returns 1 if the frame was valid
+ */
+#if defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)
+static uint8_t usart_command_apply(const uint8_t *frame, uint8_t valid, SerialCommand *command_out, uint8_t usart_idx);
+
+uint8_t usart_process_command(const uint8_t *frame, SerialCommand *command_out, uint8_t usart_idx)
+{
+  uint8_t valid = 0;
+  #ifdef CONTROL_IBUS
+    // One pass over the frame: checksum and channel decode together, the channels are published only if the frame is valid
+    uint16_t ch[IBUS_NUM_CHANNELS];
+    if (frame[offsetof(SerialCommand, start)] == IBUS_LENGTH && frame[offsetof(SerialCommand, type)] == IBUS_COMMAND) {
+      const uint8_t *p     = &frame[offsetof(SerialCommand, channels)];
+      uint16_t ibus_chksum = 0xFFFF - IBUS_LENGTH - IBUS_COMMAND;
+      for (uint8_t i = 0; i < IBUS_NUM_CHANNELS; i++, p += 2) {
+        ibus_chksum -= p[0] + p[1];
+        ch[i] = (uint16_t)CLAMP(p[0] + (p[1] << 8) - 1000, 0, 1000);   // 1000-2000 us -> 0-1000
+      }
+      valid = (ibus_chksum == RX_RD16(frame, offsetof(SerialCommand, checksuml)));
+    }
+    if (valid) {
+      #ifdef CONTROL_SERIAL_USART2
+      if (usart_idx == 2) { memcpy(ibusCh_L, ch, sizeof(ch)); }
+      #endif
+      #ifdef CONTROL_SERIAL_USART3
+      if (usart_idx == 3) { memcpy(ibusCh_R, ch, sizeof(ch)); }
+      #endif
+    }
+  #else
+  uint16_t start = RX_RD16(frame, 0);
+  #if defined(SERIAL_HW_CRC)
+  uint8_t hwCrc = (start == SERIAL_START_FRAME_HWCRC);
+  if (start == SERIAL_START_FRAME || hwCrc) {
+    uint32_t checksum = hwCrc ? calc_crc32_hw(frame,sizeof(SerialCommand)-sizeof(uint16_t)*2)
+                              : calc_crc32(frame,sizeof(SerialCommand)-sizeof(uint16_t)*2);
+  #else
+  if (start == COMMAND_START_FRAME || start == COMMAND_START_FRAME_ALT) {
+    uint32_t checksum = calc_crc32(frame,COMMAND_FRAME_LEN(frame)-sizeof(uint16_t)*2);
+  #endif
+    uint32_t checksum_package = (uint32_t)RX_RD16(frame, COMMAND_FRAME_LEN(frame)-4) | ((uint32_t)RX_RD16(frame, COMMAND_FRAME_LEN(frame)-2) << 16);
+    valid = (checksum_package == checksum);
+  }
+  #endif
+  return usart_command_apply(frame, valid, command_out, usart_idx);
+}
+
+#if defined(SERIAL_COBS)
+/*
+ * Process a COBS command frame of len bytes without the delimiter (SERIAL_COBS)
+ * - decoded in enc and converted to the start frame form in raw (max bytes), then taken as by usart_process_command
+ * - returns 1 if the frame was valid
+ */
+uint8_t usart_process_cobs(uint8_t *enc, uint16_t len, uint8_t *raw, uint16_t max, SerialCommand *command_out, uint8_t usart_idx)
+{
+  uint16_t n     = cobsUnframe(enc, len, raw, max);
+  uint16_t start = RX_RD16(raw, 0);
+  uint8_t  valid = n != 0 && (start == COMMAND_START_FRAME || start == COMMAND_START_FRAME_ALT) && n == COMMAND_FRAME_LEN(raw);
+  return usart_command_apply(raw, valid, command_out, usart_idx);
+}
+#endif
+
+/*
+ * Command frame with a checked checksum: protocol version, hold / latch, then the target and the timeout
+ * - returns 1 if the frame was valid
+ */
+static uint8_t usart_command_apply(const uint8_t *frame, uint8_t valid, SerialCommand *command_out, uint8_t usart_idx)
+{
+  #ifdef SERIAL_EXT_CMD
+  BldcExtCmd ext = {0};
+  #endif
+  #ifdef SERIAL_HW_CRC
+  uint8_t hwCrc = (RX_RD16(frame, 0) == SERIAL_START_FRAME_HWCRC);
+  #endif
+  #ifndef CONTROL_IBUS
+  if (valid && frame[offsetof(SerialCommand, version)] != PROTO_VERSION) {
+    valid = 0;                        // Intact frame of another protocol version, count it apart from line errors
+    #ifdef CONTROL_SERIAL_USART2
+    if (usart_idx == 2) { rxFrame_L.version++; }
+    #endif
+    #ifdef CONTROL_SERIAL_USART3
+    if (usart_idx == 3) { rxFrame_R.version++; }
+    #endif
+  }
+  #endif
+  #ifdef SERIAL_BUS
+  SerialCommand busCmd;
+  if (valid) {
+    frame = usart_bus_unpack(frame, &busCmd);
+  }
+  #endif
+  #ifdef SERIAL_EXT_CMD
+  if (valid && RX_RD16(frame, 0) == PROTO_START_FRAME_EXT) {
+    usart_ext_unpack(frame, &ext);
+  }
+  #endif
+  #ifndef CONTROL_IBUS
+  if (valid) {
+    SerialCommand *hold = (usart_idx == 2) ? &commandL_hold : &commandR_hold;
+    uint8_t *held       = (usart_idx == 2) ? &commandL_held : &commandR_held;
+    SerialLatency *lat  = (usart_idx == 2) ? &serialLat_L : &serialLat_R;
+    uint8_t flags       = frame[offsetof(SerialCommand, caps)];
+    uint32_t now        = timeUs();
+    #ifdef TIME_SYNC
+    usart_sync_ref(frame, now, usart_idx);
+    #endif
+    if (flags & PROTO_CMD_ECHO) {
+      serialLatUpdate(&lat->rtt, (uint16_t)((uint16_t)now - RX_RD16(frame, offsetof(SerialCommand, fbEcho))));
+    }
+    #ifdef FEEDBACK_COMPACT
+    *(usart_idx == 2 ? &serialFbCompact_L : &serialFbCompact_R) = (flags & PROTO_CMD_FB_COMPACT) != 0;
+    #endif
+    #if defined(TRIP_STATS) && !defined(SERIAL_BUS) && (defined(FEEDBACK_SERIAL_USART2) || defined(FEEDBACK_SERIAL_USART3))
+    if (flags & PROTO_CMD_TRIP) {
+      *(usart_idx == 2 ? &serialTripReq_L : &serialTripReq_R) = 1;
+    }
+    #endif
+    if (usart_idx == 2) {
+      serialSeq_L     = RX_RD16(frame, offsetof(SerialCommand, seq));
+      serialSeqTick_L = timeMs();
+    } else {
+      serialSeq_R     = RX_RD16(frame, offsetof(SerialCommand, seq));
+      serialSeqTick_R = timeMs();
+    }
+    #ifdef SERIAL_BAUD_NEGOTIATION
+    if (flags & PROTO_CMD_BAUD) {
+      uint32_t baud = (uint32_t)RX_RD16(frame, offsetof(SerialCommand, speed)) * 100U;
+      #ifdef CONTROL_SERIAL_USART2
+      if (usart_idx == 2) { usart_baud_request(&serialBaud_L, baud); }
+      #endif
+      #ifdef CONTROL_SERIAL_USART3
+      if (usart_idx == 3) { usart_baud_request(&serialBaud_R, baud); }
+      #endif
+      return valid;                   // Counted as a good frame, the target and the timeout are not changed
+    }
+    #endif
+    if (flags & PROTO_CMD_HOLD) {
+      memcpy((uint8_t *)hold, frame, sizeof(SerialCommand));
+      #ifdef SERIAL_EXT_CMD
+      *(usart_idx == 2 ? &commandL_holdExt : &commandR_holdExt) = ext;
+      #endif
+      *held = 1;
+      return valid;                   // Counted as a good frame, but the target and the timeout wait for the latch
+    }
+    if (flags & PROTO_CMD_LATCH) {
+      if (!*held) {
+        return valid;                 // Nothing held, e.g. the hold frame was lost: keep the previous target
+      }
+      frame = (const uint8_t *)hold;
+      *held = 0;
+      #ifdef SERIAL_EXT_CMD
+      ext   = *(usart_idx == 2 ? &commandL_holdExt : &commandR_holdExt);
+      #endif
+      #ifdef CONTROL_SERIAL_USART2
+      if (usart_idx == 2) { rxFrame_L.latch++; }
+      #endif
+      #ifdef CONTROL_SERIAL_USART3
+      if (usart_idx == 3) { rxFrame_R.latch++; }
+      #endif
+    }
+    lat->rxUs    = now;
+    lat->pending = 1;
+  }
+  #endif
+  if (valid) {
+    memcpy((uint8_t *)command_out, frame, sizeof(SerialCommand));
+    #ifdef POS_CTRL
+    usart_pos_command(command_out, usart_idx);
+    #endif
+    #ifdef SERIAL_EXT_CMD
+    uint32_t basepri = __get_BASEPRI();
+    __set_BASEPRI(IRQ_BASEPRI(IRQ_PRIO_CONTROL));     // mode, limits and fast targets reach the same control tick
+    usart_ext_command(&ext, usart_idx);
+    #endif
+    #ifdef SERIAL_FAST_CMD
+    usart_fast_command(command_out, usart_idx);
+    #endif
+    #ifdef SERIAL_EXT_CMD
+    __set_BASEPRI(basepri);
+    #endif
+    if (usart_idx == 2) {             // Sideboard USART2
+      #ifdef CONTROL_SERIAL_USART2
+      timeoutFlgSerial_L = 0;         // Clear timeout flag
+      timeoutCntSerial_L = 0;         // Reset timeout counter
+      #ifdef SERIAL_TIMEOUT_ADAPTIVE
+      serialSupFrame(&serialSup_L);
+      #endif
+      #endif
+      #ifdef SERIAL_HW_CRC
+      serialHwCrc_L = hwCrc;          // Answer feedback in the same format
+      #endif
+    } else if (usart_idx == 3) {      // Sideboard USART3
+      #ifdef CONTROL_SERIAL_USART3
+      timeoutFlgSerial_R = 0;         // Clear timeout flag
+      timeoutCntSerial_R = 0;         // Reset timeout counter
+      #ifdef SERIAL_TIMEOUT_ADAPTIVE
+      serialSupFrame(&serialSup_R);
+      #endif
+      #endif
+      #ifdef SERIAL_HW_CRC
+      serialHwCrc_R = hwCrc;          // Answer feedback in the same format
+      #endif
+    }
+  }
+  return valid;
+}
+#endif
+
+/*
+ * Process Sideboard Rx data
+ * - v1 frames (SERIAL_START_FRAME, XOR checksum) are copied to Sideboard_out as they are
+ * - v2 frames (PROTO_SB_START_FRAME, CRC, seq) are decoded into the same fields, seq gaps are counted as lost frames
+ * - returns 1 if the frame was valid
+ */
+#if defined(SIDEBOARD_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART3)
+uint8_t usart_process_sideboard(const uint8_t *frame, SerialSideboard *Sideboard_out, uint8_t usart_idx)
+{
+  uint16_t checksum;
+  uint8_t  valid = 0;
+  SerialRx *rx   = NULL;
+  #ifdef SIDEBOARD_SERIAL_USART2
+  if (usart_idx == 2) { rx = &rxFrame_L; }
+  #endif
+  #ifdef SIDEBOARD_SERIAL_USART3
+  if (usart_idx == 3) { rx = &rxFrame_R; }
+  #endif
+  if (RX_RD16(frame, 0) == PROTO_SB_START_FRAME) {
+    uint8_t  caps = frame[offsetof(ProtoSideboard, caps)];
+    uint32_t checksum_package = (uint32_t)RX_RD16(frame, offsetof(ProtoSideboard, checksumL)) | ((uint32_t)RX_RD16(frame, offsetof(ProtoSideboard, checksumH)) << 16);
+    #if defined(SERIAL_HW_CRC)
+    valid = (checksum_package == ((caps & PROTO_SB_CAP_HW_CRC) ? calc_crc32_hw(frame, offsetof(ProtoSideboard, checksumL))
+                                                               : calc_crc32(frame, offsetof(ProtoSideboard, checksumL))));
+    #else
+    valid = !(caps & PROTO_SB_CAP_HW_CRC) && checksum_package == calc_crc32(frame, offsetof(ProtoSideboard, checksumL));  // Hardware CRC frames need SERIAL_HW_CRC
+    #endif
+    if (valid && frame[offsetof(ProtoSideboard, version)] != PROTO_SB_VERSION) {
+      valid = 0;                      // Intact frame of another sideboard version, count it apart from line errors
+      rx->version++;
+    }
+    if (valid) {
+      uint16_t seq = RX_RD16(frame, offsetof(ProtoSideboard, seq));
+      if (rx->sbV2) {
+        rx->lost += (uint16_t)(seq - rx->seq - 1);
+      }
+      rx->seq    = seq;
+      rx->sbCaps = caps;
+      rx->sbV2   = 1;
+      Sideboard_out->start    = SERIAL_START_FRAME;
+      Sideboard_out->pitch    = (int16_t)RX_RD16(frame, offsetof(ProtoSideboard, pitch));
+      Sideboard_out->dPitch   = (int16_t)RX_RD16(frame, offsetof(ProtoSideboard, dPitch));
+      Sideboard_out->cmd1     = (int16_t)RX_RD16(frame, offsetof(ProtoSideboard, cmd1));
+      Sideboard_out->cmd2     = (int16_t)RX_RD16(frame, offsetof(ProtoSideboard, cmd2));
+      Sideboard_out->sensors  = RX_RD16(frame, offsetof(ProtoSideboard, sensors));
+      Sideboard_out->checksum = 0;
+    }
+  } else if (RX_RD16(frame, 0) == SERIAL_START_FRAME) {
+    checksum = 0;
+    for (uint8_t i = 0; i < sizeof(SerialSideboard) - sizeof(uint16_t); i += 2) {
+      checksum ^= RX_RD16(frame, i);  // start ^ pitch ^ dPitch ^ cmd1 ^ cmd2 ^ sensors
+    }
+    valid = (RX_RD16(frame, sizeof(SerialSideboard) - sizeof(uint16_t)) == checksum);
+    if (valid) {
+      memcpy((uint8_t *)Sideboard_out, frame, sizeof(SerialSideboard));
+      rx->sbCaps = 0;
+      rx->sbV2   = 0;
+    }
+  }
+  if (valid) {
+    if (usart_idx == 2) {             // Sideboard USART2
+      #ifdef SIDEBOARD_SERIAL_USART2
+      timeoutCntSerial_L  = 0;        // Reset timeout counter
+      timeoutFlgSerial_L = 0;         // Clear timeout flag
+      #ifdef SERIAL_TIMEOUT_ADAPTIVE
+      serialSupFrame(&serialSup_L);
+      #endif
+      #endif
+    } else if (usart_idx == 3) {      // Sideboard USART3
+      #ifdef SIDEBOARD_SERIAL_USART3
+      timeoutCntSerial_R = 0;         // Reset timeout counter
+      timeoutFlgSerial_R = 0;         // Clear timeout flag
+      #ifdef SERIAL_TIMEOUT_ADAPTIVE
+      serialSupFrame(&serialSup_R);
+      #endif
+      #endif
+    }
+  }
+  return valid;
+}
+#endif
+
+
+/* =========================== Sideboard Functions =========================== */
+
+#if defined(SIDEBOARD_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART3)
+// Sideboard LED patterns: on for `on` ticks, then off for `off` ticks of the sideboard task (DELAY_IN_MAIN_LOOP)
+enum sideboardLedPatterns {LED_PAT_OFF, LED_PAT_ON, LED_PAT_BLINK_FAST, LED_PAT_BLINK_SLOW, LED_PAT_BLINK_BAT};
+typedef struct {
+  uint16_t on;
+  uint16_t off;
+} LedPattern;
+static const LedPattern ledPatterns[] = {
+  [LED_PAT_OFF]        = {0,  1},
+  [LED_PAT_ON]         = {1,  0},
+  [LED_PAT_BLINK_FAST] = {20, 20},
+  [LED_PAT_BLINK_SLOW] = {50, 50},
+  [LED_PAT_BLINK_BAT]  = {BAT_BLINK_INTERVAL, BAT_BLINK_INTERVAL},
+};
+#define SIDEBOARD_LEDS  5                                 // LED1 .. LED5, bit k of the LED byte is LED k+1
+static uint8_t  ledPat[SIDEBOARD_LEDS];                   // current pattern per LED
+static uint16_t ledPhase[SIDEBOARD_LEDS];                 // [ticks] position in the pattern, restarts on a pattern change
+#endif
+
+/*
+ * Battery level of the LEDs, the beeps and the undervoltage poweroff
+ */
+#if defined(BAT_SOC_ENABLE)
+BatSoc batSoc;
+
+/* Start the state of charge estimation from the saved charge, called at power on with a settled battery voltage */
+void batSocLoad(void) {
+  uint16_t stored = BAT_SOC_NONE, storedR = BAT_SOC_NONE;
+  #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+  if (EE_ReadVariable(VirtAddVarTab[EE_ADDR_BAT    ], &stored))  stored  = BAT_SOC_NONE;
+  if (EE_ReadVariable(VirtAddVarTab[EE_ADDR_BAT + 1], &storedR)) storedR = BAT_SOC_NONE;
+  #endif
+  batVoltageCalib = (int16_t)((int32_t)batVoltage * BAT_CALIB_REAL_VOLTAGE / BAT_CALIB_ADC);
+  batSocInit(&batSoc, batVoltageCalib, stored, storedR);
+}
+#endif
+
+uint8_t batLevel(void) {
+  #if defined(BAT_SOC_ENABLE)
+  return batSocLevel(&batSoc);
+  #else
+  if (batVoltage < BAT_DEAD) return BAT_LEVEL_DEAD;
+  if (batVoltage < BAT_LVL1) return BAT_LEVEL_1;
+  if (batVoltage < BAT_LVL2) return BAT_LEVEL_2;
+  if (batVoltage < BAT_LVL3) return BAT_LEVEL_3;
+  if (batVoltage < BAT_LVL4) return BAT_LEVEL_4;
+  if (batVoltage < BAT_LVL5) return BAT_LEVEL_5;
+  return BAT_LEVEL_FULL;
+  #endif
+}
+
+/*
+ * Sideboard LEDs Handling
+ * This function manages the leds behavior connected to the sideboard. Called once per sideboard task tick,
+ * it selects a pattern per LED from the board state and returns the LED byte (LEDx_SET bits)
+ */
+uint8_t sideboardLeds(void) {
+  uint8_t leds = 0;
+  #if defined(SIDEBOARD_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART3)
+    uint8_t pat[SIDEBOARD_LEDS] = {LED_PAT_OFF, LED_PAT_OFF, LED_PAT_OFF, LED_PAT_OFF, LED_PAT_OFF};
+
+    // Enable flag: use LED4 (bottom Blue)
+    // enable == 1, turn on led
+    // enable == 0, blink led
+    pat[3] = enable ? LED_PAT_ON : LED_PAT_BLINK_FAST;
+
+    // Backward Drive: use LED5 (upper Blue)
+    // backwardDrive == 1, blink led
+    // backwardDrive == 0, turn off led
+    pat[4] = backwardDrive ? LED_PAT_BLINK_SLOW : LED_PAT_OFF;
+
+    // Brake: use LED5 (upper Blue)
+    // brakePressed == 1, turn on led
+    #ifdef VARIANT_HOVERCAR
+      if (brakePressed) {
+        pat[4] = LED_PAT_ON;
+      }
+    #endif
+
+    // Battery Level Indicator: use LED1, LED2, LED3                //  | RED (LED1) | YELLOW (LED3) | GREEN (LED2) |
+    uint8_t bat = batLevel();
+    if (bat == BAT_LEVEL_DEAD) {                                    //  |     0      |       0       |      0       |
+    } else if (bat == BAT_LEVEL_1) {                                //  |     B      |       0       |      0       |
+      pat[0] = LED_PAT_BLINK_BAT;
+    } else if (bat == BAT_LEVEL_2) {                                //  |     1      |       0       |      0       |
+      pat[0] = LED_PAT_ON;
+    } else if (bat == BAT_LEVEL_3) {                                //  |     0      |       B       |      0       |
+      pat[2] = LED_PAT_BLINK_BAT;
+    } else if (bat == BAT_LEVEL_4) {                                //  |     0      |       1       |      0       |
+      pat[2] = LED_PAT_ON;
+    } else if (bat == BAT_LEVEL_5) {                                //  |     0      |       0       |      B       |
+      pat[1] = LED_PAT_BLINK_BAT;
+    } else {                                                        //  |     0      |       0       |      1       |
+      pat[1] = LED_PAT_ON;
+    }
+
+    // Error handling
+    // Critical error:  LED1 on (RED)     + high pitch beep (hadled in main)
+    // Soft error:      LED3 on (YELLOW)  + low  pitch beep (hadled in main)
+    if (rtY_Left.z_errCode || rtY_Right.z_errCode) {
+      pat[0] = LED_PAT_ON;
+      pat[1] = pat[2] = LED_PAT_OFF;
+    }
+    if (timeoutFlgADC || timeoutFlgSerial) {
+      pat[2] = LED_PAT_ON;
+      pat[0] = pat[1] = LED_PAT_OFF;
+    }
+
+    // Pattern engine: advance each LED by one tick
+    for (uint8_t k = 0; k < SIDEBOARD_LEDS; k++) {
+      const LedPattern *p = &ledPatterns[pat[k]];
+      if (pat[k] != ledPat[k]) {
+        ledPat[k]   = pat[k];
+        ledPhase[k] = 0;
+      } else if (++ledPhase[k] >= p->on + p->off) {
+        ledPhase[k] = 0;
+      }
+      if (ledPhase[k] < p->on) {
+        leds |= (uint8_t)(1U << k);
+      }
+    }
+  #endif
+  return leds;
+}
+
+/*
+ * Sideboard Sensor Handling
+ * This function manages the sideboards photo sensors.
+ * In non-hoverboard variants, the sensors are used as push buttons.
+ */
+void sideboardSensors(uint8_t sensors) {
+  #if !defined(VARIANT_HOVERBOARD) && (defined(SIDEBOARD_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART3))
+    static uint8_t sensor1_index;                                 // holds the press index number for sensor1, when used as a button
+    static uint8_t sensor1_prev,  sensor2_prev;
+    uint8_t sensor1_trig = 0, sensor2_trig = 0;
+    #if defined(SIDEBOARD_SERIAL_USART2)
+    uint8_t  sideboardIdx = SIDEBOARD_SERIAL_USART2;
+    uint16_t sideboardSns = Sideboard_L.sensors;
+    #else
+    uint8_t  sideboardIdx = SIDEBOARD_SERIAL_USART3;
+    uint16_t sideboardSns = Sideboard_R.sensors;
+    #endif
+
+    if (inIdx == sideboardIdx) {                                  // Use Sideboard data
+      sensor1_index = 2 + ((sideboardSns & SWB_SET) >> 9);        // SWB on RC transmitter is used to change Control Type
+      if (sensor1_index == 2) {                                   // FOC control Type
+        sensor1_index = (sideboardSns & SWC_SET) >> 11;           // SWC on RC transmitter is used to change Control Mode
+      }
+      sensor1_trig  = sensor1_index != sensor1_prev;              // rising or falling edge change detection
+      if (inIdx != inIdx_prev) {                                  // Force one update at Input idx change
+        sensor1_trig  = 1;
+      }
+      sensor1_prev  = sensor1_index;
+    } else {                                                      // Use Optical switches
+      sensor1_trig  = (sensors & SENSOR1_SET) && !sensor1_prev;   // rising edge detection
+      sensor1_prev  =  sensors & SENSOR1_SET;
+    }
+
+    // Control MODE and Control Type Handling
+    #if !defined(CTRL_FIXED)
+    if (sensor1_trig) {
+      switch (sensor1_index) {
+        case 0:     // FOC VOLTAGE
+          rtP_Left.z_ctrlTypSel = rtP_Right.z_ctrlTypSel = FOC_CTRL;
+          ctrlModReqRaw         = VLT_MODE;
+          break;
+        case 1:     // FOC SPEED
+          rtP_Left.z_ctrlTypSel = rtP_Right.z_ctrlTypSel = FOC_CTRL;
+          ctrlModReqRaw         = SPD_MODE;
+          break;
+        case 2:     // FOC TORQUE
+          rtP_Left.z_ctrlTypSel = rtP_Right.z_ctrlTypSel = FOC_CTRL;
+          ctrlModReqRaw         = TRQ_MODE;
+          break;
+        case 3:     // SINUSOIDAL
+          rtP_Left.z_ctrlTypSel = rtP_Right.z_ctrlTypSel = SIN_CTRL;
+          break;
+        case 4:     // COMMUTATION
+          rtP_Left.z_ctrlTypSel = rtP_Right.z_ctrlTypSel = COM_CTRL;
+          break;
+      }
+      if (inIdx == inIdx_prev) { beepShortMany(sensor1_index + 1, 1); }
+      if (++sensor1_index > 4) { sensor1_index = 0; }
+    }
+    #endif
+
+                                                             // Field Weakening Activation/Deactivation
+      static uint8_t  sensor2_index = 1;                          // holds the press index number for sensor2, when used as a button
+
+      // Override in case the Sideboard control is Active
       if (inIdx == sideboardIdx) {                                // Use Sideboard data
         sensor2_index = (sideboardSns & SWD_SET) >> 13;           // SWD on RC transmitter is used to Activate/Deactivate Field Weakening
         sensor2_trig  = sensor2_index != sensor2_prev;            // rising or falling edge change detection
@@ -1449,7 +2751,11 @@ void sideboardSensors(uint8_t sensors) {
         sensor2_prev  =  sensors & SENSOR2_SET;
       }
 
-      #ifdef CRUISE_CONTROL_SUPPORT                                 // Cruise Control Activation/Deactivation
+      #if defined(DRIVE_PROFILE_BUTTON)                             // Drive profile selection, taken over at standstill
+        if (sensor2_trig) {
+          driveProfileReq = inIdx == sideboardIdx ? MIN(sensor2_index, DRIVE_PROFILES - 1) : (driveProfile + 1) % DRIVE_PROFILES;
+        }
+      #elif defined(CRUISE_CONTROL_SUPPORT)                         // Cruise Control Activation/Deactivation
         if (sensor2_trig) {
           cruiseControl(sensor2_trig);
         }
@@ -1482,265 +2788,717 @@ void sideboardSensors(uint8_t sensors) {
  * Save Configuration to Flash
  * This function makes sure data is not lost after power-off
  */
+#if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+/* Write the input limits and the current / speed limits through the EEPROM cache, only the changed words reach the flash */
+static void saveInputConfig(void) {
+  #if defined(DEBUG_OUT)
+    printf("Saving configuration to EEprom\r\n");
+  #endif
+
+  #if defined(DEBUG_SERIAL_PROTOCOL) && defined(DEBUG_OUT)
+  saveAllParamVal();                              // Keeps the schema and CRC words consistent with the values
+  #else
+  EE_WriteVariable(VirtAddVarTab[0] , (uint16_t)FLASH_WRITE_KEY);
+  EE_WriteVariable(VirtAddVarTab[1] , (uint16_t)rtP_Left.i_max);
+  EE_WriteVariable(VirtAddVarTab[2] , (uint16_t)rtP_Left.n_max);
+  for (uint8_t i=0; i<INPUTS_NR; i++) {
+    EE_WriteVariable(VirtAddVarTab[ 3+8*i] , (uint16_t)input1[i].typ);
+    EE_WriteVariable(VirtAddVarTab[ 4+8*i] , (uint16_t)input1[i].min);
+    EE_WriteVariable(VirtAddVarTab[ 5+8*i] , (uint16_t)input1[i].mid);
+    EE_WriteVariable(VirtAddVarTab[ 6+8*i] , (uint16_t)input1[i].max);
+    EE_WriteVariable(VirtAddVarTab[ 7+8*i] , (uint16_t)input2[i].typ);
+    EE_WriteVariable(VirtAddVarTab[ 8+8*i] , (uint16_t)input2[i].min);
+    EE_WriteVariable(VirtAddVarTab[ 9+8*i] , (uint16_t)input2[i].mid);
+    EE_WriteVariable(VirtAddVarTab[10+8*i] , (uint16_t)input2[i].max);
+  }
+  HAL_FLASH_Unlock();
+  EE_Commit();                                    // Writes only the changed values, at most one page transfer
+  HAL_FLASH_Lock();
+  #endif
+  inp_cal_valid = cur_spd_valid = 0;
+}
+#endif
+
 void saveConfig() {
   #ifdef VARIANT_TRANSPOTTER
     if (saveValue_valid) {
-      HAL_FLASH_Unlock();
       EE_WriteVariable(VirtAddVarTab[0], saveValue);
+      HAL_FLASH_Unlock();
+      EE_Commit();
       HAL_FLASH_Lock();
     }
   #endif
   #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
     if (inp_cal_valid || cur_spd_valid) {
-      #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
-        printf("Saving configuration to EEprom\r\n");
-      #endif
-
-      HAL_FLASH_Unlock();
-      EE_WriteVariable(VirtAddVarTab[0] , (uint16_t)FLASH_WRITE_KEY);
-      EE_WriteVariable(VirtAddVarTab[1] , (uint16_t)rtP_Left.i_max);
-      EE_WriteVariable(VirtAddVarTab[2] , (uint16_t)rtP_Left.n_max);
-      for (uint8_t i=0; i<INPUTS_NR; i++) {
-        EE_WriteVariable(VirtAddVarTab[ 3+8*i] , (uint16_t)input1[i].typ);
-        EE_WriteVariable(VirtAddVarTab[ 4+8*i] , (uint16_t)input1[i].min);
-        EE_WriteVariable(VirtAddVarTab[ 5+8*i] , (uint16_t)input1[i].mid);
-        EE_WriteVariable(VirtAddVarTab[ 6+8*i] , (uint16_t)input1[i].max);
-        EE_WriteVariable(VirtAddVarTab[ 7+8*i] , (uint16_t)input2[i].typ);
-        EE_WriteVariable(VirtAddVarTab[ 8+8*i] , (uint16_t)input2[i].min);
-        EE_WriteVariable(VirtAddVarTab[ 9+8*i] , (uint16_t)input2[i].mid);
-        EE_WriteVariable(VirtAddVarTab[10+8*i] , (uint16_t)input2[i].max);
+      saveInputConfig();
+    }
+    #if defined(CALIBRATION_ADAPTIVE)
+      // Save the ADC offsets for the next warm start, only if they moved noticeably to spare the flash
+      uint8_t calibSave = adcCalib.done && !adcCalib.warmValid;
+      for (uint8_t i = 0; i < CALIB_CH && adcCalib.done; i++) {
+        if (ABS((int16_t)adcCalib.offset[i] - (int16_t)adcCalib.warm[i]) > CALIBRATION_WARM_TOL / 2) calibSave = 1;
+      }
+      if (calibSave) {
+        for (uint8_t i = 0; i < CALIB_CH; i++) {
+          EE_WriteVariable(VirtAddVarTab[EE_ADDR_CALIB + i], adcCalib.offset[i]);
+        }
+        HAL_FLASH_Unlock();
+        EE_Commit();
+        HAL_FLASH_Lock();
       }
+    #endif
+    #if defined(BAT_SOC_ENABLE)
+      EE_WriteVariable(VirtAddVarTab[EE_ADDR_BAT    ], batSocStored(&batSoc));
+      EE_WriteVariable(VirtAddVarTab[EE_ADDR_BAT + 1], batSoc.rInt);
+      HAL_FLASH_Unlock();
+      EE_Commit();                                    // At most the two changed words
       HAL_FLASH_Lock();
-    }
+    #endif
+    #if defined(SELF_TEST)
+      uint16_t selfTestWord = selfTestCache(&selfTest);
+      if (selfTestWord != selfTest.cached) {          // Only when the board turned healthy or had a fault
+        EE_WriteVariable(VirtAddVarTab[EE_ADDR_SELFTEST], selfTestWord);
+        HAL_FLASH_Unlock();
+        EE_Commit();
+        HAL_FLASH_Lock();
+      }
+    #endif
   #endif 
 }
 
 
-void poweroff(void) {
-  enable = 0;
-  #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
-  printf("-- Motors disabled --\r\n");
-  #endif
-  buzzerCount = 0;  // prevent interraction with beep counter
-  buzzerPattern = 0;
-  for (int i = 0; i < 8; i++) {
-    buzzerFreq = (uint8_t)i;
-    HAL_Delay(100);
+#if defined(HALL_CALIB)
+/*
+ * Hall edge corrections (HALL_CALIB): 6 words per motor from EE_ADDR_HALL, deg*64 as int16.
+ * A motor without stored words, or with an implausible one, keeps the nominal edges
+ */
+void hallCalLoad(void) {
+  P *p[2] = {&rtP_Left, &rtP_Right};
+  uint16_t val;
+  for (uint8_t m = 0; m < 2; m++) {
+    int16_t corr[6];
+    uint8_t valid = 1;
+    for (uint8_t k = 0; k < 6; k++) {
+      if (EE_ReadVariable(VirtAddVarTab[EE_ADDR_HALL + 6 * m + k], &val) || ABS((int16_t)val) > HALL_CAL_CORR_MAX) valid = 0;
+      corr[k] = (int16_t)val;
+    }
+    for (uint8_t k = 0; k < 6 && valid; k++) {
+      p[m]->a_hallCorr[k] = corr[k];
+    }
   }
-  saveConfig();
-  HAL_GPIO_WritePin(OFF_PORT, OFF_PIN, GPIO_PIN_RESET);
-  while(1) {}
 }
 
+/* Save the corrections of the motors whose calibration succeeded, done = 1 << motor */
+void hallCalSave(uint8_t done) {
+  const P *p[2] = {&rtP_Left, &rtP_Right};
+  for (uint8_t m = 0; m < 2; m++) {
+    for (uint8_t k = 0; k < 6 && (done & (1 << m)); k++) {
+      EE_WriteVariable(VirtAddVarTab[EE_ADDR_HALL + 6 * m + k], (uint16_t)p[m]->a_hallCorr[k]);
+    }
+  }
+  EE_Save();
+}
+#endif
 
-void poweroffPressCheck(void) {
-  #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
-    if(HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) {
-      uint16_t cnt_press = 0;
-      while(HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) {
-        HAL_Delay(10);
-        if (cnt_press++ == 5 * 100) { beepShort(5); }
-      }
+#if defined(MOTOR_IDENT)
+/*
+ * Motor constants (MOTOR_IDENT): R [mOhm], L [uH] and flux [uV s] per motor from EE_ADDR_MOTOR.
+ * They are reported (MOTR*, MOTL*, MOTF* variables) and set the current PI gains, a motor without stored words reads 0
+ * and keeps the generated gains
+ */
+void motIdLoad(void) {
+  uint16_t val[3];
+  for (uint8_t m = 0; m < 2; m++) {
+    uint8_t valid = 1;
+    for (uint8_t k = 0; k < 3; k++) {
+      if (EE_ReadVariable(VirtAddVarTab[EE_ADDR_MOTOR + 3 * m + k], &val[k]) || val[k] == 0) valid = 0;
+    }
+    if (valid) {
+      motId[m].r    = val[0];
+      motId[m].l    = val[1];
+      motId[m].flux = val[2];
+      motIdTune(m);
+    }
+  }
+}
 
-      if (cnt_press > 8) enable = 0;
+/* Current PI gains of motor m from its identified R and L for MOTOR_IDENT_BW at the nominal battery voltage. With
+ * PARAM_STAGED the controllers take them at the next bldc_param_commit of the main loop, like a $SET */
+void motIdTune(uint8_t m) {
+  #if MOTOR_IDENT_BW > 0
+  P *p = m ? &rtP_Right : &rtP_Left;
+  uint16_t kp, ki;
+  motIdGains(&motId[m], BAT_CELLS * 370, MOTOR_IDENT_BW, &kp, &ki);
+  p->cf_iqKp = p->cf_idKp = kp;
+  p->cf_iqKi = p->cf_idKi = ki;
+  #endif
+}
 
-      if (cnt_press >= 5 * 100) {                         // Check if press is more than 5 sec
-        HAL_Delay(1000);
-        if (HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) {  // Double press: Adjust Max Current, Max Speed
-          while(HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) { HAL_Delay(10); }
-          beepLong(8);
-          updateCurSpdLim();
-          beepShort(5);
-        } else {                                          // Long press: Calibrate ADC Limits
-          #ifdef AUTO_CALIBRATION_ENA
-          beepLong(16); 
-          adcCalibLim();
-          beepShort(5);
-          #endif
-        }
-      } else if (cnt_press > 8) {                         // Short press: power off (80 ms debounce)
-        #if defined(DEBUG_SERIAL_USART2) || defined(DEBUG_SERIAL_USART3)
-          printf("Powering off, button has been pressed\r\n");
-        #endif
-      poweroff();
-      }
+/* Save the constants of the motors whose identification succeeded, done = 1 << motor */
+void motIdSave(uint8_t done) {
+  for (uint8_t m = 0; m < 2; m++) {
+    if (done & (1 << m)) {
+      EE_WriteVariable(VirtAddVarTab[EE_ADDR_MOTOR + 3 * m],     motId[m].r);
+      EE_WriteVariable(VirtAddVarTab[EE_ADDR_MOTOR + 3 * m + 1], motId[m].l);
+      EE_WriteVariable(VirtAddVarTab[EE_ADDR_MOTOR + 3 * m + 2], motId[m].flux);
     }
-  #elif defined(VARIANT_TRANSPOTTER)
-    if(HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) {
-      enable = 0;
-      while(HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) { HAL_Delay(10); }
-      beepShort(5);
-      HAL_Delay(300);
-      if (HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) {
-        while(HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) { HAL_Delay(10); }
-        beepLong(5);
-        HAL_Delay(350);
-        poweroff();
-      } else {
-        setDistance += 0.25;
-        if (setDistance > 2.6) {
-          setDistance = 0.5;
-        }
-        beepShort(setDistance / 0.25);
-        saveValue = setDistance * 1000;
-        saveValue_valid = 1;
-      }
+  }
+  EE_Save();
+}
+#endif
+
+#if defined(COGGING_COMP)
+/*
+ * Cogging tables (COGGING_COMP): COG_WORDS words per motor from EE_ADDR_COG, two int8 bins per word, the even bin in
+ * the low byte. A motor without stored words keeps the zero table, no compensation
+ */
+void cogLoad(void) {
+  uint16_t val[COG_WORDS];
+  for (uint8_t m = 0; m < 2; m++) {
+    uint8_t valid = 1;
+    for (uint8_t k = 0; k < COG_WORDS; k++) {
+      if (EE_ReadVariable(VirtAddVarTab[EE_ADDR_COG + COG_WORDS * m + k], &val[k])) valid = 0;
     }
-  #else
-    if (HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) {
-      enable = 0;                                             // disable motors
-      while (HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN)) {}    // wait until button is released
-      poweroff();                                             // release power-latch
-    }
-  #endif
-}
-
-
-
-/* =========================== Filtering Functions =========================== */
-
-  /* Low pass filter fixed-point 32 bits: fixdt(1,32,16)
-  * Max:  32767.99998474121
-  * Min: -32768
-  * Res:  1.52587890625e-05
-  * 
-  * Inputs:       u     = int16 or int32
-  * Outputs:      y     = fixdt(1,32,16)
-  * Parameters:   coef  = fixdt(0,16,16) = [0,65535U]
-  * 
-  * Example: 
-  * If coef = 0.8 (in floating point), then coef = 0.8 * 2^16 = 52429 (in fixed-point)
-  * filtLowPass16(u, 52429, &y);
-  * yint = (int16_t)(y >> 16); // the integer output is the fixed-point ouput shifted by 16 bits
-  */
-void filtLowPass32(int32_t u, uint16_t coef, int32_t *y) {
-  int64_t tmp;  
-  tmp = ((int64_t)((u << 4) - (*y >> 12)) * coef) >> 4;
-  tmp = CLAMP(tmp, -2147483648LL, 2147483647LL);  // Overflow protection: 2147483647LL = 2^31 - 1
-  *y = (int32_t)tmp + (*y);
-}
-  // Old filter
-  // Inputs:       u     = int16
-  // Outputs:      y     = fixdt(1,32,20)
-  // Parameters:   coef  = fixdt(0,16,16) = [0,65535U]
-  // yint = (int16_t)(y >> 20); // the integer output is the fixed-point ouput shifted by 20 bits
-  // void filtLowPass32(int16_t u, uint16_t coef, int32_t *y) {
-  //   int32_t tmp;  
-  //   tmp = (int16_t)(u << 4) - (*y >> 16);  
-  //   tmp = CLAMP(tmp, -32768, 32767);  // Overflow protection  
-  //   *y  = coef * tmp + (*y);
-  // }
-
-
-  /* rateLimiter16(int16_t u, int16_t rate, int16_t *y);
-  * Inputs:       u     = int16
-  * Outputs:      y     = fixdt(1,16,4)
-  * Parameters:   rate  = fixdt(1,16,4) = [0, 32767] Do NOT make rate negative (>32767)
-  */
-void rateLimiter16(int16_t u, int16_t rate, int16_t *y) {
-  int16_t q0;
-  int16_t q1;
-
-  q0 = (u << 4)  - *y;
-
-  if (q0 > rate) {
-    q0 = rate;
-  } else {
-    q1 = -rate;
-    if (q0 < q1) {
-      q0 = q1;
+    for (uint8_t k = 0; k < COG_WORDS && valid; k++) {
+      cogging[m].tab[2 * k]     = (int8_t)(val[k] & 0xFF);
+      cogging[m].tab[2 * k + 1] = (int8_t)(val[k] >> 8);
     }
   }
+}
 
-  *y = q0 + *y;
+/* Save the tables of the motors whose recording succeeded, done = 1 << motor */
+void cogSave(uint8_t done) {
+  for (uint8_t m = 0; m < 2; m++) {
+    const int8_t *t = cogging[m].tab;
+    for (uint8_t k = 0; k < COG_WORDS && (done & (1 << m)); k++) {
+      EE_WriteVariable(VirtAddVarTab[EE_ADDR_COG + COG_WORDS * m + k], (uint16_t)((uint8_t)t[2 * k] | ((uint8_t)t[2 * k + 1] << 8)));
+    }
+  }
+  EE_Save();
 }
+#endif
 
+#if defined(CTRL_GAINS)
+/*
+ * Controller gain parameters (CTRL_GAINS): ctrlGains holds them in the generated units at PWM_FREQ_BASE, the controllers
+ * get them rescaled to the control rate like BLDC_Init does. With GAIN_SCHED they are the new 100 %
+ */
+uint16_t ctrlGains[CG_N] = {CTRL_GAIN_ID_KP, CTRL_GAIN_ID_KI, CTRL_GAIN_IQ_KP, CTRL_GAIN_IQ_KI, CTRL_GAIN_N_KP, CTRL_GAIN_N_KI, CTRL_GAIN_FILT};
 
-  /* mixerFcn(rtu_speed, rtu_steer, &rty_speedR, &rty_speedL); 
-  * Inputs:       rtu_speed, rtu_steer                  = fixdt(1,16,4)
-  * Outputs:      rty_speedR, rty_speedL                = int16_t
-  * Parameters:   SPEED_COEFFICIENT, STEER_COEFFICIENT  = fixdt(0,16,14)
-  */
-void mixerFcn(int16_t rtu_speed, int16_t rtu_steer, int16_t *rty_speedR, int16_t *rty_speedL) {
-    int16_t prodSpeed;
-    int16_t prodSteer;
-    int32_t tmp;
+/* Gain g per PWM_FREQ_BASE tick to the control rate, slow = 1 for the integral gains of the task groups of CTRL_MULTIRATE */
+static uint16_t ctrlGainRate(uint16_t g, uint8_t slow) {
+  uint32_t v = g;
+  #if PWM_FREQ != PWM_FREQ_BASE
+  v = v * PWM_FREQ_BASE / PWM_FREQ;
+  #endif
+  #if defined(CTRL_MULTIRATE)
+  if (slow) {
+    v /= 3;
+  }
+  #else
+  (void)slow;
+  #endif
+  return (uint16_t)MIN(v, 65535);
+}
 
-    prodSpeed   = (int16_t)((rtu_speed * (int16_t)SPEED_COEFFICIENT) >> 14);
-    prodSteer   = (int16_t)((rtu_steer * (int16_t)STEER_COEFFICIENT) >> 14);
+/* Callback of the ID_KP ... CUR_FILT parameters, also when loadAllParamVal takes them. With PARAM_STAGED the
+ * controllers take them at the next bldc_param_commit of the main loop, like a $SET */
+void ctrlGainsApply(void) {
+  P *p[2] = {&rtP_Left, &rtP_Right};
+  for (uint8_t m = 0; m < 2; m++) {
+    p[m]->cf_idKp     = ctrlGains[CG_ID_KP];
+    p[m]->cf_idKi     = ctrlGainRate(ctrlGains[CG_ID_KI], 1);
+    p[m]->cf_iqKp     = ctrlGains[CG_IQ_KP];
+    p[m]->cf_iqKi     = ctrlGainRate(ctrlGains[CG_IQ_KI], 1);
+    p[m]->cf_nKp      = ctrlGains[CG_N_KP];
+    p[m]->cf_nKi      = ctrlGainRate(ctrlGains[CG_N_KI], 1);
+    p[m]->cf_currFilt = ctrlGainRate(ctrlGains[CG_FILT], 0);
+  }
+}
+#endif
 
-    tmp         = prodSpeed - prodSteer;  
-    tmp         = CLAMP(tmp, -32768, 32767);  // Overflow protection
-    *rty_speedR = (int16_t)(tmp >> 4);        // Convert from fixed-point to int 
-    *rty_speedR = CLAMP(*rty_speedR, INPUT_MIN, INPUT_MAX);
+#if defined(SPD_FILT)
+/*
+ * Speed loop filter parameters (SPD_FILT): spdFilt holds them in Hz and %, the controllers get the biquad coefficients
+ * at the rate of their speed PI, the FOC task group
+ */
+uint16_t spdFilt[SF_N] = {SPD_FILT_NOTCH_HZ, SPD_FILT_NOTCH_BW, SPD_FILT_NOTCH_DEPTH, SPD_FILT_LP_HZ};
 
-    tmp         = prodSpeed + prodSteer;
-    tmp         = CLAMP(tmp, -32768, 32767);  // Overflow protection
-    *rty_speedL = (int16_t)(tmp >> 4);        // Convert from fixed-point to int
-    *rty_speedL = CLAMP(*rty_speedL, INPUT_MIN, INPUT_MAX);
+/* Callback of the NF_FREQ ... NLP_FREQ parameters, also at init and when loadAllParamVal takes them. With PARAM_STAGED
+ * the controllers take them at the next bldc_param_commit of the main loop, like a $SET */
+void spdFiltApply(void) {
+  #if defined(CTRL_MULTIRATE)
+  spdFiltDesign(rtP_Left.cf_nFilt, spdFilt, PWM_FREQ);
+  #else
+  spdFiltDesign(rtP_Left.cf_nFilt, spdFilt, PWM_FREQ / 3);
+  #endif
+  for (uint8_t i = 0; i < SPD_FILT_COEFS; i++) {
+    rtP_Right.cf_nFilt[i] = rtP_Left.cf_nFilt[i];
+  }
 }
+#endif
 
+#if defined(GAIN_SCHED)
+/*
+ * Gain scheduling (GAIN_SCHED): the PI gains in rtP_Left / rtP_Right over the motor speeds, once per main loop before
+ * the staged parameter commit
+ */
+GainSched gainSched[2];
+
+static void gainSchedGains(P *p, uint16_t *gain[GS_GAINS]) {
+  gain[GS_ID_KP] = &p->cf_idKp;
+  gain[GS_ID_KI] = &p->cf_idKi;
+  gain[GS_IQ_KP] = &p->cf_iqKp;
+  gain[GS_IQ_KI] = &p->cf_iqKi;
+  gain[GS_N_KP]  = &p->cf_nKp;
+  gain[GS_N_KI]  = &p->cf_nKi;
+}
 
+void gainSchedStart(void) {
+  uint16_t *gain[GS_GAINS];
+  gainSchedGains(&rtP_Left, gain);
+  gainSchedInit(&gainSched[0], gain);
+  gainSchedGains(&rtP_Right, gain);
+  gainSchedInit(&gainSched[1], gain);
+}
 
-/* =========================== Multiple Tap Function =========================== */
+/* nL, nR: motor speeds [rpm] */
+void gainSchedUpdate(int16_t nL, int16_t nR) {
+  uint16_t *gain[GS_GAINS];
+  gainSchedGains(&rtP_Left, gain);
+  gainSchedStep(&gainSched[0], gain, nL, batVoltageCalib);
+  gainSchedGains(&rtP_Right, gain);
+  gainSchedStep(&gainSched[1], gain, nR, batVoltageCalib);
+}
+#endif
 
-  /* multipleTapDet(int16_t u, uint32_t timeNow, MultipleTap *x)
-  * This function detects multiple tap presses, such as double tapping, triple tapping, etc.
-  * Inputs:       u = int16_t (input signal); timeNow = uint32_t (current time)  
-  * Outputs:      x->b_multipleTap (get the output here)
-  */
-void multipleTapDet(int16_t u, uint32_t timeNow, MultipleTap *x) {
-  uint8_t 	b_timeout;
-  uint8_t 	b_hyst;
-  uint8_t 	b_pulse;
-  uint8_t 	z_pulseCnt;
-  uint8_t   z_pulseCntRst;
-  uint32_t 	t_time; 
+#if defined(FLASH_SAFE_WRITE)
+/*
+ * FLASH_SAFE_WRITE: the control interrupt has to be taken while the flash is busy, so its vector is read from a copy
+ * of the vector table in SRAM. Aligned to the table size rounded up to a power of 2, as VTOR needs
+ */
+static uint32_t vectorsRam[16 + DMA2_Channel4_5_IRQn + 1] __attribute__((aligned(512)));
 
-  // Detect hysteresis
-  if (x->b_hysteresis) {
-    b_hyst = (u > MULTIPLE_TAP_LO);
-  } else {
-    b_hyst = (u > MULTIPLE_TAP_HI);
+void flashSafeInit(void) {
+  const uint32_t *vectors = (const uint32_t *)SCB->VTOR;
+  for (uint16_t i = 0; i < ARRAY_LEN(vectorsRam); i++) {
+    vectorsRam[i] = vectors[i];
   }
+  __DSB();
+  SCB->VTOR = (uint32_t)vectorsRam;
+  __DSB();
+}
+#endif
 
-  // Detect pulse
-  b_pulse = (b_hyst != x->b_hysteresis);
+#if defined(FAULTLOG_ENABLE) || defined(TRIP_STATS)
+/*
+ * Record log in reserved flash pages, shared by the fault log and the trip log. A record starts with its magic and a
+ * seq half-word and ends with the CRC32 of the bytes before it. The records are appended in slot order, the page after
+ * the newest record is erased when the log wraps.
+ */
+typedef struct {
+  uint32_t addr;                        // page aligned start
+  uint16_t pages;                       // [-] flash pages, at least 2
+  uint16_t size;                        // [bytes] record size, even
+  uint16_t magic;
+} FlashLog;
+
+#define FLASHLOG_SLOTS_PER_PAGE(l)  (FLASH_PAGE_SIZE / (l)->size)
+#define FLASHLOG_SLOTS(l)           (FLASHLOG_SLOTS_PER_PAGE(l) * (l)->pages)
+
+static const uint16_t *flashLogSlot(const FlashLog *l, uint16_t slot) {
+  return (const uint16_t *)(l->addr + (slot / FLASHLOG_SLOTS_PER_PAGE(l)) * FLASH_PAGE_SIZE + (slot % FLASHLOG_SLOTS_PER_PAGE(l)) * l->size);
+}
 
-  // Save time when first pulse is detected
-  if (b_hyst && b_pulse && (x->z_pulseCntPrev == 0)) {
-    t_time = timeNow;
-  } else {
-    t_time = x->t_timePrev;
+static uint8_t flashLogValid(const FlashLog *l, const uint16_t *rec) {
+  uint32_t crc;
+  memcpy(&crc, (const uint8_t *)rec + l->size - sizeof(crc), sizeof(crc));
+  return rec[0] == l->magic && crc == calc_crc32((const uint8_t *)rec, l->size - sizeof(crc));
+}
+
+static uint8_t flashLogErased(const FlashLog *l, const uint16_t *rec) {
+  for (uint16_t i = 0; i < l->size / 2; i++) {
+    if (rec[i] != 0xFFFF) return 0;
   }
+  return 1;
+}
 
-  // Create timeout boolean
-  b_timeout = (timeNow - t_time > MULTIPLE_TAP_TIMEOUT);
+// Slot of the record with the highest seq, -1 if the log is empty
+static int16_t flashLogNewest(const FlashLog *l) {
+  int16_t newest = -1;
+  for (uint16_t i = 0; i < FLASHLOG_SLOTS(l); i++) {
+    const uint16_t *rec = flashLogSlot(l, i);
+    if (flashLogValid(l, rec) && (newest < 0 || (int16_t)(rec[1] - flashLogSlot(l, newest)[1]) > 0)) {
+      newest = i;
+    }
+  }
+  return newest;
+}
 
-  // Create pulse counter
-  if ((!b_hyst) && (x->z_pulseCntPrev == 0)) {
-    z_pulseCnt = 0U;
-  } else {
-    z_pulseCnt = b_pulse;
+// 1 if the next append has to erase a page first
+static uint8_t flashLogEraseDue(const FlashLog *l) {
+  int16_t newest = flashLogNewest(l);
+  return !flashLogErased(l, flashLogSlot(l, (newest < 0) ? 0 : (newest + 1) % FLASHLOG_SLOTS(l)));
+}
+
+/*
+ * Append rec to the log: magic, seq and crc are filled in here, the record is programmed in half-words. If the next
+ * slot is not erased (the log wrapped or a previous write was interrupted), the next page is erased first.
+ */
+static void flashLogAppend(const FlashLog *l, uint16_t *rec) {
+  int16_t  newest = flashLogNewest(l);
+  uint16_t slot   = (newest < 0) ? 0 : (newest + 1) % FLASHLOG_SLOTS(l);
+  uint32_t crc;
+
+  rec[0] = l->magic;
+  rec[1] = (newest < 0) ? 0 : flashLogSlot(l, newest)[1] + 1;
+  crc    = calc_crc32((const uint8_t *)rec, l->size - sizeof(crc));
+  memcpy((uint8_t *)rec + l->size - sizeof(crc), &crc, sizeof(crc));
+
+  HAL_FLASH_Unlock();
+  if (!flashLogErased(l, flashLogSlot(l, slot))) {
+    if (slot % FLASHLOG_SLOTS_PER_PAGE(l)) {          // Interrupted write in the middle of a page: continue on the next page
+      slot = (slot / FLASHLOG_SLOTS_PER_PAGE(l) + 1) % l->pages * FLASHLOG_SLOTS_PER_PAGE(l);
+    }
+    EE_ErasePage((uint32_t)flashLogSlot(l, slot));
+  }
+  uint32_t dst = (uint32_t)flashLogSlot(l, slot);
+  for (uint16_t i = 0; i < l->size / 2; i++) {
+    EE_ProgramHalfWord(dst + 2 * i, rec[i]);
+  }
+  HAL_FLASH_Lock();
+}
+#endif
+
+#if defined(FAULTLOG_ENABLE)
+static const FlashLog faultLog = {FAULTLOG_ADDR, FAULTLOG_PAGES, sizeof(FaultRecord), FAULTLOG_MAGIC};
+
+/*
+ * Get the n-th record of the fault log, oldest first. Returns NULL past the last record.
+ * Walking the slots from the one after the newest record gives them in ascending seq.
+ */
+const FaultRecord *faultLogGet(uint8_t n) {
+  int16_t newest = flashLogNewest(&faultLog);
+  if (newest < 0) return NULL;
+  for (uint16_t i = 1; i <= FLASHLOG_SLOTS(&faultLog); i++) {
+    const uint16_t *rec = flashLogSlot(&faultLog, (newest + i) % FLASHLOG_SLOTS(&faultLog));
+    if (flashLogValid(&faultLog, rec) && n-- == 0) return (const FaultRecord *)rec;
+  }
+  return NULL;
+}
+
+/*
+ * Append a snapshot to the fault log. Called from poweroff with the motors disabled
+ */
+void faultLogWrite(uint8_t cause) {
+  FaultRecord rec;
+
+  memset(&rec, 0, sizeof(rec));
+  rec.uptime     = timeMs();
+  rec.cause      = cause;
+  rec.errCodeL   = rtY_Left.z_errCode;
+  rec.errCodeR   = rtY_Right.z_errCode;
+  rec.errLatchL  = errLatch_L | rtY_Left.z_errCode;
+  rec.errLatchR  = errLatch_R | rtY_Right.z_errCode;
+  rec.batVoltage = batVoltageCalib;
+  rec.boardTemp  = board_temp_deg_c;
+  rec.speedL     = rtY_Left.n_mot;
+  rec.speedR     = rtY_Right.n_mot;
+  #if defined(BLACKBOX_ENABLE)
+  {                                                   // Samples leading up to the trigger, or the latest ones if nothing triggered
+    uint16_t avail, last;
+    uint16_t oldest = (blackbox.wr + BLACKBOX_DEPTH - blackbox.cnt) % BLACKBOX_DEPTH;
+    uint8_t  triggered = blackbox.state != BLACKBOX_ARMED;
+    blackbox.state = BLACKBOX_FROZEN;
+    if (blackbox.cnt && triggered) {
+      last  = blackbox.trig;
+      avail = (blackbox.trig + BLACKBOX_DEPTH - oldest) % BLACKBOX_DEPTH + 1;
+    } else {
+      last  = (blackbox.wr + BLACKBOX_DEPTH - 1) % BLACKBOX_DEPTH;
+      avail = blackbox.cnt;
+    }
+    rec.bboxCnt = (avail < FAULTLOG_BBOX_SAMPLES) ? avail : FAULTLOG_BBOX_SAMPLES;
+    for (uint8_t i = 0; i < rec.bboxCnt; i++) {
+      rec.bbox[i] = blackbox.buf[(last + BLACKBOX_DEPTH + 1 - rec.bboxCnt + i) % BLACKBOX_DEPTH];
+    }
+  }
+  #endif
+  flashLogAppend(&faultLog, (uint16_t *)&rec);
+}
+#endif
+
+#if defined(TRIP_STATS)
+static const FlashLog tripLog = {TRIP_ADDR, TRIP_PAGES, sizeof(TripRecord), TRIP_MAGIC};
+Trip trip;
+
+/* Start the trip statistics from the newest record of the trip log, called at power on */
+void tripLoad(void) {
+  int16_t newest = flashLogNewest(&tripLog);
+  tripInit(&trip, (newest < 0) ? NULL : &((const TripRecord *)flashLogSlot(&tripLog, newest))->stats);
+}
+
+/* Append the totals to the trip log. Stalls the CPU for the flash write, call it at standstill or with the motors disabled.
+ * With FLASH_SAFE_WRITE only an append that erases a page (tripEraseDue) stalls the code outside SRAM */
+static int8_t tripErase = -1;           // [-] tripEraseDue, -1 = not checked since the last append
+
+void tripSave(void) {
+  TripRecord rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.stats = trip.tot;
+  flashLogAppend(&tripLog, (uint16_t *)&rec);
+  tripErase = -1;
+}
+
+/* 1 if the next tripSave erases a page. Checked once per append, the log scan takes a while */
+uint8_t tripEraseDue(void) {
+  if (tripErase < 0) {
+    tripErase = (int8_t)flashLogEraseDue(&tripLog);
+  }
+  return (uint8_t)tripErase;
+}
+#endif
+
+void poweroff(uint8_t cause) {
+  enable = 0;
+  #if defined(DEBUG_OUT)
+  printf("-- Motors disabled --\r\n");
+  #endif
+  beepCount(0, 0, 0);
+  for (int i = 0; i < 8; i++) {
+    beepNote((uint8_t)i, 100);
+  }
+  beepWait();
+  #if defined(FAULTLOG_ENABLE)
+  faultLogWrite(cause);
+  #endif
+  #if defined(TRIP_STATS)
+  tripSave();
+  #endif
+  saveConfig();
+  HAL_GPIO_WritePin(OFF_PORT, OFF_PIN, GPIO_PIN_RESET);
+  while(1) {}
+}
+
+#if defined(BOOTLOADER)
+// Restart into the UART bootloader for an update ($BOOT). The request survives the reset in a backup register and
+// the bootloader turns the power latch on again right after the reset
+void bootEnter(void) {
+  enable = 0;
+  saveConfig();
+  HAL_Delay(20);                        // let the reply leave the debug USART
+  __HAL_RCC_PWR_CLK_ENABLE();
+  __HAL_RCC_BKP_CLK_ENABLE();
+  HAL_PWR_EnableBkUpAccess();
+  BKP->DR1 = BOOT_REQ_MAGIC;
+  NVIC_SystemReset();
+}
+#endif
+
+
+/*
+ * Input calibration modes, started by the power button or by the $INCAL / $INLIM debug commands. inputCalTask is a
+ * scheduler task: it samples the inputs, reports the progress in inputCalProg and ends the mode at its timeout, while
+ * the control, feedback and timeout handling keep running. inputCalStop evaluates the samples and commits the result
+ * through the EEPROM cache right away, not only at power off. The motors stay disabled while a mode runs.
+ */
+uint8_t buttonMode;                     // buttonModes: an input mode is running
+uint8_t inputCalProg;                   // [%] elapsed part of the sampling time
+uint8_t inputCalRes;                    // inputCalResults of the last mode
+#if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+static uint32_t inputCalTick;           // [ms] start of the sampling
+#endif
+
+/* Start an input mode, BTN_MODE_CALIB or BTN_MODE_LIMITS. Returns 0 if the motors are spinning or the mode is not built */
+uint8_t inputCalStart(uint8_t mode) {
+  #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+  #ifndef AUTO_CALIBRATION_ENA
+  if (mode == BTN_MODE_CALIB) {
+    return 0;
+  }
+  #endif
+  if (speedAvgAbs > 5 || (mode != BTN_MODE_CALIB && mode != BTN_MODE_LIMITS)) {   // do not enter this mode if motors are spinning
+    return 0;
   }
+  #if defined(DEBUG_OUT)
+  printf(mode == BTN_MODE_CALIB ? "Input calibration started...\r\n" : "Torque and Speed limits update started...\r\n");
+  #endif
+  enable       = 0;
+  inputCalReset();
+  inputCalProg = 0;
+  inputCalRes  = INPUT_CAL_NONE;
+  inputCalTick = timeMs();
+  buttonMode   = mode;
+  beepLong(mode == BTN_MODE_CALIB ? 16 : 8);
+  return 1;
+  #else
+  (void)mode;
+  return 0;
+  #endif
+}
 
-  // Reset counter if we detected complete tap presses OR there is a timeout
-  if ((x->z_pulseCntPrev >= MULTIPLE_TAP_NR) || b_timeout) {
-    z_pulseCntRst = 0U;
+/* End the running input mode: evaluate the samples and save the accepted limits */
+void inputCalStop(void) {
+  #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+  if (buttonMode == BTN_MODE_CALIB) {
+    adcCalibLim();
+  } else if (buttonMode == BTN_MODE_LIMITS) {
+    updateCurSpdLim();
   } else {
-    z_pulseCntRst = x->z_pulseCntPrev;
+    return;
+  }
+  inputCalRes = (inp_cal_valid || cur_spd_valid) ? INPUT_CAL_SAVED : INPUT_CAL_REJECTED;
+  if (inp_cal_valid || cur_spd_valid) {
+    saveInputConfig();                  // the motors are still disabled, the flash stall does not matter
   }
-  z_pulseCnt = z_pulseCnt + z_pulseCntRst;
+  inputCalProg = 100;
+  buttonMode   = BTN_MODE_NONE;
+  beepShort(5);
+  #endif
+}
 
-  // Check if complete tap presses are detected AND no timeout
-  if ((z_pulseCnt >= MULTIPLE_TAP_NR) && (!b_timeout)) {
-    x->b_multipleTap = !x->b_multipleTap;	// Toggle output
+/* Scheduler task, every DELAY_IN_MAIN_LOOP ms */
+void inputCalTask(void) {
+  #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+  uint32_t timeout, dt;
+  if (buttonMode != BTN_MODE_CALIB && buttonMode != BTN_MODE_LIMITS) {
+    return;
+  }
+  timeout = buttonMode == BTN_MODE_CALIB ? BTN_CALIB_TIMEOUT : BTN_LIMITS_TIMEOUT;
+  dt      = timeMs() - inputCalTick;
+  inputCalSample();
+  inputCalProg = (uint8_t)MIN(dt * 100 / timeout, 99);
+  if (dt >= timeout) {
+    inputCalStop();
   }
+  #endif
+}
+
+
+/*
+ * Power button state machine, sampled by the monitor task every DELAY_IN_MAIN_LOOP ms. Nothing here waits for the
+ * button: the control, feedback and timeout handling keep running while it is held. A long and a double press start
+ * the input modes, a press while a mode runs confirms it (BTN_MODE).
+ */
+static uint8_t  btnState;               // buttonStates
+static uint32_t btnTick;                // [ms] start of the current state
 
-  // Update states
-  x->z_pulseCntPrev = z_pulseCnt;
-  x->b_hysteresis 	= b_hyst;
-  x->t_timePrev 	  = t_time;
+#if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+static void buttonModeStart(uint8_t mode) {
+  buttonMode = BTN_MODE_NONE;
+  btnState   = inputCalStart(mode) ? BTN_MODE : BTN_IDLE;
 }
+#endif
+
+void poweroffPressCheck(void) {
+  uint8_t  pressed = HAL_GPIO_ReadPin(BUTTON_PORT, BUTTON_PIN);
+  #if !defined(VARIANT_HOVERBOARD)
+  uint32_t dt      = timeMs() - btnTick;
+  #endif
 
+  #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
+    switch (btnState) {
+      case BTN_IDLE:
+        if (pressed && buttonMode == BTN_MODE_NONE) {
+          btnState = BTN_PRESSED;
+          btnTick  = timeMs();
+        } else if (pressed) {                             // a mode started by $INCAL / $INLIM: confirm it
+          inputCalStop();
+          btnState = BTN_RELEASE;
+        }
+        break;
+      case BTN_PRESSED:
+        if (!pressed) {
+          btnState = BTN_IDLE;
+          if (dt > BTN_DEBOUNCE) {                        // Short press: power off
+            enable = 0;
+            #if defined(DEBUG_OUT)
+              printf("Powering off, button has been pressed\r\n");
+            #endif
+            poweroff(POWEROFF_BUTTON);
+          }
+        } else if (dt >= BTN_LONG) {                      // Check if press is more than 5 sec
+          enable     = 0;
+          buttonMode = BTN_MODE_WAIT;                     // keep the motors disabled until the mode is selected
+          beepShort(5);
+          btnState   = BTN_LONG_HELD;
+        }
+        break;
+      case BTN_LONG_HELD:
+        if (!pressed) {
+          btnState = BTN_WAIT_2ND;
+          btnTick  = timeMs();
+        }
+        break;
+      case BTN_WAIT_2ND:
+        if (pressed) {                                    // Double press: Adjust Max Current, Max Speed
+          btnState = BTN_PRESSED_2ND;
+        } else if (dt >= BTN_DOUBLE) {                    // Long press: Calibrate ADC Limits
+          buttonModeStart(BTN_MODE_CALIB);
+        }
+        break;
+      case BTN_PRESSED_2ND:
+        if (!pressed) {
+          buttonModeStart(BTN_MODE_LIMITS);
+        }
+        break;
+      case BTN_MODE:                                      // confirm with a press, inputCalTask ends it at the timeout
+        if (pressed) {
+          inputCalStop();
+          btnState = BTN_RELEASE;
+        } else if (buttonMode == BTN_MODE_NONE) {
+          btnState = BTN_IDLE;
+        }
+        break;
+      default:                                            // BTN_RELEASE: the confirming press does not power off
+        if (!pressed) {
+          btnState = BTN_IDLE;
+        }
+        break;
+    }
+  #elif defined(VARIANT_TRANSPOTTER)
+    switch (btnState) {
+      case BTN_IDLE:
+        if (pressed) {
+          enable   = 0;
+          btnState = BTN_PRESSED;
+        }
+        break;
+      case BTN_PRESSED:
+        if (!pressed) {
+          beepShort(5);
+          btnState = BTN_WAIT_2ND;
+          btnTick  = timeMs();
+        }
+        break;
+      case BTN_WAIT_2ND:
+        if (pressed) {                                    // Double press: power off
+          btnState = BTN_PRESSED_2ND;
+        } else if (dt >= BTN_DOUBLE_TRANSPOTTER) {        // Single press: next distance
+          setDistance += 250;
+          if (setDistance > 2600) {
+            setDistance = 500;
+          }
+          beepShort(setDistance / 250);
+          saveValue = setDistance;
+          saveValue_valid = 1;
+          btnState = BTN_IDLE;
+        }
+        break;
+      default:                                            // BTN_PRESSED_2ND
+        if (!pressed) {
+          beepLong(5);
+          beepNote(0, 350);
+          poweroff(POWEROFF_BUTTON);
+        }
+        break;
+    }
+  #else
+    if (pressed && btnState == BTN_IDLE) {
+      enable   = 0;                                           // disable motors
+      btnState = BTN_PRESSED;
+    } else if (!pressed && btnState == BTN_PRESSED) {         // button released
+      poweroff(POWEROFF_BUTTON);                              // release power-latch
+    }
+  #endif
+}
 
@@ -0,0 +1,168 @@
+/*
+* This file is part of the hoverboard-firmware-hack project.
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Motor winding temperature (WINDING_TEMP). Only uses config.h, so it also builds on the host.
+//
+// The copper resistance rises by 0.393 %/K, so the phase resistance over the one of WTEMP_T_REF (MOTOR_IDENT or OBS_R)
+// gives the winding temperature. The control interrupt sums over 100 ms the power of the three phases, sum(v * i),
+// and sum(i^2): for a star winding sum(v * i) = R sum(i^2) + 1.5 w flux iq + the dead time voltage times the current.
+// - standstill: every WTEMP_INJ_PERIOD s without motion a d axis current (no torque with the right angle) runs at half
+//   and at full WTEMP_INJ_CUR. The voltage difference over the current difference is R, the dead time voltage, the
+//   same at both currents, cancels and is kept for the running measurement.
+// - running: R from the voltage equation without the back-EMF and the dead time voltage, only while the resistive
+//   power is at least 4 times the back-EMF power: a flux error then moves R by a quarter of it at most.
+// In between an I^2R first order model, temp' = (amb + WTEMP_RTH * R sum(i^2) - temp) / WTEMP_TAU, follows the
+// current. Each resistance measurement corrects the temperature and, slower, the ambient temperature of the model.
+
+#include <stdint.h>
+#include "config.h"
+#include "wtemp.h"
+
+#if defined(WINDING_TEMP)
+
+#define WTEMP_N_STILL       5                                     // [rpm] standstill below this mean speed
+#define WTEMP_INJ_BITS      ((int16_t)(WTEMP_INJ_CUR * A2BIT_CONV << 4))  // [fixdt(1,16,4) ADC bits]
+#define WTEMP_TC_INV        2545                                  // [degC*10] 1 / 0.393 %/K, copper
+#define WTEMP_SHIFT_INJ     1                                     // [-] correction gain of a standstill measurement, 1/2
+#define WTEMP_SHIFT_RUN     4                                     // [-] same for a running one, 1/16
+
+static uint32_t wtempSqrt(uint64_t x) {
+  uint64_t r = 0, b = 1ULL << 62;
+  while (b > x) {
+    b >>= 2;
+  }
+  while (b) {
+    if (x >= r + b) {
+      x -= r + b;
+      r  = (r >> 1) + b;
+    } else {
+      r >>= 1;
+    }
+    b >>= 2;
+  }
+  return (uint32_t)r;
+}
+
+void wtempInit(WTemp *w) {
+  w->ready = 0;
+  w->idInj = 0;
+  w->state = WTEMP_IDLE;
+  w->meas  = 0;
+  w->timer = WTEMP_INJ_PERIOD * 1000L - 2000;   // first measurement after 2 s at standstill
+  w->v0    = 0;
+  w->r     = 0;
+  w->tempQ = w->ambQ = (int32_t)WTEMP_T_REF << 16;
+  w->temp  = WTEMP_T_REF;
+}
+
+/* A resistance r [uOhm] of the nominal rNom corrects the temperature by 1 / 2^shift of the difference. The first
+ * standstill measurement after power on replaces it. Returns 0 if r is not plausible */
+static uint8_t wtempCorrect(WTemp *w, int64_t r, int64_t rNom, uint8_t shift) {
+  int32_t err;
+  if (r < rNom / 2 || r > rNom * 2) {
+    return 0;
+  }
+  w->r = (int32_t)r;
+  err  = (int32_t)((WTEMP_T_REF + (r - rNom) * WTEMP_TC_INV / rNom) << 16) - w->tempQ;
+  if (shift == WTEMP_SHIFT_INJ && w->meas == 0) {
+    w->tempQ += err;
+    w->ambQ  += err;
+  } else {
+    w->tempQ += err >> shift;
+    w->ambQ  += err >> (shift + 2);
+  }
+  return 1;
+}
+
+/* Monitor task: takes the sums of the control interrupt if there are new ones. vbat [V*100] is the bus voltage the
+ * duties are scaled to, r0 [mOhm] and flux [uV s] the motor constants at WTEMP_T_REF, active is 1 while the motor is
+ * on in a FOC current or speed mode. Returns the winding temperature [degC*10], also in w->temp */
+int16_t wtempStep(WTemp *w, int16_t vbat, uint16_t r0, uint16_t flux, uint8_t polePairs, uint8_t active) {
+  WTempSum s;
+  int64_t  rNom = (int64_t)r0 * 1000, rT, p, e, u;
+  int32_t  i, dt;
+  uint8_t  still;
+
+  if (!w->ready) {
+    return w->temp;
+  }
+  s        = w->sum;
+  w->ready = 0;
+  if (s.ticks == 0) {
+    return w->temp;
+  }
+  dt = (int32_t)s.ticks * 1000 / PWM_FREQ;
+  // Power [uW] of the phases, back-EMF power [uW], current [mA] as sqrt(sum(i^2)) and the model resistance [uOhm]
+  p  = s.p * vbat * 5 / ((int64_t)A2BIT_CONV * s.ticks);
+  e  = s.e / s.ticks * polePairs * flux * 18849 / (1920000LL * A2BIT_CONV);
+  i  = (int32_t)wtempSqrt((uint64_t)(s.i2 * 1000000 / ((int64_t)A2BIT_CONV * A2BIT_CONV * s.ticks)));
+  rT = rNom + rNom * ((w->tempQ >> 16) - WTEMP_T_REF) / WTEMP_TC_INV;
+
+  // Thermal model, copper loss R sum(i^2) [mW]
+  {
+    int64_t pCu = rT * i * i / 1000000000LL;
+    int32_t tgt = w->ambQ + (int32_t)((pCu * WTEMP_RTH / 10000) << 16);
+    w->tempQ   += (int32_t)((int64_t)(tgt - w->tempQ) * dt / (WTEMP_TAU * 1000L));
+  }
+
+  // Resistance measurements
+  still = active && s.n / s.ticks <= WTEMP_N_STILL;
+  if (w->state != WTEMP_IDLE && !still) {
+    w->idInj = 0;                       // the motor moves or is off: give up, next try after WTEMP_INJ_PERIOD
+    w->state = WTEMP_IDLE;
+    w->timer = 0;
+  }
+  switch (w->state) {
+    case WTEMP_IDLE:
+      w->timer += dt;
+      if (still && w->timer >= WTEMP_INJ_PERIOD * 1000L) {
+        w->idInj = WTEMP_INJ_BITS / 2;
+        w->state = WTEMP_LO_SETTLE;
+      } else if (active && w->meas > 0 && i >= WTEMP_INJ_CUR * 1000L && (e < 0 ? -e : e) * 4 <= rT * i * i / 1000000) {
+        wtempCorrect(w, (p - e - (int64_t)w->v0 * i / 1000) * 1000000 / ((int64_t)i * i), rNom, WTEMP_SHIFT_RUN);
+      }
+      break;
+    case WTEMP_LO_SETTLE:               // the current step is in these sums
+    case WTEMP_HI_SETTLE:
+      w->state++;
+      break;
+    case WTEMP_LO:
+      w->uLo   = i > 0 ? p * 1000 / i : 0;
+      w->iLo   = i;
+      w->idInj = WTEMP_INJ_BITS;
+      w->state = WTEMP_HI_SETTLE;
+      break;
+    case WTEMP_HI:
+      if (i - w->iLo >= WTEMP_INJ_CUR * 250L) {
+        int64_t r;
+        u     = p * 1000 / i;
+        r     = (u - w->uLo) * 1000 / (i - w->iLo);
+        if (wtempCorrect(w, r, rNom, WTEMP_SHIFT_INJ)) {
+          w->v0   = (int32_t)(w->uLo - r * w->iLo / 1000);
+          w->meas = w->meas < 255 ? w->meas + 1 : 255;
+        }
+      }
+      w->idInj = 0;
+      w->state = WTEMP_IDLE;
+      w->timer = 0;
+      break;
+  }
+  w->temp = (int16_t)(w->tempQ >> 16);
+  return w->temp;
+}
+
+#endif
@@ -0,0 +1,197 @@
+/*
+* Host benchmark of BLDC_controller_step (make host-bench)
+* Steps one controller instance with synthetic hall/current inputs or with inputs recorded in a text file
+* and reports the time and the instruction count per step, plus a checksum of the outputs.
+* The checksum only changes when the controller behaviour changes, the timing when its speed changes.
+*
+* usage: bench [-n steps] [-s rpm] [-i amplitude] [-t inpTgt] [-f file]
+*   -n steps      number of controller steps (default 1000000)
+*   -s rpm        synthetic motor speed (default 300)
+*   -i amplitude  synthetic phase current amplitude [ADC bits] (default 250 = 5 A)
+*   -t inpTgt     input target, r_inpTgt (default 500)
+*   -f file       recorded inputs, one step per line: hall i_phaAB i_phaBC i_DCLink r_inpTgt [z_ctrlModReq [b_motEna]]
+*                 hall = hallA | hallB << 1 | hallC << 2 as read by bldc.c. The file is replayed until -n steps are done
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include "config.h"
+#include "BLDC_controller.h"
+
+#define POLE_PAIRS      15              // hoverboard motor
+
+typedef struct {
+  uint8_t hall;
+  int16_t i_phaAB, i_phaBC, i_DCLink, r_inpTgt;
+  uint8_t ctrlModReq, motEna;
+} BenchInput;
+
+static RT_MODEL rtM_;
+static RT_MODEL *const rtM = &rtM_;
+static DW   rtDW;
+static ExtU rtU;
+static ExtY rtY;
+extern P    rtP_Left;
+
+static const uint8_t hallSeq[6] = {6, 4, 5, 1, 3, 2};   // hall codes for a positive speed (positions 5..0 of vec_hallToPos)
+
+// Same parameters as BLDC_Init in util.c
+static void benchInit(void) {
+  rtP_Left.b_angleMeasEna       = 0;
+  rtP_Left.z_selPhaCurMeasABC   = 0;
+  rtP_Left.z_ctrlTypSel         = CTRL_TYP_SEL;
+  rtP_Left.b_diagEna            = DIAG_ENA;
+  rtP_Left.i_max                = (I_MOT_MAX * A2BIT_CONV) << 4;
+  rtP_Left.n_max                = N_MOT_MAX << 4;
+  rtP_Left.b_fieldWeakEna       = FIELD_WEAK_ENA;
+  rtP_Left.id_fieldWeakMax      = (FIELD_WEAK_MAX * A2BIT_CONV) << 4;
+  rtP_Left.a_phaAdvMax          = PHASE_ADV_MAX << 4;
+  rtP_Left.r_fieldWeakHi        = FIELD_WEAK_HI << 4;
+  rtP_Left.r_fieldWeakLo        = FIELD_WEAK_LO << 4;
+
+  rtM->defaultParam             = &rtP_Left;
+  rtM->dwork                    = &rtDW;
+  rtM->inputs                   = &rtU;
+  rtM->outputs                  = &rtY;
+  BLDC_controller_initialize(rtM);
+}
+
+// Synthetic inputs: constant speed, sinusoidal phase currents in phase with the hall angle
+static BenchInput *benchSynthetic(uint32_t len, double rpm, double amp, int16_t inpTgt) {
+  BenchInput *in = calloc(len, sizeof(BenchInput));
+  double dAngle  = 360.0 * rpm / 60.0 * POLE_PAIRS / PWM_FREQ;
+  double angle   = 0;
+  for (uint32_t k = 0; k < len; k++) {
+    double th       = angle * M_PI / 180.0;
+    in[k].hall      = hallSeq[(uint32_t)(angle / 60.0) % 6];
+    in[k].i_phaAB   = (int16_t)lround(amp * cos(th));
+    in[k].i_phaBC   = (int16_t)lround(amp * cos(th - 2.0 * M_PI / 3.0));
+    in[k].i_DCLink  = (int16_t)lround(amp * 0.3);
+    in[k].r_inpTgt  = inpTgt;
+    in[k].ctrlModReq = CTRL_MOD_REQ;
+    in[k].motEna    = 1;
+    angle += dAngle;
+    if (angle >= 360.0) angle -= 360.0;
+  }
+  return in;
+}
+
+static BenchInput *benchLoad(const char *file, uint32_t *len) {
+  FILE *f = fopen(file, "r");
+  if (!f) { perror(file); exit(1); }
+  uint32_t n = 0, cap = 1024;
+  BenchInput *in = malloc(cap * sizeof(BenchInput));
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    int h, a, b, dc, tgt, mod = CTRL_MOD_REQ, ena = 1;
+    if (line[0] == '#' || sscanf(line, "%i %i %i %i %i %i %i", &h, &a, &b, &dc, &tgt, &mod, &ena) < 5) continue;
+    if (n == cap) in = realloc(in, (cap *= 2) * sizeof(BenchInput));
+    in[n++] = (BenchInput){(uint8_t)h, (int16_t)a, (int16_t)b, (int16_t)dc, (int16_t)tgt, (uint8_t)mod, (uint8_t)ena};
+  }
+  fclose(f);
+  if (n == 0) { fprintf(stderr, "%s: no input lines\n", file); exit(1); }
+  *len = n;
+  return in;
+}
+
+// Retired user space instructions, -1 if the counter is not available (e.g. in containers)
+static int perfOpen(void) {
+#if defined(__linux__)
+  struct perf_event_attr pe;
+  memset(&pe, 0, sizeof(pe));
+  pe.type           = PERF_TYPE_HARDWARE;
+  pe.size           = sizeof(pe);
+  pe.config         = PERF_COUNT_HW_INSTRUCTIONS;
+  pe.disabled       = 1;
+  pe.exclude_kernel = 1;
+  pe.exclude_hv     = 1;
+  return (int)syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+int main(int argc, char **argv) {
+  uint32_t steps = 1000000, len;
+  double rpm = 300, amp = 250;
+  int16_t inpTgt = 500;
+  const char *file = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:i:t:f:")) != -1) {
+    switch (opt) {
+      case 'n': steps  = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 's': rpm    = atof(optarg); break;
+      case 'i': amp    = atof(optarg); break;
+      case 't': inpTgt = (int16_t)atoi(optarg); break;
+      case 'f': file   = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-n steps] [-s rpm] [-i amplitude] [-t inpTgt] [-f file]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  BenchInput *in;
+  if (file) {
+    in = benchLoad(file, &len);
+  } else {
+    len = PWM_FREQ;                                           // one second of inputs, replayed
+    in  = benchSynthetic(len, rpm, amp, inpTgt);
+  }
+
+  benchInit();
+  int fd = perfOpen();
+  uint64_t insn = 0;
+  uint32_t crc = 2166136261U;                                 // FNV-1a over the outputs
+  struct timespec t0, t1;
+
+#if defined(__linux__)
+  if (fd >= 0) { ioctl(fd, PERF_EVENT_IOC_RESET, 0); ioctl(fd, PERF_EVENT_IOC_ENABLE, 0); }
+#endif
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (uint32_t k = 0, j = 0; k < steps; k++) {
+    const BenchInput *u = &in[j];
+    if (++j == len) j = 0;
+    rtU.b_motEna     = u->motEna;
+    rtU.z_ctrlModReq = u->ctrlModReq;
+    rtU.r_inpTgt     = u->r_inpTgt;
+    rtU.b_hallA      =  u->hall       & 1;
+    rtU.b_hallB      = (u->hall >> 1) & 1;
+    rtU.b_hallC      =  u->hall >> 2;
+    rtU.i_phaAB      = u->i_phaAB;
+    rtU.i_phaBC      = u->i_phaBC;
+    rtU.i_DCLink     = u->i_DCLink;
+    BLDC_controller_step(rtM);
+    const uint8_t *y = (const uint8_t *)&rtY;
+    for (size_t b = 0; b < sizeof(rtY); b++) crc = (crc ^ y[b]) * 16777619U;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+#if defined(__linux__)
+  if (fd >= 0) { ioctl(fd, PERF_EVENT_IOC_DISABLE, 0); if (read(fd, &insn, sizeof(insn)) != sizeof(insn)) insn = 0; close(fd); }
+#endif
+
+  double ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / steps;
+  printf("steps:%u type:%i mode:%i%s\n", steps, CTRL_TYP_SEL, CTRL_MOD_REQ,
+#if defined(CTRL_FIXED)
+         " fixed"
+#else
+         ""
+#endif
+         );
+  printf("ns/step:%.1f\n", ns);
+  if (fd >= 0 && insn) printf("insn/step:%.1f\n", (double)insn / steps);
+  else                 printf("insn/step:n/a\n");
+  printf("n_mot:%i errCode:%i checksum:%08x\n", rtY.n_mot, rtY.z_errCode, crc);
+  free(in);
+  return 0;
+}
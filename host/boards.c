@@ -0,0 +1,507 @@
+/*
+* Multi-board mock (make host-boards): N mainboards behind virtual serial ports, to run host tools, hoverclient or the
+* ESP32 controller against more boards than are at hand and measure bus throughput, scheduling and latency.
+*
+* Each board is a process running the firmware of the main loop simulation (Src/main.c, util.c, comms.c ... against
+* host/halsim, see host/loop.c), built with VARIANT_USART and DEBUG_SERIAL_PROTOCOL. So the control port (USART2) takes
+* the command frames of usart_process_command and sends SerialFeedback, and the debug port (USART3) speaks the debug
+* protocol ($GET, $SET, the telemetry stream), byte for byte as the firmware of that configuration does.
+* The control interrupt (halsimTick below) runs BLDC_controller_step of both motors against the motor model of
+* host/plant.c, as host/sil.c does. The bldc.c glue is reduced to the hall sensors, the phase and DC link currents, the
+* duty cycles and the odometry: no chopping, dead time compensation, observer or the other options of bldc.c.
+* The slow task and the beeper behave as in host/loop.c, the battery sags with the current of both motors.
+*
+* The virtual clock is paced to the wall clock, the UART transmissions take their time on the wire at the baud rate and
+* the received bytes are taken at the baud rate, once per millisecond. So the ports have the timing of real boards as
+* long as the host keeps up: every board prints the largest lag of its clock behind the wall clock at the end.
+*
+* Ports: one pseudo terminal per port (host/pty.c), the paths are printed at the start, e.g. "board 2 bus 1 id 0 ctl /dev/pts/7
+* dbg /dev/pts/8", with -l also as symlinks. With -b k the control ports of k boards share one pseudo terminal, a
+* multi-drop bus: each byte of the host reaches all of them, their answers are merged in the order they are sent.
+* Build with BOARDS_DEFS=-DSERIAL_BUS so each board only answers its polls, board n gets the bus id n % k (the BUS_ID
+* parameter in its EEPROM). Two boards sending at the same time are not a collision here, their bytes interleave.
+* A reset ($REBOOT, watchdog) restarts the board process with an empty EEPROM, a poweroff ends it.
+*
+* usage: boards [-n boards] [-b k] [-l dir] [-t s] [-f]
+*   -n n      number of boards, default 4
+*   -b k      boards per control port (bus), default 1
+*   -l dir    symlinks dir/boardN.dbg and dir/busM.ctl (dir/boardN.ctl with -b 1) to the ports
+*   -t s      end after s seconds, default at Ctrl-C
+*   -f        free running: the virtual clock runs as fast as the host goes, no pacing, e.g. for soak tests
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "setup.h"
+#include "util.h"
+#include "bldc.h"
+#include "BLDC_controller.h"
+#include "eeprom.h"
+#include "halsim.h"
+#include "plant.h"
+#undef main                             // main.c is built with -Dmain=firmwareMain
+
+#if defined(MCU_GD32F103) || defined(MCU_AT32F403)
+  #error halsim has the HAL clock setup of the STM32F103 only, not the register one of mcu.h. The PWM timing of these parts: make host-sil HOST_DEFS="-DMCU_AT32F403"
+#endif
+
+#define MAX_BOARDS      64
+#define RX_CHUNK        64              // [bytes] largest read of a port per millisecond
+#define EXIT_RESET      3               // exit code of a board process after NVIC_SystemReset
+
+extern uint16_t VirtAddVarTab[NB_OF_VAR];
+int firmwareMain(void);
+int ptyOpen(char *name, size_t len);    // host/pty.c, apart from the register names of halsim
+
+// ####### bldc.c #######
+volatile int pwml, pwmr;
+uint8_t  enable;
+int16_t  batVoltage = (400 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE;
+uint8_t  buzzerFreq, buzzerPattern, buzzerCount;
+volatile uint32_t buzzerTimer;
+AdcCalib adcCalib;
+Odometry odo[2];
+uint8_t  pwmZeroSeq = PWM_ZSEQ;         // parameters of the debug protocol, not applied by pwmCcr
+int16_t  dtComp = DT_COMP;
+IsrDeadlineMiss isrMiss;
+#if defined(HALL_STATS)
+HallStat         hallStat[2];
+volatile uint8_t hallStatReq[2] = {1, 1};
+#endif
+#if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+volatile uint8_t holdReq;
+volatile int16_t holdTgt[2];
+#endif
+
+static int32_t  batVoltageFixdt = (400 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE << 16;
+static BeepNote beepQueue[BEEP_QUEUE_LEN];
+static uint8_t  beepHead, beepTail;
+static uint32_t beepNoteTicks;          // [PWM_FREQ ticks] rest of the playing note
+static BldcState state;
+
+uint8_t beepNote(uint8_t freq, uint16_t ms) {
+  if (((beepHead + 1) & (BEEP_QUEUE_LEN - 1)) == beepTail) {
+    return 0;
+  }
+  beepQueue[beepHead] = (BeepNote){freq, ms};
+  beepHead = (beepHead + 1) & (BEEP_QUEUE_LEN - 1);
+  return 1;
+}
+
+uint8_t beepBusy(void) {
+  halsimAdvance(HALSIM_READ_NS);        // beepWait polls
+  return beepNoteTicks != 0 || beepTail != beepHead;
+}
+
+void bldc_cycle_counter_init(void) {}
+
+void bldc_start_calibration(void) {
+  adcCalib.done = 1;
+}
+
+void bldc_state_read(BldcState *out) {
+  *out = state;
+}
+
+// ####### BOARD PROCESS #######
+typedef struct {
+  int      fd;                          // socket to the port relay of the parent
+  UART_HandleTypeDef *huart;
+  void   (*rxCheck)(void);              // usartX_rx_check, PendSV after an IDLE line
+  uint32_t budget;                      // [bytes / 1000] what the baud rate lets through until now
+  uint64_t rx, tx;                      // [bytes]
+} BoardPort;
+
+static PlantParam plant = PLANT_DEFAULT;
+static SimMotor   motL, motR;
+static uint16_t   ccrL[3], ccrR[3];
+static double     Vbat = BAT_CELLS * 3.8, Rbat = 0.15;  // [V] nominal charge, [Ohm] battery and wiring
+static double     Vdc;
+static BoardPort  ports[2];             // control (USART2) and debug (USART3) port
+static int        boardNr, freeRun;
+static uint32_t   tickCnt;
+static uint8_t    hallPrev[2] = {6, 6};
+static struct timespec wall0;
+static double     lagMax;               // [s] largest lag of the virtual clock behind the wall clock
+static jmp_buf    runEnd;
+static volatile sig_atomic_t stopReq;
+static int        endCode;              // exit code of the board process
+static uint8_t    latched;              // power latch (OFF_PIN) set by the firmware
+
+// bldc.c hall2pos and odoStep: hall steps, counting up while n_mot is positive
+#define HALL_IDX(u, v, w)   ((u) | ((v) << 1) | ((w) << 2))
+static const uint8_t hall2pos[8] = {
+  [HALL_IDX(0,0,0)] = 6, [HALL_IDX(0,0,1)] = 2, [HALL_IDX(0,1,0)] = 4, [HALL_IDX(0,1,1)] = 3,
+  [HALL_IDX(1,0,0)] = 0, [HALL_IDX(1,0,1)] = 1, [HALL_IDX(1,1,0)] = 5, [HALL_IDX(1,1,1)] = 6
+};
+
+static void odoStep(uint8_t m, uint8_t hall) {
+  uint8_t cur = hall2pos[hall], prev = hallPrev[m];
+  if (cur == prev) {
+    return;
+  }
+  int8_t d = (int8_t)cur - (int8_t)prev, dir = 0;
+  if (cur < 6 && prev < 6) {
+    dir = (d == -1 || d == 5) ? 1 : ((d == 1 || d == -5) ? -1 : 0);
+  }
+  odo[m].pos     += dir;
+  odo[m].edgeTick = tickCnt;
+  #if defined(HALL_STATS)
+  if (hallStatReq[m]) {
+    hallStatReset(&hallStat[m]);
+    hallStatReq[m] = 0;
+  }
+  hallStatEdge(&hallStat[m], cur, prev, dir, tickCnt);
+  #endif
+  hallPrev[m] = cur;
+}
+
+static int16_t adcCurrent(double i) {   // bldc.c: cur = offset - adc, A2BIT_CONV bits per A
+  return (int16_t)CLAMP(lround(i * A2BIT_CONV), -2048, 2047);
+}
+
+// bldc.c pwmApply without the dead time compensation and the shunt margin: compare values of the rtY DC_pha* duties
+static void pwmCcr(const ExtY *y, uint16_t ccr[3]) {
+  const int32_t dc[3] = {y->DC_phaA, y->DC_phaB, y->DC_phaC};
+  for (int k = 0; k < 3; k++) {
+    ccr[k] = (uint16_t)CLAMP(dc[k] * PWM_RES / PWM_RES_BASE + PWM_RES / 2, 0, PWM_RES);
+  }
+}
+
+// One controller step of a motor: its inputs from the plant, the step, the plant over the next period.
+// cur0, cur1 are the phases with a shunt (z_selPhaCurMeasABC), A and B on the left, B and C on the right
+static void motorTick(RT_MODEL *rtM, ExtU *u, ExtY *y, SimMotor *mot, uint16_t ccr[3], int pwm, uint8_t enableFin, int cur0, int cur1) {
+  u->b_motEna     = enableFin;
+  u->z_ctrlModReq = ctrlModReq;
+  u->r_inpTgt     = (int16_t)pwm;
+  u->b_hallA      =  mot->hall       & 1;
+  u->b_hallB      = (mot->hall >> 1) & 1;
+  u->b_hallC      =  mot->hall >> 2;
+  u->i_phaAB      = adcCurrent(mot->i[cur0]);
+  u->i_phaBC      = adcCurrent(mot->i[cur1]);
+  u->i_DCLink     = adcCurrent(mot->iDC);
+  BLDC_controller_step(rtM);
+  pwmCcr(y, ccr);
+  plantStep(&plant, mot, ccr, enable, Vdc, 0.0, 0.0, 0);
+}
+
+static double wallNow(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)(t.tv_sec - wall0.tv_sec) + (double)(t.tv_nsec - wall0.tv_nsec) * 1e-9;
+}
+
+/* Every millisecond of virtual time: wait for the wall clock, then what the host sent in that time at the baud rate */
+static void boardIo(void) {
+  double t = (double)halsimNs() * 1e-9, lag = wallNow() - t;
+  if (!freeRun && lag < 0) {
+    struct timespec d = {0, (long)(-lag * 1e9)};
+    nanosleep(&d, NULL);
+  }
+  lagMax = MAX(lagMax, lag);
+
+  for (int p = 0; p < 2; p++) {
+    BoardPort *bp = &ports[p];
+    uint8_t    buf[RX_CHUNK];
+    bp->budget = MIN(bp->budget + bp->huart->Init.BaudRate / 10U, (uint32_t)RX_CHUNK * 1000U);
+    if (bp->budget < 1000U) {
+      continue;
+    }
+    ssize_t n  = recv(bp->fd, buf, bp->budget / 1000U, MSG_DONTWAIT);
+    if (n == 0) {                       // the relay is gone
+      stopReq = 1;
+    }
+    if (n > 0) {
+      bp->budget -= (uint32_t)n * 1000U;
+      bp->rx     += (uint64_t)n;
+      halsimUartRx(bp->huart, buf, (uint16_t)n);
+      bp->rxCheck();
+    }
+  }
+}
+
+static void boardTx(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size) {
+  BoardPort *bp = &ports[huart == &huart2 ? 0 : 1];
+  bp->tx += size;
+  while (size) {
+    ssize_t n = send(bp->fd, data, size, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return;                           // the relay is gone, the next boardIo ends the run
+    }
+    data += n;
+    size -= (uint16_t)n;
+  }
+}
+
+// ####### CONTROL INTERRUPT AND SLOW TASK #######
+void halsimTick(void) {
+  if (stopReq) longjmp(runEnd, 1);
+  tickCnt++;
+  if (tickCnt % (PWM_FREQ / 1000) == 0) {
+    boardIo();
+  }
+
+  // Slow ADC channels: the battery after its resistance, room temperature
+  Vdc = Vbat - Rbat * (motL.iDC + motR.iDC);
+  adc_buffer.batt1 = (uint16_t)CLAMP(Vdc * 100.0 * BAT_CALIB_ADC / BAT_CALIB_REAL_VOLTAGE, 0, 4095);
+  adc_buffer.temp  = (uint16_t)CLAMP(TEMP_CAL_LOW_ADC + (250.0 - TEMP_CAL_LOW_DEG_C) *
+                                     (TEMP_CAL_HIGH_ADC - TEMP_CAL_LOW_ADC) / (TEMP_CAL_HIGH_DEG_C - TEMP_CAL_LOW_DEG_C), 0, 4095);
+
+  // Slow task: battery filter at 16 Hz, beep sequencer
+  buzzerTimer++;
+  if (tickCnt % (PWM_FREQ / 16) == 0) {
+    filtLowPass32Fast(adc_buffer.batt1, BAT_FILT_COEF, &batVoltageFixdt);
+    batVoltage = (int16_t)(batVoltageFixdt >> 16);
+  }
+  if (beepNoteTicks == 0 && beepTail != beepHead) {
+    beepNoteTicks = (uint32_t)beepQueue[beepTail].ms * (PWM_FREQ / 1000);
+    beepTail      = (beepTail + 1) & (BEEP_QUEUE_LEN - 1);
+  }
+  if (beepNoteTicks) {
+    beepNoteTicks--;
+  }
+
+  // Motors
+  uint8_t enableFin = enable && !rtY_Left.z_errCode && !rtY_Right.z_errCode;
+  odoStep(0, motL.hall);
+  odoStep(1, motR.hall);
+  motorTick(rtM_Left,  &rtU_Left,  &rtY_Left,  &motL, ccrL, pwml, enableFin, 0, 1);
+  motorTick(rtM_Right, &rtU_Right, &rtY_Right, &motR, ccrR, pwmr, enableFin, 1, 2);
+
+  state.tick        = tickCnt;
+  state.odo[0]      = odo[0];
+  state.odo[1]      = odo[1];
+  state.n_mot[0]    = rtY_Left.n_mot;
+  state.n_mot[1]    = rtY_Right.n_mot;
+  state.i_DCLink[0] = rtU_Left.i_DCLink;
+  state.i_DCLink[1] = rtU_Right.i_DCLink;
+  state.iq[0]       = rtY_Left.iq;
+  state.iq[1]       = rtY_Right.iq;
+  state.id[0]       = rtY_Left.id;
+  state.id[1]       = rtY_Right.id;
+  state.errCode[0]  = rtY_Left.z_errCode;
+  state.errCode[1]  = rtY_Right.z_errCode;
+  state.batVoltage  = batVoltage;
+}
+
+void halsimPinWrite(GPIO_TypeDef *port, uint16_t pin) {
+  if (port != OFF_PORT || pin != OFF_PIN) return;
+  if (port->ODR & pin) {
+    latched = 1;
+  } else if (latched) {                 // the latch lets go: the board is off
+    fprintf(stderr, "board %i: poweroff\n", boardNr);
+    longjmp(runEnd, 1);
+  }
+}
+
+void halsimReset(void) {
+  endCode = EXIT_RESET;
+  longjmp(runEnd, 1);
+}
+
+static void boardStop(int sig) {
+  (void)sig;
+  stopReq = 1;
+}
+
+static int boardRun(int nr, uint8_t id, int ctlFd, int dbgFd) {
+  boardNr  = nr;
+  ports[0] = (BoardPort){.fd = ctlFd, .huart = &huart2, .rxCheck = usart2_rx_check};
+  ports[1] = (BoardPort){.fd = dbgFd, .huart = &huart3, .rxCheck = usart3_rx_check};
+  Vdc      = Vbat;
+  signal(SIGINT, boardStop);
+  signal(SIGTERM, boardStop);
+  halsimUartTxHook(boardTx);
+  halsimUartWire(1);
+  #if defined(SERIAL_BUS)
+  EE_WriteVariable(VirtAddVarTab[EE_ADDR_BUS], id);
+  #else
+  (void)id;
+  #endif
+  clock_gettime(CLOCK_MONOTONIC, &wall0);
+  if (!setjmp(runEnd)) {
+    firmwareMain();
+  }
+  double t = (double)halsimNs() * 1e-9;
+  fprintf(stderr, "board %i: %.1f s, lag max %.1f ms, ctl rx %llu tx %llu, dbg rx %llu tx %llu bytes\n", nr, t, lagMax * 1e3,
+          (unsigned long long)ports[0].rx, (unsigned long long)ports[0].tx, (unsigned long long)ports[1].rx,
+          (unsigned long long)ports[1].tx);
+  return endCode;
+}
+
+// ####### PORT RELAY #######
+static int   nBoards = 4, perBus = 1;
+static int   ctlPty[MAX_BOARDS], dbgPty[MAX_BOARDS];        // pseudo terminal masters, ctlPty per bus
+static int   ctlSock[MAX_BOARDS][2], dbgSock[MAX_BOARDS][2]; // [0] relay end, [1] board end
+static pid_t pid[MAX_BOARDS];
+static volatile sig_atomic_t quit;
+
+static void relayStop(int sig) {
+  (void)sig;
+  quit = 1;
+}
+
+static void portLink(const char *dir, const char *name, const char *path) {
+  char link[256];
+  snprintf(link, sizeof(link), "%s/%s", dir, name);
+  unlink(link);
+  if (symlink(path, link)) perror(link);
+}
+
+static pid_t boardStart(int b) {
+  fflush(NULL);
+  pid_t p = fork();
+  if (p == 0) {
+    for (int k = 0; k < nBoards; k++) {
+      close(ctlSock[k][0]);
+      close(dbgSock[k][0]);
+      close(dbgPty[k]);
+      if (k % perBus == 0) close(ctlPty[k / perBus]);
+    }
+    exit(boardRun(b, (uint8_t)(b % perBus), ctlSock[b][1], dbgSock[b][1]));
+  }
+  return p;
+}
+
+/* Bytes from a pseudo terminal to the board sockets on it, or from a board socket to its pseudo terminal. A full
+ * pseudo terminal (no client reading) drops them as a line nobody listens to */
+static void relay(int from, const int *to, int nTo) {
+  uint8_t buf[4096];
+  ssize_t n = read(from, buf, sizeof(buf));
+  for (int k = 0; k < nTo && n > 0; k++) {
+    if (write(to[k], buf, (size_t)n) < 0 && errno != EAGAIN) {
+      perror("relay");
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *linkDir = NULL;
+  double tEnd = 0;
+  int fast = 0;
+
+  for (int k = 1; k < argc; k++) {
+    if (!strcmp(argv[k], "-n") && k + 1 < argc) nBoards = atoi(argv[++k]);
+    else if (!strcmp(argv[k], "-b") && k + 1 < argc) perBus = atoi(argv[++k]);
+    else if (!strcmp(argv[k], "-l") && k + 1 < argc) linkDir = argv[++k];
+    else if (!strcmp(argv[k], "-t") && k + 1 < argc) tEnd = atof(argv[++k]);
+    else if (!strcmp(argv[k], "-f")) fast = 1;
+    else {
+      fprintf(stderr, "usage: %s [-n boards] [-b k] [-l dir] [-t s] [-f]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (nBoards < 1 || nBoards > MAX_BOARDS || perBus < 1 || perBus > nBoards) {
+    fprintf(stderr, "1..%i boards, 1..n boards per bus\n", MAX_BOARDS);
+    return 1;
+  }
+  #if defined(SERIAL_BUS)
+  if (perBus > PROTO_BUS_MAX) {
+    fprintf(stderr, "at most %i boards per bus (PROTO_BUS_MAX)\n", PROTO_BUS_MAX);
+    return 1;
+  }
+  #else
+  if (perBus > 1) {
+    fprintf(stderr, "note: built without SERIAL_BUS, all boards of a bus answer every frame\n");
+  }
+  #endif
+  freeRun = fast;
+
+  int  nBus = (nBoards + perBus - 1) / perBus;
+  char ctlPath[MAX_BOARDS][64];
+  for (int b = 0; b < nBus; b++) {
+    char name[64];
+    ctlPty[b] = ptyOpen(ctlPath[b], sizeof(ctlPath[b]));
+    snprintf(name, sizeof(name), perBus > 1 ? "bus%i.ctl" : "board%i.ctl", b);
+    if (linkDir) portLink(linkDir, name, ctlPath[b]);
+  }
+  for (int b = 0; b < nBoards; b++) {
+    char name[64], path[64];
+    dbgPty[b] = ptyOpen(path, sizeof(path));
+    snprintf(name, sizeof(name), "board%i.dbg", b);
+    if (linkDir) portLink(linkDir, name, path);
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, ctlSock[b]) || socketpair(AF_UNIX, SOCK_STREAM, 0, dbgSock[b])) {
+      perror("socketpair");
+      return 1;
+    }
+    fcntl(ctlSock[b][0], F_SETFL, O_NONBLOCK);        // a board takes the bytes at its baud rate, more is an overrun
+    fcntl(dbgSock[b][0], F_SETFL, O_NONBLOCK);
+    printf("board %i bus %i id %i ctl %s dbg %s\n", b, b / perBus, b % perBus, ctlPath[b / perBus], path);
+  }
+  for (int b = 0; b < nBoards; b++) {
+    pid[b] = boardStart(b);
+  }
+  signal(SIGINT, relayStop);
+  signal(SIGTERM, relayStop);
+
+  struct pollfd fds[3 * MAX_BOARDS];
+  struct timespec t0, t;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  int alive = nBoards;
+  while (!quit && alive) {
+    int nf = 0;
+    for (int b = 0; b < nBus; b++)    fds[nf++] = (struct pollfd){.fd = ctlPty[b], .events = POLLIN};
+    for (int b = 0; b < nBoards; b++) fds[nf++] = (struct pollfd){.fd = dbgPty[b], .events = POLLIN};
+    for (int b = 0; b < nBoards; b++) fds[nf++] = (struct pollfd){.fd = ctlSock[b][0], .events = POLLIN};
+    for (int b = 0; b < nBoards; b++) fds[nf++] = (struct pollfd){.fd = dbgSock[b][0], .events = POLLIN};
+    if (poll(fds, (nfds_t)nf, 100) > 0) {
+      nf = 0;
+      for (int b = 0; b < nBus; b++, nf++) {
+        if (fds[nf].revents & POLLIN) {
+          int to[MAX_BOARDS], nTo = 0;
+          for (int k = b * perBus; k < MIN((b + 1) * perBus, nBoards); k++) to[nTo++] = ctlSock[k][0];
+          relay(ctlPty[b], to, nTo);
+        }
+      }
+      for (int b = 0; b < nBoards; b++, nf++) {
+        if (fds[nf].revents & POLLIN) relay(dbgPty[b], &dbgSock[b][0], 1);
+      }
+      for (int b = 0; b < nBoards; b++, nf++) {
+        if (fds[nf].revents & POLLIN) relay(ctlSock[b][0], &ctlPty[b / perBus], 1);
+      }
+      for (int b = 0; b < nBoards; b++, nf++) {
+        if (fds[nf].revents & POLLIN) relay(dbgSock[b][0], &dbgPty[b], 1);
+      }
+    }
+
+    int   st;
+    pid_t p;
+    while ((p = waitpid(-1, &st, WNOHANG)) > 0) {
+      for (int b = 0; b < nBoards; b++) {
+        if (pid[b] != p) continue;
+        if (WIFEXITED(st) && WEXITSTATUS(st) == EXIT_RESET && !quit) {
+          fprintf(stderr, "board %i: reset\n", b);
+          pid[b] = boardStart(b);
+        } else {
+          pid[b] = 0;
+          alive--;
+        }
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    if (tEnd > 0 && (double)(t.tv_sec - t0.tv_sec) + (double)(t.tv_nsec - t0.tv_nsec) * 1e-9 >= tEnd) {
+      quit = 1;
+    }
+  }
+
+  for (int b = 0; b < nBoards; b++) {
+    if (pid[b] > 0) kill(pid[b], SIGTERM);
+  }
+  while (wait(NULL) > 0) {}
+  return 0;
+}
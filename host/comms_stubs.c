@@ -0,0 +1,99 @@
+/*
+* Firmware globals and functions used by Src/comms.c, for the host builds that link it (host/fuzz_comms.c,
+* host/eeprom_image.c). Covers the params[] of VARIANT_USART and VARIANT_ADC with DEBUG_SERIAL_PROTOCOL, a
+* configuration reaching more globals fails to link until they are added here.
+* The emulated EEPROM is a RAM array indexed like VirtAddVarTab, a variable not written yet reads as not found.
+*/
+
+#include <stdint.h>
+#include <time.h>
+#include "defines.h"                    // pulls in Inc/config.h
+#include "util.h"
+#include "bldc.h"
+#include "sched.h"
+#include "eeprom.h"
+#include "comms.h"
+#include "BLDC_controller.h"
+#include "comms_stubs.h"
+
+P     rtP_Left, rtP_Right;
+ExtY  rtY_Left, rtY_Right;
+int16_t batVoltageCalib, board_temp_deg_c, cmdL, cmdR, dc_curr, left_dc_curr, right_dc_curr, speedAvg, dtComp;
+uint8_t boardCfgFlags, buttonMode, ctrlModReqRaw, inputCalProg, inputCalRes, pwmZeroSeq, schedRst;
+uint32_t debugTxDrop;
+uint16_t VirtAddVarTab[NB_OF_VAR];
+#if defined(PRI_INPUT1) && defined(PRI_INPUT2) && defined(AUX_INPUT1) && defined(AUX_INPUT2)
+InputStruct input1[INPUTS_NR] = { {0, 0, 0, PRI_INPUT1}, {0, 0, 0, AUX_INPUT1} };     // as util.c, config.h limits
+InputStruct input2[INPUTS_NR] = { {0, 0, 0, PRI_INPUT2}, {0, 0, 0, AUX_INPUT2} };
+#else
+InputStruct input1[INPUTS_NR] = { {0, 0, 0, PRI_INPUT1} };
+InputStruct input2[INPUTS_NR] = { {0, 0, 0, PRI_INPUT2} };
+#endif
+AdcCalib adcCalib;
+IsrDeadlineMiss isrMiss;
+Odometry odo[2];
+SchedTask schedTasks[SCHED_TASKS];
+#if defined(CTRL_GAINS)
+uint16_t ctrlGains[CG_N] = {CTRL_GAIN_ID_KP, CTRL_GAIN_ID_KI, CTRL_GAIN_IQ_KP, CTRL_GAIN_IQ_KI, CTRL_GAIN_N_KP, CTRL_GAIN_N_KI, CTRL_GAIN_FILT};
+#endif
+#if defined(SELF_TEST)
+SelfTest selfTest;
+#endif
+#if defined(CONTROL_SERIAL_USART2) || defined(SIDEBOARD_SERIAL_USART2)
+SerialRx rxFrame_L;
+#endif
+#if defined(CONTROL_SERIAL_USART3) || defined(SIDEBOARD_SERIAL_USART3)
+SerialRx rxFrame_R;
+#endif
+#if (defined(CONTROL_SERIAL_USART2) || defined(CONTROL_SERIAL_USART3)) && !defined(CONTROL_IBUS)
+SerialLatency serialLat_L, serialLat_R;
+#endif
+#if !defined(SERIAL_BUS) && defined(FEEDBACK_SERIAL_USART2)
+SerialTx fbTx_L;
+#endif
+#if !defined(SERIAL_BUS) && defined(FEEDBACK_SERIAL_USART3)
+SerialTx fbTx_R;
+#endif
+
+uint64_t stubTxBytes;
+uint16_t stubEE[NB_OF_VAR];
+uint8_t  stubEEWritten[NB_OF_VAR];
+
+int  debugTxFree(void) { return 1 << 16; }
+int  debugTxWrite(const uint8_t *data, int len) { (void)data; stubTxBytes += len; return len; }
+void Board_Cfg_Init(void) {}
+void Input_Lim_Init(void) {}
+void Input_Scale_Init(void) {}
+#if defined(CTRL_GAINS)
+void ctrlGainsApply(void) {}
+#endif
+void beepShort(uint8_t freq) { (void)freq; }
+uint8_t inputCalStart(uint8_t mode) { (void)mode; return 1; }
+void inputCalStop(void) {}
+uint32_t timeUs(void) { return (uint32_t)clock(); }
+int  HAL_FLASH_Unlock(void) { return 0; }
+int  HAL_FLASH_Lock(void) { return 0; }
+uint16_t EE_Commit(void) { return 0; }
+void EE_Save(void) {}
+
+static int stubEEIndex(uint16_t VirtAddress) {
+  for (int i = 0; i < NB_OF_VAR; i++) {
+    if (VirtAddVarTab[i] == VirtAddress) return i;
+  }
+  return -1;
+}
+
+uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t *Data) {
+  int i = stubEEIndex(VirtAddress);
+  if (i < 0 || !stubEEWritten[i]) return 1;
+  *Data = stubEE[i];
+  return 0;
+}
+
+uint16_t EE_WriteVariable(uint16_t VirtAddress, uint16_t Data) {
+  int i = stubEEIndex(VirtAddress);
+  if (i < 0) return NO_VALID_PAGE;
+  stubEE[i]        = Data;
+  stubEEWritten[i] = 1;
+  return 0;
+}
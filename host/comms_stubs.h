@@ -0,0 +1,7 @@
+#pragma once
+#include <stdint.h>
+
+// Stubs of host/comms_stubs.c
+extern uint64_t stubTxBytes;            // [bytes] written by debugTxWrite
+extern uint16_t stubEE[];               // emulated EEPROM values, indexed like VirtAddVarTab
+extern uint8_t  stubEEWritten[];        // [-] value written by EE_WriteVariable or loaded by the host tool
@@ -0,0 +1,108 @@
+/*
+* Host build configuration for BLDC_controller (make host-bench).
+* Replaces Inc/config.h, which needs the STM32 HAL. Only the settings used by the
+* controller and by the host programs are defined here, keep the defaults in sync with Inc/config.h.
+*/
+
+// Define to prevent recursive inclusion
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <limits.h>
+
+// The generated code checks for a 32-bit long. The controller does not use long,
+// so the check is satisfied on 64-bit hosts as well
+#if ULONG_MAX != 0xFFFFFFFFU
+  #undef  ULONG_MAX
+  #undef  LONG_MAX
+  #define ULONG_MAX       0xFFFFFFFFU
+  #define LONG_MAX        0x7FFFFFFF
+#endif
+
+#define COM_CTRL        0               // [-] Commutation Control Type
+#define SIN_CTRL        1               // [-] Sinusoidal Control Type
+#define FOC_CTRL        2               // [-] Field Oriented Control (FOC) Type
+
+#define OPEN_MODE       0               // [-] OPEN mode
+#define VLT_MODE        1               // [-] VOLTAGE mode
+#define SPD_MODE        2               // [-] SPEED mode
+#define TRQ_MODE        3               // [-] TORQUE mode
+#define POS_MODE        4               // [-] POSITION mode, the controller runs in SPD_MODE
+
+#ifndef CTRL_TYP_SEL
+  #define CTRL_TYP_SEL  FOC_CTRL        // [-] Control type selection, e.g. make host-bench HOST_DEFS="-DCTRL_TYP_SEL=1"
+#endif
+#ifndef CTRL_MOD_REQ
+  #define CTRL_MOD_REQ  VLT_MODE        // [-] Control mode request
+#endif
+// #define CTRL_FIXED                   // [-] Pass -DCTRL_FIXED in HOST_DEFS to benchmark the specialised controller
+// #define CTRL_MULTIRATE               // [-] Pass -DCTRL_MULTIRATE in HOST_DEFS for FOC every tick, slow tasks every CTRL_SLOW_DIV ticks
+// #define CTRL_DSP                     // [-] Pass -DCTRL_DSP in HOST_DEFS for the paired Park products, in plain C on the host
+#ifndef CTRL_SLOW_DIV
+  #define CTRL_SLOW_DIV 4               // [ticks] CTRL_MULTIRATE slow task period
+#endif
+
+#ifndef PWM_FREQ
+  #define PWM_FREQ      16000           // PWM frequency in Hz, controller step rate, e.g. make host-sil HOST_DEFS="-DPWM_FREQ=20000"
+#endif
+#define PWM_FREQ_BASE   16000           // [Hz] rate the generated controller parameters were tuned for
+#define PWM_RES_BASE    (64000000 / 2 / PWM_FREQ_BASE)  // [timer counts] period the controller duties are scaled for
+#if defined(SYSCLK_HZ)                  // [Hz] PWM timer clock of the simulated board, as Inc/config.h: HOST_DEFS="-DMCU_AT32F403"
+#elif defined(MCU_AT32F403)
+  #define SYSCLK_HZ     240000000
+#elif defined(MCU_GD32F103)
+  #define SYSCLK_HZ     108000000
+#elif defined(CLOCK_HSE)
+  #define SYSCLK_HZ     72000000
+#else
+  #define SYSCLK_HZ     64000000
+#endif
+#define DELAY_IN_MAIN_LOOP 5            // [ms] main loop period, the input target is updated at this rate
+#define A2BIT_CONV      50              // A to bit for current conversion on ADC
+#define DIAG_ENA        1               // [-] Motor Diagnostics enable flag
+#define I_MOT_MAX       20              // [A] Maximum single motor current limit
+#define I_DC_MAX        25              // [A] Maximum stage2 DC Link current limit (current chopping)
+#define N_MOT_MAX       2000            // [rpm] Maximum motor speed limit
+#define FIELD_WEAK_ENA  1               // [-] Field Weakening / Phase Advance: 0 = off, 1 = linear, 2 = map (FOC)
+#define FIELD_WEAK_MAX  10              // [A] Maximum Field Weakening D axis current
+#define PHASE_ADV_MAX   25              // [deg] Maximum Phase Advance angle
+#define FIELD_WEAK_HI   1000            // Input target High threshold for reaching maximum Field Weakening / Phase Advance
+#define FIELD_WEAK_LO   750             // Input target Low threshold for starting Field Weakening / Phase Advance
+#define FIELD_WEAK_MAP_VBAT 3600        // [V*100] battery voltage of the field weakening map calibration (sil -w)
+#define SPEED_COEFFICIENT   16384       // fixdt(1,16,14) mixer speed coefficient, 1.0
+#define STEER_COEFFICIENT   8192        // fixdt(1,16,14) mixer steer coefficient, 0.5
+
+// #define SPD_REF_GEN                  // [-] Pass -DSPD_REF_GEN in HOST_DEFS for the SPD_MODE reference generator and feedforward
+#define SPD_REF_ACC     500             // [rpm/s] maximum speed reference acceleration
+#define SPD_REF_JERK    5000            // [rpm/s^2] maximum change of the acceleration
+#define SPD_FF_ACC      28              // [mA per rpm/s] acceleration current of the SIL wheel, J * 2 pi / 60 / (1.5 * Ke)
+
+// #define POS_CTRL                     // [-] Pass -DPOS_CTRL in HOST_DEFS for the position loop (sil signal pos)
+#define POS_CTRL_DIV    16              // [ticks] position loop period
+#define POS_SPD_MAX     300             // [rpm] maximum speed of a position move
+#define POS_ACC         600             // [rpm/s] acceleration and braking of a position move
+#define POS_KP          20              // [1/s] position gain near the target
+// #define STANDSTILL_HOLD_ENABLE       // [-] Pass -DSTANDSTILL_HOLD_ENABLE and / or -DCRUISE_CONTROL_SUPPORT in HOST_DEFS for the holds (sil signal hold)
+
+// #define ANGLE_OBSERVER               // [-] Pass -DANGLE_OBSERVER in HOST_DEFS to run the flux observer in the SIL
+#define OBS_R           120             // [mOhm] motor phase resistance, the SIL motor: set R
+#define OBS_L           250             // [uH] motor phase inductance, set L
+#define OBS_FLUX        25333           // [uV s] rotor flux linkage, set Ke / 15 pole pairs. Within a factor 1.5
+#define OBS_SPD_LO      150             // [rpm] hall angle below, offset learning above
+#define OBS_SPD_HI      250             // [rpm] observer angle above, once the offset is learned
+#define DT_COMP         0               // [timer counts] dead time compensation, e.g. -p dt_comp=24 with "set dead 48"
+#define DT_COMP_BAND    300             // [mA] linear band around zero current
+#define FOC_VOLT_MAX    900             // [-] FOC voltage vector limit, e.g. -p foc_volt_max=945
+// #define HALL_CALIB                   // [-] Pass -DHALL_CALIB in HOST_DEFS for the hallcal signal and the hall edge correction
+#define HALL_CALIB_VOLT  40             // [-] open loop voltage amplitude, 1000 = full
+#define HALL_CALIB_SPEED 10             // [rpm] open loop wheel speed
+// #define MOTOR_IDENT                  // [-] Pass -DMOTOR_IDENT in HOST_DEFS for the motorid signal (R, L and flux identification)
+#define MOTOR_IDENT_CUR  8              // [A] DC test current
+#define MOTOR_IDENT_VLT  400            // [-] VLT_MODE target of the flux measurement
+#define MOTOR_IDENT_BW   500            // [Hz] current loop bandwidth of the gains applied after the identification, 0 = keep
+// #define COGGING_COMP                 // [-] Pass -DCOGGING_COMP in HOST_DEFS for the cogcal signal and the TORQUE mode compensation
+#define COGGING_SPEED    30             // [rpm] recording speed
+#define COGGING_TIME     10             // [s] recording time per direction
+#define COGGING_N_MAX    60             // [rpm] full compensation up to this speed
+
+#endif // CONFIG_H
@@ -0,0 +1,265 @@
+/*
+* EEPROM emulation image of a vehicle configuration (make eeprom-image), for provisioning a board in one flash operation.
+* The parameters persisted by params[] of Src/comms.c are taken from a parameter file, the others keep their config.h
+* values, and written like saveAllParamVal does: FLASH_WRITE_KEY, the values, the schema and the CRC. The records go
+* into a VALID_PAGE bank in the format of Src/eeprom.c, the second bank stays erased. At boot loadAllParamVal accepts
+* the configuration and the config.h defaults and the input auto detection are skipped.
+*
+* comms.c is built with the same Inc/config.h as the firmware, so the image matches the params[] layout of that build;
+* the stubs of host/comms_stubs.c stand in for the rest of the firmware. Before it is written the image is read back
+* through loadAllParamVal and compared.
+*
+* Parameter file, one per line, in external units as for $SET, '#' starts a comment:
+*   NAME value
+*   $SET NAME value
+*   # name:"NAME" id:3 value:1500 init:...      (the "$GET" output of a configured board, parameters without address skipped)
+*
+* usage: eeprom_image -t                                       template with the config.h values of all persisted parameters
+*        eeprom_image [-i firmware.bin [-a base]] params out.bin  the two banks, to flash at EEPROM_START_ADDRESS, or with -i
+*                                                              the firmware padded up to the banks, to flash at base
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "defines.h"                    // pulls in Inc/config.h
+#include "util.h"
+#include "eeprom.h"
+#include "comms.h"
+#include "comms_stubs.h"
+
+#if !defined(DEBUG_SERIAL_PROTOCOL) || defined(VARIANT_HOVERBOARD) || defined(VARIANT_TRANSPOTTER)
+  #error The EEPROM image needs DEBUG_SERIAL_PROTOCOL and a variant with the EEPROM emulation: the layout is the params[] of comms.c.
+#endif
+
+#if defined(DEBUG_NO_HELP)
+  #define PARAM_HELP_TEXT(i)  ""        // params[] has no help texts, make param-export has them
+#else
+  #define PARAM_HELP_TEXT(i)  params[i].help
+#endif
+
+#define VIRT_ADDR_BASE  1000            // VirtAddVarTab of util.c: 1000 + index
+#define LINE_MAX_LEN    256
+
+extern const parameter_entry params[];
+
+static uint8_t nParams;
+static uint8_t bank[2 * PAGE_SIZE];
+
+static int persisted(uint8_t i) {
+  return params[i].type == PARAMETER && params[i].addr;
+}
+
+static int inputParam(uint8_t i) {     // points into input1[] / input2[], the defaults come from PRI_INPUTx / AUX_INPUTx
+  const char *p = params[i].valueL;
+  return (p >= (const char *)input1 && p < (const char *)(input1 + INPUTS_NR)) ||
+         (p >= (const char *)input2 && p < (const char *)(input2 + INPUTS_NR));
+}
+
+// config.h values: the params[] init values, the input limits and types as set up by util.c for the config.h path
+static void configDefaults(void) {
+  for (uint8_t i = 0; i < nParams; i++) {
+    if (persisted(i) && !inputParam(i)) setParamValInt(i, getParamInitInt(i));
+  }
+  for (uint8_t i = 0; i < INPUTS_NR; i++) {
+    input1[i].typ = input1[i].typDef;
+    input2[i].typ = input2[i].typDef;
+  }
+}
+
+static int findName(const char *name) {
+  char buf[40];
+  uint8_t size;
+  int len = snprintf(buf, sizeof(buf), "%s\n", name);
+  if (len >= (int)sizeof(buf)) return -1;
+  return findParam((uint8_t *)buf, (uint32_t)len, &size);
+}
+
+// Apply one line of the parameter file, returns 0 on an error
+static int applyLine(char *line, const char *file, int lineNr) {
+  char name[40];
+  long value;
+  int idx, dump = 0;
+
+  line[strcspn(line, "\r\n")] = 0;
+  if (sscanf(line, " # name:\"%39[^\"]\" id:%*d value:%ld", name, &value) == 2) {
+    dump = 1;
+  } else {
+    char *c = strchr(line, '#');
+    if (c) *c = 0;
+    if (sscanf(line, " $SET %39s %ld", name, &value) != 2 && sscanf(line, " %39s %ld", name, &value) != 2) {
+      char extra[2];
+      if (sscanf(line, " %1s", extra) != 1) return 1;        // empty or comment
+      fprintf(stderr, "%s:%d: expected NAME value\n", file, lineNr);
+      return 0;
+    }
+  }
+
+  idx = findName(name);
+  if (idx < 0) {
+    if (dump) return 1;                 // parameter of another configuration or firmware version in a $GET dump
+    fprintf(stderr, "%s:%d: unknown parameter %s\n", file, lineNr, name);
+    return 0;
+  }
+  if (!persisted((uint8_t)idx)) {
+    if (dump) return 1;
+    fprintf(stderr, "%s:%d: %s is not saved to the EEPROM\n", file, lineNr, name);
+    return 0;
+  }
+  if (!IN_RANGE(value, params[idx].min, params[idx].max)) {
+    fprintf(stderr, "%s:%d: %s %ld out of range %li..%li\n", file, lineNr, name, value, (long)params[idx].min, (long)params[idx].max);
+    return 0;
+  }
+  setParamValInt((uint8_t)idx, extToInt((uint8_t)idx, (int32_t)value));
+  return 1;
+}
+
+// A stored input type is used as is, the auto detection (3) only runs on the config.h path
+static int checkInputTypes(void) {
+  int ok = 1;
+  for (uint8_t i = 0; i < nParams; i++) {
+    if (persisted(i) && inputParam(i) && params[i].datatype == UINT8_T && getParamValInt(i) == 3) {
+      fprintf(stderr, "%s is 3 (auto), set 0 (disabled), 1 (normal) or 2 (mid resting)\n", params[i].name);
+      ok = 0;
+    }
+  }
+  return ok;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static uint16_t get16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Bank 0 valid with the records of saveAllParamVal in VirtAddVarTab order, bank 1 erased
+static int buildBanks(void) {
+  uint32_t pos = 4;
+  memset(stubEEWritten, 0, NB_OF_VAR);
+  saveAllParamVal();
+  memset(bank, 0xFF, sizeof(bank));
+  put16(bank, VALID_PAGE);
+  for (uint16_t i = 0; i < NB_OF_VAR; i++) {
+    if (!stubEEWritten[i]) continue;
+    if (pos + 4 > PAGE_SIZE) return 0;
+    put16(bank + pos,     stubEE[i]);
+    put16(bank + pos + 2, VirtAddVarTab[i]);
+    pos += 4;
+  }
+  return 1;
+}
+
+// Read bank 0 like EE_CacheLoad into the stubbed EEPROM, load it with loadAllParamVal and compare
+static int verifyBanks(void) {
+  int32_t expect[128];
+  for (uint8_t i = 0; i < nParams; i++) {
+    if (persisted(i)) {
+      expect[i] = getParamValInt(i);
+      setParamValInt(i, ~expect[i] & 1);
+    }
+  }
+  memset(stubEEWritten, 0, NB_OF_VAR);
+  if (get16(bank) != VALID_PAGE) return 0;
+  for (uint32_t pos = 4; pos + 4 <= PAGE_SIZE && get16(bank + pos + 2) != 0xFFFF; pos += 4) {
+    EE_WriteVariable(get16(bank + pos + 2), get16(bank + pos));
+  }
+  if (!loadAllParamVal()) return 0;
+  for (uint8_t i = 0; i < nParams; i++) {
+    if (persisted(i) && getParamValInt(i) != expect[i]) {
+      fprintf(stderr, "read back %s: %li, expected %li\n", params[i].name, (long)getParamValInt(i), (long)expect[i]);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int writeImage(const char *out, const char *fw, uint32_t base) {
+  uint32_t pad = 0, fwLen = 0;
+  uint8_t *fwData = NULL;
+  FILE *f;
+
+  if (fw) {
+    if (base > EEPROM_START_ADDRESS) {
+      fprintf(stderr, "base 0x%08x above the EEPROM emulation at 0x%08x\n", (unsigned)base, (unsigned)EEPROM_START_ADDRESS);
+      return 0;
+    }
+    if (!(f = fopen(fw, "rb"))) { perror(fw); return 0; }
+    fseek(f, 0, SEEK_END);
+    fwLen = (uint32_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (fwLen > EEPROM_START_ADDRESS - base) {
+      fprintf(stderr, "%s: %u bytes from 0x%08x overlap the EEPROM emulation at 0x%08x\n", fw, (unsigned)fwLen, (unsigned)base, (unsigned)EEPROM_START_ADDRESS);
+      fclose(f);
+      return 0;
+    }
+    fwData = malloc(fwLen ? fwLen : 1);
+    if (fread(fwData, 1, fwLen, f) != fwLen) { perror(fw); fclose(f); free(fwData); return 0; }
+    fclose(f);
+    pad = EEPROM_START_ADDRESS - base - fwLen;
+  }
+
+  if (!(f = fopen(out, "wb"))) { perror(out); free(fwData); return 0; }
+  fwrite(fwData, 1, fwLen, f);
+  for (uint32_t i = 0; i < pad; i++) fputc(0xFF, f);          // erased flash, including the fault log pages
+  fwrite(bank, 1, sizeof(bank), f);
+  fclose(f);
+  free(fwData);
+  printf("%s: flash at 0x%08x\n", out, (unsigned)(fw ? base : EEPROM_START_ADDRESS));
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  const char *fw = NULL, *in = NULL, *out = NULL;
+  uint32_t base = 0x08000000;
+  int tmpl = 0, ok = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-t")) tmpl = 1;
+    else if (!strcmp(argv[i], "-i") && i + 1 < argc) fw = argv[++i];
+    else if (!strcmp(argv[i], "-a") && i + 1 < argc) base = (uint32_t)strtoul(argv[++i], NULL, 0);
+    else if (!in) in = argv[i];
+    else out = argv[i];
+  }
+  if (!tmpl && (!in || !out)) {
+    fprintf(stderr, "usage: %s -t | [-i firmware.bin [-a base]] params out.bin\n", argv[0]);
+    return 2;
+  }
+
+  for (uint16_t i = 0; i < NB_OF_VAR; i++) VirtAddVarTab[i] = VIRT_ADDR_BASE + i;
+  while (nParams < 127) {                                      // "#<id>" is found up to the last params[] entry
+    char id[8];
+    snprintf(id, sizeof(id), "#%u", nParams);
+    if (findName(id) < 0) break;
+    nParams++;
+  }
+  configDefaults();
+
+  if (tmpl) {
+    printf("# NAME value, config.h values. An input type 3 (auto) has to be replaced by the type of the input\n");
+    for (uint8_t i = 0; i < nParams; i++) {
+      if (persisted(i)) printf("%-16s %6li    # %li..%li %s\n", params[i].name, (long)getParamValExt(i), (long)params[i].min, (long)params[i].max, PARAM_HELP_TEXT(i));
+    }
+    return 0;
+  }
+
+  FILE *f = fopen(in, "r");
+  if (!f) { perror(in); return 1; }
+  char line[LINE_MAX_LEN];
+  for (int n = 1; fgets(line, sizeof(line), f); n++) ok &= applyLine(line, in, n);
+  fclose(f);
+  if (!ok || !checkInputTypes()) return 1;
+
+  if (!buildBanks()) {
+    fprintf(stderr, "the records do not fit into a bank of %u bytes\n", (unsigned)PAGE_SIZE);
+    return 1;
+  }
+  if (!verifyBanks()) {
+    fprintf(stderr, "the image is not accepted by loadAllParamVal\n");
+    return 1;
+  }
+  return writeImage(out, fw, base) ? 0 : 1;
+}
@@ -0,0 +1,283 @@
+/*
+* Throughput benchmark and coverage-guided fuzzer of the debug protocol input path of Src/comms.c
+* (make host-parse-bench, make host-fuzz): handle_input_chunk, handle_input, findCommand, findParam, the binary requests
+* and process_commands. comms.c is built against host/shim and the real Inc/config.h with VARIANT_USART and
+* DEBUG_SERIAL_PROTOCOL; the globals it reaches through params[] and the HAL, EEPROM and UART functions are stubbed in
+* host/comms_stubs.c.
+*
+* The fuzz build instruments comms.c with -fsanitize-coverage=trace-pc: an input that reaches a new edge joins the corpus.
+* AddressSanitizer and UBSan stop at the first over-read, overflow or undefined operation, the input is saved first.
+* The parser keeps a partial line or binary request across inputs, like on the board.
+*
+* usage: fuzz_comms -b                              lines per second for $SET / $GET / $WATCH traffic and a garbage burst
+*        fuzz_comms [-n runs] [-s seed] corpus_dir  fuzz from the seed files in corpus_dir, a failing input goes to fuzz-crash.bin
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/common_interface_defs.h>
+#endif
+#include "defines.h"                    // pulls in Inc/config.h
+#include "util.h"
+#include "bldc.h"
+#include "sched.h"
+#include "eeprom.h"
+#include "comms.h"
+#include "BLDC_controller.h"
+#include "comms_stubs.h"
+
+#define FUZZ_MAX_INPUT  512             // [bytes] longest fuzz input
+#define FUZZ_MAX_CORPUS 1024            // inputs kept
+#define COV_BITS        16              // [-] edge map of 64k entries
+
+// ####### COVERAGE: AFL style edge map, filled by the trace-pc calls in comms.c #######
+static uint8_t  covMap[1 << COV_BITS];
+static uintptr_t covPrev;
+static uint32_t covNew;
+
+void __sanitizer_cov_trace_pc(void) {
+  uintptr_t pc = (uintptr_t)__builtin_return_address(0);
+  uintptr_t e  = ((pc >> 4) ^ (pc << 8) ^ covPrev) & ((1 << COV_BITS) - 1);
+  covPrev = (pc >> 5) & ((1 << COV_BITS) - 1);
+  if (!covMap[e]) {
+    covMap[e] = 1;
+    covNew++;
+  }
+}
+
+// ####### INPUT PATH #######
+static uint32_t rngState = 0x2545F491;
+static uint32_t rnd(void) {             // xorshift32
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+// Feed data in UART idle sized chunks, then run the queued commands as the main loop does
+static void feed(const uint8_t *data, uint32_t len, uint32_t chunk) {
+  while (len) {
+    uint32_t n = (len < chunk) ? len : chunk;
+    uint8_t *c = malloc(n);             // exact size, so ASan sees a read past the chunk
+    memcpy(c, data, n);
+    handle_input_chunk(c, n);
+    free(c);
+    process_bin_commands();
+    process_commands();
+    data += n;
+    len  -= n;
+  }
+  process_debug();
+  process_stream();
+}
+
+static uint8_t paramCount(void) {       // "#<id>" is found up to the last params[] entry
+  uint8_t size, n = 0;
+  char id[8];
+  while (1) {
+    int len = snprintf(id, sizeof(id), "#%u\n", n);
+    if (findParam((uint8_t *)id, (uint32_t)len, &size) < 0) return n;
+    n++;
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ####### BENCHMARK #######
+static int bench(void) {
+  extern const parameter_entry params[];
+  const uint8_t np = paramCount();
+  const uint32_t nLines = 200000;
+  char *traffic = malloc(nLines * 48), *p = traffic;
+
+  for (uint32_t i = 0; i < nLines; i++) {
+    const parameter_entry *e = &params[(i * 7) % np];
+    switch (i % 8) {
+      case 0: case 1: case 2: p += sprintf(p, "$GET %s\r\n", e->name); break;
+      case 3: case 4:         p += sprintf(p, "$SET %s %li\r\n", e->name, (long)e->init); break;
+      case 5:                 p += sprintf(p, "$@%u GET #%u\r\n", i % 1000, (i * 7) % np); break;
+      default:                p += sprintf(p, "$WATCH %s\r\n", e->name); break;   // toggles, the list stays short
+    }
+  }
+  uint32_t len = (uint32_t)(p - traffic);
+
+  uint8_t *garbage = malloc(len);       // no '$' at a line start: dropped by handle_input, long lines by the line buffer
+  for (uint32_t i = 0; i < len; i++) {
+    uint8_t c = (uint8_t)rnd();
+    garbage[i] = (i % 97 == 0) ? '\n' : (c == '$' || c == (uint8_t)DEBUG_BIN_START_FRAME) ? 'x' : c;
+  }
+
+  double t0 = now();
+  feed((const uint8_t *)traffic, len, 32);
+  double t1 = now();
+  feed(garbage, len, 32);
+  double t2 = now();
+
+  fprintf(stderr, "params %u, %u lines, %u bytes\n", np, nLines, len);
+  fprintf(stderr, "commands: %8.0f lines/s %8.2f MB/s (parse and execute, %llu reply bytes, %u dropped)\n",
+          nLines / (t1 - t0), len / (t1 - t0) / 1e6, (unsigned long long)stubTxBytes, cmdQueueDrop);
+  fprintf(stderr, "garbage:  %8.0f lines/s %8.2f MB/s\n", len / 97 / (t2 - t1), len / (t2 - t1) / 1e6);
+  free(traffic);
+  free(garbage);
+  return 0;
+}
+
+// ####### FUZZER #######
+typedef struct {
+  uint16_t len;
+  uint8_t  data[FUZZ_MAX_INPUT];
+} Input;
+
+static Input   corpus[FUZZ_MAX_CORPUS];
+static uint32_t nCorpus;
+static Input   cur;
+
+static const char *const dict[] = {"$", "\r\n", "\n", "\r", " ", "@", "#", "-", "GET ", "SET ", "WATCH ", "STREAM ",
+                                   "HELP ", "INIT ", "SAVE", "INLIM", "32767", "32768", "-32768", "4294967295", "#127", "#200"};
+
+#if defined(__SANITIZE_ADDRESS__)
+static void saveCrash(void) {
+  FILE *f = fopen("fuzz-crash.bin", "wb");
+  if (f) {
+    fwrite(cur.data, 1, cur.len, f);
+    fclose(f);
+  }
+  fprintf(stderr, "failing input (%u bytes) written to fuzz-crash.bin\n", cur.len);
+}
+#endif
+
+static void addCorpus(const Input *in) {
+  if (nCorpus < FUZZ_MAX_CORPUS) corpus[nCorpus++] = *in;
+  else corpus[rnd() % FUZZ_MAX_CORPUS] = *in;
+}
+
+static void insert(Input *in, uint32_t pos, const uint8_t *s, uint32_t n) {
+  if (in->len + n > FUZZ_MAX_INPUT) return;
+  memmove(&in->data[pos + n], &in->data[pos], in->len - pos);
+  memcpy(&in->data[pos], s, n);
+  in->len += n;
+}
+
+static void mutate(Input *in) {
+  extern const parameter_entry params[];
+  static uint8_t np;
+  if (!np) np = paramCount();
+
+  for (uint32_t k = 1 + rnd() % 4; k; k--) {
+    uint32_t pos = in->len ? rnd() % (in->len + 1) : 0;
+    switch (rnd() % 8) {
+      case 0:                           // flip a bit
+        if (pos < in->len) in->data[pos] ^= 1 << (rnd() % 8);
+        break;
+      case 1:                           // random byte
+        if (pos < in->len) in->data[pos] = (uint8_t)rnd();
+        break;
+      case 2: {                         // delete a run
+        uint32_t n = 1 + rnd() % 8;
+        if (pos + n <= in->len) {
+          memmove(&in->data[pos], &in->data[pos + n], in->len - pos - n);
+          in->len -= n;
+        }
+        break;
+      }
+      case 3: case 4: {                 // protocol token
+        const char *s = dict[rnd() % (sizeof(dict) / sizeof(dict[0]))];
+        insert(in, pos, (const uint8_t *)s, (uint32_t)strlen(s));
+        break;
+      }
+      case 5: {                         // parameter name, sometimes cut short
+        const char *s = params[rnd() % np].name;
+        uint32_t n = (uint32_t)strlen(s);
+        insert(in, pos, (const uint8_t *)s, (rnd() & 3) ? n : rnd() % (n + 1));
+        break;
+      }
+      case 6: {                         // repeat a byte, long lines and digit runs
+        uint8_t c = pos < in->len ? in->data[pos] : '9';
+        uint8_t run[64];
+        uint32_t n = 1 + rnd() % sizeof(run);
+        memset(run, c, n);
+        insert(in, pos, run, n);
+        break;
+      }
+      default:                          // splice with another corpus entry
+        if (nCorpus) {
+          const Input *o = &corpus[rnd() % nCorpus];
+          uint32_t from = o->len ? rnd() % o->len : 0;
+          insert(in, pos, &o->data[from], (o->len - from) < 32 ? (o->len - from) : 32);
+        }
+        break;
+    }
+  }
+}
+
+static void loadSeeds(const char *dir) {
+  DIR *d = opendir(dir);
+  struct dirent *de;
+  char path[512];
+  if (!d) {
+    fprintf(stderr, "cannot open %s\n", dir);
+    exit(1);
+  }
+  while ((de = readdir(d)) != NULL) {
+    if (de->d_name[0] == '.') continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+    FILE *f = fopen(path, "rb");
+    if (!f) continue;
+    Input in;
+    in.len = (uint16_t)fread(in.data, 1, FUZZ_MAX_INPUT, f);
+    fclose(f);
+    cur = in;
+    feed(in.data, in.len, in.len ? in.len : 1);
+    addCorpus(&in);
+  }
+  closedir(d);
+}
+
+static int fuzz(const char *dir, uint32_t runs) {
+  #if defined(__SANITIZE_ADDRESS__)
+  __sanitizer_set_death_callback(saveCrash);
+  #endif
+  loadSeeds(dir);
+  uint32_t seeds = nCorpus;
+  fprintf(stderr, "seeds: %u, %u binary requests dropped\n", seeds, binReqDrop);
+  double t0 = now();
+
+  for (uint32_t r = 0; r < runs; r++) {
+    cur = nCorpus ? corpus[rnd() % nCorpus] : (Input){0};
+    mutate(&cur);
+    uint32_t covBefore = covNew;
+    feed(cur.data, cur.len, 1 + rnd() % 64);
+    if (covNew != covBefore) addCorpus(&cur);
+    if ((r + 1) % 100000 == 0) fprintf(stderr, "%u runs, %u edges, corpus %u\n", r + 1, covNew, nCorpus);
+  }
+  fprintf(stderr, "fuzz: %u runs in %.1f s, %u edges, corpus %u (%u seeds), no failure\n", runs, now() - t0, covNew, nCorpus, seeds);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  uint32_t runs = 500000;
+  const char *dir = NULL;
+  int benchMode = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-b")) benchMode = 1;
+    else if (!strcmp(argv[i], "-n") && i + 1 < argc) runs = (uint32_t)strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-s") && i + 1 < argc) rngState = (uint32_t)strtoul(argv[++i], NULL, 0) | 1;
+    else dir = argv[i];
+  }
+  if (!benchMode && !dir) {
+    fprintf(stderr, "usage: fuzz_comms -b | fuzz_comms [-n runs] [-s seed] corpus_dir\n");
+    return 2;
+  }
+  if (!freopen("/dev/null", "w", stdout)) return 1;   // only the reply byte counts of debugTxWrite matter
+  return benchMode ? bench() : fuzz(dir, runs);
+}
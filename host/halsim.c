@@ -0,0 +1,278 @@
+/*
+* Host stand-in for the STM32 HAL, the peripheral setup (setup.c), the timebase (timebase.c) and the EEPROM emulation
+* (eeprom.c) of the main loop simulation (make host-loop, host/loop.c). The header is host/halsim/stm32f1xx_hal.h.
+*
+* Virtual clock: simNs only moves forward when the firmware reads the time or waits. Every read of timeUs, timeMs or a
+* GPIO input costs HALSIM_READ_NS, so a polling loop progresses; __WFI jumps to the next control tick and HAL_Delay
+* jumps by its duration. Each control tick crossed on the way (PWM_FREQ) runs halsimTick of host/loop.c, which stands
+* in for the control interrupt and the slow task, so the interrupts preempt the main loop at the points where it reads
+* the clock or sleeps. A UART DMA transfer completes at the next tick, or after its time on the wire at the baud rate
+* with halsimUartWire. Received bytes are put into the circular Rx DMA buffer by halsimUartRx.
+*
+* The EEPROM is a RAM array indexed like VirtAddVarTab, empty at start: the firmware boots with the config.h defaults.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "setup.h"
+#include "eeprom.h"
+#include "timebase.h"
+#include "halsim.h"
+
+#define HALSIM_TICK_NS  (1000000000ULL / PWM_FREQ)      // [ns] control interrupt period
+
+// ####### REGISTERS #######
+uint32_t SystemCoreClock = SYSCLK_HZ;
+DWT_Type       halsimDwt;
+CoreDebug_Type halsimCoreDebug;
+DBGMCU_TypeDef halsimDbgmcu;
+SCB_Type       halsimScb;
+GPIO_TypeDef   halsimGpio[5];
+TIM_TypeDef    halsimTim[9];
+ADC_TypeDef    halsimAdc[3];
+USART_TypeDef  halsimUsart[4];
+DMA_Channel_TypeDef halsimDmaCh[8];
+DMA_TypeDef    halsimDma1;
+I2C_TypeDef    halsimI2c[3];
+CRC_TypeDef    halsimCrc;
+BKP_TypeDef    halsimBkp;
+RCC_TypeDef    halsimRcc;
+AFIO_TypeDef   halsimAfio;
+
+// ####### setup.c #######
+TIM_HandleTypeDef htim_left, htim_right;
+ADC_HandleTypeDef hadc1, hadc2;
+UART_HandleTypeDef huart2, huart3;
+I2C_HandleTypeDef hi2c2;
+DMA_HandleTypeDef hdma_usart2_rx, hdma_usart2_tx, hdma_usart3_rx, hdma_usart3_tx, hdma_i2c2_rx, hdma_i2c2_tx;
+volatile adc_buf_t adc_buffer;          // the slow channels are set by halsimTick
+
+void MX_GPIO_Init(void) {}
+void MX_TIM_Init(void) {}
+void MX_ADC1_Init(void) {}
+void MX_ADC2_Init(void) {}
+void UART2_Init(void) {
+  huart2.Instance          = USART2;
+  huart2.gState            = HAL_UART_STATE_READY;
+  huart2.hdmarx            = &hdma_usart2_rx;
+  hdma_usart2_rx.Instance  = DMA1_Channel6;
+  #if defined(USART2_BAUD)
+  huart2.Init.BaudRate     = USART2_BAUD;
+  #endif
+}
+
+void UART3_Init(void) {
+  huart3.Instance          = USART3;
+  huart3.gState            = HAL_UART_STATE_READY;
+  huart3.hdmarx            = &hdma_usart3_rx;
+  hdma_usart3_rx.Instance  = DMA1_Channel3;
+  #if defined(USART3_BAUD)
+  huart3.Init.BaudRate     = USART3_BAUD;
+  #endif
+}
+
+void UART_SetBaud(UART_HandleTypeDef *huart, uint32_t baud) { huart->Init.BaudRate = baud; }
+
+// ####### VIRTUAL CLOCK #######
+static uint64_t simNs;                  // [ns] virtual time since reset
+static uint64_t tickNs = HALSIM_TICK_NS;  // [ns] next control tick
+static uint8_t  inIrq;
+static UART_HandleTypeDef *txPending[2];
+static uint64_t txDoneNs[2];            // [ns] end of the pending transfer on the wire, 0 = at the next tick
+static uint8_t  uartWire;
+static FILE    *uartOut;
+static HalsimUartTx uartTx;
+
+void halsimAdvance(uint64_t ns) {
+  uint64_t end = simNs + ns;
+  while (tickNs <= end) {
+    simNs   = tickNs;
+    tickNs += HALSIM_TICK_NS;
+    inIrq   = 1;
+    halsimTick();
+    for (int i = 0; i < 2; i++) {       // DMA transfer complete
+      UART_HandleTypeDef *h = txPending[i];
+      if (h && simNs >= txDoneNs[i]) {
+        txPending[i] = NULL;
+        h->gState = HAL_UART_STATE_READY;
+        HAL_UART_TxCpltCallback(h);
+      }
+    }
+    inIrq = 0;
+  }
+  simNs = end;
+}
+
+uint64_t halsimNs(void) {
+  return simNs;
+}
+
+uint32_t halsimCycles(void) {
+  return (uint32_t)(simNs * (SystemCoreClock / 1000000U) / 1000U);
+}
+
+void halsimWfi(void) {
+  halsimAdvance(tickNs - simNs);
+}
+
+uint32_t halsimIpsr(void) {
+  return inIrq ? (uint32_t)TIM8_UP_IRQn + 16U : 0U;     // the control interrupt, see stm32f1xx_it.c
+}
+
+void halsimUartOut(FILE *f) {
+  uartOut = f;
+}
+
+void halsimUartTxHook(HalsimUartTx fn) {
+  uartTx = fn;
+}
+
+void halsimUartWire(uint8_t on) {
+  uartWire = on;
+}
+
+uint16_t halsimUartRx(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t len) {
+  DMA_Channel_TypeDef *ch = huart->hdmarx ? huart->hdmarx->Instance : NULL;
+  if (!ch || huart->RxState != HAL_UART_STATE_BUSY_RX || huart->RxXferSize == 0) {
+    return 0;                           // receiver not started, the bytes are lost as on the wire
+  }
+  for (uint16_t k = 0; k < len; k++) {
+    huart->pRxBuffPtr[huart->RxXferSize - ch->CNDTR] = data[k];
+    ch->CNDTR = (ch->CNDTR > 1) ? ch->CNDTR - 1 : huart->RxXferSize;   // circular mode reloads the counter
+  }
+  return len;
+}
+
+// ####### timebase.c #######
+volatile uint32_t timeEpoch;
+
+void timeInit(void) {}
+
+uint64_t timeUs64(void) {
+  halsimAdvance(HALSIM_READ_NS);
+  return simNs / 1000U;
+}
+
+uint32_t timeUs(void) {
+  return (uint32_t)timeUs64();
+}
+
+uint32_t timeMs(void) {
+  return (uint32_t)(timeUs64() / 1000U);
+}
+
+void timeEpochIrq(void) {}
+
+// ####### HAL #######
+HAL_StatusTypeDef HAL_Init(void) { return HAL_OK; }
+uint32_t HAL_GetTick(void) { return timeMs(); }
+void HAL_Delay(uint32_t ms) { halsimAdvance((uint64_t)ms * 1000000U); }
+void HAL_NVIC_SetPriorityGrouping(uint32_t group) { (void)group; }
+void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t pre, uint32_t sub) { (void)irq; (void)pre; (void)sub; }
+void HAL_NVIC_EnableIRQ(IRQn_Type irq) { (void)irq; }
+void HAL_NVIC_DisableIRQ(IRQn_Type irq) { (void)irq; }
+void NVIC_EnableIRQ(IRQn_Type irq) { (void)irq; }
+void NVIC_DisableIRQ(IRQn_Type irq) { (void)irq; }
+void NVIC_SetPendingIRQ(IRQn_Type irq) { (void)irq; }
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *osc) { (void)osc; return HAL_OK; }
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *clk, uint32_t latency) { (void)clk; (void)latency; return HAL_OK; }
+HAL_StatusTypeDef HAL_RCCEx_PeriphCLKConfig(RCC_PeriphCLKInitTypeDef *clk) { (void)clk; return HAL_OK; }
+uint32_t HAL_RCC_GetHCLKFreq(void) { return SystemCoreClock; }
+uint32_t HAL_RCC_GetPCLK1Freq(void) { return SystemCoreClock / 2U; }
+uint32_t HAL_RCC_GetPCLK2Freq(void) { return SystemCoreClock; }
+uint32_t HAL_SYSTICK_Config(uint32_t ticks) { (void)ticks; return 0; }
+void HAL_SYSTICK_CLKSourceConfig(uint32_t src) { (void)src; }
+HAL_StatusTypeDef HAL_ADC_Start(ADC_HandleTypeDef *hadc) { (void)hadc; return HAL_OK; }
+void HAL_PWR_EnableBkUpAccess(void) {}
+
+void NVIC_SystemReset(void) {
+  halsimReset();
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init) { (void)port; (void)init; }
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin) {
+  halsimAdvance(HALSIM_READ_NS);
+  return (port->IDR & pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state) {
+  if (state == GPIO_PIN_SET) {
+    port->ODR |= pin;
+  } else {
+    port->ODR &= ~(uint32_t)pin;
+  }
+  halsimPinWrite(port, pin);
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *port, uint16_t pin) {
+  port->ODR ^= pin;
+  halsimPinWrite(port, pin);
+}
+
+// Transmit: the bytes go to the halsimUartTxHook function or the output of halsimUartOut at once, the transfer completes
+// at the next tick, with halsimUartWire after 10 bits per byte at the baud rate
+HAL_StatusTypeDef UART_TxDma(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size) {
+  int i = (huart == &huart2) ? 0 : 1;
+  if (txPending[i]) {
+    return HAL_BUSY;
+  }
+  if (uartTx) {
+    uartTx(huart, data, size);
+  } else if (uartOut) {
+    fwrite(data, 1, size, uartOut);
+  }
+  huart->gState = HAL_UART_STATE_BUSY_TX;
+  txPending[i]  = huart;
+  txDoneNs[i]   = (uartWire && huart->Init.BaudRate) ? simNs + (uint64_t)size * 10U * 1000000000U / huart->Init.BaudRate : 0;
+  return HAL_OK;
+}
+
+void UART_RxDma(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size) {
+  huart->pRxBuffPtr  = data;
+  huart->RxXferSize  = size;
+  huart->RxState     = HAL_UART_STATE_BUSY_RX;
+  if (huart->hdmarx) {
+    huart->hdmarx->Instance->CNDTR = size;
+  }
+}
+
+__attribute__((weak)) void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) { (void)huart; }
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) { return HAL_OK; }
+HAL_StatusTypeDef HAL_FLASH_Lock(void) { return HAL_OK; }
+
+// ####### eeprom.c #######
+static uint16_t eeData[NB_OF_VAR];
+static uint8_t  eeValid[NB_OF_VAR];
+extern uint16_t VirtAddVarTab[NB_OF_VAR];
+
+static int eeIndex(uint16_t VirtAddress) {
+  for (int i = 0; i < NB_OF_VAR; i++) {
+    if (VirtAddVarTab[i] == VirtAddress) return i;
+  }
+  return -1;
+}
+
+uint16_t EE_Init(void) { return HAL_OK; }
+uint16_t EE_Commit(void) { return HAL_OK; }
+void EE_Save(void) {}
+
+uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t *Data) {
+  int i = eeIndex(VirtAddress);
+  if (i < 0 || !eeValid[i]) return 1;
+  *Data = eeData[i];
+  return 0;
+}
+
+uint16_t EE_WriteVariable(uint16_t VirtAddress, uint16_t Data) {
+  int i = eeIndex(VirtAddress);
+  if (i < 0) return NO_VALID_PAGE;
+  eeData[i]  = Data;
+  eeValid[i] = 1;
+  return HAL_OK;
+}
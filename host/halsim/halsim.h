@@ -0,0 +1,22 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include "stm32f1xx_hal.h"
+
+#define HALSIM_READ_NS  1000            // [ns] cost of a clock or input read on the virtual clock
+
+// Virtual clock of host/halsim.c
+void    halsimAdvance(uint64_t ns);    // move the clock forward, running the control ticks on the way
+uint64_t halsimNs(void);                // [ns] time since reset
+void     halsimUartOut(FILE *f);        // destination of the UART DMA transmissions, NULL drops them
+
+// UART transmissions to fn instead of the halsimUartOut file, NULL restores it
+typedef void (*HalsimUartTx)(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size);
+void     halsimUartTxHook(HalsimUartTx fn);
+void     halsimUartWire(uint8_t on);    // 1: a transmission takes its time on the wire at Init.BaudRate, 0: one tick
+uint16_t halsimUartRx(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t len);  // bytes into the Rx DMA buffer, the caller runs usartX_rx_check
+
+// Provided by the simulation (host/loop.c)
+void halsimTick(void);                  // control interrupt and slow task, once per PWM_FREQ period
+void halsimPinWrite(GPIO_TypeDef *port, uint16_t pin);  // output pin written, ODR already updated
+void halsimReset(void);                 // NVIC_SystemReset, does not return
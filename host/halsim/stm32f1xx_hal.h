@@ -0,0 +1,402 @@
+/*
+* Host stand-in for the STM32 HAL and CMSIS headers of the main loop simulation (make host-loop, host/loop.c).
+* Lets Src/main.c, Src/util.c and Src/sched.c compile natively: the peripherals are plain register structs in RAM,
+* the HAL functions used by those files are implemented in host/halsim.c on a virtual clock.
+* Only what the main loop sources name is provided, a new HAL call fails to compile until it is added here.
+*/
+
+#ifndef __STM32F1xx_HAL_H
+#define __STM32F1xx_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+
+// As in host/config.h: BLDC_controller.c checks for a 32-bit long, which it does not use
+#if ULONG_MAX != 0xFFFFFFFFU
+  #undef  ULONG_MAX
+  #undef  LONG_MAX
+  #define ULONG_MAX       0xFFFFFFFFU
+  #define LONG_MAX        0x7FFFFFFF
+#endif
+
+#define __IO    volatile
+#define __I     volatile const
+#define __O     volatile
+#define __STATIC_INLINE static inline
+
+// ####### CORE #######
+typedef enum {
+  NonMaskableInt_IRQn = -14, MemoryManagement_IRQn = -12, BusFault_IRQn = -11, UsageFault_IRQn = -10,
+  SVCall_IRQn = -5, DebugMonitor_IRQn = -4, PendSV_IRQn = -2, SysTick_IRQn = -1,
+  EXTI0_IRQn = 6, EXTI1_IRQn = 7, EXTI2_IRQn = 8, EXTI3_IRQn = 9, EXTI4_IRQn = 10,
+  DMA1_Channel1_IRQn = 11, DMA1_Channel2_IRQn = 12, DMA1_Channel3_IRQn = 13, DMA1_Channel4_IRQn = 14,
+  DMA1_Channel5_IRQn = 15, DMA1_Channel6_IRQn = 16, DMA1_Channel7_IRQn = 17, ADC1_2_IRQn = 18,
+  EXTI9_5_IRQn = 23, TIM1_UP_IRQn = 25, TIM2_IRQn = 28, TIM3_IRQn = 29, TIM4_IRQn = 30,
+  I2C2_EV_IRQn = 33, I2C2_ER_IRQn = 34, USART2_IRQn = 38, USART3_IRQn = 39, EXTI15_10_IRQn = 40,
+  TIM8_UP_IRQn = 44, TIM5_IRQn = 50
+} IRQn_Type;
+
+typedef enum {HAL_OK = 0, HAL_ERROR = 1, HAL_BUSY = 2, HAL_TIMEOUT = 3} HAL_StatusTypeDef;
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus;
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+
+#define SET_BIT(REG, BIT)     ((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT)   ((REG) &= ~(BIT))
+#define READ_BIT(REG, BIT)    ((REG) & (BIT))
+#define UNUSED(X)             (void)(X)
+
+extern uint32_t SystemCoreClock;
+
+typedef struct {
+  __IO uint32_t CTRL, CYCCNT;
+} DWT_Type;
+typedef struct {
+  __IO uint32_t DEMCR;
+} CoreDebug_Type;
+typedef struct {
+  __IO uint32_t CR;
+} DBGMCU_TypeDef;
+typedef struct {
+  __IO uint32_t VTOR, AIRCR, SCR, SHCSR, CFSR;
+} SCB_Type;
+
+// The cycle counter follows the virtual clock at SystemCoreClock, see halsimCycles
+extern DWT_Type       halsimDwt;
+extern CoreDebug_Type halsimCoreDebug;
+extern DBGMCU_TypeDef halsimDbgmcu;
+extern SCB_Type       halsimScb;
+uint32_t halsimCycles(void);
+#define DWT                     (halsimDwt.CYCCNT = halsimCycles(), &halsimDwt)
+#define CoreDebug               (&halsimCoreDebug)
+#define DBGMCU                  (&halsimDbgmcu)
+#define SCB                     (&halsimScb)
+#define DWT_CTRL_CYCCNTENA_Msk  1U
+#define CoreDebug_DEMCR_TRCENA_Msk (1U << 24)
+#define DBGMCU_CR_DBG_SLEEP     1U
+#define SCB_SCR_SLEEPONEXIT_Msk (1U << 1)
+#define SCB_SCR_SLEEPDEEP_Msk   (1U << 2)
+
+void     halsimWfi(void);               // sleep: the virtual clock jumps to the next interrupt
+uint32_t halsimIpsr(void);              // exception number of the simulated interrupt running, 0 in the main loop
+#define __NVIC_PRIO_BITS        4U
+#define __WFI()                 halsimWfi()
+#define __WFE()                 halsimWfi()
+#define __NOP()                 ((void)0)
+#define __DSB()                 __sync_synchronize()
+#define __ISB()                 __sync_synchronize()
+static inline void __DMB(void) { __sync_synchronize(); }
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t m) { (void)m; }
+static inline uint32_t __get_BASEPRI(void) { return 0; }
+static inline void __set_BASEPRI(uint32_t m) { (void)m; }
+static inline uint32_t __get_IPSR(void) { return halsimIpsr(); }
+static inline uint32_t __get_MSP(void) { return (uint32_t)(uintptr_t)__builtin_frame_address(0); }
+static inline uint32_t __CLZ(uint32_t x) { return x ? (uint32_t)__builtin_clz(x) : 32U; }
+static inline uint32_t __RBIT(uint32_t x) { uint32_t r = 0; for (int i = 0; i < 32; i++) { r = (r << 1) | (x & 1); x >>= 1; } return r; }
+static inline int32_t __SSAT(int32_t x, uint32_t bits) {
+  int32_t max = (int32_t)((1UL << (bits - 1)) - 1);
+  return x > max ? max : (x < -max - 1 ? -max - 1 : x);
+}
+static inline uint32_t __USAT(int32_t x, uint32_t bits) {
+  uint32_t max = (uint32_t)((1ULL << bits) - 1);
+  return x < 0 ? 0 : ((uint32_t)x > max ? max : (uint32_t)x);
+}
+
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+void NVIC_SetPendingIRQ(IRQn_Type irq);
+void NVIC_SystemReset(void);
+
+// ####### PERIPHERAL REGISTERS: memory only #######
+typedef struct {
+  __IO uint32_t CRL, CRH, IDR, ODR, BSRR, BRR, LCKR;
+} GPIO_TypeDef;
+typedef struct {
+  __IO uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CCMR1, CCMR2, CCER, CNT, PSC, ARR, RCR, CCR1, CCR2, CCR3, CCR4, BDTR, DCR, DMAR;
+} TIM_TypeDef;
+typedef struct {
+  __IO uint32_t SR, CR1, CR2, SMPR1, SMPR2, JOFR1, JOFR2, JOFR3, JOFR4, HTR, LTR, SQR1, SQR2, SQR3, JSQR, JDR1, JDR2, JDR3, JDR4, DR;
+} ADC_TypeDef;
+typedef struct {
+  __IO uint32_t SR, DR, BRR, CR1, CR2, CR3, GTPR;
+} USART_TypeDef;
+typedef struct {
+  __IO uint32_t CCR, CNDTR, CPAR, CMAR;
+} DMA_Channel_TypeDef;
+typedef struct {
+  __IO uint32_t ISR, IFCR;
+} DMA_TypeDef;
+typedef struct {
+  __IO uint32_t CR1, CR2, OAR1, OAR2, DR, SR1, SR2, CCR, TRISE;
+} I2C_TypeDef;
+typedef struct {
+  __IO uint32_t DR, IDR, CR;
+} CRC_TypeDef;
+typedef struct {
+  __IO uint32_t DR1, DR2, DR3, DR4;
+} BKP_TypeDef;
+typedef struct {
+  __IO uint32_t CR, CFGR, CIR, APB2RSTR, APB1RSTR, AHBENR, APB2ENR, APB1ENR, BDCR, CSR;
+} RCC_TypeDef;
+typedef struct {
+  __IO uint32_t EVCR, MAPR, EXTICR[4];
+} AFIO_TypeDef;
+
+extern GPIO_TypeDef halsimGpio[5];
+extern TIM_TypeDef  halsimTim[9];
+extern ADC_TypeDef  halsimAdc[3];
+extern USART_TypeDef halsimUsart[4];
+extern DMA_Channel_TypeDef halsimDmaCh[8];
+extern DMA_TypeDef  halsimDma1;
+extern I2C_TypeDef  halsimI2c[3];
+extern CRC_TypeDef  halsimCrc;
+extern BKP_TypeDef  halsimBkp;
+extern RCC_TypeDef  halsimRcc;
+extern AFIO_TypeDef halsimAfio;
+
+#define GPIOA           (&halsimGpio[0])
+#define GPIOB           (&halsimGpio[1])
+#define GPIOC           (&halsimGpio[2])
+#define GPIOD           (&halsimGpio[3])
+#define GPIOE           (&halsimGpio[4])
+#define TIM1            (&halsimTim[1])
+#define TIM2            (&halsimTim[2])
+#define TIM3            (&halsimTim[3])
+#define TIM4            (&halsimTim[4])
+#define TIM5            (&halsimTim[5])
+#define TIM8            (&halsimTim[8])
+#define ADC1            (&halsimAdc[0])
+#define ADC2            (&halsimAdc[1])
+#define ADC3            (&halsimAdc[2])
+#define USART1          (&halsimUsart[1])
+#define USART2          (&halsimUsart[2])
+#define USART3          (&halsimUsart[3])
+#define DMA1            (&halsimDma1)
+#define DMA1_Channel1   (&halsimDmaCh[1])
+#define DMA1_Channel2   (&halsimDmaCh[2])
+#define DMA1_Channel3   (&halsimDmaCh[3])
+#define DMA1_Channel4   (&halsimDmaCh[4])
+#define DMA1_Channel5   (&halsimDmaCh[5])
+#define DMA1_Channel6   (&halsimDmaCh[6])
+#define DMA1_Channel7   (&halsimDmaCh[7])
+#define I2C1            (&halsimI2c[1])
+#define I2C2            (&halsimI2c[2])
+#define CRC             (&halsimCrc)
+#define BKP             (&halsimBkp)
+#define RCC             (&halsimRcc)
+#define AFIO            (&halsimAfio)
+
+#define GPIO_PIN_0      ((uint16_t)0x0001)
+#define GPIO_PIN_1      ((uint16_t)0x0002)
+#define GPIO_PIN_2      ((uint16_t)0x0004)
+#define GPIO_PIN_3      ((uint16_t)0x0008)
+#define GPIO_PIN_4      ((uint16_t)0x0010)
+#define GPIO_PIN_5      ((uint16_t)0x0020)
+#define GPIO_PIN_6      ((uint16_t)0x0040)
+#define GPIO_PIN_7      ((uint16_t)0x0080)
+#define GPIO_PIN_8      ((uint16_t)0x0100)
+#define GPIO_PIN_9      ((uint16_t)0x0200)
+#define GPIO_PIN_10     ((uint16_t)0x0400)
+#define GPIO_PIN_11     ((uint16_t)0x0800)
+#define GPIO_PIN_12     ((uint16_t)0x1000)
+#define GPIO_PIN_13     ((uint16_t)0x2000)
+#define GPIO_PIN_14     ((uint16_t)0x4000)
+#define GPIO_PIN_15     ((uint16_t)0x8000)
+#define GPIO_MODE_INPUT       0x00U
+#define GPIO_MODE_OUTPUT_PP   0x01U
+#define GPIO_MODE_OUTPUT_OD   0x11U
+#define GPIO_MODE_AF_PP       0x02U
+#define GPIO_MODE_AF_OD       0x12U
+#define GPIO_MODE_AF_INPUT    GPIO_MODE_INPUT
+#define GPIO_MODE_ANALOG      0x03U
+#define GPIO_MODE_IT_RISING   0x10110000U
+#define GPIO_MODE_IT_FALLING  0x10210000U
+#define GPIO_NOPULL           0x0U
+#define GPIO_PULLUP           0x1U
+#define GPIO_PULLDOWN         0x2U
+#define GPIO_SPEED_FREQ_LOW     0x2U
+#define GPIO_SPEED_FREQ_MEDIUM  0x1U
+#define GPIO_SPEED_FREQ_HIGH    0x3U
+
+typedef enum {GPIO_PIN_RESET = 0, GPIO_PIN_SET} GPIO_PinState;
+typedef struct {
+  uint32_t Pin, Mode, Pull, Speed;
+} GPIO_InitTypeDef;
+
+#define TIM_CR1_CEN     (1U << 0)
+#define TIM_CR1_URS     (1U << 2)
+#define TIM_EGR_UG      (1U << 0)
+#define TIM_SR_UIF      (1U << 0)
+#define TIM_DIER_UIE    (1U << 0)
+#define TIM_BDTR_MOE    (1U << 15)
+#define TIM_TRGO_UPDATE (2U << 4)
+#define TIM_TS_ITR2     (2U << 4)
+#define TIM_SLAVEMODE_EXTERNAL1 7U
+#define USART_CR1_PEIE  (1U << 8)
+#define USART_CR1_IDLEIE (1U << 4)
+#define USART_CR3_EIE   (1U << 0)
+#define USART_SR_IDLE   (1U << 4)
+#define ADC_CR2_SWSTART (1U << 22)
+
+// ####### HAL HANDLES #######
+typedef struct {
+  uint32_t Direction, PeriphInc, MemInc, PeriphDataAlignment, MemDataAlignment, Mode, Priority;
+} DMA_InitTypeDef;
+typedef struct __DMA_HandleTypeDef {
+  DMA_Channel_TypeDef *Instance;
+  DMA_InitTypeDef Init;
+  void *Parent;
+} DMA_HandleTypeDef;
+
+typedef enum {
+  HAL_UART_STATE_RESET = 0x00U, HAL_UART_STATE_READY = 0x20U, HAL_UART_STATE_BUSY = 0x24U,
+  HAL_UART_STATE_BUSY_TX = 0x21U, HAL_UART_STATE_BUSY_RX = 0x22U, HAL_UART_STATE_BUSY_TX_RX = 0x23U
+} HAL_UART_StateTypeDef;
+typedef struct {
+  uint32_t BaudRate, WordLength, StopBits, Parity, Mode, HwFlowCtl, OverSampling;
+} UART_InitTypeDef;
+typedef struct __UART_HandleTypeDef {
+  USART_TypeDef *Instance;
+  UART_InitTypeDef Init;
+  uint8_t *pTxBuffPtr;
+  uint16_t TxXferSize;
+  uint8_t *pRxBuffPtr;
+  uint16_t RxXferSize;
+  DMA_HandleTypeDef *hdmatx;
+  DMA_HandleTypeDef *hdmarx;
+  volatile HAL_UART_StateTypeDef gState;
+  volatile HAL_UART_StateTypeDef RxState;
+  volatile uint32_t ErrorCode;
+} UART_HandleTypeDef;
+#define UART_WORDLENGTH_8B  0x0U
+#define UART_WORDLENGTH_9B  0x1000U
+#define UART_STOPBITS_1     0x0U
+#define UART_PARITY_NONE    0x0U
+#define UART_MODE_TX_RX     0xCU
+#define UART_MODE_RX        0x4U
+#define UART_MODE_TX        0x8U
+#define UART_HWCONTROL_NONE 0x0U
+#define UART_OVERSAMPLING_16 0x0U
+
+typedef struct {
+  uint32_t Prescaler, CounterMode, Period, ClockDivision, RepetitionCounter, AutoReloadPreload;
+} TIM_Base_InitTypeDef;
+typedef struct {
+  TIM_TypeDef *Instance;
+  TIM_Base_InitTypeDef Init;
+} TIM_HandleTypeDef;
+
+typedef struct {
+  uint32_t DataAlign, ScanConvMode, ContinuousConvMode, NbrOfConversion, DiscontinuousConvMode, NbrOfDiscConversion, ExternalTrigConv;
+} ADC_InitTypeDef;
+typedef struct {
+  ADC_TypeDef *Instance;
+  ADC_InitTypeDef Init;
+  DMA_HandleTypeDef *DMA_Handle;
+} ADC_HandleTypeDef;
+
+typedef struct {
+  uint32_t ClockSpeed, DutyCycle, OwnAddress1, AddressingMode, DualAddressMode, OwnAddress2, GeneralCallMode, NoStretchMode;
+} I2C_InitTypeDef;
+typedef struct {
+  I2C_TypeDef *Instance;
+  I2C_InitTypeDef Init;
+  DMA_HandleTypeDef *hdmatx;
+  DMA_HandleTypeDef *hdmarx;
+} I2C_HandleTypeDef;
+
+#define __HAL_DMA_GET_COUNTER(h)  ((h)->Instance->CNDTR)
+#define __HAL_UART_CLEAR_IDLEFLAG(h) ((h)->Instance->SR &= ~USART_SR_IDLE)
+#define __HAL_UART_ENABLE_IT(h, it) ((void)(h))
+#define __HAL_UART_DISABLE_IT(h, it) ((void)(h))
+#define __HAL_TIM_SET_COMPARE(h, ch, v) ((void)(h), (void)(v))
+
+// ####### RCC, FLASH, PWR #######
+typedef struct {
+  uint32_t PLLState, PLLSource, PLLMUL;
+} RCC_PLLInitTypeDef;
+typedef struct {
+  uint32_t OscillatorType, HSEState, HSEPredivValue, LSEState, HSIState, HSICalibrationValue, LSIState;
+  RCC_PLLInitTypeDef PLL;
+} RCC_OscInitTypeDef;
+typedef struct {
+  uint32_t ClockType, SYSCLKSource, AHBCLKDivider, APB1CLKDivider, APB2CLKDivider;
+} RCC_ClkInitTypeDef;
+typedef struct {
+  uint32_t PeriphClockSelection, RTCClockSelection, AdcClockSelection;
+} RCC_PeriphCLKInitTypeDef;
+#define RCC_OSCILLATORTYPE_HSE  0x1U
+#define RCC_OSCILLATORTYPE_HSI  0x2U
+#define RCC_HSE_ON              0x1U
+#define RCC_HSE_PREDIV_DIV1     0x0U
+#define RCC_HSI_ON              0x1U
+#define RCC_PLL_ON              0x2U
+#define RCC_PLLSOURCE_HSE       0x1U
+#define RCC_PLLSOURCE_HSI_DIV2  0x0U
+#define RCC_PLL_MUL9            0x7U
+#define RCC_PLL_MUL16           0xEU
+#define RCC_CLOCKTYPE_SYSCLK    0x1U
+#define RCC_CLOCKTYPE_HCLK      0x2U
+#define RCC_CLOCKTYPE_PCLK1     0x4U
+#define RCC_CLOCKTYPE_PCLK2     0x8U
+#define RCC_SYSCLKSOURCE_PLLCLK 0x2U
+#define RCC_SYSCLK_DIV1         0x0U
+#define RCC_HCLK_DIV1           0x0U
+#define RCC_HCLK_DIV2           0x4U
+#define RCC_PERIPHCLK_ADC       0x2U
+#define RCC_ADCPCLK2_DIV4       0x1U
+#define RCC_ADCPCLK2_DIV6       0x2U
+#define RCC_ADCPCLK2_DIV8       0x3U
+#define FLASH_LATENCY_2         0x2U
+#define SYSTICK_CLKSOURCE_HCLK  0x4U
+#define NVIC_PRIORITYGROUP_4    0x3U
+
+#define __HAL_RCC_AFIO_CLK_ENABLE()   ((void)0)
+#define __HAL_RCC_CRC_CLK_ENABLE()    ((void)0)
+#define __HAL_RCC_DMA1_CLK_ENABLE()   ((void)0)
+#define __HAL_RCC_DMA1_CLK_DISABLE()  ((void)0)
+#define __HAL_RCC_TIM3_CLK_ENABLE()   ((void)0)
+#define __HAL_RCC_TIM4_CLK_ENABLE()   ((void)0)
+#define __HAL_RCC_PWR_CLK_ENABLE()    ((void)0)
+#define __HAL_RCC_BKP_CLK_ENABLE()    ((void)0)
+
+#define FLASH_PAGE_SIZE               0x800U    // STM32F103xE
+#define FLASH_TYPEERASE_PAGES         0x0U
+#define FLASH_TYPEPROGRAM_HALFWORD    0x1U
+typedef struct {
+  uint32_t TypeErase, Banks, PageAddress, NbPages;
+} FLASH_EraseInitTypeDef;
+
+HAL_StatusTypeDef HAL_Init(void);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t ms);
+void HAL_NVIC_SetPriorityGrouping(uint32_t group);
+void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t pre, uint32_t sub);
+void HAL_NVIC_EnableIRQ(IRQn_Type irq);
+void HAL_NVIC_DisableIRQ(IRQn_Type irq);
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *osc);
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *clk, uint32_t latency);
+HAL_StatusTypeDef HAL_RCCEx_PeriphCLKConfig(RCC_PeriphCLKInitTypeDef *clk);
+uint32_t HAL_RCC_GetHCLKFreq(void);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+uint32_t HAL_RCC_GetPCLK2Freq(void);
+uint32_t HAL_SYSTICK_Config(uint32_t ticks);
+void HAL_SYSTICK_CLKSourceConfig(uint32_t src);
+void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+void HAL_GPIO_TogglePin(GPIO_TypeDef *port, uint16_t pin);
+HAL_StatusTypeDef HAL_ADC_Start(ADC_HandleTypeDef *hadc);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_I2C_Master_Transmit(I2C_HandleTypeDef *hi2c, uint16_t addr, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_I2C_Master_Receive(I2C_HandleTypeDef *hi2c, uint16_t addr, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uint32_t addr, uint64_t data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *erase, uint32_t *pageError);
+void HAL_PWR_EnableBkUpAccess(void);
+
+#endif
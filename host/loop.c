@@ -0,0 +1,365 @@
+/*
+* Main loop simulation (make host-loop): Src/main.c, util.c, sched.c and the other main loop sources, built with the
+* real Inc/config.h against the HAL stand-in of host/halsim, run on a virtual clock. Minutes of vehicle time take well
+* under a second, e.g. the INACTIVITY_TIMEOUT, the battery and temperature poweroff or the button handling.
+* main.c is built with -Dmain=firmwareMain and is called as is: boot, power on melody, scheduler loop. The run ends at
+* the scenario end, at the release of the power latch (poweroff) or at a reset.
+*
+* bldc.c and the control interrupt are replaced by halsimTick below: the ADC slow channels come from the scenario
+* signals, the battery voltage filter and the beep sequencer behave like the slow task, and each wheel follows its
+* command with a first order lag (tau) up to rpm at 1000. The standstill hold stops the wheels, the cruise control
+* keeps the speed it was engaged at. There are no motor errors, currents or hall sensors: for the controller use
+* make host-sil. A configuration that needs more of bldc.c (e.g. IDLE_POWER_SAVE, CURRENT_DERATING) fails to link
+* until the globals are added here; VARIANT_HOVERCAR cannot be built, its config.h enables USART3 twice.
+*
+* usage: loop [-o trace.csv] [-v] scenario
+*   -o file   CSV trace every "set trace" seconds
+*   -v        firmware printf and UART output to stdout, dropped otherwise
+* The exit code is 1 if an expectation failed.
+*
+* Scenario file, one statement per line, '#' starts a comment, times in seconds:
+*   set    <name> <value>                     end [s], trace [s], tau [s], rpm [rpm at command 1000]
+*   at     <t> <signal> <value>               step a signal at time t
+*   ramp   <t0> <t1> <signal> <v0> <v1>       linear ramp of a signal, the last started event of a signal wins
+*   expect <t0> <t1> <var> <min> <max>        var stays within [min, max] from t0 to t1
+*   poweroff <t0> <t1>                        the board switches off between t0 and t1, without this line it must not
+* Signals: in1 in2 [ADC bits] (adc_buffer.l_tx2 / l_rx2), vbat [V], temp [deg C], button [0 1],
+*          push [rpm] (speed imposed from outside, e.g. pushing the vehicle, added to both wheels)
+* Variables: enable, speedAvg, cmdL, cmdR, pwml, pwmr, batVoltageCalib [V*100], board_temp_deg_c [deg C*10],
+*            buzzerFreq, beep (1 while beepNote notes play), buttonMode, holdReq
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <time.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "setup.h"
+#include "util.h"
+#include "bldc.h"
+#include "BLDC_controller.h"
+#include "halsim.h"
+#undef main                             // main.c is built with -Dmain=firmwareMain
+
+#define MAX_EVENTS      256
+#define MAX_EXPECT      64
+
+extern int16_t batVoltageCalib, board_temp_deg_c, cmdL, cmdR;
+int firmwareMain(void);
+
+// ####### bldc.c #######
+volatile int pwml, pwmr;
+uint8_t  enable;
+int16_t  batVoltage = (400 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE;
+uint8_t  buzzerFreq, buzzerPattern, buzzerCount;
+volatile uint32_t buzzerTimer;
+AdcCalib adcCalib;
+Odometry odo[2];
+#if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+volatile uint8_t holdReq;
+volatile int16_t holdTgt[2];
+#endif
+
+static int32_t  batVoltageFixdt = (400 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE << 16;
+static BeepNote beepQueue[BEEP_QUEUE_LEN];
+static uint8_t  beepHead, beepTail;
+static uint32_t beepNoteTicks;          // [PWM_FREQ ticks] rest of the playing note
+static BldcState state;
+
+uint8_t beepNote(uint8_t freq, uint16_t ms) {
+  if (((beepHead + 1) & (BEEP_QUEUE_LEN - 1)) == beepTail) {
+    return 0;
+  }
+  beepQueue[beepHead] = (BeepNote){freq, ms};
+  beepHead = (beepHead + 1) & (BEEP_QUEUE_LEN - 1);
+  return 1;
+}
+
+uint8_t beepBusy(void) {
+  halsimAdvance(HALSIM_READ_NS);        // beepWait polls
+  return beepNoteTicks != 0 || beepTail != beepHead;
+}
+
+void bldc_cycle_counter_init(void) {}
+
+void bldc_start_calibration(void) {
+  adcCalib.done = 1;
+}
+
+void bldc_state_read(BldcState *out) {
+  *out = state;
+}
+
+// ####### SCENARIO #######
+enum simSignals {SIG_IN1, SIG_IN2, SIG_VBAT, SIG_TEMP, SIG_BUTTON, SIG_PUSH, SIG_N};
+static const char *sigNames[SIG_N] = {"in1", "in2", "vbat", "temp", "button", "push"};
+static double sig[SIG_N] = {2048, 2048, 40, 25, 0, 0};   // inputs at rest (PRI_INPUTx MID), 4 V per cell, room temperature
+
+enum simVars {VAR_ENABLE, VAR_SPEED, VAR_CMDL, VAR_CMDR, VAR_PWML, VAR_PWMR, VAR_BATV, VAR_TEMP, VAR_BUZZER, VAR_BEEP, VAR_BTNMODE, VAR_HOLD, VAR_N};
+static const char *varNames[VAR_N] = {"enable", "speedAvg", "cmdL", "cmdR", "pwml", "pwmr", "batVoltageCalib", "board_temp_deg_c",
+                                      "buzzerFreq", "beep", "buttonMode", "holdReq"};
+
+typedef struct {
+  double t0, t1, v0, v1;
+  uint8_t sig;
+} SimEvent;
+
+typedef struct {
+  double  t0, t1;
+  int32_t min, max;
+  uint8_t var;
+  uint8_t failed;
+  double  tFail;
+  int32_t vFail;
+} SimExpect;
+
+static SimEvent  events[MAX_EVENTS];
+static uint32_t  nEvents;
+static SimExpect expects[MAX_EXPECT];
+static uint32_t  nExpects;
+static double    tEnd = 10, tTrace, tau = 0.3, rpmMax = N_MOT_MAX;
+static double    offT0 = -1, offT1 = -1;
+
+// ####### RUN STATE #######
+static jmp_buf  runEnd;
+static double   tOff = -1, tReset = -1;
+static uint8_t  latched;                // power latch (OFF_PIN) set by the firmware
+static double   nL, nR;                 // [rpm] wheel model, motor frame like rtY n_mot
+static uint32_t tickCnt;
+static FILE    *trace;
+static double   tNextTrace;
+
+static int sigIndex(const char *name) {
+  for (int k = 0; k < SIG_N; k++) if (!strcmp(name, sigNames[k])) return k;
+  fprintf(stderr, "unknown signal %s\n", name);
+  exit(1);
+}
+
+static int varIndex(const char *name) {
+  for (int k = 0; k < VAR_N; k++) if (!strcmp(name, varNames[k])) return k;
+  fprintf(stderr, "unknown variable %s\n", name);
+  exit(1);
+}
+
+static int simSet(const char *name, double v) {
+  if      (!strcmp(name, "end"))   tEnd   = v;
+  else if (!strcmp(name, "trace")) tTrace = v;
+  else if (!strcmp(name, "tau"))   tau    = v;
+  else if (!strcmp(name, "rpm"))   rpmMax = v;
+  else return 0;
+  return 1;
+}
+
+static void addEvent(double t0, double t1, const char *name, double v0, double v1) {
+  if (nEvents == MAX_EVENTS) { fprintf(stderr, "too many events\n"); exit(1); }
+  events[nEvents++] = (SimEvent){t0, t1, v0, v1, (uint8_t)sigIndex(name)};
+}
+
+static void loadScenario(const char *file) {
+  FILE *f = fopen(file, "r");
+  if (!f) { perror(file); exit(1); }
+  char line[256], a[32], b[32];
+  double t0, t1, v0, v1;
+  int ln = 0;
+  while (fgets(line, sizeof(line), f)) {
+    ln++;
+    char *c = strchr(line, '#');
+    if (c) *c = 0;
+    if (sscanf(line, " %31s", a) != 1) continue;
+    if (!strcmp(a, "set") && sscanf(line, " set %31s %lf", b, &v0) == 2 && simSet(b, v0)) continue;
+    if (!strcmp(a, "at") && sscanf(line, " at %lf %31s %lf", &t0, b, &v0) == 3) { addEvent(t0, t0, b, v0, v0); continue; }
+    if (!strcmp(a, "ramp") && sscanf(line, " ramp %lf %lf %31s %lf %lf", &t0, &t1, b, &v0, &v1) == 5) { addEvent(t0, t1, b, v0, v1); continue; }
+    if (!strcmp(a, "expect") && sscanf(line, " expect %lf %lf %31s %lf %lf", &t0, &t1, b, &v0, &v1) == 5 && nExpects < MAX_EXPECT) {
+      expects[nExpects++] = (SimExpect){.t0 = t0, .t1 = t1, .min = (int32_t)v0, .max = (int32_t)v1, .var = (uint8_t)varIndex(b)};
+      continue;
+    }
+    if (!strcmp(a, "poweroff") && sscanf(line, " poweroff %lf %lf", &offT0, &offT1) == 2) continue;
+    fprintf(stderr, "%s:%i: cannot parse: %s", file, ln, line);
+    exit(1);
+  }
+  fclose(f);
+}
+
+static void updateSignals(double t) {
+  for (uint32_t k = 0; k < nEvents; k++) {
+    const SimEvent *ev = &events[k];
+    if (t < ev->t0) continue;
+    if (t >= ev->t1 || ev->t1 <= ev->t0) sig[ev->sig] = ev->v1;
+    else sig[ev->sig] = ev->v0 + (ev->v1 - ev->v0) * (t - ev->t0) / (ev->t1 - ev->t0);
+  }
+}
+
+static int32_t varValue(uint8_t v) {
+  switch (v) {
+    case VAR_ENABLE:  return enable;
+    case VAR_SPEED:   return speedAvg;
+    case VAR_CMDL:    return cmdL;
+    case VAR_CMDR:    return cmdR;
+    case VAR_PWML:    return pwml;
+    case VAR_PWMR:    return pwmr;
+    case VAR_BATV:    return batVoltageCalib;
+    case VAR_TEMP:    return board_temp_deg_c;
+    case VAR_BUZZER:  return buzzerFreq;
+    case VAR_BEEP:    return beepNoteTicks != 0 || beepTail != beepHead;
+    case VAR_BTNMODE: return buttonMode;
+    #if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+    case VAR_HOLD:    return holdReq;
+    #endif
+    default:          return 0;
+  }
+}
+
+// ####### CONTROL INTERRUPT AND SLOW TASK #######
+// Wheel target in the motor frame: the command, none while disabled, held while a hold is requested
+static double wheelTarget(int pwm, int motor) {
+  #if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+  if (holdReq == BLDC_HOLD_POS) return 0;
+  if (holdReq == BLDC_HOLD_SPD) return holdTgt[motor];
+  #endif
+  (void)motor;
+  return enable ? pwm * rpmMax / 1000.0 : 0;
+}
+
+void halsimTick(void) {
+  const double dt = 1.0 / PWM_FREQ;
+  double t = (double)halsimNs() * 1e-9;
+  if (t >= tEnd) longjmp(runEnd, 1);
+  updateSignals(t);
+  tickCnt++;
+
+  // Slow ADC channels and the power button
+  adc_buffer.l_tx2 = (uint16_t)CLAMP(sig[SIG_IN1], 0, 4095);
+  adc_buffer.l_rx2 = (uint16_t)CLAMP(sig[SIG_IN2], 0, 4095);
+  adc_buffer.batt1 = (uint16_t)CLAMP(sig[SIG_VBAT] * 100.0 * BAT_CALIB_ADC / BAT_CALIB_REAL_VOLTAGE, 0, 4095);
+  adc_buffer.temp  = (uint16_t)CLAMP(TEMP_CAL_LOW_ADC + (sig[SIG_TEMP] * 10.0 - TEMP_CAL_LOW_DEG_C) *
+                                     (TEMP_CAL_HIGH_ADC - TEMP_CAL_LOW_ADC) / (TEMP_CAL_HIGH_DEG_C - TEMP_CAL_LOW_DEG_C), 0, 4095);
+  if (sig[SIG_BUTTON] >= 0.5) BUTTON_PORT->IDR |= BUTTON_PIN;
+  else                        BUTTON_PORT->IDR &= ~(uint32_t)BUTTON_PIN;
+
+  // Slow task: battery filter at 16 Hz, beep sequencer
+  buzzerTimer++;
+  if (tickCnt % (PWM_FREQ / 16) == 0) {
+    filtLowPass32Fast(adc_buffer.batt1, BAT_FILT_COEF, &batVoltageFixdt);
+    batVoltage = (int16_t)(batVoltageFixdt >> 16);
+  }
+  if (beepNoteTicks == 0 && beepTail != beepHead) {
+    beepNoteTicks = (uint32_t)beepQueue[beepTail].ms * (PWM_FREQ / 1000);
+    beepTail      = (beepTail + 1) & (BEEP_QUEUE_LEN - 1);
+  }
+  if (beepNoteTicks) {
+    beepNoteTicks--;
+  }
+
+  // Wheels
+  #if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+  static uint8_t holdPrev;
+  if (holdReq == BLDC_HOLD_SPD && holdPrev != BLDC_HOLD_SPD) {   // cruise speed taken when engaged, as bldc.c does
+    holdTgt[0] = (int16_t)nL;
+    holdTgt[1] = (int16_t)nR;
+  }
+  holdPrev = holdReq;
+  #endif
+  nL += (wheelTarget(pwml, 0) - nL) * dt / tau;
+  nR += (wheelTarget(pwmr, 1) - nR) * dt / tau;
+  rtY_Left.n_mot  = (int16_t)CLAMP(nL + boardOutL((int16_t)sig[SIG_PUSH]), INT16_MIN, INT16_MAX);
+  rtY_Right.n_mot = (int16_t)CLAMP(nR + boardOutR((int16_t)sig[SIG_PUSH]), INT16_MIN, INT16_MAX);
+  state.tick       = tickCnt;
+  state.n_mot[0]   = rtY_Left.n_mot;
+  state.n_mot[1]   = rtY_Right.n_mot;
+  state.batVoltage = batVoltage;
+
+  // Expectations and trace
+  for (uint32_t k = 0; k < nExpects; k++) {
+    SimExpect *e = &expects[k];
+    if (e->failed || t < e->t0 || t > e->t1) continue;
+    int32_t v = varValue(e->var);
+    if (v < e->min || v > e->max) {
+      e->failed = 1;
+      e->tFail  = t;
+      e->vFail  = v;
+    }
+  }
+  if (trace && tTrace > 0 && t >= tNextTrace) {
+    tNextTrace += tTrace;
+    fprintf(trace, "%.3f,%d,%d,%.1f,%.1f,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", t, adc_buffer.l_tx2, adc_buffer.l_rx2, sig[SIG_VBAT],
+            sig[SIG_TEMP], (int)sig[SIG_BUTTON], enable, cmdL, cmdR, pwml, pwmr, speedAvg, batVoltageCalib, board_temp_deg_c, buzzerFreq);
+  }
+}
+
+void halsimPinWrite(GPIO_TypeDef *port, uint16_t pin) {
+  if (port != OFF_PORT || pin != OFF_PIN) return;
+  if (port->ODR & pin) {
+    latched = 1;
+  } else if (latched) {                 // the latch lets go: the board is off
+    tOff = (double)halsimNs() * 1e-9;
+    longjmp(runEnd, 1);
+  }
+}
+
+void halsimReset(void) {
+  tReset = (double)halsimNs() * 1e-9;
+  longjmp(runEnd, 1);
+}
+
+int main(int argc, char **argv) {
+  const char *out = NULL, *scenario = NULL;
+  int verbose = 0;
+
+  for (int k = 1; k < argc; k++) {
+    if (!strcmp(argv[k], "-o") && k + 1 < argc) out = argv[++k];
+    else if (!strcmp(argv[k], "-v")) verbose = 1;
+    else scenario = argv[k];
+  }
+  if (!scenario) {
+    fprintf(stderr, "usage: %s [-o trace.csv] [-v] scenario\n", argv[0]);
+    return 1;
+  }
+  loadScenario(scenario);
+  if (out) {
+    if (!(trace = fopen(out, "w"))) { perror(out); return 1; }
+    fprintf(trace, "t,in1,in2,vbat,temp,button,enable,cmdL,cmdR,pwml,pwmr,speedAvg,batVoltageCalib,board_temp_deg_c,buzzerFreq\n");
+  }
+  if (verbose) {
+    halsimUartOut(stdout);
+  } else if (!freopen("/dev/null", "w", stdout)) {      // firmware printf
+    return 1;
+  }
+
+  clock_t c0 = clock();
+  if (!setjmp(runEnd)) {
+    firmwareMain();
+  }
+  double wall = (double)(clock() - c0) / CLOCKS_PER_SEC;
+  double t    = (double)halsimNs() * 1e-9;
+  if (trace) fclose(trace);
+
+  int fail = 0;
+  fprintf(stderr, "%s: %.1f s simulated in %.2f s (%.0fx)", scenario, t, wall, t / (wall > 1e-6 ? wall : 1e-6));
+  if (tOff >= 0)   fprintf(stderr, ", poweroff at %.3f s", tOff);
+  if (tReset >= 0) fprintf(stderr, ", reset at %.3f s", tReset);
+  fprintf(stderr, "\n");
+
+  if (offT0 >= 0 && (tOff < offT0 || tOff > offT1)) {
+    fprintf(stderr, "  FAIL poweroff expected between %.3f and %.3f s\n", offT0, offT1);
+    fail = 1;
+  } else if (offT0 < 0 && tOff >= 0) {
+    fprintf(stderr, "  FAIL unexpected poweroff\n");
+    fail = 1;
+  }
+  for (uint32_t k = 0; k < nExpects; k++) {
+    const SimExpect *e = &expects[k];
+    if (e->failed) {
+      fprintf(stderr, "  FAIL %s = %li at %.3f s, expected %li..%li from %.3f to %.3f s\n", varNames[e->var], (long)e->vFail,
+              e->tFail, (long)e->min, (long)e->max, e->t0, e->t1);
+      fail = 1;
+    } else if (e->t0 > t) {
+      fprintf(stderr, "  FAIL %s from %.3f s not reached\n", varNames[e->var], e->t0);
+      fail = 1;
+    }
+  }
+  return fail;
+}
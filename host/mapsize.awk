@@ -0,0 +1,51 @@
+# Flash and RAM per object file from a GNU ld map file (make ram-report), largest RAM user first
+# flash: .isr_vector .text .rodata .ARM* init arrays and the load images of .ramfunc and .data
+# ram:   .ramfunc .data .bss, the heap reserve and the stack (_Min_Heap_Size, _Min_Stack_Size) are listed separately
+# Library members are summed per archive, e.g. libc_nano.a
+
+function hex(s,    v, i, c) {
+  v = 0
+  s = tolower(substr(s, 3))
+  for (i = 1; i <= length(s); i++) {
+    c = index("0123456789abcdef", substr(s, i, 1)) - 1
+    v = v * 16 + c
+  }
+  return v
+}
+
+function add(addr, size, file,    n, p, key) {
+  size = hex(size)
+  if (size == 0 || hex(addr) == 0) return       # discarded by --gc-sections
+  if (file ~ /.\(/) sub(/\(.*$/, "", file)        # archive member
+  n = split(file, p, "/")
+  key = p[n]
+  sub(/\.o$/, "", key)
+  if (out ~ /^\.(isr_vector|text|rodata|ARM|preinit_array|init_array|fini_array)/) flash[key] += size
+  else if (out == ".ramfunc" || out == ".data") { flash[key] += size; ram[key] += size }
+  else if (out == ".bss") ram[key] += size
+  else return
+  seen[key] = 1
+}
+
+/^Linker script and memory map/ { on = 1; next }
+!on { next }
+
+!pend && $2 ~ /^_Min_(Heap|Stack)_Size$/ { reserve[$2] = hex($1); next }   # linker script assignments
+/^\./ { out = $1; pend = 0; next }                          # output section
+pend && /^ +0x/ { add($1, $2, $3); pend = 0; next }         # continuation of a long input section name
+/^ \*fill\*/ { if (NF >= 3) add($2, $3, "(fill)"); next }
+/^ [.A-Z]/ {
+  if (NF == 1) pend = 1
+  else if (NF >= 4 && $3 ~ /^0x/) add($2, $3, $4)
+  next
+}
+
+END {
+  printf "%-24s %8s %8s\n", "object", "flash", "ram"
+  for (k in seen) printf "%-24s %8d %8d\n", k, flash[k], ram[k] | "sort -k3,3nr -k2,2nr"
+  close("sort -k3,3nr -k2,2nr")
+  for (k in seen) { tf += flash[k]; tr += ram[k] }
+  printf "%-24s %8d %8d\n", "total", tf, tr
+  printf "%-24s %8s %8d\n", "heap reserve", "", reserve["_Min_Heap_Size"]
+  printf "%-24s %8s %8d\n", "stack reserve", "", reserve["_Min_Stack_Size"]
+}
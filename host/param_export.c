@@ -0,0 +1,78 @@
+/*
+* Parameter metadata of a configuration (make param-export), for host tools that address parameters by id.
+* The "#<id>" of the protocol and the binary GET / SET ids are the params[] index, which depends on the config.h of
+* the build; this exports the table of that build so a tool does not have to parse "$HELP" or hard-code the ids.
+*
+* comms.c is built with the same Inc/config.h as the firmware, the stubs of host/comms_stubs.c stand in for the rest.
+* The values come from params[] as the firmware converts them, the help texts from an expansion of Inc/params.def of
+* its own, so they are also there with DEBUG_NO_HELP (the firmware then prints the id instead of the text).
+*
+* usage: param_export -j       JSON array, one object per parameter in id order
+*        param_export -c       C / C++ header: the PARAM_ID_<name> ids and a table of the metadata
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "defines.h"                    // pulls in Inc/config.h
+#include "util.h"
+#include "comms.h"
+#include "comms_stubs.h"
+
+#if !defined(DEBUG_SERIAL_PROTOCOL)
+  #error The parameter export needs DEBUG_SERIAL_PROTOCOL: the table is the params[] of comms.c.
+#endif
+
+extern const parameter_entry params[];
+
+static const char *const paramHelp[PARAM_COUNT] = {
+  #define PARAM(type, name, value, valueR, addr, init, ext, min, max, div, mul, fix, callback, help)  help,
+  #define PARAM_CONST(name, init, mul, fix, help)  help,
+  #include "params.def"
+};
+
+static const char *const typeNames[] = {"uint8", "uint16", "uint32", "int8", "int16", "int32", "int", "float"};
+
+static void printJson(void) {
+  printf("[\n");
+  for (uint8_t i = 0; i < PARAM_COUNT; i++) {
+    printf("  {\"id\":%u, \"name\":\"%s\", \"type\":\"%s\", \"datatype\":\"%s\", \"addr\":%u, \"init\":%li, "
+           "\"min\":%li, \"max\":%li, \"div\":%u, \"mul\":%u, \"fix\":%u, \"help\":\"%s\"}%s\n",
+           i, params[i].name, params[i].type == PARAMETER ? "parameter" : "variable", typeNames[params[i].datatype],
+           params[i].addr, (long)getParamInitExt(i), (long)params[i].min, (long)params[i].max,
+           params[i].div, params[i].mul, params[i].fix, paramHelp[i], (i + 1 < PARAM_COUNT) ? "," : "");
+  }
+  printf("]\n");
+}
+
+static void printHeader(void) {
+  printf("// Generated by host/param_export.c from Inc/params.def and Inc/config.h, valid for that build only\n");
+  printf("#pragma once\n#include <stdint.h>\n\n");
+  printf("enum HoverParamId {\n");
+  for (uint8_t i = 0; i < PARAM_COUNT; i++) printf("  PARAM_ID_%s = %u,\n", params[i].name, i);
+  printf("  PARAM_COUNT = %u\n};\n\n", PARAM_COUNT);
+  printf("struct HoverParamInfo {\n"
+         "  const char *name;\n"
+         "  uint8_t     writable;               // PARAMETER, can be set and saved\n"
+         "  uint16_t    addr;                   // EEPROM address, 0 = not saved\n"
+         "  int32_t     init, min, max;         // external units\n"
+         "  const char *help;\n"
+         "};\n\n");
+  printf("static const struct HoverParamInfo hoverParams[PARAM_COUNT] = {\n");
+  for (uint8_t i = 0; i < PARAM_COUNT; i++) {
+    printf("  {\"%s\", %u, %u, %li, %li, %li, \"%s\"},\n", params[i].name, params[i].type == PARAMETER,
+           params[i].addr, (long)getParamInitExt(i), (long)params[i].min, (long)params[i].max, paramHelp[i]);
+  }
+  printf("};\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2 || (strcmp(argv[1], "-j") && strcmp(argv[1], "-c"))) {
+    fprintf(stderr, "usage: %s -j | -c\n", argv[0]);
+    return 2;
+  }
+  if (!strcmp(argv[1], "-j")) printJson();
+  else                        printHeader();
+  return 0;
+}
@@ -0,0 +1,67 @@
+/*
+* Motor model of the host simulations (make host-sil, make host-boards): a three phase BLDC motor with sinusoidal
+* back-EMF, the inverter with its dead time and free wheeling diodes, the hall sensors and the load on the shaft.
+* No config.h here, host/sil.c and host/boards.c build with different ones: the PWM frequency comes with PlantParam.
+*/
+
+#include <math.h>
+#include "plant.h"
+
+#define SUBSTEPS        4               // plant integration steps per controller step
+#define HALL_OFFSET     90              // [deg] electrical angle of the hall sensors, aligns the controller angle with the back-EMF (best torque per A)
+#define CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
+
+// [deg] start of the 180 deg high half of the sensors A, B, C: hall codes 6, 4, 5, 1, 3, 2 of a positive rotation, see host/bench.c
+static const double hallOn[3] = {120, 240, 0};
+
+// One controller period of the motor, inverter and hall sensors.
+// ccr[] are the timer compare values, on = 0 when the PWM outputs are disabled (MOE cleared)
+void plantStep(const PlantParam *p, SimMotor *m, const uint16_t ccr[3], uint8_t on, double Vdc, double Tload, double Tslope, uint8_t lock) {
+  const double dt   = 1.0 / p->pwmFreq / SUBSTEPS;
+  const int    res  = p->sysClk / 2 / p->pwmFreq;         // bldc.c pwm_res
+  double duty[3];
+  for (int k = 0; k < 3; k++) duty[k] = ccr[k] / (double)res;
+
+  for (int s = 0; s < SUBSTEPS; s++) {
+    double the = m->th * POLE_PAIRS, e[3], v[3], d[3], vn = 0, esum = 0;
+    for (int k = 0; k < 3; k++) {
+      e[k] = p->Ke * m->w * sin(the - k * 2.0 * M_PI / 3.0);
+      if (on) {                                           // Dead time: the diode of the current direction conducts, smoothed over 50 mA
+        d[k] = CLAMP(duty[k] - p->dead / res * CLAMP(m->i[k] / 0.05, -1.0, 1.0), 0.0, 1.0);
+        v[k] = d[k] * Vdc;
+      } else {                                            // Diodes: current into the motor from ground, out of the motor into Vdc
+        v[k] = m->i[k] > 0 ? 0.0 : (m->i[k] < 0 ? Vdc : Vdc / 2);
+      }
+      vn += v[k]; esum += e[k];
+    }
+    vn = (vn - esum) / 3.0;                               // Star point, sum of the currents is 0
+
+    m->T = 0; m->iDC = 0;
+    for (int k = 0; k < 3; k++) {
+      double i = m->i[k] + dt * (v[k] - vn - p->R * m->i[k] - e[k]) / p->L;
+      if (!on && i * m->i[k] <= 0) i = 0;                 // the diode blocks when the current ends
+      m->i[k] = i;
+      m->T   += p->Ke * sin(the - k * 2.0 * M_PI / 3.0) * i;
+      m->iDC += on ? d[k] * i : (i < 0 ? i : 0);
+    }
+
+    if (lock) {
+      m->w = 0;
+    } else {
+      double Tc = p->cog * sin(p->cogHarm * the);        // cogging, a function of the rotor position only
+      double Tl = Tload;                                  // load opposes the motion, holds up to its value at standstill
+      if (m->w > 1e-3)       Tl =  Tload;
+      else if (m->w < -1e-3) Tl = -Tload;
+      else                   Tl = CLAMP(m->T - Tc - Tslope, -Tload, Tload);
+      m->w += dt * (m->T - Tc - p->B * m->w - Tl - Tslope) / p->J;
+    }
+    m->th += dt * m->w;
+  }
+  const double err[3] = {p->hallErr, -p->hallErr / 2, 0};
+  m->hall = 0;
+  for (int k = 0; k < 3; k++) {
+    double a = fmod(m->th * POLE_PAIRS * 180.0 / M_PI + HALL_OFFSET - hallOn[k] - err[k], 360.0);
+    if (a < 0) a += 360.0;
+    if (a < 180.0) m->hall |= 1 << k;
+  }
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+
+// Motor, inverter and hall sensor model of the host simulations (see plant.c), shared by host/sil.c and host/boards.c.
+#define POLE_PAIRS      15              // hoverboard motor
+
+typedef struct {
+  double R, L, Ke, J, B;                // phase resistance [Ohm] and inductance [H], back-EMF [V s/rad, phase peak], inertia [kg m2], viscous friction [Nm s/rad]
+  double hallErr;                       // [deg] hall sensor placement error, electrical: A +hallErr, B -hallErr / 2, C 0
+  double dead;                          // [timer counts] inverter dead time per PWM period, DEAD_TIME for the real one
+  double cog, cogHarm;                  // [Nm] cogging torque amplitude, its periods per electrical turn
+  int    pwmFreq;                       // [Hz] controller period, PWM_FREQ of the simulated firmware
+  int    sysClk;                        // [Hz] PWM timer clock, SYSCLK_HZ of the simulated firmware
+} PlantParam;
+
+#define PLANT_DEFAULT   {0.12, 0.00025, 0.38, 0.15, 0.002, 0.0, 0.0, 0.0, 6, PWM_FREQ, SYSCLK_HZ}   // with the clocks of the including file
+
+typedef struct {
+  double i[3];                          // [A] phase currents
+  double w;                             // [rad/s] mechanical speed
+  double th;                            // [rad] mechanical angle
+  double T;                             // [Nm] electromagnetic torque
+  double iDC;                           // [A] DC link current
+  uint8_t hall;
+} SimMotor;
+
+void plantStep(const PlantParam *p, SimMotor *m, const uint16_t ccr[3], uint8_t on, double Vdc, double Tload, double Tslope, uint8_t lock);
@@ -0,0 +1,31 @@
+/*
+* Pseudo terminals of the multi-board mock (host/boards.c), in a file of their own: termios.h defines names like CR1
+* that are register names in host/halsim/stm32f1xx_hal.h.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+/* A raw pseudo terminal, its slave path in name. The slave stays open in this process, so the master keeps working
+ * while no client has it open. Returns the master, non-blocking */
+int ptyOpen(char *name, size_t len) {
+  struct termios tio;
+  int m = posix_openpt(O_RDWR | O_NOCTTY);
+  if (m < 0 || grantpt(m) || unlockpt(m) || ptsname_r(m, name, len)) {
+    perror("pty");
+    exit(1);
+  }
+  int s = open(name, O_RDWR | O_NOCTTY);
+  if (s < 0 || tcgetattr(s, &tio)) {
+    perror(name);
+    exit(1);
+  }
+  cfmakeraw(&tio);
+  tcsetattr(s, TCSANOW, &tio);
+  fcntl(m, F_SETFL, O_NONBLOCK);
+  return m;
+}
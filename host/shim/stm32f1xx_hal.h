@@ -0,0 +1,35 @@
+/*
+* Host stand-in for the STM32 HAL header (make host-test, make host-fuzz).
+* Lets the HAL-free firmware sources include the real config.h, defines.h and util.h on the build machine.
+* Only the types named in those headers, the CMSIS intrinsics of fixpt.h and comms.c and the two flash
+* functions of comms.c (stubbed by host/comms_stubs.c) are provided, using any other HAL function fails to compile.
+*/
+
+#ifndef __STM32F1xx_HAL_H
+#define __STM32F1xx_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct __UART_HandleTypeDef UART_HandleTypeDef;
+typedef int IRQn_Type;
+
+// Portable CMSIS saturation intrinsics (Inc/fixpt.h)
+static inline int32_t __SSAT(int32_t x, uint32_t bits) {
+  int32_t max = (int32_t)((1UL << (bits - 1)) - 1);
+  return x > max ? max : (x < -max - 1 ? -max - 1 : x);
+}
+static inline uint32_t __USAT(int32_t x, uint32_t bits) {
+  uint32_t max = (uint32_t)((1ULL << bits) - 1);
+  return x < 0 ? 0 : ((uint32_t)x > max ? max : (uint32_t)x);
+}
+
+
+static inline void __DMB(void) { __sync_synchronize(); }
+
+#define FLASH_PAGE_SIZE 0x800U          // STM32F103xE, for the EEPROM emulation layout of eeprom.h
+
+int HAL_FLASH_Unlock(void);
+int HAL_FLASH_Lock(void);
+
+#endif
@@ -0,0 +1,1096 @@
+/*
+* Software-in-the-loop simulator (make host-sil)
+* Two BLDC motor + inverter + hall sensor models closed around the unmodified BLDC_controller_step.
+* The firmware glue around the controller (bldc_control current scaling, PWM clamping and chopping,
+* mixerFcn and the main loop output mapping) is reproduced below, keep it in sync with bldc.c, util.c and main.c.
+*
+* usage: sil [-p name=value]... [-o trace.csv] [-w] [-b dump.txt] scenario
+*        sil [-p name=value]... [-o diff.csv] [-s skip] [-t tol] -r dump.txt [scenario]
+*   -p name=value   controller parameter, overrides the scenario (see simParam for the names)
+*   -o file         CSV trace output, default stdout
+*   -w              print r_fieldWeakMap_Table (FI_WEAK_ENA 2) for the plant settings of the scenario instead of running it
+*   -b file         also write the controller inputs and outputs of every step as a black box dump ($BBOX format)
+*   -r file         replay: no plant, every black box sample of a saved $BBOX or $FLOG dump is fed to the controller and
+*                   the duty outputs and z_errCode are compared with the recorded ones. The exit code is 1 on a
+*                   difference above tol (default 0) after the first skip samples of a dump (default 0)
+*
+* Replay needs a dump of a firmware with BLACKBOX_DECIM 1, with decimation the inputs are held over the skipped steps and
+* the comparison is approximate. The controller starts from its reset state, so a dump that starts with the motors
+* disabled replays exactly, otherwise pass -s to skip the samples until the states match. The controller parameters of
+* the board are given as for the simulation (-p, param). Not replayed: ANGLE_OBSERVER, CURRENT_DERATING and parameter
+* changes during the dump.
+*
+* Scenario file, one statement per line, '#' starts a comment, times in seconds:
+*   set   <name> <value>                 plant/run setting: R L Ke J B Vbat Rbat noise hall_err dead cog cog_harm trace end (see simSet)
+*   param <name> <value>                 controller parameter in config.h units, e.g. "param i_max 15"
+*   at    <t> <signal> <value>           step a signal at time t
+*   ramp  <t0> <t1> <signal> <v0> <v1>   linear ramp of a signal, the last started event of a signal wins
+*   measure <t0> <t1>                    print efficiency and torque ripple over [t0, t1] to stderr
+*   cost  <term> <t0> <t1> <weight>      add weight * term over [t0, t1] to the cost printed at the end ("cost: ..." on
+*                                        stderr), the objective of make host-tune. Terms: loss (input minus output energy
+*                                        over the mechanical energy both ways [%], also fair with regenerative braking),
+*                                        ripple (torque ripple rms [Nm]), overshoot and settle (of a speed step at t0:
+*                                        overshoot [%] and the time to stay within 2 % of the step [ms], the end value is
+*                                        the mean of the last quarter of the window), speed (mean wheel speed [rpm], with
+*                                        a negative weight a reward), error (share of the time with a controller error or
+*                                        DC current chopping [%])
+* Signals: speed steer (mixer inputs), enable, mode (z_ctrlModReq), load loadl loadr [Nm], lock lockl lockr (stall),
+*          slope slopel sloper [Nm] (constant torque against driving forward, e.g. a slope, unlike load also at standstill),
+*          hallcal (rising edge starts the HALL_CALIB calibration of both motors, like $HALLCAL),
+*          motorid (rising edge starts the MOTOR_IDENT identification of both motors, like $MOTID),
+*          cogcal (rising edge starts the COGGING_COMP table recording of both motors, like $COGCAL),
+*          posl posr (POS_CTRL position targets [hall steps] of the mode 4 POS_MODE, odometry of each motor),
+*          hold (STANDSTILL_HOLD_ENABLE / CRUISE_CONTROL_SUPPORT hold request: 0 none, 1 standstill position, 2 cruise)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "config.h"
+#include "BLDC_controller.h"
+#include "observer.h"
+#include "hallcal.h"
+#include "motorid.h"
+#include "cogging.h"
+#include "posctrl.h"
+#include "plant.h"
+
+#define MAX_EVENTS      256
+#define MAX_MEASURE     32
+#define MAX_COST        16
+#define CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+enum simSignals {SIG_SPEED, SIG_STEER, SIG_ENABLE, SIG_MODE, SIG_LOADL, SIG_LOADR, SIG_LOCKL, SIG_LOCKR, SIG_HALLCAL, SIG_MOTORID, SIG_POSL, SIG_POSR, SIG_HOLD, SIG_SLOPEL, SIG_SLOPER, SIG_COGCAL, SIG_N};
+static const char *sigNames[SIG_N] = {"speed", "steer", "enable", "mode", "loadl", "loadr", "lockl", "lockr", "hallcal", "motorid", "posl", "posr", "hold", "slopel", "sloper", "cogcal"};
+
+typedef struct {
+  double t0, t1;                        // ramp from t0 to t1, step if t0 == t1
+  double v0, v1;
+  uint8_t sig;
+} SimEvent;
+
+typedef struct {
+  double t0, t1;
+  double eIn, eOut, eAbs, tSum, tSq, tMin, tMax, wSum, wMin, wMax;
+  uint32_t n, nErr;
+} SimMeasure;
+
+enum simCostTerms {COST_LOSS, COST_RIPPLE, COST_OVERSHOOT, COST_SETTLE, COST_SPEED, COST_ERROR, COST_N};
+static const char *costNames[COST_N] = {"loss", "ripple", "overshoot", "settle", "speed", "error"};
+
+typedef struct {
+  SimMeasure m;
+  double     w;
+  uint8_t    term;
+  float     *v;                         // [rad/s] vehicle speed of every step of the window, overshoot and settle
+  uint32_t   nv, cap;
+} SimCost;
+
+// Plant and run settings
+static PlantParam plant = PLANT_DEFAULT;                               // motor model, see host/plant.h
+static double Vbat = 36.0, Rbat = 0.15, noise = 0.0;                   // battery voltage [V] and resistance [Ohm], current measurement noise [ADC bits rms]
+static double tTrace = 0.001, tEnd = 5.0;                              // [s] trace period and simulation end
+
+static SimEvent   events[MAX_EVENTS];
+static uint32_t   nEvents;
+static SimMeasure meas[MAX_MEASURE];
+static uint32_t   nMeas;
+static SimCost    costs[MAX_COST];
+static uint32_t   nCosts;
+static double     sig[SIG_N] = {0, 0, 1, CTRL_MOD_REQ, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// Black box sample flags of Inc/bldc.h, keep in sync
+#define BBOX_ERR        0x0F            // BLACKBOX_ERR
+#define BBOX_MODE_SHIFT 4               // BLACKBOX_MODE_SHIFT
+#define BBOX_ENA        0x40            // BLACKBOX_ENA
+#define BBOX_CHOP       0x80            // BLACKBOX_CHOP
+#define BBOX_CTRL_ERR   0x07            // z_errCode bits of the controller, bit 3 is set by bldc.c (ERR_DEADLINE_MISS)
+#define BBOX_COLS       10              // values per motor in a dump line
+
+typedef struct {
+  int16_t v[2][BBOX_COLS];              // per motor: curA curB curDC dutyA dutyB dutyC n hall flags cmd
+} BboxSample;
+
+typedef struct {
+  BboxSample *s;
+  uint32_t    n, cap;
+  int         decim;
+  int         line;                     // line of the header in the dump file
+} BboxDump;
+
+static RT_MODEL rtM_Left_, rtM_Right_;
+static RT_MODEL *const rtM_Left  = &rtM_Left_;
+static RT_MODEL *const rtM_Right = &rtM_Right_;
+extern P rtP_Left;
+static P    rtP_Right;
+static DW   rtDW_Left, rtDW_Right;
+static ExtU rtU_Left, rtU_Right;
+static ExtY rtY_Left, rtY_Right;
+
+// Controller parameters in config.h units, applied like BLDC_Init and the CTRL_*, I_MOT_MAX, ... parameters of comms.c
+static int  ctrlTyp = CTRL_TYP_SEL, iMotMax = I_MOT_MAX, nMotMax = N_MOT_MAX, fwEna = FIELD_WEAK_ENA;
+static int  fwMax = FIELD_WEAK_MAX, fwHi = FIELD_WEAK_HI, fwLo = FIELD_WEAK_LO, phaAdvMax = PHASE_ADV_MAX, iDCMax = I_DC_MAX;
+static int  dtComp = DT_COMP, focVoltMax = FOC_VOLT_MAX;
+// PI gains and current filter in the generated units at PWM_FREQ_BASE, the CTRL_GAINS parameters, -1 = generated
+enum simGains {GAIN_ID_KP, GAIN_ID_KI, GAIN_IQ_KP, GAIN_IQ_KI, GAIN_N_KP, GAIN_N_KI, GAIN_FILT, GAIN_N};
+static const char *gainNames[GAIN_N] = {"id_kp", "id_ki", "iq_kp", "iq_ki", "n_kp", "n_ki", "curr_filt"};
+static int  gains[GAIN_N] = {-1, -1, -1, -1, -1, -1, -1};
+static int  simParam(const char *name, double v) {
+  for (int k = 0; k < GAIN_N; k++) {
+    if (!strcmp(name, gainNames[k])) { gains[k] = (int)v; return 1; }
+  }
+  if      (!strcmp(name, "ctrl_typ"))      ctrlTyp   = (int)v;
+  else if (!strcmp(name, "ctrl_mod"))      sig[SIG_MODE] = v;
+  else if (!strcmp(name, "i_max"))         iMotMax   = (int)v;
+  else if (!strcmp(name, "n_max"))         nMotMax   = (int)v;
+  else if (!strcmp(name, "i_dc_max"))      iDCMax    = (int)v;
+  else if (!strcmp(name, "fi_weak_ena"))   fwEna     = (int)v;
+  else if (!strcmp(name, "fi_weak_max"))   fwMax     = (int)v;
+  else if (!strcmp(name, "fi_weak_hi"))    fwHi      = (int)v;
+  else if (!strcmp(name, "fi_weak_lo"))    fwLo      = (int)v;
+  else if (!strcmp(name, "pha_adv_max"))   phaAdvMax = (int)v;
+  else if (!strcmp(name, "dt_comp"))       dtComp    = (int)v;
+  else if (!strcmp(name, "foc_volt_max"))  focVoltMax = (int)v;
+  else return 0;
+  return 1;
+}
+
+static int simSet(const char *name, double v) {
+  if      (!strcmp(name, "R"))     plant.R  = v;
+  else if (!strcmp(name, "L"))     plant.L  = v;
+  else if (!strcmp(name, "Ke"))    plant.Ke = v;
+  else if (!strcmp(name, "J"))     plant.J  = v;
+  else if (!strcmp(name, "B"))     plant.B  = v;
+  else if (!strcmp(name, "Vbat"))  Vbat   = v;
+  else if (!strcmp(name, "Rbat"))  Rbat   = v;
+  else if (!strcmp(name, "noise")) noise  = v;
+  else if (!strcmp(name, "hall_err")) plant.hallErr = v;
+  else if (!strcmp(name, "dead"))  plant.dead = v;
+  else if (!strcmp(name, "cog"))   plant.cog  = v;
+  else if (!strcmp(name, "cog_harm")) plant.cogHarm = v;
+  else if (!strcmp(name, "trace")) tTrace = v;
+  else if (!strcmp(name, "end"))   tEnd   = v;
+  else return 0;
+  return 1;
+}
+
+static void simInit(void) {
+  rtP_Left.b_angleMeasEna       = 0;
+  rtP_Left.z_selPhaCurMeasABC   = 0;
+  rtP_Left.z_ctrlTypSel         = ctrlTyp;
+  rtP_Left.b_diagEna            = DIAG_ENA;
+  rtP_Left.i_max                = (iMotMax * A2BIT_CONV) << 4;
+  rtP_Left.n_max                = nMotMax << 4;
+  rtP_Left.b_fieldWeakEna       = fwEna;
+  rtP_Left.id_fieldWeakMax      = (fwMax * A2BIT_CONV) << 4;
+  rtP_Left.a_phaAdvMax          = phaAdvMax << 4;
+  rtP_Left.r_fieldWeakHi        = fwHi << 4;
+  rtP_Left.r_fieldWeakLo        = fwLo << 4;
+  uint16_t *gain[GAIN_N] = {&rtP_Left.cf_idKp, &rtP_Left.cf_idKi, &rtP_Left.cf_iqKp, &rtP_Left.cf_iqKi,
+                            &rtP_Left.cf_nKp, &rtP_Left.cf_nKi, &rtP_Left.cf_currFilt};
+  for (int k = 0; k < GAIN_N; k++) {                    // util.c BLDC_Init CTRL_GAINS
+    if (gains[k] >= 0) *gain[k] = (uint16_t)MIN(gains[k], 65535);
+  }
+#if PWM_FREQ != PWM_FREQ_BASE                           // util.c BLDC_Init rate rescaling
+  #define TICKS_SCALE(x)    ((int32_t)(x) * PWM_FREQ / PWM_FREQ_BASE)
+  #define PER_TICK_SCALE(x) ((int32_t)(x) * PWM_FREQ_BASE / PWM_FREQ)
+  rtP_Left.cf_speedCoef         = TICKS_SCALE(rtP_Left.cf_speedCoef);
+  rtP_Left.z_maxCntRst          = TICKS_SCALE(rtP_Left.z_maxCntRst);
+  rtP_Left.dz_cntTrnsDetHi      = TICKS_SCALE(rtP_Left.dz_cntTrnsDetHi);
+  rtP_Left.dz_cntTrnsDetLo      = TICKS_SCALE(rtP_Left.dz_cntTrnsDetLo);
+  rtP_Left.t_errQual            = TICKS_SCALE(rtP_Left.t_errQual);
+  rtP_Left.t_errDequal          = TICKS_SCALE(rtP_Left.t_errDequal);
+  rtP_Left.dV_openRate          = PER_TICK_SCALE(rtP_Left.dV_openRate);
+  rtP_Left.cf_currFilt          = PER_TICK_SCALE(rtP_Left.cf_currFilt);
+  rtP_Left.cf_idKi              = PER_TICK_SCALE(rtP_Left.cf_idKi);
+  rtP_Left.cf_iqKi              = PER_TICK_SCALE(rtP_Left.cf_iqKi);
+  rtP_Left.cf_nKi               = PER_TICK_SCALE(rtP_Left.cf_nKi);
+  rtP_Left.cf_iqKiLimProt       = PER_TICK_SCALE(rtP_Left.cf_iqKiLimProt);
+  rtP_Left.cf_nKiLimProt        = PER_TICK_SCALE(rtP_Left.cf_nKiLimProt);
+  rtP_Left.cf_KbLimProt         = PER_TICK_SCALE(rtP_Left.cf_KbLimProt);
+#endif
+#if defined(CTRL_MULTIRATE)                             // util.c BLDC_Init task rate rescaling
+  #define SLOW_TICKS_SCALE(x)   ((int32_t)(x) * 3 / CTRL_SLOW_DIV)
+  #define SLOW_PER_TICK_SCALE(x) ((int32_t)(x) * CTRL_SLOW_DIV / 3)
+  rtP_Left.cf_idKi              = rtP_Left.cf_idKi / 3;
+  rtP_Left.cf_iqKi              = rtP_Left.cf_iqKi / 3;
+  rtP_Left.cf_nKi               = rtP_Left.cf_nKi  / 3;
+  rtP_Left.t_errQual            = SLOW_TICKS_SCALE(rtP_Left.t_errQual);
+  rtP_Left.t_errDequal          = SLOW_TICKS_SCALE(rtP_Left.t_errDequal);
+  rtP_Left.dV_openRate          = SLOW_PER_TICK_SCALE(rtP_Left.dV_openRate);
+  rtP_Left.cf_iqKiLimProt       = SLOW_PER_TICK_SCALE(rtP_Left.cf_iqKiLimProt);
+  rtP_Left.cf_nKiLimProt        = SLOW_PER_TICK_SCALE(rtP_Left.cf_nKiLimProt);
+  rtP_Left.cf_KbLimProt         = SLOW_PER_TICK_SCALE(rtP_Left.cf_KbLimProt);
+#endif
+  if (focVoltMax != 900) {                              // util.c BLDC_Init FOC_VOLT_MAX
+    rtP_Left.Vd_max             = focVoltMax << 4;
+    for (int k = 0; k < 46; k++) {
+      rtP_Left.Vq_max_M1[k]     = (int16_t)((int32_t)rtP_Left.Vq_max_M1[k] * focVoltMax / 900);
+      rtP_Left.Vq_max_XA[k]     = (int16_t)(k * (320 * focVoltMax / 900));
+    }
+  }
+  rtP_Right                     = rtP_Left;
+  rtP_Right.z_selPhaCurMeasABC  = 1;
+
+  rtM_Left->defaultParam        = &rtP_Left;
+  rtM_Left->dwork               = &rtDW_Left;
+  rtM_Left->inputs              = &rtU_Left;
+  rtM_Left->outputs             = &rtY_Left;
+  rtM_Right->defaultParam       = &rtP_Right;
+  rtM_Right->dwork              = &rtDW_Right;
+  rtM_Right->inputs             = &rtU_Right;
+  rtM_Right->outputs            = &rtY_Right;
+  BLDC_controller_initialize(rtM_Left);
+  BLDC_controller_initialize(rtM_Right);
+#if defined(CTRL_MULTIRATE)
+  rtDW_Right.z_taskCnt           = CTRL_SLOW_DIV - CTRL_SLOW_DIV / 4;
+  rtDW_Right.UnitDelay2_DSTATE_c = 0;
+#else
+  rtDW_Right.UnitDelay2_DSTATE_c = 0;
+  rtDW_Right.UnitDelay6_DSTATE   = 1;
+#endif
+}
+
+// util.c mixerFcn
+static void mixerFcn(int16_t rtu_speed, int16_t rtu_steer, int16_t *rty_speedR, int16_t *rty_speedL, int16_t inMin, int16_t inMax) {
+  int16_t prodSpeed = (int16_t)((rtu_speed * (int16_t)SPEED_COEFFICIENT) >> 14);
+  int16_t prodSteer = (int16_t)((rtu_steer * (int16_t)STEER_COEFFICIENT) >> 14);
+  int32_t tmp;
+
+  tmp         = prodSpeed - prodSteer;
+  tmp         = CLAMP(tmp, -32768, 32767);
+  *rty_speedR = (int16_t)(tmp >> 4);
+  *rty_speedR = CLAMP(*rty_speedR, inMin, inMax);
+
+  tmp         = prodSpeed + prodSteer;
+  tmp         = CLAMP(tmp, -32768, 32767);
+  *rty_speedL = (int16_t)(tmp >> 4);
+  *rty_speedL = CLAMP(*rty_speedL, inMin, inMax);
+}
+
+#if defined(POS_CTRL) || defined(STANDSTILL_HOLD_ENABLE)
+// bldc.c hall2pos and odoStep: hall steps, counting up while n_mot is positive
+#define HALL_IDX(u, v, w)   ((u) | ((v) << 1) | ((w) << 2))
+static const uint8_t hall2pos[8] = {
+  [HALL_IDX(0,0,0)] = 6, [HALL_IDX(0,0,1)] = 2, [HALL_IDX(0,1,0)] = 4, [HALL_IDX(0,1,1)] = 3,
+  [HALL_IDX(1,0,0)] = 0, [HALL_IDX(1,0,1)] = 1, [HALL_IDX(1,1,0)] = 5, [HALL_IDX(1,1,1)] = 6
+};
+
+static void odoStep(int32_t *odo, uint8_t *prev, uint8_t hall) {
+  uint8_t cur = hall2pos[hall];
+  if (cur != *prev && cur < 6 && *prev < 6) {
+    int8_t d = (int8_t)cur - (int8_t)*prev;
+    *odo += (d == -1 || d == 5) ? 1 : ((d == 1 || d == -5) ? -1 : 0);
+  }
+  *prev = cur;
+}
+#endif
+
+#if defined(SPD_REF_GEN) || defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+// filters.c refGenStep
+typedef struct {
+  int32_t y, a;
+} RefGen;
+
+static int64_t refGenStopDist(int32_t v, int32_t jerkMax) {
+  int64_t n;
+  if (v <= 0) return 0;
+  n = (v + jerkMax - 1) / jerkMax;
+  return n * v - jerkMax * n * (n - 1) / 2;
+}
+
+static void refGenStep(int16_t u, int32_t accMax, int32_t jerkMax, RefGen *g) {
+  int32_t e = ((int32_t)u << 16) - g->y, d, v, vUp;
+
+  if (abs(e) <= jerkMax && abs(g->a) <= jerkMax) {
+    g->y = (int32_t)u << 16;
+    g->a = 0;
+    return;
+  }
+  d   = (e > 0 || (e == 0 && g->a < 0)) ? 1 : -1;
+  v   = d * g->a;
+  e   = d * e;
+  vUp = MIN(v + jerkMax, accMax);
+  if (v > accMax) {
+    v -= jerkMax;
+  } else if (refGenStopDist(vUp, jerkMax) <= e) {
+    v  = vUp;
+  } else if (refGenStopDist(v, jerkMax) > e) {
+    v  = MAX(v - jerkMax, -accMax);
+  }
+  g->a  = d * v;
+  g->y += g->a;
+}
+#endif
+
+#if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+// bldc.c holdTick, holdInput: standstill position hold (mode 1) and cruise (mode 2) every POS_CTRL_DIV ticks
+#define HOLD_ACC        ((int32_t)((int64_t)SPD_REF_ACC * 65536 * POS_CTRL_DIV / PWM_FREQ))
+#define HOLD_BAND       1
+#define HOLD_JERK       ((int32_t)((int64_t)SPD_REF_JERK * 65536 * POS_CTRL_DIV * POS_CTRL_DIV / ((int64_t)PWM_FREQ * PWM_FREQ)))
+typedef struct {
+  uint8_t mode, div;
+  int16_t n[2], tgt[2], inpTgt[2];
+  int32_t acc[2], pos[2];
+  RefGen  ref[2];
+  PosCtrl pc[2];
+} SimHold;
+
+static void holdTick(SimHold *h, uint8_t req, const int32_t odo[2]) {
+  uint8_t div = h->div;
+  h->div = (div == POS_CTRL_DIV - 1) ? 0 : div + 1;
+  if (div != 0) return;
+  for (int i = 0; i < 2; i++) {
+    int16_t n = i ? rtY_Right.n_mot : rtY_Left.n_mot;
+    h->acc[i] += ((((int32_t)n - h->n[i]) << 16) - h->acc[i]) >> 5;
+    h->n[i]    = n;
+    if (req != h->mode) {
+      int32_t a = CLAMP(h->acc[i], -HOLD_ACC, HOLD_ACC);
+      int32_t d = (int32_t)(((int64_t)abs(a) * (abs(a) / HOLD_JERK + 1)) >> 17);
+#if defined(STANDSTILL_HOLD_ENABLE)
+      h->pos[i]   = odo[i];
+      posCtrlReset(&h->pc[i], n);
+#endif
+      h->ref[i].y = (int32_t)n << 16;
+      h->ref[i].a = a;
+      h->tgt[i]   = (int16_t)CLAMP(n + (a < 0 ? -d : d), -N_MOT_MAX, N_MOT_MAX);
+    }
+    if (req == 2) refGenStep(h->tgt[i], HOLD_ACC, HOLD_JERK, &h->ref[i]);
+#if defined(STANDSTILL_HOLD_ENABLE)
+    if (req == 1) {
+      const P *p = i ? &rtP_Right : &rtP_Left;
+      int32_t e = h->pos[i] - odo[i];
+      h->inpTgt[i] = posCtrlStep(&h->pc[i], abs(e) <= HOLD_BAND ? odo[i] : h->pos[i], odo[i], p->n_max, p->n_polePairs);
+    }
+#endif
+  }
+  h->mode = req;
+}
+
+static void holdInput(const SimHold *h, int i, P *p, ExtU *u) {
+  p->b_cruiseCtrlEna = (h->mode == 2);
+  p->n_cruiseMotTgt  = (int16_t)((h->ref[i].y + 32768) >> 16);
+#if defined(STANDSTILL_HOLD_ENABLE)
+  if (h->mode == 1) {
+    u->z_ctrlModReq = SPD_MODE;
+    u->r_inpTgt     = h->inpTgt[i];
+  }
+#else
+  (void)u;
+#endif
+}
+#endif
+
+static double gauss(void) {
+  double u1 = (rand() + 1.0) / (RAND_MAX + 2.0), u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static int16_t adcCurrent(double i) {   // bldc.c: cur = offset - adc, A2BIT_CONV bits per A
+  return (int16_t)CLAMP(lround(i * A2BIT_CONV + (noise > 0 ? noise * gauss() : 0)), -2048, 2047);
+}
+
+// bldc.c dtCompApply and pwmApply (PWM_ZSEQ_MID): timer compare values of the controller outputs rtY.DC_pha*,
+// cur = phase currents [ADC bits], noShunt = the phase without a current shunt
+static void pwmCcr(const int16_t DC[3], const int16_t cur[3], int16_t margin, int noShunt, uint16_t ccr[3]) {
+  const int    res  = SYSCLK_HZ / 2 / PWM_FREQ;           // bldc.c pwm_res
+  const int    dc   = 2 * 1000 * res / PWM_RES_BASE;      // bldc.c PWM_DUTY, +-1000 = full duty
+  const int    band = DT_COMP_BAND * A2BIT_CONV / 1000;  // bldc.c DT_COMP_BITS
+  int d[3], top[3], low = res, over = -res, shift = 0;
+  for (int k = 0; k < 3; k++) {
+    d[k]   = DC[k] * dc / 2000 + (ctrlTyp == FOC_CTRL ? dtComp * CLAMP(cur[k], -band, band) / band : 0) + res / 2;
+    top[k] = k == noShunt ? res : res - margin;
+    low    = MIN(low, d[k]);
+    over   = MAX(over, d[k] - top[k]);
+  }
+  if (over > 0)     shift = -MIN(over, MAX(low, 0));
+  else if (low < 0) shift = MIN(-low, -over);
+  for (int k = 0; k < 3; k++) ccr[k] = (uint16_t)CLAMP(d[k] + shift, 0, top[k]);
+}
+
+// Field weakening map calibration (-w). Steady state of the motor model in d/q: Vd = R id - we L iq, Vq = R iq + we L id + Ke w.
+// For each speed and input target (the q axis current target, input / 1000 * i_max) the smallest d axis current that keeps
+// the voltage vector FW_MAP_RESERVE below the FOC limit, FOC_VOLT_MAX of the phase peak voltage Vbat / sqrt(3), up to fi_weak_max.
+// The battery voltage is FIELD_WEAK_MAP_VBAT, the firmware scales the speed to it. Paste the output into rtConstP in
+// Src/BLDC_controller_data.c
+#define FW_MAP_RESERVE  0.05            // [-] voltage left to the current controllers
+static void printFieldWeakMap(void) {
+  double vMax = FIELD_WEAK_MAP_VBAT / 100.0 / sqrt(3.0) * focVoltMax / 1000.0 * (1.0 - FW_MAP_RESERVE);
+  printf("  /* r_fieldWeakMap_Table, host/sil -w: R %g, L %g, Ke %g, i_max %d, fi_weak_max %d\n   */\n  {", plant.R, plant.L, plant.Ke, iMotMax, fwMax);
+  for (int r = 0; r < FW_MAP_R; r++) {
+    double iq = MIN(r << FW_MAP_R_SHIFT >> 4, 1000) / 1000.0 * iMotMax;
+    for (int n = 0; n < FW_MAP_N; n++) {
+      double w = (n << FW_MAP_N_SHIFT >> 4) * 2.0 * M_PI / 60.0, we = POLE_PAIRS * w, id = 0.0;
+      for (; id < fwMax; id += 0.01) {                    // d axis current magnitude, the map value is applied as -id
+        double vd = -plant.R * id - we * plant.L * iq, vq = plant.R * iq - we * plant.L * id + plant.Ke * w;
+        if (vd * vd + vq * vq <= vMax * vMax) break;
+      }
+      printf("%s%ld", n == 0 ? (r == 0 ? " " : ",\n    ") : (n % 13 == 0 ? ",\n    " : ", "), lround(MIN(id, fwMax) * A2BIT_CONV * 16));
+    }
+  }
+  printf(" },\n");
+}
+
+static int sigIndex(const char *name) {
+  if (!strcmp(name, "load")) return SIG_N;                // both loads
+  if (!strcmp(name, "lock")) return SIG_N + 1;            // both locks
+  if (!strcmp(name, "slope")) return SIG_N + 2;           // both slopes
+  for (int k = 0; k < SIG_N; k++) if (!strcmp(name, sigNames[k])) return k;
+  fprintf(stderr, "unknown signal %s\n", name);
+  exit(1);
+}
+
+static void addEvent(double t0, double t1, const char *name, double v0, double v1) {
+  int k = sigIndex(name);
+  int n = k >= SIG_N ? 2 : 1;
+  for (int j = 0; j < n; j++) {
+    if (nEvents == MAX_EVENTS) { fprintf(stderr, "too many events\n"); exit(1); }
+    uint8_t s = k == SIG_N ? SIG_LOADL + j : (k == SIG_N + 1 ? SIG_LOCKL + j : (k == SIG_N + 2 ? SIG_SLOPEL + j : k));
+    events[nEvents++] = (SimEvent){t0, t1, v0, v1, s};
+  }
+}
+
+static SimMeasure measureInit(double t0, double t1) {
+  return (SimMeasure){.t0 = t0, .t1 = t1, .tMin = 1e9, .tMax = -1e9, .wMin = 1e9, .wMax = -1e9};
+}
+
+/* One plant step of a measure window at t: power in and out [W], motor models, error or chopping of the step.
+ * Returns 1 if t is in the window */
+static int measureStep(SimMeasure *ms, double t, double pIn, double pOut, const SimMotor *mL, const SimMotor *mR, int err) {
+  if (t < ms->t0 || t >= ms->t1) return 0;
+  double T = 0.5 * (mL->T - mR->T);                     // vehicle torque per wheel, the right motor is mirrored
+  ms->eIn  += pIn  / PWM_FREQ;
+  ms->eOut += pOut / PWM_FREQ;
+  ms->eAbs += fabs(mL->T * mL->w) / PWM_FREQ + fabs(mR->T * mR->w) / PWM_FREQ;
+  ms->tSum += T; ms->tSq += T * T; ms->n++;
+  ms->tMin  = MIN(ms->tMin, T); ms->tMax = MAX(ms->tMax, T);
+  ms->wSum += 0.5 * (mL->w - mR->w);
+  ms->wMin  = MIN(ms->wMin, mL->w); ms->wMax = MAX(ms->wMax, mL->w);
+  ms->nErr += err != 0;
+  return 1;
+}
+
+/* Value of a cost term over its window */
+static double costTerm(const SimCost *c) {
+  const SimMeasure *ms = &c->m;
+  if (ms->n == 0) return 0;
+  if (c->term == COST_LOSS)   return ms->eAbs > 0 ? 100 * (ms->eIn - ms->eOut) / ms->eAbs : 0;
+  if (c->term == COST_ERROR)  return 100.0 * ms->nErr / ms->n;
+  if (c->term == COST_SPEED)  return ms->wSum / ms->n * 60 / (2 * M_PI);
+  if (c->term == COST_RIPPLE) {
+    double mean = ms->tSum / ms->n;
+    return sqrt(MAX(0.0, ms->tSq / ms->n - mean * mean));
+  }
+  // Speed step: end value, overshoot beyond it and the last sample outside its 2 % band
+  double end = 0, peak = 0, step;
+  uint32_t q = c->nv - c->nv / 4, last = 0;
+  for (uint32_t k = q; k < c->nv; k++) end += c->v[k];
+  end /= c->nv - q;
+  step = end - c->v[0];
+  if (fabs(step) < 1.0) return 0;                       // [rad/s] no step
+  for (uint32_t k = 0; k < c->nv; k++) {
+    peak = MAX(peak, (c->v[k] - end) / step);           // beyond the end value in the step direction
+    if (fabs(c->v[k] - end) > 0.02 * fabs(step)) last = k + 1;
+  }
+  return c->term == COST_OVERSHOOT ? 100 * peak : 1000.0 * last / PWM_FREQ;
+}
+
+static void loadScenario(const char *file) {
+  FILE *f = fopen(file, "r");
+  if (!f) { perror(file); exit(1); }
+  char line[256], a[32], b[32];
+  double t0, t1, v0, v1;
+  int ln = 0;
+  while (fgets(line, sizeof(line), f)) {
+    ln++;
+    char *c = strchr(line, '#');
+    if (c) *c = 0;
+    if (sscanf(line, " %31s", a) != 1) continue;
+    if (!strcmp(a, "set") && sscanf(line, " set %31s %lf", b, &v0) == 2 && simSet(b, v0)) continue;
+    if (!strcmp(a, "param") && sscanf(line, " param %31s %lf", b, &v0) == 2 && simParam(b, v0)) continue;
+    if (!strcmp(a, "at") && sscanf(line, " at %lf %31s %lf", &t0, b, &v0) == 3) { addEvent(t0, t0, b, v0, v0); continue; }
+    if (!strcmp(a, "ramp") && sscanf(line, " ramp %lf %lf %31s %lf %lf", &t0, &t1, b, &v0, &v1) == 5) { addEvent(t0, t1, b, v0, v1); continue; }
+    if (!strcmp(a, "measure") && sscanf(line, " measure %lf %lf", &t0, &t1) == 2 && nMeas < MAX_MEASURE) {
+      meas[nMeas++] = measureInit(t0, t1);
+      continue;
+    }
+    if (!strcmp(a, "cost") && sscanf(line, " cost %31s %lf %lf %lf", b, &t0, &t1, &v0) == 4 && nCosts < MAX_COST) {
+      int k = 0;
+      while (k < COST_N && strcmp(b, costNames[k])) k++;
+      if (k < COST_N) {
+        costs[nCosts++] = (SimCost){measureInit(t0, t1), v0, (uint8_t)k};
+        continue;
+      }
+    }
+    fprintf(stderr, "%s:%i: cannot parse: %s", file, ln, line);
+    exit(1);
+  }
+  fclose(f);
+}
+
+static void updateSignals(double t) {
+  for (uint32_t k = 0; k < nEvents; k++) {
+    const SimEvent *ev = &events[k];
+    if (t < ev->t0) continue;
+    if (t >= ev->t1 || ev->t1 <= ev->t0) sig[ev->sig] = ev->v1;
+    else sig[ev->sig] = ev->v0 + (ev->v1 - ev->v0) * (t - ev->t0) / (ev->t1 - ev->t0);
+  }
+}
+
+// Dump files (-r): every "# bbox" header of $BBOX and every "F" record line of $FLOG starts a dump, lines of
+// 2 x BBOX_COLS numbers are its samples, all other lines are ignored
+static uint32_t loadDumps(const char *file, BboxDump **dumps) {
+  FILE *f = fopen(file, "r");
+  if (!f) { perror(file); exit(1); }
+  char line[512];
+  uint32_t nd = 0;
+  int ln = 0;
+  *dumps = NULL;
+  while (fgets(line, sizeof(line), f)) {
+    ln++;
+    const char *h = strstr(line, "# bbox samples:");
+    if (h || line[0] == 'F') {
+      *dumps = realloc(*dumps, (nd + 1) * sizeof(BboxDump));
+      BboxDump *d = &(*dumps)[nd++];
+      *d = (BboxDump){.decim = 1, .line = ln};
+      const char *dc = h ? strstr(h, "decim:") : NULL;
+      if (dc) d->decim = MAX(1, atoi(dc + 6));
+      continue;
+    }
+    int16_t v[2 * BBOX_COLS + 1];
+    int n = 0;
+    char *p = line, *e;
+    while (n < 2 * BBOX_COLS + 1) {
+      long x = strtol(p, &e, 10);
+      if (e == p) break;
+      v[n++] = (int16_t)x;
+      p = e;
+    }
+    while (*p == ' ' || *p == '\r' || *p == '\n') p++;
+    if (nd == 0 || *p || n < 2 * BBOX_COLS - 2) continue;
+    if (n != 2 * BBOX_COLS) {
+      fprintf(stderr, "%s:%i: %i values, the dump needs the cmdL / cmdR columns of a newer firmware\n", file, ln, n);
+      exit(1);
+    }
+    BboxDump *d = &(*dumps)[nd - 1];
+    if (d->n == d->cap) {
+      d->cap = d->cap ? 2 * d->cap : 512;
+      d->s   = realloc(d->s, d->cap * sizeof(BboxSample));
+    }
+    memcpy(d->s[d->n].v[0], v, BBOX_COLS * sizeof(int16_t));
+    memcpy(d->s[d->n].v[1], v + BBOX_COLS, BBOX_COLS * sizeof(int16_t));
+    d->n++;
+  }
+  fclose(f);
+  return nd;
+}
+
+// One controller step with the inputs of a black box sample of one motor
+static void replayStep(RT_MODEL *m, ExtU *u, const int16_t *v) {
+  u->b_motEna     = (v[8] & BBOX_ENA) != 0;
+  u->z_ctrlModReq = (uint8_t)((v[8] >> BBOX_MODE_SHIFT) & 3);
+  u->r_inpTgt     = v[9];
+  u->b_hallA      =  v[7]       & 1;
+  u->b_hallB      = (v[7] >> 1) & 1;
+  u->b_hallC      = (v[7] >> 2) & 1;
+  u->i_phaAB      = v[0];
+  u->i_phaBC      = v[1];
+  u->i_DCLink     = v[2];
+  BLDC_controller_step(m);
+}
+
+static int replay(const char *file, FILE *fo, uint32_t skip, int tol) {
+  BboxDump *dumps;
+  uint32_t nd = loadDumps(file, &dumps);
+  const P pInit = rtP_Left;                               // simInit rescales rtP_Left in place
+  int fail = 0;
+
+  fprintf(fo, "dump,k,t,cmdL,dutyAL,dutyBL,dutyCL,recAL,recBL,recCL,nL,recNL,errL,recErrL,"
+              "cmdR,dutyAR,dutyBR,dutyCR,recAR,recBR,recCR,nR,recNR,errR,recErrR\n");
+  for (uint32_t j = 0; j < nd; j++) {
+    const BboxDump *d = &dumps[j];
+    int dMax[2] = {0, 0}, nMax[2] = {0, 0};
+    uint32_t over = 0, errDiff = 0;
+    int32_t first = -1;
+
+    rtP_Left = pInit;
+    memset(&rtDW_Left, 0, sizeof(DW));  memset(&rtDW_Right, 0, sizeof(DW));
+    memset(&rtU_Left, 0, sizeof(ExtU)); memset(&rtU_Right, 0, sizeof(ExtU));
+    memset(&rtY_Left, 0, sizeof(ExtY)); memset(&rtY_Right, 0, sizeof(ExtY));
+    simInit();
+    if (d->decim > 1) fprintf(stderr, "dump %u: decim %i, inputs held between the samples, outputs approximate\n", j, d->decim);
+
+    for (uint32_t k = 0; k < d->n; k++) {
+      const BboxSample *b = &d->s[k];
+      for (int r = 0; r < d->decim; r++) {
+        replayStep(rtM_Left,  &rtU_Left,  b->v[0]);
+        replayStep(rtM_Right, &rtU_Right, b->v[1]);
+      }
+      const ExtY *y[2] = {&rtY_Left, &rtY_Right};
+      int diff = 0, err = 0;
+      for (int m = 0; m < 2; m++) {
+        const int16_t *v = b->v[m];
+        int dd = MAX(abs(y[m]->DC_phaA - v[3]), MAX(abs(y[m]->DC_phaB - v[4]), abs(y[m]->DC_phaC - v[5])));
+        diff   = MAX(diff, dd);
+        err   |= (y[m]->z_errCode ^ v[8]) & BBOX_CTRL_ERR;
+        if (k >= skip) {
+          dMax[m] = MAX(dMax[m], dd);
+          nMax[m] = MAX(nMax[m], abs(y[m]->n_mot - v[6]));
+        }
+      }
+      if (k >= skip && (diff > tol || err)) {
+        if (first < 0) first = (int32_t)k;
+        over    += diff > tol;
+        errDiff += err != 0;
+      }
+      fprintf(fo, "%u,%u,%.5f", j, k, (double)k * d->decim / PWM_FREQ);
+      for (int m = 0; m < 2; m++) {
+        const int16_t *v = b->v[m];
+        fprintf(fo, ",%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i", v[9], y[m]->DC_phaA, y[m]->DC_phaB, y[m]->DC_phaC,
+          v[3], v[4], v[5], y[m]->n_mot, v[6], y[m]->z_errCode, v[8] & BBOX_ERR);
+      }
+      fprintf(fo, "\n");
+    }
+    fprintf(stderr, "dump %u (line %i): %u samples, duty diff max L:%i R:%i, n_mot diff max L:%i R:%i, "
+      "over tol:%u errCode diff:%u first:%i\n", j, d->line, d->n, dMax[0], dMax[1], nMax[0], nMax[1], over, errDiff, first);
+    fail |= over > 0 || errDiff > 0;
+    free(d->s);
+  }
+  free(dumps);
+  if (nd == 0) fprintf(stderr, "%s: no black box dump found\n", file);
+  return fail || nd == 0;
+}
+
+int main(int argc, char **argv) {
+  const char *out = NULL, *scenario = NULL, *dumpIn = NULL, *dumpOut = NULL;
+  int    fwMap = 0, tol = 0;
+  uint32_t skip = 0;
+  double pv[32];
+  char   pn[32][32];
+  int    np = 0;
+
+  for (int k = 1; k < argc; k++) {
+    if (!strcmp(argv[k], "-p") && k + 1 < argc) {
+      if (np < 32 && sscanf(argv[++k], "%31[^=]=%lf", pn[np], &pv[np]) == 2) np++;
+    } else if (!strcmp(argv[k], "-o") && k + 1 < argc) {
+      out = argv[++k];
+    } else if (!strcmp(argv[k], "-w")) {
+      fwMap = 1;
+    } else if (!strcmp(argv[k], "-r") && k + 1 < argc) {
+      dumpIn = argv[++k];
+    } else if (!strcmp(argv[k], "-b") && k + 1 < argc) {
+      dumpOut = argv[++k];
+    } else if (!strcmp(argv[k], "-s") && k + 1 < argc) {
+      skip = (uint32_t)atol(argv[++k]);
+    } else if (!strcmp(argv[k], "-t") && k + 1 < argc) {
+      tol = atoi(argv[++k]);
+    } else {
+      scenario = argv[k];
+    }
+  }
+  if (!scenario && !dumpIn) {
+    fprintf(stderr, "usage: %s [-p name=value]... [-o trace.csv] [-w] [-b dump.txt] scenario\n"
+                    "       %s [-p name=value]... [-o diff.csv] [-s skip] [-t tol] -r dump.txt [scenario]\n", argv[0], argv[0]);
+    return 1;
+  }
+  if (scenario) loadScenario(scenario);
+  for (int k = 0; k < np; k++) {
+    if (!simParam(pn[k], pv[k])) { fprintf(stderr, "unknown parameter %s\n", pn[k]); return 1; }
+  }
+  if (fwMap) {
+    printFieldWeakMap();
+    return 0;
+  }
+  FILE *fo = out ? fopen(out, "w") : stdout;
+  if (!fo) { perror(out); return 1; }
+  if (dumpIn) {
+    int ret = replay(dumpIn, fo, skip, tol);
+    if (out) fclose(fo);
+    return ret;
+  }
+  FILE *fb = dumpOut ? fopen(dumpOut, "w") : NULL;
+  if (dumpOut && !fb) { perror(dumpOut); return 1; }
+
+  simInit();
+  int16_t inMax = fwEna ? MAX(1000, fwHi) : 1000;       // util.c Input_Lim_Init
+  int16_t inMin = -inMax;
+  int16_t margin = ctrlTyp == FOC_CTRL ? 110 : 0;        // bldc.c pwm_margin
+  int16_t curDC_max = iDCMax * A2BIT_CONV;
+
+  SimMotor mL = {0}, mR = {0};
+  uint16_t ccrL[3] = {0}, ccrR[3] = {0};
+#if defined(ANGLE_OBSERVER)
+  Observer obsL, obsR;                                    // bldc.c obs[]
+  uint16_t obsAng;
+  uint32_t obsTicks = 0;
+  obsInit(&obsL);
+  obsInit(&obsR);
+#endif
+#if defined(HALL_CALIB)
+  HallCal hcL = {0}, hcR = {0};                           // bldc.c hallCal[]
+  uint8_t hcRun = 0;
+#endif
+#if defined(MOTOR_IDENT)
+  MotId   miL = {0}, miR = {0};                           // bldc.c motId[]
+  uint8_t miRun = 0;
+#endif
+#if defined(COGGING_COMP)
+  static Cogging cgL, cgR;                                // bldc.c cogging[]
+  uint8_t cgRun = 0;
+#endif
+  int16_t pwml = 0, pwmr = 0, cmdL = 0, cmdR = 0;
+#if defined(POS_CTRL) || defined(STANDSTILL_HOLD_ENABLE)
+  int32_t odoL = 0, odoR = 0;                             // bldc.c odo[]
+  uint8_t odoPrevL = 6, odoPrevR = 6;
+#endif
+#if defined(POS_CTRL)
+  PosCtrl pcL, pcR;                                       // bldc.c posCtrl[], posCtrlTick
+  int32_t posPeak[2] = {0};
+  uint8_t posDiv = 0;
+  int16_t posInpTgt[2] = {0};
+#endif
+#if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+  SimHold hold = {0};
+  int32_t holdDrift[2] = {0};
+#endif
+#if defined(SPD_REF_GEN)
+  RefGen  steerRef = {0}, speedRef = {0};                 // main.c spdRefUpdate
+  int16_t spdFfAcc[2] = {0};
+  int32_t spdFfKv = 0;
+#endif
+  double  Vdc = Vbat;
+  uint32_t nSteps = (uint32_t)(tEnd * PWM_FREQ), loopTicks = DELAY_IN_MAIN_LOOP * PWM_FREQ / 1000;
+  uint32_t traceTicks = MAX(1, (uint32_t)lround(tTrace * PWM_FREQ));
+
+  fprintf(fo, "t,speed,steer,pwml,pwmr,rpmL,rpmR,n_motL,n_motR,iqL,idL,iqR,idR,torqueL,torqueR,iaL,iaR,vdc,idc,pIn,pOut,errL,errR,chopL,chopR\n");
+  if (fb) fprintf(fb, "# bbox samples:%u trig:-1 time:0 decim:1\r\n", nSteps);
+  for (uint32_t k = 0; k < nSteps; k++) {
+    double t = (double)k / PWM_FREQ;
+    updateSignals(t);
+
+    if (k % loopTicks == 0) {                             // main loop: mixer and output mapping of main.c
+      int16_t speed = (int16_t)sig[SIG_SPEED], steer = (int16_t)sig[SIG_STEER];
+#if defined(SPD_REF_GEN)
+      int32_t nMax = MAX(rtP_Left.n_max >> 4, 10), cV = (int32_t)lround(Vdc * 100);
+      spdFfKv = (int32_t)((int64_t)nMax * rtP_Left.n_polePairs * OBS_FLUX * 6283 * 4096 / (300000000LL * cV));
+      if (sig[SIG_MODE] != SPD_MODE) {
+        steerRef.y = (int32_t)steer << 16;
+        speedRef.y = (int32_t)speed << 16;
+        steerRef.a = speedRef.a = 0;
+        spdFfAcc[0] = spdFfAcc[1] = 0;
+      } else {
+        int32_t acc  = (int32_t)CLAMP((int64_t)SPD_REF_ACC * 65536 * DELAY_IN_MAIN_LOOP / nMax, 1, 1 << 24);
+        int32_t jerk = (int32_t)CLAMP((int64_t)SPD_REF_JERK * 65536 * DELAY_IN_MAIN_LOOP * DELAY_IN_MAIN_LOOP / (1000 * nMax), 1, acc);
+        refGenStep(steer, acc, jerk, &steerRef);
+        refGenStep(speed, acc, jerk, &speedRef);
+        steer = (int16_t)(steerRef.y >> 16);
+        speed = (int16_t)(speedRef.y >> 16);
+        int32_t accR = (int32_t)(((int64_t)speedRef.a * SPEED_COEFFICIENT - (int64_t)steerRef.a * STEER_COEFFICIENT) >> 14);
+        int32_t accL = (int32_t)(((int64_t)speedRef.a * SPEED_COEFFICIENT + (int64_t)steerRef.a * STEER_COEFFICIENT) >> 14);
+        accL = (int32_t)((int64_t)accL * nMax * SPD_FF_ACC * OBS_R / (20480LL * DELAY_IN_MAIN_LOOP * cV));
+        accR = (int32_t)((int64_t)accR * nMax * SPD_FF_ACC * OBS_R / (20480LL * DELAY_IN_MAIN_LOOP * cV));
+        spdFfAcc[0] = (int16_t)CLAMP(accL, -4000, 4000);
+        spdFfAcc[1] = (int16_t)-CLAMP(accR, -4000, 4000);
+      }
+#endif
+      mixerFcn(speed << 4, steer << 4, &cmdR, &cmdL, inMin, inMax);
+      pwmr = -cmdR;
+      pwml = cmdL;
+      rtP_Left.r_fieldWeakMapSca = rtP_Right.r_fieldWeakMapSca =  // main.c taskMonitor
+        (uint16_t)CLAMP(lround(FIELD_WEAK_MAP_VBAT * 4096.0 / (Vdc * 100)), 2048, 8192);
+    }
+
+    // bldc_control: measured currents, chopping and controller inputs
+    uint8_t enable    = sig[SIG_ENABLE] != 0;
+    uint8_t enableFin = enable && !rtY_Left.z_errCode && !rtY_Right.z_errCode;
+    int16_t curL_DC   = adcCurrent(mL.iDC), curR_DC = adcCurrent(mR.iDC);
+    uint8_t chopL     = abs(curL_DC) > curDC_max, chopR = abs(curR_DC) > curDC_max;
+#if defined(POS_CTRL) || defined(STANDSTILL_HOLD_ENABLE)
+    odoStep(&odoL, &odoPrevL, mL.hall);
+    odoStep(&odoR, &odoPrevR, mR.hall);
+#endif
+#if defined(POS_CTRL)
+    if (sig[SIG_MODE] != POS_MODE || !enableFin) {
+      posCtrlReset(&pcL, rtY_Left.n_mot);
+      posCtrlReset(&pcR, rtY_Right.n_mot);
+      posDiv = 0;
+    } else {
+      if (posDiv == 0) {
+        posInpTgt[0] = posCtrlStep(&pcL, (int32_t)sig[SIG_POSL], odoL, rtP_Left.n_max, rtP_Left.n_polePairs);
+        posInpTgt[1] = posCtrlStep(&pcR, (int32_t)sig[SIG_POSR], odoR, rtP_Right.n_max, rtP_Right.n_polePairs);
+      }
+      posDiv = (posDiv == POS_CTRL_DIV - 1) ? 0 : posDiv + 1;
+      pwml   = posInpTgt[0];                              // traced as pwml / pwmr
+      pwmr   = posInpTgt[1];
+      posPeak[0] = MAX(posPeak[0], abs(rtY_Left.n_mot));
+      posPeak[1] = MAX(posPeak[1], abs(rtY_Right.n_mot));
+    }
+#endif
+#if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+    {
+      uint8_t req = (enableFin && sig[SIG_MODE] != POS_MODE) ? (uint8_t)sig[SIG_HOLD] : 0;
+      int32_t odoLR[2];
+  #if defined(STANDSTILL_HOLD_ENABLE)
+      odoLR[0] = odoL;
+      odoLR[1] = odoR;
+  #else
+      odoLR[0] = odoLR[1] = 0;
+  #endif
+      holdTick(&hold, req, odoLR);
+      if (hold.mode == 1) {
+        holdDrift[0] = MAX(holdDrift[0], abs(odoLR[0] - hold.pos[0]));
+        holdDrift[1] = MAX(holdDrift[1], abs(odoLR[1] - hold.pos[1]));
+      }
+    }
+#endif
+
+    rtU_Left.b_motEna      = enableFin;
+    rtU_Left.z_ctrlModReq  = (uint8_t)sig[SIG_MODE];
+    rtU_Left.r_inpTgt      = pwml;
+    rtU_Left.b_hallA       =  mL.hall       & 1;
+    rtU_Left.b_hallB       = (mL.hall >> 1) & 1;
+    rtU_Left.b_hallC       =  mL.hall >> 2;
+    rtU_Left.i_phaAB       = adcCurrent(mL.i[0]);
+    rtU_Left.i_phaBC       = adcCurrent(mL.i[1]);
+    rtU_Left.i_DCLink      = curL_DC;
+#if defined(POS_CTRL)
+    if (sig[SIG_MODE] == POS_MODE) {
+      rtU_Left.z_ctrlModReq = SPD_MODE;
+      rtU_Left.r_inpTgt     = posInpTgt[0];
+    }
+#endif
+#if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+    holdInput(&hold, 0, &rtP_Left, &rtU_Left);
+#endif
+#if defined(MOTOR_IDENT)
+    if (sig[SIG_MOTORID] > 0.5 && !miRun) {                // bldc.c motIdMotor, comms.c process_motid
+      motIdStart(&miL);
+      motIdStart(&miR);
+      miRun = 1;
+    }
+    if (sig[SIG_MOTORID] < 0.5) miRun = 0;
+    motIdInput(&miL, &rtU_Left.z_ctrlModReq, &rtU_Left.r_inpTgt);
+#endif
+#if defined(COGGING_COMP)
+    if (sig[SIG_COGCAL] > 0.5 && !cgRun) {                 // bldc.c cogMotorInput, comms.c process_cogcal
+      cogStart(&cgL);
+      cogStart(&cgR);
+      cgRun = 1;
+    }
+    if (sig[SIG_COGCAL] < 0.5) cgRun = 0;
+    if (rtU_Left.z_ctrlModReq == TRQ_MODE) rtU_Left.r_inpTgt += cogComp(&cgL, rtY_Left.a_elecAngle, rtY_Left.n_mot);
+    cogInput(&cgL, rtP_Left.n_max, &rtU_Left.z_ctrlModReq, &rtU_Left.r_inpTgt);
+#endif
+#if defined(SPD_REF_GEN)
+    rtU_Left.Vq_ff         = (int16_t)CLAMP(((rtU_Left.r_inpTgt * spdFfKv) >> 8) + spdFfAcc[0], -16000, 16000);  // bldc.c spdFf
+#endif
+#if defined(ANGLE_OBSERVER)
+    if (chopL || !enable) {
+      obsReset(&obsL);
+    } else {
+      const int16_t iL[3] = {rtU_Left.i_phaAB, rtU_Left.i_phaBC, -rtU_Left.i_phaAB - rtU_Left.i_phaBC};
+      obsStep(&obsL, iL, ccrL, (int16_t)lround(Vdc * 100));
+    }
+    rtP_Left.b_angleMeasEna = obsAngle(&obsL, rtY_Left.a_elecAngle, rtY_Left.n_mot, &obsAng);
+    rtU_Left.a_mechAngle    = (int16_t)((((obsAng * 5760) >> 16) + 480) / rtP_Left.n_polePairs);
+    obsTicks               += rtP_Left.b_angleMeasEna;
+#endif
+    BLDC_controller_step(rtM_Left);
+
+    rtU_Right.b_motEna     = enableFin;
+    rtU_Right.z_ctrlModReq = (uint8_t)sig[SIG_MODE];
+    rtU_Right.r_inpTgt     = pwmr;
+    rtU_Right.b_hallA      =  mR.hall       & 1;
+    rtU_Right.b_hallB      = (mR.hall >> 1) & 1;
+    rtU_Right.b_hallC      =  mR.hall >> 2;
+    rtU_Right.i_phaAB      = adcCurrent(mR.i[1]);
+    rtU_Right.i_phaBC      = adcCurrent(mR.i[2]);
+    rtU_Right.i_DCLink     = curR_DC;
+#if defined(POS_CTRL)
+    if (sig[SIG_MODE] == POS_MODE) {
+      rtU_Right.z_ctrlModReq = SPD_MODE;
+      rtU_Right.r_inpTgt     = posInpTgt[1];
+    }
+#endif
+#if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+    holdInput(&hold, 1, &rtP_Right, &rtU_Right);
+#endif
+#if defined(MOTOR_IDENT)
+    motIdInput(&miR, &rtU_Right.z_ctrlModReq, &rtU_Right.r_inpTgt);
+#endif
+#if defined(COGGING_COMP)
+    if (rtU_Right.z_ctrlModReq == TRQ_MODE) rtU_Right.r_inpTgt += cogComp(&cgR, rtY_Right.a_elecAngle, rtY_Right.n_mot);
+    cogInput(&cgR, rtP_Right.n_max, &rtU_Right.z_ctrlModReq, &rtU_Right.r_inpTgt);
+#endif
+#if defined(SPD_REF_GEN)
+    rtU_Right.Vq_ff        = (int16_t)CLAMP(((rtU_Right.r_inpTgt * spdFfKv) >> 8) + spdFfAcc[1], -16000, 16000);
+#endif
+#if defined(ANGLE_OBSERVER)
+    if (chopR || !enable) {
+      obsReset(&obsR);
+    } else {
+      const int16_t iR[3] = {-rtU_Right.i_phaAB - rtU_Right.i_phaBC, rtU_Right.i_phaAB, rtU_Right.i_phaBC};
+      obsStep(&obsR, iR, ccrR, (int16_t)lround(Vdc * 100));
+    }
+    rtP_Right.b_angleMeasEna = obsAngle(&obsR, rtY_Right.a_elecAngle, rtY_Right.n_mot, &obsAng);
+    rtU_Right.a_mechAngle    = (int16_t)((((obsAng * 5760) >> 16) + 480) / rtP_Right.n_polePairs);
+#endif
+    BLDC_controller_step(rtM_Right);
+
+    if (fb) {                                             // bldc.c blackboxRecord, every step
+      const ExtU *u[2] = {&rtU_Left, &rtU_Right};
+      const ExtY *y[2] = {&rtY_Left, &rtY_Right};
+      const uint8_t chop[2] = {chopL && enable, chopR && enable};
+      for (int m = 0; m < 2; m++) {
+        fprintf(fb, "%i %i %i %i %i %i %i %i %i %i%s", u[m]->i_phaAB, u[m]->i_phaBC, u[m]->i_DCLink,
+          y[m]->DC_phaA, y[m]->DC_phaB, y[m]->DC_phaC, y[m]->n_mot, u[m]->b_hallA | u[m]->b_hallB << 1 | u[m]->b_hallC << 2,
+          y[m]->z_errCode | u[m]->z_ctrlModReq << BBOX_MODE_SHIFT | (u[m]->b_motEna ? BBOX_ENA : 0) | (chop[m] ? BBOX_CHOP : 0),
+          u[m]->r_inpTgt, m ? "\r\n" : " ");
+      }
+    }
+
+    // The new duty cycles are applied for the next PWM period
+    int16_t dcL[3] = {rtY_Left.DC_phaA,  rtY_Left.DC_phaB,  rtY_Left.DC_phaC};
+    int16_t dcR[3] = {rtY_Right.DC_phaA, rtY_Right.DC_phaB, rtY_Right.DC_phaC};
+#if defined(HALL_CALIB)
+    if (sig[SIG_HALLCAL] > 0.5 && !hcRun) {                // bldc.c hallCalMotor, comms.c process_hallcal
+      hallCalStart(&hcL, mL.hall, rtP_Left.n_polePairs);
+      hallCalStart(&hcR, mR.hall, rtP_Right.n_polePairs);
+      hcRun = 1;
+    }
+    if (sig[SIG_HALLCAL] < 0.5) hcRun = 0;
+    hallCalStep(&hcL, mL.hall, dcL);
+    hallCalStep(&hcR, mR.hall, dcR);
+    HallCal *hc[2] = {&hcL, &hcR};
+    P       *hp[2] = {&rtP_Left, &rtP_Right};
+    for (int j = 0; j < 2; j++) {
+      if (hc[j]->state == HALL_CAL_DONE) {
+        fprintf(stderr, "hallcal %c at %.2f s:", j ? 'R' : 'L', t);
+        for (int e = 0; e < 6; e++) {
+          hp[j]->a_hallCorr[e] = hc[j]->corr[e];
+          fprintf(stderr, " %.1f", hc[j]->corr[e] / 64.0);
+        }
+        fprintf(stderr, " deg\n");
+      } else if (hc[j]->state == HALL_CAL_FAIL) {
+        fprintf(stderr, "hallcal %c at %.2f s: failed\n", j ? 'R' : 'L', t);
+      }
+      if (hc[j]->state >= HALL_CAL_DONE) hc[j]->state = HALL_CAL_IDLE;
+    }
+#endif
+    const int16_t curL[3] = {rtU_Left.i_phaAB, rtU_Left.i_phaBC, -rtU_Left.i_phaAB - rtU_Left.i_phaBC};
+    const int16_t curR[3] = {-rtU_Right.i_phaAB - rtU_Right.i_phaBC, rtU_Right.i_phaAB, rtU_Right.i_phaBC};
+#if defined(MOTOR_IDENT)
+    MotId *mi[2] = {&miL, &miR};
+    const ExtY *my[2] = {&rtY_Left, &rtY_Right};
+    P *mp[2] = {&rtP_Left, &rtP_Right};
+    for (int j = 0; j < 2; j++) {
+      motIdStep(mi[j], j ? curR : curL, (int16_t)lround(Vdc * 100), my[j]->a_elecAngle, my[j]->n_mot, j ? dcR : dcL);
+      if (mi[j]->state == MOT_ID_DONE && motIdResult(mi[j])) {
+        fprintf(stderr, "motorid %c at %.2f s: R %u mOhm, L %u uH, flux %u uV s (plant %.0f, %.0f, %.0f)\n", j ? 'R' : 'L', t,
+          mi[j]->r, mi[j]->l, mi[j]->flux, plant.R * 1e3, plant.L * 1e6, plant.Ke / POLE_PAIRS * 1e6);
+        if (MOTOR_IDENT_BW > 0) {                          // util.c motIdTune, at the simulated bus voltage
+          uint16_t kp, ki;
+          motIdGains(mi[j], (int16_t)lround(Vdc * 100), MOTOR_IDENT_BW, &kp, &ki);
+          fprintf(stderr, "motorid %c: current PI Kp %u -> %u, Ki %u -> %u\n", j ? 'R' : 'L', mp[j]->cf_iqKp, kp, mp[j]->cf_iqKi, ki);
+          mp[j]->cf_iqKp = mp[j]->cf_idKp = kp;
+          mp[j]->cf_iqKi = mp[j]->cf_idKi = ki;
+        }
+      }
+      if (mi[j]->state == MOT_ID_FAIL) {
+        fprintf(stderr, "motorid %c at %.2f s: failed in state %u\n", j ? 'R' : 'L', t, mi[j]->failState);
+      }
+      if (mi[j]->state >= MOT_ID_DONE) mi[j]->state = MOT_ID_IDLE;
+    }
+#endif
+#if defined(COGGING_COMP)
+    Cogging *cg[2] = {&cgL, &cgR};
+    const ExtY *cy[2] = {&rtY_Left, &rtY_Right};
+    for (int j = 0; j < 2; j++) {
+      cogStep(cg[j], cy[j]->a_elecAngle, cy[j]->n_mot, cy[j]->iq, j ? rtP_Right.i_max : rtP_Left.i_max);
+      if (cg[j]->state == COG_DONE) {
+        int lo = 0, hi = 0;
+        for (int b = 0; b < COG_BINS; b++) {
+          lo = MIN(lo, cg[j]->tab[b]);
+          hi = MAX(hi, cg[j]->tab[b]);
+        }
+        fprintf(stderr, "cogcal %c at %.2f s: table pp %i (plant %.0f)\n", j ? 'R' : 'L', t, hi - lo,
+          2 * plant.cog / (1.5 * plant.Ke * iMotMax) * 1000);
+      } else if (cg[j]->state == COG_FAIL) {
+        fprintf(stderr, "cogcal %c at %.2f s: failed\n", j ? 'R' : 'L', t);
+      }
+      if (cg[j]->state >= COG_DONE) cg[j]->state = COG_IDLE;
+    }
+#endif
+    pwmCcr(dcL, curL, margin, 2, ccrL);                   // shunts on U, V
+    pwmCcr(dcR, curR, margin, 0, ccrR);                   // shunts on V, W
+    plantStep(&plant, &mL, ccrL, !chopL && enable, Vdc, sig[SIG_LOADL], sig[SIG_SLOPEL], sig[SIG_LOCKL] != 0);
+    plantStep(&plant, &mR, ccrR, !chopR && enable, Vdc, sig[SIG_LOADR], -sig[SIG_SLOPER], sig[SIG_LOCKR] != 0);
+    double idc = mL.iDC + mR.iDC;
+    Vdc = Vbat - Rbat * idc;
+
+    double pIn = Vdc * idc, pOut = mL.T * mL.w + mR.T * mR.w;
+    int    err = rtY_Left.z_errCode || rtY_Right.z_errCode || chopL || chopR;
+    for (uint32_t j = 0; j < nMeas; j++) {
+      measureStep(&meas[j], t, pIn, pOut, &mL, &mR, err);
+    }
+    for (uint32_t j = 0; j < nCosts; j++) {
+      SimCost *c = &costs[j];
+      if (!measureStep(&c->m, t, pIn, pOut, &mL, &mR, err) || (c->term != COST_OVERSHOOT && c->term != COST_SETTLE)) continue;
+      if (c->nv == c->cap) {
+        c->cap = c->cap ? 2 * c->cap : PWM_FREQ;
+        c->v   = realloc(c->v, c->cap * sizeof(float));
+        if (!c->v) { fprintf(stderr, "out of memory\n"); return 1; }
+      }
+      c->v[c->nv++] = (float)(0.5 * (mL.w - mR.w));
+    }
+
+    if (k % traceTicks == 0) {
+      fprintf(fo, "%.5f,%i,%i,%i,%i,%.1f,%.1f,%i,%i,%i,%i,%i,%i,%.3f,%.3f,%.2f,%.2f,%.2f,%.2f,%.1f,%.1f,%i,%i,%i,%i\n",
+        t, (int)sig[SIG_SPEED], (int)sig[SIG_STEER], pwml, pwmr, mL.w * 60 / (2 * M_PI), mR.w * 60 / (2 * M_PI),
+        rtY_Left.n_mot, rtY_Right.n_mot, rtY_Left.iq, rtY_Left.id, rtY_Right.iq, rtY_Right.id,
+        mL.T, mR.T, mL.i[0], mR.i[0], Vdc, idc, pIn, pOut, rtY_Left.z_errCode, rtY_Right.z_errCode, chopL, chopR);
+    }
+  }
+
+#if defined(POS_CTRL)
+  fprintf(stderr, "posctrl L: target %i odometry %i peak %i rpm, R: target %i odometry %i peak %i rpm\n",
+    (int)sig[SIG_POSL], odoL, posPeak[0], (int)sig[SIG_POSR], odoR, posPeak[1]);
+#endif
+#if defined(CRUISE_CONTROL_SUPPORT) || defined(STANDSTILL_HOLD_ENABLE)
+  fprintf(stderr, "hold: largest standstill drift L %i R %i hall steps, last cruise target L %i R %i rpm\n",
+    holdDrift[0], holdDrift[1], hold.tgt[0], hold.tgt[1]);
+#endif
+  for (uint32_t j = 0; j < nMeas; j++) {
+    const SimMeasure *ms = &meas[j];
+    if (ms->n == 0) continue;
+    double mean = ms->tSum / ms->n, sd = sqrt(MAX(0.0, ms->tSq / ms->n - mean * mean));
+    fprintf(stderr, "measure %.3f-%.3f: rpm:%.1f rpmL_pp:%.2f torque:%.3f ripple_pp:%.3f ripple_rms:%.3f eIn:%.2f eOut:%.2f eff:%.3f\n",
+      ms->t0, ms->t1, ms->wSum / ms->n * 60 / (2 * M_PI), (ms->wMax - ms->wMin) * 60 / (2 * M_PI), mean, ms->tMax - ms->tMin, sd,
+      ms->eIn, ms->eOut, ms->eIn > 0 ? ms->eOut / ms->eIn : 0.0);
+  }
+  if (nCosts) {
+    double sum = 0, term[COST_N] = {0};
+    for (uint32_t j = 0; j < nCosts; j++) {
+      double v = costTerm(&costs[j]);
+      term[costs[j].term] += v;
+      sum += costs[j].w * v;
+      free(costs[j].v);
+    }
+    fprintf(stderr, "cost: %.6f loss:%.2f ripple:%.4f overshoot:%.2f settle:%.1f speed:%.1f error:%.2f\n", sum,
+      term[COST_LOSS], term[COST_RIPPLE], term[COST_OVERSHOOT], term[COST_SETTLE], term[COST_SPEED], term[COST_ERROR]);
+  }
+#if defined(ANGLE_OBSERVER)
+  fprintf(stderr, "observer: left angle fed to the controller %.1f%% of the steps, hall offset %.1f deg\n",
+    100.0 * obsTicks / nSteps, (obsL.offset >> 8) * 360.0 / 65536);
+#endif
+  if (fb) {
+    fprintf(fb, "# bbox end\r\n");
+    fclose(fb);
+  }
+  if (out) fclose(fo);
+  return 0;
+}
@@ -0,0 +1,354 @@
+/*
+* Golden vector regression test and micro-benchmark of the fixed-point helpers in Src/filters.c (make host-test)
+* The vectors are generated from a fixed seed and the outputs are compared with host/golden/filters.txt:
+* a hash over all outputs per function, plus the first cases written out in full to show where a change differs.
+* An optimised helper passes only if it is bit-exact with the original over the whole input set.
+*
+* usage: test_filters golden_file          check the outputs and print ns/call
+*        test_filters -g golden_file       write the golden file from the current implementation (make host-golden)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "defines.h"                    // pulls in Inc/config.h, a plain "config.h" here would find host/config.h
+#include "util.h"
+
+#define N_CASES         200000          // random cases per function
+#define N_LISTED        16              // cases written out in full in the golden file
+#define N_BENCH         20000000        // calls per function for the benchmark
+#define N_FUNCS         9
+
+int16_t INPUT_MAX;                      // defined in util.c in the firmware
+int16_t INPUT_MIN;
+
+typedef struct {
+  const char *name;
+  uint32_t hash, n;
+  char listed[N_LISTED][96];
+} Result;
+
+static uint32_t rngState;
+static uint32_t rnd(void) {             // xorshift32
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+static int32_t rndRange(int32_t lo, int32_t hi) { return lo + (int32_t)(rnd() % (uint32_t)(hi - lo + 1)); }
+
+static void record(Result *r, const int32_t *v, int nv, const char *line) {
+  for (int k = 0; k < nv; k++) {
+    uint32_t x = (uint32_t)v[k];
+    for (int b = 0; b < 4; b++) { r->hash = (r->hash ^ (x & 0xFF)) * 16777619U; x >>= 8; }
+  }
+  if (r->n < N_LISTED) snprintf(r->listed[r->n], sizeof(r->listed[0]), "%s", line);
+  r->n++;
+}
+
+// Edge values first, then random ones
+static const int32_t edge32[] = {0, 1, -1, 32767, -32768, 65535, -65536, 134217727, -134217728, 2147483647, -2147483647 - 1};
+static const int16_t edge16[] = {0, 1, -1, 2047, -2048, 16000, -16000, 32767, -32768};
+
+static void testLowPass(Result *r) {
+  char line[96];
+  rngState = 0x1234567;
+  for (uint32_t k = 0; k < N_CASES; k++) {
+    int32_t  u    = k < 121 ? edge32[k % 11] >> 4 : ((k & 1) ? rndRange(-32768, 32767) : rndRange(-134217728, 134217727));
+    int32_t  y    = k < 121 ? edge32[k / 11] : (int32_t)rnd();
+    uint16_t coef = (k % 7 == 0) ? ((k / 7) & 1 ? 65535 : 0) : (uint16_t)rnd();
+    int32_t  y0   = y;
+    filtLowPass32(u, coef, &y);
+    int32_t v[4] = {u, coef, y0, y};
+    snprintf(line, sizeof(line), "u:%i coef:%u y:%i -> %i", u, coef, y0, y);
+    record(r, v, 4, line);
+  }
+  int32_t y = 0;                        // filter run, as used for the battery voltage and speed
+  for (uint32_t k = 0; k < N_CASES; k++) {
+    int32_t u = (k / 1000) & 1 ? 4000 : rndRange(-2048, 2047);
+    filtLowPass32(u, (uint16_t)((k / 5000) * 977 + 1), &y);
+    record(r, &y, 1, "");
+  }
+}
+
+// Over the documented input range only, every output must also equal filtLowPass32
+static uint32_t fastErr;
+static void testLowPassFast(Result *r) {
+  static const int32_t edgeU[] = {0, 1, -1, 4095, 16383, -16383};
+  static const int32_t edgeY[] = {0, -1, 1073741823, -1073741824, 268369920, -268369920};
+  char line[96];
+  rngState = 0x1357913;
+  for (uint32_t k = 0; k < N_CASES; k++) {
+    int32_t  u    = k < 36 ? edgeU[k % 6] : rndRange(-16383, 16383);
+    int32_t  y    = k < 36 ? edgeY[k / 6] : ((k & 1) ? rndRange(-1073741824, 1073741823) : (u << 16) + rndRange(-65536, 65535));
+    uint16_t coef = (k % 7 == 0) ? ((k / 7) & 1 ? 65535 : 0) : (uint16_t)rnd();
+    int32_t  y0 = y, yRef = y;
+    filtLowPass32Fast(u, coef, &y);
+    filtLowPass32(u, coef, &yRef);
+    if (y != yRef && fastErr++ < 4) printf("  filtLowPass32Fast u:%i coef:%u y:%i -> %i, filtLowPass32 -> %i\n", u, coef, y0, y, yRef);
+    int32_t v[4] = {u, coef, y0, y};
+    snprintf(line, sizeof(line), "u:%i coef:%u y:%i -> %i", u, coef, y0, y);
+    record(r, v, 4, line);
+  }
+}
+
+static void testRateLimiter(Result *r) {
+  char line[96];
+  rngState = 0x2345678;
+  for (uint32_t k = 0; k < N_CASES; k++) {
+    int16_t u    = k < 81 ? edge16[k % 9] >> 4 : (int16_t)rndRange(-2048, 2047);
+    int16_t y    = k < 81 ? edge16[k / 9] : (int16_t)rnd();
+    int16_t rate = (k % 5 == 0) ? (int16_t)((k / 5) & 1 ? 32767 : 0) : (int16_t)rndRange(0, 32767);
+    int16_t y0   = y;
+    rateLimiter16(u, rate, &y);
+    int32_t v[4] = {u, rate, y0, y};
+    snprintf(line, sizeof(line), "u:%i rate:%i y:%i -> %i", u, rate, y0, y);
+    record(r, v, 4, line);
+  }
+}
+
+// Target steps, half of them held until the reference settles. The bounds must hold on every step (a lowered acc
+// only brings |a| down at the jerk limit), and a reference that starts at rest must reach the target without overshoot
+static uint32_t refGenErr;
+static void testRefGen(Result *r) {
+  char line[96];
+  RefGen g = {0};
+  uint32_t k = 0;
+  rngState = 0x6789ABC;
+  while (k < N_CASES) {
+    int16_t u      = (int16_t)rndRange(-16383, 16383);
+    int32_t acc    = rndRange(1 << 14, 1 << 22);
+    int32_t jerk   = rndRange(acc >> 8, acc) | 1;
+    int32_t hold   = (rnd() & 1) ? rndRange(1, 200) : 40000;
+    int32_t from   = g.y, dir = ((int32_t)u << 16) > from ? 1 : -1;
+    int     atRest = g.a == 0;
+    for (int32_t n = 0; n < hold && k < N_CASES; n++) {
+      int32_t y0 = g.y, a0 = g.a;
+      k++;
+      refGenStep(u, acc, jerk, &g);
+      int over = atRest && (int64_t)dir * ((int64_t)g.y - ((int32_t)u << 16)) > 0;
+      if ((ABS(g.a) > MAX(acc, ABS(a0)) || ABS(g.a - a0) > jerk || over) && refGenErr++ < 4) {
+        printf("  refGenStep u:%i acc:%i jerk:%i y:%i a:%i -> y:%i a:%i\n", u, acc, jerk, y0, a0, g.y, g.a);
+      }
+      int32_t v[5] = {u, acc, jerk, g.y, g.a};
+      snprintf(line, sizeof(line), "u:%i acc:%i jerk:%i y:%i a:%i -> y:%i a:%i", u, acc, jerk, y0, a0, g.y, g.a);
+      record(r, v, 5, line);
+      if (hold > 200 && g.a == 0 && g.y == (int32_t)u << 16) break;
+    }
+    if (hold > 200 && k < N_CASES && (g.a != 0 || g.y != (int32_t)u << 16) && refGenErr++ < 4) {
+      printf("  refGenStep u:%i acc:%i jerk:%i did not settle from y:%i\n", u, acc, jerk, from);
+    }
+  }
+}
+
+static void testMixer(Result *r) {
+  char line[96];
+  rngState = 0x3456789;
+  for (uint32_t k = 0; k < N_CASES; k++) {
+    INPUT_MAX = (k & 1) ? 1500 : 1000;  // Input_Lim_Init with and without field weakening
+    INPUT_MIN = -INPUT_MAX;
+    int16_t speed = k < 81 ? edge16[k % 9] : (int16_t)rnd();
+    int16_t steer = k < 81 ? edge16[k / 9] : (int16_t)rnd();
+    int16_t cmdR, cmdL;
+    mixerFcn(speed, steer, &cmdR, &cmdL);
+    int32_t v[5] = {INPUT_MAX, speed, steer, cmdR, cmdL};
+    snprintf(line, sizeof(line), "lim:%i speed:%i steer:%i -> R:%i L:%i", INPUT_MAX, speed, steer, cmdR, cmdL);
+    record(r, v, 5, line);
+  }
+}
+
+static void testMultipleTap(Result *r) {
+  char line[96];
+  MultipleTap x = {0};
+  uint32_t t = 0xFFFF0000U;             // the timer wraps during the test
+  int16_t  u = 0;
+  rngState = 0x456789A;
+  for (uint32_t k = 0; k < N_CASES; k++) {
+    uint32_t p = rnd();
+    if ((p & 0xF) == 0) u = (int16_t)rndRange(-100, 1000);      // steps across both thresholds
+    else u = (int16_t)(u + rndRange(-40, 40));
+    t += (p >> 8) % 64 == 0 ? MULTIPLE_TAP_TIMEOUT : DELAY_IN_MAIN_LOOP;
+    multipleTapDet(u, t, &x);
+    int32_t v[5] = {u, (int32_t)x.t_timePrev, x.z_pulseCntPrev, x.b_hysteresis, x.b_multipleTap};
+    snprintf(line, sizeof(line), "u:%i t:%u -> cnt:%u hyst:%u tap:%u", u, t, x.z_pulseCntPrev, x.b_hysteresis, x.b_multipleTap);
+    record(r, v, 5, line);
+  }
+}
+
+// Pedal steps with ADC noise, both ADC input pre-filters see the same samples
+static void testAdcFilt(Result *rBox, Result *rEma) {
+  char line[96];
+  BoxcarFilt box;
+  Ema2Filt   ema;
+  uint16_t   level = 2048;
+  boxcarInit(&box, level);
+  ema2Init(&ema, level);
+  rngState = 0x56789AB;
+  for (uint32_t k = 0; k < N_CASES; k++) {
+    if (k % 500 == 0) level = (k / 500) & 1 ? (uint16_t)rndRange(0, 4095) : ((k / 1000) & 1 ? 4095 : 0);
+    int32_t  n = (int32_t)level + rndRange(-20, 20);
+    uint16_t u = (uint16_t)CLAMP(n, 0, 4095);
+    int32_t  v[2] = {u, boxcarStep(&box, u)};
+    snprintf(line, sizeof(line), "u:%u -> %i", u, v[1]);
+    record(rBox, v, 2, line);
+    v[1] = ema2Step(&ema, u);
+    snprintf(line, sizeof(line), "u:%u -> %i", u, v[1]);
+    record(rEma, v, 2, line);
+  }
+}
+
+// Commands over the whole int16 range with the config.h curve, edge values at the points and segment ends first
+static const int16_t curvePts[INPUT_CURVE_N] = {INPUT_CURVE_1, INPUT_CURVE_2, INPUT_CURVE_3, INPUT_CURVE_4, INPUT_CURVE_5};
+static const int16_t edgeCurve[] = {0, 1, -1, 199, 200, -200, 201, 999, 1000, -1000, 1001, 1500, -1500, 32767, -32768};
+static void testInputCurve(Result *r) {
+  char line[96];
+  rngState = 0x6789ABC;
+  for (uint32_t k = 0; k < N_CASES; k++) {
+    int16_t u = k < 15 ? edgeCurve[k] : (k & 1) ? (int16_t)rndRange(-1500, 1500) : (int16_t)rnd();
+    int32_t v[2] = {u, inputCurveStep(u, curvePts)};
+    snprintf(line, sizeof(line), "u:%i -> %i", u, v[1]);
+    record(r, v, 2, line);
+  }
+}
+
+static double nsNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The inputs depend on the previous output, so the calls can not be hoisted out of the loop
+static void bench(void) {
+  volatile int32_t sink;
+  int32_t  y32 = 0;
+  int16_t  y16 = 0, a, b;
+  MultipleTap x = {0};
+  double   t0;
+
+  t0 = nsNow();
+  for (uint32_t k = 0; k < N_BENCH; k++) filtLowPass32((int32_t)(k & 0x7FF) - (y32 >> 20), 3277, &y32);
+  printf("bench filtLowPass32     %6.2f ns/call\n", (nsNow() - t0) / N_BENCH);
+  sink = y32;
+
+  y32 = 0;
+  t0  = nsNow();
+  for (uint32_t k = 0; k < N_BENCH; k++) filtLowPass32Fast((int32_t)(k & 0x7FF) - (y32 >> 20), 3277, &y32);
+  printf("bench filtLowPass32Fast %6.2f ns/call\n", (nsNow() - t0) / N_BENCH);
+  sink = y32;
+
+  t0 = nsNow();
+  for (uint32_t k = 0; k < N_BENCH; k++) rateLimiter16((int16_t)((k >> 6) & 0x3FF) - (y16 >> 8), 480, &y16);
+  printf("bench rateLimiter16     %6.2f ns/call\n", (nsNow() - t0) / N_BENCH);
+  sink = y16;
+
+  RefGen g = {0};
+  t0 = nsNow();
+  for (uint32_t k = 0; k < N_BENCH; k++) refGenStep((int16_t)((k >> 10) & 0x3FF) - (g.a >> 20), 80000, 2000, &g);
+  printf("bench refGenStep        %6.2f ns/call\n", (nsNow() - t0) / N_BENCH);
+  sink = g.y;
+
+  INPUT_MAX = 1000; INPUT_MIN = -1000;
+  a = b = 0;
+  t0 = nsNow();
+  for (uint32_t k = 0; k < N_BENCH; k++) mixerFcn((int16_t)(k << 4) ^ a, (int16_t)(k << 2) ^ b, &a, &b);
+  printf("bench mixerFcn          %6.2f ns/call\n", (nsNow() - t0) / N_BENCH);
+  sink = a + b;
+
+  t0 = nsNow();
+  for (uint32_t k = 0; k < N_BENCH; k++) multipleTapDet((int16_t)((k >> 5) & 0x3FF) ^ x.b_multipleTap, k * DELAY_IN_MAIN_LOOP, &x);
+  printf("bench multipleTapDet    %6.2f ns/call\n", (nsNow() - t0) / N_BENCH);
+  sink = x.b_multipleTap;
+
+  BoxcarFilt box;
+  Ema2Filt   ema;
+  boxcarInit(&box, 0);
+  ema2Init(&ema, 0);
+  a = 0;
+  t0 = nsNow();
+  for (uint32_t k = 0; k < N_BENCH; k++) a = (int16_t)boxcarStep(&box, (uint16_t)((k ^ a) & 0xFFF));
+  printf("bench boxcarStep        %6.2f ns/call\n", (nsNow() - t0) / N_BENCH);
+  t0 = nsNow();
+  for (uint32_t k = 0; k < N_BENCH; k++) a = (int16_t)ema2Step(&ema, (uint16_t)((k ^ a) & 0xFFF));
+  printf("bench ema2Step          %6.2f ns/call\n", (nsNow() - t0) / N_BENCH);
+  sink = a;
+
+  a = 0;
+  t0 = nsNow();
+  for (uint32_t k = 0; k < N_BENCH; k++) a = inputCurveStep((int16_t)(((k ^ a) & 0x7FF) - 1024), curvePts);
+  printf("bench inputCurveStep    %6.2f ns/call\n", (nsNow() - t0) / N_BENCH);
+  sink = a;
+  (void)sink;
+}
+
+int main(int argc, char **argv) {
+  int generate = argc > 2 && !strcmp(argv[1], "-g");
+  const char *file = argv[argc - 1];
+  static Result res[N_FUNCS] = {{"filtLowPass32", 2166136261U}, {"filtLowPass32Fast", 2166136261U}, {"rateLimiter16", 2166136261U},
+                                {"mixerFcn", 2166136261U}, {"multipleTapDet", 2166136261U}, {"boxcarStep", 2166136261U}, {"ema2Step", 2166136261U},
+                                {"refGenStep", 2166136261U}, {"inputCurveStep", 2166136261U}};
+  int fails = 0;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s [-g] golden_file\n", argv[0]);
+    return 1;
+  }
+  testLowPass(&res[0]);
+  testLowPassFast(&res[1]);
+  testRateLimiter(&res[2]);
+  testMixer(&res[3]);
+  testMultipleTap(&res[4]);
+  testAdcFilt(&res[5], &res[6]);
+  testRefGen(&res[7]);
+  testInputCurve(&res[8]);
+  if (fastErr) { printf("FAIL filtLowPass32Fast differs from filtLowPass32 in %u cases\n", fastErr); fails++; }
+  if (refGenErr) { printf("FAIL refGenStep out of bounds or overshoot in %u cases\n", refGenErr); fails++; }
+
+  if (generate) {
+    if (fails) return 1;
+    FILE *f = fopen(file, "w");
+    if (!f) { perror(file); return 1; }
+    fprintf(f, "# Golden vectors of Src/filters.c, written by make host-golden. Do not edit.\n");
+    fprintf(f, "# SPEED_COEFFICIENT:%i STEER_COEFFICIENT:%i MULTIPLE_TAP_NR:%i ADC_INPUT_FILT_SHIFT:%i\n", SPEED_COEFFICIENT, STEER_COEFFICIENT, MULTIPLE_TAP_NR, ADC_INPUT_FILT_SHIFT);
+    for (int k = 0; k < N_FUNCS; k++) {
+      fprintf(f, "%s %u %08x\n", res[k].name, res[k].n, res[k].hash);
+      for (int j = 0; j < N_LISTED; j++) if (res[k].listed[j][0]) fprintf(f, "  %s\n", res[k].listed[j]);
+    }
+    fclose(f);
+    printf("wrote %s\n", file);
+    return 0;
+  }
+
+  FILE *f = fopen(file, "r");
+  if (!f) { perror(file); return 1; }
+  char line[160], name[32];
+  unsigned n, hash;
+  int cur = -1, idx = 0, seen[N_FUNCS] = {0};
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#') continue;
+    if (line[0] == ' ') {               // listed case of the current function
+      if (cur >= 0 && idx < N_LISTED) {
+        line[strcspn(line, "\n")] = 0;
+        if (strcmp(line + 2, res[cur].listed[idx])) printf("  expected %s\n  got      %s\n", line + 2, res[cur].listed[idx]);
+        idx++;
+      }
+      continue;
+    }
+    if (sscanf(line, "%31s %u %x", name, &n, &hash) != 3) continue;
+    cur = -1; idx = 0;
+    for (int k = 0; k < N_FUNCS; k++) if (!strcmp(name, res[k].name)) cur = k;
+    if (cur < 0) { printf("FAIL %s: unknown function\n", name); fails++; continue; }
+    int ok = res[cur].n == n && res[cur].hash == hash;
+    seen[cur] = 1;
+    printf("%s %-17s %u cases\n", ok ? "PASS" : "FAIL", name, n);
+    fails += !ok;
+  }
+  fclose(f);
+  for (int k = 0; k < N_FUNCS; k++) {
+    if (!seen[k]) { printf("FAIL %-17s not in %s, run make host-golden\n", res[k].name, file); fails++; }
+  }
+
+  bench();
+  return fails ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+/*
+* Test and micro-benchmark of the debug formatter Src/print.c (make host-test)
+* The supported subset is compared with the C library snprintf over random values, through printFormat and
+* through debugPrintf (whose chunks are collected by the debugTxWrite below). The fixed-point precision has no
+* C equivalent and is checked against fixed strings.
+*
+* usage: test_print
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "defines.h"                    // pulls in Inc/config.h
+#include "util.h"
+#include "print.h"
+#undef printf                           // the reference output comes from the C library
+
+#define N_CASES         200000          // random cases per format
+#define N_BENCH         2000000         // calls per formatter for the benchmark
+
+static char     txBuf[1024];
+static int      txLen;
+
+int debugTxWrite(const uint8_t *data, int len) {
+  if (txLen + len < (int)sizeof(txBuf)) memcpy(&txBuf[txLen], data, len);
+  txLen += len;
+  return len;
+}
+
+static uint32_t rngState = 1;
+static uint32_t rnd(void) {             // xorshift32
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int fails;
+
+static void check(const char *what, const char *got, int gotLen, const char *ref, int refLen) {
+  if (gotLen == refLen && strcmp(got, ref) == 0) return;
+  if (fails++ < 10) printf("FAIL %s: \"%s\" (%i), expected \"%s\" (%i)\n", what, got, gotLen, ref, refLen);
+}
+
+// Same format and arguments through snprintf, printFormat and debugPrintf
+#define CHECK(fmt, ...) do { \
+    char ref[128], got[128]; \
+    int  refLen = snprintf(ref, sizeof(ref), fmt, __VA_ARGS__); \
+    int  gotLen = printFormat(got, sizeof(got), fmt, __VA_ARGS__); \
+    check("printFormat " fmt, got, gotLen, ref, refLen); \
+    txLen  = 0; \
+    gotLen = debugPrintf(fmt, __VA_ARGS__); \
+    txBuf[txLen < (int)sizeof(txBuf) ? txLen : 0] = '\0'; \
+    check("debugPrintf " fmt, txBuf, txLen == gotLen ? gotLen : -1, ref, refLen); \
+  } while (0)
+
+#define CHECK_FIX(ref, fmt, ...) do { \
+    char got[64]; \
+    int  gotLen = printFormat(got, sizeof(got), fmt, __VA_ARGS__); \
+    check("fixed-point " fmt, got, gotLen, ref, (int)strlen(ref)); \
+  } while (0)
+
+int main(void) {
+  static const char *names[] = { "", "x", "CMD_L", "BAT_CALIB", "a_name_longer_than_22_characters" };
+  for (int n = 0; n < N_CASES; n++) {
+    int32_t  v  = (int32_t)rnd() >> (rnd() % 32);       // all magnitudes
+    uint32_t u  = rnd() >> (rnd() % 32);
+    const char *s = names[rnd() % 5];
+    CHECK("%i", (int)v);
+    CHECK("%d|%5i|%-5i|%05i", (int)v, (int)v, (int)v, (int)v);
+    CHECK("%u %6u %06u", (unsigned)u, (unsigned)u, (unsigned)u);
+    CHECK("%li %6lu", (long)v, (unsigned long)u);
+    CHECK("%s:%li ", s, (long)v);
+    CHECK("%-22s %6s|%c%%", s, s, (char)('A' + u % 26));
+    CHECK("%s", "a line longer than one chunk of debugPrintf, which is flushed to the queue in several parts\r\n");
+  }
+  CHECK("%i %li", INT32_MIN, (long)INT32_MIN);
+  CHECK("%u", UINT32_MAX);
+
+  CHECK_FIX("12.34", "%.2i", 1234);
+  CHECK_FIX("-0.05", "%.2i", -5);
+  CHECK_FIX("0.000", "%.3i", 0);
+  CHECK_FIX("  -1.5", "%6.1i", -15);
+  CHECK_FIX("-001.5", "%06.1i", -15);
+  CHECK_FIX("429496729.5", "%.1u", UINT32_MAX);
+
+  char small[8];
+  int  len = printFormat(small, sizeof(small), "%s", "truncated");
+  check("truncation", small, len, "truncat", 9);
+
+  // Benchmark: one watch list entry, see printParamVal in comms.c
+  char buf[64];
+  volatile int sink = 0;
+  double t0 = now();
+  for (int n = 0; n < N_BENCH; n++) sink += snprintf(buf, sizeof(buf), "%s:%li ", names[n & 3], (long)(n - N_BENCH / 2));
+  double t1 = now();
+  for (int n = 0; n < N_BENCH; n++) sink += printFormat(buf, sizeof(buf), "%s:%li ", names[n & 3], (long)(n - N_BENCH / 2));
+  double t2 = now();
+  printf("watch entry: snprintf %6.1f ns, printFormat %6.1f ns\n", (t1 - t0) / N_BENCH * 1e9, (t2 - t1) / N_BENCH * 1e9);
+
+  if (fails) {
+    printf("%i failures\n", fails);
+    return 1;
+  }
+  printf("print: %i cases OK\n", 7 * N_CASES + 9);
+  return 0;
+}
@@ -0,0 +1,275 @@
+/*
+* Controller parameter search on the software-in-the-loop simulator (make host-tune)
+* Runs host/sil with candidate current / speed PI gains, current filter and field weakening thresholds and minimises
+* the cost of the scenario: the weighted sum of its "cost" statements (see sil.c), e.g. the energy loss over a drive
+* cycle, the torque ripple and the overshoot of speed steps. The candidates of a generation run in parallel, one sil
+* process each. The best parameters are written as "$SET NAME value" lines, for the debug protocol or make eeprom-image
+* (the gains are the CTRL_GAINS parameters of the firmware, the d and q axis get the same current loop gains).
+*
+* Search: (1 + lambda) evolution strategy in the normalised space of the variables (log for the gains), starting from
+* the generated gains and the config.h values. A generation samples lambda candidates around the best one with the
+* step size sigma, sigma grows after an improvement and shrinks otherwise. Seeded, so a run is reproducible.
+*
+* usage: tune [-e sil] [-j jobs] [-n generations] [-l lambda] [-s seed] [-x name]... [-p name=value]... [-o out.txt] scenario
+*   -e sil          simulator executable, default build/host/sil
+*   -j jobs         parallel sil processes, default the online cores
+*   -n generations  default 20, the search also stops when sigma is below 0.005
+*   -l lambda       candidates per generation, default 2 x jobs, at least 4
+*   -s seed         random seed, default 1
+*   -x name         keep a variable (see tuneVars) at its start value
+*   -p name=value   passed to every sil run, e.g. plant independent controller parameters
+*   -o file         parameter file, default stdout
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "config.h"
+#include "BLDC_controller.h"
+
+#define MAX_JOBS        64
+#define MAX_LAMBDA      256
+#define MAX_PASS        32
+#define OUT_MAX         16384           // [bytes] stderr of a sil run, MAX_MEASURE measure lines and the rest fit
+#define SIGMA_START     0.15
+#define SIGMA_MIN       0.005
+#define SIGMA_MAX       0.3
+#define CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
+
+extern P rtP_Left;                      // generated defaults of BLDC_controller_data.c, the start gains
+
+typedef struct {
+  const char *name;
+  const char *sil[2];                   // sil parameter names of the value
+  const char *param[2];                 // firmware parameter names of the value
+  double lo, hi;                        // search range in the parameter units
+  uint8_t log;                          // 1 = searched on a log scale
+  uint8_t fixed;                        // -x
+  double start;
+} TuneVar;
+
+static TuneVar tuneVars[] = {
+  {"i_kp",        {"id_kp", "iq_kp"},       {"ID_KP", "IQ_KP"},     100,  10000, 1, 0, 0},
+  {"i_ki",        {"id_ki", "iq_ki"},       {"ID_KI", "IQ_KI"},     50,   10000, 1, 0, 0},
+  {"n_kp",        {"n_kp", NULL},           {"N_KP", NULL},         300,  40000, 1, 0, 0},
+  {"n_ki",        {"n_ki", NULL},           {"N_KI", NULL},         10,   4000,  1, 0, 0},
+  {"curr_filt",   {"curr_filt", NULL},      {"CUR_FILT", NULL},     1000, 65535, 1, 0, 0},
+  {"fi_weak_max", {"fi_weak_max", NULL},    {"FI_WEAK_MAX", NULL},  0,    20,    0, 0, 0},   // [A]
+  {"fi_weak_hi",  {"fi_weak_hi", NULL},     {"FI_WEAK_HI", NULL},   1000, 1500,  0, 0, 0},   // input target
+  {"fi_weak_lo",  {"fi_weak_lo", NULL},     {"FI_WEAK_LO", NULL},   500,  1000,  0, 0, 0},
+};
+#define N_VARS  (sizeof(tuneVars) / sizeof(tuneVars[0]))
+
+typedef struct {
+  double  x[N_VARS];                    // [0, 1] normalised
+  double  cost;
+  char    terms[128];                   // the terms of the cost line
+} Candidate;
+
+static const char *silExe = "build/host/sil", *scenario;
+static const char *pass[MAX_PASS];
+static int      nPass;
+static uint64_t rng = 1;
+
+static double uniform(void) {           // xorshift64*
+  rng ^= rng >> 12; rng ^= rng << 25; rng ^= rng >> 27;
+  return (double)((rng * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static double gauss(void) {
+  return sqrt(-2 * log(1 - uniform())) * cos(2 * M_PI * uniform());
+}
+
+/* Value of variable k at the normalised x, rounded to the integer parameter */
+static long varValue(int k, double x) {
+  const TuneVar *v = &tuneVars[k];
+  x = CLAMP(x, 0.0, 1.0);
+  return lround(v->log ? v->lo * pow(v->hi / v->lo, x) : v->lo + (v->hi - v->lo) * x);
+}
+
+static double varNorm(int k, double value) {
+  const TuneVar *v = &tuneVars[k];
+  value = CLAMP(value, v->lo, v->hi);
+  return v->log ? log(value / v->lo) / log(v->hi / v->lo) : (value - v->lo) / (v->hi - v->lo);
+}
+
+typedef struct {
+  pid_t      pid;
+  int        fd;
+  Candidate *c;
+} Job;
+
+static void jobStart(Job *j, Candidate *c) {
+  char  *argv[4 + 2 * (MAX_PASS + 2 * N_VARS) + 2], val[2 * N_VARS][48];
+  int   fds[2], n = 0, k, m = 0;
+
+  argv[n++] = (char *)silExe;
+  argv[n++] = "-o";
+  argv[n++] = "/dev/null";
+  for (k = 0; k < nPass; k++) {
+    argv[n++] = "-p";
+    argv[n++] = (char *)pass[k];
+  }
+  for (k = 0; k < (int)N_VARS; k++) {
+    for (int a = 0; a < 2 && tuneVars[k].sil[a]; a++) {
+      snprintf(val[m], sizeof(val[m]), "%s=%ld", tuneVars[k].sil[a], varValue(k, c->x[k]));
+      argv[n++] = "-p";
+      argv[n++] = val[m++];
+    }
+  }
+  argv[n++] = (char *)scenario;
+  argv[n]   = NULL;
+  if (pipe(fds)) { perror("pipe"); exit(1); }
+  j->c   = c;
+  j->fd  = fds[0];
+  j->pid = fork();
+  if (j->pid < 0) { perror("fork"); exit(1); }
+  if (j->pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, 1);
+    dup2(fds[1], 2);
+    close(fds[0]);
+    execv(silExe, argv);
+    _exit(127);
+  }
+  close(fds[1]);
+}
+
+/* Reads the stderr of a finished run, the cost is HUGE_VAL without a cost line or on a failure */
+static void jobFinish(Job *j, int status) {
+  char   buf[OUT_MAX + 1], *line;
+  size_t len = 0;
+  ssize_t r;
+  while ((r = read(j->fd, buf + len, OUT_MAX - len)) > 0 && (len += r) < OUT_MAX) {}
+  buf[len] = 0;
+  close(j->fd);
+  j->c->cost     = HUGE_VAL;
+  j->c->terms[0] = 0;
+  line = strstr(buf, "cost: ");
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && line) {
+    sscanf(line, "cost: %lf %127[^\n]", &j->c->cost, j->c->terms);
+  }
+  j->pid = 0;
+}
+
+/* Runs the n candidates, at most jobs at a time. The output of a sil run is far below the pipe buffer, so a run never
+ * blocks on it and the pipe is read once the process is done */
+static void evaluate(Candidate *c, int n, int jobs) {
+  Job job[MAX_JOBS] = {{0}};
+  int next = 0, running = 0;
+  while (next < n || running > 0) {
+    while (next < n && running < jobs) {
+      for (int k = 0; k < jobs; k++) {
+        if (!job[k].pid) { jobStart(&job[k], &c[next++]); running++; break; }
+      }
+    }
+    int   status;
+    pid_t pid = wait(&status);
+    if (pid < 0) { perror("wait"); exit(1); }
+    for (int k = 0; k < jobs; k++) {
+      if (job[k].pid == pid) { jobFinish(&job[k], status); running--; break; }
+    }
+  }
+}
+
+static void printCandidate(FILE *f, const Candidate *c) {
+  for (int k = 0; k < (int)N_VARS; k++) {
+    for (int a = 0; a < 2 && tuneVars[k].param[a]; a++) {
+      fprintf(f, "$SET %-12s %ld\n", tuneVars[k].param[a], varValue(k, c->x[k]));
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *out = NULL;
+  int    jobs = (int)sysconf(_SC_NPROCESSORS_ONLN), gens = 20, lambda = 0;
+  static Candidate cand[MAX_LAMBDA];
+  Candidate best, start;
+
+  for (int k = 1; k < argc; k++) {
+    if (!strcmp(argv[k], "-e") && k + 1 < argc) {
+      silExe = argv[++k];
+    } else if (!strcmp(argv[k], "-j") && k + 1 < argc) {
+      jobs = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "-n") && k + 1 < argc) {
+      gens = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "-l") && k + 1 < argc) {
+      lambda = atoi(argv[++k]);
+    } else if (!strcmp(argv[k], "-s") && k + 1 < argc) {
+      rng = strtoull(argv[++k], NULL, 0) | 1;
+    } else if (!strcmp(argv[k], "-x") && k + 1 < argc) {
+      int j = 0;
+      k++;
+      while (j < (int)N_VARS && strcmp(argv[k], tuneVars[j].name)) j++;
+      if (j == (int)N_VARS) { fprintf(stderr, "unknown variable %s\n", argv[k]); return 1; }
+      tuneVars[j].fixed = 1;
+    } else if (!strcmp(argv[k], "-p") && k + 1 < argc) {
+      if (nPass < MAX_PASS) pass[nPass++] = argv[++k];
+    } else if (!strcmp(argv[k], "-o") && k + 1 < argc) {
+      out = argv[++k];
+    } else {
+      scenario = argv[k];
+    }
+  }
+  if (!scenario) {
+    fprintf(stderr, "usage: %s [-e sil] [-j jobs] [-n generations] [-l lambda] [-s seed] [-x name]... [-p name=value]... "
+                    "[-o out.txt] scenario\n", argv[0]);
+    return 1;
+  }
+  jobs   = CLAMP(jobs, 1, MAX_JOBS);
+  lambda = CLAMP(lambda > 0 ? lambda : 2 * jobs, 4, MAX_LAMBDA);
+
+  // Start: the generated gains, the config.h field weakening (host/config.h, as sil)
+  tuneVars[0].start = rtP_Left.cf_iqKp;
+  tuneVars[1].start = rtP_Left.cf_iqKi;
+  tuneVars[2].start = rtP_Left.cf_nKp;
+  tuneVars[3].start = rtP_Left.cf_nKi;
+  tuneVars[4].start = rtP_Left.cf_currFilt;
+  tuneVars[5].start = FIELD_WEAK_MAX;
+  tuneVars[6].start = FIELD_WEAK_HI;
+  tuneVars[7].start = FIELD_WEAK_LO;
+  for (int k = 0; k < (int)N_VARS; k++) {
+    start.x[k] = varNorm(k, tuneVars[k].start);
+  }
+  evaluate(&start, 1, 1);
+  if (start.cost == HUGE_VAL) {
+    fprintf(stderr, "%s %s: no cost, check the scenario has cost statements\n", silExe, scenario);
+    return 1;
+  }
+  best = start;
+  fprintf(stderr, "start: cost %.6f %s\n", best.cost, best.terms);
+
+  double sigma = SIGMA_START;
+  for (int g = 0; g < gens && sigma >= SIGMA_MIN; g++) {
+    for (int i = 0; i < lambda; i++) {
+      for (int k = 0; k < (int)N_VARS; k++) {
+        cand[i].x[k] = tuneVars[k].fixed ? best.x[k] : CLAMP(best.x[k] + sigma * gauss(), 0.0, 1.0);
+      }
+    }
+    evaluate(cand, lambda, jobs);
+    int b = 0;
+    for (int i = 1; i < lambda; i++) {
+      if (cand[i].cost < cand[b].cost) b = i;
+    }
+    if (cand[b].cost < best.cost) {
+      best  = cand[b];
+      sigma = fmin(sigma * 1.5, SIGMA_MAX);
+    } else {
+      sigma *= 0.6;
+    }
+    fprintf(stderr, "generation %i: cost %.6f %s, sigma %.4f\n", g + 1, best.cost, best.terms, sigma);
+  }
+
+  FILE *fo = out ? fopen(out, "w") : stdout;
+  if (!fo) { perror(out); return 1; }
+  fprintf(fo, "# make host-tune %s: cost %.6f -> %.6f\n# %s\n", scenario, start.cost, best.cost, best.terms);
+  fprintf(fo, "# Gains in the generated units at PWM_FREQ_BASE, the ID_KP ... CUR_FILT parameters need CTRL_GAINS\n");
+  printCandidate(fo, &best);
+  if (out) fclose(fo);
+  return 0;
+}
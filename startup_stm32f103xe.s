@@ -96,6 +96,21 @@ LoopCopyDataInit:
   adds r2, r0, r1
   cmp r2, r3
   bcc CopyDataInit
+
+/* Copy the functions executed from RAM (.ramfunc) from flash to SRAM */
+  ldr r0, =_sramfunc
+  ldr r1, =_eramfunc
+  ldr r2, =_siramfunc
+  b LoopCopyRamfunc
+
+CopyRamfunc:
+  ldr r3, [r2], #4
+  str r3, [r0], #4
+
+LoopCopyRamfunc:
+  cmp r0, r1
+  bcc CopyRamfunc
+
   ldr r2, =_sbss
   b LoopFillZerobss
 /* Zero fill the bss segment. */